@@ -778,6 +778,7 @@ TPM_RESULT TPM_Process_SetOwnerInstall(tpm_state_t *tpm_state,
 		TPM_SetCapability_Flag(&writeAllNV,				/* altered */
 				       &(tpm_state->tpm_permanent_flags.ownership),	/* flag */
 				       state);						/* value */
+		TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
 		/* Store the permanent flags back to NVRAM */
 		returnCode = TPM_PermanentAll_NVStore(tpm_state,
 						      writeAllNV,
@@ -955,6 +956,7 @@ TPM_RESULT TPM_Process_OwnerSetDisable(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.disable),	/* flag */
 			       disableState);					/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
 	/* Store the permanent flags back to NVRAM */
 	returnCode = TPM_PermanentAll_NVStore(tpm_state,
 					      writeAllNV,
@@ -1013,7 +1015,7 @@ TPM_RESULT TPM_Process_OwnerSetDisable(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     return rcf;
 }
@@ -1102,6 +1104,7 @@ TPM_RESULT TPM_Process_PhysicalEnable(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.disable),	/* flag */
 			       FALSE);						/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
 	/* Store the permanent flags back to NVRAM */
 	returnCode = TPM_PermanentAll_NVStore(tpm_state,
 					      writeAllNV,
@@ -1234,6 +1237,7 @@ TPM_RESULT TPM_Process_PhysicalDisable(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.disable ),	/* flag */
 			       TRUE);						/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
 	/* Store the permanent flags back to NVRAM */
 	returnCode = TPM_PermanentAll_NVStore(tpm_state,
 					      writeAllNV,
@@ -1378,6 +1382,7 @@ TPM_RESULT TPM_Process_PhysicalSetDeactivated(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.deactivated),	/* flag */
 			       state);						/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
 	/* Store the permanent flags back to NVRAM */
 	returnCode = TPM_PermanentAll_NVStore(tpm_state,
 					      writeAllNV,
@@ -1634,7 +1639,7 @@ TPM_RESULT TPM_Process_SetTempDeactivated(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -1740,6 +1745,7 @@ TPM_RESULT TPM_Process_SetOperatorAuth(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.tpmOperator),	/* flag */
 			       TRUE);						/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA | TPM_PERMANENT_DIRTY_FLAGS);
 	/* Store the permanent data and flags back to NVRAM */
 	returnCode = TPM_PermanentAll_NVStore(tpm_state,
 					      TRUE,
@@ -1997,7 +2003,7 @@ TPM_RESULT TPM_Process_ResetLockValue(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     return rcf;
 }
@@ -1046,7 +1046,7 @@ TPM_RESULT TPM_Process_GetAuditDigestSigned(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -1202,6 +1202,7 @@ TPM_RESULT TPM_Process_SetOrdinalAuditStatus(tpm_state_t *tpm_state,
 						  ordinalToAudit);
 	/* It's not really uninitialized, but beam doesn't understand that TPM_GetInParamDigest()
 	   can't turn a FALSE into a TRUE */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
     }
     /* Store the permanent data back to NVRAM */
     if (returnCode == TPM_SUCCESS) {
@@ -1265,7 +1266,7 @@ TPM_RESULT TPM_Process_SetOrdinalAuditStatus(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     return rcf;
 }
@@ -53,6 +53,7 @@
 #include "tpm_permanent.h"
 #include "tpm_process.h"
 #include "tpm_secret.h"
+#include "tpm_session.h"
 #include "tpm_storage.h"
 #include "tpm_time.h"
 #include "tpm_transport.h"
@@ -199,6 +200,7 @@ TPM_RESULT TPM_AuthParams_Set(TPM_STORE_BUFFER *response,
 {
     TPM_RESULT		rc = 0;
     TPM_AUTHDATA	resAuth;	/* The authorization digest for the returned parameters */
+    TPM_HMAC_SCHEDULE	*hmacSchedule;	/* cached HMAC key schedule, may be NULL */
 
     printf(" TPM_AuthParams_Set:\n");
     /* generate new nonceEven */
@@ -215,8 +217,10 @@ TPM_RESULT TPM_AuthParams_Set(TPM_STORE_BUFFER *response,
     }
     /* Calculate resAuth using the hmac key */
     if (rc == 0) {
+	TPM_AuthSessionData_GetHmacSchedule(&hmacSchedule, auth_session_data, hmacKey);
 	rc = TPM_Authdata_Generate(resAuth,			/* result */
 				   hmacKey,			/* HMAC key */
+				   hmacSchedule,		/* HMAC key schedule */
 				   outParamDigest,		/* params */
 				   auth_session_data->nonceEven,
 				   nonceOdd,
@@ -231,6 +235,7 @@ TPM_RESULT TPM_AuthParams_Set(TPM_STORE_BUFFER *response,
 
 TPM_RESULT TPM_Authdata_Generate(TPM_AUTHDATA resAuth,		/* result */
 				 TPM_SECRET usageAuth,		/* HMAC key */
+				 TPM_HMAC_SCHEDULE *hmacSchedule, /* HMAC key schedule, may be NULL */
 				 TPM_DIGEST outParamDigest, /* digest of outputs above double
 							       line */
 				 TPM_NONCE nonceEven,
@@ -246,13 +251,14 @@ TPM_RESULT TPM_Authdata_Generate(TPM_AUTHDATA resAuth,		/* result */
 	TPM_PrintFour("  TPM_Authdata_Generate: nonceEven", nonceEven);
 	TPM_PrintFour("  TPM_Authdata_Generate: nonceOdd", nonceOdd);
 	printf       ("  TPM_Authdata_Generate: continueSession %02x\n", continueSession);
-	rc = TPM_HMAC_Generate(resAuth,
-			       usageAuth,				/* key */
-			       TPM_DIGEST_SIZE, outParamDigest,		/* response digest */
-			       TPM_NONCE_SIZE, nonceEven,		/* 2H */
-			       TPM_NONCE_SIZE, nonceOdd,		/* 3H */
-			       sizeof(TPM_BOOL), &continueSession,	/* 4H */
-			       0, NULL);
+	rc = TPM_HMAC_GenerateSchedule(resAuth,
+				       hmacSchedule,				/* cached key schedule */
+				       usageAuth,				/* key */
+				       TPM_DIGEST_SIZE, outParamDigest,		/* response digest */
+				       TPM_NONCE_SIZE, nonceEven,		/* 2H */
+				       TPM_NONCE_SIZE, nonceOdd,		/* 3H */
+				       sizeof(TPM_BOOL), &continueSession,	/* 4H */
+				       0, NULL);
 	TPM_PrintFour("  TPM_Authdata_Generate: resAuth", resAuth);
     }
     return rc;
@@ -276,6 +282,7 @@ TPM_RESULT TPM_Authdata_Check(tpm_state_t	*tpm_state,
 {
     TPM_RESULT		rc = 0;
     TPM_BOOL		valid;
+    TPM_HMAC_SCHEDULE	*hmacSchedule;	/* cached HMAC key schedule, may be NULL */
     
     printf(" TPM_Authdata_Check:\n");
     if (rc == 0) {
@@ -286,14 +293,16 @@ TPM_RESULT TPM_Authdata_Check(tpm_state_t	*tpm_state,
 	printf       ("  TPM_Authdata_Check: continueSession %02x\n", continueSession);
 	/* HMAC the inParamDigest, authLastNonceEven, nonceOdd, continue */
 	/* authLastNonceEven is retrieved from internal authorization session storage */
-	rc = TPM_HMAC_Check(&valid,
-			    usageAuth,					/* expected, from command */
-			    hmacKey,					/* key */
-			    sizeof(TPM_DIGEST), inParamDigest,		/* command digest */
-			    sizeof(TPM_NONCE), tpm_auth_session_data->nonceEven,	/* 2H */
-			    sizeof(TPM_NONCE), nonceOdd,				/* 3H */
-			    sizeof(TPM_BOOL), &continueSession,				/* 4H */
-			    0, NULL);
+	TPM_AuthSessionData_GetHmacSchedule(&hmacSchedule, tpm_auth_session_data, hmacKey);
+	rc = TPM_HMAC_CheckSchedule(&valid,
+				    usageAuth,				/* expected, from command */
+				    hmacSchedule,			/* cached key schedule */
+				    hmacKey,				/* key */
+				    sizeof(TPM_DIGEST), inParamDigest,		/* command digest */
+				    sizeof(TPM_NONCE), tpm_auth_session_data->nonceEven,	/* 2H */
+				    sizeof(TPM_NONCE), nonceOdd,			/* 3H */
+				    sizeof(TPM_BOOL), &continueSession,			/* 4H */
+				    0, NULL);
     }
     if (rc == 0) {
 	if (!valid) {
@@ -1221,10 +1230,10 @@ TPM_RESULT TPM_Process_ChangeAuth(tpm_state_t *tpm_state,
     /* 15. The TPM MUST enforce the destruction of both the parentAuthHandle and entityAuthHandle
        sessions. */
     if (parentAuthHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, parentAuthHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), parentAuthHandle);
     }
     if (entityAuthHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, entityAuthHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), entityAuthHandle);
     }
     /*
       cleanup
@@ -1422,13 +1431,14 @@ TPM_RESULT TPM_Process_ChangeAuthOwner(tpm_state_t *tpm_state,
 	continueAuthSession = FALSE;
 	/* 7. Set the authorization data for the indicated entity to decryptAuth */
 	TPM_Secret_Copy(*entityAuth, decryptAuth);
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	/* save a copy of the HMAC key for the response before invalidating */
 	TPM_Secret_Copy(saveKey, *hmacKey);
 	/* 8. The TPM MUST invalidate all owner authorized OSAP and DSAP sessions, active or
 	   saved. */
 	TPM_AuthSessions_TerminateEntity(&continueAuthSession,
 					 ownerAuthHandle,
-					 tpm_state->tpm_stclear_data.authSessions,
+					 &(tpm_state->tpm_stclear_data.authSessions),
 					 TPM_ET_OWNER,			/* TPM_ENTITY_TYPE */
 					 NULL);				/* ignore entityDigest */
 	/* 9. The TPM MAY invalidate all sessions, active or saved */
@@ -1490,7 +1500,7 @@ TPM_RESULT TPM_Process_ChangeAuthOwner(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	ownerAuthHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, ownerAuthHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), ownerAuthHandle);
     }
     /*
       cleanup
@@ -1750,7 +1760,7 @@ TPM_RESULT TPM_Process_ChangeAuthAsymStart(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	ephHandle = 0;	/* no preferred value */
 	returnCode = TPM_KeyHandleEntries_AddKeyEntry(&ephHandle,			/* output */
-						      tpm_state->tpm_key_handle_entries, /* input */
+						      &(tpm_state->tpm_key_handle_entries), /* input */
 						      tempKey,				/* input */
 						      0,	/* parentPCRStatus not used */
 						      0);	/* keyControl not used */
@@ -1854,7 +1864,7 @@ TPM_RESULT TPM_Process_ChangeAuthAsymStart(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -1870,7 +1880,7 @@ TPM_RESULT TPM_Process_ChangeAuthAsymStart(tpm_state_t *tpm_state,
 	if (key_added) {
 	    /* if there was a failure and tempKey was stored in the handle list, free the handle.
 	       Ignore errors, since only one error code can be returned. */
-	    TPM_KeyHandleEntries_DeleteHandle(tpm_state->tpm_key_handle_entries, ephHandle);
+	    TPM_KeyHandleEntries_DeleteHandle(&(tpm_state->tpm_key_handle_entries), ephHandle);
 	}	
     }
     return rcf;
@@ -2215,7 +2225,7 @@ TPM_RESULT TPM_Process_ChangeAuthAsymFinish(tpm_state_t *tpm_state,
 	TPM_Key_Delete(ephKey);		/* free the key resources */
 	free(ephKey);			/* free the key itself */
 	/* remove entry from the key handle entries list */
-	returnCode = TPM_KeyHandleEntries_DeleteHandle(tpm_state->tpm_key_handle_entries,
+	returnCode = TPM_KeyHandleEntries_DeleteHandle(&(tpm_state->tpm_key_handle_entries),
 						       ephHandle);
     }
     /*
@@ -2281,7 +2291,7 @@ TPM_RESULT TPM_Process_ChangeAuthAsymFinish(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
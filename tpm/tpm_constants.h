@@ -194,6 +194,9 @@
 
 /* TPM_CAP_MFR capabilities */
 #define TPM_CAP_PROCESS_ID              0x00000020
+#define TPM_CAP_NV_METRICS              0x00000021
+#define TPM_CAP_AUTH_METRICS            0x00000022
+#define TPM_CAP_CONTEXT_METRICS         0x00000023
 
 
 /* define a value for an illegal instance handle */
@@ -288,12 +291,43 @@
 
 #define TPM_TAG_NVSTATE_V1		0x0001		/* svn revision 4078 */
 
+/* V2 state is a manifest holding the digest of each separately stored section.  The sections are
+   permanent data, permanent flags, owner evict keys, NV defined space, in the V1 order. */
+
+#define TPM_TAG_NVSTATE_V2		0x0002
+
+/* V3 state is a manifest holding the copy number and digest of each section.  Each section has
+   two NV copies, so that an update never overwrites the copy that the manifest records. */
+
+#define TPM_TAG_NVSTATE_V3		0x0003
+
+#define TPM_PERMANENT_SECTION_DATA	0
+#define TPM_PERMANENT_SECTION_FLAGS	1
+#define TPM_PERMANENT_SECTION_OE	2
+#define TPM_PERMANENT_SECTION_NV	3
+#define TPM_PERMANENT_SECTIONS		4
+
+#define TPM_PERMANENT_COPY_NONE		0xff	/* V2 section, stored under its base name */
+
+/* section bit masks for TPM_PermanentAll_SetDirty() */
+
+#define TPM_PERMANENT_DIRTY_DATA	(1 << TPM_PERMANENT_SECTION_DATA)
+#define TPM_PERMANENT_DIRTY_FLAGS	(1 << TPM_PERMANENT_SECTION_FLAGS)
+#define TPM_PERMANENT_DIRTY_OE		(1 << TPM_PERMANENT_SECTION_OE)
+#define TPM_PERMANENT_DIRTY_NV		(1 << TPM_PERMANENT_SECTION_NV)
+#define TPM_PERMANENT_DIRTY_ALL		((1 << TPM_PERMANENT_SECTIONS) - 1)
+
 /* These tags describe the TPM_PERMANENT_DATA format */
 
 /* For the first release, use the standard TPM_TAG_PERMANENT_DATA tag.  Since this tag is never
    visible outside the TPM, the tag value can be changed if the format changes.
 */
 
+/* PD_V2 prepended the number of rows to the family and delegate tables, see
+   TPM_FamilyTable_SetRows() */
+
+#define TPM_TAG_NVSTATE_PD_V2		0x0002
+
 /* These tags describe the TPM_PERMANENT_FLAGS format */
 
 /* The TPM_PERMANENT_FLAGS structure changed from rev 94 to 103.  Unfortunately, the standard TPM
@@ -307,6 +341,10 @@
 
 #define TPM_TAG_NVSTATE_OE_V1		0x0001
 
+/* V2 replaced each key with its digest and NV file copy, see TPM_OWNER_EVICT_KEY_NAME */
+
+#define TPM_TAG_NVSTATE_OE_V2		0x0002
+
 /* This tag describes the NV defined space format */
 
 #define TPM_TAG_NVSTATE_NV_V1		0x0001
@@ -315,6 +353,10 @@
 
 #define TPM_TAG_NVSTATE_NV_V2		0x0002
 
+/* V3 replaced each data area with its digest and NV file copy, see TPM_NV_DATA_NAME */
+
+#define TPM_TAG_NVSTATE_NV_V3		0x0003
+
 /*
   These tags are used to describe the format of serialized TPM volatile state
 */
@@ -327,6 +369,20 @@
 
 #define TPM_TAG_VSTATE_V1		0x0001
 
+/* V2 state is a manifest holding a checkpoint sequence number and, for each separately stored
+   section, the section copy number and digest.  The sections hold the V1 members, grouped so that
+   a typical ordinal changes few of them. */
+
+#define TPM_TAG_VSTATE_V2		0x0002
+
+#define TPM_VOLATILE_SECTION_FLAGS	0	/* parameters, flags, transport handle, testState */
+#define TPM_VOLATILE_SECTION_STCLEAR	1
+#define TPM_VOLATILE_SECTION_STANY	2
+#define TPM_VOLATILE_SECTION_KEYS	3
+#define TPM_VOLATILE_SECTION_SHA1	4
+#define TPM_VOLATILE_SECTION_NV		5
+#define TPM_VOLATILE_SECTIONS		6
+
 /* This tag defines the TPM Parameters format */
 
 #define TPM_TAG_TPM_PARAMETERS_V1	0x0001
@@ -349,6 +405,10 @@
 
 #define TPM_TAG_STCLEAR_DATA_V2         0X0024
 
+/* V3 stores the contextList as a count followed by the outstanding context counts */
+
+#define TPM_TAG_STCLEAR_DATA_V3         0X0025
+
 /* These tags describe the TPM_STANY_DATA format */
 
 /* For the first release, use the standard TPM_TAG_STANY_DATA tag.  Since this tag is never visible
@@ -657,6 +657,7 @@ TPM_RESULT TPM_Process_CreateCounter(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	writeAllNV = TRUE;
 	/* 5. Increment the max counter value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	TPM_Counters_GetNextCount(&nextCount,
 				  tpm_state->tpm_permanent_data.monotonicCounter);
 	/* 6. Set the counter to the max counter value */
@@ -732,7 +733,7 @@ TPM_RESULT TPM_Process_CreateCounter(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -915,6 +916,7 @@ TPM_RESULT TPM_Process_IncrementCounter(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	/* 3. Increments the counter by 1 */
 	counterValue->counter++;	/* in TPM_PERMANENT_DATA */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	/* save the permanent data structure in NVRAM */
 	returnCode = TPM_PermanentAll_NVStore(tpm_state,
 					      TRUE,
@@ -975,7 +977,7 @@ TPM_RESULT TPM_Process_IncrementCounter(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -1255,7 +1257,7 @@ TPM_RESULT TPM_Process_ReleaseCounter(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	TPM_AuthSessions_TerminateEntity(&continueAuthSession,
 					 authHandle,
-					 tpm_state->tpm_stclear_data.authSessions,
+					 &(tpm_state->tpm_stclear_data.authSessions),
 					 TPM_ET_COUNTER,		/* TPM_ENTITY_TYPE */
 					 &(counterValue->digest));	/* entityDigest */
     }
@@ -1267,6 +1269,7 @@ TPM_RESULT TPM_Process_ReleaseCounter(tpm_state_t *tpm_state,
     }
     if (returnCode == TPM_SUCCESS) {
 	writeAllNV= TRUE;
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	/* 4. If TPM_STCLEAR_DATA -> countID equals countID,  */
 	if (tpm_state->tpm_stclear_data.countID == countID ) {
 	    printf("TPM_Process_ReleaseCounter: Deactivating counter %u\n", countID);
@@ -1331,7 +1334,7 @@ TPM_RESULT TPM_Process_ReleaseCounter(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -1476,7 +1479,7 @@ TPM_RESULT TPM_Process_ReleaseCounterOwner(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	TPM_AuthSessions_TerminateEntity(&continueAuthSession,
 					 authHandle,
-					 tpm_state->tpm_stclear_data.authSessions,
+					 &(tpm_state->tpm_stclear_data.authSessions),
 					 TPM_ET_COUNTER,		/* TPM_ENTITY_TYPE */
 					 &(counterValue->digest));	/* entityDigest */
     }
@@ -1493,6 +1496,7 @@ TPM_RESULT TPM_Process_ReleaseCounterOwner(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	writeAllNV = TRUE;
 	/* 5. If TPM_STCLEAR_DATA -> countID equals countID,  */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	if (tpm_state->tpm_stclear_data.countID == countID ) {
 	    printf("TPM_Process_ReleaseCounterOwner: Deactivating counter %u\n", countID);
 	    /* a. Set TPM_STCLEAR_DATA -> countID to an illegal value (not the zero value) */
@@ -1556,7 +1560,7 @@ TPM_RESULT TPM_Process_ReleaseCounterOwner(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -131,6 +131,7 @@ static TPM_RESULT TPM_SymmetricKeyData_Crypt(unsigned char *data_out,
 /* local prototype and structure for AES */
 
 #include <openssl/aes.h>
+#include <openssl/modes.h>
 
 /* AES requires data lengths that are a multiple of the block size */
 #define TPM_AES_BITS 128
@@ -267,14 +268,35 @@ TPM_RESULT TPM_Crypto_TestSpecific()
   Random Number Functions
 */
 
-/* TPM_Random() fills 'buffer' with 'bytes' bytes.
- */
+/* Random numbers are drawn from the openSSL RNG in blocks of TPM_RANDOM_POOL_SIZE bytes.  Nonces
+   and other small requests are then served from the pool without an openSSL RNG call (and its
+   lock) per request.  Requests larger than the pool go directly to the openSSL RNG.
 
-TPM_RESULT TPM_Random(BYTE *buffer, size_t bytes)
+   Bytes are handed out once.  They are zeroed when consumed, and the remainder of the pool is
+   discarded when the RNG is stirred.
+*/
+
+#ifndef TPM_RANDOM_POOL_SIZE
+#define TPM_RANDOM_POOL_SIZE 1024
+#endif
+
+static unsigned char tpm_random_pool[TPM_RANDOM_POOL_SIZE];
+static size_t tpm_random_pool_next = TPM_RANDOM_POOL_SIZE;	/* next unused byte, empty pool */
+
+/* TPM_Random_PoolDiscard() zeros the unused part of the random number pool and marks it empty */
+
+static void TPM_Random_PoolDiscard(void)
 {
-    TPM_RESULT rc = 0;
+    memset(tpm_random_pool, 0, sizeof(tpm_random_pool));
+    tpm_random_pool_next = sizeof(tpm_random_pool);
+    return;
+}
 
-    printf(" TPM_Random: Requesting %lu bytes\n", (unsigned long)bytes);
+/* TPM_Random_Bytes() fills 'buffer' with 'bytes' bytes directly from the openSSL RNG */
+
+static TPM_RESULT TPM_Random_Bytes(BYTE *buffer, size_t bytes)
+{
+    TPM_RESULT rc = 0;
 
     if (rc == 0) {
             /* openSSL call */
@@ -290,6 +312,44 @@ TPM_RESULT TPM_Random(BYTE *buffer, size_t bytes)
     return rc;
 }
 
+/* TPM_Random() fills 'buffer' with 'bytes' bytes.
+ */
+
+TPM_RESULT TPM_Random(BYTE *buffer, size_t bytes)
+{
+    TPM_RESULT rc = 0;
+    size_t available;
+
+    printf(" TPM_Random: Requesting %lu bytes\n", (unsigned long)bytes);
+    /* large requests bypass the pool */
+    if (bytes > sizeof(tpm_random_pool)) {
+	rc = TPM_Random_Bytes(buffer, bytes);
+    }
+    else {
+	/* use what remains in the pool */
+	available = sizeof(tpm_random_pool) - tpm_random_pool_next;
+	if (available > bytes) {
+	    available = bytes;
+	}
+	memcpy(buffer, tpm_random_pool + tpm_random_pool_next, available);
+	memset(tpm_random_pool + tpm_random_pool_next, 0, available);
+	tpm_random_pool_next += available;
+	/* refill the pool for the rest */
+	if (available < bytes) {
+	    rc = TPM_Random_Bytes(tpm_random_pool, sizeof(tpm_random_pool));
+	    if (rc == 0) {
+		memcpy(buffer + available, tpm_random_pool, bytes - available);
+		memset(tpm_random_pool, 0, bytes - available);
+		tpm_random_pool_next = bytes - available;
+	    }
+	    else {
+		TPM_Random_PoolDiscard();
+	    }
+	}
+    }
+    return rc;
+}
+
 TPM_RESULT TPM_StirRandomCmd(TPM_SIZED_BUFFER *inData)
 {
     TPM_RESULT rc = 0;
@@ -302,6 +362,8 @@ TPM_RESULT TPM_StirRandomCmd(TPM_SIZED_BUFFER *inData)
 		 inData->size,		/* number of bytes */
 		 inData->size);	/* entropy, the lower bound of an estimate of how much randomness is
 				   contained in buf */
+	/* bytes already in the pool predate the stir, draw new ones */
+	TPM_Random_PoolDiscard();
     }
     return rc;
 }
@@ -1789,6 +1851,33 @@ TPM_RESULT TPM_SHA1FinalCmd(unsigned char *md, void *context)
     return rc;
 }
 
+/* TPM_SHA1CopyCmd() copies the state of 'srcContext' to 'destContext'.  If 'destContext' is NULL,
+   it is allocated.  Otherwise the existing context is overwritten.
+
+   This permits a digested prefix to be reused for several messages.
+
+   The structure must be freed using TPM_SHA1Delete()
+*/
+
+TPM_RESULT TPM_SHA1CopyCmd(void **destContext, void *srcContext)
+{
+    TPM_RESULT  rc = 0;
+
+    printf(" TPM_SHA1CopyCmd:\n");
+    if (srcContext == NULL) {
+        printf("TPM_SHA1CopyCmd: Error, no existing SHA1 thread\n");
+        rc = TPM_SHA_THREAD;
+    }
+    /* reuse an existing destination context */
+    if ((rc== 0) && (*destContext == NULL)) {
+        rc = TPM_Malloc((unsigned char **)destContext, sizeof(SHA_CTX));
+    }
+    if (rc== 0) {
+        memcpy(*destContext, srcContext, sizeof(SHA_CTX));
+    }
+    return rc;
+}
+
 /* TPM_SHA1Delete() zeros and frees the SHA1 context */
 
 void TPM_SHA1Delete(void **context)
@@ -2651,6 +2740,50 @@ TPM_RESULT TPM_SymmetricKeyData_Decrypt(unsigned char **decrypt_data,   /* outpu
     return rc;
 }
 
+/* TPM_SymmetricKeyData_SetStreamKey() sets '*tpm_symmetric_key_token' to the symmetric key
+   'symmetric_key', truncating as required.
+
+   If '*tpm_symmetric_key_token' is NULL, the token is allocated.  It must be freed by the caller
+   using TPM_SymmetricKeyData_Free().
+
+   If the token already holds the same key, the expanded AES key is reused.  This lets a caller
+   that encrypts repeatedly with the same key, such as a transport session, keep the token as a
+   cache.
+*/
+
+TPM_RESULT TPM_SymmetricKeyData_SetStreamKey(TPM_SYMMETRIC_KEY_TOKEN *tpm_symmetric_key_token,
+					     const unsigned char *symmetric_key,
+					     uint32_t symmetric_key_size)
+{
+    TPM_RESULT  rc = 0;
+    TPM_SYMMETRIC_KEY_DATA *tpm_symmetric_key_data;
+
+    printf(" TPM_SymmetricKeyData_SetStreamKey:\n");
+    /* allocate memory for the key token.  The token is opaque in the API, but at this low level,
+       the code understands the TPM_SYMMETRIC_KEY_DATA structure */
+    if ((rc == 0) && (*tpm_symmetric_key_token == NULL)) {
+	rc = TPM_SymmetricKeyData_New(tpm_symmetric_key_token);
+    }
+    if (rc == 0) {
+	tpm_symmetric_key_data = (TPM_SYMMETRIC_KEY_DATA *)*tpm_symmetric_key_token;
+	/* the expanded key is already current */
+	if (tpm_symmetric_key_data->valid &&
+	    (symmetric_key_size >= sizeof(tpm_symmetric_key_data->userKey)) &&
+	    (memcmp(tpm_symmetric_key_data->userKey, symmetric_key,
+		    sizeof(tpm_symmetric_key_data->userKey)) == 0)) {
+	    printf("  TPM_SymmetricKeyData_SetStreamKey: Reusing expanded key\n");
+	}
+	/* convert the raw key to the AES key, truncating as required */
+	else {
+	    tpm_symmetric_key_data->valid = FALSE;
+	    rc = TPM_SymmetricKeyData_SetKey(tpm_symmetric_key_data,
+					     symmetric_key,
+					     symmetric_key_size);
+	}
+    }
+    return rc;
+}
+
 /* TPM_SymmetricKeyData_CtrCrypt() does an encrypt or decrypt (they are the same XOR operation with
    a CTR mode pad) of 'data_in' to 'data_out'.
 
@@ -2669,25 +2802,49 @@ TPM_RESULT TPM_SymmetricKeyData_CtrCrypt(unsigned char *data_out,
                                          uint32_t ctr_in_size)			/* input */
 {
     TPM_RESULT  rc = 0;
-    TPM_SYMMETRIC_KEY_DATA *tpm_symmetric_key_data = NULL;	/* freed @1 */
-    unsigned char ctr[TPM_AES_BLOCK_SIZE];
+    TPM_SYMMETRIC_KEY_TOKEN tpm_symmetric_key_token = NULL;	/* freed @1 */
 
     printf(" TPM_SymmetricKeyData_CtrCrypt: data_size %u\n", data_size);
-    /* allocate memory for the key token.  The token is opaque in the API, but at this low level,
-       the code understands the TPM_SYMMETRIC_KEY_DATA structure */
+    /* convert the raw key to the AES key, truncating as required */
     if (rc == 0) {
-	rc = TPM_SymmetricKeyData_New((TPM_SYMMETRIC_KEY_TOKEN *)&tpm_symmetric_key_data);
+        rc = TPM_SymmetricKeyData_SetStreamKey(&tpm_symmetric_key_token,
+					       symmetric_key,
+					       symmetric_key_size);
     }
-    /* convert the raw key to the AES key, truncating as required */
     if (rc == 0) {
-        rc = TPM_SymmetricKeyData_SetKey(tpm_symmetric_key_data,
-                                         symmetric_key,
-                                         symmetric_key_size);
+	rc = TPM_SymmetricKeyData_CtrCryptToken(data_out,
+						data_in,
+						data_size,
+						tpm_symmetric_key_token,
+						ctr_in,
+						ctr_in_size);
     }
+    TPM_SymmetricKeyData_Free(&tpm_symmetric_key_token);	/* @1 */
+    return rc;
+}
+
+/* TPM_SymmetricKeyData_CtrCryptToken() is TPM_SymmetricKeyData_CtrCrypt() using a key token
+   already set by TPM_SymmetricKeyData_SetStreamKey().
+*/
+
+TPM_RESULT TPM_SymmetricKeyData_CtrCryptToken(unsigned char *data_out,		/* output */
+					      const unsigned char *data_in,	/* input */
+					      uint32_t data_size,		/* input */
+					      const TPM_SYMMETRIC_KEY_TOKEN
+					      tpm_symmetric_key_token,		/* input */
+					      const unsigned char *ctr_in,	/* input */
+					      uint32_t ctr_in_size)		/* input */
+{
+    TPM_RESULT  rc = 0;
+    TPM_SYMMETRIC_KEY_DATA *tpm_symmetric_key_data =
+	(TPM_SYMMETRIC_KEY_DATA *)tpm_symmetric_key_token;
+    unsigned char ctr[TPM_AES_BLOCK_SIZE];
+
+    printf(" TPM_SymmetricKeyData_CtrCryptToken: data_size %u\n", data_size);
     /* check the input CTR size, it can be truncated, but cannot be smaller than the AES key */
     if (rc == 0) {
         if (ctr_in_size < sizeof(ctr)) {
-            printf("  TPM_SymmetricKeyData_CtrCrypt: Error (fatal)"
+            printf("  TPM_SymmetricKeyData_CtrCryptToken: Error (fatal)"
                    ", CTR size %u too small for AES key\n", ctr_in_size);
             rc = TPM_FAIL;              /* should never occur */
         }
@@ -2695,22 +2852,24 @@ TPM_RESULT TPM_SymmetricKeyData_CtrCrypt(unsigned char *data_out,
     if (rc == 0) {
         /* make a truncated copy of CTR, since AES_ctr128_encrypt alters the value */
         memcpy(ctr, ctr_in, sizeof(ctr));
-        printf("  TPM_SymmetricKeyData_CtrCrypt: Calling AES in CTR mode\n");
-        TPM_PrintFour("  TPM_SymmetricKeyData_CtrCrypt: CTR", ctr);
+        printf("  TPM_SymmetricKeyData_CtrCryptToken: Calling AES in CTR mode\n");
+        TPM_PrintFour("  TPM_SymmetricKeyData_CtrCryptToken: CTR", ctr);
         rc = TPM_AES_ctr128_encrypt(data_out,
 				    data_in,
 				    data_size,
 				    &(tpm_symmetric_key_data->aes_enc_key),
 				    ctr);
     }
-    TPM_SymmetricKeyData_Free((TPM_SYMMETRIC_KEY_TOKEN *)&tpm_symmetric_key_data);	/* @1 */
     return rc;
 }
 
 /* TPM_AES_ctr128_encrypt() is a TPM variant of the openSSL AES_ctr128_encrypt() function that
    increments only the low 4 bytes of the counter.
 
-   openSSL increments the entire CTR array.  The TPM does not follow that convention.
+   openSSL increments the entire CTR array.  The TPM does not follow that convention.  The data is
+   therefore split where the low 4 bytes wrap.  Each segment is passed to the openSSL CTR mode, which
+   does not carry out of the low 4 bytes within the segment.  The counter for the next segment is
+   reset to the original high 12 bytes with low 4 bytes of zero.
 */
 
 static TPM_RESULT TPM_AES_ctr128_encrypt(unsigned char *data_out,
@@ -2721,33 +2880,38 @@ static TPM_RESULT TPM_AES_ctr128_encrypt(unsigned char *data_out,
 {
     TPM_RESULT  rc = 0;
     uint32_t cint;
-    unsigned char pad_buffer[TPM_AES_BLOCK_SIZE];       /* the XOR pad */
-
-    printf("  TPM_AES_Ctr128_encrypt:\n");
+    uint64_t wrap_size;		/* bytes until the low 4 bytes of CTR wrap */
+    uint32_t segment_size;
+    unsigned char high_ctr[TPM_AES_BLOCK_SIZE];		/* CTR after a wrap */
+    unsigned char ecount_buf[TPM_AES_BLOCK_SIZE];	/* the XOR pad */
+    unsigned int num;
+
+    printf("  TPM_AES_Ctr128_encrypt: data_size %lu\n", (unsigned long)data_size);
+    /* CTR is a big endian array, so the low 4 bytes are 12-15 */
+    memcpy(high_ctr, ctr, TPM_AES_BLOCK_SIZE);
+    STORE32(high_ctr, 12, 0);
     while (data_size != 0) {
-        printf("   TPM_AES_Ctr128_encrypt: data_size %lu\n", (unsigned long)data_size);
-        /* get an XOR pad array by encrypting the CTR with the AES key */
-        AES_encrypt(ctr, pad_buffer, aes_enc_key);
-        /* partial or full last data block */
-        if (data_size <= TPM_AES_BLOCK_SIZE) {
-            TPM_XOR(data_out, data_in, pad_buffer, data_size);
-            data_size = 0;
-        }
-        /* full block, not the last block */
-        else {
-            TPM_XOR(data_out, data_in, pad_buffer, TPM_AES_BLOCK_SIZE);
-            data_in += TPM_AES_BLOCK_SIZE;
-            data_out += TPM_AES_BLOCK_SIZE;
-            data_size -= TPM_AES_BLOCK_SIZE;
-        }
-        /* if not the last block, increment CTR, only the low 4 bytes */
-        if (data_size != 0) {
-            /* CTR is a big endian array, so the low 4 bytes are 12-15 */
-            cint = LOAD32(ctr, 12);     /* byte array to uint32_t */
-            cint++;                     /* increment */
-            STORE32(ctr, 12, cint);     /* uint32_t to byte array */
-        }
+	cint = LOAD32(ctr, 12);     /* byte array to uint32_t */
+	wrap_size = ((uint64_t)0x100000000ULL - cint) * TPM_AES_BLOCK_SIZE;
+	if (data_size <= wrap_size) {
+	    segment_size = data_size;
+	}
+	else {
+	    segment_size = (uint32_t)wrap_size;
+	}
+	num = 0;
+	CRYPTO_ctr128_encrypt(data_in, data_out, segment_size,
+			      aes_enc_key, ctr, ecount_buf, &num,
+			      (block128_f)AES_encrypt);
+	data_in += segment_size;
+	data_out += segment_size;
+	data_size -= segment_size;
+	/* the low 4 bytes wrapped, do not carry into the high bytes */
+	if (data_size != 0) {
+	    memcpy(ctr, high_ctr, TPM_AES_BLOCK_SIZE);
+	}
     }
+    memset(ecount_buf, 0, sizeof(ecount_buf));
     return rc;
 }
 
@@ -2760,16 +2924,6 @@ static TPM_RESULT TPM_AES_ctr128_encrypt(unsigned char *data_out,
    'ivec_in' is the initial IV value before possible truncation
 */
 
-/* openSSL prototype
-
-   void AES_ofb128_encrypt(const unsigned char *in,
-                           unsigned char *out,
-                           const unsigned long length,
-                           const AES_KEY *key,
-                           unsigned char *ivec,
-                           int *num);
-*/
-
 TPM_RESULT TPM_SymmetricKeyData_OfbCrypt(unsigned char *data_out,       /* output */
                                          const unsigned char *data_in,  /* input */
                                          uint32_t data_size,		/* input */
@@ -2779,26 +2933,60 @@ TPM_RESULT TPM_SymmetricKeyData_OfbCrypt(unsigned char *data_out,       /* outpu
                                          uint32_t ivec_in_size)		/* input */
 {
     TPM_RESULT  rc = 0;
-    TPM_SYMMETRIC_KEY_DATA *tpm_symmetric_key_data = NULL;	/* freed @1 */
-    unsigned char ivec[TPM_AES_BLOCK_SIZE];
-    int num;
+    TPM_SYMMETRIC_KEY_TOKEN tpm_symmetric_key_token = NULL;	/* freed @1 */
 
     printf(" TPM_SymmetricKeyData_OfbCrypt: data_size %u\n", data_size);
-    /* allocate memory for the key token.  The token is opaque in the API, but at this low level,
-       the code understands the TPM_SYMMETRIC_KEY_DATA structure */
+    /* convert the raw key to the AES key, truncating as required */
     if (rc == 0) {
-	rc = TPM_SymmetricKeyData_New((TPM_SYMMETRIC_KEY_TOKEN *)&tpm_symmetric_key_data);
+        rc = TPM_SymmetricKeyData_SetStreamKey(&tpm_symmetric_key_token,
+					       symmetric_key,
+					       symmetric_key_size);
     }
-    /* convert the raw key to the AES key, truncating as required */
     if (rc == 0) {
-        rc = TPM_SymmetricKeyData_SetKey(tpm_symmetric_key_data,
-                                         symmetric_key,
-                                         symmetric_key_size);
+	rc = TPM_SymmetricKeyData_OfbCryptToken(data_out,
+						data_in,
+						data_size,
+						tpm_symmetric_key_token,
+						ivec_in,
+						ivec_in_size);
     }
+    TPM_SymmetricKeyData_Free(&tpm_symmetric_key_token);	/* @1 */
+    return rc;
+}
+
+/* TPM_SymmetricKeyData_OfbCryptToken() is TPM_SymmetricKeyData_OfbCrypt() using a key token
+   already set by TPM_SymmetricKeyData_SetStreamKey().
+*/
+
+/* openSSL prototype
+
+   void AES_ofb128_encrypt(const unsigned char *in,
+                           unsigned char *out,
+                           const unsigned long length,
+                           const AES_KEY *key,
+                           unsigned char *ivec,
+                           int *num);
+*/
+
+TPM_RESULT TPM_SymmetricKeyData_OfbCryptToken(unsigned char *data_out,		/* output */
+					      const unsigned char *data_in,	/* input */
+					      uint32_t data_size,		/* input */
+					      const TPM_SYMMETRIC_KEY_TOKEN
+					      tpm_symmetric_key_token,		/* input */
+					      unsigned char *ivec_in,		/* input */
+					      uint32_t ivec_in_size)		/* input */
+{
+    TPM_RESULT  rc = 0;
+    TPM_SYMMETRIC_KEY_DATA *tpm_symmetric_key_data =
+	(TPM_SYMMETRIC_KEY_DATA *)tpm_symmetric_key_token;
+    unsigned char ivec[TPM_AES_BLOCK_SIZE];
+    int num;
+
+    printf(" TPM_SymmetricKeyData_OfbCryptToken: data_size %u\n", data_size);
     /* check the input OFB size, it can be truncated, but cannot be smaller than the AES key */
     if (rc == 0) {
         if (ivec_in_size < sizeof(ivec)) {
-            printf("  TPM_SymmetricKeyData_OfbCrypt: Error (fatal),"
+            printf("  TPM_SymmetricKeyData_OfbCryptToken: Error (fatal),"
                    "IV size %u too small for AES key\n", ivec_in_size);
             rc = TPM_FAIL;              /* should never occur */
         }
@@ -2807,8 +2995,8 @@ TPM_RESULT TPM_SymmetricKeyData_OfbCrypt(unsigned char *data_out,       /* outpu
         /* make a truncated copy of IV, since AES_ofb128_encrypt alters the value */
         memcpy(ivec, ivec_in, sizeof(ivec));
         num = 0;
-        printf("  TPM_SymmetricKeyData_OfbCrypt: Calling AES in OFB mode\n");
-        TPM_PrintFour("  TPM_SymmetricKeyData_OfbCrypt: IV", ivec);
+        printf("  TPM_SymmetricKeyData_OfbCryptToken: Calling AES in OFB mode\n");
+        TPM_PrintFour("  TPM_SymmetricKeyData_OfbCryptToken: IV", ivec);
         AES_ofb128_encrypt(data_in,
                            data_out,
                            data_size,
@@ -2816,7 +3004,6 @@ TPM_RESULT TPM_SymmetricKeyData_OfbCrypt(unsigned char *data_out,       /* outpu
                            ivec,
                            &num);
     }
-    TPM_SymmetricKeyData_Free((TPM_SYMMETRIC_KEY_TOKEN *)&tpm_symmetric_key_data);
     return rc;
 }
 
@@ -169,6 +169,7 @@ TPM_RESULT TPM_RSAVerifySHA1(unsigned char *signature,
 TPM_RESULT TPM_SHA1InitCmd(void **context);
 TPM_RESULT TPM_SHA1UpdateCmd(void *context, const unsigned char *data, uint32_t length);
 TPM_RESULT TPM_SHA1FinalCmd(unsigned char *md, void *context);
+TPM_RESULT TPM_SHA1CopyCmd(void **destContext, void *srcContext);
 void       TPM_SHA1Delete(void **context);
 
 /* SHA-1 Context */
@@ -216,4 +217,19 @@ TPM_RESULT TPM_SymmetricKeyData_OfbCrypt(unsigned char *data_out,
                                          uint32_t symmetric_key_size,
                                          unsigned char *ivec_in,
                                          uint32_t ivec_in_size);
+TPM_RESULT TPM_SymmetricKeyData_SetStreamKey(TPM_SYMMETRIC_KEY_TOKEN *tpm_symmetric_key_token,
+                                             const unsigned char *symmetric_key,
+                                             uint32_t symmetric_key_size);
+TPM_RESULT TPM_SymmetricKeyData_CtrCryptToken(unsigned char *data_out,
+                                              const unsigned char *data_in,
+                                              uint32_t data_size,
+                                              const TPM_SYMMETRIC_KEY_TOKEN tpm_symmetric_key_token,
+                                              const unsigned char *ctr_in,
+                                              uint32_t ctr_in_size);
+TPM_RESULT TPM_SymmetricKeyData_OfbCryptToken(unsigned char *data_out,
+                                              const unsigned char *data_in,
+                                              uint32_t data_size,
+                                              const TPM_SYMMETRIC_KEY_TOKEN tpm_symmetric_key_token,
+                                              unsigned char *ivec_in,
+                                              uint32_t ivec_in_size);
 #endif
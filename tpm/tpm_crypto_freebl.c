@@ -1829,6 +1829,40 @@ TPM_RESULT TPM_SHA1FinalCmd(unsigned char *md, void *context)
     return rc;
 }
 
+/* TPM_SHA1CopyCmd() copies the state of 'srcContext' to 'destContext'.  If 'destContext' is NULL,
+   it is allocated.  Otherwise the existing context is overwritten.
+
+   This permits a digested prefix to be reused for several messages.
+
+   The structure must be freed using TPM_SHA1Delete()
+*/
+
+TPM_RESULT TPM_SHA1CopyCmd(void **destContext, void *srcContext)
+{
+    TPM_RESULT  rc = 0;
+
+    printf(" TPM_SHA1CopyCmd:\n");
+    if (rc == 0) {
+	if (srcContext == NULL) {
+	    printf("TPM_SHA1CopyCmd: Error, no existing SHA1 thread\n");
+	    rc = TPM_SHA_THREAD;
+	}
+    }
+    /* reuse an existing destination context */
+    if ((rc == 0) && (*destContext == NULL)) {
+	/* create a new freebl SHA1 context */
+	*destContext = SHA1_NewContext();
+	if (*destContext == NULL) {
+	    printf("TPM_SHA1CopyCmd:  Error allocating a new context\n");
+            rc = TPM_SIZE;
+	}
+    }
+    if (rc == 0) {
+	SHA1_Clone(*destContext, srcContext);
+    }
+    return rc;
+}
+
 /* TPM_SHA1Delete() zeros and frees the SHA1 context */
 
 void TPM_SHA1Delete(void **context)
@@ -2649,4 +2683,89 @@ TPM_RESULT TPM_SymmetricKeyData_OfbCrypt(unsigned char *data_out,       	/* outp
     return rc;
 }
 
+/* TPM_SymmetricKeyData_SetStreamKey() sets '*tpm_symmetric_key_token' to the symmetric key
+   'symmetric_key', truncating as required.
+
+   If '*tpm_symmetric_key_token' is NULL, the token is allocated.  It must be freed by the caller
+   using TPM_SymmetricKeyData_Free().
+
+   FreeBL keeps only the raw key in the token.  The AES context is created for each operation.
+*/
+
+TPM_RESULT TPM_SymmetricKeyData_SetStreamKey(TPM_SYMMETRIC_KEY_TOKEN *tpm_symmetric_key_token,
+					     const unsigned char *symmetric_key,
+					     uint32_t symmetric_key_size)
+{
+    TPM_RESULT  rc = 0;
+    TPM_SYMMETRIC_KEY_DATA *tpm_symmetric_key_data;
+
+    printf(" TPM_SymmetricKeyData_SetStreamKey:\n");
+    if ((rc == 0) && (*tpm_symmetric_key_token == NULL)) {
+	rc = TPM_SymmetricKeyData_New(tpm_symmetric_key_token);
+    }
+    /* check the input data size, it can be truncated, but cannot be smaller than the AES key */
+    if (rc == 0) {
+	tpm_symmetric_key_data = (TPM_SYMMETRIC_KEY_DATA *)*tpm_symmetric_key_token;
+        if (sizeof(tpm_symmetric_key_data->userKey) > symmetric_key_size) {
+            printf("TPM_SymmetricKeyData_SetStreamKey: Error (fatal), need %lu bytes, received %u\n",
+                   (unsigned long)sizeof(tpm_symmetric_key_data->userKey), symmetric_key_size);
+            rc = TPM_FAIL;              /* should never occur */
+        }
+    }
+    if (rc == 0) {
+        memcpy(tpm_symmetric_key_data->userKey, symmetric_key,
+	       sizeof(tpm_symmetric_key_data->userKey));
+        tpm_symmetric_key_data->valid = TRUE;
+    }
+    return rc;
+}
+
+/* TPM_SymmetricKeyData_CtrCryptToken() is TPM_SymmetricKeyData_CtrCrypt() using a key token
+   already set by TPM_SymmetricKeyData_SetStreamKey().
+*/
+
+TPM_RESULT TPM_SymmetricKeyData_CtrCryptToken(unsigned char *data_out,		/* output */
+					      const unsigned char *data_in,	/* input */
+					      uint32_t data_size,		/* input */
+					      const TPM_SYMMETRIC_KEY_TOKEN
+					      tpm_symmetric_key_token,		/* input */
+					      const unsigned char *ctr_in,	/* input */
+					      uint32_t ctr_in_size)		/* input */
+{
+    TPM_SYMMETRIC_KEY_DATA *tpm_symmetric_key_data =
+	(TPM_SYMMETRIC_KEY_DATA *)tpm_symmetric_key_token;
+
+    return TPM_SymmetricKeyData_CtrCrypt(data_out,
+					 data_in,
+					 data_size,
+					 tpm_symmetric_key_data->userKey,
+					 sizeof(tpm_symmetric_key_data->userKey),
+					 ctr_in,
+					 ctr_in_size);
+}
+
+/* TPM_SymmetricKeyData_OfbCryptToken() is TPM_SymmetricKeyData_OfbCrypt() using a key token
+   already set by TPM_SymmetricKeyData_SetStreamKey().
+*/
+
+TPM_RESULT TPM_SymmetricKeyData_OfbCryptToken(unsigned char *data_out,		/* output */
+					      const unsigned char *data_in,	/* input */
+					      uint32_t data_size,		/* input */
+					      const TPM_SYMMETRIC_KEY_TOKEN
+					      tpm_symmetric_key_token,		/* input */
+					      unsigned char *ivec_in,		/* input */
+					      uint32_t ivec_in_size)		/* input */
+{
+    TPM_SYMMETRIC_KEY_DATA *tpm_symmetric_key_data =
+	(TPM_SYMMETRIC_KEY_DATA *)tpm_symmetric_key_token;
+
+    return TPM_SymmetricKeyData_OfbCrypt(data_out,
+					 data_in,
+					 data_size,
+					 tpm_symmetric_key_data->userKey,
+					 sizeof(tpm_symmetric_key_data->userKey),
+					 ivec_in,
+					 ivec_in_size);
+}
+
 #endif  /* TPM_AES */
@@ -55,6 +55,7 @@
 #include "tpm_key.h"
 #include "tpm_pcr.h"
 #include "tpm_process.h"
+#include "tpm_secret.h"
 #include "tpm_store.h"
 #include "tpm_ver.h"
 
@@ -67,7 +68,11 @@ static TPM_RESULT TPM_SHA1_valist(TPM_DIGEST md,
 				  va_list ap);
 static TPM_RESULT TPM_HMAC_Generatevalist(TPM_HMAC hmac,
 					  const TPM_SECRET key,
+					  TPM_HMAC_SCHEDULE *tpm_hmac_schedule,
 					  va_list ap);
+static void       TPM_HMAC_PadKey(unsigned char *ipad,
+				  unsigned char *opad,
+				  const TPM_SECRET key);
 
 static TPM_RESULT TPM_SHA1CompleteCommon(TPM_DIGEST hashValue,
 					 void **sha1_context,
@@ -755,6 +760,10 @@ TPM_RESULT TPM_SymmetricKeyData_EncryptSbuffer(TPM_SIZED_BUFFER *encrypt_data,
 
    AES 128 with CTR or OFB modes are supported.	 For CTR mode, pad is the initial count.  For OFB
    mode, pad is the IV.
+
+   If 'symmetric_key_cache' is not NULL, it holds the platform dependent key token across calls.  If
+   it already holds 'symmetric_key', the key schedule is not recalculated.  The caller frees it with
+   TPM_SymmetricKeyData_Free().  If NULL, a temporary token is used.
 */
 
 TPM_RESULT TPM_SymmetricKeyData_StreamCrypt(unsigned char *data_out,		/* output */
@@ -764,32 +773,46 @@ TPM_RESULT TPM_SymmetricKeyData_StreamCrypt(unsigned char *data_out,		/* output
 					    TPM_ENC_SCHEME encScheme,		/* mode */
 					    const unsigned char *symmetric_key, /* input */
 					    uint32_t symmetric_key_size,	/* input */
+					    TPM_SYMMETRIC_KEY_TOKEN *symmetric_key_cache, /* in/out */
 					    unsigned char *pad_in,		/* input */
 					    uint32_t pad_in_size)		/* input */
 {
     TPM_RESULT		rc = 0;
+    TPM_SYMMETRIC_KEY_TOKEN tpm_symmetric_key_token = NULL;	/* freed @1 */
+    TPM_SYMMETRIC_KEY_TOKEN *key_token;
 
     printf(" TPM_SymmetricKeyData_StreamCrypt:\n");
+    if (symmetric_key_cache != NULL) {
+	key_token = symmetric_key_cache;
+    }
+    else {
+	key_token = &tpm_symmetric_key_token;
+    }
     switch (algId) {
       case TPM_ALG_AES128:
+	/* expand the key, or reuse the cached expanded key */
+	rc = TPM_SymmetricKeyData_SetStreamKey(key_token,
+					       symmetric_key,
+					       symmetric_key_size);
+	if (rc != 0) {
+	    break;
+	}
 	switch (encScheme) {
 	  case TPM_ES_SYM_CTR:
-	    rc = TPM_SymmetricKeyData_CtrCrypt(data_out,
-					       data_in,
-					       data_size,
-					       symmetric_key,
-					       symmetric_key_size,
-					       pad_in,
-					       pad_in_size);
+	    rc = TPM_SymmetricKeyData_CtrCryptToken(data_out,
+						    data_in,
+						    data_size,
+						    *key_token,
+						    pad_in,
+						    pad_in_size);
 	    break;
 	  case TPM_ES_SYM_OFB:
-	    rc = TPM_SymmetricKeyData_OfbCrypt(data_out,
-					       data_in,
-					       data_size,
-					       symmetric_key,
-					       symmetric_key_size,
-					       pad_in,
-					       pad_in_size);
+	    rc = TPM_SymmetricKeyData_OfbCryptToken(data_out,
+						    data_in,
+						    data_size,
+						    *key_token,
+						    pad_in,
+						    pad_in_size);
 	    break;
 	  default:
 	    printf("TPM_SymmetricKeyData_StreamCrypt: Error, bad AES128 encScheme %04x\n",
@@ -803,6 +826,7 @@ TPM_RESULT TPM_SymmetricKeyData_StreamCrypt(unsigned char *data_out,		/* output
 	rc = TPM_INAPPROPRIATE_ENC;
 	break;
     }
+    TPM_SymmetricKeyData_Free(&tpm_symmetric_key_token);	/* @1 */
     return rc;
 }
 
@@ -1066,7 +1090,29 @@ TPM_RESULT TPM_HMAC_Generate(TPM_HMAC tpm_hmac,
     
     printf(" TPM_HMAC_Generate:\n");
     va_start(ap, hmac_key);
-    rc = TPM_HMAC_Generatevalist(tpm_hmac, hmac_key, ap);
+    rc = TPM_HMAC_Generatevalist(tpm_hmac, hmac_key, NULL, ap);
+    va_end(ap);
+    return rc;
+}
+
+/* TPM_HMAC_GenerateSchedule() is TPM_HMAC_Generate() using the cached key schedule
+   'tpm_hmac_schedule'.
+
+   If the schedule was not calculated from 'hmac_key', it is recalculated first.  If
+   'tpm_hmac_schedule' is NULL, the HMAC is calculated without a schedule.
+*/
+
+TPM_RESULT TPM_HMAC_GenerateSchedule(TPM_HMAC tpm_hmac,
+				     TPM_HMAC_SCHEDULE *tpm_hmac_schedule,
+				     const TPM_SECRET hmac_key,
+				     ...)
+{
+    TPM_RESULT		rc = 0;
+    va_list		ap;
+    
+    printf(" TPM_HMAC_GenerateSchedule:\n");
+    va_start(ap, hmac_key);
+    rc = TPM_HMAC_Generatevalist(tpm_hmac, hmac_key, tpm_hmac_schedule, ap);
     va_end(ap);
     return rc;
 }
@@ -1075,41 +1121,79 @@ TPM_RESULT TPM_HMAC_Generate(TPM_HMAC tpm_hmac,
 
    It is called from TPM_HMAC_Generate() and TPM_HMAC_Check() with the va_list for the text already
    formed.
+
+   If 'tpm_hmac_schedule' is not NULL, the inner and outer hashes start from its cached contexts
+   rather than digesting the padded key.
 */
 
 #define TPM_HMAC_BLOCK_SIZE 64
 
 static TPM_RESULT TPM_HMAC_Generatevalist(TPM_HMAC tpm_hmac,
 					  const TPM_SECRET key,
+					  TPM_HMAC_SCHEDULE *tpm_hmac_schedule,
 					  va_list ap)
 {
     TPM_RESULT		rc = 0;
     unsigned char	ipad[TPM_HMAC_BLOCK_SIZE];
     unsigned char	opad[TPM_HMAC_BLOCK_SIZE];
-    size_t		i;
     TPM_DIGEST		inner_hash;
+    uint32_t		length;
+    unsigned char	*buffer;
+    void		*context = NULL;	/* platform dependent context */
+    TPM_BOOL		done = FALSE;
 
     printf(" TPM_HMAC_Generatevalist:\n");
-    /* calculate key XOR ipad and key XOR opad */
-    if (rc == 0) {
-	/* first part, key XOR pad */
-	for (i = 0 ; i < TPM_AUTHDATA_SIZE ; i++) {
-	    ipad[i] = key[i] ^ 0x36;	/* magic numbers from RFC 2104 */
-	    opad[i] = key[i] ^ 0x5c;
+    /* no cached schedule, calculate key XOR ipad and key XOR opad */
+    if (tpm_hmac_schedule == NULL) {
+	if (rc == 0) {
+	    TPM_HMAC_PadKey(ipad, opad, key);
+	    /* calculate the inner hash, hash the key XOR ipad and the text */
+	    rc = TPM_SHA1_valist(inner_hash,
+				 TPM_HMAC_BLOCK_SIZE, ipad, ap);
+	}
+	/* hash the key XOR opad and the previous hash */
+	if (rc == 0) {
+	    rc = TPM_SHA1(tpm_hmac,
+			  TPM_HMAC_BLOCK_SIZE, opad,
+			  TPM_DIGEST_SIZE, inner_hash,
+			  0, NULL);
 	}
-	/* second part, 0x00 XOR pad */
-	memset(ipad + TPM_AUTHDATA_SIZE, 0x36, TPM_HMAC_BLOCK_SIZE - TPM_AUTHDATA_SIZE);
-	memset(opad + TPM_AUTHDATA_SIZE, 0x5c, TPM_HMAC_BLOCK_SIZE - TPM_AUTHDATA_SIZE);
-	/* calculate the inner hash, hash the key XOR ipad and the text */
-	rc = TPM_SHA1_valist(inner_hash,
-			     TPM_HMAC_BLOCK_SIZE, ipad, ap);
     }
-    /* hash the key XOR opad and the previous hash */
-    if (rc == 0) {
-	rc = TPM_SHA1(tpm_hmac,
-		      TPM_HMAC_BLOCK_SIZE, opad,
-		      TPM_DIGEST_SIZE, inner_hash,
-		      0, NULL);
+    /* cached schedule, start from the digested key XOR ipad and key XOR opad */
+    else {
+	/* recalculate the schedule if it is not for this key */
+	if (rc == 0) {
+	    rc = TPM_HmacSchedule_Set(tpm_hmac_schedule, key);
+	}
+	/* calculate the inner hash, continue from key XOR ipad and hash the text */
+	if (rc == 0) {
+	    rc = TPM_SHA1CopyCmd(&context, tpm_hmac_schedule->innerContext);	/* freed @1 */
+	}
+	while ((rc == 0) && !done) {
+	    length = va_arg(ap, uint32_t);		/* first vararg is the length */
+	    if (length != 0) {			/* loop until a zero length argument terminates */
+		buffer = va_arg(ap, unsigned char *);	/* second vararg is the array */
+		rc = TPM_SHA1UpdateCmd(context, buffer, length);	/* hash the buffer */
+	    }
+	    else {
+		done = TRUE;
+	    }
+	}
+	if (rc == 0) {
+	    rc = TPM_SHA1FinalCmd(inner_hash, context);
+	}
+	TPM_SHA1Delete(&context);		/* @1 */
+	/* continue from key XOR opad and hash the previous hash */
+	if (rc == 0) {
+	    rc = TPM_SHA1CopyCmd(&context, tpm_hmac_schedule->outerContext);	/* freed @2 */
+	}
+	if (rc == 0) {
+	    rc = TPM_SHA1UpdateCmd(context, inner_hash, TPM_DIGEST_SIZE);
+	}
+	if (rc == 0) {
+	    rc = TPM_SHA1FinalCmd(tpm_hmac, context);
+	}
+	TPM_SHA1Delete(&context);		/* @2 */
     }
     if (rc == 0) {
 	TPM_PrintFour(" TPM_HMAC_Generatevalist: HMAC", tpm_hmac);
@@ -1117,6 +1201,26 @@ static TPM_RESULT TPM_HMAC_Generatevalist(TPM_HMAC tpm_hmac,
     return rc;
 }
 
+/* TPM_HMAC_PadKey() calculates the RFC 2104 key XOR ipad and key XOR opad blocks
+ */
+
+static void TPM_HMAC_PadKey(unsigned char *ipad,
+			    unsigned char *opad,
+			    const TPM_SECRET key)
+{
+    size_t		i;
+
+    /* first part, key XOR pad */
+    for (i = 0 ; i < TPM_AUTHDATA_SIZE ; i++) {
+	ipad[i] = key[i] ^ 0x36;	/* magic numbers from RFC 2104 */
+	opad[i] = key[i] ^ 0x5c;
+    }
+    /* second part, 0x00 XOR pad */
+    memset(ipad + TPM_AUTHDATA_SIZE, 0x36, TPM_HMAC_BLOCK_SIZE - TPM_AUTHDATA_SIZE);
+    memset(opad + TPM_AUTHDATA_SIZE, 0x5c, TPM_HMAC_BLOCK_SIZE - TPM_AUTHDATA_SIZE);
+    return;
+}
+
 /* TPM_HMAC_CheckSbuffer() checks the HMAC of a TPM_STORE_BUFFER.
 
    This is commonly used when checking an HMAC on a serialized structure.  Structures are serialized
@@ -1169,7 +1273,7 @@ TPM_RESULT TPM_HMAC_Check(TPM_BOOL *valid,
     printf(" TPM_HMAC_Check:\n");
     va_start(ap, key);
     if (rc == 0) {
-	rc = TPM_HMAC_Generatevalist(actual, key, ap);
+	rc = TPM_HMAC_Generatevalist(actual, key, NULL, ap);
     }
     if (rc == 0) {
 	TPM_PrintFour("  TPM_HMAC_Check: Calculated", actual);
@@ -1186,6 +1290,43 @@ TPM_RESULT TPM_HMAC_Check(TPM_BOOL *valid,
     return rc;
 }
 
+/* TPM_HMAC_CheckSchedule() is TPM_HMAC_Check() using the cached key schedule 'tpm_hmac_schedule'.
+
+   If the schedule was not calculated from 'key', it is recalculated first.  If 'tpm_hmac_schedule'
+   is NULL, the HMAC is calculated without a schedule.
+*/
+
+TPM_RESULT TPM_HMAC_CheckSchedule(TPM_BOOL *valid,
+				  TPM_HMAC expect,
+				  TPM_HMAC_SCHEDULE *tpm_hmac_schedule,
+				  const TPM_SECRET key,
+				  ...)
+{
+    TPM_RESULT		rc = 0;
+    va_list		ap;
+    TPM_HMAC		actual;
+    int			result;
+
+    printf(" TPM_HMAC_CheckSchedule:\n");
+    va_start(ap, key);
+    if (rc == 0) {
+	rc = TPM_HMAC_Generatevalist(actual, key, tpm_hmac_schedule, ap);
+    }
+    if (rc == 0) {
+	TPM_PrintFour("  TPM_HMAC_CheckSchedule: Calculated", actual);
+	TPM_PrintFour("  TPM_HMAC_CheckSchedule: Received  ", expect);
+	result = memcmp(expect, actual, TPM_DIGEST_SIZE);
+	if (result == 0) {
+	    *valid = TRUE;
+	}
+	else {
+	    *valid = FALSE;
+	}
+    }
+    va_end(ap);
+    return rc;
+}
+
 /* TPM_HMAC_CheckStructure() is a generic function that checks the integrity HMAC of a structure.
 
    hmacKey is the HMAC key
@@ -1236,8 +1377,99 @@ TPM_RESULT TPM_HMAC_CheckStructure(const TPM_SECRET hmac_key,
     return rc;
 }
 
+/*
+  TPM_HMAC_SCHEDULE
+*/
+
+/* TPM_HmacSchedule_Init()
+
+   sets members to default values
+   sets all pointers to NULL and sizes to 0
+   always succeeds - no return code
+*/
+
+void TPM_HmacSchedule_Init(TPM_HMAC_SCHEDULE *tpm_hmac_schedule)
+{
+    tpm_hmac_schedule->valid = FALSE;
+    TPM_Secret_Init(tpm_hmac_schedule->key);
+    tpm_hmac_schedule->innerContext = NULL;
+    tpm_hmac_schedule->outerContext = NULL;
+    return;
+}
+
+/* TPM_HmacSchedule_Set() calculates the schedule for the HMAC 'key'.
+
+   If the schedule is already valid for 'key', it is not recalculated.
+*/
+
+TPM_RESULT TPM_HmacSchedule_Set(TPM_HMAC_SCHEDULE *tpm_hmac_schedule,
+				const TPM_SECRET key)
+{
+    TPM_RESULT		rc = 0;
+    unsigned char	ipad[TPM_HMAC_BLOCK_SIZE];
+    unsigned char	opad[TPM_HMAC_BLOCK_SIZE];
+
+    /* the usual case, the schedule is already calculated from this key */
+    if (tpm_hmac_schedule->valid &&
+	(memcmp(tpm_hmac_schedule->key, key, TPM_SECRET_SIZE) == 0)) {
+	return rc;
+    }
+    printf(" TPM_HmacSchedule_Set: Calculating\n");
+    /* discard any schedule for a different key */
+    TPM_HmacSchedule_Delete(tpm_hmac_schedule);
+    TPM_HMAC_PadKey(ipad, opad, key);
+    /* digest the key XOR ipad block */
+    if (rc == 0) {
+	rc = TPM_SHA1InitCmd(&(tpm_hmac_schedule->innerContext));
+    }
+    if (rc == 0) {
+	rc = TPM_SHA1UpdateCmd(tpm_hmac_schedule->innerContext, ipad, TPM_HMAC_BLOCK_SIZE);
+    }
+    /* digest the key XOR opad block */
+    if (rc == 0) {
+	rc = TPM_SHA1InitCmd(&(tpm_hmac_schedule->outerContext));
+    }
+    if (rc == 0) {
+	rc = TPM_SHA1UpdateCmd(tpm_hmac_schedule->outerContext, opad, TPM_HMAC_BLOCK_SIZE);
+    }
+    if (rc == 0) {
+	TPM_Secret_Copy(tpm_hmac_schedule->key, key);
+	tpm_hmac_schedule->valid = TRUE;
+    }
+    else {
+	TPM_HmacSchedule_Delete(tpm_hmac_schedule);
+    }
+    /* the pads are equivalent to the key */
+    memset(ipad, 0, TPM_HMAC_BLOCK_SIZE);
+    memset(opad, 0, TPM_HMAC_BLOCK_SIZE);
+    return rc;
+}
+
+/* TPM_HmacSchedule_Delete()
+
+   No-OP if the parameter is NULL, else:
+   frees memory allocated for the object
+   sets pointers to NULL
+   calls TPM_HmacSchedule_Init to set members back to default values
+   The object itself is not freed
+*/
+
+void TPM_HmacSchedule_Delete(TPM_HMAC_SCHEDULE *tpm_hmac_schedule)
+{
+    if (tpm_hmac_schedule != NULL) {
+	/* TPM_SHA1Delete() zeros the contexts, which are equivalent to the key */
+	TPM_SHA1Delete(&(tpm_hmac_schedule->innerContext));
+	TPM_SHA1Delete(&(tpm_hmac_schedule->outerContext));
+	TPM_HmacSchedule_Init(tpm_hmac_schedule);
+    }
+    return;
+}
+
 /* TPM_XOR XOR's 'in1' and 'in2' of 'length', putting the result in 'out'
 
+   The bulk of the buffers is processed a machine word at a time.  memcpy() is used for the word
+   loads and stores so that the buffers need not be aligned.  'out' may be the same as 'in1' or
+   'in2'.
 */
 
 void TPM_XOR(unsigned char *out,
@@ -1246,8 +1478,17 @@ void TPM_XOR(unsigned char *out,
 	     size_t length)
 {
     size_t i;
+    unsigned long word1;
+    unsigned long word2;
     
-    for (i = 0 ; i < length ; i++) {
+    for (i = 0 ; (i + sizeof(unsigned long)) <= length ; i += sizeof(unsigned long)) {
+	memcpy(&word1, in1 + i, sizeof(unsigned long));
+	memcpy(&word2, in2 + i, sizeof(unsigned long));
+	word1 ^= word2;
+	memcpy(out + i, &word1, sizeof(unsigned long));
+    }
+    /* trailing bytes */
+    for ( ; i < length ; i++) {
 	out[i] = in1[i] ^ in2[i];
     }
     return;
@@ -1294,6 +1535,8 @@ TPM_RESULT TPM_MGF1(unsigned char       *mask,
     uint32_t	        count;          /* counter as an integral type */
     uint32_t		outLen;
     TPM_DIGEST          lastDigest;     
+    void		*seedContext = NULL;	/* digest of mgfSeed, freed @1 */
+    void		*counterContext = NULL;	/* digest of mgfSeed || C, freed @2 */
     
     printf(" TPM_MGF1: Output length %u\n", maskLen);
     if (rc == 0) {
@@ -1306,6 +1549,14 @@ TPM_RESULT TPM_MGF1(unsigned char       *mask,
     /* 1.If l > 2^32(hLen), output "mask too long" and stop. */
     /* NOTE Checked by caller */
     /* 2. Let T be the empty octet string. */
+    /* The seed is common to every block.  Digest it once and resume from a copy for each
+       counter. */
+    if (rc == 0) {
+	rc = TPM_SHA1InitCmd(&seedContext);
+    }
+    if (rc == 0) {
+	rc = TPM_SHA1UpdateCmd(seedContext, mgfSeed, mgfSeedlen);
+    }
     /* 3. For counter from 0 to [masklen/hLen] - 1, do the following: */
     for (count = 0, outLen = 0 ; (rc == 0) && (outLen < maskLen) ; count++) {
 	/* a. Convert counter to an octet string C of length 4 octets - see Section 4.1 */
@@ -1314,27 +1565,30 @@ TPM_RESULT TPM_MGF1(unsigned char       *mask,
 	memcpy(counter, &count_n, 4);
 	/* b.Concatenate the hash of the seed mgfSeed and C to the octet string T: */
 	/* T = T || Hash (mgfSeed || C) */
+	if (rc == 0) {
+	    rc = TPM_SHA1CopyCmd(&counterContext, seedContext);
+	}
+	if (rc == 0) {
+	    rc = TPM_SHA1UpdateCmd(counterContext, counter, 4);
+	}
 	/* If the entire digest is needed for the mask */
-	if ((outLen + TPM_DIGEST_SIZE) < maskLen) {
-	    rc = TPM_SHA1(mask + outLen,
-			  mgfSeedlen, mgfSeed,
-			  4, counter,
-			  0, NULL);
+	if ((rc == 0) && ((outLen + TPM_DIGEST_SIZE) < maskLen)) {
+	    rc = TPM_SHA1FinalCmd(mask + outLen, counterContext);
 	    outLen += TPM_DIGEST_SIZE;
 	}
 	/* if the mask is not modulo TPM_DIGEST_SIZE, only part of the final digest is needed */
-	else {
+	else if (rc == 0) {
 	    /* hash to a temporary digest variable */
-	    rc = TPM_SHA1(lastDigest,
-			  mgfSeedlen, mgfSeed,
-			  4, counter,
-			  0, NULL);
+	    rc = TPM_SHA1FinalCmd(lastDigest, counterContext);
 	    /* copy what's needed */
 	    memcpy(mask + outLen, lastDigest, maskLen - outLen);
 	    outLen = maskLen;           /* outLen = outLen + maskLen - outLen */
 	}
     }
     /* 4.Output the leading l octets of T as the octet string mask. */
+    /* call TPM_SHA1Delete even if there was an error */
+    TPM_SHA1Delete(&counterContext);	/* @2 */
+    TPM_SHA1Delete(&seedContext);	/* @1 */
     return rc;
 }
 
@@ -2322,6 +2576,8 @@ TPM_RESULT TPM_CryptoTest(void)
 			       0x9a,0xf4,0x8a,0xa1,0x7b,0x4f,0x63,0xf1,0x75,0xd3};
     /* data  0xdd repeated 50 times */
     unsigned char data2[50];
+    TPM_HMAC_SCHEDULE hmacSchedule;		/* freed @8 */
+    int		i;
 
     /* oaep tests */
     const unsigned char oaep_pad_str[] = { 'T', 'C', 'P', 'A' };
@@ -2365,6 +2621,7 @@ TPM_RESULT TPM_CryptoTest(void)
     p = NULL;			/* freed @4 */
     q = NULL;			/* freed @5 */
     d = NULL;			/* freed @6 */
+    TPM_HmacSchedule_Init(&hmacSchedule);	/* freed @8 */
     
     if (rc == 0) {
 	printf(" TPM_CryptoTest: Test 1 - SHA1 one part\n");
@@ -2450,6 +2707,26 @@ TPM_RESULT TPM_CryptoTest(void)
 	    rc = TPM_FAILEDSELFTEST;
 	}
     }
+    /* the first pass calculates the key schedule, the second pass reuses it */
+    for (i = 0 ; (rc == 0) && (i < 2) ; i++) {
+	if (rc == 0) {
+	    printf(" TPM_CryptoTest: Test 4 - HMAC check with key schedule - pass %d\n", i);
+	    memset(data2, 0xdd, 50);
+	    rc = TPM_HMAC_CheckSchedule(&valid,
+					expect2,
+					&hmacSchedule,
+					key2,
+					20, data2,
+					30, data2 + 20,
+					0, NULL);
+	}
+	if (rc == 0) {
+	    if (!valid) {
+		printf("TPM_CryptoTest: Error in test 4 with key schedule\n");
+		rc = TPM_FAILEDSELFTEST;
+	    }
+	}
+    }
     if (rc == 0) {
 	printf(" TPM_CryptoTest: Test 5 - OAEP add and check\n");
 	rc = TPM_SHA1(pHash_in,
@@ -2744,6 +3021,7 @@ TPM_RESULT TPM_CryptoTest(void)
     free(q);						/* @5 */
     free(d);						/* @6 */
     TPM_SymmetricKeyData_Free(&tpm_symmetric_key_data);	/* @7 */
+    TPM_HmacSchedule_Delete(&hmacSchedule);		/* @8 */
     return rc;
 }
 
@@ -3079,7 +3357,7 @@ TPM_RESULT TPM_Process_Sign(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -4538,13 +4816,13 @@ TPM_RESULT TPM_Process_CertifyKey(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueKeySession) &&
 	keyAuthHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, keyAuthHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), keyAuthHandle);
     }
     if (((rcf != 0) ||
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	certAuthHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, certAuthHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), certAuthHandle);
     }
     /*
       cleanup
@@ -5073,13 +5351,13 @@ TPM_RESULT TPM_Process_CertifyKey2(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueKeySession) &&
 	keyAuthHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, keyAuthHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), keyAuthHandle);
     }
     if (((rcf != 0) ||
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	certAuthHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, certAuthHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), certAuthHandle);
     }
     /*
       cleanup
@@ -5352,7 +5630,7 @@ TPM_RESULT TPM_Process_CertifySelfTest(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -107,6 +107,7 @@ TPM_RESULT TPM_SymmetricKeyData_StreamCrypt(unsigned char *data_out,
                                             TPM_ENC_SCHEME encScheme,
                                             const unsigned char *symmetric_key,
                                             uint32_t symmetric_key_size,
+                                            TPM_SYMMETRIC_KEY_TOKEN *symmetric_key_cache,
                                             unsigned char *pad_in,
                                             uint32_t pad_in_size);
 
@@ -216,6 +217,10 @@ TPM_RESULT TPM_HMAC_GenerateStructure(TPM_HMAC tpm_hmac,
 TPM_RESULT TPM_HMAC_Generate(TPM_HMAC tpm_hmac,
                              const TPM_SECRET hmac_key,
                              ...);
+TPM_RESULT TPM_HMAC_GenerateSchedule(TPM_HMAC tpm_hmac,
+                                     TPM_HMAC_SCHEDULE *tpm_hmac_schedule,
+                                     const TPM_SECRET hmac_key,
+                                     ...);
 
 TPM_RESULT TPM_HMAC_CheckSbuffer(TPM_BOOL *valid,
                                  TPM_HMAC expect,
@@ -225,12 +230,26 @@ TPM_RESULT TPM_HMAC_Check(TPM_BOOL *valid,
                           TPM_HMAC expect,
                           const TPM_SECRET key,
                           ...);
+TPM_RESULT TPM_HMAC_CheckSchedule(TPM_BOOL *valid,
+                                  TPM_HMAC expect,
+                                  TPM_HMAC_SCHEDULE *tpm_hmac_schedule,
+                                  const TPM_SECRET key,
+                                  ...);
 TPM_RESULT TPM_HMAC_CheckStructure(const TPM_SECRET hmac_key,
                                    void *structure,
                                    TPM_HMAC expect,
                                    TPM_STORE_FUNCTION_T storeFunction,
                                    TPM_RESULT error);
 
+/*
+  TPM_HMAC_SCHEDULE
+*/
+
+void       TPM_HmacSchedule_Init(TPM_HMAC_SCHEDULE *tpm_hmac_schedule);
+TPM_RESULT TPM_HmacSchedule_Set(TPM_HMAC_SCHEDULE *tpm_hmac_schedule,
+                                const TPM_SECRET key);
+void       TPM_HmacSchedule_Delete(TPM_HMAC_SCHEDULE *tpm_hmac_schedule);
+
 /*
   XOR
 */
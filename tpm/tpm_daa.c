@@ -5323,7 +5323,7 @@ TPM_RESULT TPM_Process_DAAJoin(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /* on error, terminate the DAA session */
     if (((rcf != 0) || (returnCode != TPM_SUCCESS)) && daaHandleValid) {
@@ -5711,7 +5711,7 @@ TPM_RESULT TPM_Process_DAASign(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /* on error, terminate the DAA session */
     if (((rcf != 0) || (returnCode != TPM_SUCCESS)) && daaHandleValid) {
@@ -47,6 +47,7 @@
 #include "tpm_digest.h"
 #include "tpm_error.h"
 #include "tpm_key.h"
+#include "tpm_memory.h"
 #include "tpm_pcr.h"
 #include "tpm_permanent.h"
 #include "tpm_process.h"
@@ -54,6 +55,16 @@
 
 #include "tpm_delegate.h"
 
+/* local prototypes */
+
+static TPM_RESULT TPM_FamilyTable_Alloc(TPM_FAMILY_TABLE *tpm_family_table,
+					uint32_t rows);
+static void TPM_FamilyTable_Index(TPM_FAMILY_TABLE *tpm_family_table);
+static uint32_t TPM_FamilyTable_Hash(const TPM_FAMILY_TABLE *tpm_family_table,
+				     TPM_FAMILY_ID familyID);
+static TPM_RESULT TPM_DelegateTable_Alloc(TPM_DELEGATE_TABLE *tpm_delegate_table,
+					  uint32_t rows);
+
 /*
   TPM_DELEGATE_PUBLIC
 */
@@ -912,26 +923,93 @@ void TPM_DelegateKeyBlob_Delete(TPM_DELEGATE_KEY_BLOB *tpm_delegate_key_blob)
 
 /*
   TPM_FAMILY_TABLE
+
+  The rows are indexed by a hash of the familyID.  Each row is either chained from its hash
+  bucket, if valid, or on the free list.
 */
 
-/* TPM_FamilyTable_Init()
+/* tpm_family_table_rows is the number of rows in the family table.  It may be raised at startup
+   with TPM_FamilyTable_SetRows(), before the TPM state is allocated. */
 
-   sets members to default values
-   sets all pointers to NULL and sizes to 0
-   always succeeds - no return code
+static uint32_t tpm_family_table_rows = TPM_NUM_FAMILY_TABLE_ENTRY_MIN;
+
+/* TPM_FamilyTable_SetRows() sets the number of family table rows, bounded by the compiled minimum
+   and by TPM_ALLOC_MAX.
 */
 
-void TPM_FamilyTable_Init(TPM_FAMILY_TABLE *tpm_family_table)
+void TPM_FamilyTable_SetRows(uint32_t rows)
 {
-    size_t i;
+    uint32_t maxRows = TPM_ALLOC_MAX / sizeof(TPM_FAMILY_TABLE_ENTRY);
 
-    printf(" TPM_FamilyTable_Init: Qty %u\n", TPM_NUM_FAMILY_TABLE_ENTRY_MIN);
-    for (i = 0 ; i < TPM_NUM_FAMILY_TABLE_ENTRY_MIN ; i++) {
-	TPM_FamilyTableEntry_Init(&(tpm_family_table->famTableRow[i]));
+    if (rows < TPM_NUM_FAMILY_TABLE_ENTRY_MIN) {
+	printf("TPM_FamilyTable_SetRows: %u raised to minimum %u\n",
+	       rows, TPM_NUM_FAMILY_TABLE_ENTRY_MIN);
+	rows = TPM_NUM_FAMILY_TABLE_ENTRY_MIN;
     }
+    if (rows > maxRows) {
+	printf("TPM_FamilyTable_SetRows: %u lowered to maximum %u\n", rows, maxRows);
+	rows = maxRows;
+    }
+    printf(" TPM_FamilyTable_SetRows: %u\n", rows);
+    tpm_family_table_rows = rows;
     return;
 }
 
+/* TPM_FamilyTable_Init()
+
+   allocates tpm_family_table_rows rows and sets members to default values
+   returns 0 or error codes
+
+   After use, call TPM_FamilyTable_Delete() to free memory
+*/
+
+TPM_RESULT TPM_FamilyTable_Init(TPM_FAMILY_TABLE *tpm_family_table)
+{
+    printf(" TPM_FamilyTable_Init: Qty %u\n", tpm_family_table_rows);
+    tpm_family_table->famTableRow = NULL;
+    tpm_family_table->rows = 0;
+    tpm_family_table->next = NULL;
+    tpm_family_table->buckets = NULL;
+    tpm_family_table->hashSize = 0;
+    tpm_family_table->freeHead = 0;
+    return TPM_FamilyTable_Alloc(tpm_family_table, tpm_family_table_rows);
+}
+
+/* TPM_FamilyTable_Alloc() frees the rows of the family table and allocates 'rows' invalid rows */
+
+static TPM_RESULT TPM_FamilyTable_Alloc(TPM_FAMILY_TABLE *tpm_family_table,
+					uint32_t rows)
+{
+    TPM_RESULT	rc = 0;
+    uint32_t	i;
+
+    TPM_FamilyTable_Delete(tpm_family_table);
+    /* the hash size is the smallest power of 2 not less than the number of rows */
+    for (tpm_family_table->hashSize = 1 ;
+	 tpm_family_table->hashSize < rows ;
+	 tpm_family_table->hashSize <<= 1) ;
+    if (rc == 0) {
+	rc = TPM_Malloc((unsigned char **)&(tpm_family_table->famTableRow),
+			rows * sizeof(TPM_FAMILY_TABLE_ENTRY));
+    }
+    if (rc == 0) {
+	rc = TPM_Malloc((unsigned char **)&(tpm_family_table->next),
+			rows * sizeof(uint32_t));
+    }
+    if (rc == 0) {
+	rc = TPM_Malloc((unsigned char **)&(tpm_family_table->buckets),
+			tpm_family_table->hashSize * sizeof(uint32_t));
+    }
+    if (rc == 0) {
+	tpm_family_table->rows = rows;
+	for (i = 0 ; i < rows ; i++) {
+	    TPM_FamilyTableEntry_Init(&(tpm_family_table->famTableRow[i]));
+	}
+	TPM_FamilyTable_Index(tpm_family_table);
+    }
+    return rc;
+}
+
 /* TPM_FamilyTable_Load()
 
    deserialize the structure from a 'stream'
@@ -947,14 +1025,51 @@ TPM_RESULT TPM_FamilyTable_Load(TPM_FAMILY_TABLE *tpm_family_table,
 				uint32_t *stream_size)
 {
     TPM_RESULT	rc = 0;
-    size_t	i;
+    uint32_t	rows;
+
+    /* load the number of rows */
+    if (rc == 0) {
+	rc = TPM_Load32(&rows, stream, stream_size);
+    }
+    if (rc == 0) {
+	rc = TPM_FamilyTable_LoadRows(tpm_family_table, rows, stream, stream_size);
+    }
+    return rc;
+}
+
+/* TPM_FamilyTable_LoadRows() loads 'rows' rows from the stream.
+
+   The table is enlarged if the stream holds more rows than the table.  Family ID's are not moved,
+   so a table raised at startup keeps its valid rows.
+*/
+
+TPM_RESULT TPM_FamilyTable_LoadRows(TPM_FAMILY_TABLE *tpm_family_table,
+				    uint32_t rows,
+				    unsigned char **stream,
+				    uint32_t *stream_size)
+{
+    TPM_RESULT	rc = 0;
+    uint32_t	i;
 
-    printf(" TPM_FamilyTable_Load: Qty %u\n", TPM_NUM_FAMILY_TABLE_ENTRY_MIN);
-    for (i = 0 ; (rc == 0) && (i < TPM_NUM_FAMILY_TABLE_ENTRY_MIN) ; i++) {
+    printf(" TPM_FamilyTable_LoadRows: Qty %u into %u\n", rows, tpm_family_table->rows);
+    if ((rc == 0) && (rows > tpm_family_table->rows)) {
+	if (rows > (TPM_ALLOC_MAX / sizeof(TPM_FAMILY_TABLE_ENTRY))) {
+	    printf("TPM_FamilyTable_LoadRows: Error (fatal), %u rows too large\n", rows);
+	    rc = TPM_FAIL;
+	}
+	if (rc == 0) {
+	    rc = TPM_FamilyTable_Alloc(tpm_family_table, rows);
+	}
+    }
+    for (i = 0 ; (rc == 0) && (i < rows) ; i++) {
 	rc = TPM_FamilyTableEntry_Load(&(tpm_family_table->famTableRow[i]),
 				       stream,
 				       stream_size);
     }
+    /* index the loaded rows */
+    if (rc == 0) {
+	TPM_FamilyTable_Index(tpm_family_table);
+    }
     return rc;
 }
 
@@ -971,10 +1086,13 @@ TPM_RESULT TPM_FamilyTable_Store(TPM_STORE_BUFFER *sbuffer,
 				 TPM_BOOL store_tag)
 {
     TPM_RESULT		rc = 0;
-    size_t i;
+    uint32_t		i;
 
-    printf(" TPM_FamilyTable_Store: Qty %u\n", TPM_NUM_FAMILY_TABLE_ENTRY_MIN);
-    for (i = 0 ; (rc == 0) && (i < TPM_NUM_FAMILY_TABLE_ENTRY_MIN) ; i++) {
+    printf(" TPM_FamilyTable_Store: Qty %u\n", tpm_family_table->rows);
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(sbuffer, tpm_family_table->rows);
+    }
+    for (i = 0 ; (rc == 0) && (i < tpm_family_table->rows) ; i++) {
 	rc = TPM_FamilyTableEntry_Store(sbuffer,
 					&(tpm_family_table->famTableRow[i]), store_tag);
     }
@@ -986,26 +1104,88 @@ TPM_RESULT TPM_FamilyTable_Store(TPM_STORE_BUFFER *sbuffer,
    No-OP if the parameter is NULL, else:
    frees memory allocated for the object
    sets pointers to NULL
-   calls TPM_FamilyTable_Init to set members back to default values
    The object itself is not freed
 */   
 
 void TPM_FamilyTable_Delete(TPM_FAMILY_TABLE *tpm_family_table)
 {
-    size_t i;
+    uint32_t i;
 
-    printf(" TPM_FamilyTable_Delete: Qty %u\n", TPM_NUM_FAMILY_TABLE_ENTRY_MIN);
     if (tpm_family_table != NULL) {
-	for (i = 0 ; i < TPM_NUM_FAMILY_TABLE_ENTRY_MIN ; i++) {
+	printf(" TPM_FamilyTable_Delete: Qty %u\n", tpm_family_table->rows);
+	for (i = 0 ; i < tpm_family_table->rows ; i++) {
 	    TPM_FamilyTableEntry_Delete(&(tpm_family_table->famTableRow[i]));
 	}
-	TPM_FamilyTable_Init(tpm_family_table);
+	free(tpm_family_table->famTableRow);
+	free(tpm_family_table->next);
+	free(tpm_family_table->buckets);
+	tpm_family_table->famTableRow = NULL;
+	tpm_family_table->rows = 0;
+	tpm_family_table->next = NULL;
+	tpm_family_table->buckets = NULL;
+	tpm_family_table->hashSize = 0;
+	tpm_family_table->freeHead = 0;
+    }
+    return;
+}
+
+/* TPM_FamilyTable_Clear() invalidates all rows of the family table.  The rows remain allocated.
+*/
+
+void TPM_FamilyTable_Clear(TPM_FAMILY_TABLE *tpm_family_table)
+{
+    uint32_t i;
+
+    printf(" TPM_FamilyTable_Clear: Qty %u\n", tpm_family_table->rows);
+    for (i = 0 ; i < tpm_family_table->rows ; i++) {
+	TPM_FamilyTableEntry_Delete(&(tpm_family_table->famTableRow[i]));
+    }
+    TPM_FamilyTable_Index(tpm_family_table);
+    return;
+}
+
+/* TPM_FamilyTable_Index() rebuilds the familyID hash chains and the free list from the valid
+   rows */
+
+static void TPM_FamilyTable_Index(TPM_FAMILY_TABLE *tpm_family_table)
+{
+    uint32_t	i;
+    uint32_t	*link;
+
+    for (i = 0 ; i < tpm_family_table->hashSize ; i++) {
+	tpm_family_table->buckets[i] = 0;
+    }
+    tpm_family_table->freeHead = 0;
+    /* in reverse, so that the free list is in row order */
+    for (i = tpm_family_table->rows ; i > 0 ; i--) {
+	if (tpm_family_table->famTableRow[i - 1].valid) {
+	    link = &(tpm_family_table->buckets
+		     [TPM_FamilyTable_Hash(tpm_family_table,
+					   tpm_family_table->famTableRow[i - 1].familyID)]);
+	}
+	else {
+	    link = &(tpm_family_table->freeHead);
+	}
+	tpm_family_table->next[i - 1] = *link;
+	*link = i;
     }
     return;
 }
 
-/* TPM_FamilyTable_GetEntry() searches all entries for the entry matching the familyID, and returns
-   the TPM_FAMILY_TABLE_ENTRY associated with the familyID.
+/* TPM_FamilyTable_Hash() returns the hash bucket for the familyID */
+
+static uint32_t TPM_FamilyTable_Hash(const TPM_FAMILY_TABLE *tpm_family_table,
+				     TPM_FAMILY_ID familyID)
+{
+    uint32_t hash;
+
+    hash = familyID * 0x9e3779b1;
+    hash ^= hash >> 16;
+    return hash & (tpm_family_table->hashSize - 1);
+}
+
+/* TPM_FamilyTable_GetEntry() searches the hash chain for the entry matching the familyID, and
+   returns the TPM_FAMILY_TABLE_ENTRY associated with the familyID.
 
    Returns
 	0 for success
@@ -1017,15 +1197,19 @@ TPM_RESULT TPM_FamilyTable_GetEntry(TPM_FAMILY_TABLE_ENTRY **tpm_family_table_en
 				    TPM_FAMILY_ID familyID)
 {
     TPM_RESULT	rc = 0;
-    size_t	i;
+    uint32_t	row;
     TPM_BOOL	found;
 
     printf(" TPM_FamilyTable_GetEntry: familyID %08x\n", familyID);
-    for (i = 0, found = FALSE ; (i < TPM_NUM_FAMILY_TABLE_ENTRY_MIN) && !found ; i++) {
-	if (tpm_family_table->famTableRow[i].valid &&
-	    (tpm_family_table->famTableRow[i].familyID == familyID)) {	/* found */
-	    found = TRUE;
-	    *tpm_family_table_entry = &(tpm_family_table->famTableRow[i]);
+    found = FALSE;
+    if (tpm_family_table->hashSize > 0) {
+	for (row = tpm_family_table->buckets[TPM_FamilyTable_Hash(tpm_family_table, familyID)] ;
+	     (row != 0) && !found ;
+	     row = tpm_family_table->next[row - 1]) {
+	    if (tpm_family_table->famTableRow[row - 1].familyID == familyID) {	/* found */
+		found = TRUE;
+		*tpm_family_table_entry = &(tpm_family_table->famTableRow[row - 1]);
+	    }
 	}
     }
     if (!found) {
@@ -1069,33 +1253,80 @@ TPM_RESULT TPM_FamilyTable_GetEnabledEntry(TPM_FAMILY_TABLE_ENTRY **tpm_family_t
 
 /* TPM_FamilyTable_IsSpace() returns success if an entry is available, an error if not.
 
-   If success, 'family_table_entry' holds the first free family table row.
+   If success, 'family_table_entry' holds the first free family table row.  The caller sets the
+   familyID and valid, and then calls TPM_FamilyTable_AddEntry().
 */
 
 TPM_RESULT TPM_FamilyTable_IsSpace(TPM_FAMILY_TABLE_ENTRY **tpm_family_table_entry, /* output */
 				   TPM_FAMILY_TABLE *tpm_family_table)
 {
-    size_t	i;
-    TPM_BOOL	isSpace;
     TPM_RESULT	rc = 0;
     
-    
     printf(" TPM_FamilyTable_IsSpace:\n");
-    for (i = 0, isSpace = FALSE ; i < TPM_NUM_FAMILY_TABLE_ENTRY_MIN; i++) {
-	*tpm_family_table_entry = &(tpm_family_table->famTableRow[i]);
-	if (!((*tpm_family_table_entry)->valid)) {
-	    printf("  TPM_FamilyTable_IsSpace: Found space at %lu\n", (unsigned long)i);
-	    isSpace = TRUE;
-	    break;
-	}	    
+    if (tpm_family_table->freeHead != 0) {
+	printf("  TPM_FamilyTable_IsSpace: Found space at %u\n", tpm_family_table->freeHead - 1);
+	*tpm_family_table_entry = &(tpm_family_table->famTableRow[tpm_family_table->freeHead - 1]);
     }
-    if (!isSpace) {
+    else {
 	printf("  TPM_FamilyTable_IsSpace: Error, no space found\n");
 	rc = TPM_RESOURCES;
     }
     return rc;
 }
 
+/* TPM_FamilyTable_AddEntry() moves the free row returned by TPM_FamilyTable_IsSpace(), now valid,
+   from the free list to the hash chain of its familyID.
+*/
+
+void TPM_FamilyTable_AddEntry(TPM_FAMILY_TABLE *tpm_family_table,
+			      TPM_FAMILY_TABLE_ENTRY *tpm_family_table_entry)
+{
+    uint32_t	row = tpm_family_table_entry - tpm_family_table->famTableRow;
+    uint32_t	*link;
+
+    printf(" TPM_FamilyTable_AddEntry: familyID %08x row %u\n",
+	   tpm_family_table_entry->familyID, row);
+    /* unlink from the free list */
+    for (link = &(tpm_family_table->freeHead) ;
+	 (*link != 0) && (*link != (row + 1)) ;
+	 link = &(tpm_family_table->next[*link - 1])) ;
+    if (*link != 0) {
+	*link = tpm_family_table->next[row];
+    }
+    /* link into the hash chain */
+    link = &(tpm_family_table->buckets[TPM_FamilyTable_Hash(tpm_family_table,
+							    tpm_family_table_entry->familyID)]);
+    tpm_family_table->next[row] = *link;
+    *link = row + 1;
+    return;
+}
+
+/* TPM_FamilyTable_DeleteEntry() invalidates a row and moves it from its hash chain to the free
+   list */
+
+void TPM_FamilyTable_DeleteEntry(TPM_FAMILY_TABLE *tpm_family_table,
+				 TPM_FAMILY_TABLE_ENTRY *tpm_family_table_entry)
+{
+    uint32_t	row = tpm_family_table_entry - tpm_family_table->famTableRow;
+    uint32_t	*link;
+
+    printf(" TPM_FamilyTable_DeleteEntry: familyID %08x row %u\n",
+	   tpm_family_table_entry->familyID, row);
+    if (tpm_family_table_entry->valid) {
+	for (link = &(tpm_family_table->buckets
+		      [TPM_FamilyTable_Hash(tpm_family_table, tpm_family_table_entry->familyID)]) ;
+	     (*link != 0) && (*link != (row + 1)) ;
+	     link = &(tpm_family_table->next[*link - 1])) ;
+	if (*link != 0) {
+	    *link = tpm_family_table->next[row];
+	}
+	tpm_family_table->next[row] = tpm_family_table->freeHead;
+	tpm_family_table->freeHead = row + 1;
+    }
+    TPM_FamilyTableEntry_Delete(tpm_family_table_entry);
+    return;
+}
+
 /* TPM_FamilyTable_StoreValid() stores only the valid (occupied) entries
 
    If store_tag is TRUE, the TPM_FAMILY_TABLE_ENTRY tag is stored.
@@ -1109,10 +1340,10 @@ TPM_RESULT TPM_FamilyTable_StoreValid(TPM_STORE_BUFFER *sbuffer,
 				      TPM_BOOL store_tag)
 {
     TPM_RESULT	rc = 0;
-    size_t	i;
+    uint32_t	i;
 
     printf(" TPM_FamilyTable_StoreValid: \n");
-    for (i = 0 ; (rc == 0) && (i < TPM_NUM_FAMILY_TABLE_ENTRY_MIN) ; i++) {
+    for (i = 0 ; (rc == 0) && (i < tpm_family_table->rows) ; i++) {
 	/* store only the valid rows */
 	if (tpm_family_table->famTableRow[i].valid) {
 	    /* store only the publicly visible members */
@@ -1284,24 +1515,72 @@ void TPM_FamilyTableEntry_Delete(TPM_FAMILY_TABLE_ENTRY *tpm_family_table_entry)
   TPM_DELEGATE_TABLE
 */
 
-/* TPM_DelegateTable_Init()
+/* tpm_delegate_table_rows is the number of rows in the delegate table.  It may be raised at
+   startup with TPM_DelegateTable_SetRows(), before the TPM state is allocated. */
 
-   sets members to default values
-   sets all pointers to NULL and sizes to 0
-   always succeeds - no return code
+static uint32_t tpm_delegate_table_rows = TPM_NUM_DELEGATE_TABLE_ENTRY_MIN;
+
+/* TPM_DelegateTable_SetRows() sets the number of delegate table rows, bounded by the compiled
+   minimum and by TPM_ALLOC_MAX.
 */
 
-void TPM_DelegateTable_Init(TPM_DELEGATE_TABLE *tpm_delegate_table)
+void TPM_DelegateTable_SetRows(uint32_t rows)
 {
-    size_t i;
+    uint32_t maxRows = TPM_ALLOC_MAX / sizeof(TPM_DELEGATE_TABLE_ROW);
 
-    printf(" TPM_DelegateTable_Init: Qty %u\n", TPM_NUM_DELEGATE_TABLE_ENTRY_MIN);
-    for (i = 0 ; i < TPM_NUM_DELEGATE_TABLE_ENTRY_MIN ; i++) {
-	TPM_DelegateTableRow_Init(&(tpm_delegate_table->delRow[i]));
+    if (rows < TPM_NUM_DELEGATE_TABLE_ENTRY_MIN) {
+	printf("TPM_DelegateTable_SetRows: %u raised to minimum %u\n",
+	       rows, TPM_NUM_DELEGATE_TABLE_ENTRY_MIN);
+	rows = TPM_NUM_DELEGATE_TABLE_ENTRY_MIN;
+    }
+    if (rows > maxRows) {
+	printf("TPM_DelegateTable_SetRows: %u lowered to maximum %u\n", rows, maxRows);
+	rows = maxRows;
     }
+    printf(" TPM_DelegateTable_SetRows: %u\n", rows);
+    tpm_delegate_table_rows = rows;
     return;
 }
 
+/* TPM_DelegateTable_Init()
+
+   allocates tpm_delegate_table_rows rows and sets members to default values
+   returns 0 or error codes
+
+   After use, call TPM_DelegateTable_Delete() to free memory
+*/
+
+TPM_RESULT TPM_DelegateTable_Init(TPM_DELEGATE_TABLE *tpm_delegate_table)
+{
+    printf(" TPM_DelegateTable_Init: Qty %u\n", tpm_delegate_table_rows);
+    tpm_delegate_table->delRow = NULL;
+    tpm_delegate_table->rows = 0;
+    return TPM_DelegateTable_Alloc(tpm_delegate_table, tpm_delegate_table_rows);
+}
+
+/* TPM_DelegateTable_Alloc() frees the rows of the delegate table and allocates 'rows' invalid
+   rows */
+
+static TPM_RESULT TPM_DelegateTable_Alloc(TPM_DELEGATE_TABLE *tpm_delegate_table,
+					  uint32_t rows)
+{
+    TPM_RESULT	rc = 0;
+    uint32_t	i;
+
+    TPM_DelegateTable_Delete(tpm_delegate_table);
+    if (rc == 0) {
+	rc = TPM_Malloc((unsigned char **)&(tpm_delegate_table->delRow),
+			rows * sizeof(TPM_DELEGATE_TABLE_ROW));
+    }
+    if (rc == 0) {
+	tpm_delegate_table->rows = rows;
+	for (i = 0 ; i < rows ; i++) {
+	    TPM_DelegateTableRow_Init(&(tpm_delegate_table->delRow[i]));
+	}
+    }
+    return rc;
+}
+
 /* TPM_DelegateTable_Load()
 
    deserialize the structure from a 'stream'
@@ -1317,10 +1596,43 @@ TPM_RESULT TPM_DelegateTable_Load(TPM_DELEGATE_TABLE *tpm_delegate_table,
 				  uint32_t *stream_size)
 {
     TPM_RESULT	rc = 0;
-    size_t	i;
+    uint32_t	rows;
+
+    /* load the number of rows */
+    if (rc == 0) {
+	rc = TPM_Load32(&rows, stream, stream_size);
+    }
+    if (rc == 0) {
+	rc = TPM_DelegateTable_LoadRows(tpm_delegate_table, rows, stream, stream_size);
+    }
+    return rc;
+}
+
+/* TPM_DelegateTable_LoadRows() loads 'rows' rows from the stream.
+
+   The table is enlarged if the stream holds more rows than the table.  Rows are not moved, since
+   the row index is the delegate table index.
+*/
 
-    printf(" TPM_DelegateTable_Load: Qty %u\n", TPM_NUM_DELEGATE_TABLE_ENTRY_MIN);
-    for (i = 0 ; (rc == 0) && (i < TPM_NUM_DELEGATE_TABLE_ENTRY_MIN)  ; i++) {
+TPM_RESULT TPM_DelegateTable_LoadRows(TPM_DELEGATE_TABLE *tpm_delegate_table,
+				      uint32_t rows,
+				      unsigned char **stream,
+				      uint32_t *stream_size)
+{
+    TPM_RESULT	rc = 0;
+    uint32_t	i;
+
+    printf(" TPM_DelegateTable_LoadRows: Qty %u into %u\n", rows, tpm_delegate_table->rows);
+    if ((rc == 0) && (rows > tpm_delegate_table->rows)) {
+	if (rows > (TPM_ALLOC_MAX / sizeof(TPM_DELEGATE_TABLE_ROW))) {
+	    printf("TPM_DelegateTable_LoadRows: Error (fatal), %u rows too large\n", rows);
+	    rc = TPM_FAIL;
+	}
+	if (rc == 0) {
+	    rc = TPM_DelegateTable_Alloc(tpm_delegate_table, rows);
+	}
+    }
+    for (i = 0 ; (rc == 0) && (i < rows)  ; i++) {
 	rc = TPM_DelegateTableRow_Load(&(tpm_delegate_table->delRow[i]),
 					 stream,
 					 stream_size);
@@ -1338,10 +1650,13 @@ TPM_RESULT TPM_DelegateTable_Store(TPM_STORE_BUFFER *sbuffer,
 				   const TPM_DELEGATE_TABLE *tpm_delegate_table)
 {
     TPM_RESULT		rc = 0;
-    size_t i;
+    uint32_t i;
 
-    printf(" TPM_DelegateTable_Store: Qty %u\n", TPM_NUM_DELEGATE_TABLE_ENTRY_MIN);
-    for (i = 0 ; (rc == 0) && (i < TPM_NUM_DELEGATE_TABLE_ENTRY_MIN) ; i++) {
+    printf(" TPM_DelegateTable_Store: Qty %u\n", tpm_delegate_table->rows);
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(sbuffer, tpm_delegate_table->rows);
+    }
+    for (i = 0 ; (rc == 0) && (i < tpm_delegate_table->rows) ; i++) {
 	rc = TPM_DelegateTableRow_Store(sbuffer, &(tpm_delegate_table->delRow[i]));
     }
     return rc;
@@ -1352,20 +1667,36 @@ TPM_RESULT TPM_DelegateTable_Store(TPM_STORE_BUFFER *sbuffer,
    No-OP if the parameter is NULL, else:
    frees memory allocated for the object
    sets pointers to NULL
-   calls TPM_DelegateTable_Init to set members back to default values
    The object itself is not freed
 */   
 
 void TPM_DelegateTable_Delete(TPM_DELEGATE_TABLE *tpm_delegate_table)
 {
-    size_t i;
+    uint32_t i;
 
-    printf(" TPM_DelegateTable_Delete: Qty %u\n", TPM_NUM_DELEGATE_TABLE_ENTRY_MIN);
     if (tpm_delegate_table != NULL) {
-	for (i = 0 ; i < TPM_NUM_DELEGATE_TABLE_ENTRY_MIN ; i++) {
+	printf(" TPM_DelegateTable_Delete: Qty %u\n", tpm_delegate_table->rows);
+	for (i = 0 ; i < tpm_delegate_table->rows ; i++) {
 	    TPM_DelegateTableRow_Delete(&(tpm_delegate_table->delRow[i]));
 	}
-	TPM_DelegateTable_Init(tpm_delegate_table);
+	free(tpm_delegate_table->delRow);
+	tpm_delegate_table->delRow = NULL;
+	tpm_delegate_table->rows = 0;
+    }
+    return;
+}
+
+/* TPM_DelegateTable_Clear() invalidates all rows of the delegate table.  The rows remain
+   allocated.
+*/
+
+void TPM_DelegateTable_Clear(TPM_DELEGATE_TABLE *tpm_delegate_table)
+{
+    uint32_t i;
+
+    printf(" TPM_DelegateTable_Clear: Qty %u\n", tpm_delegate_table->rows);
+    for (i = 0 ; i < tpm_delegate_table->rows ; i++) {
+	TPM_DelegateTableRow_Delete(&(tpm_delegate_table->delRow[i]));
     }
     return;
 }
@@ -1384,7 +1715,7 @@ TPM_RESULT TPM_DelegateTable_StoreValid(TPM_STORE_BUFFER *sbuffer,
     uint32_t	i;
 
     printf(" TPM_DelegateTable_StoreValid:\n");
-    for (i = 0 ; (rc == 0) && (i < TPM_NUM_DELEGATE_TABLE_ENTRY_MIN) ; i++) {
+    for (i = 0 ; (rc == 0) && (i < tpm_delegate_table->rows) ; i++) {
 	/* store only the valid rows */
 	if (tpm_delegate_table->delRow[i].valid) {
 	    /* a. Write the TPM_DELEGATE_INDEX to delegateTable */
@@ -1416,7 +1747,7 @@ TPM_RESULT TPM_DelegateTable_GetRow(TPM_DELEGATE_TABLE_ROW **delegateTableRow,
 
     printf(" TPM_DelegateTable_GetRow: index %u\n", rowIndex);
     if (rc == 0) {
-	if (rowIndex >= TPM_NUM_DELEGATE_TABLE_ENTRY_MIN) {
+	if (rowIndex >= tpm_delegate_table->rows) {
 	    printf("TPM_DelegateTable_GetRow: index %u out of range\n", rowIndex);
 	    rc = TPM_BADINDEX;
 	}
@@ -1816,7 +2147,7 @@ TPM_RESULT TPM_Process_DelegateManage(tpm_state_t *tpm_state,
 	/* d. MAY invalidate any other session */
 	TPM_AuthSessions_TerminatexSAP(&continueAuthSession,
 				       authHandle,
-				       tpm_state->tpm_stclear_data.authSessions);
+				       &(tpm_state->tpm_stclear_data.authSessions));
 	/* c. MUST set TPM_STCLEAR_DATA -> ownerReference to TPM_KH_OWNER */
 	tpm_state->tpm_stclear_data.ownerReference = TPM_KH_OWNER;
     }
@@ -1850,6 +2181,7 @@ TPM_RESULT TPM_Process_DelegateManage(tpm_state_t *tpm_state,
 	    tpm_state->tpm_permanent_data.lastFamilyID++;
 	    /* must write TPM_PERMANENT_DATA back to NVRAM, set this flag after NVRAM is written */
 	    writeAllNV = TRUE;
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	    /* e. Set F2 -> familyID = TPM_PERMANENT_DATA -> lastFamilyID */
 	    familyRow->familyID = tpm_state->tpm_permanent_data.lastFamilyID;
 	    /* f. Set F2 -> verificationCount = 1 */
@@ -1862,6 +2194,7 @@ TPM_RESULT TPM_Process_DelegateManage(tpm_state_t *tpm_state,
 	    /* j. Set retData = F2 -> familyID */
 	    printf("TPM_Process_DelegateManage: Created familyID %08x\n", familyRow->familyID);
 	    familyRow->valid = TRUE;
+	    TPM_FamilyTable_AddEntry(&(tpm_state->tpm_permanent_data.familyTable), familyRow);
 	    returnCode = TPM_Sbuffer_Append32(&retData, familyRow->familyID);
 	}
 	/* k. Return TPM_SUCCESS */
@@ -1902,6 +2235,7 @@ TPM_RESULT TPM_Process_DelegateManage(tpm_state_t *tpm_state,
 	}
 	if (returnCode == TPM_SUCCESS) {
 	    writeAllNV = TRUE;
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	}
     }
     /* 8. else If opflag == TPM_FAMILY_ENABLE */
@@ -1932,6 +2266,7 @@ TPM_RESULT TPM_Process_DelegateManage(tpm_state_t *tpm_state,
 	}
 	if (returnCode == TPM_SUCCESS) {
 	    writeAllNV = TRUE;
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	}
     }
     /* 9. else If opflag == TPM_FAMILY_INVALIDATE */
@@ -1940,12 +2275,13 @@ TPM_RESULT TPM_Process_DelegateManage(tpm_state_t *tpm_state,
 	/* a. Invalidate all data associated with familyRow */
 	/* i. All data is all information pointed to by FR */
 	/* ii. return TPM_SELFTEST_FAILED on failure */
-	TPM_FamilyTableEntry_Delete(familyRow);
+	TPM_FamilyTable_DeleteEntry(&(tpm_state->tpm_permanent_data.familyTable), familyRow);
 	/* b.The TPM MAY invalidate delegate rows that contain the same familyID. */
 	/* c. Set retDataSize = 0 */
 	/* NOTE Done by TPM_Sbuffer_Init() */
 	/* d. Return TPM_SUCCESS */
 	writeAllNV = TRUE;
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
     }
     /* 10. Else return TPM_BAD_PARAMETER */
     if (returnCode == TPM_SUCCESS) {
@@ -2024,7 +2360,7 @@ TPM_RESULT TPM_Process_DelegateManage(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -2395,7 +2731,7 @@ TPM_RESULT TPM_Process_DelegateCreateKeyDelegation(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -2644,6 +2980,7 @@ TPM_RESULT TPM_Process_DelegateCreateOwnerDelegation(tpm_state_t *tpm_state,
 	/* a. Increment FR -> verificationCount */
 	familyRow->verificationCount++;
 	writeAllNV = TRUE;
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	/* b. Set TPM_STCLEAR_DATA -> ownerReference to TPM_KH_OWNER */
 	tpm_state->tpm_stclear_data.ownerReference = TPM_KH_OWNER;
 	/* c. The TPM invalidates sessions */
@@ -2652,7 +2989,7 @@ TPM_RESULT TPM_Process_DelegateCreateOwnerDelegation(tpm_state_t *tpm_state,
 	/* iii. MAY invalidate any other session */
 	TPM_AuthSessions_TerminatexSAP(&continueAuthSession,
 				       authHandle,
-				       tpm_state->tpm_stclear_data.authSessions);
+				       &(tpm_state->tpm_stclear_data.authSessions));
     }
     /* 8. Create M1 a TPM_DELEGATE_SENSITIVE structure */
     if (returnCode == TPM_SUCCESS) {
@@ -2772,7 +3109,7 @@ TPM_RESULT TPM_Process_DelegateCreateOwnerDelegation(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -3069,7 +3406,7 @@ TPM_RESULT TPM_Process_DelegateLoadOwnerDelegation(tpm_state_t *tpm_state,
 	/* c. MAY invalidate any other session */
 	TPM_AuthSessions_TerminatexSAP(&continueAuthSession,
 				       authHandle,
-				       tpm_state->tpm_stclear_data.authSessions);
+				       &(tpm_state->tpm_stclear_data.authSessions));
     }
     /* 12. Copy data to the delegate table row */
     if (returnCode == TPM_SUCCESS) {
@@ -3077,6 +3414,7 @@ TPM_RESULT TPM_Process_DelegateLoadOwnerDelegation(tpm_state_t *tpm_state,
 	   pub. */
 	returnCode = TPM_DelegatePublic_Copy(&delegateTableRow->pub, &(d1Blob.pub));
 	writeAllNV = TRUE;
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
     }
     if (returnCode == TPM_SUCCESS) {
 	delegateTableRow->valid = TRUE;
@@ -3157,7 +3495,7 @@ TPM_RESULT TPM_Process_DelegateLoadOwnerDelegation(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -3574,6 +3912,7 @@ TPM_RESULT TPM_Process_DelegateUpdateVerification(tpm_state_t *tpm_state,
 	if (inputData.size == sizeof(TPM_DELEGATE_INDEX)) {
 	    d1DelegateTableRow->pub.verificationCount = familyRow->verificationCount;
 	    writeAllNV = TRUE;
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	}
 	else {
 	    switch (d1Tag) {
@@ -3689,7 +4028,7 @@ TPM_RESULT TPM_Process_DelegateUpdateVerification(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
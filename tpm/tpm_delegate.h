@@ -40,6 +40,7 @@
 #ifndef TPM_DELEGATE_H
 #define TPM_DELEGATE_H
 
+#include "tpm_global.h"
 #include "tpm_structures.h"
 
 /*
@@ -126,14 +127,20 @@ void       TPM_DelegateKeyBlob_Delete(TPM_DELEGATE_KEY_BLOB *tpm_delegate_key_bl
   TPM_FAMILY_TABLE
 */
 
-void       TPM_FamilyTable_Init(TPM_FAMILY_TABLE *tpm_family_table);
+void       TPM_FamilyTable_SetRows(uint32_t rows);
+TPM_RESULT TPM_FamilyTable_Init(TPM_FAMILY_TABLE *tpm_family_table);
 TPM_RESULT TPM_FamilyTable_Load(TPM_FAMILY_TABLE *tpm_family_table,
                                 unsigned char **stream,
                                 uint32_t *stream_size);
+TPM_RESULT TPM_FamilyTable_LoadRows(TPM_FAMILY_TABLE *tpm_family_table,
+                                    uint32_t rows,
+                                    unsigned char **stream,
+                                    uint32_t *stream_size);
 TPM_RESULT TPM_FamilyTable_Store(TPM_STORE_BUFFER *sbuffer,
                                  const TPM_FAMILY_TABLE *tpm_family_table,
 				 TPM_BOOL store_tag);
 void       TPM_FamilyTable_Delete(TPM_FAMILY_TABLE *tpm_family_table);
+void       TPM_FamilyTable_Clear(TPM_FAMILY_TABLE *tpm_family_table);
 
 TPM_RESULT TPM_FamilyTable_StoreValid(TPM_STORE_BUFFER *sbuffer,
                                       const TPM_FAMILY_TABLE *tpm_family_table,
@@ -146,6 +153,10 @@ TPM_RESULT TPM_FamilyTable_GetEnabledEntry(TPM_FAMILY_TABLE_ENTRY **tpm_family_t
                                            TPM_FAMILY_ID familyID);
 TPM_RESULT TPM_FamilyTable_IsSpace(TPM_FAMILY_TABLE_ENTRY **tpm_family_table_entry,
                                    TPM_FAMILY_TABLE *tpm_family_table);
+void       TPM_FamilyTable_AddEntry(TPM_FAMILY_TABLE *tpm_family_table,
+                                    TPM_FAMILY_TABLE_ENTRY *tpm_family_table_entry);
+void       TPM_FamilyTable_DeleteEntry(TPM_FAMILY_TABLE *tpm_family_table,
+                                       TPM_FAMILY_TABLE_ENTRY *tpm_family_table_entry);
 
 /*
   TPM_FAMILY_TABLE_ENTRY
@@ -167,13 +178,19 @@ void       TPM_FamilyTableEntry_Delete(TPM_FAMILY_TABLE_ENTRY *tpm_family_table_
   TPM_DELEGATE_TABLE
 */
 
-void       TPM_DelegateTable_Init(TPM_DELEGATE_TABLE *tpm_delegate_table);
+void       TPM_DelegateTable_SetRows(uint32_t rows);
+TPM_RESULT TPM_DelegateTable_Init(TPM_DELEGATE_TABLE *tpm_delegate_table);
 TPM_RESULT TPM_DelegateTable_Load(TPM_DELEGATE_TABLE *tpm_delegate_table,
                                   unsigned char **stream,
                                   uint32_t *stream_size);
+TPM_RESULT TPM_DelegateTable_LoadRows(TPM_DELEGATE_TABLE *tpm_delegate_table,
+                                      uint32_t rows,
+                                      unsigned char **stream,
+                                      uint32_t *stream_size);
 TPM_RESULT TPM_DelegateTable_Store(TPM_STORE_BUFFER *sbuffer,
                                    const TPM_DELEGATE_TABLE *tpm_delegate_table);
 void       TPM_DelegateTable_Delete(TPM_DELEGATE_TABLE *tpm_delegate_table);
+void       TPM_DelegateTable_Clear(TPM_DELEGATE_TABLE *tpm_delegate_table);
 
 TPM_RESULT TPM_DelegateTable_StoreValid(TPM_STORE_BUFFER *sbuffer,
                                         const TPM_DELEGATE_TABLE *tpm_delegate_table);
@@ -51,8 +51,11 @@
 #include "tpm_nvram.h"
 #include "tpm_permanent.h"
 #include "tpm_platform.h"
+#include "tpm_session.h"
 #include "tpm_startup.h"
+#include "tpm_store.h"
 #include "tpm_structures.h"
+#include "tpm_transport.h"
 
 
 #include "tpm_global.h"
@@ -68,6 +71,7 @@ tpm_state_t *tpm_instances[TPMS_MAX];
 TPM_RESULT TPM_Global_Init(tpm_state_t *tpm_state)
 {
     TPM_RESULT rc = 0;
+    size_t i;
     
     printf("TPM_Global_Init: TPMs %lu\n",
            (unsigned long)sizeof(tpm_instances)/sizeof(tpm_state_t *));
@@ -104,7 +108,9 @@ TPM_RESULT TPM_Global_Init(tpm_state_t *tpm_state)
     /* initialize the TPM_KEY_HANDLE_LIST structure */
     if (rc == 0) {
         printf("TPM_Global_Init: Initializing TPM_KEY_HANDLE_LIST\n");
-        TPM_KeyHandleEntries_Init(tpm_state->tpm_key_handle_entries);
+        rc = TPM_KeyHandleEntries_Init(&(tpm_state->tpm_key_handle_entries));
+    }
+    if (rc == 0) {
 	/* initialize the SHA1 thread context */
 	tpm_state->sha1_context = NULL;
 	/* initialize the TIS SHA1 thread context */
@@ -112,6 +118,27 @@ TPM_RESULT TPM_Global_Init(tpm_state_t *tpm_state)
 	tpm_state->transportHandle = 0;
         printf("TPM_Global_Init: Initializing TPM_NV_INDEX_ENTRIES\n");
 	TPM_NVIndexEntries_Init(&(tpm_state->tpm_nv_index_entries));
+	TPM_NVDataFiles_Init(&(tpm_state->tpm_nv_data_files));
+	TPM_OwnerEvictFiles_Init(&(tpm_state->tpm_owner_evict_files));
+	/* nothing has been read from or written to NV yet */
+	tpm_state->permanentSectionsValid = FALSE;
+	tpm_state->permanentStorePending = FALSE;
+	tpm_state->permanentStoreDeferred = FALSE;
+	tpm_state->permanentSnapshotValid = FALSE;
+	tpm_state->permanentSectionsDirty = TPM_PERMANENT_DIRTY_ALL;
+	tpm_state->permanentSectionsUnwritten = 0;
+	for (i = 0 ; i < TPM_PERMANENT_SECTIONS ; i++) {
+	    tpm_state->permanentSectionCopies[i] = TPM_PERMANENT_COPY_NONE;
+	    TPM_Sbuffer_Init(&(tpm_state->permanentSnapshot[i]));
+	}
+	/* no volatile state checkpoint has been read or written */
+	tpm_state->volatileSectionsValid = FALSE;
+	tpm_state->volatileSequence = 0;
+	tpm_state->volatileCheckpointPending = FALSE;
+	for (i = 0 ; i < TPM_VOLATILE_SECTIONS ; i++) {
+	    tpm_state->volatileSectionCopies[i] = 0;
+	    TPM_Sbuffer_Init(&(tpm_state->volatileCheckpoint[i]));
+	}
     }
     /* comes up in limited operation mode */
     /* shutdown is set on a self test failure, before calling TPM_Global_Init() */
@@ -162,6 +189,7 @@ TPM_RESULT TPM_Global_Store(tpm_state_t *tpm_state)
 
     printf(" TPM_Global_Store:\n");
     if (rc == 0) {
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_ALL);
 	rc = TPM_PermanentAll_NVStore(tpm_state, TRUE, 0);
     }
     if (rc == 0) {
@@ -181,6 +209,8 @@ TPM_RESULT TPM_Global_Store(tpm_state_t *tpm_state)
 
 void TPM_Global_Delete(tpm_state_t *tpm_state)
 {
+    size_t i;
+
     printf(" TPM_Global_Delete:\n");
     if (tpm_state != NULL) {
 	/* TPM_PERMANENT_FLAGS have no allocated memory or secrets */
@@ -192,14 +222,25 @@ void TPM_Global_Delete(tpm_state_t *tpm_state)
 	TPM_StclearData_Delete(&(tpm_state->tpm_stclear_data),
 			       tpm_state->tpm_permanent_data.pcrAttrib,
 			       TRUE);       /* reset the PCR's */
+	TPM_AuthSessions_Free(&(tpm_state->tpm_stclear_data.authSessions));
+	TPM_TransportSessions_Free(&(tpm_state->tpm_stclear_data.transSessions));
+	TPM_ContextList_Free(&(tpm_state->tpm_stclear_data.contextList));
 	printf("  TPM_Global_Delete: Deleting TPM_STANY_DATA\n");
 	TPM_StanyData_Delete(&(tpm_state->tpm_stany_data));
 	printf("  TPM_Global_Delete: Deleting key handle entries\n");
-	TPM_KeyHandleEntries_Delete(tpm_state->tpm_key_handle_entries);
+	TPM_KeyHandleEntries_Delete(&(tpm_state->tpm_key_handle_entries));
 	printf("  TPM_Global_Delete: Deleting SHA1 contexts\n");
 	TPM_SHA1Delete(&(tpm_state->sha1_context));
 	TPM_SHA1Delete(&(tpm_state->sha1_context_tis));
 	TPM_NVIndexEntries_Delete(&(tpm_state->tpm_nv_index_entries));
+	TPM_NVDataFiles_Delete(&(tpm_state->tpm_nv_data_files));
+	TPM_OwnerEvictFiles_Delete(&(tpm_state->tpm_owner_evict_files));
+	for (i = 0 ; i < TPM_PERMANENT_SECTIONS ; i++) {
+	    TPM_Sbuffer_Delete(&(tpm_state->permanentSnapshot[i]));
+	}
+	for (i = 0 ; i < TPM_VOLATILE_SECTIONS ; i++) {
+	    TPM_Sbuffer_Delete(&(tpm_state->volatileCheckpoint[i]));
+	}
     }
     return;
 }
@@ -65,7 +65,7 @@ typedef struct tdTPM_STATE
     /* 7.6 TPM_STANY_DATA  */
     TPM_STANY_DATA tpm_stany_data;
     /* 5.6 TPM_KEY_HANDLE_ENTRY */
-    TPM_KEY_HANDLE_ENTRY tpm_key_handle_entries[TPM_KEY_HANDLES];
+    TPM_KEY_HANDLE_ENTRIES tpm_key_handle_entries;
     /* Context for SHA1 functions */
     void *sha1_context;
     void *sha1_context_tis;
@@ -77,6 +77,38 @@ typedef struct tdTPM_STATE
        have been read.  The index not being present indicates that some volatile fields should be
        cleared at first read. */
     TPM_NV_INDEX_ENTRIES tpm_nv_index_entries;
+    /* NV file copies and digests of the NV defined space data areas as last written to or read
+       from NV */
+    TPM_NV_DATA_FILES tpm_nv_data_files;
+    /* NV file copies and digests of the owner evict keys as last written to or read from NV */
+    TPM_OWNER_EVICT_FILES tpm_owner_evict_files;
+    /* copies and digests of the permanent state sections as last written to or read from NV.
+       Only sections whose digest changes are rewritten. */
+    TPM_BOOL permanentSectionsValid;	/* FALSE if the digests do not reflect NV */
+    BYTE permanentSectionCopies[TPM_PERMANENT_SECTIONS];
+    TPM_DIGEST permanentSectionDigests[TPM_PERMANENT_SECTIONS];
+    /* TPM_PERMANENT_DIRTY_ masks of the sections altered since the snapshot, set at the mutation
+       sites by TPM_PermanentAll_SetDirty(), and of the snapshot sections not yet written to NV */
+    uint32_t permanentSectionsDirty;
+    uint32_t permanentSectionsUnwritten;
+    /* group commit, TRUE if the permanent state changed but has not been written to NV, and TRUE
+       if the current command deferred a write.  The server clears permanentStoreDeferred before
+       each command. */
+    TPM_BOOL permanentStorePending;
+    TPM_BOOL permanentStoreDeferred;
+    /* serialized sections of the last committed permanent state, i.e. the state at the start of
+       any ordinal.  A failing ordinal rolls back from the snapshot rather than from NV. */
+    TPM_BOOL permanentSnapshotValid;	/* FALSE if the snapshot does not reflect the state */
+    TPM_STORE_BUFFER permanentSnapshot[TPM_PERMANENT_SECTIONS];
+    /* sequence number, section copies, and section digests of the last volatile state checkpoint
+       written to or read from NV.  Only sections whose digest changes are rewritten. */
+    TPM_BOOL volatileSectionsValid;	/* FALSE if the digests do not reflect NV */
+    uint32_t volatileSequence;
+    BYTE volatileSectionCopies[TPM_VOLATILE_SECTIONS];
+    TPM_DIGEST volatileSectionDigests[TPM_VOLATILE_SECTIONS];
+    /* serialized sections of a checkpoint not yet written to NV */
+    TPM_BOOL volatileCheckpointPending;
+    TPM_STORE_BUFFER volatileCheckpoint[TPM_VOLATILE_SECTIONS];
     /* NOTE: members added here should be initialized by TPM_Global_Init() and possibly added to
        TPM_SaveState_Load() and TPM_SaveState_Store() */
 } tpm_state_t;
@@ -59,6 +59,7 @@
 #include "tpm_platform.h"
 #include "tpm_session.h"
 #include "tpm_startup.h"
+#include "tpm_store.h"
 #include "tpm_structures.h"
 #include "tpm_ticks.h"
 #include "tpm_transport.h"
@@ -66,9 +67,14 @@
 
 #include "tpm_init.h"
 
+/* The handle generator state, see TPM_Handle_GenerateHandle() */
+static TPM_SECRET tpm_handle_key;		/* permutation key */
+static uint32_t tpm_handle_counter = 0;		/* next permutation input, 0 draws a new key */
+
 /* local prototypes */
 
 static TPM_RESULT TPM_CheckTypes(void);
+static TPM_RESULT TPM_Handle_Next(TPM_HANDLE *tpm_handle);
 
 
 /* TPM_Init transitions the TPM from a power-off state to one where the TPM begins an initialization
@@ -662,6 +668,7 @@ TPM_RESULT TPM_StclearData_Load(TPM_STCLEAR_DATA *tpm_stclear_data,
 	switch (tag) {
 	  case TPM_TAG_STCLEAR_DATA:
 	  case TPM_TAG_STCLEAR_DATA_V2:
+	  case TPM_TAG_STCLEAR_DATA_V3:
 	    break;
 	  default:
             printf("TPM_StclearData_Load: Error (fatal), version %04x unsupported\n", tag);
@@ -705,11 +712,11 @@ TPM_RESULT TPM_StclearData_Load(TPM_STCLEAR_DATA *tpm_stclear_data,
     }
     /* load authorization sessions */
     if (rc == 0) {
-        rc = TPM_AuthSessions_Load(tpm_stclear_data->authSessions, stream, stream_size); 
+        rc = TPM_AuthSessions_Load(&(tpm_stclear_data->authSessions), stream, stream_size); 
     }
     /* load transport sessions */
     if (rc == 0) {
-        rc = TPM_TransportSessions_Load(tpm_stclear_data->transSessions, stream, stream_size); 
+        rc = TPM_TransportSessions_Load(&(tpm_stclear_data->transSessions), stream, stream_size); 
     }
     /* load DAA sessions */
     if (rc == 0) {
@@ -725,7 +732,9 @@ TPM_RESULT TPM_StclearData_Load(TPM_STCLEAR_DATA *tpm_stclear_data,
     }
     /* load contextList */
     if (rc == 0) {
-        rc = TPM_ContextList_Load(tpm_stclear_data->contextList, stream, stream_size);
+        rc = TPM_ContextList_Load(&(tpm_stclear_data->contextList),
+                                  (tag == TPM_TAG_STCLEAR_DATA_V3),     /* counted */
+                                  stream, stream_size);
     }
     /* load auditDigest */
     if (rc == 0) {
@@ -764,7 +773,7 @@ TPM_RESULT TPM_StclearData_Store(TPM_STORE_BUFFER *sbuffer,
     printf(" TPM_StclearData_Store:\n");
     /* store tag */
     if (rc == 0) {
-        rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_STCLEAR_DATA_V2);
+        rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_STCLEAR_DATA_V3);
     }
     /* store contextNonceKey */
     if (rc == 0) {
@@ -803,11 +812,11 @@ TPM_RESULT TPM_StclearData_Store(TPM_STORE_BUFFER *sbuffer,
     }
     /* store authorization sessions */
     if (rc == 0) {
-        rc = TPM_AuthSessions_Store(sbuffer, tpm_stclear_data->authSessions);
+        rc = TPM_AuthSessions_Store(sbuffer, &(tpm_stclear_data->authSessions));
     }
     /* store transport sessions */
     if (rc == 0) {
-        rc = TPM_TransportSessions_Store(sbuffer, tpm_stclear_data->transSessions);
+        rc = TPM_TransportSessions_Store(sbuffer, &(tpm_stclear_data->transSessions));
     }
     /* store DAA sessions */
     if (rc == 0) {
@@ -823,7 +832,7 @@ TPM_RESULT TPM_StclearData_Store(TPM_STORE_BUFFER *sbuffer,
     }
     /* store contextList */
     if (rc == 0) {
-        rc = TPM_ContextList_Store(sbuffer, tpm_stclear_data->contextList);
+        rc = TPM_ContextList_Store(sbuffer, &(tpm_stclear_data->contextList));
     }
     /* store auditDigest */
     if (rc == 0) {
@@ -873,13 +882,13 @@ void TPM_StclearData_SessionInit(TPM_STCLEAR_DATA *tpm_stclear_data)
 {
     printf(" TPM_StclearData_SessionInit:\n");
     /* active sessions */
-    TPM_AuthSessions_Init(tpm_stclear_data->authSessions);
-    TPM_TransportSessions_Init(tpm_stclear_data->transSessions);
+    TPM_AuthSessions_Init(&(tpm_stclear_data->authSessions));
+    TPM_TransportSessions_Init(&(tpm_stclear_data->transSessions));
     TPM_DaaSessions_Init(tpm_stclear_data->daaSessions);
     /* saved sessions */
     TPM_Nonce_Init(tpm_stclear_data->contextNonceSession);
     tpm_stclear_data->contextCount = 0;
-    TPM_ContextList_Init(tpm_stclear_data->contextList);
+    TPM_ContextList_Init(&(tpm_stclear_data->contextList));
     return;
 }
 
@@ -896,7 +905,7 @@ void TPM_StclearData_SessionDelete(TPM_STCLEAR_DATA *tpm_stclear_data)
        entries */
     TPM_StclearData_AuthSessionDelete(tpm_stclear_data);
     /* loaded transport sessions */
-    TPM_TransportSessions_Delete(tpm_stclear_data->transSessions);
+    TPM_TransportSessions_Delete(&(tpm_stclear_data->transSessions));
     /* loaded DAA sessions */
     TPM_DaaSessions_Delete(tpm_stclear_data->daaSessions);
     return;
@@ -912,11 +921,11 @@ void TPM_StclearData_AuthSessionDelete(TPM_STCLEAR_DATA *tpm_stclear_data)
 {
     printf(" TPM_StclearData_AuthSessionDelete:\n");
     /* active sessions */
-    TPM_AuthSessions_Delete(tpm_stclear_data->authSessions);
+    TPM_AuthSessions_Delete(&(tpm_stclear_data->authSessions));
     /* saved sessions */
     TPM_Nonce_Init(tpm_stclear_data->contextNonceSession);
     tpm_stclear_data->contextCount = 0;
-    TPM_ContextList_Init(tpm_stclear_data->contextList);
+    TPM_ContextList_Init(&(tpm_stclear_data->contextList));
     return;
 }
 
@@ -930,6 +939,10 @@ TPM_RESULT TPM_InitCmd(tpm_state_t *tpm_state)
     uint32_t	tpm_number;
     
     printf(" TPM_Init:\n");
+    /* write any group commit, since the state is reloaded from NV */
+    if (rc == TPM_SUCCESS) {
+	rc = TPM_PermanentAll_NVFlush(tpm_state);
+    }
     /* Release all resources for the TPM and reinitialize */
     if (rc == TPM_SUCCESS) {
         tpm_number = tpm_state->tpm_number;     /* save the TPM value */
@@ -949,6 +962,54 @@ TPM_RESULT TPM_InitCmd(tpm_state_t *tpm_state)
     return rc;
 }
 
+/* TPM_Handle_Next() returns the next value of a keyed permutation of the 32-bit handle space.
+
+   The permutation is a 4 round Feistel network on 16 bit halves, with a SHA-1 round function keyed
+   by a random secret.  The input is a counter, so the values do not repeat until the counter wraps,
+   while each value is unpredictable without the key.  The key is drawn on first use and again when
+   the counter wraps.
+*/
+
+static TPM_RESULT TPM_Handle_Next(TPM_HANDLE *tpm_handle)
+{
+    TPM_RESULT  rc = 0;
+    uint16_t    left;
+    uint16_t    right;
+    uint16_t    temp;
+    BYTE        round;
+    BYTE        rightBytes[2];
+    TPM_DIGEST  digest;
+
+    if (rc == 0) {
+        if (tpm_handle_counter == 0) {
+            printf("  TPM_Handle_Next: New permutation key\n");
+            rc = TPM_Random(tpm_handle_key, TPM_SECRET_SIZE);
+        }
+    }
+    if (rc == 0) {
+        left = (uint16_t)(tpm_handle_counter >> 16);
+        right = (uint16_t)(tpm_handle_counter & 0xffff);
+        tpm_handle_counter++;
+    }
+    for (round = 0 ; (rc == 0) && (round < 4) ; round++) {
+        STORE16(rightBytes, 0, right);
+        rc = TPM_SHA1(digest,
+                      TPM_SECRET_SIZE, tpm_handle_key,
+                      sizeof(BYTE), &round,
+                      sizeof(rightBytes), rightBytes,
+                      0, NULL);
+        if (rc == 0) {
+            temp = right;
+            right = left ^ (uint16_t)((digest[0] << 8) | digest[1]);
+            left = temp;
+        }
+    }
+    if (rc == 0) {
+        *tpm_handle = ((uint32_t)left << 16) | right;
+    }
+    return rc;
+}
+
 /*
   TPM_Handle_GenerateHandle() is a utility function that returns an unused handle.
 
@@ -958,13 +1019,16 @@ TPM_RESULT TPM_InitCmd(tpm_state_t *tpm_state)
   If 'tpm_handle' is non-zero, it is the first value tried.  If 'keepHandle' is TRUE, it is the only
   value tried.
 
-  If 'tpm_handle' is zero, a random value is assigned.  If 'keepHandle' is TRUE, an error returned,
-  as zero is an illegal handle value.
+  If 'tpm_handle' is zero, a value is assigned from TPM_Handle_Next().  If 'keepHandle' is TRUE, an
+  error returned, as zero is an illegal handle value.
 
   If 'isKeyHandle' is TRUE, special checking is performed to avoid reserved values.
 
   'getEntryFunction' is a function callback to check whether the handle has already been assigned to
-  an entry in the appropriate handle list.
+  an entry in the appropriate handle list.  Assigned values never repeat, so the first value tried is
+  usually free, and only a handle kept from a saved context or the volatile state can collide.  The
+  key, authorization and transport session tables are hash indexed, so the check is a single
+  lookup.  The DAA session table has only TPM_MIN_DAA_SESSIONS entries and is scanned.
 */
 
 TPM_RESULT TPM_Handle_GenerateHandle(TPM_HANDLE *tpm_handle,
@@ -1016,17 +1080,17 @@ TPM_RESULT TPM_Handle_GenerateHandle(TPM_HANDLE *tpm_handle,
         /* implement a crude timeout in case the random number generator fails and there are too
            many collisions */
         for (done = FALSE, timeout = 0 ; (rc == 0) && !done && (timeout < 1000) ; timeout++) {
-            /* If no handle has been assigned, try a random value.  If a handle has been assigned,
-               try it first */
+            /* If no handle has been assigned, try the next generated value.  If a handle has been
+               assigned, try it first */
             if (rc == 0) {
                 if (*tpm_handle == 0) {
-                    rc = TPM_Random((BYTE *)tpm_handle, sizeof(uint32_t));
+                    rc = TPM_Handle_Next(tpm_handle);
                 }
             }
-            /* if the random value is 0, reject it immediately */
+            /* if the generated value is 0, reject it immediately */
             if (rc == 0) {
                 if (*tpm_handle == 0) {
-                    printf("  TPM_Handle_GenerateHandle: Random value 0 rejected\n");
+                    printf("  TPM_Handle_GenerateHandle: Generated value 0 rejected\n");
                     continue;
                 }
             }
@@ -1034,7 +1098,7 @@ TPM_RESULT TPM_Handle_GenerateHandle(TPM_HANDLE *tpm_handle,
             if (rc == 0) {
                 if (isKeyHandle) {
                     if ((*tpm_handle & 0xff000000) == 0x40000000) {
-                        printf("  TPM_Handle_GenerateHandle: Random value %08x rejected\n",
+                        printf("  TPM_Handle_GenerateHandle: Generated value %08x rejected\n",
                                *tpm_handle);
                         *tpm_handle = 0;                /* ignore the assigned value */
                         continue;
@@ -1052,14 +1116,14 @@ TPM_RESULT TPM_Handle_GenerateHandle(TPM_HANDLE *tpm_handle,
                     done = TRUE;
                 }
                 else {                          /* found, try again */
-                    *tpm_handle = 0;            /* ignore the assigned value */
                     printf("  TPM_Handle_GenerateHandle: Handle %08x already used\n",
                            *tpm_handle);
+                    *tpm_handle = 0;            /* ignore the assigned value */
                 }
             }
         }
         if (!done) {
-            printf("TPM_Handle_GenerateHandle: Error (fatal), random number generator failed\n");
+            printf("TPM_Handle_GenerateHandle: Error (fatal), handle generator failed\n");
             rc = TPM_FAIL;      
         }
     }
@@ -388,6 +388,93 @@ TPM_RESULT TPM_IO_Connect(TPM_CONNECTION_FD *connection_fd,     /* read/write fi
     return rc;
 }
 
+/* TPM_IO_IsConnectPending() returns 'pending' TRUE if a client connection is waiting to be
+   accepted.  It waits up to 'msec' for one, and does not block if 'msec' is 0.
+   
+   This is the Unix platform dependent socket version.
+*/
+
+TPM_RESULT TPM_IO_IsConnectPending(TPM_BOOL *pending,
+                                   uint32_t msec)
+{
+    TPM_RESULT          rc = 0;
+    fd_set              readfds;
+    struct timeval      timeout;
+    int                 n;
+
+    FD_ZERO(&readfds);
+    FD_SET(sock_fd, &readfds);
+    timeout.tv_sec = msec / 1000;
+    timeout.tv_usec = (msec % 1000) * 1000;
+    n = select(sock_fd + 1, &readfds, NULL, NULL, &timeout);
+    if (n < 0) {
+        printf("TPM_IO_IsConnectPending: Error, select() %d %s\n", errno, strerror(errno));
+        rc = TPM_IOERROR;
+    }
+    *pending = (n > 0) && FD_ISSET(sock_fd, &readfds);
+    return rc;
+}
+
+/* TPM_IO_Select() waits until one of the open client connections has a command, or, if 'listen'
+   is TRUE, a new client connection is waiting to be accepted.
+
+   'readyIndex' is the index of the readable connection, 'count' for a pending connection, or
+   'count' + 1 if nothing is ready.  It waits up to 'msec', or without a limit if 'msec' is
+   TPM_IO_WAIT_FOREVER, and does not block if 'msec' is 0.  The search start rotates, so that a
+   busy connection does not starve the others.
+
+   This is the Unix platform dependent socket version.
+*/
+
+TPM_RESULT TPM_IO_Select(size_t *readyIndex,
+                         const TPM_CONNECTION_FD *connection_fds,
+                         size_t count,
+                         TPM_BOOL listen,
+                         uint32_t msec)
+{
+    TPM_RESULT          rc = 0;
+    static size_t       start = 0;
+    fd_set              readfds;
+    struct timeval      timeout;
+    int                 max_fd = -1;
+    int                 fd;
+    int                 n;
+    size_t              i;
+    size_t              j;
+
+    *readyIndex = count + 1;
+    FD_ZERO(&readfds);
+    for (i = 0 ; i < count ; i++) {
+        FD_SET(connection_fds[i].fd, &readfds);
+        if (connection_fds[i].fd > max_fd) {
+            max_fd = connection_fds[i].fd;
+        }
+    }
+    if (listen) {
+        FD_SET(sock_fd, &readfds);
+        if (sock_fd > max_fd) {
+            max_fd = sock_fd;
+        }
+    }
+    timeout.tv_sec = msec / 1000;
+    timeout.tv_usec = (msec % 1000) * 1000;
+    n = select(max_fd + 1, &readfds, NULL, NULL, (msec == TPM_IO_WAIT_FOREVER) ? NULL : &timeout);
+    if (n < 0) {
+        printf("TPM_IO_Select: Error, select() %d %s\n", errno, strerror(errno));
+        rc = TPM_IOERROR;
+    }
+    for (i = 0 ; (rc == 0) && (n > 0) && (i <= count) ; i++) {
+        j = (start + i) % (count + 1);
+        fd = (j < count) ? connection_fds[j].fd : sock_fd;
+        if (((j < count) || listen) && FD_ISSET(fd, &readfds)) {
+            *readyIndex = j;
+            start = j + 1;
+            break;
+        }
+    }
+    return rc;
+}
+
 /* TPM_IO_ReadBytes() reads nbytes from connection_fd and puts them in buffer.
 
    The buffer has already been checked for sufficient size.
@@ -647,6 +734,88 @@ TPM_RESULT TPM_IO_Connect(TPM_CONNECTION_FD *connection_fd,     /* read/write fi
     return rc;
 }
 
+/* TPM_IO_IsConnectPending() returns 'pending' TRUE if a client connection is waiting to be
+   accepted.  It waits up to 'msec' for one, and does not block if 'msec' is 0.
+   
+   This is the Windows platform dependent socket version.
+*/
+
+TPM_RESULT TPM_IO_IsConnectPending(TPM_BOOL *pending,
+                                   uint32_t msec)
+{
+    TPM_RESULT          rc = 0;
+    fd_set              readfds;
+    struct timeval      timeout;
+    int                 n;
+
+    FD_ZERO(&readfds);
+    FD_SET(sock_fd, &readfds);
+    timeout.tv_sec = msec / 1000;
+    timeout.tv_usec = (msec % 1000) * 1000;
+    n = select(0, &readfds, NULL, NULL, &timeout);	/* nfds is ignored by winsock */
+    if (n == SOCKET_ERROR) {
+        printf("TPM_IO_IsConnectPending: Error, select()\n");
+        TPM_HandleWsaError("TPM_IO_IsConnectPending: ");
+        rc = TPM_IOERROR;
+    }
+    *pending = (n > 0) && FD_ISSET(sock_fd, &readfds);
+    return rc;
+}
+
+/* TPM_IO_Select() waits until one of the open client connections has a command, or, if 'listen'
+   is TRUE, a new client connection is waiting to be accepted.
+
+   'readyIndex' is the index of the readable connection, 'count' for a pending connection, or
+   'count' + 1 if nothing is ready.  It waits up to 'msec', or without a limit if 'msec' is
+   TPM_IO_WAIT_FOREVER, and does not block if 'msec' is 0.  The search start rotates, so that a
+   busy connection does not starve the others.
+
+   This is the Windows platform dependent socket version.
+*/
+
+TPM_RESULT TPM_IO_Select(size_t *readyIndex,
+                         const TPM_CONNECTION_FD *connection_fds,
+                         size_t count,
+                         TPM_BOOL listen,
+                         uint32_t msec)
+{
+    TPM_RESULT          rc = 0;
+    static size_t       start = 0;
+    fd_set              readfds;
+    struct timeval      timeout;
+    SOCKET              fd;
+    int                 n;
+    size_t              i;
+    size_t              j;
+
+    *readyIndex = count + 1;
+    FD_ZERO(&readfds);
+    for (i = 0 ; i < count ; i++) {
+        FD_SET(connection_fds[i].fd, &readfds);
+    }
+    if (listen) {
+        FD_SET(sock_fd, &readfds);
+    }
+    timeout.tv_sec = msec / 1000;
+    timeout.tv_usec = (msec % 1000) * 1000;
+    n = select(0, &readfds, NULL, NULL, (msec == TPM_IO_WAIT_FOREVER) ? NULL : &timeout);	/* nfds is ignored by winsock */
+    if (n == SOCKET_ERROR) {
+        printf("TPM_IO_Select: Error, select()\n");
+        TPM_HandleWsaError("TPM_IO_Select: ");
+        rc = TPM_IOERROR;
+    }
+    for (i = 0 ; (rc == 0) && (n > 0) && (i <= count) ; i++) {
+        j = (start + i) % (count + 1);
+        fd = (j < count) ? connection_fds[j].fd : sock_fd;
+        if (((j < count) || listen) && FD_ISSET(fd, &readfds)) {
+            *readyIndex = j;
+            start = j + 1;
+            break;
+        }
+    }
+    return rc;
+}
+
 /* TPM_IO_ReadBytes() reads nbytes from connection_fd and puts them in buffer.
 
    The buffer has already been checked for sufficient size.
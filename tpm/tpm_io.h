@@ -53,10 +53,21 @@ typedef struct TPM_CONNECTION_FD {
 #endif
 } TPM_CONNECTION_FD;
 
+/* TPM_IO_Select() timeout that waits until a connection is ready */
+
+#define TPM_IO_WAIT_FOREVER 0xffffffff
+
 
 TPM_RESULT TPM_IO_IsNotifyAvailable(TPM_BOOL *isAvailable);
 TPM_RESULT TPM_IO_Connect(TPM_CONNECTION_FD *connection_fd,
                           void *mainLoopArgs);
+TPM_RESULT TPM_IO_IsConnectPending(TPM_BOOL *pending,
+                                   uint32_t msec);
+TPM_RESULT TPM_IO_Select(size_t *readyIndex,
+                         const TPM_CONNECTION_FD *connection_fds,
+                         size_t count,
+                         TPM_BOOL listen,
+                         uint32_t msec);
 TPM_RESULT TPM_IO_Read(TPM_CONNECTION_FD *connection_fd,
                        unsigned char *buffer,
                        uint32_t *paramSize,
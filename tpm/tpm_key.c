@@ -54,6 +54,7 @@
 #include "tpm_memory.h"
 #include "tpm_nonce.h"
 #include "tpm_nvfile.h"
+#include "tpm_nvfilename.h"
 #include "tpm_nvram.h"
 #include "tpm_owner.h"
 #include "tpm_pcr.h"
@@ -70,9 +71,33 @@
 /* The default RSA exponent */
 unsigned char tpm_default_rsa_exponent[] = {0x01, 0x00, 0x01};
 
+/* The number of key slots allocated by TPM_KeyHandleEntries_Init() */
+static uint32_t tpm_key_handles = TPM_KEY_HANDLES;
+
+/* The number of owner evict keys allowed by TPM_KeyHandleEntries_Init() */
+static uint32_t tpm_owner_evict_key_handles = TPM_OWNER_EVICT_KEY_HANDLES;
+
 /* local prototypes */
 
 static TPM_RESULT TPM_Key_CheckTag(TPM_KEY12 *tpm_key12);
+static TPM_RESULT TPM_KeyHandleEntry_GetKeyDigest(TPM_DIGEST keyDigest,
+						  const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry);
+static void TPM_KeyHandleEntry_KeyName(char *name,
+				       TPM_KEY_HANDLE handle,
+				       BYTE keyCopy);
+static uint32_t TPM_KeyHandleEntries_Hash(const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+					  TPM_KEY_HANDLE tpm_key_handle);
+static void TPM_KeyHandleEntries_Remove(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+					uint32_t slot);
+static void TPM_KeyHandleEntries_OwnerEvictInsert(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+						  uint32_t slot);
+static void TPM_KeyHandleEntries_OwnerEvictRemove(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+						  uint32_t slot);
+static TPM_OWNER_EVICT_FILE *TPM_OwnerEvictFiles_Find(const TPM_OWNER_EVICT_FILES
+						      *tpm_owner_evict_files,
+						      TPM_KEY_HANDLE handle);
+static int TPM_OwnerEvictFiles_Compare(const void *a, const void *b);
+static int TPM_KeyHandleEntry_CompareHandle(const void *a, const void *b);
 
 /*
   TPM_KEY, TPM_KEY12
@@ -361,8 +386,10 @@ TPM_RESULT TPM_Key_LoadClear(TPM_KEY *tpm_key,		/* result */
 	rc = TPM_Load32(&storeAsymkeySize, stream, stream_size);
     }
     /* The size might be 0 for an uninitialized internal key.  That case is not an error. */
+    /* The stream was created by the TPM, so the private key is not derived until first use.  See
+       TPM_Key_GetPrivateKey(). */
     if ((rc == 0) && (storeAsymkeySize > 0)) {
-	rc = TPM_Key_LoadStoreAsymKey(tpm_key, isEK, stream, stream_size);
+	rc = TPM_Key_LoadStoreAsymKeyConvert(tpm_key, isEK, FALSE, stream, stream_size);
     }			     
     return rc;
 }
@@ -778,22 +805,37 @@ TPM_RESULT TPM_Key_LoadStoreAsymKey(TPM_KEY *tpm_key,
 				    TPM_BOOL isEK,
 				    unsigned char **stream,	/* decrypted encData (clear text) */
 				    uint32_t *stream_size)
+{
+    return TPM_Key_LoadStoreAsymKeyConvert(tpm_key, isEK, TRUE, stream, stream_size);
+}
+
+/* TPM_Key_LoadStoreAsymKeyConvert() is TPM_Key_LoadStoreAsymKey(), but if 'convert' is FALSE, only
+   the prime factor p is loaded.  The prime factor q and the private key d are then derived by
+   TPM_Key_GetPrivateKey().
+*/
+
+TPM_RESULT TPM_Key_LoadStoreAsymKeyConvert(TPM_KEY *tpm_key,
+					   TPM_BOOL isEK,
+					   TPM_BOOL convert,
+					   unsigned char **stream,
+					   uint32_t *stream_size)
 {
     TPM_RESULT	rc = 0;
     
     /* This function should never be called when the TPM_STORE_ASYMKEY structure has already been
        loaded.	This indicates an internal error. */
-    printf(" TPM_Key_LoadStoreAsymKey:\n");
+    printf(" TPM_Key_LoadStoreAsymKeyConvert: convert %u\n", convert);
     if (rc == 0) {
 	if (tpm_key->tpm_store_asymkey != NULL) {
-	    printf("TPM_Key_LoadStoreAsymKey: Error (fatal), TPM_STORE_ASYMKEY already loaded\n");
+	    printf("TPM_Key_LoadStoreAsymKeyConvert: Error (fatal), "
+		   "TPM_STORE_ASYMKEY already loaded\n");
 	    rc = TPM_FAIL;	/* should never occur */
 	}
     }
     /* If the stream size is 0, there is an internal error. */
     if (rc == 0) {
 	if (*stream_size == 0) {
-	    printf("TPM_Key_LoadStoreAsymKey: Error (fatal), stream size is 0\n");
+	    printf("TPM_Key_LoadStoreAsymKeyConvert: Error (fatal), stream size is 0\n");
 	    rc = TPM_FAIL;	/* should never occur */
 	}
     }
@@ -806,8 +848,9 @@ TPM_RESULT TPM_Key_LoadStoreAsymKey(TPM_KEY *tpm_key,
 	TPM_StoreAsymkey_Init(tpm_key->tpm_store_asymkey);
 	rc = TPM_StoreAsymkey_Load(tpm_key->tpm_store_asymkey, isEK,
 				   stream, stream_size,
-				   &(tpm_key->algorithmParms), &(tpm_key->pubKey));
-	TPM_PrintFour("  TPM_Key_LoadStoreAsymKey: usageAuth",
+				   convert ? &(tpm_key->algorithmParms) : NULL,
+				   convert ? &(tpm_key->pubKey) : NULL);
+	TPM_PrintFour("  TPM_Key_LoadStoreAsymKeyConvert: usageAuth",
 		      tpm_key->tpm_store_asymkey->usageAuth);
     }
     return rc;
@@ -942,6 +985,9 @@ TPM_RESULT TPM_Key_GetPrimeFactorP(uint32_t 		*pbytes,
 }
 
 /* TPM_Key_GetPrivateKey() gets the private key from the TPM_STORE_ASYMKEY contained in a TPM_KEY
+
+   If the key was loaded by TPM_Key_LoadClear(), the private key is derived from the prime factor p
+   on first use.
  */
 
 TPM_RESULT TPM_Key_GetPrivateKey(uint32_t	*dbytes,
@@ -955,6 +1001,13 @@ TPM_RESULT TPM_Key_GetPrivateKey(uint32_t	*dbytes,
     if (rc == 0) {
 	rc = TPM_Key_GetStoreAsymkey(&tpm_store_asymkey, tpm_key);
     }
+    if ((rc == 0) &&
+	(tpm_store_asymkey->privKey.d_key.size == 0) &&
+	(tpm_store_asymkey->privKey.p_key.size != 0)) {
+	printf("  TPM_Key_GetPrivateKey: Deriving private key\n");
+	rc = TPM_StorePrivkey_Convert(tpm_store_asymkey,
+				      &(tpm_key->algorithmParms), &(tpm_key->pubKey));
+    }
     if (rc == 0) {
 	*dbytes = tpm_store_asymkey->privKey.d_key.size;
 	*darr = tpm_store_asymkey->privKey.d_key.buffer;
@@ -2992,6 +3045,9 @@ void TPM_KeyHandleEntry_Init(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry)
     tpm_key_handle_entry->key = NULL;
     tpm_key_handle_entry->parentPCRStatus = TRUE;
     tpm_key_handle_entry->keyControl = 0;
+    tpm_key_handle_entry->lazyKey = FALSE;
+    tpm_key_handle_entry->keyCopy = TPM_KEY_COPY_NONE;
+    TPM_Digest_Init(tpm_key_handle_entry->keyDigest);
     return;
 }
 
@@ -3108,56 +3164,339 @@ TPM_RESULT TPM_KeyHandleEntry_FlushSpecific(tpm_state_t *tpm_state,
 	    rc = TPM_FAIL;
 	}
     }
-    /* terminate OSAP and DSAP sessions associated with the key */
-    if (rc == 0) {
+    /* terminate OSAP and DSAP sessions associated with the key.  An owner evict key not yet read
+       from NV has never been used, so no session can be bound to it. */
+    if ((rc == 0) && !tpm_key_handle_entry->lazyKey) {
 	/* The dummy parameters are not used.  The session, if any, associated with this function
 	   is handled elsewhere. */
 	TPM_AuthSessions_TerminateEntity(&continueAuthSession,
 					 authHandle,
-					 tpm_state->tpm_stclear_data.authSessions,
+					 &(tpm_state->tpm_stclear_data.authSessions),
 					 TPM_ET_KEYHANDLE,		/* TPM_ENTITY_TYPE */
 					 &(tpm_key_handle_entry->key->
 					   tpm_store_asymkey->pubDataDigest)); /* entityDigest */
+    }
+    if (rc == 0) {
 	printf(" TPM_KeyHandleEntry_FlushSpecific: Flushing key handle %08x\n",
 	       tpm_key_handle_entry->handle);
 	/* free the TPM_KEY resources, free the key itself, and remove entry from the key handle
 	   entries list */
-	TPM_KeyHandleEntry_Delete(tpm_key_handle_entry);
+	TPM_KeyHandleEntries_DeleteEntry(&(tpm_state->tpm_key_handle_entries),
+					 tpm_key_handle_entry);
+    }
+    return rc;
+}
+
+/* TPM_KeyHandleEntry_LoadKey() reads an owner evict key loaded by
+   TPM_KeyHandleEntries_OwnerEvictLoad() from its NV file.  It must be called before the key member
+   is used.
+
+   No-op if the key was already read.
+*/
+
+TPM_RESULT TPM_KeyHandleEntry_LoadKey(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry,
+				      uint32_t tpm_number)
+{
+    TPM_RESULT		rc = 0;
+    char		name[TPM_FILENAME_MAX];
+    unsigned char	*stream = NULL;
+    unsigned char	*stream_start = NULL;
+    uint32_t		stream_size;
+
+    if (tpm_key_handle_entry->lazyKey) {
+	printf(" TPM_KeyHandleEntry_LoadKey: Reading key handle %08x copy %u\n",
+	       tpm_key_handle_entry->handle, tpm_key_handle_entry->keyCopy);
+	TPM_KeyHandleEntry_KeyName(name,
+				   tpm_key_handle_entry->handle,
+				   tpm_key_handle_entry->keyCopy);
+	rc = TPM_NVRAM_LoadData(&stream,	/* freed @1 */
+				&stream_size,
+				tpm_number,
+				name);
+	/* the file must hold the key recorded in the section */
+	if (rc == 0) {
+	    stream_start = stream;
+	    rc = TPM_SHA1_Check(tpm_key_handle_entry->keyDigest,
+				stream_size, stream,
+				0, NULL);
+	}
+	if (rc == 0) {
+	    rc = TPM_Key_LoadClear(tpm_key_handle_entry->key,
+				   FALSE,			/* not EK */
+				   &stream, &stream_size);
+	}
+	if ((rc == 0) && (stream_size != 0)) {
+	    printf("TPM_KeyHandleEntry_LoadKey: Error, %s has %u bytes remaining\n",
+		   name, stream_size);
+	    rc = TPM_FAIL;
+	}
+	if (rc == 0) {
+	    tpm_key_handle_entry->lazyKey = FALSE;
+	}
+	/* leave the placeholder valid for a retry or delete */
+	else {
+	    printf("TPM_KeyHandleEntry_LoadKey: Error (fatal) reading %s\n", name);
+	    TPM_Key_Delete(tpm_key_handle_entry->key);
+	    rc = TPM_FAIL;
+	}
+	free(stream_start);			/* @1 */
+    }
+    return rc;
+}
+
+/* TPM_KeyHandleEntry_GetKeyDigest() returns the digest of the owner evict NV file serialization of
+   the key.  A key not yet digested must be in memory.
+*/
+
+static TPM_RESULT TPM_KeyHandleEntry_GetKeyDigest(TPM_DIGEST keyDigest,
+						  const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry)
+{
+    TPM_RESULT		rc = 0;
+    TPM_STORE_BUFFER	sbuffer;	/* key serialization */
+    const unsigned char *buffer;
+    uint32_t		length;
+
+    if (tpm_key_handle_entry->keyCopy != TPM_KEY_COPY_NONE) {
+	TPM_Digest_Copy(keyDigest, tpm_key_handle_entry->keyDigest);
+    }
+    else {
+	TPM_Sbuffer_Init(&sbuffer);		/* freed @1 */
+	if (tpm_key_handle_entry->lazyKey) {
+	    printf("TPM_KeyHandleEntry_GetKeyDigest: Error (fatal) key handle %08x has no key\n",
+		   tpm_key_handle_entry->handle);
+	    rc = TPM_FAIL;
+	}
+	if (rc == 0) {
+	    rc = TPM_Key_StoreClear(&sbuffer, FALSE, tpm_key_handle_entry->key);
+	}
+	if (rc == 0) {
+	    TPM_Sbuffer_Get(&sbuffer, &buffer, &length);
+	    rc = TPM_SHA1(keyDigest,
+			  length, buffer,
+			  0, NULL);
+	}
+	TPM_Sbuffer_Delete(&sbuffer);		/* @1 */
     }
     return rc;
 }
 
+/* TPM_KeyHandleEntry_KeyName() returns the NV name of an owner evict key copy */
+
+static void TPM_KeyHandleEntry_KeyName(char *name,
+				       TPM_KEY_HANDLE handle,
+				       BYTE keyCopy)
+{
+    sprintf(name, "%s%08x%u", TPM_OWNER_EVICT_KEY_NAME, handle, keyCopy);
+    return;
+}
+
 /*
   Key Handle Entries
 */
 
-/* TPM_KeyHandleEntries_Init() initializes the fixed TPM_KEY_HANDLE_ENTRY array.  All entries are
-   emptied.  The keys are not deleted.
+/* TPM_KeyHandleEntries_Init() allocates the key handle entries table with the number of slots set
+   by TPM_KeyHandleEntries_SetKeyHandles().  All entries are empty and on the free list.
+
+   After use, call TPM_KeyHandleEntries_Delete() to free memory
 */
 
-void TPM_KeyHandleEntries_Init(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
+TPM_RESULT TPM_KeyHandleEntries_Init(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries)
 {
-    size_t i;
+    TPM_RESULT	rc = 0;
+    uint32_t	i;
     
-    printf(" TPM_KeyHandleEntries_Init:\n");
-    for (i = 0 ; i < TPM_KEY_HANDLES ; i++) {
-	TPM_KeyHandleEntry_Init(&(tpm_key_handle_entries[i]));
+    printf(" TPM_KeyHandleEntries_Init: %u slots, %u owner evict\n",
+	   tpm_key_handles, tpm_owner_evict_key_handles);
+    tpm_key_handle_entries->keyHandles = 0;
+    tpm_key_handle_entries->entries = NULL;
+    tpm_key_handle_entries->next = NULL;
+    tpm_key_handle_entries->buckets = NULL;
+    tpm_key_handle_entries->hashSize = 0;
+    tpm_key_handle_entries->freeHead = 0;
+    tpm_key_handle_entries->freeCount = 0;
+    tpm_key_handle_entries->ownerEvictKeyHandles = 0;
+    tpm_key_handle_entries->ownerEvict = NULL;
+    tpm_key_handle_entries->ownerEvictCount = 0;
+    /* the hash size is the smallest power of 2 not less than the number of slots */
+    if (rc == 0) {
+	for (tpm_key_handle_entries->hashSize = 1 ;
+	     tpm_key_handle_entries->hashSize < tpm_key_handles ;
+	     tpm_key_handle_entries->hashSize <<= 1) ;
+	rc = TPM_Malloc((unsigned char **)&(tpm_key_handle_entries->entries),
+			tpm_key_handles * sizeof(TPM_KEY_HANDLE_ENTRY));
     }
-    return;
+    if (rc == 0) {
+	rc = TPM_Malloc((unsigned char **)&(tpm_key_handle_entries->next),
+			tpm_key_handles * sizeof(uint32_t));
+    }
+    if (rc == 0) {
+	rc = TPM_Malloc((unsigned char **)&(tpm_key_handle_entries->buckets),
+			tpm_key_handle_entries->hashSize * sizeof(uint32_t));
+    }
+    if (rc == 0) {
+	rc = TPM_Malloc((unsigned char **)&(tpm_key_handle_entries->ownerEvict),
+			tpm_owner_evict_key_handles * sizeof(uint32_t));
+    }
+    /* chain all slots on the free list, in order */
+    if (rc == 0) {
+	tpm_key_handle_entries->keyHandles = tpm_key_handles;
+	tpm_key_handle_entries->ownerEvictKeyHandles = tpm_owner_evict_key_handles;
+	for (i = 0 ; i < tpm_key_handles ; i++) {
+	    TPM_KeyHandleEntry_Init(&(tpm_key_handle_entries->entries[i]));
+	    tpm_key_handle_entries->next[i] = ((i + 1) < tpm_key_handles) ? (i + 2) : 0;
+	}
+	tpm_key_handle_entries->freeHead = 1;
+	tpm_key_handle_entries->freeCount = tpm_key_handles;
+	for (i = 0 ; i < tpm_key_handle_entries->hashSize ; i++) {
+	    tpm_key_handle_entries->buckets[i] = 0;
+	}
+    }
+    return rc;
 }
 
 /* TPM_KeyHandleEntries_Delete() deletes and freed all TPM_KEY's stored in entries, and the entry
-
+   table itself.
 */
 
-void TPM_KeyHandleEntries_Delete(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
+void TPM_KeyHandleEntries_Delete(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries)
 {
-    size_t i;
+    uint32_t i;
     
     printf(" TPM_KeyHandleEntries_Delete:\n");
-    for (i = 0 ; i < TPM_KEY_HANDLES ; i++) {
-	TPM_KeyHandleEntry_Delete(&(tpm_key_handle_entries[i]));
+    for (i = 0 ; i < tpm_key_handle_entries->keyHandles ; i++) {
+	TPM_KeyHandleEntry_Delete(&(tpm_key_handle_entries->entries[i]));
+    }
+    free(tpm_key_handle_entries->entries);
+    free(tpm_key_handle_entries->next);
+    free(tpm_key_handle_entries->buckets);
+    free(tpm_key_handle_entries->ownerEvict);
+    tpm_key_handle_entries->keyHandles = 0;
+    tpm_key_handle_entries->entries = NULL;
+    tpm_key_handle_entries->next = NULL;
+    tpm_key_handle_entries->buckets = NULL;
+    tpm_key_handle_entries->hashSize = 0;
+    tpm_key_handle_entries->freeHead = 0;
+    tpm_key_handle_entries->freeCount = 0;
+    tpm_key_handle_entries->ownerEvictKeyHandles = 0;
+    tpm_key_handle_entries->ownerEvict = NULL;
+    tpm_key_handle_entries->ownerEvictCount = 0;
+    return;
+}
+
+/* TPM_KeyHandleEntries_SetKeyHandles() sets the number of key slots allocated by subsequent calls
+   to TPM_KeyHandleEntries_Init(), overriding TPM_KEY_HANDLES.
+
+   TPM_KEY_HANDLES remains the minimum, since TPM_OWNER_EVICT_KEY_HANDLES is checked against it.
+   The minimum is raised to keep 2 non-owner evict slots above the owner evict keys.  The maximum
+   is the slot array that TPM_Malloc() can allocate, within the uint16_t of TPM_GetCapability.
+*/
+
+void TPM_KeyHandleEntries_SetKeyHandles(uint32_t keyHandles)
+{
+    uint32_t maxKeyHandles = TPM_ALLOC_MAX / sizeof(TPM_KEY_HANDLE_ENTRY);
+    uint32_t minKeyHandles = TPM_KEY_HANDLES;
+
+    if (maxKeyHandles > 0xffff) {
+	maxKeyHandles = 0xffff;
+    }
+    if (minKeyHandles < (tpm_owner_evict_key_handles + 2)) {
+	minKeyHandles = tpm_owner_evict_key_handles + 2;
+    }
+    if (keyHandles < minKeyHandles) {
+	printf("TPM_KeyHandleEntries_SetKeyHandles: %u raised to minimum %u\n",
+	       keyHandles, minKeyHandles);
+	keyHandles = minKeyHandles;
+    }
+    if (keyHandles > maxKeyHandles) {
+	printf("TPM_KeyHandleEntries_SetKeyHandles: %u lowered to maximum %u\n",
+	       keyHandles, maxKeyHandles);
+	keyHandles = maxKeyHandles;
+    }
+    printf(" TPM_KeyHandleEntries_SetKeyHandles: %u\n", keyHandles);
+    tpm_key_handles = keyHandles;
+    return;
+}
+
+/* TPM_KeyHandleEntries_SetOwnerEvictKeyHandles() sets the number of owner evict keys allowed by
+   subsequent calls to TPM_KeyHandleEntries_Init(), overriding TPM_OWNER_EVICT_KEY_HANDLES.
+
+   TPM_OWNER_EVICT_KEY_HANDLES remains the minimum.  Since the TPM reserves 2 key slots for
+   non-owner evict keys, the number of key slots is raised if necessary.
+*/
+
+void TPM_KeyHandleEntries_SetOwnerEvictKeyHandles(uint32_t ownerEvictKeyHandles)
+{
+    uint32_t maxOwnerEvictKeyHandles = (TPM_ALLOC_MAX / sizeof(TPM_KEY_HANDLE_ENTRY)) - 2;
+
+    if (maxOwnerEvictKeyHandles > (0xffff - 2)) {
+	maxOwnerEvictKeyHandles = 0xffff - 2;
+    }
+    if (ownerEvictKeyHandles < TPM_OWNER_EVICT_KEY_HANDLES) {
+	printf("TPM_KeyHandleEntries_SetOwnerEvictKeyHandles: %u raised to minimum %u\n",
+	       ownerEvictKeyHandles, TPM_OWNER_EVICT_KEY_HANDLES);
+	ownerEvictKeyHandles = TPM_OWNER_EVICT_KEY_HANDLES;
+    }
+    if (ownerEvictKeyHandles > maxOwnerEvictKeyHandles) {
+	printf("TPM_KeyHandleEntries_SetOwnerEvictKeyHandles: %u lowered to maximum %u\n",
+	       ownerEvictKeyHandles, maxOwnerEvictKeyHandles);
+	ownerEvictKeyHandles = maxOwnerEvictKeyHandles;
+    }
+    printf(" TPM_KeyHandleEntries_SetOwnerEvictKeyHandles: %u\n", ownerEvictKeyHandles);
+    tpm_owner_evict_key_handles = ownerEvictKeyHandles;
+    if (tpm_key_handles < (ownerEvictKeyHandles + 2)) {
+	TPM_KeyHandleEntries_SetKeyHandles(ownerEvictKeyHandles + 2);
+    }
+    return;
+}
+
+/* TPM_KeyHandleEntries_GetOwnerEvictKeyHandles() returns the number of owner evict keys allowed.
+   Each key takes two NV names, see TPM_OWNER_EVICT_KEY_NAME.
+*/
+
+uint32_t TPM_KeyHandleEntries_GetOwnerEvictKeyHandles(void)
+{
+    return tpm_owner_evict_key_handles;
+}
+
+/* TPM_KeyHandleEntries_Hash() returns the hash chain for the key handle.  Handles are mostly
+   random, but the multiply spreads sequential and suggested values.
+*/
+
+static uint32_t TPM_KeyHandleEntries_Hash(const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+					  TPM_KEY_HANDLE tpm_key_handle)
+{
+    uint32_t hash;
+
+    hash = tpm_key_handle * 0x9e3779b1;
+    hash ^= hash >> 16;
+    return hash & (tpm_key_handle_entries->hashSize - 1);
+}
+
+/* TPM_KeyHandleEntries_Remove() unlinks the occupied 'slot' from its hash chain, empties it, and
+   returns it to the free list.  The TPM_KEY is not deleted.
+*/
+
+static void TPM_KeyHandleEntries_Remove(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+					uint32_t slot)
+{
+    uint32_t *link;
+
+    link = &(tpm_key_handle_entries->buckets
+	     [TPM_KeyHandleEntries_Hash(tpm_key_handle_entries,
+					tpm_key_handle_entries->entries[slot].handle)]);
+    while ((*link != 0) && (*link != (slot + 1))) {
+	link = &(tpm_key_handle_entries->next[*link - 1]);
+    }
+    if (*link != 0) {
+	*link = tpm_key_handle_entries->next[slot];
+    }
+    if (tpm_key_handle_entries->entries[slot].keyControl & TPM_KEY_CONTROL_OWNER_EVICT) {
+	TPM_KeyHandleEntries_OwnerEvictRemove(tpm_key_handle_entries, slot);
     }
+    TPM_KeyHandleEntry_Init(&(tpm_key_handle_entries->entries[slot]));
+    tpm_key_handle_entries->next[slot] = tpm_key_handle_entries->freeHead;
+    tpm_key_handle_entries->freeHead = slot + 1;
+    tpm_key_handle_entries->freeCount++;
     return;
 }
 
@@ -3189,10 +3528,10 @@ TPM_RESULT TPM_KeyHandleEntries_Load(tpm_state_t *tpm_state,
     }
     /* sanity check that keyCount not greater than key slots */
     if (rc == 0) {
-	if (keyCount > TPM_KEY_HANDLES) {
+	if (keyCount > tpm_state->tpm_key_handle_entries.keyHandles) {
 	    printf("TPM_KeyHandleEntries_Load: Error (fatal)"
-		   " key handles in stream %u greater than %d\n",
-		   keyCount, TPM_KEY_HANDLES);
+		   " key handles in stream %u greater than %u\n",
+		   keyCount, tpm_state->tpm_key_handle_entries.keyHandles);
 	    rc = TPM_FAIL;
 	}
     }    
@@ -3211,7 +3550,7 @@ TPM_RESULT TPM_KeyHandleEntries_Load(tpm_state_t *tpm_state,
 	       handle was saved twice.	*/
 	    rc = TPM_KeyHandleEntries_AddEntry(&(tpm_key_handle_entry.handle), 	/* suggested */
 					       TRUE,				/* keep handle */
-					       tpm_state->tpm_key_handle_entries,
+					       &(tpm_state->tpm_key_handle_entries),
 					       &tpm_key_handle_entry);
 	}
 	/* if there was an error copying the entry to the array, the entry must be delete'd to
@@ -3252,7 +3591,7 @@ TPM_RESULT TPM_KeyHandleEntries_Store(TPM_STORE_BUFFER *sbuffer,
 	   /* returns TPM_RETRY when at the end of the table, terminates loop */
 	   (TPM_KeyHandleEntries_GetNextEntry(&tpm_key_handle_entry,
 					      &current,
-					      tpm_state->tpm_key_handle_entries,
+					      &(tpm_state->tpm_key_handle_entries),
 					      start)) == 0) {
 	TPM_SaveState_IsSaveKey(&save, tpm_key_handle_entry);
 	if (save) {
@@ -3274,7 +3613,7 @@ TPM_RESULT TPM_KeyHandleEntries_Store(TPM_STORE_BUFFER *sbuffer,
 	   /* returns TPM_RETRY when at the end of the table, terminates loop */
 	   (TPM_KeyHandleEntries_GetNextEntry(&tpm_key_handle_entry,
 					      &current,
-					      tpm_state->tpm_key_handle_entries,
+					      &(tpm_state->tpm_key_handle_entries),
 					      start)) == 0) {
 	TPM_SaveState_IsSaveKey(&save, tpm_key_handle_entry);
 	if (save) {
@@ -3301,26 +3640,24 @@ TPM_RESULT TPM_KeyHandleEntries_Store(TPM_STORE_BUFFER *sbuffer,
 */
 
 TPM_RESULT TPM_KeyHandleEntries_StoreHandles(TPM_STORE_BUFFER *sbuffer,
-					     const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
+					     const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries)
 {
     TPM_RESULT	rc = 0;
-    uint16_t	i, loadedCount;
+    uint32_t	i;
+    uint16_t	loadedCount;
     
     printf(" TPM_KeyHandleEntries_StoreHandles:\n");
     if (rc == 0) {
-	loadedCount = 0;
-	/* count the number of loaded handles */
-	for (i = 0 ; i < TPM_KEY_HANDLES ; i++) {
-	    if (tpm_key_handle_entries[i].key != NULL) {
-		loadedCount++;
-	    }
-	}
+	/* the number of loaded handles */
+	loadedCount = tpm_key_handle_entries->keyHandles - tpm_key_handle_entries->freeCount;
 	/* store 'loaded' handle count */
 	rc = TPM_Sbuffer_Append16(sbuffer, loadedCount); 
     }
-    for (i = 0 ; (rc == 0) && (i < TPM_KEY_HANDLES) ; i++) {
-	if (tpm_key_handle_entries[i].key != NULL) {	/* if the index is loaded */
-	    rc = TPM_Sbuffer_Append32(sbuffer, tpm_key_handle_entries[i].handle); /* store it */
+    for (i = 0 ; (rc == 0) && (i < tpm_key_handle_entries->keyHandles) ; i++) {
+	/* if the index is loaded */
+	if (tpm_key_handle_entries->entries[i].key != NULL) {
+	    /* store it */
+	    rc = TPM_Sbuffer_Append32(sbuffer, tpm_key_handle_entries->entries[i].handle);
 	}
     }
     return rc;
@@ -3332,7 +3669,7 @@ TPM_RESULT TPM_KeyHandleEntries_StoreHandles(TPM_STORE_BUFFER *sbuffer,
    the table.
 */
 
-TPM_RESULT TPM_KeyHandleEntries_DeleteHandle(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+TPM_RESULT TPM_KeyHandleEntries_DeleteHandle(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
 					     TPM_KEY_HANDLE tpm_key_handle)
 {
     TPM_RESULT	rc = 0;
@@ -3351,27 +3688,47 @@ TPM_RESULT TPM_KeyHandleEntries_DeleteHandle(TPM_KEY_HANDLE_ENTRY *tpm_key_handl
     }
     /* delete the entry */
     if (rc == 0) {
-	TPM_KeyHandleEntry_Init(tpm_key_handle_entry);
+	TPM_KeyHandleEntries_Remove(tpm_key_handle_entries,
+				    tpm_key_handle_entry - tpm_key_handle_entries->entries);
     }
     return rc;
 }
 
+/* TPM_KeyHandleEntries_DeleteEntry() deletes and frees the TPM_KEY of an entry in the table, and
+   removes the entry from the table.
+*/
+
+void TPM_KeyHandleEntries_DeleteEntry(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+				      TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry)
+{
+    if (tpm_key_handle_entry->key != NULL) {
+	printf(" TPM_KeyHandleEntries_DeleteEntry: Deleting %08x\n", tpm_key_handle_entry->handle);
+	TPM_Key_Delete(tpm_key_handle_entry->key);
+	free(tpm_key_handle_entry->key);
+	TPM_KeyHandleEntries_Remove(tpm_key_handle_entries,
+				    tpm_key_handle_entry - tpm_key_handle_entries->entries);
+    }
+    return;
+}
+
 /* TPM_KeyHandleEntries_IsSpace() returns 'isSpace' TRUE if an entry is available, FALSE if not.
 
-   If TRUE, 'index' holds the first free position.
+   If TRUE, 'index' holds the position at the head of the free list.
 */
 
 void TPM_KeyHandleEntries_IsSpace(TPM_BOOL *isSpace,
 				  uint32_t *index,
-				  const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
+				  const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries)
 {
     printf(" TPM_KeyHandleEntries_IsSpace:\n");
-    for (*index = 0, *isSpace = FALSE ; *index < TPM_KEY_HANDLES ; (*index)++) {
-	if (tpm_key_handle_entries[*index].key == NULL) {	/* if the index is empty */
-	    printf("  TPM_KeyHandleEntries_IsSpace: Found space at %u\n", *index);
-	    *isSpace = TRUE;
-	    break;
-	}
+    if (tpm_key_handle_entries->freeHead != 0) {
+	*index = tpm_key_handle_entries->freeHead - 1;
+	printf("  TPM_KeyHandleEntries_IsSpace: Found space at %u\n", *index);
+	*isSpace = TRUE;
+    }
+    else {
+	*index = tpm_key_handle_entries->keyHandles;
+	*isSpace = FALSE;
     }
     return;
 }
@@ -3381,16 +3738,10 @@ void TPM_KeyHandleEntries_IsSpace(TPM_BOOL *isSpace,
 */
 
 void TPM_KeyHandleEntries_GetSpace(uint32_t *space,
-				   const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
+				   const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries)
 {
-    uint32_t i;
-
     printf(" TPM_KeyHandleEntries_GetSpace:\n");
-    for (*space = 0 , i = 0 ; i < TPM_KEY_HANDLES ; i++) {
-	if (tpm_key_handle_entries[i].key == NULL) {	/* if the index is empty */
-	    (*space)++;
-	}	    
-    }
+    *space = tpm_key_handle_entries->freeCount;
     return;
 }
 
@@ -3399,22 +3750,13 @@ void TPM_KeyHandleEntries_GetSpace(uint32_t *space,
 */
 
 void TPM_KeyHandleEntries_IsEvictSpace(TPM_BOOL *isSpace,
-				       const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+				       const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
 				       uint32_t minSpace)
 {
     uint32_t evictSpace;
-    uint32_t i;
 
-    for (i = 0,	 evictSpace = 0 ; i < TPM_KEY_HANDLES ; i++) {
-	if (tpm_key_handle_entries[i].key == NULL) {	/* if the index is empty */
-	    evictSpace++;
-	}
-	else {							/* is index is used */
-	    if (!(tpm_key_handle_entries[i].keyControl & TPM_KEY_CONTROL_OWNER_EVICT)) {
-		evictSpace++;	/* space that can be evicted */
-	    }
-	}
-    }
+    /* empty slots and slots holding keys that can be evicted */
+    evictSpace = tpm_key_handle_entries->keyHandles - tpm_key_handle_entries->ownerEvictCount;
     printf(" TPM_KeyHandleEntries_IsEvictSpace: evictable space, minimum %u free %u\n",
 	   minSpace, evictSpace);
     if (evictSpace >= minSpace) {
@@ -3435,7 +3777,7 @@ void TPM_KeyHandleEntries_IsEvictSpace(TPM_BOOL *isSpace,
 */
 
 TPM_RESULT TPM_KeyHandleEntries_AddKeyEntry(TPM_KEY_HANDLE *tpm_key_handle,		/* i/o */
-					    TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries, /* in */
+					    TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries, /* in */
 					    TPM_KEY *tpm_key,
 					    TPM_BOOL parentPCRStatus,
 					    TPM_KEY_CONTROL keyControl)
@@ -3444,6 +3786,7 @@ TPM_RESULT TPM_KeyHandleEntries_AddKeyEntry(TPM_KEY_HANDLE *tpm_key_handle,		/*
     TPM_KEY_HANDLE_ENTRY	tpm_key_handle_entry;
 
     printf(" TPM_KeyHandleEntries_AddKeyEntry:\n");
+    TPM_KeyHandleEntry_Init(&tpm_key_handle_entry);
     tpm_key_handle_entry.key = tpm_key;
     tpm_key_handle_entry.parentPCRStatus = parentPCRStatus;
     tpm_key_handle_entry.keyControl = keyControl;
@@ -3471,13 +3814,15 @@ TPM_RESULT TPM_KeyHandleEntries_AddKeyEntry(TPM_KEY_HANDLE *tpm_key_handle,		/*
 
 TPM_RESULT TPM_KeyHandleEntries_AddEntry(TPM_KEY_HANDLE *tpm_key_handle,		/* i/o */
 					 TPM_BOOL keepHandle,				/* input */
-					 TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,	/* input */
+					 TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,	/* input */
 					 TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry)	/* input */
 					 
 {
     TPM_RESULT			rc = 0;
     uint32_t			index;
+    uint32_t			bucket;
     TPM_BOOL			isSpace;
+    TPM_KEY_HANDLE_ENTRY	*entry;
     
     printf(" TPM_KeyHandleEntries_AddEntry: handle %08x, keepHandle %u\n",
 	   *tpm_key_handle, keepHandle);
@@ -3496,6 +3841,13 @@ TPM_RESULT TPM_KeyHandleEntries_AddEntry(TPM_KEY_HANDLE *tpm_key_handle,		/* i/o
 	    rc = TPM_NOSPACE;
 	}
     }
+    if ((rc == 0) && (tpm_key_handle_entry->keyControl & TPM_KEY_CONTROL_OWNER_EVICT)) {
+	if (tpm_key_handle_entries->ownerEvictCount >=
+	    tpm_key_handle_entries->ownerEvictKeyHandles) {
+	    printf("TPM_KeyHandleEntries_AddEntry: Error, owner evict entries full\n");
+	    rc = TPM_NOSPACE;
+	}
+    }
     if (rc == 0) {
 	rc = TPM_Handle_GenerateHandle(tpm_key_handle,			/* I/O */
 				       tpm_key_handle_entries,		/* handle array */
@@ -3503,35 +3855,55 @@ TPM_RESULT TPM_KeyHandleEntries_AddEntry(TPM_KEY_HANDLE *tpm_key_handle,		/* i/o
 				       TRUE,				/* isKeyHandle */
 				       (TPM_GETENTRY_FUNCTION_T)TPM_KeyHandleEntries_GetEntry);
     }
-    if (rc == 0) {
-	tpm_key_handle_entries[index].handle = *tpm_key_handle;
-	tpm_key_handle_entries[index].key = tpm_key_handle_entry->key;
-	tpm_key_handle_entries[index].keyControl = tpm_key_handle_entry->keyControl;
-	tpm_key_handle_entries[index].parentPCRStatus = tpm_key_handle_entry->parentPCRStatus;
+    /* take the slot from the free list and chain it from the handle hash */
+    if (rc == 0) {
+	tpm_key_handle_entries->freeHead = tpm_key_handle_entries->next[index];
+	tpm_key_handle_entries->freeCount--;
+	entry = &(tpm_key_handle_entries->entries[index]);
+	entry->handle = *tpm_key_handle;
+	entry->key = tpm_key_handle_entry->key;
+	entry->keyControl = tpm_key_handle_entry->keyControl;
+	entry->parentPCRStatus = tpm_key_handle_entry->parentPCRStatus;
+	entry->lazyKey = tpm_key_handle_entry->lazyKey;
+	entry->keyCopy = tpm_key_handle_entry->keyCopy;
+	TPM_Digest_Copy(entry->keyDigest, tpm_key_handle_entry->keyDigest);
+	bucket = TPM_KeyHandleEntries_Hash(tpm_key_handle_entries, entry->handle);
+	tpm_key_handle_entries->next[index] = tpm_key_handle_entries->buckets[bucket];
+	tpm_key_handle_entries->buckets[bucket] = index + 1;
+	if (entry->keyControl & TPM_KEY_CONTROL_OWNER_EVICT) {
+	    TPM_KeyHandleEntries_OwnerEvictInsert(tpm_key_handle_entries, index);
+	}
 	printf("  TPM_KeyHandleEntries_AddEntry: Index %u key handle %08x key pointer %p\n",
-	       index, tpm_key_handle_entries[index].handle, tpm_key_handle_entries[index].key);
+	       index, entry->handle, entry->key);
     }
     return rc;
 }
 
-/* TPM_KeyHandleEntries_GetEntry() searches all entries for the entry matching the handle, and
+/* TPM_KeyHandleEntries_GetEntry() searches the hash chain for the entry matching the handle, and
    returns that entry */
 
 TPM_RESULT TPM_KeyHandleEntries_GetEntry(TPM_KEY_HANDLE_ENTRY **tpm_key_handle_entry,
-					 TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+					 TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
 					 TPM_KEY_HANDLE tpm_key_handle)
 {
     TPM_RESULT	rc = 0;
-    size_t	i;
-    TPM_BOOL	found;
+    uint32_t	link;
+    TPM_BOOL	found = FALSE;
+    TPM_KEY_HANDLE_ENTRY *entry;
 
     printf(" TPM_KeyHandleEntries_GetEntry: Get entry for handle %08x\n", tpm_key_handle);
-    for (i = 0, found = FALSE ; (i < TPM_KEY_HANDLES) && !found ; i++) {
-	/* first test for matching handle.  Then check for non-NULL to insure that entry is valid */
-	if ((tpm_key_handle_entries[i].handle == tpm_key_handle) &&
-	    tpm_key_handle_entries[i].key != NULL) {	/* found */
-	    found = TRUE;
-	    *tpm_key_handle_entry = &(tpm_key_handle_entries[i]);
+    if (tpm_key_handle_entries->keyHandles != 0) {
+	for (link = tpm_key_handle_entries->buckets
+		    [TPM_KeyHandleEntries_Hash(tpm_key_handle_entries, tpm_key_handle)] ;
+	     (link != 0) && !found ;
+	     link = tpm_key_handle_entries->next[link - 1]) {
+	    entry = &(tpm_key_handle_entries->entries[link - 1]);
+	    /* first test for matching handle.  Then check for non-NULL to insure that entry is
+	       valid */
+	    if ((entry->handle == tpm_key_handle) && (entry->key != NULL)) {	/* found */
+		found = TRUE;
+		*tpm_key_handle_entry = entry;
+	    }
 	}
     }
     if (!found) {
@@ -3558,15 +3930,15 @@ TPM_RESULT TPM_KeyHandleEntries_GetEntry(TPM_KEY_HANDLE_ENTRY **tpm_key_handle_e
 
 TPM_RESULT TPM_KeyHandleEntries_GetNextEntry(TPM_KEY_HANDLE_ENTRY **tpm_key_handle_entry,
 					     size_t *current,
-					     TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+					     TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
 					     size_t start)
 {
     TPM_RESULT	rc = TPM_RETRY;
 
     printf(" TPM_KeyHandleEntries_GetNextEntry: Start %lu\n", (unsigned long)start);
-    for (*current = start ; *current < TPM_KEY_HANDLES ; (*current)++) {
-	if (tpm_key_handle_entries[*current].key != NULL) {
-	    *tpm_key_handle_entry = &(tpm_key_handle_entries[*current]);
+    for (*current = start ; *current < tpm_key_handle_entries->keyHandles ; (*current)++) {
+	if (tpm_key_handle_entries->entries[*current].key != NULL) {
+	    *tpm_key_handle_entry = &(tpm_key_handle_entries->entries[*current]);
 	    rc = 0;	/* found an entry */
 	    break;
 	}
@@ -3654,7 +4026,7 @@ TPM_RESULT TPM_KeyHandleEntries_GetKey(TPM_KEY **tpm_key,
     /* If not one of the special key handles, search for the handle in the list */
     if ((rc == 0) && !found) {
 	rc = TPM_KeyHandleEntries_GetEntry(&tpm_key_handle_entry,
-					   tpm_state->tpm_key_handle_entries,
+					   &(tpm_state->tpm_key_handle_entries),
 					   tpm_key_handle);
 	if (rc != 0) {
 	    printf("TPM_KeyHandleEntries_GetKey: Error, key handle %08x not found\n",
@@ -3664,6 +4036,10 @@ TPM_RESULT TPM_KeyHandleEntries_GetKey(TPM_KEY **tpm_key,
     /* Part 1 25.1 Validate Key for use 
        2. Set LK to the loaded key that is being used */
     /* NOTE:  For special handle keys, this was already done.  Just do here for keys in table */
+    /* an owner evict key is read from NV on first use */
+    if ((rc == 0) && !found) {
+	rc = TPM_KeyHandleEntry_LoadKey(tpm_key_handle_entry, tpm_state->tpm_number);
+    }
     if ((rc == 0) && !found) {
 	*tpm_key = tpm_key_handle_entry->key;
 	*parentPCRStatus = tpm_key_handle_entry->parentPCRStatus;
@@ -3690,7 +4066,7 @@ TPM_RESULT TPM_KeyHandleEntries_GetKey(TPM_KEY **tpm_key,
 /* TPM_KeyHandleEntries_SetParentPCRStatus() updates the parentPCRStatus member of the
    TPM_KEY_HANDLE_ENTRY */
 
-TPM_RESULT TPM_KeyHandleEntries_SetParentPCRStatus(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+TPM_RESULT TPM_KeyHandleEntries_SetParentPCRStatus(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
 						   TPM_KEY_HANDLE tpm_key_handle,
 						   TPM_BOOL parentPCRStatus)
 {
@@ -3716,16 +4092,29 @@ TPM_RESULT TPM_KeyHandleEntries_SetParentPCRStatus(TPM_KEY_HANDLE_ENTRY *tpm_key
 
 /* TPM_KeyHandleEntries_OwnerEvictLoad() loads all owner evict keys from the stream into the key
    handle entries table.
+
+   A TPM_TAG_NVSTATE_OE_V2 stream holds the digest and NV file copy of each key.  The key is added
+   as a placeholder and read from its NV file by TPM_KeyHandleEntry_LoadKey() on first use, so
+   that an agent's persistent keys cost nothing until they are used.
+
+   The table may already hold owner evict keys, when the section is restored from a snapshot.
+   Keys matching the stream are kept, so that the snapshot of a deferred NV write does not refer
+   to an NV file that was never written.  Other owner evict keys are deleted.
 */
 
-TPM_RESULT TPM_KeyHandleEntries_OwnerEvictLoad(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+TPM_RESULT TPM_KeyHandleEntries_OwnerEvictLoad(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
 					       unsigned char **stream,
 					       uint32_t *stream_size)
 {
     TPM_RESULT		rc = 0;
     uint16_t 		keyCount;
     uint16_t		i;		/* the uint16_t corresponds to the standard getcap */
+    uint32_t		j;
     TPM_KEY_HANDLE_ENTRY tpm_key_handle_entry;	/* each entry as read from the stream */
+    TPM_KEY_HANDLE_ENTRY *records = NULL;	/* V2 entries as read from the stream */
+    TPM_KEY_HANDLE_ENTRY *entry;
+    TPM_KEY_HANDLE_ENTRY *record;
+    TPM_DIGEST		keyDigest;
     TPM_TAG		ownerEvictVersion;
 
     printf(" TPM_KeyHandleEntries_OwnerEvictLoad:\n");
@@ -3734,7 +4123,8 @@ TPM_RESULT TPM_KeyHandleEntries_OwnerEvictLoad(TPM_KEY_HANDLE_ENTRY *tpm_key_han
 	rc = TPM_Load16(&ownerEvictVersion, stream, stream_size); 
     }
     if (rc == 0) {
-	if (ownerEvictVersion != TPM_TAG_NVSTATE_OE_V1) {
+	if ((ownerEvictVersion != TPM_TAG_NVSTATE_OE_V1) &&
+	    (ownerEvictVersion != TPM_TAG_NVSTATE_OE_V2)) {
 	    printf("TPM_KeyHandleEntries_OwnerEvictLoad: "
 		   "Error (fatal) unsupported version tag %04x\n",
 		   ownerEvictVersion);
@@ -3745,19 +4135,25 @@ TPM_RESULT TPM_KeyHandleEntries_OwnerEvictLoad(TPM_KEY_HANDLE_ENTRY *tpm_key_han
     if (rc == 0) {
 	rc = TPM_Load16(&keyCount, stream, stream_size); 
     }
-    /* sanity check that keyCount not greater than key slots */
+    /* sanity check that keyCount not greater than owner evict key slots */
     if (rc == 0) {
-	if (keyCount > TPM_OWNER_EVICT_KEY_HANDLES) {
+	if (keyCount > tpm_key_handle_entries->ownerEvictKeyHandles) {
 	    printf("TPM_KeyHandleEntries_OwnerEvictLoad: Error (fatal)"
-		   " key handles in stream %u greater than %d\n",
-		   keyCount, TPM_OWNER_EVICT_KEY_HANDLES);
+		   " key handles in stream %u greater than %u\n",
+		   keyCount, tpm_key_handle_entries->ownerEvictKeyHandles);
 	    rc = TPM_FAIL;
 	}
     }    
     if (rc == 0) {
-	printf("  TPM_KeyHandleEntries_OwnerEvictLoad: Count %hu\n", keyCount);
+	printf("  TPM_KeyHandleEntries_OwnerEvictLoad: Version %04hx count %hu\n",
+	       ownerEvictVersion, keyCount);
     }
-    for (i = 0 ; (rc == 0) && (i < keyCount) ; i++) {
+    /* V1 holds the keys in the stream */
+    if ((rc == 0) && (ownerEvictVersion == TPM_TAG_NVSTATE_OE_V1)) {
+	TPM_KeyHandleEntries_OwnerEvictDelete(tpm_key_handle_entries);
+    }
+    for (i = 0 ; (rc == 0) && (ownerEvictVersion == TPM_TAG_NVSTATE_OE_V1) && (i < keyCount) ;
+	 i++) {
 	/* Must init each time through.  This just resets the structure members.  It does not free
 	   the key that is in the structure after the first time through.  That key has been added
 	   (copied) to the key handle entries array. */
@@ -3779,26 +4175,125 @@ TPM_RESULT TPM_KeyHandleEntries_OwnerEvictLoad(TPM_KEY_HANDLE_ENTRY *tpm_key_han
 	    TPM_KeyHandleEntry_Delete(&tpm_key_handle_entry);	/* @2 on error */
 	}	
     }
+    /* V2 holds the key digests, sorted by handle */
+    if ((rc == 0) && (ownerEvictVersion == TPM_TAG_NVSTATE_OE_V2) && (keyCount > 0)) {
+	rc = TPM_Malloc((unsigned char **)&records,		/* freed @1 */
+			keyCount * sizeof(TPM_KEY_HANDLE_ENTRY));
+    }
+    for (i = 0 ; (rc == 0) && (ownerEvictVersion == TPM_TAG_NVSTATE_OE_V2) && (i < keyCount) ;
+	 i++) {
+	record = &(records[i]);
+	TPM_KeyHandleEntry_Init(record);
+	if (rc == 0) {
+	    rc = TPM_Load32(&(record->handle), stream, stream_size);
+	}
+	if (rc == 0) {
+	    rc = TPM_LoadBool(&(record->parentPCRStatus), stream, stream_size);
+	}
+	if (rc == 0) {
+	    rc = TPM_Load32(&(record->keyControl), stream, stream_size);
+	}
+	if (rc == 0) {
+	    rc = TPM_Digest_Load(record->keyDigest, stream, stream_size);
+	}
+	if (rc == 0) {
+	    rc = TPM_Load8(&(record->keyCopy), stream, stream_size);
+	}
+	if (rc == 0) {
+	    if (!(record->keyControl & TPM_KEY_CONTROL_OWNER_EVICT) ||
+		(record->keyCopy > 1) ||
+		((i > 0) && (record->handle <= records[i - 1].handle))) {
+		printf("TPM_KeyHandleEntries_OwnerEvictLoad: Error (fatal) bad key %hu\n", i);
+		rc = TPM_FAIL;
+	    }
+	}
+    }
+    /* delete the owner evict keys that are not in the stream */
+    for (j = tpm_key_handle_entries->ownerEvictCount ;
+	 (rc == 0) && (ownerEvictVersion == TPM_TAG_NVSTATE_OE_V2) && (j > 0) ; j--) {
+	entry = &(tpm_key_handle_entries->entries[tpm_key_handle_entries->ownerEvict[j - 1]]);
+	record = NULL;
+	if (keyCount > 0) {
+	    record = bsearch(entry, records, keyCount, sizeof(TPM_KEY_HANDLE_ENTRY),
+			     TPM_KeyHandleEntry_CompareHandle);
+	}
+	if (record != NULL) {
+	    rc = TPM_KeyHandleEntry_GetKeyDigest(keyDigest, entry);
+	}
+	if ((rc == 0) &&
+	    ((record == NULL) ||
+	     (memcmp(keyDigest, record->keyDigest, TPM_DIGEST_SIZE) != 0))) {
+	    TPM_KeyHandleEntries_DeleteEntry(tpm_key_handle_entries, entry);
+	}
+    }
+    for (i = 0 ; (rc == 0) && (ownerEvictVersion == TPM_TAG_NVSTATE_OE_V2) && (i < keyCount) ;
+	 i++) {
+	record = &(records[i]);
+	/* keep a key that is already loaded */
+	if (TPM_KeyHandleEntries_GetEntry(&entry, tpm_key_handle_entries, record->handle) == 0) {
+	    rc = TPM_KeyHandleEntry_GetKeyDigest(keyDigest, entry);
+	    if ((rc == 0) && (memcmp(keyDigest, record->keyDigest, TPM_DIGEST_SIZE) == 0)) {
+		if (!(entry->keyControl & TPM_KEY_CONTROL_OWNER_EVICT)) {
+		    rc = TPM_KeyHandleEntries_SetOwnerEvict(tpm_key_handle_entries, entry, TRUE);
+		}
+		if (rc == 0) {
+		    entry->parentPCRStatus = record->parentPCRStatus;
+		    entry->keyControl = record->keyControl;
+		    entry->keyCopy = record->keyCopy;
+		    TPM_Digest_Copy(entry->keyDigest, record->keyDigest);
+		}
+		continue;
+	    }
+	    /* a different key holds the handle */
+	    if (rc == 0) {
+		TPM_KeyHandleEntries_DeleteEntry(tpm_key_handle_entries, entry);
+	    }
+	}
+	/* add a placeholder */
+	if (rc == 0) {
+	    printf("  TPM_KeyHandleEntries_OwnerEvictLoad: Adding key handle %08x\n",
+		   record->handle);
+	    rc = TPM_Malloc((unsigned char **)&(record->key), sizeof(TPM_KEY));
+	}
+	if (rc == 0) {
+	    TPM_Key_Init(record->key);
+	    record->lazyKey = TRUE;
+	    rc = TPM_KeyHandleEntries_AddEntry(&(record->handle),	/* suggested */
+					       TRUE,			/* keep handle */
+					       tpm_key_handle_entries,
+					       record);
+	    if (rc != 0) {
+		free(record->key);
+	    }
+	}
+    }
+    free(records);		/* @1 */
     return rc;
 }
     
-/* TPM_KeyHandleEntries_OwnerEvictStore() stores all owner evict keys from the key handle entries
+/* TPM_KeyHandleEntries_OwnerEvictStore() stores the owner evict keys from the key handle entries
    table to the stream.
 
-   It is used to serialize to NVRAM.
+   It is used to serialize to NVRAM.  Each key is stored as its digest and NV file copy, see
+   TPM_KeyHandleEntries_OwnerEvictNVStore().  A key not yet digested is assigned the NV file copy
+   not holding a different key in 'tpm_owner_evict_files', so that an interrupted update leaves the
+   copy that the NV section still records.
 */
 
 TPM_RESULT TPM_KeyHandleEntries_OwnerEvictStore(TPM_STORE_BUFFER *sbuffer,
-						const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
+						TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+						const TPM_OWNER_EVICT_FILES *tpm_owner_evict_files)
 {
     TPM_RESULT	rc = 0;
     uint16_t 	count;
-    uint16_t	i;		/* the uint16_t corresponds to the standard getcap */
+    uint32_t	i;
+    TPM_KEY_HANDLE_ENTRY *entry;
+    TPM_OWNER_EVICT_FILE *tpm_owner_evict_file;
 
     printf(" TPM_KeyHandleEntries_OwnerEvictStore:\n");
     /* append the owner evict version number to the stream */
     if (rc == 0) {
-	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_NVSTATE_OE_V1); 
+	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_NVSTATE_OE_V2); 
     }
     /* count the number of owner evict keys */
     if (rc == 0) {
@@ -3808,15 +4303,43 @@ TPM_RESULT TPM_KeyHandleEntries_OwnerEvictStore(TPM_STORE_BUFFER *sbuffer,
     if (rc == 0) {
 	rc = TPM_Sbuffer_Append16(sbuffer, count); 
     }
-    for (i = 0 ; (rc == 0) && (i < TPM_KEY_HANDLES) ; i++) {
-	/* if the slot is occupied */
-	if (tpm_key_handle_entries[i].key != NULL) {
-	    /* if the key is owner evict */
-	    if ((tpm_key_handle_entries[i].keyControl & TPM_KEY_CONTROL_OWNER_EVICT)) {
-		/* store it */
-		rc = TPM_KeyHandleEntry_Store(sbuffer, &(tpm_key_handle_entries[i]));
+    for (i = 0 ; (rc == 0) && (i < tpm_key_handle_entries->ownerEvictCount) ; i++) {
+	entry = &(tpm_key_handle_entries->entries[tpm_key_handle_entries->ownerEvict[i]]);
+	/* digest a new owner evict key and assign its NV file copy */
+	if (entry->keyCopy == TPM_KEY_COPY_NONE) {
+	    rc = TPM_KeyHandleEntry_GetKeyDigest(entry->keyDigest, entry);
+	    if (rc == 0) {
+		tpm_owner_evict_file = TPM_OwnerEvictFiles_Find(tpm_owner_evict_files,
+								entry->handle);
+		if (tpm_owner_evict_file == NULL) {
+		    entry->keyCopy = 0;
+		}
+		else if (memcmp(tpm_owner_evict_file->keyDigest, entry->keyDigest,
+				TPM_DIGEST_SIZE) == 0) {
+		    entry->keyCopy = tpm_owner_evict_file->keyCopy;
+		}
+		else {
+		    entry->keyCopy = tpm_owner_evict_file->keyCopy ^ 1;
+		}
+		printf("  TPM_KeyHandleEntries_OwnerEvictStore: Key handle %08x copy %u\n",
+		       entry->handle, entry->keyCopy);
 	    }
 	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append32(sbuffer, entry->handle);
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append(sbuffer, &(entry->parentPCRStatus), sizeof(TPM_BOOL)); 
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append32(sbuffer, entry->keyControl);
+	}
+	if (rc == 0) {
+	    rc = TPM_Digest_Store(sbuffer, entry->keyDigest);
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append(sbuffer, &(entry->keyCopy), sizeof(BYTE));
+	}
     }
     return rc;
 }
@@ -3826,33 +4349,68 @@ TPM_RESULT TPM_KeyHandleEntries_OwnerEvictStore(TPM_STORE_BUFFER *sbuffer,
 
 TPM_RESULT
 TPM_KeyHandleEntries_OwnerEvictGetCount(uint16_t *count,
-					const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
+					const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries)
 {
     TPM_RESULT	rc = 0;
-    uint16_t	i;		/* the uint16_t corresponds to the standard getcap */
 
     printf(" TPM_KeyHandleEntries_OwnerEvictGetCount:\n");
-    /* count the number of loaded owner evict handles */
-    if (rc == 0) {
-	for (i = 0 , *count = 0 ; i < TPM_KEY_HANDLES ; i++) {
-	    /* if the slot is occupied */
-	    if (tpm_key_handle_entries[i].key != NULL) {
-		/* if the key is owner evict */
-		if ((tpm_key_handle_entries[i].keyControl & TPM_KEY_CONTROL_OWNER_EVICT)) {
-		    (*count)++;		/* count it */
-		}
-	    }
-	}
-	printf("  TPM_KeyHandleEntries_OwnerEvictGetCount: Count %hu\n", *count);
-    }
     /* sanity check */
     if (rc == 0) {
-	if (*count > TPM_OWNER_EVICT_KEY_HANDLES) {
+	if (tpm_key_handle_entries->ownerEvictCount >
+	    tpm_key_handle_entries->ownerEvictKeyHandles) {
 	    printf("TPM_KeyHandleEntries_OwnerEvictGetCount: Error (fatal), "
-		   "count greater that max %u\n", TPM_OWNER_EVICT_KEY_HANDLES);
+		   "count greater that max %u\n", tpm_key_handle_entries->ownerEvictKeyHandles);
 	    rc = TPM_FAIL;	/* should never occur */
 	}
     }
+    if (rc == 0) {
+	*count = tpm_key_handle_entries->ownerEvictCount;
+	printf("  TPM_KeyHandleEntries_OwnerEvictGetCount: Count %hu\n", *count);
+    }
+    return rc;
+}
+
+/* TPM_KeyHandleEntries_SetOwnerEvict() sets or clears the owner evict bit of a key handle entry.
+
+   Returns TPM_NOSPACE if the owner evict keys are at the maximum.
+*/
+
+TPM_RESULT TPM_KeyHandleEntries_SetOwnerEvict(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+					      TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry,
+					      TPM_BOOL ownerEvict)
+{
+    TPM_RESULT	rc = 0;
+    uint32_t	slot;
+
+    printf(" TPM_KeyHandleEntries_SetOwnerEvict: Handle %08x ownerEvict %u\n",
+	   tpm_key_handle_entry->handle, ownerEvict);
+    slot = tpm_key_handle_entry - tpm_key_handle_entries->entries;
+    if (ownerEvict && !(tpm_key_handle_entry->keyControl & TPM_KEY_CONTROL_OWNER_EVICT)) {
+	if (tpm_key_handle_entries->ownerEvictCount >=
+	    tpm_key_handle_entries->ownerEvictKeyHandles) {
+	    printf("TPM_KeyHandleEntries_SetOwnerEvict: Error, "
+		   "no evict space, only %u evict slots\n",
+		   tpm_key_handle_entries->ownerEvictKeyHandles);
+	    rc = TPM_NOSPACE;
+	}
+	if (rc == 0) {
+	    tpm_key_handle_entry->keyControl |= TPM_KEY_CONTROL_OWNER_EVICT;
+	    /* the NV file copy is assigned at the next store */
+	    tpm_key_handle_entry->keyCopy = TPM_KEY_COPY_NONE;
+	    TPM_KeyHandleEntries_OwnerEvictInsert(tpm_key_handle_entries, slot);
+	}
+    }
+    else if (!ownerEvict && (tpm_key_handle_entry->keyControl & TPM_KEY_CONTROL_OWNER_EVICT)) {
+	/* a key that is not owner evict must be in memory */
+	if (tpm_key_handle_entry->lazyKey) {
+	    printf("TPM_KeyHandleEntries_SetOwnerEvict: Error (fatal), key not loaded\n");
+	    rc = TPM_FAIL;
+	}
+	if (rc == 0) {
+	    TPM_KeyHandleEntries_OwnerEvictRemove(tpm_key_handle_entries, slot);
+	    tpm_key_handle_entry->keyControl &= ~TPM_KEY_CONTROL_OWNER_EVICT;
+	}
+    }
     return rc;
 }
 
@@ -3860,22 +4418,274 @@ TPM_KeyHandleEntries_OwnerEvictGetCount(uint16_t *count,
 
 */
 
-void TPM_KeyHandleEntries_OwnerEvictDelete(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
+void TPM_KeyHandleEntries_OwnerEvictDelete(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries)
 {
-    uint16_t	i;		/* the uint16_t corresponds to the standard getcap */
+    uint32_t	slot;
 
-    for (i = 0 ; i < TPM_KEY_HANDLES ; i++) {
-	/* if the slot is occupied */
-	if (tpm_key_handle_entries[i].key != NULL) {
-	    /* if the key is owner evict */
-	    if ((tpm_key_handle_entries[i].keyControl & TPM_KEY_CONTROL_OWNER_EVICT)) {
-		TPM_KeyHandleEntry_Delete(&(tpm_key_handle_entries[i]));
-	    }
+    /* each delete removes the slot from the owner evict index */
+    while (tpm_key_handle_entries->ownerEvictCount > 0) {
+	slot = tpm_key_handle_entries->ownerEvict[tpm_key_handle_entries->ownerEvictCount - 1];
+	TPM_KeyHandleEntries_DeleteEntry(tpm_key_handle_entries,
+					 &(tpm_key_handle_entries->entries[slot]));
+    }
+    return;
+}
+
+/* TPM_KeyHandleEntries_OwnerEvictInsert() adds the owner evict 'slot' to the owner evict index,
+   keeping the index sorted by handle.  The caller checks for space.
+*/
+
+static void TPM_KeyHandleEntries_OwnerEvictInsert(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+						  uint32_t slot)
+{
+    uint32_t i;
+    TPM_KEY_HANDLE handle = tpm_key_handle_entries->entries[slot].handle;
+
+    for (i = tpm_key_handle_entries->ownerEvictCount ;
+	 (i > 0) &&
+	     (tpm_key_handle_entries->entries[tpm_key_handle_entries->ownerEvict[i - 1]].handle >
+	      handle) ;
+	 i--) {
+	tpm_key_handle_entries->ownerEvict[i] = tpm_key_handle_entries->ownerEvict[i - 1];
+    }
+    tpm_key_handle_entries->ownerEvict[i] = slot;
+    tpm_key_handle_entries->ownerEvictCount++;
+    return;
+}
+
+/* TPM_KeyHandleEntries_OwnerEvictRemove() removes the owner evict 'slot' from the owner evict
+   index */
+
+static void TPM_KeyHandleEntries_OwnerEvictRemove(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+						  uint32_t slot)
+{
+    uint32_t i;
+
+    for (i = 0 ; (i < tpm_key_handle_entries->ownerEvictCount) &&
+	     (tpm_key_handle_entries->ownerEvict[i] != slot) ; i++) ;
+    if (i < tpm_key_handle_entries->ownerEvictCount) {
+	tpm_key_handle_entries->ownerEvictCount--;
+	for ( ; i < tpm_key_handle_entries->ownerEvictCount ; i++) {
+	    tpm_key_handle_entries->ownerEvict[i] = tpm_key_handle_entries->ownerEvict[i + 1];
+	}
+    }
+    return;
+}
+
+/* TPM_KeyHandleEntry_CompareHandle() orders TPM_KEY_HANDLE_ENTRY by handle for bsearch() */
+
+static int TPM_KeyHandleEntry_CompareHandle(const void *a, const void *b)
+{
+    TPM_KEY_HANDLE handleA = ((const TPM_KEY_HANDLE_ENTRY *)a)->handle;
+    TPM_KEY_HANDLE handleB = ((const TPM_KEY_HANDLE_ENTRY *)b)->handle;
+
+    if (handleA < handleB) {
+	return -1;
+    }
+    if (handleA > handleB) {
+	return 1;
+    }
+    return 0;
+}
+
+/* TPM_KeyHandleEntries_OwnerEvictNVStore() writes the owner evict keys that differ from those
+   recorded in 'tpm_owner_evict_files', the keys last written to or read from NV.
+
+   Each key is written to the NV file copy recorded in its entry.  'new_owner_evict_files' returns
+   the keys now in NV.  The caller writes the section recording them and then calls
+   TPM_OwnerEvictFiles_Commit().
+*/
+
+TPM_RESULT TPM_KeyHandleEntries_OwnerEvictNVStore(TPM_OWNER_EVICT_FILES *new_owner_evict_files,
+						  TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+						  const TPM_OWNER_EVICT_FILES *tpm_owner_evict_files,
+						  uint32_t tpm_number)
+{
+    TPM_RESULT		rc = 0;
+    TPM_STORE_BUFFER	sbuffer;	/* key serialization */
+    const unsigned char *buffer;
+    uint32_t		length;
+    TPM_KEY_HANDLE_ENTRY *entry;
+    TPM_OWNER_EVICT_FILE *tpm_owner_evict_file;
+    TPM_OWNER_EVICT_FILE *new_owner_evict_file;
+    char		name[TPM_FILENAME_MAX];
+    uint32_t		i;
+
+    printf(" TPM_KeyHandleEntries_OwnerEvictNVStore:\n");
+    TPM_Sbuffer_Init(&sbuffer);			/* freed @1 */
+    TPM_OwnerEvictFiles_Delete(new_owner_evict_files);
+    if ((rc == 0) && (tpm_key_handle_entries->ownerEvictCount > 0)) {
+	rc = TPM_Malloc((unsigned char **)&(new_owner_evict_files->file),
+			tpm_key_handle_entries->ownerEvictCount * sizeof(TPM_OWNER_EVICT_FILE));
+    }
+    /* the owner evict index is sorted by handle, so the new files are as well */
+    for (i = 0 ; (rc == 0) && (i < tpm_key_handle_entries->ownerEvictCount) ; i++) {
+	entry = &(tpm_key_handle_entries->entries[tpm_key_handle_entries->ownerEvict[i]]);
+	/* the copy is assigned by TPM_KeyHandleEntries_OwnerEvictStore() */
+	if (entry->keyCopy == TPM_KEY_COPY_NONE) {
+	    printf("TPM_KeyHandleEntries_OwnerEvictNVStore: Error (fatal) "
+		   "key handle %08x has no copy\n", entry->handle);
+	    rc = TPM_FAIL;
+	    break;
+	}
+	new_owner_evict_file = &(new_owner_evict_files->file[new_owner_evict_files->count]);
+	new_owner_evict_files->count++;
+	new_owner_evict_file->handle = entry->handle;
+	new_owner_evict_file->keyCopy = entry->keyCopy;
+	TPM_Digest_Copy(new_owner_evict_file->keyDigest, entry->keyDigest);
+	/* unchanged since the last write */
+	tpm_owner_evict_file = TPM_OwnerEvictFiles_Find(tpm_owner_evict_files, entry->handle);
+	if ((tpm_owner_evict_file != NULL) &&
+	    (tpm_owner_evict_file->keyCopy == entry->keyCopy) &&
+	    (memcmp(tpm_owner_evict_file->keyDigest, entry->keyDigest, TPM_DIGEST_SIZE) == 0)) {
+	    continue;
+	}
+	/* a key that is neither in memory nor in NV was lost */
+	if (entry->lazyKey) {
+	    printf("TPM_KeyHandleEntries_OwnerEvictNVStore: Error (fatal) "
+		   "key handle %08x has no key\n", entry->handle);
+	    rc = TPM_FAIL;
+	}
+	if (rc == 0) {
+	    TPM_Sbuffer_Clear(&sbuffer);
+	    rc = TPM_Key_StoreClear(&sbuffer, FALSE, entry->key);
+	}
+	if (rc == 0) {
+	    TPM_KeyHandleEntry_KeyName(name, entry->handle, entry->keyCopy);
+	    printf("  TPM_KeyHandleEntries_OwnerEvictNVStore: Writing %s\n", name);
+	    TPM_Sbuffer_Get(&sbuffer, &buffer, &length);
+	    rc = TPM_NVRAM_StoreData(buffer,
+				     length,
+				     tpm_number,
+				     name);
 	}
     }
+    TPM_Sbuffer_Delete(&sbuffer);		/* @1 */
+    return rc;
+}
+
+/*
+  Owner Evict Files
+
+  The NV file copy and digest of each owner evict key as last written to or read from NV.  A key
+  is written only if its entry records a different copy or digest.
+*/
+
+/* TPM_OwnerEvictFiles_Init() initializes the TPM_OWNER_EVICT_FILES array */
+
+void TPM_OwnerEvictFiles_Init(TPM_OWNER_EVICT_FILES *tpm_owner_evict_files)
+{
+    tpm_owner_evict_files->count = 0;
+    tpm_owner_evict_files->file = NULL;
+    return;
+}
+
+/* TPM_OwnerEvictFiles_Delete() frees and reinitializes the TPM_OWNER_EVICT_FILES array.  It does
+   not delete the NV files.
+*/
+
+void TPM_OwnerEvictFiles_Delete(TPM_OWNER_EVICT_FILES *tpm_owner_evict_files)
+{
+    free(tpm_owner_evict_files->file);
+    TPM_OwnerEvictFiles_Init(tpm_owner_evict_files);
     return;
 }
 
+/* TPM_OwnerEvictFiles_Set() sets the TPM_OWNER_EVICT_FILES array from the owner evict keys loaded
+   from NV that are in their own NV files.
+*/
+
+TPM_RESULT TPM_OwnerEvictFiles_Set(TPM_OWNER_EVICT_FILES *tpm_owner_evict_files,
+				   const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries)
+{
+    TPM_RESULT		rc = 0;
+    const TPM_KEY_HANDLE_ENTRY *entry;
+    TPM_OWNER_EVICT_FILE *tpm_owner_evict_file;
+    uint32_t		i;
+
+    printf(" TPM_OwnerEvictFiles_Set:\n");
+    TPM_OwnerEvictFiles_Delete(tpm_owner_evict_files);
+    if ((rc == 0) && (tpm_key_handle_entries->ownerEvictCount > 0)) {
+	rc = TPM_Malloc((unsigned char **)&(tpm_owner_evict_files->file),
+			tpm_key_handle_entries->ownerEvictCount * sizeof(TPM_OWNER_EVICT_FILE));
+    }
+    for (i = 0 ; (rc == 0) && (i < tpm_key_handle_entries->ownerEvictCount) ; i++) {
+	entry = &(tpm_key_handle_entries->entries[tpm_key_handle_entries->ownerEvict[i]]);
+	if (entry->lazyKey) {
+	    tpm_owner_evict_file = &(tpm_owner_evict_files->file[tpm_owner_evict_files->count]);
+	    tpm_owner_evict_files->count++;
+	    tpm_owner_evict_file->handle = entry->handle;
+	    tpm_owner_evict_file->keyCopy = entry->keyCopy;
+	    TPM_Digest_Copy(tpm_owner_evict_file->keyDigest, entry->keyDigest);
+	}
+    }
+    return rc;
+}
+
+/* TPM_OwnerEvictFiles_Commit() replaces 'tpm_owner_evict_files' with 'new_owner_evict_files' once
+   the section recording them is in NV.  The NV files of keys that are no longer recorded are
+   deleted.
+*/
+
+TPM_RESULT TPM_OwnerEvictFiles_Commit(TPM_OWNER_EVICT_FILES *tpm_owner_evict_files,
+				      TPM_OWNER_EVICT_FILES *new_owner_evict_files,
+				      uint32_t tpm_number)
+{
+    TPM_RESULT		rc = 0;
+    char		name[TPM_FILENAME_MAX];
+    BYTE		keyCopy;
+    uint32_t		i;
+
+    printf(" TPM_OwnerEvictFiles_Commit: %u keys\n", new_owner_evict_files->count);
+    for (i = 0 ; (rc == 0) && (i < tpm_owner_evict_files->count) ; i++) {
+	if (TPM_OwnerEvictFiles_Find(new_owner_evict_files,
+				     tpm_owner_evict_files->file[i].handle) != NULL) {
+	    continue;
+	}
+	for (keyCopy = 0 ; (rc == 0) && (keyCopy < 2) ; keyCopy++) {
+	    TPM_KeyHandleEntry_KeyName(name, tpm_owner_evict_files->file[i].handle, keyCopy);
+	    printf("  TPM_OwnerEvictFiles_Commit: Deleting %s\n", name);
+	    rc = TPM_NVRAM_DeleteName(tpm_number, name, FALSE);
+	}
+    }
+    TPM_OwnerEvictFiles_Delete(tpm_owner_evict_files);
+    *tpm_owner_evict_files = *new_owner_evict_files;
+    TPM_OwnerEvictFiles_Init(new_owner_evict_files);
+    return rc;
+}
+
+/* TPM_OwnerEvictFiles_Find() returns the TPM_OWNER_EVICT_FILE for handle, or NULL */
+
+static TPM_OWNER_EVICT_FILE *TPM_OwnerEvictFiles_Find(const TPM_OWNER_EVICT_FILES
+						      *tpm_owner_evict_files,
+						      TPM_KEY_HANDLE handle)
+{
+    TPM_OWNER_EVICT_FILE key;
+
+    if (tpm_owner_evict_files->count == 0) {
+	return NULL;
+    }
+    key.handle = handle;
+    return bsearch(&key, tpm_owner_evict_files->file, tpm_owner_evict_files->count,
+		   sizeof(TPM_OWNER_EVICT_FILE), TPM_OwnerEvictFiles_Compare);
+}
+
+/* TPM_OwnerEvictFiles_Compare() orders TPM_OWNER_EVICT_FILE for qsort() and bsearch() */
+
+static int TPM_OwnerEvictFiles_Compare(const void *a, const void *b)
+{
+    TPM_KEY_HANDLE handleA = ((const TPM_OWNER_EVICT_FILE *)a)->handle;
+    TPM_KEY_HANDLE handleB = ((const TPM_OWNER_EVICT_FILE *)b)->handle;
+
+    if (handleA < handleB) {
+	return -1;
+    }
+    if (handleA > handleB) {
+	return 1;
+    }
+    return 0;
+}
+
 /*
   Processing Functions
 */
@@ -4189,6 +4999,7 @@ TPM_RESULT TPM_Process_CreateRevocableEK(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV1,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.enableRevokeEK),	/* flag */
 			       TRUE);							/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA | TPM_PERMANENT_DIRTY_FLAGS);
 	/* a. If generateReset is TRUE then */
 	if (generateReset) {
 	    /* i. Set TPM_PERMANENT_DATA -> EKreset to the next value from the TPM RNG */
@@ -4371,6 +5182,7 @@ TPM_RESULT TPM_Process_CreateEndorsementKeyPair(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV2,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.enableRevokeEK),	/* flag */
 			       FALSE);						/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
     }
     /* save the permanent data and flags structures to NVRAM */
     returnCode = TPM_PermanentAll_NVStore(tpm_state,
@@ -4578,6 +5390,7 @@ TPM_RESULT TPM_CreateEndorsementKeyPair_Common(TPM_KEY *endorsementKey,		/* outp
     /* 9. Set TPM_PERMANENT_FLAGS -> CEKPUsed to TRUE */
     if (returnCode == TPM_SUCCESS) {
 	tpm_state->tpm_permanent_flags.CEKPUsed = TRUE;
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA | TPM_PERMANENT_DIRTY_FLAGS);
     }
     /*
       cleanup
@@ -4895,6 +5708,7 @@ TPM_RESULT TPM_Process_DisablePubekRead(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.readPubek),	/* flag */
 			       FALSE);						/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
 	printf("TPM_Process_DisablePubekRead: readPubek now %02x\n",
 	       tpm_state->tpm_permanent_flags.readPubek);
 	/* save the permanent flags structure to NVRAM */
@@ -4956,7 +5770,7 @@ TPM_RESULT TPM_Process_DisablePubekRead(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     return rcf;
 }
@@ -5146,7 +5960,7 @@ TPM_RESULT TPM_Process_OwnerReadPubek(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -5244,7 +6058,7 @@ TPM_RESULT TPM_Process_EvictKey(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	printf("TPM_Process_EvictKey: Evicting handle %08x\n", evictHandle);
 	returnCode = TPM_KeyHandleEntries_GetEntry(&tpm_key_handle_entry,
-						   tpm_state->tpm_key_handle_entries,
+						   &(tpm_state->tpm_key_handle_entries),
 						   evictHandle);
 	if (returnCode != TPM_SUCCESS) {
 	    printf("TPM_Process_EvictKey: Error, key handle %08x not found\n",
@@ -5515,7 +6329,7 @@ TPM_RESULT TPM_Process_OwnerReadInternalPub(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
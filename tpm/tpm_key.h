@@ -98,6 +98,11 @@ TPM_RESULT TPM_Key_LoadStoreAsymKey(TPM_KEY *tpm_key,
 				    TPM_BOOL isEK,
                                     unsigned char **stream,
                                     uint32_t *stream_size);
+TPM_RESULT TPM_Key_LoadStoreAsymKeyConvert(TPM_KEY *tpm_key,
+					   TPM_BOOL isEK,
+					   TPM_BOOL convert,
+					   unsigned char **stream,
+					   uint32_t *stream_size);
 TPM_RESULT TPM_Key_StorePubkey(TPM_STORE_BUFFER *pubkeyStream,
                                const unsigned char **pubkKeyStreamBuffer,
                                uint32_t *pubkeyStreamLength,
@@ -240,13 +245,18 @@ void       TPM_KeyHandleEntry_Delete(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry)
 
 TPM_RESULT TPM_KeyHandleEntry_FlushSpecific(tpm_state_t *tpm_state,
                                             TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry);
+TPM_RESULT TPM_KeyHandleEntry_LoadKey(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry,
+                                      uint32_t tpm_number);
 
 /*
   TPM_KEY_HANDLE_ENTRY entries list
 */
 
-void       TPM_KeyHandleEntries_Init(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries);
-void       TPM_KeyHandleEntries_Delete(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries);
+TPM_RESULT TPM_KeyHandleEntries_Init(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries);
+void       TPM_KeyHandleEntries_Delete(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries);
+void       TPM_KeyHandleEntries_SetKeyHandles(uint32_t keyHandles);
+void       TPM_KeyHandleEntries_SetOwnerEvictKeyHandles(uint32_t ownerEvictKeyHandles);
+uint32_t   TPM_KeyHandleEntries_GetOwnerEvictKeyHandles(void);
 
 TPM_RESULT TPM_KeyHandleEntries_Load(tpm_state_t *tpm_state,
 				     unsigned char **stream,
@@ -255,28 +265,30 @@ TPM_RESULT TPM_KeyHandleEntries_Store(TPM_STORE_BUFFER *sbuffer,
 				      tpm_state_t *tpm_state);
 
 TPM_RESULT TPM_KeyHandleEntries_StoreHandles(TPM_STORE_BUFFER *sbuffer,
-                                             const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries);
-TPM_RESULT TPM_KeyHandleEntries_DeleteHandle(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+                                             const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries);
+TPM_RESULT TPM_KeyHandleEntries_DeleteHandle(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
                                              TPM_KEY_HANDLE tpm_key_handle);
+void       TPM_KeyHandleEntries_DeleteEntry(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+                                            TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry);
 
 void       TPM_KeyHandleEntries_IsSpace(TPM_BOOL *isSpace, uint32_t *index,
-                                        const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries);
+                                        const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries);
 void       TPM_KeyHandleEntries_GetSpace(uint32_t *space,
-                                         const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries);
+                                         const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries);
 void       TPM_KeyHandleEntries_IsEvictSpace(TPM_BOOL *isSpace,
-                                             const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+                                             const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
                                              uint32_t minSpace);
 TPM_RESULT TPM_KeyHandleEntries_AddKeyEntry(TPM_KEY_HANDLE *tpm_key_handle,
-                                            TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+                                            TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
                                             TPM_KEY *tpm_key,
                                             TPM_BOOL parentPCRStatus,
                                             TPM_KEY_CONTROL keyControl);
 TPM_RESULT TPM_KeyHandleEntries_AddEntry(TPM_KEY_HANDLE *tpm_key_handle,
                                          TPM_BOOL keepHandle,
-                                         TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+                                         TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
                                          TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry);
 TPM_RESULT TPM_KeyHandleEntries_GetEntry(TPM_KEY_HANDLE_ENTRY **tpm_key_handle_entry,
-                                         TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+                                         TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
                                          TPM_KEY_HANDLE tpm_key_handle);
 TPM_RESULT TPM_KeyHandleEntries_GetKey(TPM_KEY **tpm_key,
                                        TPM_BOOL *parentPCRStatus,
@@ -285,22 +297,40 @@ TPM_RESULT TPM_KeyHandleEntries_GetKey(TPM_KEY **tpm_key,
                                        TPM_BOOL readOnly,
                                        TPM_BOOL ignorePCRs,
                                        TPM_BOOL allowEK);
-TPM_RESULT TPM_KeyHandleEntries_SetParentPCRStatus(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+TPM_RESULT TPM_KeyHandleEntries_SetParentPCRStatus(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
                                                    TPM_KEY_HANDLE tpm_key_handle,
                                                    TPM_BOOL parentPCRStatus);
 TPM_RESULT TPM_KeyHandleEntries_GetNextEntry(TPM_KEY_HANDLE_ENTRY **tpm_key_handle_entry,
                                              size_t *current,
-                                             TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+                                             TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
                                              size_t start);
 
-TPM_RESULT TPM_KeyHandleEntries_OwnerEvictLoad(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+TPM_RESULT TPM_KeyHandleEntries_OwnerEvictLoad(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
 					       unsigned char **stream, uint32_t *stream_size);
 TPM_RESULT TPM_KeyHandleEntries_OwnerEvictStore(TPM_STORE_BUFFER *sbuffer,
-						const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries);
+						TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+						const TPM_OWNER_EVICT_FILES *tpm_owner_evict_files);
 TPM_RESULT TPM_KeyHandleEntries_OwnerEvictGetCount(uint16_t *count,
-						   const TPM_KEY_HANDLE_ENTRY
+						   const TPM_KEY_HANDLE_ENTRIES
 						   *tpm_key_handle_entries);
-void       TPM_KeyHandleEntries_OwnerEvictDelete(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries);
+TPM_RESULT TPM_KeyHandleEntries_SetOwnerEvict(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+					      TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry,
+					      TPM_BOOL ownerEvict);
+void       TPM_KeyHandleEntries_OwnerEvictDelete(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries);
+TPM_RESULT TPM_KeyHandleEntries_OwnerEvictNVStore(TPM_OWNER_EVICT_FILES *new_owner_evict_files,
+						  TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
+						  const TPM_OWNER_EVICT_FILES *tpm_owner_evict_files,
+						  uint32_t tpm_number);
+
+/* TPM_OWNER_EVICT_FILES */
+
+void       TPM_OwnerEvictFiles_Init(TPM_OWNER_EVICT_FILES *tpm_owner_evict_files);
+void       TPM_OwnerEvictFiles_Delete(TPM_OWNER_EVICT_FILES *tpm_owner_evict_files);
+TPM_RESULT TPM_OwnerEvictFiles_Set(TPM_OWNER_EVICT_FILES *tpm_owner_evict_files,
+				   const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries);
+TPM_RESULT TPM_OwnerEvictFiles_Commit(TPM_OWNER_EVICT_FILES *tpm_owner_evict_files,
+				      TPM_OWNER_EVICT_FILES *new_owner_evict_files,
+				      uint32_t tpm_number);
 
 /* TPM_RSA_KEY_PARMS */
 
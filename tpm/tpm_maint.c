@@ -358,6 +358,7 @@ TPM_RESULT TPM_Process_CreateMaintenanceArchive(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.maintenanceDone),	/* flag */
 			       TRUE);						/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
     }
     /* Store the permanent flags back to NVRAM */
     returnCode = TPM_PermanentAll_NVStore(tpm_state,
@@ -426,7 +427,7 @@ TPM_RESULT TPM_Process_CreateMaintenanceArchive(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -748,7 +749,7 @@ TPM_RESULT TPM_Process_LoadMaintenanceArchive(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -891,6 +892,7 @@ TPM_RESULT TPM_Process_KillMaintenanceFeature(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.allowMaintenance),	/* flag */
 			       FALSE);						/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
 	/* Store the permanent flags back to NVRAM */
 	returnCode = TPM_PermanentAll_NVStore(tpm_state,
 					      writeAllNV,
@@ -949,7 +951,7 @@ TPM_RESULT TPM_Process_KillMaintenanceFeature(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -1082,6 +1084,7 @@ TPM_RESULT TPM_Process_LoadManuMaintPub(tpm_state_t *tpm_state,
 	returnCode = TPM_Pubkey_Copy(&(tpm_state->tpm_permanent_data.manuMaintPub),
 				     &pubKey);
 	writeAllNV = TRUE;
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
     }
     /* 2. Set checksum to SHA-1 of (pubkey || antiReplay) */
     if (returnCode == TPM_SUCCESS) {
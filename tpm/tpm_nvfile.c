@@ -48,6 +48,21 @@
         TPM_NVRAM_DeleteName();
 
    They take a 'name' that is mapped to a rooted file name.
+
+   If the TPM_NV_JOURNAL environment variable is set, the names are stored through a journal.  See
+   'Journal' below.
+
+   If the TPM_NV_MMAP environment variable is set, the names are stored in one memory mapped file
+   per TPM instance.  See 'Memory Map' below.
+
+   A file is replaced by writing a temporary file and renaming it over the original, so that a
+   crash leaves either the old or the new contents.  The TPM_NV_SYNC environment variable selects
+   when the data reaches stable storage:
+
+	always	(default) fsync() the file and the directory before returning
+	N	group commit, fsync() pending directory entries and journal appends once the
+		oldest is N msec old.  A replacement file is still synced before its rename.
+	none	never fsync(), for test environments
 */
 
 #include <stdio.h>
@@ -55,10 +70,22 @@
 #include <stdlib.h>
 #include <errno.h>
 
+#ifdef TPM_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "tpm_cryptoh.h"
 #include "tpm_debug.h"
 #include "tpm_error.h"
+#include "tpm_load.h"
 #include "tpm_memory.h"
+#include "tpm_nvfilename.h"
 #include "tpm_nvram.h"
+#include "tpm_store.h"
+#include "tpm_time.h"
 
 #include "tpm_nvfile.h"
 
@@ -72,6 +99,53 @@
 static void       TPM_NVRAM_GetFilenameForName(char *filename,
 					       uint32_t tpm_number,
                                                const char *name);
+static uint32_t   TPM_NVRAM_Hash(uint32_t key,
+				 const char *name,
+				 uint32_t count);
+static TPM_RESULT TPM_NVRAM_ReadFile(unsigned char **data,
+				     uint32_t *length,
+				     const char *filename);
+static TPM_RESULT TPM_NVRAM_WriteFile(const unsigned char *data,
+				      uint32_t length,
+				      const char *filename,
+				      const char *mode);
+static TPM_RESULT TPM_NVRAM_SyncFile(FILE *file,
+				     TPM_BOOL replace,
+				     TPM_BOOL directory);
+static void       TPM_NVRAM_UpdateMetrics(uint32_t length,
+					  uint32_t usec);
+static TPM_RESULT TPM_NVRAM_Elapsed(uint32_t *usec,
+				    uint32_t start_sec,
+				    uint32_t start_usec);
+
+static TPM_RESULT TPM_NVRAM_Journal_LoadData(unsigned char **data,
+					     uint32_t *length,
+					     uint32_t tpm_number,
+					     const char *name);
+static TPM_RESULT TPM_NVRAM_Journal_StoreData(const unsigned char *data,
+					      uint32_t length,
+					      uint32_t tpm_number,
+					      const char *name);
+static TPM_RESULT TPM_NVRAM_Journal_DeleteName(uint32_t tpm_number,
+					       const char *name,
+					       TPM_BOOL mustExist);
+static TPM_RESULT TPM_NVRAM_Journal_Compact(uint32_t tpm_number);
+static TPM_RESULT TPM_NVRAM_Journal_Drain(uint32_t tpm_number);
+#ifdef TPM_POSIX
+static TPM_RESULT TPM_NVRAM_Map_LoadData(unsigned char **data,
+					 uint32_t *length,
+					 uint32_t tpm_number,
+					 const char *name);
+static TPM_RESULT TPM_NVRAM_Map_StoreData(const unsigned char *data,
+					  uint32_t length,
+					  uint32_t tpm_number,
+					  const char *name);
+static TPM_RESULT TPM_NVRAM_Map_DeleteName(uint32_t tpm_number,
+					   const char *name,
+					   TPM_BOOL mustExist);
+static TPM_RESULT TPM_NVRAM_Map_SyncAll(void);
+#endif
+static TPM_RESULT TPM_NVRAM_Map_Drain(uint32_t tpm_number);
 
 
 /* A file name in NVRAM is composed of 3 parts:
@@ -90,6 +164,232 @@ static void       TPM_NVRAM_GetFilenameForName(char *filename,
 
 char state_directory[FILENAME_MAX];
 
+/*
+  Durability
+*/
+
+/* temporary file suffix, the new contents are written here and then renamed */
+
+#define TPM_NVRAM_TMP_SUFFIX		".tmp"
+
+/* maximum number of files with a pending group commit fsync() */
+
+#ifndef TPM_NVRAM_SYNC_PENDING
+#define TPM_NVRAM_SYNC_PENDING		16
+#endif
+
+#define TPM_NVRAM_SYNC_ALWAYS		0
+#define TPM_NVRAM_SYNC_GROUP		1
+#define TPM_NVRAM_SYNC_NONE		2
+
+static int nvram_sync_policy = TPM_NVRAM_SYNC_ALWAYS;
+static uint32_t nvram_sync_interval = 0;	/* group commit interval in msec */
+#ifdef TPM_POSIX
+/* group commit, descriptors of written files not yet synced */
+static int nvram_sync_fds[TPM_NVRAM_SYNC_PENDING];
+static size_t nvram_sync_count = 0;
+static TPM_BOOL nvram_sync_directory = FALSE;	/* a rename is not yet synced */
+static TPM_BOOL nvram_sync_map = FALSE;		/* a memory map write is not yet synced */
+static uint32_t nvram_sync_sec;			/* time of the oldest pending write */
+static uint32_t nvram_sync_usec;
+#endif
+static TPM_NVRAM_METRICS nvram_metrics;
+
+/*
+  Journal
+
+  When enabled, TPM_NVRAM_StoreData() does not rewrite the file.  It compares the new data to the
+  current contents and appends the changed byte ranges as records to the per-TPM journal file
+  tpm_number.TPM_JOURNAL_NAME.  An NV write or a counter increment then costs an append of a few
+  tens of bytes rather than a rewrite of the NV state.
+
+  The current contents of each name, the file plus the journal records, are cached in memory.
+  When the journal grows beyond the TPM_NV_JOURNAL threshold, it is compacted.  Each cached name
+  is written to its file and the journal is emptied.
+
+  A record is:
+
+	type		TPM_NVRAM_JOURNAL_WRITE or TPM_NVRAM_JOURNAL_DELETE
+	name		1 byte length, name
+	length		total length of the name after the record
+	offset		offset of the written range
+	data		4 byte size, bytes of the written range
+	digest		SHA-1 of the above, detects a record torn by a crash
+
+  Replay applies the records in order, starting from the file contents.  Since a record holds the
+  new bytes and the total length, rather than a difference, replaying over a file that was
+  already compacted yields the same result.  Replay stops at the first invalid record, and the
+  journal is truncated there.
+*/
+
+/* maximum journal compaction threshold, so that the journal can be read in one allocation */
+
+#define TPM_NVRAM_JOURNAL_MAX		(TPM_ALLOC_MAX / 2)
+
+/* names cached for all TPM instances.  Each NV defined space index takes two names, see
+   TPM_NV_DATA_NAME.  TPM_NVRAM_CheckNames() rejects an NV defined space size that could exceed
+   the cache. */
+
+#ifndef TPM_NVRAM_JOURNAL_NAMES
+#define TPM_NVRAM_JOURNAL_NAMES		(1024 * TPMS_MAX)
+#endif
+
+/* changed ranges closer than this are coalesced into one record */
+
+#ifndef TPM_NVRAM_JOURNAL_GAP
+#define TPM_NVRAM_JOURNAL_GAP		16
+#endif
+
+#define TPM_NVRAM_JOURNAL_WRITE		1
+#define TPM_NVRAM_JOURNAL_DELETE	2
+
+/* the current contents of a name */
+
+typedef struct tdTPM_NVRAM_ENTRY {
+    TPM_BOOL		inUse;
+    uint32_t		tpm_number;
+    char		name[TPM_FILENAME_MAX];
+    TPM_BOOL		exists;		/* FALSE if the name was never stored or was deleted */
+    unsigned char	*data;
+    uint32_t		length;
+    uint32_t		next;		/* hash chain or free list, entry + 1, 0 at the end */
+} TPM_NVRAM_ENTRY;
+
+/* journal compaction threshold in bytes, 0 if journaling is disabled */
+static uint32_t nvram_journal_max = 0;
+static TPM_NVRAM_ENTRY nvram_entries[TPM_NVRAM_JOURNAL_NAMES];
+/* hash chains of the cached names, entry + 1, 0 if empty */
+static uint32_t nvram_entry_buckets[TPM_NVRAM_JOURNAL_NAMES];
+/* freed entries, entry + 1, 0 if empty.  Entries above nvram_entries_used were never used. */
+static uint32_t nvram_entry_free = 0;
+static uint32_t nvram_entries_used = 0;
+/* TRUE once the instance journal has been replayed */
+static TPM_BOOL nvram_journal_replayed[TPMS_MAX];
+/* current size of the instance journal */
+static uint32_t nvram_journal_size[TPMS_MAX];
+
+/*
+  Memory Map
+
+  When enabled, the names of a TPM instance are stored in one file, tpm_number.TPM_NVMAP_NAME, that
+  is mapped into memory.  A load copies from the mapping, and a store copies only the pages that
+  differ.  The kernel then writes back only those pages, so an NV write or a counter increment
+  writes a page or two rather than the whole NV state.  The TPM_NV_SYNC policy is applied with
+  msync().
+
+  The file layout is fixed:
+
+	header		a magic number, a version, the slot count, and the free lists
+	slots		the index, TPM_NVRAM_MAP_SLOTS_OFFSET bytes into the file
+	regions		the data, allocated at the end of the file after the header is page aligned
+
+  Each slot holds a key (the instance and a name) and two copies of its data.  A store writes the
+  inactive copy, syncs it, and then switches copies by updating the slot state, which is one 32 bit
+  word holding the exists flag, the active copy and the length.  A crash therefore leaves either
+  the old or the new contents, as with the file rename.  The inactive copy is compared page by page
+  before writing, so unchanged pages are not dirtied.  A copy that is too small is reallocated.
+  Since only the inactive copy moves, the slot state is the only word that changes the visible
+  contents.
+
+  Regions are a power of two times TPM_NVRAM_MAP_ALIGN.  A reallocated or deleted region is pushed
+  onto the free list for its size, threaded through the first word of each free region, and reused
+  before the file grows.  A crash between the steps of an allocation or release can leak a region
+  but never shares one.
+
+  A name that is not yet in the map is imported from its file, which is then removed.  Conversely,
+  when TPM_NV_MMAP is not set, a map left by an earlier run is exported to the files and removed.
+
+  Container
+
+  If the TPM_NV_CONTAINER environment variable names a file, that one file holds the state of all
+  instances instead, so that many virtual TPMs do not each cost a set of files.  The index is then
+  TPM_NVRAM_CONTAINER_SLOTS slots, addressed by a hash of the key with linear probing.  A deleted
+  name keeps its slot as a tombstone, which a later insert may reuse.
+
+  Each server process typically hosts one virtual TPM as instance 0, so the key is the
+  TPM_NV_INSTANCE environment variable plus the TPM number.  Several processes may share the
+  container.  A process holds an fcntl() write lock on one byte per instance for as long as it
+  runs, so that two processes cannot open the same instance.  Changes to the shared parts of the
+  file, the slot assignment, the free lists, and the file size, are serialized by a lock on
+  another byte.  The lock bytes are beyond the end of the file.  Each process only changes the
+  slots of its own instances, so that a lookup needs no lock.  Since a lookup ends at a never used
+  slot, a tombstone that is reused for another key is never seen with an empty name.
+
+  A container is not exported to the files when TPM_NV_CONTAINER is unset.
+*/
+
+/* slots of a new map.  Each NV defined space index takes two names, see TPM_NV_DATA_NAME.  An
+   existing map keeps the slot count it was created with.  TPM_NVRAM_CheckNames() rejects an NV
+   defined space size that could exceed the slots. */
+
+#ifndef TPM_NVRAM_MAP_SLOTS
+#define TPM_NVRAM_MAP_SLOTS		1024
+#endif
+#ifndef TPM_NVRAM_CONTAINER_SLOTS
+#define TPM_NVRAM_CONTAINER_SLOTS	8192
+#endif
+
+/* page alignment and smallest region */
+
+#define TPM_NVRAM_MAP_ALIGN		4096
+#define TPM_NVRAM_MAP_MAGIC		0x4e564d50	/* NVMP */
+#define TPM_NVRAM_MAP_VERSION		2
+#define TPM_NVRAM_MAP_SLOTS_OFFSET	128
+
+/* region sizes, TPM_NVRAM_MAP_ALIGN << class */
+
+#define TPM_NVRAM_MAP_CLASSES		16
+
+/* fcntl() lock bytes in the container, the allocation lock and then one per instance */
+
+#define TPM_NVRAM_CONTAINER_LOCK	0x7f000000
+
+/* slot state */
+
+#define TPM_NVRAM_MAP_EXISTS		0x80000000
+#define TPM_NVRAM_MAP_ACTIVE		0x40000000	/* copy 1 is active */
+#define TPM_NVRAM_MAP_LENGTH		0x3fffffff
+
+typedef struct tdTPM_NVRAM_MAP_HEADER {
+    uint32_t		magic;
+    uint32_t		version;
+    uint32_t		slotCount;
+    uint32_t		reserved;
+    uint32_t		freeHead[TPM_NVRAM_MAP_CLASSES];	/* first free region, 0 if none */
+} TPM_NVRAM_MAP_HEADER;
+
+/* 64 bytes, so that a slot never spans a disk sector */
+
+typedef struct tdTPM_NVRAM_MAP_SLOT {
+    char		name[TPM_FILENAME_MAX];	/* empty if the slot was never used */
+    uint32_t		tpm_number;		/* the instance key */
+    uint32_t		offset[2];		/* file offset of each copy */
+    uint32_t		capacity[2];		/* allocated size of each copy, 0 if none */
+    uint32_t		state;
+    uint32_t		reserved[4];
+} TPM_NVRAM_MAP_SLOT;
+
+/* TRUE if TPM_NV_MMAP or TPM_NV_CONTAINER is set */
+static TPM_BOOL nvram_map = FALSE;
+#ifdef TPM_POSIX
+/* TRUE if TPM_NV_CONTAINER is set, all instances then use mapping 0 */
+static TPM_BOOL nvram_container = FALSE;
+static char nvram_container_path[FILENAME_MAX];
+static uint32_t nvram_container_instance = 0;	/* TPM_NV_INSTANCE */
+/* the mappings, NULL if not yet opened */
+static unsigned char *nvram_map_base[TPMS_MAX];
+static uint32_t nvram_map_size[TPMS_MAX];
+static int nvram_map_fd[TPMS_MAX];
+/* group commit, TRUE if the mapping has writes that are not yet synced */
+static TPM_BOOL nvram_map_dirty[TPMS_MAX];
+/* TRUE once the container instance lock is held */
+static TPM_BOOL nvram_map_locked[TPMS_MAX];
+/* TRUE once a leftover map has been exported to the files */
+static TPM_BOOL nvram_map_drained[TPMS_MAX];
+/* the most names of an instance, see TPM_NVRAM_CheckNames(), 0 if not checked */
+static uint32_t nvram_map_names = 0;
+#endif
+
 /* TPM_NVRAM_Init() is called once at startup.  It does any NVRAM required initialization.
 
    This function sets some static variables that are used by all TPM's.
@@ -99,6 +399,15 @@ TPM_RESULT TPM_NVRAM_Init(void)
 {
     TPM_RESULT  rc = 0;
     char        *tpm_state_path;
+    char        *tpm_nv_journal;
+    char        *tpm_nv_mmap;
+#ifdef TPM_POSIX
+    char        *tpm_nv_container;
+    char        *tpm_nv_instance;
+    size_t      i;
+#endif
+    char        *tpm_nv_sync;
+    char        *tpm_nv_sync_end;
     size_t      length;
 
 #ifdef TPM_LIBTPMS_CALLBACKS
@@ -136,6 +445,82 @@ TPM_RESULT TPM_NVRAM_Init(void)
         strcpy(state_directory, tpm_state_path);
         printf("TPM_NVRAM_Init: Rooted state path %s\n", state_directory);
     }
+    /* the optional journal compaction threshold */
+    if (rc == 0) {
+        tpm_nv_journal = getenv("TPM_NV_JOURNAL");
+        if (tpm_nv_journal != NULL) {
+            nvram_journal_max = strtoul(tpm_nv_journal, NULL, 0);
+            if (nvram_journal_max > TPM_NVRAM_JOURNAL_MAX) {
+                nvram_journal_max = TPM_NVRAM_JOURNAL_MAX;
+            }
+        }
+        printf("TPM_NVRAM_Init: Journal compaction threshold %u\n", nvram_journal_max);
+    }
+    /* the optional memory mapped store */
+    if (rc == 0) {
+        tpm_nv_mmap = getenv("TPM_NV_MMAP");
+        if (tpm_nv_mmap != NULL) {
+            nvram_map = (strtoul(tpm_nv_mmap, NULL, 0) != 0);
+        }
+#ifdef TPM_POSIX
+        /* the optional container shared by all instances */
+        tpm_nv_container = getenv("TPM_NV_CONTAINER");
+        if ((tpm_nv_container != NULL) && (tpm_nv_container[0] != '\0')) {
+            if (strlen(tpm_nv_container) >= FILENAME_MAX) {
+                printf("TPM_NVRAM_Init: Error (fatal), TPM_NV_CONTAINER %s too large\n",
+                       tpm_nv_container);
+                rc = TPM_FAIL;
+            }
+            else {
+                strcpy(nvram_container_path, tpm_nv_container);
+                nvram_container = TRUE;
+                nvram_map = TRUE;
+            }
+        }
+        for (i = 0 ; i < TPMS_MAX ; i++) {
+            nvram_map_fd[i] = -1;
+        }
+        tpm_nv_instance = getenv("TPM_NV_INSTANCE");
+        if (tpm_nv_instance != NULL) {
+            nvram_container_instance = strtoul(tpm_nv_instance, NULL, 0);
+        }
+        printf("TPM_NVRAM_Init: Memory map %u container %u instance %u\n",
+               nvram_map, nvram_container, nvram_container_instance);
+#else
+        if (nvram_map || (getenv("TPM_NV_CONTAINER") != NULL)) {
+            printf("TPM_NVRAM_Init: Error (fatal), TPM_NV_MMAP is not supported\n");
+            rc = TPM_FAIL;
+        }
+#endif
+    }
+    if ((rc == 0) && nvram_map && (nvram_journal_max != 0)) {
+        printf("TPM_NVRAM_Init: Error (fatal), TPM_NV_MMAP and TPM_NV_JOURNAL are exclusive\n");
+        rc = TPM_FAIL;
+    }
+    /* the durability policy */
+    if (rc == 0) {
+        tpm_nv_sync = getenv("TPM_NV_SYNC");
+        if ((tpm_nv_sync == NULL) || (strcmp(tpm_nv_sync, "always") == 0)) {
+            nvram_sync_policy = TPM_NVRAM_SYNC_ALWAYS;
+        }
+        else if (strcmp(tpm_nv_sync, "none") == 0) {
+            nvram_sync_policy = TPM_NVRAM_SYNC_NONE;
+        }
+        else {
+            nvram_sync_interval = strtoul(tpm_nv_sync, &tpm_nv_sync_end, 0);
+            if ((*tpm_nv_sync_end != '\0') || (nvram_sync_interval == 0)) {
+                printf("TPM_NVRAM_Init: Error (fatal), TPM_NV_SYNC %s must be always, none, "
+                       "or a group commit interval in msec\n", tpm_nv_sync);
+                rc = TPM_FAIL;
+            }
+            nvram_sync_policy = TPM_NVRAM_SYNC_GROUP;
+        }
+    }
+    if (rc == 0) {
+        printf("TPM_NVRAM_Init: Sync policy %d interval %u msec\n",
+               nvram_sync_policy, nvram_sync_interval);
+        memset(&nvram_metrics, 0, sizeof(TPM_NVRAM_METRICS));
+    }
     return rc;
 }
 
@@ -155,10 +540,6 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
                               const char *name) 
 {
     TPM_RESULT  rc = 0;
-    long        lrc;
-    size_t      src;
-    int         irc;
-    FILE        *file = NULL;
     char        filename[FILENAME_MAX]; /* rooted file name from name */
 
 #ifdef TPM_LIBTPMS_CALLBACKS
@@ -173,21 +554,122 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
 #endif
 
     printf(" TPM_NVRAM_LoadData: From file %s\n", name);
+    *data = NULL;
+    *length = 0;
+    if (nvram_journal_max != 0) {
+        rc = TPM_NVRAM_Journal_LoadData(data, length, tpm_number, name);
+    }
+#ifdef TPM_POSIX
+    else if (nvram_map) {
+        /* fold in a journal left by a run with TPM_NV_JOURNAL set */
+        rc = TPM_NVRAM_Journal_Drain(tpm_number);
+        if (rc == 0) {
+            rc = TPM_NVRAM_Map_LoadData(data, length, tpm_number, name);
+        }
+    }
+#endif
+    else {
+        /* fold in a journal or map left by a run with TPM_NV_JOURNAL or TPM_NV_MMAP set */
+        rc = TPM_NVRAM_Journal_Drain(tpm_number);
+        if (rc == 0) {
+            rc = TPM_NVRAM_Map_Drain(tpm_number);
+        }
+        if (rc == 0) {
+            /* map name to the rooted filename */
+            TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
+            rc = TPM_NVRAM_ReadFile(data, length, filename);
+        }
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_StoreData stores 'data' of 'length' to the rooted 'filename'
+
+   Returns
+        0 on success
+        TPM_FAIL for other fatal errors
+*/
+
+TPM_RESULT TPM_NVRAM_StoreData(const unsigned char *data,
+                               uint32_t length,
+			       uint32_t tpm_number,
+                               const char *name)
+{
+    TPM_RESULT  rc = 0;
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+
+#ifdef TPM_LIBTPMS_CALLBACKS
+    struct libtpms_callbacks *cbs = TPMLIB_GetCallbacks();
+
+    /* call user-provided function if available, otherwise execute
+       default behavior */
+    if (cbs->tpm_nvram_storedata) {
+        rc = cbs->tpm_nvram_storedata(data, length, tpm_number, name);
+        return rc;
+    }
+#endif
+
+    printf(" TPM_NVRAM_StoreData: To name %s\n", name);
+    if (nvram_journal_max != 0) {
+        rc = TPM_NVRAM_Journal_StoreData(data, length, tpm_number, name);
+    }
+#ifdef TPM_POSIX
+    else if (nvram_map) {
+        /* fold in a journal left by a run with TPM_NV_JOURNAL set */
+        rc = TPM_NVRAM_Journal_Drain(tpm_number);
+        if (rc == 0) {
+            rc = TPM_NVRAM_Map_StoreData(data, length, tpm_number, name);
+        }
+    }
+#endif
+    else {
+        /* fold in a journal or map left by a run with TPM_NV_JOURNAL or TPM_NV_MMAP set */
+        rc = TPM_NVRAM_Journal_Drain(tpm_number);
+        if (rc == 0) {
+            rc = TPM_NVRAM_Map_Drain(tpm_number);
+        }
+        if (rc == 0) {
+            /* map name to the rooted filename */
+            TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
+            rc = TPM_NVRAM_WriteFile(data, length, filename, "wb");
+        }
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_ReadFile() reads 'data' of 'length' from the rooted 'filename'.
+
+   'data' must be freed after use.
+
+   Returns
+        0 on success.
+        TPM_RETRY and NULL,0 on non-existent file
+        TPM_FAIL on failure to load (fatal), since it should never occur
+*/
+
+static TPM_RESULT TPM_NVRAM_ReadFile(unsigned char **data,     /* freed by caller */
+				     uint32_t *length,
+				     const char *filename)
+{
+    TPM_RESULT  rc = 0;
+    long        lrc;
+    size_t      src;
+    int         irc;
+    FILE        *file = NULL;
+
     *data = NULL;
     *length = 0;
     /* open the file */
     if (rc == 0) {
-        /* map name to the rooted filename */
-        TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
-        printf("  TPM_NVRAM_LoadData: Opening file %s\n", filename);
+        printf("  TPM_NVRAM_ReadFile: Opening file %s\n", filename);
         file = fopen(filename, "rb");                           /* closed @1 */
         if (file == NULL) {     /* if failure, determine cause */
             if (errno == ENOENT) {
-                printf("TPM_NVRAM_LoadData: No such file %s\n", filename);
+                printf("TPM_NVRAM_ReadFile: No such file %s\n", filename);
                 rc = TPM_RETRY;         /* first time start up */
             }
             else {
-                printf("TPM_NVRAM_LoadData: Error (fatal) opening %s for read, %s\n",
+                printf("TPM_NVRAM_ReadFile: Error (fatal) opening %s for read, %s\n",
                        filename, strerror(errno));
                 rc = TPM_FAIL;
             }
@@ -197,7 +679,7 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
     if (rc == 0) {
         irc = fseek(file, 0L, SEEK_END);        /* seek to end of file */
         if (irc == -1L) {
-            printf("TPM_NVRAM_LoadData: Error (fatal) fseek'ing %s, %s\n",
+            printf("TPM_NVRAM_ReadFile: Error (fatal) fseek'ing %s, %s\n",
                    filename, strerror(errno));
             rc = TPM_FAIL;
         }
@@ -205,7 +687,7 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
     if (rc == 0) {
         lrc = ftell(file);                      /* get position in the stream */
         if (lrc == -1L) {
-            printf("TPM_NVRAM_LoadData: Error (fatal) ftell'ing %s, %s\n",
+            printf("TPM_NVRAM_ReadFile: Error (fatal) ftell'ing %s, %s\n",
                    filename, strerror(errno));
             rc = TPM_FAIL;
         }
@@ -216,17 +698,17 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
     if (rc == 0) {
         irc = fseek(file, 0L, SEEK_SET);        /* seek back to the beginning of the file */
         if (irc == -1L) {
-            printf("TPM_NVRAM_LoadData: Error (fatal) fseek'ing %s, %s\n",
+            printf("TPM_NVRAM_ReadFile: Error (fatal) fseek'ing %s, %s\n",
                    filename, strerror(errno));
             rc = TPM_FAIL;
         }
     }
     /* allocate a buffer for the actual data */
     if ((rc == 0) && *length != 0) {
-        printf(" TPM_NVRAM_LoadData: Reading %u bytes of data\n", *length);
+        printf(" TPM_NVRAM_ReadFile: Reading %u bytes of data\n", *length);
         rc = TPM_Malloc(data, *length);
 	if (rc != 0) {
-            printf("TPM_NVRAM_LoadData: Error (fatal) allocating %u bytes\n", *length);
+            printf("TPM_NVRAM_ReadFile: Error (fatal) allocating %u bytes\n", *length);
             rc = TPM_FAIL;
 	}
     }
@@ -234,152 +716,2132 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
     if ((rc == 0) && *length != 0) {
         src = fread(*data, 1, *length, file);
         if (src != *length) {
-            printf("TPM_NVRAM_LoadData: Error (fatal), data read of %u only read %lu\n",
+            printf("TPM_NVRAM_ReadFile: Error (fatal), data read of %u only read %lu\n",
                    *length, (unsigned long)src);
             rc = TPM_FAIL;
         }
     }
     /* close the file */
     if (file != NULL) {
-        printf(" TPM_NVRAM_LoadData: Closing file %s\n", filename);
+        printf(" TPM_NVRAM_ReadFile: Closing file %s\n", filename);
         irc = fclose(file);             /* @1 */
         if (irc != 0) {
-            printf("TPM_NVRAM_LoadData: Error (fatal) closing file %s\n", filename);
+            printf("TPM_NVRAM_ReadFile: Error (fatal) closing file %s\n", filename);
             rc = TPM_FAIL;
         }
         else {
-            printf(" TPM_NVRAM_LoadData: Closed file %s\n", filename);
+            printf(" TPM_NVRAM_ReadFile: Closed file %s\n", filename);
         }
     }
+    if (rc != 0) {
+        free(*data);
+        *data = NULL;
+        *length = 0;
+    }
     return rc;
 }
 
-/* TPM_NVRAM_StoreData stores 'data' of 'length' to the rooted 'filename'
+/* TPM_NVRAM_WriteFile() writes 'data' of 'length' to the rooted 'filename'.
+
+   'mode' is the fopen() mode, "wb" to replace the file or "ab" to append to it.
+
+   A replacement is written to a temporary file that is then renamed to 'filename', so that a crash
+   leaves either the old or the new file.  The file, and for a rename the directory, are synced
+   according to the TPM_NV_SYNC policy.
 
    Returns
         0 on success
         TPM_FAIL for other fatal errors
 */
 
-TPM_RESULT TPM_NVRAM_StoreData(const unsigned char *data,
-                               uint32_t length,
-			       uint32_t tpm_number,
-                               const char *name)
+static TPM_RESULT TPM_NVRAM_WriteFile(const unsigned char *data,
+				      uint32_t length,
+				      const char *filename,
+				      const char *mode)
 {
     TPM_RESULT  rc = 0;
     uint32_t      lrc;
     int         irc;
     FILE        *file = NULL;
-    char        filename[FILENAME_MAX]; /* rooted file name from name */
-
-#ifdef TPM_LIBTPMS_CALLBACKS
-    struct libtpms_callbacks *cbs = TPMLIB_GetCallbacks();
+    TPM_BOOL    append = (mode[0] == 'a');
+    TPM_BOOL    created = !append;	/* a new directory entry must be synced */
+    char        tmpname[FILENAME_MAX];	/* temporary file for a replacement */
+    const char  *writename;
+    uint32_t    start_sec = 0;
+    uint32_t    start_usec = 0;
+    uint32_t    usec = 0;
 
-    /* call user-provided function if available, otherwise execute
-       default behavior */
-    if (cbs->tpm_nvram_storedata) {
-        rc = cbs->tpm_nvram_storedata(data, length, tpm_number, name);
-        return rc;
+    if (rc == 0) {
+        rc = TPM_GetTimeOfDay(&start_sec, &start_usec);
     }
-#endif
-
-    printf(" TPM_NVRAM_StoreData: To name %s\n", name);
     if (rc == 0) {
-        /* map name to the rooted filename */
-        TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
+        if (append) {
+            writename = filename;
+        }
+        else {
+            sprintf(tmpname, "%s%s", filename, TPM_NVRAM_TMP_SUFFIX);
+            writename = tmpname;
+        }
         /* open the file */
-        printf(" TPM_NVRAM_StoreData: Opening file %s\n", filename);
-        file = fopen(filename, "wb");                           /* closed @1 */
+        printf(" TPM_NVRAM_WriteFile: Opening file %s\n", writename);
+        file = fopen(writename, mode);                           /* closed @1 */
         if (file == NULL) {
-            printf("TPM_NVRAM_StoreData: Error (fatal) opening %s for write failed, %s\n",
-                   filename, strerror(errno));
+            printf("TPM_NVRAM_WriteFile: Error (fatal) opening %s for write failed, %s\n",
+                   writename, strerror(errno));
             rc = TPM_FAIL;
         }
     }
+    /* an append that creates the file adds a directory entry */
+    if ((rc == 0) && append) {
+        irc = fseek(file, 0L, SEEK_END);
+        if ((irc == 0) && (ftell(file) == 0)) {
+            created = TRUE;
+        }
+    }
     /* write the data to the file */
     if (rc == 0) {
-        printf("  TPM_NVRAM_StoreData: Writing %u bytes of data\n", length);
+        printf("  TPM_NVRAM_WriteFile: Writing %u bytes of data\n", length);
         lrc = fwrite(data, 1, length, file);
         if (lrc != length) {
-            printf("TPM_NVRAM_StoreData: Error (fatal), data write of %u only wrote %u\n",
+            printf("TPM_NVRAM_WriteFile: Error (fatal), data write of %u only wrote %u\n",
                    length, lrc);
             rc = TPM_FAIL;
         }
     }
+    if (rc == 0) {
+        irc = fflush(file);
+        if (irc != 0) {
+            printf("TPM_NVRAM_WriteFile: Error (fatal) flushing file %s, %s\n",
+                   writename, strerror(errno));
+            rc = TPM_FAIL;
+        }
+    }
+    /* sync the data before the rename, so that the rename never exposes a partial file */
+    if (rc == 0) {
+        rc = TPM_NVRAM_SyncFile(file, !append, created);
+    }
     if (file != NULL) {
-        printf("  TPM_NVRAM_StoreData: Closing file %s\n", filename);
+        printf("  TPM_NVRAM_WriteFile: Closing file %s\n", writename);
         irc = fclose(file);             /* @1 */
         if (irc != 0) {
-            printf("TPM_NVRAM_StoreData: Error (fatal) closing file\n");
+            printf("TPM_NVRAM_WriteFile: Error (fatal) closing file\n");
             rc = TPM_FAIL;
         }
         else {
-            printf("  TPM_NVRAM_StoreData: Closed file %s\n", filename);
+            printf("  TPM_NVRAM_WriteFile: Closed file %s\n", writename);
+        }
+    }
+    /* replace the original file */
+    if ((rc == 0) && !append) {
+#ifdef TPM_WINDOWS
+        remove(filename);	/* rename() does not replace an existing file */
+#endif
+        irc = rename(tmpname, filename);
+        if (irc != 0) {
+            printf("TPM_NVRAM_WriteFile: Error (fatal) renaming %s, %s\n",
+                   tmpname, strerror(errno));
+            rc = TPM_FAIL;
         }
     }
+    if ((rc != 0) && !append) {
+        remove(tmpname);
+    }
+    /* sync the directory entry, and any group commit that is due */
+    if (rc == 0) {
+        rc = TPM_NVRAM_Sync(FALSE);
+    }
+    /* update the write statistics */
+    if (rc == 0) {
+        rc = TPM_NVRAM_Elapsed(&usec, start_sec, start_usec);
+    }
+    if (rc == 0) {
+        TPM_NVRAM_UpdateMetrics(length, usec);
+        printf("  TPM_NVRAM_WriteFile: Wrote %u bytes in %u usec\n", length, usec);
+    }
     return rc;
 }
 
+/* TPM_NVRAM_SyncFile() applies the TPM_NV_SYNC policy to a written and flushed 'file'.
 
-/* TPM_NVRAM_GetFilenameForName() constructs a rooted file name from the name.
-
-   The filename is of the form:
+   If 'replace' is TRUE, the file is a temporary file that will be renamed over the original.  If
+   'directory' is TRUE, the write also created or renamed a directory entry, and the state
+   directory must be synced.
 
-   state_directory/tpm_number.name
+   always:	sync the file, and the directory after the rename
+   group:	sync a replacement file before its rename.  Queue an appended file and the directory,
+		and sync all pending writes if the interval has expired.
+   none:	nothing
 */
 
-static void TPM_NVRAM_GetFilenameForName(char *filename,        /* output: rooted filename */
-					 uint32_t tpm_number,
-                                         const char *name)      /* input: abstract name */
+static TPM_RESULT TPM_NVRAM_SyncFile(FILE *file,
+				     TPM_BOOL replace,
+				     TPM_BOOL directory)
 {
-    printf(" TPM_NVRAM_GetFilenameForName: For name %s\n", name);
-    sprintf(filename, "%s/%02lx.%s", state_directory, (unsigned long)tpm_number, name);
-    printf("  TPM_NVRAM_GetFilenameForName: File name %s\n", filename);
-    return;
-}
+    TPM_RESULT  rc = 0;
+#ifdef TPM_POSIX
+    int         irc;
 
-/* TPM_NVRAM_DeleteName() deletes the 'name' from NVRAM
+    switch (nvram_sync_policy) {
+      case TPM_NVRAM_SYNC_ALWAYS:
+	irc = fsync(fileno(file));
+	if (irc != 0) {
+	    printf("TPM_NVRAM_SyncFile: Error (fatal) syncing file, %s\n", strerror(errno));
+	    rc = TPM_FAIL;
+	}
+	/* the rename has not happened yet, TPM_NVRAM_Sync() syncs the directory afterwards */
+	if (rc == 0) {
+	    nvram_sync_directory = nvram_sync_directory || directory;
+	}
+	break;
+      case TPM_NVRAM_SYNC_GROUP:
+	/* if the queue is full, sync it first */
+	if (!replace && (nvram_sync_count == TPM_NVRAM_SYNC_PENDING)) {
+	    rc = TPM_NVRAM_Sync(TRUE);
+	}
+	/* the first pending write starts the interval */
+	if ((rc == 0) && (nvram_sync_count == 0) && !nvram_sync_directory && !nvram_sync_map) {
+	    rc = TPM_GetTimeOfDay(&nvram_sync_sec, &nvram_sync_usec);
+	}
+	/* the data must be stable before the rename, or a crash could leave the renamed file empty
+	   or torn.  Only the directory entry is deferred. */
+	if ((rc == 0) && replace) {
+	    irc = fsync(fileno(file));
+	    if (irc != 0) {
+		printf("TPM_NVRAM_SyncFile: Error (fatal) syncing file, %s\n", strerror(errno));
+		rc = TPM_FAIL;
+	    }
+	}
+	/* an append is a journal record, which replay discards if a crash tears it.  Keep a
+	   descriptor, the file can be synced after it is closed. */
+	if ((rc == 0) && !replace) {
+	    nvram_sync_fds[nvram_sync_count] = dup(fileno(file));
+	    if (nvram_sync_fds[nvram_sync_count] < 0) {
+		printf("TPM_NVRAM_SyncFile: Error (fatal) dup failed, %s\n", strerror(errno));
+		rc = TPM_FAIL;
+	    }
+	    if (rc == 0) {
+		nvram_sync_count++;
+	    }
+	}
+	if (rc == 0) {
+	    nvram_sync_directory = nvram_sync_directory || directory;
+	}
+	break;
+      default:
+	break;
+    }
+#else
+    file = file;		/* not used */
+    replace = replace;		/* not used */
+    directory = directory;	/* not used */
+#endif
+    return rc;
+}
 
-   Returns:
-        0 on success, or if the file does not exist and mustExist is FALSE
-        TPM_FAIL if the file could not be removed, since this should never occur and there is
-		no recovery
+/* TPM_NVRAM_Sync() syncs the writes pending under the group commit policy, and the directory
+   entries of completed renames.
 
-   NOTE: Not portable code, but supported by Linux and Windows
+   If 'force' is FALSE, pending writes are only synced once the oldest is older than the TPM_NV_SYNC
+   interval.  Writes call this function, and a caller may call it periodically, e.g. after each
+   command, to bound the time that a write remains volatile.
 */
 
-TPM_RESULT TPM_NVRAM_DeleteName(uint32_t tpm_number,
-				const char *name,
-                                TPM_BOOL mustExist)
+TPM_RESULT TPM_NVRAM_Sync(TPM_BOOL force)
 {
     TPM_RESULT  rc = 0;
+#ifdef TPM_POSIX
     int         irc;
-    char        filename[FILENAME_MAX]; /* rooted file name from name */
-
-#ifdef TPM_LIBTPMS_CALLBACKS
-    struct libtpms_callbacks *cbs = TPMLIB_GetCallbacks();
+    int         dirfd;
+    size_t      i;
+    uint32_t    usec;
 
-    /* call user-provided function if available, otherwise execute
-       default behavior */
-    if (cbs->tpm_nvram_deletename) {
-        rc = cbs->tpm_nvram_deletename(tpm_number, name, mustExist);
-        return rc;
+    /* nothing pending */
+    if ((nvram_sync_count == 0) && !nvram_sync_directory && !nvram_sync_map) {
+	return rc;
     }
-#endif
-    
-    printf(" TPM_NVRAM_DeleteName: Name %s\n", name);
-    /* map name to the rooted filename */
-    TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
-    if (rc == 0) {
-        irc = remove(filename);
-        if ((irc != 0) &&               /* if the remove failed */
-            (mustExist ||               /* if any error is a failure, or */
-             (errno != ENOENT))) {      /* if error other than no such file */
-            printf("TPM_NVRAM_DeleteName: Error, (fatal) file remove failed, errno %d\n",
-                   errno);
-            rc = TPM_FAIL;
+    /* not yet due */
+    if ((rc == 0) && !force && (nvram_sync_policy == TPM_NVRAM_SYNC_GROUP)) {
+	rc = TPM_NVRAM_Elapsed(&usec, nvram_sync_sec, nvram_sync_usec);
+	if ((rc == 0) && (usec < (nvram_sync_interval * 1000))) {
+	    return rc;
+	}
+    }
+    printf(" TPM_NVRAM_Sync: Syncing %lu files, directory %u, memory map %u\n",
+	   (unsigned long)nvram_sync_count, nvram_sync_directory, nvram_sync_map);
+    if (nvram_sync_map) {
+	rc = TPM_NVRAM_Map_SyncAll();
+    }
+    for (i = 0 ; i < nvram_sync_count ; i++) {
+	irc = fsync(nvram_sync_fds[i]);
+	if ((irc != 0) && (rc == 0)) {
+	    printf("TPM_NVRAM_Sync: Error (fatal) syncing file, %s\n", strerror(errno));
+	    rc = TPM_FAIL;
+	}
+	close(nvram_sync_fds[i]);
+    }
+    nvram_sync_count = 0;
+    if (nvram_sync_directory) {
+	dirfd = open(state_directory, O_RDONLY);
+	if (dirfd < 0) {
+	    printf("TPM_NVRAM_Sync: Error (fatal) opening %s, %s\n",
+		   state_directory, strerror(errno));
+	    rc = TPM_FAIL;
+	}
+	else {
+	    irc = fsync(dirfd);
+	    if ((irc != 0) && (rc == 0)) {
+		printf("TPM_NVRAM_Sync: Error (fatal) syncing %s, %s\n",
+		       state_directory, strerror(errno));
+		rc = TPM_FAIL;
+	    }
+	    close(dirfd);
+	}
+	nvram_sync_directory = FALSE;
+    }
+    nvram_metrics.syncs++;
+#else
+    force = force;		/* not used */
+#endif
+    return rc;
+}
+
+/* TPM_NVRAM_SyncTimeout() returns 'pending' TRUE if NV writes or directory entries wait for a
+   sync, and 'msec' the time until TPM_NVRAM_Sync() with 'force' FALSE syncs them.
+
+   A server that waits for a client should wait no longer than 'msec' and then call
+   TPM_NVRAM_Sync(), since otherwise the writes of an idle server remain volatile.
+*/
+
+TPM_RESULT TPM_NVRAM_SyncTimeout(TPM_BOOL *pending,
+				 uint32_t *msec)
+{
+    TPM_RESULT  rc = 0;
+    uint32_t    usec = 0;
+
+    *pending = FALSE;
+    *msec = 0;
+#ifdef TPM_POSIX
+    *pending = (nvram_sync_count != 0) || nvram_sync_directory || nvram_sync_map;
+    if ((rc == 0) && *pending && (nvram_sync_policy == TPM_NVRAM_SYNC_GROUP)) {
+	rc = TPM_NVRAM_Elapsed(&usec, nvram_sync_sec, nvram_sync_usec);
+	/* round up, so that the sync is due when the wait expires */
+	if ((rc == 0) && (usec < (nvram_sync_interval * 1000))) {
+	    *msec = ((nvram_sync_interval * 1000) - usec + 999) / 1000;
+	}
+    }
+#endif
+    return rc;
+}
+
+/* TPM_NVRAM_CheckNames() returns an error if 'names', the most NV names of one TPM instance, may
+   not fit in the journal name cache or in the slots of the memory map.  A memory map opened
+   later is checked as well.
+
+   The journal and the map cannot grow, so the configuration is rejected at startup rather than
+   failing a later write.
+*/
+
+TPM_RESULT TPM_NVRAM_CheckNames(uint32_t names)
+{
+    TPM_RESULT  rc = 0;
+#ifdef TPM_POSIX
+    uint32_t    slotCount;
+    size_t      m;
+#endif
+
+    printf(" TPM_NVRAM_CheckNames: %u names\n", names);
+    if ((nvram_journal_max != 0) && (names > (TPM_NVRAM_JOURNAL_NAMES / TPMS_MAX))) {
+	printf("TPM_NVRAM_CheckNames: Error (fatal), %u names, the journal caches %u\n",
+	       names, TPM_NVRAM_JOURNAL_NAMES / TPMS_MAX);
+	rc = TPM_FAIL;
+    }
+#ifdef TPM_POSIX
+    if ((rc == 0) && nvram_map) {
+	nvram_map_names = names;
+	slotCount = nvram_container ? TPM_NVRAM_CONTAINER_SLOTS : TPM_NVRAM_MAP_SLOTS;
+	if (names > slotCount) {
+	    printf("TPM_NVRAM_CheckNames: Error (fatal), %u names, a new map has %u slots\n",
+		   names, slotCount);
+	    rc = TPM_FAIL;
+	}
+	for (m = 0 ; (rc == 0) && (m < TPMS_MAX) ; m++) {
+	    if (nvram_map_base[m] != NULL) {
+		slotCount = ((TPM_NVRAM_MAP_HEADER *)nvram_map_base[m])->slotCount;
+		if (names > slotCount) {
+		    printf("TPM_NVRAM_CheckNames: Error (fatal), %u names, the map has %u slots\n",
+			   names, slotCount);
+		    rc = TPM_FAIL;
+		}
+	    }
+	}
+    }
+#endif
+    return rc;
+}
+
+/* TPM_NVRAM_GetMetrics() returns the NV write statistics */
+
+void TPM_NVRAM_GetMetrics(TPM_NVRAM_METRICS *tpm_nvram_metrics)
+{
+    *tpm_nvram_metrics = nvram_metrics;
+    return;
+}
+
+/* TPM_NVRAM_UpdateMetrics() records a write of 'length' bytes that took 'usec' */
+
+static void TPM_NVRAM_UpdateMetrics(uint32_t length,
+				    uint32_t usec)
+{
+    nvram_metrics.writes++;
+    nvram_metrics.bytes += length;
+    nvram_metrics.lastUsec = usec;
+    nvram_metrics.totalUsec += usec;
+    if (usec > nvram_metrics.maxUsec) {
+	nvram_metrics.maxUsec = usec;
+    }
+    return;
+}
+
+/* TPM_NVRAM_Elapsed() returns the time in usec since 'start_sec' and 'start_usec' */
+
+static TPM_RESULT TPM_NVRAM_Elapsed(uint32_t *usec,
+				    uint32_t start_sec,
+				    uint32_t start_usec)
+{
+    TPM_RESULT  rc = 0;
+    uint32_t    now_sec;
+    uint32_t    now_usec;
+
+    rc = TPM_GetTimeOfDay(&now_sec, &now_usec);
+    if (rc == 0) {
+	/* saturate rather than wrap */
+	if ((now_sec - start_sec) >= (0xffffffff / 1000000)) {
+	    *usec = 0xffffffff;
+	}
+	else {
+	    *usec = ((now_sec - start_sec) * 1000000) + now_usec - start_usec;
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_GetFilenameForName() constructs a rooted file name from the name.
+
+   The filename is of the form:
+
+   state_directory/tpm_number.name
+*/
+
+static void TPM_NVRAM_GetFilenameForName(char *filename,        /* output: rooted filename */
+					 uint32_t tpm_number,
+                                         const char *name)      /* input: abstract name */
+{
+    printf(" TPM_NVRAM_GetFilenameForName: For name %s\n", name);
+    sprintf(filename, "%s/%02lx.%s", state_directory, (unsigned long)tpm_number, name);
+    printf("  TPM_NVRAM_GetFilenameForName: File name %s\n", filename);
+    return;
+}
+
+/* TPM_NVRAM_Hash() returns a hash of the key and the name, less than 'count' */
+
+static uint32_t TPM_NVRAM_Hash(uint32_t key,
+			       const char *name,
+			       uint32_t count)
+{
+    uint32_t    hash = 2166136261U;	/* FNV-1a */
+    size_t      i;
+
+    for (i = 0 ; i < sizeof(uint32_t) ; i++) {
+	hash = (hash ^ ((key >> (8 * i)) & 0xff)) * 16777619U;
+    }
+    for ( ; *name != '\0' ; name++) {
+	hash = (hash ^ (unsigned char)*name) * 16777619U;
+    }
+    return hash % count;
+}
+
+/* TPM_NVRAM_DeleteName() deletes the 'name' from NVRAM
+
+   Returns:
+        0 on success, or if the file does not exist and mustExist is FALSE
+        TPM_FAIL if the file could not be removed, since this should never occur and there is
+		no recovery
+
+   NOTE: Not portable code, but supported by Linux and Windows
+*/
+
+TPM_RESULT TPM_NVRAM_DeleteName(uint32_t tpm_number,
+				const char *name,
+                                TPM_BOOL mustExist)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+
+#ifdef TPM_LIBTPMS_CALLBACKS
+    struct libtpms_callbacks *cbs = TPMLIB_GetCallbacks();
+
+    /* call user-provided function if available, otherwise execute
+       default behavior */
+    if (cbs->tpm_nvram_deletename) {
+        rc = cbs->tpm_nvram_deletename(tpm_number, name, mustExist);
+        return rc;
+    }
+#endif
+    
+    printf(" TPM_NVRAM_DeleteName: Name %s\n", name);
+    if (nvram_journal_max != 0) {
+        rc = TPM_NVRAM_Journal_DeleteName(tpm_number, name, mustExist);
+    }
+#ifdef TPM_POSIX
+    else if (nvram_map) {
+        /* fold in a journal left by a run with TPM_NV_JOURNAL set */
+        rc = TPM_NVRAM_Journal_Drain(tpm_number);
+        if (rc == 0) {
+            rc = TPM_NVRAM_Map_DeleteName(tpm_number, name, mustExist);
+        }
+    }
+#endif
+    else {
+        /* fold in a journal or map left by a run with TPM_NV_JOURNAL or TPM_NV_MMAP set */
+        rc = TPM_NVRAM_Journal_Drain(tpm_number);
+        if (rc == 0) {
+            rc = TPM_NVRAM_Map_Drain(tpm_number);
         }
+        if (rc == 0) {
+            /* map name to the rooted filename */
+            TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
+            irc = remove(filename);
+            if ((irc != 0) &&               /* if the remove failed */
+                (mustExist ||               /* if any error is a failure, or */
+                 (errno != ENOENT))) {      /* if error other than no such file */
+                printf("TPM_NVRAM_DeleteName: Error, (fatal) file remove failed, errno %d\n",
+                       errno);
+                rc = TPM_FAIL;
+            }
+        }
+    }
+    return rc;
+}
+
+/*
+  Journal
+*/
+
+/* TPM_NVRAM_Journal_GetEntry() returns the cached contents of 'name'.
+
+   If the name is not cached, a free entry is initialized from the file.  A missing file yields an
+   entry with 'exists' FALSE.
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_GetEntry(TPM_NVRAM_ENTRY **entry,
+					     uint32_t tpm_number,
+					     const char *name)
+{
+    TPM_RESULT  rc = 0;
+    uint32_t    bucket;
+    uint32_t    i;
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+
+    *entry = NULL;
+    /* search the hash chain for the cached name */
+    bucket = TPM_NVRAM_Hash(tpm_number, name, TPM_NVRAM_JOURNAL_NAMES);
+    for (i = nvram_entry_buckets[bucket] ; (i != 0) && (*entry == NULL) ;
+	 i = nvram_entries[i - 1].next) {
+	if ((nvram_entries[i - 1].tpm_number == tpm_number) &&
+	    (strcmp(nvram_entries[i - 1].name, name) == 0)) {
+	    *entry = &(nvram_entries[i - 1]);
+	}
+    }
+    /* if not cached, get a free entry */
+    if (*entry == NULL) {
+	if (strlen(name) >= TPM_FILENAME_MAX) {
+	    printf("TPM_NVRAM_Journal_GetEntry: Error (fatal), name %s too long\n", name);
+	    rc = TPM_FAIL;
+	}
+	/* the entries of deleted or missing names are freed by a compaction.  A replay does not
+	   compact, the journal would then lose the records not yet replayed. */
+	if ((rc == 0) && nvram_journal_replayed[tpm_number] &&
+	    (nvram_entry_free == 0) && (nvram_entries_used >= TPM_NVRAM_JOURNAL_NAMES)) {
+	    rc = TPM_NVRAM_Journal_Compact(tpm_number);
+	}
+	if (rc == 0) {
+	    if (nvram_entry_free != 0) {
+		i = nvram_entry_free;
+	    }
+	    else if (nvram_entries_used < TPM_NVRAM_JOURNAL_NAMES) {
+		i = nvram_entries_used + 1;
+	    }
+	    else {
+		printf("TPM_NVRAM_Journal_GetEntry: Error (fatal), no free entry for %s\n", name);
+		rc = TPM_FAIL;
+	    }
+	}
+	/* initialize the entry from the file */
+	if (rc == 0) {
+	    *entry = &(nvram_entries[i - 1]);
+	    TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
+	    rc = TPM_NVRAM_ReadFile(&((*entry)->data), &((*entry)->length), filename);
+	    if (rc == 0) {
+		(*entry)->exists = TRUE;
+	    }
+	    else if (rc == TPM_RETRY) {
+		(*entry)->exists = FALSE;
+		rc = 0;
+	    }
+	}
+	/* take the entry and link it into the hash chain */
+	if (rc == 0) {
+	    if (i == nvram_entry_free) {
+		nvram_entry_free = (*entry)->next;
+	    }
+	    else {
+		nvram_entries_used++;
+	    }
+	    (*entry)->inUse = TRUE;
+	    (*entry)->tpm_number = tpm_number;
+	    strcpy((*entry)->name, name);
+	    (*entry)->next = nvram_entry_buckets[bucket];
+	    nvram_entry_buckets[bucket] = i;
+	}
+	else {
+	    *entry = NULL;
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Journal_FreeEntry() removes the entry from its hash chain, frees its contents, and
+   puts it on the free list */
+
+static void TPM_NVRAM_Journal_FreeEntry(TPM_NVRAM_ENTRY *entry)
+{
+    uint32_t    *link;
+    uint32_t    i = (entry - nvram_entries) + 1;
+
+    for (link = &(nvram_entry_buckets[TPM_NVRAM_Hash(entry->tpm_number, entry->name,
+						      TPM_NVRAM_JOURNAL_NAMES)]) ;
+	 (*link != 0) && (*link != i) ;
+	 link = &(nvram_entries[*link - 1].next)) ;
+    if (*link != 0) {
+	*link = entry->next;
+    }
+    free(entry->data);
+    memset(entry, 0, sizeof(TPM_NVRAM_ENTRY));
+    entry->next = nvram_entry_free;
+    nvram_entry_free = i;
+    return;
+}
+
+/* TPM_NVRAM_Journal_Apply() applies a write of 'size' bytes of 'data' at 'offset' to the entry,
+   after setting the entry to 'length' bytes.
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_Apply(TPM_NVRAM_ENTRY *entry,
+					  uint32_t length,
+					  uint32_t offset,
+					  uint32_t size,
+					  const unsigned char *data)
+{
+    TPM_RESULT  rc = 0;
+
+    if ((offset > length) || (size > (length - offset))) {
+	printf("TPM_NVRAM_Journal_Apply: Error (fatal), range %u %u beyond length %u\n",
+	       offset, size, length);
+	rc = TPM_FAIL;
+    }
+    /* resize, zero filling any extension */
+    if ((rc == 0) && (length != entry->length)) {
+	if (length == 0) {
+	    free(entry->data);
+	    entry->data = NULL;
+	}
+	else {
+	    rc = TPM_Realloc(&(entry->data), length);
+	    if ((rc == 0) && (length > entry->length)) {
+		memset(entry->data + entry->length, 0, length - entry->length);
+	    }
+	}
+    }
+    if (rc == 0) {
+	entry->length = length;
+	entry->exists = TRUE;
+	if (size != 0) {
+	    memcpy(entry->data + offset, data, size);
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Journal_Record() appends a journal record to 'sbuffer'.
+
+   'data' is the complete new contents of 'length' bytes.  The record holds the 'size' bytes at
+   'offset'.
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_Record(TPM_STORE_BUFFER *sbuffer,
+					   uint16_t type,
+					   const char *name,
+					   uint32_t length,
+					   uint32_t offset,
+					   uint32_t size,
+					   const unsigned char *data)
+{
+    TPM_RESULT		rc = 0;
+    const unsigned char *buffer;
+    uint32_t		start;
+    uint32_t		end;
+    TPM_DIGEST		digest;
+
+    TPM_Sbuffer_Get(sbuffer, &buffer, &start);
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append16(sbuffer, type);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append8(sbuffer, (uint8_t)strlen(name));
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append(sbuffer, (const unsigned char *)name, strlen(name));
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(sbuffer, length);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(sbuffer, offset);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(sbuffer, size);
+    }
+    if ((rc == 0) && (size != 0)) {
+	rc = TPM_Sbuffer_Append(sbuffer, data + offset, size);
+    }
+    /* digest the record */
+    if (rc == 0) {
+	TPM_Sbuffer_Get(sbuffer, &buffer, &end);
+	rc = TPM_SHA1(digest,
+		      end - start, buffer + start,
+		      0, NULL);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append(sbuffer, digest, TPM_DIGEST_SIZE);
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Journal_Replay() applies the records in 'stream' to the cached entries.
+
+   'valid_size' returns the size of the valid records.  Records after an invalid record, typically
+   one torn by a crash, are ignored.
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_Replay(uint32_t *valid_size,
+					   uint32_t tpm_number,
+					   unsigned char *stream,
+					   uint32_t stream_size)
+{
+    TPM_RESULT		rc = 0;
+    TPM_RESULT		rc1 = 0;	/* record parse result */
+    unsigned char	*record;
+    uint32_t		record_size;
+    uint16_t		type = 0;
+    uint8_t		nameLength = 0;
+    char		name[TPM_FILENAME_MAX];
+    uint32_t		length = 0;
+    uint32_t		offset = 0;
+    uint32_t		size = 0;
+    unsigned char	*data = NULL;
+    TPM_NVRAM_ENTRY	*entry;
+    uint32_t		records;
+
+    printf(" TPM_NVRAM_Journal_Replay: Journal size %u\n", stream_size);
+    *valid_size = 0;
+    for (records = 0 ; (rc == 0) && (stream_size != 0) ; records++) {
+	record = stream;
+	record_size = stream_size;
+	rc1 = 0;
+	/* parse the record */
+	if (rc1 == 0) {
+	    rc1 = TPM_Load16(&type, &stream, &stream_size);
+	}
+	if (rc1 == 0) {
+	    rc1 = TPM_Load8(&nameLength, &stream, &stream_size);
+	}
+	if (rc1 == 0) {
+	    if ((nameLength >= TPM_FILENAME_MAX) || (nameLength > stream_size)) {
+		rc1 = TPM_BAD_PARAM_SIZE;
+	    }
+	}
+	if (rc1 == 0) {
+	    memcpy(name, stream, nameLength);
+	    name[nameLength] = '\0';
+	    stream += nameLength;
+	    stream_size -= nameLength;
+	    rc1 = TPM_Load32(&length, &stream, &stream_size);
+	}
+	if (rc1 == 0) {
+	    rc1 = TPM_Load32(&offset, &stream, &stream_size);
+	}
+	if (rc1 == 0) {
+	    rc1 = TPM_Load32(&size, &stream, &stream_size);
+	}
+	if (rc1 == 0) {
+	    if ((size > stream_size) ||
+		((stream_size - size) < TPM_DIGEST_SIZE)) {
+		rc1 = TPM_BAD_PARAM_SIZE;
+	    }
+	}
+	if (rc1 == 0) {
+	    data = stream;
+	    stream += size;
+	    stream_size -= size;
+	    rc1 = TPM_SHA1_Check(stream,
+				 record_size - stream_size, record,
+				 0, NULL);
+	}
+	if (rc1 == 0) {
+	    stream += TPM_DIGEST_SIZE;
+	    stream_size -= TPM_DIGEST_SIZE;
+	}
+	/* a bad record ends the journal */
+	if (rc1 != 0) {
+	    printf("TPM_NVRAM_Journal_Replay: Ignoring %u bytes after record %u\n",
+		   record_size, records);
+	    break;
+	}
+	/* apply the record */
+	if (rc == 0) {
+	    rc = TPM_NVRAM_Journal_GetEntry(&entry, tpm_number, name);
+	}
+	if (rc == 0) {
+	    if (type == TPM_NVRAM_JOURNAL_WRITE) {
+		rc = TPM_NVRAM_Journal_Apply(entry, length, offset, size, data);
+	    }
+	    else if (type == TPM_NVRAM_JOURNAL_DELETE) {
+		free(entry->data);
+		entry->data = NULL;
+		entry->length = 0;
+		entry->exists = FALSE;
+	    }
+	    else {
+		printf("TPM_NVRAM_Journal_Replay: Error (fatal), bad record type %04hx\n", type);
+		rc = TPM_FAIL;
+	    }
+	}
+	if (rc == 0) {
+	    *valid_size += record_size - stream_size;
+	}
+    }
+    printf("  TPM_NVRAM_Journal_Replay: Replayed %u bytes\n", *valid_size);
+    return rc;
+}
+
+/* TPM_NVRAM_Journal_Open() replays the instance journal once, before the first access to an
+   instance name.
+
+   A torn record at the end of the journal is removed, so that later records are appended after
+   the last valid record.
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_Open(uint32_t tpm_number)
+{
+    TPM_RESULT		rc = 0;
+    unsigned char	*stream = NULL;
+    uint32_t		stream_size;
+    uint32_t		valid_size = 0;
+    char		filename[FILENAME_MAX]; /* rooted file name from name */
+
+    if (tpm_number >= TPMS_MAX) {
+	printf("TPM_NVRAM_Journal_Open: Error (fatal), TPM number %u out of range\n", tpm_number);
+	rc = TPM_FAIL;
+    }
+    if ((rc == 0) && !nvram_journal_replayed[tpm_number]) {
+	printf(" TPM_NVRAM_Journal_Open: TPM number %u\n", tpm_number);
+	TPM_NVRAM_GetFilenameForName(filename, tpm_number, TPM_JOURNAL_NAME);
+	if (rc == 0) {
+	    rc = TPM_NVRAM_ReadFile(&stream, &stream_size, filename);	/* freed @1 */
+	}
+	if (rc == 0) {
+	    rc = TPM_NVRAM_Journal_Replay(&valid_size, tpm_number, stream, stream_size);
+	}
+	/* remove a torn record */
+	if ((rc == 0) && (valid_size != stream_size)) {
+	    rc = TPM_NVRAM_WriteFile(stream, valid_size, filename, "wb");
+	}
+	/* no journal, first time or just compacted */
+	if (rc == TPM_RETRY) {
+	    rc = 0;
+	}
+	if (rc == 0) {
+	    nvram_journal_size[tpm_number] = valid_size;
+	    nvram_journal_replayed[tpm_number] = TRUE;
+	}
+	free(stream);	/* @1 */
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Journal_Compact() writes all cached names of the instance to their files and empties
+   the journal.  The entries of the names that do not exist are then freed.
+
+   If interrupted, the journal is still complete, and replaying it over the partially written
+   files yields the current state.
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_Compact(uint32_t tpm_number)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+    size_t      i;
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+
+    printf(" TPM_NVRAM_Journal_Compact: TPM number %u journal size %u\n",
+	   tpm_number, nvram_journal_size[tpm_number]);
+    for (i = 0 ; (rc == 0) && (i < TPM_NVRAM_JOURNAL_NAMES) ; i++) {
+	if (nvram_entries[i].inUse && (nvram_entries[i].tpm_number == tpm_number)) {
+	    TPM_NVRAM_GetFilenameForName(filename, tpm_number, nvram_entries[i].name);
+	    if (nvram_entries[i].exists) {
+		rc = TPM_NVRAM_WriteFile(nvram_entries[i].data, nvram_entries[i].length,
+					 filename, "wb");
+	    }
+	    else {
+		irc = remove(filename);
+		if ((irc != 0) && (errno != ENOENT)) {
+		    printf("TPM_NVRAM_Journal_Compact: Error, (fatal) file remove failed, "
+			   "errno %d\n", errno);
+		    rc = TPM_FAIL;
+		}
+	    }
+	}
+    }
+    /* empty the journal */
+    if (rc == 0) {
+	TPM_NVRAM_GetFilenameForName(filename, tpm_number, TPM_JOURNAL_NAME);
+	rc = TPM_NVRAM_WriteFile(NULL, 0, filename, "wb");
+    }
+    if (rc == 0) {
+	nvram_journal_size[tpm_number] = 0;
+    }
+    /* a deleted name no longer needs its entry, the missing file now records the deletion */
+    for (i = 0 ; (rc == 0) && (i < TPM_NVRAM_JOURNAL_NAMES) ; i++) {
+	if (nvram_entries[i].inUse && (nvram_entries[i].tpm_number == tpm_number) &&
+	    !nvram_entries[i].exists) {
+	    TPM_NVRAM_Journal_FreeEntry(&(nvram_entries[i]));
+	}
     }
     return rc;
 }
 
+/* TPM_NVRAM_Journal_Drain() is called when journaling is disabled.  Once per instance, a journal
+   left by an earlier run with TPM_NV_JOURNAL set is replayed into the files and removed.
+   Otherwise, the files would silently lose the journaled writes.
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_Drain(uint32_t tpm_number)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+    size_t      i;
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+
+    if ((tpm_number < TPMS_MAX) && !nvram_journal_replayed[tpm_number]) {
+	if (rc == 0) {
+	    rc = TPM_NVRAM_Journal_Open(tpm_number);
+	}
+	/* write the replayed contents to the files */
+	if ((rc == 0) && (nvram_journal_size[tpm_number] != 0)) {
+	    printf(" TPM_NVRAM_Journal_Drain: TPM number %u\n", tpm_number);
+	    rc = TPM_NVRAM_Journal_Compact(tpm_number);
+	}
+	if (rc == 0) {
+	    TPM_NVRAM_GetFilenameForName(filename, tpm_number, TPM_JOURNAL_NAME);
+	    irc = remove(filename);
+	    if ((irc != 0) && (errno != ENOENT)) {
+		printf("TPM_NVRAM_Journal_Drain: Error, (fatal) file remove failed, errno %d\n",
+		       errno);
+		rc = TPM_FAIL;
+	    }
+	}
+	/* the files are now current, the cache is not used */
+	for (i = 0 ; (rc == 0) && (i < TPM_NVRAM_JOURNAL_NAMES) ; i++) {
+	    if (nvram_entries[i].inUse && (nvram_entries[i].tpm_number == tpm_number)) {
+		TPM_NVRAM_Journal_FreeEntry(&(nvram_entries[i]));
+	    }
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Journal_Append() appends the records in 'sbuffer' to the instance journal.
+
+   The caller updates the cached contents and then calls TPM_NVRAM_Journal_Limit().
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_Append(uint32_t tpm_number,
+					   TPM_STORE_BUFFER *sbuffer)
+{
+    TPM_RESULT		rc = 0;
+    const unsigned char *buffer;
+    uint32_t		length;
+    char		filename[FILENAME_MAX]; /* rooted file name from name */
+
+    TPM_Sbuffer_Get(sbuffer, &buffer, &length);
+    if (length != 0) {
+	printf(" TPM_NVRAM_Journal_Append: Appending %u bytes\n", length);
+	TPM_NVRAM_GetFilenameForName(filename, tpm_number, TPM_JOURNAL_NAME);
+	rc = TPM_NVRAM_WriteFile(buffer, length, filename, "ab");
+	if (rc == 0) {
+	    nvram_journal_size[tpm_number] += length;
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Journal_Limit() compacts the journal if it exceeds the threshold.
+
+   It must follow the update of the cached contents, since compaction writes the cache to the
+   files and empties the journal.
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_Limit(uint32_t tpm_number)
+{
+    TPM_RESULT		rc = 0;
+
+    if (nvram_journal_size[tpm_number] > nvram_journal_max) {
+	rc = TPM_NVRAM_Journal_Compact(tpm_number);
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Journal_LoadData() returns a copy of the current contents of 'name'.
+
+   Returns TPM_RETRY if the name does not exist.
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_LoadData(unsigned char **data,     /* freed by caller */
+					     uint32_t *length,
+					     uint32_t tpm_number,
+					     const char *name)
+{
+    TPM_RESULT		rc = 0;
+    TPM_NVRAM_ENTRY	*entry;
+
+    if (rc == 0) {
+	rc = TPM_NVRAM_Journal_Open(tpm_number);
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Journal_GetEntry(&entry, tpm_number, name);
+    }
+    if (rc == 0) {
+	if (!entry->exists) {
+	    printf("TPM_NVRAM_Journal_LoadData: No such name %s\n", name);
+	    rc = TPM_RETRY;
+	}
+    }
+    if ((rc == 0) && (entry->length != 0)) {
+	printf(" TPM_NVRAM_Journal_LoadData: Copying %u bytes of data\n", entry->length);
+	rc = TPM_Malloc(data, entry->length);
+	if (rc == 0) {
+	    memcpy(*data, entry->data, entry->length);
+	    *length = entry->length;
+	}
+	else {
+	    printf("TPM_NVRAM_Journal_LoadData: Error (fatal) allocating %u bytes\n",
+		   entry->length);
+	    rc = TPM_FAIL;
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Journal_StoreData() appends the bytes of 'data' that differ from the current contents
+   of 'name' to the journal.
+
+   Changed ranges are coalesced when they are closer than TPM_NVRAM_JOURNAL_GAP.  If the name is
+   new or its length changes, all of 'data' is recorded.
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_StoreData(const unsigned char *data,
+					      uint32_t length,
+					      uint32_t tpm_number,
+					      const char *name)
+{
+    TPM_RESULT		rc = 0;
+    TPM_NVRAM_ENTRY	*entry;
+    TPM_STORE_BUFFER	sbuffer;	/* journal records */
+    uint32_t		start;		/* changed range */
+    uint32_t		end;
+    uint32_t		i;
+
+    TPM_Sbuffer_Init(&sbuffer);		/* freed @1 */
+    if (rc == 0) {
+	rc = TPM_NVRAM_Journal_Open(tpm_number);
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Journal_GetEntry(&entry, tpm_number, name);
+    }
+    /* record the changed ranges */
+    if (rc == 0) {
+	if (!entry->exists || (entry->length != length)) {
+	    rc = TPM_NVRAM_Journal_Record(&sbuffer, TPM_NVRAM_JOURNAL_WRITE, name,
+					  length, 0, length, data);
+	}
+	else {
+	    for (i = 0 ; (rc == 0) && (i < length) ; ) {
+		/* skip unchanged bytes */
+		if (data[i] == entry->data[i]) {
+		    i++;
+		    continue;
+		}
+		/* extend the range until TPM_NVRAM_JOURNAL_GAP unchanged bytes */
+		start = i;
+		end = i + 1;
+		for (i++ ; (i < length) && ((i - end) < TPM_NVRAM_JOURNAL_GAP) ; i++) {
+		    if (data[i] != entry->data[i]) {
+			end = i + 1;
+		    }
+		}
+		rc = TPM_NVRAM_Journal_Record(&sbuffer, TPM_NVRAM_JOURNAL_WRITE, name,
+					      length, start, end - start, data);
+	    }
+	}
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Journal_Append(tpm_number, &sbuffer);
+    }
+    /* update the cached contents */
+    if (rc == 0) {
+	rc = TPM_NVRAM_Journal_Apply(entry, length, 0, length, data);
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Journal_Limit(tpm_number);
+    }
+    TPM_Sbuffer_Delete(&sbuffer);	/* @1 */
+    return rc;
+}
+
+/* TPM_NVRAM_Journal_DeleteName() appends a delete record for 'name' to the journal.
+
+   Returns TPM_FAIL if the name does not exist and mustExist is TRUE.
+*/
+
+static TPM_RESULT TPM_NVRAM_Journal_DeleteName(uint32_t tpm_number,
+					       const char *name,
+					       TPM_BOOL mustExist)
+{
+    TPM_RESULT		rc = 0;
+    TPM_NVRAM_ENTRY	*entry;
+    TPM_STORE_BUFFER	sbuffer;	/* journal record */
+
+    TPM_Sbuffer_Init(&sbuffer);		/* freed @1 */
+    if (rc == 0) {
+	rc = TPM_NVRAM_Journal_Open(tpm_number);
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Journal_GetEntry(&entry, tpm_number, name);
+    }
+    if ((rc == 0) && !entry->exists && mustExist) {
+	printf("TPM_NVRAM_Journal_DeleteName: Error, (fatal) name %s does not exist\n", name);
+	rc = TPM_FAIL;
+    }
+    if ((rc == 0) && entry->exists) {
+	if (rc == 0) {
+	    rc = TPM_NVRAM_Journal_Record(&sbuffer, TPM_NVRAM_JOURNAL_DELETE, name,
+					  0, 0, 0, NULL);
+	}
+	if (rc == 0) {
+	    rc = TPM_NVRAM_Journal_Append(tpm_number, &sbuffer);
+	}
+	if (rc == 0) {
+	    free(entry->data);
+	    entry->data = NULL;
+	    entry->length = 0;
+	    entry->exists = FALSE;
+	}
+	if (rc == 0) {
+	    rc = TPM_NVRAM_Journal_Limit(tpm_number);
+	}
+    }
+    TPM_Sbuffer_Delete(&sbuffer);	/* @1 */
+    return rc;
+}
+
+/*
+  Memory Map
+*/
+
+#ifdef TPM_POSIX
+
+/* TPM_NVRAM_Map_Index() returns the mapping used by the instance */
+
+static size_t TPM_NVRAM_Map_Index(uint32_t tpm_number)
+{
+    return nvram_container ? 0 : tpm_number;
+}
+
+/* TPM_NVRAM_Map_Key() returns the slot key of the instance */
+
+static uint32_t TPM_NVRAM_Map_Key(uint32_t tpm_number)
+{
+    return nvram_container ? (nvram_container_instance + tpm_number) : tpm_number;
+}
+
+/* TPM_NVRAM_Map_Slot() returns slot 'i' of mapping 'm'.  The pointer is invalidated by a remap. */
+
+static TPM_NVRAM_MAP_SLOT *TPM_NVRAM_Map_Slot(size_t m,
+					      uint32_t i)
+{
+    return (TPM_NVRAM_MAP_SLOT *)(nvram_map_base[m] + TPM_NVRAM_MAP_SLOTS_OFFSET +
+				  (i * sizeof(TPM_NVRAM_MAP_SLOT)));
+}
+
+/* TPM_NVRAM_Map_HeaderSize() returns the page aligned size of the header and 'slotCount' slots */
+
+static uint32_t TPM_NVRAM_Map_HeaderSize(uint32_t slotCount)
+{
+    uint32_t    size;
+
+    size = TPM_NVRAM_MAP_SLOTS_OFFSET + (slotCount * sizeof(TPM_NVRAM_MAP_SLOT));
+    return ((size + TPM_NVRAM_MAP_ALIGN - 1) / TPM_NVRAM_MAP_ALIGN) * TPM_NVRAM_MAP_ALIGN;
+}
+
+/* TPM_NVRAM_Map_Msync() syncs 'size' bytes of mapping 'm' starting at 'offset' */
+
+static TPM_RESULT TPM_NVRAM_Map_Msync(size_t m,
+				      uint32_t offset,
+				      uint32_t size)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+    uint32_t    pagesize = sysconf(_SC_PAGESIZE);
+    uint32_t    start;
+
+    /* msync() requires a page aligned address */
+    start = offset - (offset % pagesize);
+    irc = msync(nvram_map_base[m] + start, size + offset - start, MS_SYNC);
+    if (irc != 0) {
+	printf("TPM_NVRAM_Map_Msync: Error (fatal) syncing, %s\n", strerror(errno));
+	rc = TPM_FAIL;
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_SyncAll() syncs all mappings with writes pending under the group commit policy */
+
+static TPM_RESULT TPM_NVRAM_Map_SyncAll(void)
+{
+    TPM_RESULT  rc = 0;
+    TPM_RESULT  rc1;
+    size_t      m;
+
+    for (m = 0 ; m < TPMS_MAX ; m++) {
+	if (nvram_map_dirty[m]) {
+	    /* msync() writes back only the dirty pages */
+	    rc1 = TPM_NVRAM_Map_Msync(m, 0, nvram_map_size[m]);
+	    if (rc == 0) {
+		rc = rc1;
+	    }
+	    nvram_map_dirty[m] = FALSE;
+	}
+    }
+    nvram_sync_map = FALSE;
+    return rc;
+}
+
+/* TPM_NVRAM_Map_Written() applies the TPM_NV_SYNC policy to 'size' bytes written at 'offset'.
+
+   always:	sync the bytes
+   group:	mark the mapping, TPM_NVRAM_Sync() syncs it when the interval has expired
+   none:	nothing
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_Written(size_t m,
+					uint32_t offset,
+					uint32_t size)
+{
+    TPM_RESULT  rc = 0;
+
+    switch (nvram_sync_policy) {
+      case TPM_NVRAM_SYNC_ALWAYS:
+	rc = TPM_NVRAM_Map_Msync(m, offset, size);
+	break;
+      case TPM_NVRAM_SYNC_GROUP:
+	/* the first pending write starts the interval */
+	if ((nvram_sync_count == 0) && !nvram_sync_directory && !nvram_sync_map) {
+	    rc = TPM_GetTimeOfDay(&nvram_sync_sec, &nvram_sync_usec);
+	}
+	if (rc == 0) {
+	    nvram_map_dirty[m] = TRUE;
+	    nvram_sync_map = TRUE;
+	}
+	break;
+      default:
+	break;
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_Ordered() syncs 'size' bytes written at 'offset' that a later write will refer to,
+   such as the new copy of a name before the slot state switches to it.  Unlike
+   TPM_NVRAM_Map_Written(), the group commit policy does not defer the sync, since the later write
+   might otherwise reach the file first.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_Ordered(size_t m,
+					uint32_t offset,
+					uint32_t size)
+{
+    TPM_RESULT  rc = 0;
+
+    if (nvram_sync_policy != TPM_NVRAM_SYNC_NONE) {
+	rc = TPM_NVRAM_Map_Msync(m, offset, size);
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_Close() unmaps and closes mapping 'm' */
+
+static void TPM_NVRAM_Map_Close(size_t m)
+{
+    if (nvram_map_base[m] != NULL) {
+	munmap(nvram_map_base[m], nvram_map_size[m]);
+	nvram_map_base[m] = NULL;
+	nvram_map_size[m] = 0;
+    }
+    if (nvram_map_fd[m] >= 0) {
+	close(nvram_map_fd[m]);
+	nvram_map_fd[m] = -1;
+    }
+    nvram_map_dirty[m] = FALSE;
+    return;
+}
+
+/* TPM_NVRAM_Map_Remap() maps the file of mapping 'm', which is 'size' bytes */
+
+static TPM_RESULT TPM_NVRAM_Map_Remap(size_t m,
+				      uint32_t size)
+{
+    TPM_RESULT  rc = 0;
+    void        *base;
+
+    if (nvram_map_base[m] != NULL) {
+	munmap(nvram_map_base[m], nvram_map_size[m]);
+	nvram_map_base[m] = NULL;
+	nvram_map_size[m] = 0;
+    }
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, nvram_map_fd[m], 0);
+    if (base == MAP_FAILED) {
+	printf("TPM_NVRAM_Map_Remap: Error (fatal) mapping %u bytes, %s\n",
+	       size, strerror(errno));
+	rc = TPM_FAIL;
+    }
+    if (rc == 0) {
+	nvram_map_base[m] = base;
+	nvram_map_size[m] = size;
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_Lock() takes or releases the container allocation lock.  It is a no-op for a per
+   instance map.
+
+   After taking the lock, the mapping is extended if another process grew the file.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_Lock(size_t m,
+				     TPM_BOOL lock)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+    struct flock fl;
+    struct stat st;
+
+    if (nvram_container) {
+	memset(&fl, 0, sizeof(struct flock));
+	fl.l_type = lock ? F_WRLCK : F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = TPM_NVRAM_CONTAINER_LOCK;
+	fl.l_len = 1;
+	irc = fcntl(nvram_map_fd[m], F_SETLKW, &fl);
+	if (irc != 0) {
+	    printf("TPM_NVRAM_Map_Lock: Error (fatal) lock %u, %s\n", lock, strerror(errno));
+	    rc = TPM_FAIL;
+	}
+	if ((rc == 0) && lock) {
+	    irc = fstat(nvram_map_fd[m], &st);
+	    if (irc != 0) {
+		printf("TPM_NVRAM_Map_Lock: Error (fatal) fstat, %s\n", strerror(errno));
+		rc = TPM_FAIL;
+	    }
+	    if ((rc == 0) && (st.st_size > 0x7fffffff)) {
+		printf("TPM_NVRAM_Map_Lock: Error (fatal) size %lu\n", (unsigned long)st.st_size);
+		rc = TPM_FAIL;
+	    }
+	    if ((rc == 0) && (st.st_size != 0) && ((uint32_t)st.st_size != nvram_map_size[m])) {
+		rc = TPM_NVRAM_Map_Remap(m, st.st_size);
+	    }
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_LockInstance() takes the container lock of the instance, once.  A second process
+   opening the same instance fails.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_LockInstance(uint32_t tpm_number)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+    struct flock fl;
+    uint32_t    key = TPM_NVRAM_Map_Key(tpm_number);
+
+    if (nvram_container && !nvram_map_locked[tpm_number]) {
+	if (key >= (0x7fffffff - TPM_NVRAM_CONTAINER_LOCK)) {
+	    printf("TPM_NVRAM_Map_LockInstance: Error (fatal) instance %u\n", key);
+	    rc = TPM_FAIL;
+	}
+	if (rc == 0) {
+	    memset(&fl, 0, sizeof(struct flock));
+	    fl.l_type = F_WRLCK;
+	    fl.l_whence = SEEK_SET;
+	    fl.l_start = TPM_NVRAM_CONTAINER_LOCK + 1 + key;
+	    fl.l_len = 1;
+	    irc = fcntl(nvram_map_fd[TPM_NVRAM_Map_Index(tpm_number)], F_SETLK, &fl);
+	    if (irc != 0) {
+		printf("TPM_NVRAM_Map_LockInstance: Error (fatal) instance %u is in use, %s\n",
+		       key, strerror(errno));
+		rc = TPM_FAIL;
+	    }
+	}
+	if (rc == 0) {
+	    printf(" TPM_NVRAM_Map_LockInstance: Locked instance %u\n", key);
+	    nvram_map_locked[tpm_number] = TRUE;
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_Validate() checks the mapped file of mapping 'm', so that later accesses can trust
+   the header and the slots.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_Validate(size_t m)
+{
+    TPM_RESULT  rc = 0;
+    TPM_NVRAM_MAP_HEADER *header = (TPM_NVRAM_MAP_HEADER *)nvram_map_base[m];
+    TPM_NVRAM_MAP_SLOT *slot;
+    uint32_t    size = nvram_map_size[m];
+    uint32_t    i;
+    size_t      j;
+
+    if ((header->magic != TPM_NVRAM_MAP_MAGIC) ||
+	(header->version != TPM_NVRAM_MAP_VERSION)) {
+	printf("TPM_NVRAM_Map_Validate: Error (fatal) magic %08x version %u\n",
+	       header->magic, header->version);
+	rc = TPM_FAIL;
+    }
+    if ((rc == 0) &&
+	((header->slotCount == 0) ||
+	 (header->slotCount > ((size - TPM_NVRAM_MAP_SLOTS_OFFSET) / sizeof(TPM_NVRAM_MAP_SLOT))) ||
+	 (TPM_NVRAM_Map_HeaderSize(header->slotCount) > size))) {
+	printf("TPM_NVRAM_Map_Validate: Error (fatal) slot count %u\n", header->slotCount);
+	rc = TPM_FAIL;
+    }
+    /* an existing map keeps its slot count, see TPM_NVRAM_CheckNames() */
+    if ((rc == 0) && (header->slotCount < nvram_map_names)) {
+	printf("TPM_NVRAM_Map_Validate: Error (fatal) slot count %u, %u names\n",
+	       header->slotCount, nvram_map_names);
+	rc = TPM_FAIL;
+    }
+    for (j = 0 ; (rc == 0) && (j < TPM_NVRAM_MAP_CLASSES) ; j++) {
+	if ((header->freeHead[j] != 0) &&
+	    (((header->freeHead[j] % TPM_NVRAM_MAP_ALIGN) != 0) ||
+	     (header->freeHead[j] > (size - TPM_NVRAM_MAP_ALIGN)))) {
+	    printf("TPM_NVRAM_Map_Validate: Error (fatal) free list %lu\n", (unsigned long)j);
+	    rc = TPM_FAIL;
+	}
+    }
+    for (i = 0 ; (rc == 0) && (i < header->slotCount) ; i++) {
+	slot = TPM_NVRAM_Map_Slot(m, i);
+	if (slot->name[TPM_FILENAME_MAX - 1] != '\0') {
+	    rc = TPM_FAIL;
+	}
+	for (j = 0 ; (rc == 0) && (j < 2) ; j++) {
+	    if ((slot->capacity[j] != 0) &&
+		((slot->offset[j] < TPM_NVRAM_MAP_ALIGN) ||
+		 (slot->capacity[j] > size) ||
+		 (slot->offset[j] > (size - slot->capacity[j])))) {
+		rc = TPM_FAIL;
+	    }
+	}
+	if ((rc == 0) && (slot->state & TPM_NVRAM_MAP_EXISTS) &&
+	    ((slot->state & TPM_NVRAM_MAP_LENGTH) >
+	     slot->capacity[(slot->state & TPM_NVRAM_MAP_ACTIVE) ? 1 : 0])) {
+	    rc = TPM_FAIL;
+	}
+	if (rc != 0) {
+	    printf("TPM_NVRAM_Map_Validate: Error (fatal) slot %u is invalid\n", i);
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_Open() maps the file holding the instance once, before the first access.
+
+   If 'create' is FALSE, a missing file returns TPM_RETRY.  Otherwise, it is created with an empty
+   header.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_Open(uint32_t tpm_number,
+				     TPM_BOOL create)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+    size_t      m = TPM_NVRAM_Map_Index(tpm_number);
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+    struct stat st;
+    TPM_BOOL    locked = FALSE;
+    uint32_t    slotCount;
+    TPM_NVRAM_MAP_HEADER *header;
+
+    if (tpm_number >= TPMS_MAX) {
+	printf("TPM_NVRAM_Map_Open: Error (fatal) TPM number %u\n", tpm_number);
+	rc = TPM_FAIL;
+    }
+    if ((rc == 0) && (nvram_map_base[m] == NULL)) {
+	if (nvram_container) {
+	    strcpy(filename, nvram_container_path);
+	}
+	else {
+	    TPM_NVRAM_GetFilenameForName(filename, tpm_number, TPM_NVMAP_NAME);
+	}
+	nvram_map_fd[m] = open(filename, O_RDWR | (create ? O_CREAT : 0), 0600);
+	if (nvram_map_fd[m] < 0) {
+	    if (!create && (errno == ENOENT)) {
+		return TPM_RETRY;
+	    }
+	    printf("TPM_NVRAM_Map_Open: Error (fatal) opening %s, %s\n",
+		   filename, strerror(errno));
+	    rc = TPM_FAIL;
+	}
+	/* a concurrent process may be creating or growing the container */
+	if (rc == 0) {
+	    rc = TPM_NVRAM_Map_Lock(m, TRUE);
+	    locked = (rc == 0);
+	}
+	if (rc == 0) {
+	    irc = fstat(nvram_map_fd[m], &st);
+	    if ((irc != 0) || (st.st_size > 0x7fffffff)) {
+		printf("TPM_NVRAM_Map_Open: Error (fatal) fstat %s\n", filename);
+		rc = TPM_FAIL;
+	    }
+	}
+	/* a new file gets an empty header */
+	if ((rc == 0) && (st.st_size == 0)) {
+	    printf(" TPM_NVRAM_Map_Open: Creating %s\n", filename);
+	    slotCount = nvram_container ? TPM_NVRAM_CONTAINER_SLOTS : TPM_NVRAM_MAP_SLOTS;
+	    irc = ftruncate(nvram_map_fd[m], TPM_NVRAM_Map_HeaderSize(slotCount));
+	    if (irc != 0) {
+		printf("TPM_NVRAM_Map_Open: Error (fatal) sizing %s, %s\n",
+		       filename, strerror(errno));
+		rc = TPM_FAIL;
+	    }
+	    if (rc == 0) {
+		rc = TPM_NVRAM_Map_Remap(m, TPM_NVRAM_Map_HeaderSize(slotCount));
+	    }
+	    if (rc == 0) {
+		header = (TPM_NVRAM_MAP_HEADER *)nvram_map_base[m];
+		header->magic = TPM_NVRAM_MAP_MAGIC;
+		header->version = TPM_NVRAM_MAP_VERSION;
+		header->slotCount = slotCount;
+		rc = TPM_NVRAM_Map_Written(m, 0, nvram_map_size[m]);
+	    }
+	    /* the new directory entry */
+	    if ((rc == 0) && !nvram_container) {
+		nvram_sync_directory = TRUE;
+		rc = TPM_NVRAM_Sync(FALSE);
+	    }
+	}
+	/* an existing file is mapped and validated */
+	else if (rc == 0) {
+	    printf(" TPM_NVRAM_Map_Open: Mapping %s\n", filename);
+	    if (st.st_size < TPM_NVRAM_MAP_ALIGN) {
+		printf("TPM_NVRAM_Map_Open: Error (fatal) %s size %lu\n",
+		       filename, (unsigned long)st.st_size);
+		rc = TPM_FAIL;
+	    }
+	    if ((rc == 0) && (nvram_map_base[m] == NULL)) {
+		rc = TPM_NVRAM_Map_Remap(m, st.st_size);
+	    }
+	    if (rc == 0) {
+		rc = TPM_NVRAM_Map_Validate(m);
+	    }
+	}
+	if (locked) {
+	    TPM_NVRAM_Map_Lock(m, FALSE);
+	}
+	if (rc != 0) {
+	    TPM_NVRAM_Map_Close(m);
+	}
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Map_LockInstance(tpm_number);
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_Probe() searches for the slot of 'name'.
+
+   If found, 'index' is its slot and 'found' is TRUE.  Otherwise, 'index' is the first tombstone or
+   free slot on the probe sequence, and 'available' is FALSE if there is none.
+*/
+
+static void TPM_NVRAM_Map_Probe(uint32_t *index,
+				TPM_BOOL *found,
+				TPM_BOOL *available,
+				size_t m,
+				uint32_t key,
+				const char *name)
+{
+    uint32_t    slotCount = ((TPM_NVRAM_MAP_HEADER *)nvram_map_base[m])->slotCount;
+    uint32_t    i;
+    uint32_t    n;
+    TPM_NVRAM_MAP_SLOT *slot;
+
+    *found = FALSE;
+    *available = FALSE;
+    i = TPM_NVRAM_Hash(key, name, slotCount);
+    for (n = 0 ; n < slotCount ; n++, i = (i + 1) % slotCount) {
+	slot = TPM_NVRAM_Map_Slot(m, i);
+	/* a never used slot ends the probe sequence */
+	if (slot->name[0] == '\0') {
+	    if (!*available) {
+		*index = i;
+		*available = TRUE;
+	    }
+	    break;
+	}
+	if ((slot->tpm_number == key) && (strcmp(slot->name, name) == 0)) {
+	    *index = i;
+	    *found = TRUE;
+	    break;
+	}
+	/* a deleted name without storage can be reused by another key */
+	if (!*available && !(slot->state & TPM_NVRAM_MAP_EXISTS) &&
+	    (slot->capacity[0] == 0) && (slot->capacity[1] == 0)) {
+	    *index = i;
+	    *available = TRUE;
+	}
+    }
+    return;
+}
+
+/* TPM_NVRAM_Map_GetSlot() returns the index of the slot for 'name'.
+
+   If the name has no slot and 'create' is TRUE, a slot is assigned.  Otherwise, TPM_RETRY is
+   returned.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_GetSlot(uint32_t *index,
+					uint32_t tpm_number,
+					const char *name,
+					TPM_BOOL create)
+{
+    TPM_RESULT  rc = 0;
+    size_t      m = TPM_NVRAM_Map_Index(tpm_number);
+    uint32_t    key = TPM_NVRAM_Map_Key(tpm_number);
+    TPM_BOOL    found = FALSE;
+    TPM_BOOL    available;
+    TPM_BOOL    locked = FALSE;
+    TPM_NVRAM_MAP_SLOT *slot;
+
+    if ((strlen(name) == 0) || (strlen(name) >= TPM_FILENAME_MAX)) {
+	printf("TPM_NVRAM_Map_GetSlot: Error (fatal) name %s length\n", name);
+	rc = TPM_FAIL;
+    }
+    /* only this process assigns slots to its instances, so a lookup needs no lock */
+    if (rc == 0) {
+	TPM_NVRAM_Map_Probe(index, &found, &available, m, key, name);
+	if (!found && !create) {
+	    rc = TPM_RETRY;
+	}
+    }
+    /* assign a slot, probing again since other processes may have assigned slots */
+    if ((rc == 0) && !found) {
+	rc = TPM_NVRAM_Map_Lock(m, TRUE);
+	locked = (rc == 0);
+	if (rc == 0) {
+	    TPM_NVRAM_Map_Probe(index, &found, &available, m, key, name);
+	    if (!available) {
+		printf("TPM_NVRAM_Map_GetSlot: Error (fatal) no free slot for %s\n", name);
+		rc = TPM_FAIL;
+	    }
+	}
+	/* A lookup by another process takes no lock, and an empty name ends its probe sequence, so
+	   a reused tombstone must never pass through an empty name.  Write the key, then the name
+	   over the old one, and only then clear the other fields. */
+	if (rc == 0) {
+	    slot = TPM_NVRAM_Map_Slot(m, *index);
+	    slot->tpm_number = key;
+	    __sync_synchronize();
+	    strcpy(slot->name, name);
+	    memset(slot->name + strlen(name), 0, TPM_FILENAME_MAX - strlen(name));
+	    __sync_synchronize();
+	    memset(slot->offset, 0, sizeof(slot->offset));
+	    memset(slot->capacity, 0, sizeof(slot->capacity));
+	    slot->state = 0;
+	    memset(slot->reserved, 0, sizeof(slot->reserved));
+	    rc = TPM_NVRAM_Map_Written(m, (unsigned char *)slot - nvram_map_base[m],
+				       sizeof(TPM_NVRAM_MAP_SLOT));
+	}
+	if (locked) {
+	    TPM_NVRAM_Map_Lock(m, FALSE);
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_Class() returns the free list of a region of 'capacity' bytes */
+
+static size_t TPM_NVRAM_Map_Class(uint32_t capacity)
+{
+    size_t      c;
+
+    for (c = 0 ; ((uint32_t)TPM_NVRAM_MAP_ALIGN << c) < capacity ; c++) {
+    }
+    return c;
+}
+
+/* TPM_NVRAM_Map_Alloc() allocates a region of 'capacity' bytes, a power of two multiple of
+   TPM_NVRAM_MAP_ALIGN, and returns its 'offset'.
+
+   A free region of that size is reused.  Otherwise, the file grows.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_Alloc(uint32_t *offset,
+				      size_t m,
+				      uint32_t capacity)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+    TPM_NVRAM_MAP_HEADER *header;
+    size_t      c = TPM_NVRAM_Map_Class(capacity);
+    TPM_BOOL    locked = FALSE;
+
+    if (rc == 0) {
+	rc = TPM_NVRAM_Map_Lock(m, TRUE);
+	locked = (rc == 0);
+    }
+    if (rc == 0) {
+	header = (TPM_NVRAM_MAP_HEADER *)nvram_map_base[m];
+	*offset = header->freeHead[c];
+    }
+    /* reuse a free region, unlinking it before use */
+    if ((rc == 0) && (*offset != 0)) {
+	printf(" TPM_NVRAM_Map_Alloc: Reusing %u bytes at %u\n", capacity, *offset);
+	header->freeHead[c] = *(uint32_t *)(nvram_map_base[m] + *offset);
+	if ((header->freeHead[c] % TPM_NVRAM_MAP_ALIGN) != 0 ||
+	    (header->freeHead[c] > (nvram_map_size[m] - capacity))) {
+	    printf("TPM_NVRAM_Map_Alloc: Error (fatal) free list %lu\n", (unsigned long)c);
+	    rc = TPM_FAIL;
+	}
+	if (rc == 0) {
+	    rc = TPM_NVRAM_Map_Written(m, 0, sizeof(TPM_NVRAM_MAP_HEADER));
+	}
+    }
+    /* grow the file */
+    else if (rc == 0) {
+	*offset = nvram_map_size[m];
+	printf(" TPM_NVRAM_Map_Alloc: Allocating %u bytes at %u\n", capacity, *offset);
+	if (capacity > (0x7fffffff - *offset)) {
+	    printf("TPM_NVRAM_Map_Alloc: Error (fatal) map size overflow\n");
+	    rc = TPM_FAIL;
+	}
+	if (rc == 0) {
+	    irc = ftruncate(nvram_map_fd[m], *offset + capacity);
+	    if (irc != 0) {
+		printf("TPM_NVRAM_Map_Alloc: Error (fatal) sizing, %s\n", strerror(errno));
+		rc = TPM_FAIL;
+	    }
+	}
+	/* the new size must be stable before a slot refers to it */
+	if ((rc == 0) && (nvram_sync_policy != TPM_NVRAM_SYNC_NONE)) {
+	    irc = fsync(nvram_map_fd[m]);
+	    if (irc != 0) {
+		printf("TPM_NVRAM_Map_Alloc: Error (fatal) syncing, %s\n", strerror(errno));
+		rc = TPM_FAIL;
+	    }
+	}
+	if (rc == 0) {
+	    rc = TPM_NVRAM_Map_Remap(m, *offset + capacity);
+	}
+    }
+    if (locked) {
+	TPM_NVRAM_Map_Lock(m, FALSE);
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_Free() returns the region of 'capacity' bytes at 'offset' to its free list.  The
+   caller must have removed all references to it.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_Free(size_t m,
+				     uint32_t offset,
+				     uint32_t capacity)
+{
+    TPM_RESULT  rc = 0;
+    TPM_NVRAM_MAP_HEADER *header;
+    size_t      c = TPM_NVRAM_Map_Class(capacity);
+    TPM_BOOL    locked = FALSE;
+
+    printf(" TPM_NVRAM_Map_Free: Freeing %u bytes at %u\n", capacity, offset);
+    if (rc == 0) {
+	rc = TPM_NVRAM_Map_Lock(m, TRUE);
+	locked = (rc == 0);
+    }
+    /* link the region before publishing it */
+    if (rc == 0) {
+	header = (TPM_NVRAM_MAP_HEADER *)nvram_map_base[m];
+	*(uint32_t *)(nvram_map_base[m] + offset) = header->freeHead[c];
+	rc = TPM_NVRAM_Map_Ordered(m, offset, sizeof(uint32_t));
+    }
+    if (rc == 0) {
+	header->freeHead[c] = offset;
+	rc = TPM_NVRAM_Map_Written(m, 0, sizeof(TPM_NVRAM_MAP_HEADER));
+    }
+    if (locked) {
+	TPM_NVRAM_Map_Lock(m, FALSE);
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_LoadData() returns a copy of the current contents of 'name'.
+
+   A name not yet in the map is imported from its file.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_LoadData(unsigned char **data,     /* freed by caller */
+					 uint32_t *length,
+					 uint32_t tpm_number,
+					 const char *name)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+    size_t      m = TPM_NVRAM_Map_Index(tpm_number);
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+    TPM_NVRAM_MAP_SLOT *slot;
+    uint32_t    index;
+
+    if (rc == 0) {
+	rc = TPM_NVRAM_Map_Open(tpm_number, TRUE);
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Map_GetSlot(&index, tpm_number, name, FALSE);
+	/* not in the map, import the file */
+	if (rc == TPM_RETRY) {
+	    TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
+	    rc = TPM_NVRAM_ReadFile(data, length, filename);
+	    if (rc == 0) {
+		printf(" TPM_NVRAM_Map_LoadData: Importing %s\n", filename);
+		rc = TPM_NVRAM_Map_StoreData(*data, *length, tpm_number, name);
+		/* Under group commit, the store deferred the sync of the slot state.  The map
+		   copy must be stable before the file, the only other copy, is removed. */
+		if (rc == 0) {
+		    rc = TPM_NVRAM_Map_GetSlot(&index, tpm_number, name, FALSE);
+		}
+		if (rc == 0) {
+		    rc = TPM_NVRAM_Map_Ordered(m,
+					       TPM_NVRAM_MAP_SLOTS_OFFSET +
+					       (index * sizeof(TPM_NVRAM_MAP_SLOT)),
+					       sizeof(TPM_NVRAM_MAP_SLOT));
+		}
+		if (rc == 0) {
+		    irc = remove(filename);
+		    if (irc != 0) {
+			printf("TPM_NVRAM_Map_LoadData: Error (fatal) file remove failed, "
+			       "errno %d\n", errno);
+			rc = TPM_FAIL;
+		    }
+		}
+		if (rc != 0) {
+		    free(*data);
+		    *data = NULL;
+		    *length = 0;
+		}
+	    }
+	    return rc;
+	}
+    }
+    if (rc == 0) {
+	slot = TPM_NVRAM_Map_Slot(m, index);
+	if (!(slot->state & TPM_NVRAM_MAP_EXISTS)) {
+	    rc = TPM_RETRY;
+	}
+    }
+    if (rc == 0) {
+	*length = slot->state & TPM_NVRAM_MAP_LENGTH;
+	printf(" TPM_NVRAM_Map_LoadData: Reading %u bytes\n", *length);
+	rc = TPM_Malloc(data, *length);
+    }
+    if (rc == 0) {
+	memcpy(*data,
+	       nvram_map_base[m] + slot->offset[(slot->state & TPM_NVRAM_MAP_ACTIVE) ? 1 : 0],
+	       *length);
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_StoreData() writes 'data' to the inactive copy of 'name', and then makes it the
+   active copy.
+
+   Only the pages that differ from the inactive copy are written.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_StoreData(const unsigned char *data,
+					  uint32_t length,
+					  uint32_t tpm_number,
+					  const char *name)
+{
+    TPM_RESULT  rc = 0;
+    size_t      m = TPM_NVRAM_Map_Index(tpm_number);
+    TPM_NVRAM_MAP_SLOT *slot;
+    uint32_t    slotOffset;
+    uint32_t    index;
+    uint32_t    copy;		/* the inactive copy, to be written */
+    uint32_t    capacity;
+    uint32_t    offset;
+    uint32_t    oldOffset = 0;
+    uint32_t    oldCapacity = 0;
+    unsigned char *region;
+    uint32_t    page;
+    uint32_t    size;
+    uint32_t    first = 0;	/* range of written bytes */
+    uint32_t    last = 0;
+    uint32_t    written = 0;
+    uint32_t    start_sec = 0;
+    uint32_t    start_usec = 0;
+    uint32_t    usec = 0;
+
+    if (rc == 0) {
+	rc = TPM_GetTimeOfDay(&start_sec, &start_usec);
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Map_Open(tpm_number, TRUE);
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Map_GetSlot(&index, tpm_number, name, TRUE);
+    }
+    if ((rc == 0) && (length > (TPM_NVRAM_MAP_ALIGN << (TPM_NVRAM_MAP_CLASSES - 2)))) {
+	printf("TPM_NVRAM_Map_StoreData: Error (fatal) length %u too large\n", length);
+	rc = TPM_FAIL;
+    }
+    if (rc == 0) {
+	slotOffset = TPM_NVRAM_MAP_SLOTS_OFFSET + (index * sizeof(TPM_NVRAM_MAP_SLOT));
+	slot = TPM_NVRAM_Map_Slot(m, index);
+	copy = (slot->state & TPM_NVRAM_MAP_ACTIVE) ? 0 : 1;
+	/* reallocate a copy that is too small, leaving room to grow */
+	if (length > slot->capacity[copy]) {
+	    for (capacity = TPM_NVRAM_MAP_ALIGN ; capacity < (2 * length) ; capacity <<= 1) {
+	    }
+	    oldOffset = slot->offset[copy];
+	    oldCapacity = slot->capacity[copy];
+	    rc = TPM_NVRAM_Map_Alloc(&offset, m, capacity);
+	    if (rc == 0) {
+		/* the mapping may have moved */
+		slot = TPM_NVRAM_Map_Slot(m, index);
+		slot->offset[copy] = offset;
+		slot->capacity[copy] = capacity;
+		/* the slot no longer refers to the old copy before it is freed */
+		rc = TPM_NVRAM_Map_Ordered(m, slotOffset, sizeof(TPM_NVRAM_MAP_SLOT));
+	    }
+	    /* the old inactive copy is no longer referenced */
+	    if ((rc == 0) && (oldCapacity != 0)) {
+		rc = TPM_NVRAM_Map_Free(m, oldOffset, oldCapacity);
+		slot = TPM_NVRAM_Map_Slot(m, index);
+	    }
+	}
+    }
+    /* write the pages that differ */
+    if (rc == 0) {
+	region = nvram_map_base[m] + slot->offset[copy];
+	for (page = 0 ; page < length ; page += TPM_NVRAM_MAP_ALIGN) {
+	    size = length - page;
+	    if (size > TPM_NVRAM_MAP_ALIGN) {
+		size = TPM_NVRAM_MAP_ALIGN;
+	    }
+	    if (memcmp(region + page, data + page, size) != 0) {
+		memcpy(region + page, data + page, size);
+		if (written == 0) {
+		    first = page;
+		}
+		last = page + size;
+		written += size;
+	    }
+	}
+	printf(" TPM_NVRAM_Map_StoreData: Name %s copy %u wrote %u of %u bytes\n",
+	       name, copy, written, length);
+    }
+    /* the data is stable before the state switches to it */
+    if ((rc == 0) && (written != 0)) {
+	rc = TPM_NVRAM_Map_Ordered(m, slot->offset[copy] + first, last - first);
+    }
+    /* switch to the new copy */
+    if (rc == 0) {
+	slot->state = TPM_NVRAM_MAP_EXISTS | (copy ? TPM_NVRAM_MAP_ACTIVE : 0) | length;
+	rc = TPM_NVRAM_Map_Written(m, slotOffset, sizeof(TPM_NVRAM_MAP_SLOT));
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Sync(FALSE);
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Elapsed(&usec, start_sec, start_usec);
+    }
+    if (rc == 0) {
+	TPM_NVRAM_UpdateMetrics(written, usec);
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Map_DeleteName() marks 'name' as not existing and frees its copies.  The slot remains
+   as a tombstone.
+
+   Any file of the same name is also removed, so that it is not imported later.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_DeleteName(uint32_t tpm_number,
+					   const char *name,
+					   TPM_BOOL mustExist)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+    size_t      m = TPM_NVRAM_Map_Index(tpm_number);
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+    TPM_NVRAM_MAP_SLOT *slot;
+    uint32_t    slotOffset;
+    uint32_t    index;
+    uint32_t    offset[2];
+    uint32_t    capacity[2];
+    size_t      j;
+    TPM_BOOL    existed = FALSE;
+
+    if (rc == 0) {
+	rc = TPM_NVRAM_Map_Open(tpm_number, TRUE);
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Map_GetSlot(&index, tpm_number, name, FALSE);
+	if (rc == 0) {
+	    slotOffset = TPM_NVRAM_MAP_SLOTS_OFFSET + (index * sizeof(TPM_NVRAM_MAP_SLOT));
+	    slot = TPM_NVRAM_Map_Slot(m, index);
+	    existed = ((slot->state & TPM_NVRAM_MAP_EXISTS) != 0);
+	    /* unreference the copies, then free them */
+	    memcpy(offset, slot->offset, sizeof(offset));
+	    memcpy(capacity, slot->capacity, sizeof(capacity));
+	    slot->state = 0;
+	    rc = TPM_NVRAM_Map_Written(m, slotOffset, sizeof(TPM_NVRAM_MAP_SLOT));
+	    /* this also syncs the tombstone before any file of the name is removed below, so
+	       that a crash after the removal cannot bring the name back from the map */
+	    if (rc == 0) {
+		memset(slot->offset, 0, sizeof(slot->offset));
+		memset(slot->capacity, 0, sizeof(slot->capacity));
+		rc = TPM_NVRAM_Map_Ordered(m, slotOffset, sizeof(TPM_NVRAM_MAP_SLOT));
+	    }
+	    for (j = 0 ; (rc == 0) && (j < 2) ; j++) {
+		if (capacity[j] != 0) {
+		    rc = TPM_NVRAM_Map_Free(m, offset[j], capacity[j]);
+		}
+	    }
+	}
+	else if (rc == TPM_RETRY) {
+	    rc = 0;
+	}
+    }
+    if (rc == 0) {
+	TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
+	irc = remove(filename);
+	if (irc == 0) {
+	    existed = TRUE;
+	}
+	else if (errno != ENOENT) {
+	    printf("TPM_NVRAM_Map_DeleteName: Error, (fatal) file remove failed, errno %d\n",
+		   errno);
+	    rc = TPM_FAIL;
+	}
+    }
+    if ((rc == 0) && mustExist && !existed) {
+	printf("TPM_NVRAM_Map_DeleteName: Error, (fatal) name %s does not exist\n", name);
+	rc = TPM_FAIL;
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Sync(FALSE);
+    }
+    return rc;
+}
+
+#endif	/* TPM_POSIX */
+
+/* TPM_NVRAM_Map_Drain() is called when the memory map is disabled.  Once per instance, a map left
+   by an earlier run with TPM_NV_MMAP set is exported to the files and removed.
+*/
+
+static TPM_RESULT TPM_NVRAM_Map_Drain(uint32_t tpm_number)
+{
+    TPM_RESULT  rc = 0;
+#ifdef TPM_POSIX
+    int         irc;
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+    TPM_NVRAM_MAP_SLOT *slot;
+    uint32_t    i;
+
+    if ((tpm_number < TPMS_MAX) && !nvram_map_drained[tpm_number]) {
+	rc = TPM_NVRAM_Map_Open(tpm_number, FALSE);
+	if (rc == 0) {
+	    printf(" TPM_NVRAM_Map_Drain: TPM number %u\n", tpm_number);
+	}
+	for (i = 0 ;
+	     (rc == 0) && (i < ((TPM_NVRAM_MAP_HEADER *)nvram_map_base[tpm_number])->slotCount) ;
+	     i++) {
+	    slot = TPM_NVRAM_Map_Slot(tpm_number, i);
+	    if (slot->name[0] == '\0') {
+		continue;
+	    }
+	    TPM_NVRAM_GetFilenameForName(filename, tpm_number, slot->name);
+	    if (slot->state & TPM_NVRAM_MAP_EXISTS) {
+		rc = TPM_NVRAM_WriteFile(nvram_map_base[tpm_number] +
+					 slot->offset[(slot->state & TPM_NVRAM_MAP_ACTIVE) ? 1 : 0],
+					 slot->state & TPM_NVRAM_MAP_LENGTH,
+					 filename, "wb");
+	    }
+	    else {
+		irc = remove(filename);
+		if ((irc != 0) && (errno != ENOENT)) {
+		    printf("TPM_NVRAM_Map_Drain: Error, (fatal) file remove failed, errno %d\n",
+			   errno);
+		    rc = TPM_FAIL;
+		}
+	    }
+	}
+	/* the files are now current */
+	if (rc == 0) {
+	    TPM_NVRAM_Map_Close(tpm_number);
+	    TPM_NVRAM_GetFilenameForName(filename, tpm_number, TPM_NVMAP_NAME);
+	    irc = remove(filename);
+	    if (irc != 0) {
+		printf("TPM_NVRAM_Map_Drain: Error, (fatal) file remove failed, errno %d\n",
+		       errno);
+		rc = TPM_FAIL;
+	    }
+	}
+	/* no map */
+	if (rc == TPM_RETRY) {
+	    rc = 0;
+	}
+	if (rc == 0) {
+	    nvram_map_drained[tpm_number] = TRUE;
+	}
+    }
+#else
+    tpm_number = tpm_number;	/* not used */
+#endif
+    return rc;
+}
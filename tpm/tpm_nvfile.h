@@ -42,13 +42,25 @@
 
 #include "tpm_types.h"
 
-/* characters in the TPM base file name, 14 for file name, slash, NUL terminator, etc.
+/* characters in the TPM base file name, 14 for file name, slash, NUL terminator, the temporary
+   file suffix, etc.
 
    This macro is used once during initialization to ensure that the TPM_PATH environment variable
    length will not cause the rooted file name to overflow file name buffers.
 */
 
-#define TPM_FILENAME_MAX 20
+#define TPM_FILENAME_MAX 24
+
+/* NV write statistics, returned by TPM_GetCapability TPM_CAP_MFR TPM_CAP_NV_METRICS */
+
+typedef struct tdTPM_NVRAM_METRICS {
+    uint32_t writes;		/* file writes and journal appends */
+    uint32_t bytes;		/* bytes written */
+    uint32_t syncs;		/* fsync() batches */
+    uint32_t lastUsec;		/* latency of the last write, including any sync */
+    uint32_t maxUsec;		/* maximum write latency */
+    uint64_t totalUsec;		/* total write latency */
+} TPM_NVRAM_METRICS;
 
 TPM_RESULT TPM_NVRAM_Init(void);
 
@@ -68,4 +80,14 @@ TPM_RESULT TPM_NVRAM_DeleteName(uint32_t tpm_number,
 				const char *name,
                                 TPM_BOOL mustExist);
 
+/*
+  Durability
+*/
+
+TPM_RESULT TPM_NVRAM_Sync(TPM_BOOL force);
+TPM_RESULT TPM_NVRAM_SyncTimeout(TPM_BOOL *pending,
+				 uint32_t *msec);
+TPM_RESULT TPM_NVRAM_CheckNames(uint32_t names);
+void       TPM_NVRAM_GetMetrics(TPM_NVRAM_METRICS *tpm_nvram_metrics);
+
 #endif
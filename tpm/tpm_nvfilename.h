@@ -48,9 +48,52 @@
 
 #define TPM_PERMANENT_ALL_NAME	"permall"
 
+/* sections of the permanent state, listed in the TPM_PERMANENT_ALL_NAME manifest.  Each name is
+   suffixed by the section copy number, 0 or 1.  A V2 manifest lists sections by base name. */
+
+#define TPM_PERMANENT_DATA_NAME		"permdata"
+#define TPM_PERMANENT_FLAGS_NAME	"permflags"
+#define TPM_OWNER_EVICT_NAME		"ownerevict"
+#define TPM_NV_INDEX_NAME		"nvindex"
+
+/* NV defined space data areas, one per index.  Each name is suffixed by the NV index in hex and
+   the copy number, 0 or 1. */
+
+#define TPM_NV_DATA_NAME		"nvdata"
+
+/* owner evict keys, one per key.  Each name is suffixed by the key handle in hex and the copy
+   number, 0 or 1. */
+
+#define TPM_OWNER_EVICT_KEY_NAME	"oekey"
+
 #define TPM_SAVESTATE_NAME      "savestate"
 
 #define TPM_VOLATILESTATE_NAME      "volatilestate"
 
+/* volatile state checkpoints, see TPM_VolatileAll_NVStoreSections().  Each name is suffixed by
+   the manifest or section copy number, 0 or 1. */
+
+#define TPM_VOLATILE_MANIFEST_NAME	"vmanifest"
+#define TPM_VOLATILE_FLAGS_NAME		"vflags"
+#define TPM_VOLATILE_STCLEAR_NAME	"vstclear"
+#define TPM_VOLATILE_STANY_NAME		"vstany"
+#define TPM_VOLATILE_KEYS_NAME		"vkeys"
+#define TPM_VOLATILE_SHA1_NAME		"vsha1"
+#define TPM_VOLATILE_NV_NAME		"vnvindex"
+
+/* the most names of one TPM instance other than the NV defined space data areas and the owner evict
+   keys: TPM_PERMANENT_ALL_NAME, two copies of each permanent section, TPM_SAVESTATE_NAME,
+   TPM_VOLATILESTATE_NAME, and two copies of the volatile manifest and each volatile section */
+
+#define TPM_NVRAM_FIXED_NAMES		25
+
+/* journal of NV writes, see tpm_nvfile.c */
+
+#define TPM_JOURNAL_NAME	"journal"
+
+/* memory mapped NV state, see tpm_nvfile.c */
+
+#define TPM_NVMAP_NAME		"nvmap"
+
 
 #endif
@@ -51,6 +51,7 @@
 #include "tpm_io.h"
 #include "tpm_memory.h"
 #include "tpm_nvfile.h"
+#include "tpm_nvfilename.h"
 #include "tpm_pcr.h"
 #include "tpm_permanent.h"
 #include "tpm_platform.h"
@@ -61,6 +62,34 @@
 
 #include "tpm_nvram.h"
 
+/* local prototypes */
+
+static TPM_RESULT TPM_NVDataSensitive_StoreHeader(TPM_STORE_BUFFER *sbuffer,
+						  const TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive);
+static void       TPM_NVDataSensitive_DataName(char *name,
+					       TPM_NV_INDEX nvIndex,
+					       BYTE dataCopy);
+static TPM_RESULT TPM_NVIndexEntries_LoadEntries(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+						 TPM_BOOL lazy,
+						 unsigned char **stream,
+						 uint32_t *stream_size);
+static uint32_t   TPM_NVIndexEntries_Hash(TPM_NV_INDEX nvIndex,
+					  uint32_t hashSize);
+static TPM_RESULT TPM_NVIndexEntries_Rehash(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
+static TPM_NV_DATA_FILE *TPM_NVDataFiles_Find(TPM_NV_DATA_FILES *tpm_nv_data_files,
+					      TPM_NV_INDEX nvIndex);
+static int        TPM_NVDataFiles_Compare(const void *a, const void *b);
+
+/* the size of the NV defined space, see TPM_MAX_NV_DEFINED_SIZE */
+
+static uint32_t tpm_nv_defined_size = TPM_MAX_NV_DEFINED_SIZE;
+
+/* minimum size of the TPM_NV_INDEX_ENTRIES hash table, a power of 2 */
+
+#ifndef TPM_NV_INDEX_HASH_MIN
+#define TPM_NV_INDEX_HASH_MIN	16
+#endif
+
 /*
   NV Defined Space Utilities
 */
@@ -331,6 +360,9 @@ void TPM_NVDataSensitive_Init(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive)
     TPM_Secret_Init(tpm_nv_data_sensitive->authValue);
     tpm_nv_data_sensitive->data = NULL;
     TPM_Digest_Init(tpm_nv_data_sensitive->digest);
+    tpm_nv_data_sensitive->lazyData = NULL;
+    TPM_Digest_Init(tpm_nv_data_sensitive->dataDigest);
+    tpm_nv_data_sensitive->dataCopy = 0;
     return;
 }
 
@@ -340,18 +372,26 @@ void TPM_NVDataSensitive_Init(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive)
    'stream_size' is checked for sufficient data
    returns 0 or error codes
    
+   If 'lazy' is TRUE, the data area is not copied.  lazyData points to it in the stream, which must
+   remain valid until TPM_NVDataSensitive_LoadData() or TPM_NVDataSensitive_Delete().
+
+   A TPM_TAG_NVSTATE_NV_V3 stream holds the digest and NV file copy in place of the data area,
+   which is read from the file by TPM_NVDataSensitive_LoadData().
+
    Before use, call TPM_NVDataSensitive_Init()
    After use, call TPM_NVDataSensitive_Delete() to free memory
 */
 
 TPM_RESULT TPM_NVDataSensitive_Load(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive,
 				    TPM_TAG nvEntriesVersion,
+				    TPM_BOOL lazy,
 				    unsigned char **stream,
 				    uint32_t *stream_size)
 {
     TPM_RESULT		rc = 0;
     TPM_BOOL 		optimize;
     TPM_BOOL		isGPIO;
+    TPM_BOOL		inStream = FALSE;	/* the data area is in the stream */
 
     printf(" TPM_NVDataSensitive_Load: nvEntriesVersion %04hx\n", nvEntriesVersion);
     /* check tag */
@@ -374,16 +414,47 @@ TPM_RESULT TPM_NVDataSensitive_Load(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive
     if (rc == 0) {
 	rc = TPM_NVDataSensitive_IsGPIO(&isGPIO, tpm_nv_data_sensitive->pubInfo.nvIndex);
     }
+    if (rc == 0) {
+	inStream = !isGPIO && (nvEntriesVersion != TPM_TAG_NVSTATE_NV_V3);
+    }
+    /* load the data area digest and NV file copy */
+    if ((rc == 0) && !isGPIO && !inStream) {
+	rc = TPM_Digest_Load(tpm_nv_data_sensitive->dataDigest, stream, stream_size);
+    }
+    if ((rc == 0) && !isGPIO && !inStream) {
+	rc = TPM_Load8(&(tpm_nv_data_sensitive->dataCopy), stream, stream_size);
+    }
+    /* skip over the data, leaving it in the stream */
+    if ((rc == 0) && inStream && lazy) {
+	if (*stream_size < tpm_nv_data_sensitive->pubInfo.dataSize) {
+	    printf("TPM_NVDataSensitive_Load: Error, stream size %u less than %u\n",
+		   *stream_size, tpm_nv_data_sensitive->pubInfo.dataSize);
+	    rc = TPM_BAD_PARAM_SIZE;
+	}
+    }
+    if ((rc == 0) && inStream && lazy) {
+	tpm_nv_data_sensitive->lazyData = *stream;
+	*stream += tpm_nv_data_sensitive->pubInfo.dataSize;
+	*stream_size -= tpm_nv_data_sensitive->pubInfo.dataSize;
+    }
     /* allocate memory for data */
-    if ((rc == 0) && !isGPIO) {
+    if ((rc == 0) && inStream && !lazy) {
 	rc = TPM_Malloc(&(tpm_nv_data_sensitive->data),
 			tpm_nv_data_sensitive->pubInfo.dataSize);
     }
     /* load data */
-    if ((rc == 0) && !isGPIO) {
+    if ((rc == 0) && inStream && !lazy) {
 	rc = TPM_Loadn(tpm_nv_data_sensitive->data, tpm_nv_data_sensitive->pubInfo.dataSize,
 		       stream, stream_size);
     }
+    /* digest the data area for the V3 serialization */
+    if ((rc == 0) && inStream) {
+	rc = TPM_SHA1(tpm_nv_data_sensitive->dataDigest,
+		      tpm_nv_data_sensitive->pubInfo.dataSize,
+		      (tpm_nv_data_sensitive->data != NULL) ?
+		      tpm_nv_data_sensitive->data : tpm_nv_data_sensitive->lazyData,
+		      0, NULL);
+    }
     /* create digest.  The digest is not stored to save NVRAM space */
     if (rc == 0) {
 	rc = TPM_SHA1(tpm_nv_data_sensitive->digest,
@@ -400,7 +471,8 @@ TPM_RESULT TPM_NVDataSensitive_Load(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive
    serialize the structure to a stream contained in 'sbuffer'
    returns 0 or error codes
 
-   nvWrite TRUE indicates a write command, not a command to define the space.
+   The data area is not serialized.  It is stored in its own NV file, see
+   TPM_NVIndexEntries_NVStoreData().
 */
 
 TPM_RESULT TPM_NVDataSensitive_Store(TPM_STORE_BUFFER *sbuffer,
@@ -410,6 +482,30 @@ TPM_RESULT TPM_NVDataSensitive_Store(TPM_STORE_BUFFER *sbuffer,
     TPM_BOOL		isGPIO;
 
     printf(" TPM_NVDataSensitive_Store:\n");
+    if (rc == 0) {
+	rc = TPM_NVDataSensitive_StoreHeader(sbuffer, tpm_nv_data_sensitive);
+    }
+    /* is the nvIndex GPIO space */
+    if (rc == 0) {
+	rc = TPM_NVDataSensitive_IsGPIO(&isGPIO, tpm_nv_data_sensitive->pubInfo.nvIndex);
+    }
+    /* store the data area digest and NV file copy */
+    if ((rc == 0) && !isGPIO) {
+	rc = TPM_Digest_Store(sbuffer, tpm_nv_data_sensitive->dataDigest);
+    }
+    if ((rc == 0) && !isGPIO) {
+	rc = TPM_Sbuffer_Append(sbuffer, &(tpm_nv_data_sensitive->dataCopy), sizeof(BYTE));
+    }
+    return rc;
+}
+
+/* TPM_NVDataSensitive_StoreHeader() serializes the members preceding the data area */
+
+static TPM_RESULT TPM_NVDataSensitive_StoreHeader(TPM_STORE_BUFFER *sbuffer,
+						  const TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive)
+{
+    TPM_RESULT		rc = 0;
+
     /* store tag */
     if (rc == 0) {
 	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_NV_DATA_SENSITIVE);
@@ -423,18 +519,123 @@ TPM_RESULT TPM_NVDataSensitive_Store(TPM_STORE_BUFFER *sbuffer,
     if (rc == 0) {
 	rc = TPM_Secret_Store(sbuffer, tpm_nv_data_sensitive->authValue);
     }
-    /* is the nvIndex GPIO space */
+    return rc;
+}
+
+/* TPM_NVDataSensitive_LoadData() copies the data area of an entry loaded by
+   TPM_NVIndexEntries_LoadLazy(), or reads it from its NV file.  It must be called before the data
+   member is used.
+
+   No-op if the data area was already copied or the index is GPIO.
+*/
+
+TPM_RESULT TPM_NVDataSensitive_LoadData(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive,
+					uint32_t tpm_number)
+{
+    TPM_RESULT		rc = 0;
+    TPM_BOOL		isGPIO;
+    char		name[TPM_FILENAME_MAX];
+    unsigned char	*stream = NULL;
+    uint32_t		stream_size;
+
     if (rc == 0) {
 	rc = TPM_NVDataSensitive_IsGPIO(&isGPIO, tpm_nv_data_sensitive->pubInfo.nvIndex);
     }
-    /* store data */
-    if ((rc == 0) && !isGPIO) {
-	rc = TPM_Sbuffer_Append(sbuffer, tpm_nv_data_sensitive->data,
-				tpm_nv_data_sensitive->pubInfo.dataSize);
+    /* copy from the lazy stream */
+    if ((rc == 0) && !isGPIO &&
+	(tpm_nv_data_sensitive->data == NULL) && (tpm_nv_data_sensitive->lazyData != NULL)) {
+	printf(" TPM_NVDataSensitive_LoadData: NV index %08x\n",
+	       tpm_nv_data_sensitive->pubInfo.nvIndex);
+	rc = TPM_Malloc(&(tpm_nv_data_sensitive->data),
+			tpm_nv_data_sensitive->pubInfo.dataSize);
+	if (rc == 0) {
+	    memcpy(tpm_nv_data_sensitive->data, tpm_nv_data_sensitive->lazyData,
+		   tpm_nv_data_sensitive->pubInfo.dataSize);
+	    tpm_nv_data_sensitive->lazyData = NULL;
+	}
+    }
+    /* read from the NV file */
+    if ((rc == 0) && !isGPIO && (tpm_nv_data_sensitive->data == NULL)) {
+	printf(" TPM_NVDataSensitive_LoadData: Reading NV index %08x copy %u\n",
+	       tpm_nv_data_sensitive->pubInfo.nvIndex, tpm_nv_data_sensitive->dataCopy);
+	TPM_NVDataSensitive_DataName(name,
+				     tpm_nv_data_sensitive->pubInfo.nvIndex,
+				     tpm_nv_data_sensitive->dataCopy);
+	rc = TPM_NVRAM_LoadData(&stream,	/* freed @1 */
+				&stream_size,
+				tpm_number,
+				name);
+	if ((rc == 0) && (stream_size != tpm_nv_data_sensitive->pubInfo.dataSize)) {
+	    printf("TPM_NVDataSensitive_LoadData: Error, %s size %u not %u\n",
+		   name, stream_size, tpm_nv_data_sensitive->pubInfo.dataSize);
+	    rc = TPM_FAIL;
+	}
+	/* the file must hold the data area recorded in the section */
+	if (rc == 0) {
+	    rc = TPM_SHA1_Check(tpm_nv_data_sensitive->dataDigest,
+				stream_size, stream,
+				0, NULL);
+	}
+	if (rc == 0) {
+	    tpm_nv_data_sensitive->data = stream;
+	    stream = NULL;
+	}
+	else {
+	    printf("TPM_NVDataSensitive_LoadData: Error (fatal) reading %s\n", name);
+	    rc = TPM_FAIL;
+	}
+	free(stream);			/* @1 */
+    }
+    return rc;
+}
+
+/* TPM_NVDataSensitive_DataChanged() updates the data area digest after the data member is
+   altered.
+
+   The data is destined for the NV file copy not holding the data area last written to NV, so that
+   an interrupted update leaves the copy that the NV section still records.
+*/
+
+TPM_RESULT TPM_NVDataSensitive_DataChanged(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive,
+					   TPM_NV_DATA_FILES *tpm_nv_data_files)
+{
+    TPM_RESULT		rc = 0;
+    TPM_NV_DATA_FILE	*tpm_nv_data_file;
+
+    if (rc == 0) {
+	rc = TPM_SHA1(tpm_nv_data_sensitive->dataDigest,
+		      tpm_nv_data_sensitive->pubInfo.dataSize, tpm_nv_data_sensitive->data,
+		      0, NULL);
+    }
+    if (rc == 0) {
+	tpm_nv_data_file = TPM_NVDataFiles_Find(tpm_nv_data_files,
+						tpm_nv_data_sensitive->pubInfo.nvIndex);
+	if (tpm_nv_data_file == NULL) {
+	    tpm_nv_data_sensitive->dataCopy = 0;
+	}
+	else if (memcmp(tpm_nv_data_file->dataDigest, tpm_nv_data_sensitive->dataDigest,
+			TPM_DIGEST_SIZE) == 0) {
+	    tpm_nv_data_sensitive->dataCopy = tpm_nv_data_file->dataCopy;
+	}
+	else {
+	    tpm_nv_data_sensitive->dataCopy = tpm_nv_data_file->dataCopy ^ 1;
+	}
+	printf(" TPM_NVDataSensitive_DataChanged: NV index %08x copy %u\n",
+	       tpm_nv_data_sensitive->pubInfo.nvIndex, tpm_nv_data_sensitive->dataCopy);
     }
     return rc;
 }
 
+/* TPM_NVDataSensitive_DataName() returns the NV name of a data area copy */
+
+static void TPM_NVDataSensitive_DataName(char *name,
+					 TPM_NV_INDEX nvIndex,
+					 BYTE dataCopy)
+{
+    sprintf(name, "%s%08x%u", TPM_NV_DATA_NAME, nvIndex, dataCopy);
+    return;
+}
+
 /* TPM_NVDataSensitive_Delete()
 
    No-OP if the parameter is NULL, else:
@@ -563,6 +764,11 @@ void TPM_NVIndexEntries_Init(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
     printf(" TPM_NVIndexEntries_Init:\n");
     tpm_nv_index_entries->nvIndexCount = 0;
     tpm_nv_index_entries->tpm_nvindex_entry = NULL;
+    tpm_nv_index_entries->lazyStream = NULL;
+    tpm_nv_index_entries->hashTable = NULL;
+    tpm_nv_index_entries->hashSize = 0;
+    tpm_nv_index_entries->hashValid = FALSE;
+    tpm_nv_index_entries->freeCount = 0;
     return;
 }
 
@@ -586,6 +792,9 @@ void TPM_NVIndexEntries_Delete(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
     }
     /* free the array */
     free(tpm_nv_index_entries->tpm_nvindex_entry);
+    /* free the stream holding data areas that were never accessed */
+    free(tpm_nv_index_entries->lazyStream);
+    free(tpm_nv_index_entries->hashTable);
     TPM_NVIndexEntries_Init(tpm_nv_index_entries);
     return;
 }
@@ -618,12 +827,42 @@ void TPM_NVIndexEntries_Trace(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
 TPM_RESULT TPM_NVIndexEntries_Load(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
 				   unsigned char **stream,
 				   uint32_t *stream_size)
+{
+    return TPM_NVIndexEntries_LoadEntries(tpm_nv_index_entries, FALSE, stream, stream_size);
+}
+
+/*
+  TPM_NVIndexEntries_LoadLazy() is TPM_NVIndexEntries_Load(), but the data areas are left in the
+  stream and copied on first access by TPM_NVDataSensitive_LoadData().  Most instances never read
+  most indexes.
+
+  'stream_start' is the allocated stream.  The TPM_NV_INDEX_ENTRIES takes ownership of it, even on
+  error, and frees it in TPM_NVIndexEntries_Delete().
+*/
+
+TPM_RESULT TPM_NVIndexEntries_LoadLazy(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+				       unsigned char *stream_start,
+				       unsigned char **stream,
+				       uint32_t *stream_size)
+{
+    free(tpm_nv_index_entries->lazyStream);
+    tpm_nv_index_entries->lazyStream = stream_start;
+    return TPM_NVIndexEntries_LoadEntries(tpm_nv_index_entries, TRUE, stream, stream_size);
+}
+
+/* TPM_NVIndexEntries_LoadEntries() is the common code for TPM_NVIndexEntries_Load() and
+   TPM_NVIndexEntries_LoadLazy() */
+
+static TPM_RESULT TPM_NVIndexEntries_LoadEntries(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+						 TPM_BOOL lazy,
+						 unsigned char **stream,
+						 uint32_t *stream_size)
 {
     TPM_RESULT 	rc = 0;
     uint32_t	i;
     TPM_TAG	nvEntriesVersion;
 
-    printf(" TPM_NVIndexEntries_Load:\n");
+    printf(" TPM_NVIndexEntries_LoadEntries: lazy %u\n", lazy);
     /* get the NV entries version number */
     if (rc == 0) {
 	rc = TPM_Load16(&nvEntriesVersion, stream, stream_size); 
@@ -633,9 +872,10 @@ TPM_RESULT TPM_NVIndexEntries_Load(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
 	switch (nvEntriesVersion) {
 	  case TPM_TAG_NVSTATE_NV_V1:
 	  case TPM_TAG_NVSTATE_NV_V2:
+	  case TPM_TAG_NVSTATE_NV_V3:
 	    break;
 	  default:
-            printf("TPM_NVIndexEntries_Load: Error (fatal), version %04x unsupported\n",
+            printf("TPM_NVIndexEntries_LoadEntries: Error (fatal), version %04x unsupported\n",
 		   nvEntriesVersion);
             rc = TPM_FAIL;
 	    break;
@@ -643,11 +883,12 @@ TPM_RESULT TPM_NVIndexEntries_Load(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
     }
     /* nvIndexCount */
     if (rc == 0) {
+	tpm_nv_index_entries->hashValid = FALSE;
 	rc = TPM_Load32(&(tpm_nv_index_entries->nvIndexCount), stream, stream_size); 
     }
     /* allocate memory for the array, nvIndexCount TPM_NV_DATA_SENSITIVE structures */
     if ((rc == 0) && (tpm_nv_index_entries->nvIndexCount > 0)) {
-	printf("  TPM_NVIndexEntries_Load: Loading %u slots\n", tpm_nv_index_entries->nvIndexCount);
+	printf("  TPM_NVIndexEntries_LoadEntries: Loading %u slots\n", tpm_nv_index_entries->nvIndexCount);
 	rc = TPM_Malloc((unsigned char **)&(tpm_nv_index_entries->tpm_nvindex_entry),
 			sizeof(TPM_NV_DATA_SENSITIVE) * tpm_nv_index_entries->nvIndexCount);
     }
@@ -657,17 +898,17 @@ TPM_RESULT TPM_NVIndexEntries_Load(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
     }
     /* tpm_nvindex_entry array */
     for (i = 0 ; (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) ; i++) {
-	printf("  TPM_NVIndexEntries_Load: Loading slot %u\n", i);
+	printf("  TPM_NVIndexEntries_LoadEntries: Loading slot %u\n", i);
 	if (rc == 0) {
 	    rc = TPM_NVDataSensitive_Load(&(tpm_nv_index_entries->tpm_nvindex_entry[i]),
-					  nvEntriesVersion, stream, stream_size);
+					  nvEntriesVersion, lazy, stream, stream_size);
 	}
 	/* should never load an unused entry */
 	if (rc == 0) {
-	    printf("  TPM_NVIndexEntries_Load: Loaded NV index %08x\n",
+	    printf("  TPM_NVIndexEntries_LoadEntries: Loaded NV index %08x\n",
 		   tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex);
 	    if (tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex == TPM_NV_INDEX_LOCK) {
-		printf("TPM_NVIndexEntries_Load: Error (fatal) Entry %u bad NV index %08x\n",
+		printf("TPM_NVIndexEntries_LoadEntries: Error (fatal) Entry %u bad NV index %08x\n",
 		       i, tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex);
 		rc = TPM_FAIL;
 	    }
@@ -681,6 +922,8 @@ TPM_RESULT TPM_NVIndexEntries_Load(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
   entries are serialized.
 
   The first data in the stream is the used count, obtained by iterating through the array.
+
+  The data areas are not serialized, see TPM_NVIndexEntries_NVStoreData().
 */
 
 TPM_RESULT TPM_NVIndexEntries_Store(TPM_STORE_BUFFER *sbuffer,
@@ -694,7 +937,7 @@ TPM_RESULT TPM_NVIndexEntries_Store(TPM_STORE_BUFFER *sbuffer,
 	   tpm_nv_index_entries->nvIndexCount);
     /* append the NV entries version number to the stream */
     if (rc == 0) {
-	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_NVSTATE_NV_V2); 
+	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_NVSTATE_NV_V3); 
     }
     /* count the number of used entries */
     if (rc == 0) {
@@ -973,14 +1216,17 @@ TPM_RESULT TPM_NVIndexEntries_GetFreeEntry(TPM_NV_DATA_SENSITIVE **tpm_nv_data_s
 
     printf(" TPM_NVIndexEntries_GetFreeEntry: Searching %u slots\n",
 	   tpm_nv_index_entries->nvIndexCount);
-    /* for debug - trace the entire TPM_NV_INDEX_ENTRIES array */
-    for (i = 0 ; i < tpm_nv_index_entries->nvIndexCount ; i++) {
-	*tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
-	printf("   TPM_NVIndexEntries_GetFreeEntry: slot %lu entry %08x\n",
-	       (unsigned long)i, (*tpm_nv_data_sensitive)->pubInfo.nvIndex);
-    }    
+    /* if the index shows that all slots are used, skip the search.  A slot freed since the index
+       was built is found after the next rebuild. */
+    if (tpm_nv_index_entries->hashValid && (tpm_nv_index_entries->freeCount == 0)) {
+	printf("  TPM_NVIndexEntries_GetFreeEntry: No free slot\n");
+	i = tpm_nv_index_entries->nvIndexCount;
+    }
+    else {
+	i = 0;
+    }
     /* search the existing array for a free entry */
-    for (i = 0 ; (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) && !done ; i++) {
+    for ( ; (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) && !done ; i++) {
 	*tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
 	/* if the entry is not used */
 	if ((*tpm_nv_data_sensitive)->pubInfo.nvIndex == TPM_NV_INDEX_LOCK) {
@@ -1002,12 +1248,17 @@ TPM_RESULT TPM_NVIndexEntries_GetFreeEntry(TPM_NV_DATA_SENSITIVE **tpm_nv_data_s
 	TPM_NVDataSensitive_Init(*tpm_nv_data_sensitive);
 	tpm_nv_index_entries->nvIndexCount++;
     }
+    /* the caller assigns an index to the slot */
+    tpm_nv_index_entries->hashValid = FALSE;
     return rc;
 }
 
 /* TPM_NVIndexEntries_GetEntry() gets the TPM_NV_DATA_SENSITIVE entry corresponding to nvIndex.
 
    Returns TPM_BADINDEX on non-existent nvIndex
+
+   The entry is found through the hash table index.  A deleted entry can leave its slot in the
+   table, so the slot is checked against nvIndex and the probe continues on a mismatch.
 */
 
 TPM_RESULT TPM_NVIndexEntries_GetEntry(TPM_NV_DATA_SENSITIVE **tpm_nv_data_sensitive,
@@ -1015,30 +1266,30 @@ TPM_RESULT TPM_NVIndexEntries_GetEntry(TPM_NV_DATA_SENSITIVE **tpm_nv_data_sensi
 				       TPM_NV_INDEX nvIndex)
 {
     TPM_RESULT			rc = 0;
-    size_t 			i;
-    TPM_BOOL			found;
+    uint32_t 			h;
+    uint32_t 			slot;
+    TPM_BOOL			found = FALSE;
     
     printf(" TPM_NVIndexEntries_GetEntry: Getting NV index %08x in %u slots\n",
 	   nvIndex, tpm_nv_index_entries->nvIndexCount);
-    /* for debug tracing */
-    for (i = 0 ; i < tpm_nv_index_entries->nvIndexCount ; i++) {
-	*tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
-	printf("   TPM_NVIndexEntries_GetEntry: slot %lu entry %08x\n",
-	       (unsigned long)i, (*tpm_nv_data_sensitive)->pubInfo.nvIndex);
-    }    
     /* check for the special index that indicates an empty entry */
     if (rc == 0) {
 	if (nvIndex == TPM_NV_INDEX_LOCK) {
 	    rc = TPM_BADINDEX;
 	}
     }
-    for (i = 0 , found = FALSE ;
-	 (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) && !found ;
-	 i++) {
+    if ((rc == 0) && !tpm_nv_index_entries->hashValid) {
+	rc = TPM_NVIndexEntries_Rehash(tpm_nv_index_entries);
+    }
+    for (h = TPM_NVIndexEntries_Hash(nvIndex, tpm_nv_index_entries->hashSize) ;
+	 (rc == 0) && (tpm_nv_index_entries->hashSize != 0) && !found &&
+	     ((slot = tpm_nv_index_entries->hashTable[h]) != 0) ;
+	 h = (h + 1) & (tpm_nv_index_entries->hashSize - 1)) {
 
-	*tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
+	*tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[slot - 1]);
 	if ((*tpm_nv_data_sensitive)->pubInfo.nvIndex == nvIndex) {
-	    printf("  TPM_NVIndexEntries_GetEntry: Found NV index at slot %lu\n", (unsigned long)i);
+	    printf("  TPM_NVIndexEntries_GetEntry: Found NV index at slot %lu\n",
+		   (unsigned long)(slot - 1));
 	    printf("   TPM_NVIndexEntries_GetEntry: permission %08x dataSize %u\n",
 		   (*tpm_nv_data_sensitive)->pubInfo.permission.attributes,
 		   (*tpm_nv_data_sensitive)->pubInfo.dataSize);
@@ -1059,6 +1310,78 @@ TPM_RESULT TPM_NVIndexEntries_GetEntry(TPM_NV_DATA_SENSITIVE **tpm_nv_data_sensi
     return rc;
 }
 
+/* TPM_NVIndexEntries_Hash() returns the first hash table position to probe for nvIndex */
+
+static uint32_t TPM_NVIndexEntries_Hash(TPM_NV_INDEX nvIndex,
+					uint32_t hashSize)
+{
+    uint32_t	h;
+
+    h = nvIndex * 0x9e3779b1;		/* golden ratio multiplier */
+    h ^= h >> 16;
+    return h & (hashSize - 1);
+}
+
+/* TPM_NVIndexEntries_Rehash() rebuilds the hash table index from the TPM_NV_INDEX_ENTRIES array.
+
+   The table is at least twice the number of slots, so that a probe always ends at an empty
+   position.
+*/
+
+static TPM_RESULT TPM_NVIndexEntries_Rehash(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
+{
+    TPM_RESULT	rc = 0;
+    uint32_t	hashSize;
+    uint32_t	h;
+    uint32_t	i;
+
+    printf(" TPM_NVIndexEntries_Rehash: Indexing %u slots\n", tpm_nv_index_entries->nvIndexCount);
+    for (hashSize = TPM_NV_INDEX_HASH_MIN ;
+	 hashSize < (tpm_nv_index_entries->nvIndexCount * 2) ;
+	 hashSize <<= 1) {
+    }
+    if (hashSize != tpm_nv_index_entries->hashSize) {
+	free(tpm_nv_index_entries->hashTable);
+	tpm_nv_index_entries->hashTable = NULL;
+	tpm_nv_index_entries->hashSize = 0;
+	rc = TPM_Malloc((unsigned char **)&(tpm_nv_index_entries->hashTable),
+			hashSize * sizeof(uint32_t));
+	if (rc == 0) {
+	    tpm_nv_index_entries->hashSize = hashSize;
+	}
+    }
+    if (rc == 0) {
+	memset(tpm_nv_index_entries->hashTable, 0, hashSize * sizeof(uint32_t));
+	tpm_nv_index_entries->freeCount = 0;
+	for (i = 0 ; i < tpm_nv_index_entries->nvIndexCount ; i++) {
+	    if (tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex == TPM_NV_INDEX_LOCK) {
+		tpm_nv_index_entries->freeCount++;
+		continue;
+	    }
+	    for (h = TPM_NVIndexEntries_Hash(tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex,
+					     hashSize) ;
+		 tpm_nv_index_entries->hashTable[h] != 0 ;
+		 h = (h + 1) & (hashSize - 1)) {
+	    }
+	    tpm_nv_index_entries->hashTable[h] = i + 1;
+	}
+	tpm_nv_index_entries->hashValid = TRUE;
+    }
+    return rc;
+}
+
+/* TPM_NVIndexEntries_IndexChanged() must be called after an index is assigned to a slot, so that
+   the hash table index is rebuilt.
+
+   Deleting an entry does not require the call.
+*/
+
+void TPM_NVIndexEntries_IndexChanged(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
+{
+    tpm_nv_index_entries->hashValid = FALSE;
+    return;
+}
+
 /* TPM_NVIndexEntries_GetUsedCount() returns the number of used entries in the TPM_NV_INDEX_ENTRIES
    array.
 
@@ -1109,8 +1432,9 @@ TPM_RESULT TPM_NVIndexEntries_GetNVList(TPM_STORE_BUFFER *sbuffer,
 
 /* TPM_NVIndexEntries_GetUsedSpace() gets the NV space consumed by NV defined space indexes.
 
-   It does it inefficiently but reliably by serializing the structure with the same function used
-   when writing to NV storage.
+   This is the size of the tag, the count, and each entry followed by its data area, as if the
+   data areas were serialized with the entries.  The entries are serialized with the same function
+   used when writing to NV storage.
 */
 
 TPM_RESULT TPM_NVIndexEntries_GetUsedSpace(uint32_t *usedSpace,
@@ -1119,16 +1443,35 @@ TPM_RESULT TPM_NVIndexEntries_GetUsedSpace(uint32_t *usedSpace,
     TPM_RESULT	rc = 0;
     TPM_STORE_BUFFER sbuffer;
     const unsigned char *buffer;
+    uint32_t	length;
+    TPM_BOOL	isGPIO;
+    size_t	i;
     
     printf("  TPM_NVIndexEntries_GetUsedSpace:\n");
     TPM_Sbuffer_Init(&sbuffer);			/* freed @1 */
-    /* serialize NV defined space */
-    if (rc == 0) {
-	rc = TPM_NVIndexEntries_Store(&sbuffer, tpm_nv_index_entries);
+    /* the tag and count */
+    *usedSpace = sizeof(uint16_t) + sizeof(uint32_t);
+    for (i = 0 ; (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) ; i++) {
+	/* if the entry is used */
+	if (tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex == TPM_NV_INDEX_LOCK) {
+	    continue;
+	}
+	TPM_Sbuffer_Clear(&sbuffer);
+	rc = TPM_NVDataSensitive_StoreHeader(&sbuffer,
+					     &(tpm_nv_index_entries->tpm_nvindex_entry[i]));
+	if (rc == 0) {
+	    rc = TPM_NVDataSensitive_IsGPIO(&isGPIO,
+					    tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex);
+	}
+	if (rc == 0) {
+	    TPM_Sbuffer_Get(&sbuffer, &buffer, &length);
+	    *usedSpace += length;
+	    if (!isGPIO) {
+		*usedSpace += tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.dataSize;
+	    }
+	}
     }
-    /* get the serialized buffer and its length */
     if (rc == 0) {
-	TPM_Sbuffer_Get(&sbuffer, &buffer, usedSpace);
 	printf("  TPM_NVIndexEntries_GetUsedSpace: Used space %u\n", *usedSpace);
     }
     TPM_Sbuffer_Delete(&sbuffer);	/* @1 */
@@ -1154,19 +1497,316 @@ TPM_RESULT TPM_NVIndexEntries_GetFreeSpace(uint32_t *freeSpace,
     }
     /* sanity check */
     if (rc == 0) {
-	if (usedSpace > TPM_MAX_NV_DEFINED_SIZE) {
+	if (usedSpace > tpm_nv_defined_size) {
 	    printf("TPM_NVIndexEntries_GetFreeSpace: used %u greater than max %u\n",
-		   usedSpace, TPM_MAX_NV_DEFINED_SIZE);
+		   usedSpace, tpm_nv_defined_size);
 	    rc = TPM_NOSPACE;
 	}
     }
     /* calculate the free space */
     if (rc == 0) {
-	*freeSpace = TPM_MAX_NV_DEFINED_SIZE - usedSpace;
+	*freeSpace = tpm_nv_defined_size - usedSpace;
 	printf("  TPM_NVIndexEntries_GetFreeSpace: Free space %u\n", *freeSpace);
     }
     return rc;
 }
+
+/* TPM_NVIndexEntries_SetDefinedSize() sets the size of the NV defined space, overriding
+   TPM_MAX_NV_DEFINED_SIZE
+*/
+
+void TPM_NVIndexEntries_SetDefinedSize(uint32_t definedSize)
+{
+    printf(" TPM_NVIndexEntries_SetDefinedSize: %u\n", definedSize);
+    tpm_nv_defined_size = definedSize;
+    return;
+}
+
+/* TPM_NVIndexEntries_GetMaxDataCount() returns the most indexes with a data area that fit in the NV
+   defined space.  Each takes at least an entry that selects no PCRs and one byte of data.  Each
+   such index takes two NV names, see TPM_NV_DATA_NAME.
+*/
+
+TPM_RESULT TPM_NVIndexEntries_GetMaxDataCount(uint32_t *maxCount)
+{
+    TPM_RESULT		rc = 0;
+    TPM_NV_DATA_SENSITIVE tpm_nv_data_sensitive;
+    TPM_STORE_BUFFER	sbuffer;
+    const unsigned char *buffer;
+    uint32_t		length;
+    uint32_t		overhead = sizeof(uint16_t) + sizeof(uint32_t);	/* the tag and count */
+
+    TPM_NVDataSensitive_Init(&tpm_nv_data_sensitive);	/* freed @1 */
+    TPM_Sbuffer_Init(&sbuffer);				/* freed @2 */
+    *maxCount = 0;
+    tpm_nv_data_sensitive.pubInfo.pcrInfoRead.pcrSelection.sizeOfSelect = 0;
+    tpm_nv_data_sensitive.pubInfo.pcrInfoWrite.pcrSelection.sizeOfSelect = 0;
+    if (rc == 0) {
+	rc = TPM_NVDataSensitive_StoreHeader(&sbuffer, &tpm_nv_data_sensitive);
+    }
+    if (rc == 0) {
+	TPM_Sbuffer_Get(&sbuffer, &buffer, &length);
+	if (tpm_nv_defined_size > overhead) {
+	    *maxCount = (tpm_nv_defined_size - overhead) / (length + 1);
+	}
+	printf(" TPM_NVIndexEntries_GetMaxDataCount: %u indexes of at least %u bytes\n",
+	       *maxCount, length + 1);
+    }
+    TPM_NVDataSensitive_Delete(&tpm_nv_data_sensitive);	/* @1 */
+    TPM_Sbuffer_Delete(&sbuffer);			/* @2 */
+    return rc;
+}
+
+/* TPM_NVIndexEntries_AdoptData() moves the data areas of 'old' entries to the same indexes in
+   'tpm_nv_index_entries' that were loaded without them, where the data area digests match.
+
+   This is used when entries are reloaded from a serialization, which does not hold the data
+   areas.  Unmatched data areas are read from NV on first access.
+*/
+
+TPM_RESULT TPM_NVIndexEntries_AdoptData(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+					TPM_NV_INDEX_ENTRIES *old,
+					uint32_t tpm_number)
+{
+    TPM_RESULT		rc = 0;
+    TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive;
+    TPM_NV_DATA_SENSITIVE *old_nv_data_sensitive;
+    size_t		i;
+
+    printf(" TPM_NVIndexEntries_AdoptData:\n");
+    for (i = 0 ; (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) ; i++) {
+	tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
+	if ((tpm_nv_data_sensitive->data != NULL) ||
+	    (tpm_nv_data_sensitive->pubInfo.nvIndex == TPM_NV_INDEX_LOCK)) {
+	    continue;
+	}
+	if (TPM_NVIndexEntries_GetEntry(&old_nv_data_sensitive, old,
+					tpm_nv_data_sensitive->pubInfo.nvIndex) != 0) {
+	    continue;
+	}
+	if ((old_nv_data_sensitive->pubInfo.dataSize != tpm_nv_data_sensitive->pubInfo.dataSize) ||
+	    (memcmp(old_nv_data_sensitive->dataDigest, tpm_nv_data_sensitive->dataDigest,
+		    TPM_DIGEST_SIZE) != 0)) {
+	    continue;
+	}
+	/* a data area still in the old lazy stream is copied before the stream is freed */
+	rc = TPM_NVDataSensitive_LoadData(old_nv_data_sensitive, tpm_number);
+	if (rc == 0) {
+	    tpm_nv_data_sensitive->data = old_nv_data_sensitive->data;
+	    old_nv_data_sensitive->data = NULL;
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVIndexEntries_NVStoreData() writes the data areas that differ from those recorded in
+   'tpm_nv_data_files', the data areas last written to or read from NV.
+
+   Each data area is written to the NV file copy recorded in its entry.  'new_nv_data_files'
+   returns the data areas now in NV.  The caller writes the section recording them and then calls
+   TPM_NVDataFiles_Commit().
+*/
+
+TPM_RESULT TPM_NVIndexEntries_NVStoreData(TPM_NV_DATA_FILES *new_nv_data_files,
+					  TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+					  TPM_NV_DATA_FILES *tpm_nv_data_files,
+					  uint32_t tpm_number)
+{
+    TPM_RESULT		rc = 0;
+    TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive;
+    TPM_NV_DATA_FILE	*tpm_nv_data_file;
+    TPM_NV_DATA_FILE	*new_nv_data_file;
+    TPM_BOOL		isGPIO;
+    char		name[TPM_FILENAME_MAX];
+    uint32_t		count;
+    size_t		i;
+
+    printf(" TPM_NVIndexEntries_NVStoreData:\n");
+    TPM_NVDataFiles_Delete(new_nv_data_files);
+    if (rc == 0) {
+	rc = TPM_NVIndexEntries_GetUsedCount(&count, tpm_nv_index_entries);
+    }
+    if ((rc == 0) && (count > 0)) {
+	rc = TPM_Malloc((unsigned char **)&(new_nv_data_files->file),
+			count * sizeof(TPM_NV_DATA_FILE));
+    }
+    for (i = 0 ; (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) ; i++) {
+	tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
+	if (tpm_nv_data_sensitive->pubInfo.nvIndex == TPM_NV_INDEX_LOCK) {
+	    continue;
+	}
+	rc = TPM_NVDataSensitive_IsGPIO(&isGPIO, tpm_nv_data_sensitive->pubInfo.nvIndex);
+	if ((rc != 0) || isGPIO) {
+	    continue;
+	}
+	new_nv_data_file = &(new_nv_data_files->file[new_nv_data_files->count]);
+	new_nv_data_files->count++;
+	new_nv_data_file->nvIndex = tpm_nv_data_sensitive->pubInfo.nvIndex;
+	new_nv_data_file->dataCopy = tpm_nv_data_sensitive->dataCopy;
+	TPM_Digest_Copy(new_nv_data_file->dataDigest, tpm_nv_data_sensitive->dataDigest);
+	/* unchanged since the last write */
+	tpm_nv_data_file = TPM_NVDataFiles_Find(tpm_nv_data_files,
+						tpm_nv_data_sensitive->pubInfo.nvIndex);
+	if ((tpm_nv_data_file != NULL) &&
+	    (tpm_nv_data_file->dataCopy == tpm_nv_data_sensitive->dataCopy) &&
+	    (memcmp(tpm_nv_data_file->dataDigest, tpm_nv_data_sensitive->dataDigest,
+		    TPM_DIGEST_SIZE) == 0)) {
+	    continue;
+	}
+	/* a data area that is neither in memory nor in NV was lost */
+	if ((tpm_nv_data_sensitive->data == NULL) && (tpm_nv_data_sensitive->lazyData == NULL)) {
+	    printf("TPM_NVIndexEntries_NVStoreData: Error (fatal) NV index %08x has no data\n",
+		   tpm_nv_data_sensitive->pubInfo.nvIndex);
+	    rc = TPM_FAIL;
+	}
+	if (rc == 0) {
+	    TPM_NVDataSensitive_DataName(name,
+					 tpm_nv_data_sensitive->pubInfo.nvIndex,
+					 tpm_nv_data_sensitive->dataCopy);
+	    printf("  TPM_NVIndexEntries_NVStoreData: Writing %s\n", name);
+	    rc = TPM_NVRAM_StoreData((tpm_nv_data_sensitive->data != NULL) ?
+				     tpm_nv_data_sensitive->data : tpm_nv_data_sensitive->lazyData,
+				     tpm_nv_data_sensitive->pubInfo.dataSize,
+				     tpm_number,
+				     name);
+	}
+    }
+    if ((rc == 0) && (new_nv_data_files->count > 1)) {
+	qsort(new_nv_data_files->file, new_nv_data_files->count, sizeof(TPM_NV_DATA_FILE),
+	      TPM_NVDataFiles_Compare);
+    }
+    return rc;
+}
+
+/*
+  NV Data Files
+
+  The NV file copy and digest of each data area as last written to or read from NV.  A data area
+  is written only if its entry records a different copy or digest.
+*/
+
+/* TPM_NVDataFiles_Init() initializes the TPM_NV_DATA_FILES array */
+
+void TPM_NVDataFiles_Init(TPM_NV_DATA_FILES *tpm_nv_data_files)
+{
+    tpm_nv_data_files->count = 0;
+    tpm_nv_data_files->file = NULL;
+    return;
+}
+
+/* TPM_NVDataFiles_Delete() frees and reinitializes the TPM_NV_DATA_FILES array.  It does not
+   delete the NV files.
+*/
+
+void TPM_NVDataFiles_Delete(TPM_NV_DATA_FILES *tpm_nv_data_files)
+{
+    free(tpm_nv_data_files->file);
+    TPM_NVDataFiles_Init(tpm_nv_data_files);
+    return;
+}
+
+/* TPM_NVDataFiles_Set() sets the TPM_NV_DATA_FILES array from the entries loaded from NV whose
+   data areas are in their own NV files.
+*/
+
+TPM_RESULT TPM_NVDataFiles_Set(TPM_NV_DATA_FILES *tpm_nv_data_files,
+			       TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
+{
+    TPM_RESULT		rc = 0;
+    TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive;
+    TPM_NV_DATA_FILE	*tpm_nv_data_file;
+    TPM_BOOL		isGPIO;
+    size_t		i;
+
+    printf(" TPM_NVDataFiles_Set:\n");
+    TPM_NVDataFiles_Delete(tpm_nv_data_files);
+    if ((rc == 0) && (tpm_nv_index_entries->nvIndexCount > 0)) {
+	rc = TPM_Malloc((unsigned char **)&(tpm_nv_data_files->file),
+			tpm_nv_index_entries->nvIndexCount * sizeof(TPM_NV_DATA_FILE));
+    }
+    for (i = 0 ; (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) ; i++) {
+	tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
+	if ((tpm_nv_data_sensitive->pubInfo.nvIndex == TPM_NV_INDEX_LOCK) ||
+	    (tpm_nv_data_sensitive->data != NULL) ||
+	    (tpm_nv_data_sensitive->lazyData != NULL)) {
+	    continue;
+	}
+	rc = TPM_NVDataSensitive_IsGPIO(&isGPIO, tpm_nv_data_sensitive->pubInfo.nvIndex);
+	if ((rc == 0) && !isGPIO) {
+	    tpm_nv_data_file = &(tpm_nv_data_files->file[tpm_nv_data_files->count]);
+	    tpm_nv_data_files->count++;
+	    tpm_nv_data_file->nvIndex = tpm_nv_data_sensitive->pubInfo.nvIndex;
+	    tpm_nv_data_file->dataCopy = tpm_nv_data_sensitive->dataCopy;
+	    TPM_Digest_Copy(tpm_nv_data_file->dataDigest, tpm_nv_data_sensitive->dataDigest);
+	}
+    }
+    if ((rc == 0) && (tpm_nv_data_files->count > 1)) {
+	qsort(tpm_nv_data_files->file, tpm_nv_data_files->count, sizeof(TPM_NV_DATA_FILE),
+	      TPM_NVDataFiles_Compare);
+    }
+    return rc;
+}
+
+/* TPM_NVDataFiles_Commit() replaces 'tpm_nv_data_files' with 'new_nv_data_files' once the section
+   recording them is in NV.  The NV files of data areas that are no longer recorded are deleted.
+*/
+
+TPM_RESULT TPM_NVDataFiles_Commit(TPM_NV_DATA_FILES *tpm_nv_data_files,
+				  TPM_NV_DATA_FILES *new_nv_data_files,
+				  uint32_t tpm_number)
+{
+    TPM_RESULT		rc = 0;
+    char		name[TPM_FILENAME_MAX];
+    BYTE		dataCopy;
+    uint32_t		i;
+
+    printf(" TPM_NVDataFiles_Commit: %u data areas\n", new_nv_data_files->count);
+    for (i = 0 ; (rc == 0) && (i < tpm_nv_data_files->count) ; i++) {
+	if (TPM_NVDataFiles_Find(new_nv_data_files, tpm_nv_data_files->file[i].nvIndex) != NULL) {
+	    continue;
+	}
+	for (dataCopy = 0 ; (rc == 0) && (dataCopy < 2) ; dataCopy++) {
+	    TPM_NVDataSensitive_DataName(name, tpm_nv_data_files->file[i].nvIndex, dataCopy);
+	    printf("  TPM_NVDataFiles_Commit: Deleting %s\n", name);
+	    rc = TPM_NVRAM_DeleteName(tpm_number, name, FALSE);
+	}
+    }
+    TPM_NVDataFiles_Delete(tpm_nv_data_files);
+    *tpm_nv_data_files = *new_nv_data_files;
+    TPM_NVDataFiles_Init(new_nv_data_files);
+    return rc;
+}
+
+/* TPM_NVDataFiles_Find() returns the TPM_NV_DATA_FILE for nvIndex, or NULL */
+
+static TPM_NV_DATA_FILE *TPM_NVDataFiles_Find(TPM_NV_DATA_FILES *tpm_nv_data_files,
+					      TPM_NV_INDEX nvIndex)
+{
+    TPM_NV_DATA_FILE	key;
+
+    if (tpm_nv_data_files->count == 0) {
+	return NULL;
+    }
+    key.nvIndex = nvIndex;
+    return bsearch(&key, tpm_nv_data_files->file, tpm_nv_data_files->count,
+		   sizeof(TPM_NV_DATA_FILE), TPM_NVDataFiles_Compare);
+}
+
+/* TPM_NVDataFiles_Compare() orders TPM_NV_DATA_FILE by nvIndex for qsort() and bsearch() */
+
+static int TPM_NVDataFiles_Compare(const void *a, const void *b)
+{
+    TPM_NV_INDEX nvIndexA = ((const TPM_NV_DATA_FILE *)a)->nvIndex;
+    TPM_NV_INDEX nvIndexB = ((const TPM_NV_DATA_FILE *)b)->nvIndex;
+
+    if (nvIndexA < nvIndexB) {
+	return -1;
+    }
+    if (nvIndexA > nvIndexB) {
+	return 1;
+    }
+    return 0;
+}
 					  
 /* TPM_OwnerClear: rev 99
    12. The TPM MUST deallocate all defined NV storage areas where
@@ -1516,6 +2156,7 @@ TPM_RESULT TPM_Process_NVReadValue(tpm_state_t *tpm_state,
 	    printf("TPM_Process_NVReadValue: dataSize 0, setting bReadSTClear\n");
 	    /* a. Set D1 -> bReadSTClear to TRUE */
 	    d1NvdataSensitive->pubInfo.bReadSTClear = TRUE;
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_NV);
 	    /* b. Set data to NULL (output parameter dataSize to 0) */
 	    /* NOTE Done by TPM_SizedBuffer_Init */
 	}
@@ -1532,6 +2173,10 @@ TPM_RESULT TPM_Process_NVReadValue(tpm_state_t *tpm_state,
 		}
 	    }
 	    /* c. Set data to area pointed to by offset */
+	    if ((returnCode == TPM_SUCCESS) && !isGPIO) {
+		returnCode = TPM_NVDataSensitive_LoadData(d1NvdataSensitive,
+							  tpm_state->tpm_number);
+	    }
 	    if ((returnCode == TPM_SUCCESS) && !isGPIO) {
 		TPM_PrintFour("TPM_Process_NVReadValue: read data",
 			      d1NvdataSensitive->data + offset);
@@ -1628,7 +2273,7 @@ TPM_RESULT TPM_Process_NVReadValue(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -1840,6 +2485,7 @@ TPM_RESULT TPM_Process_NVReadValueAuth(tpm_state_t *tpm_state,
 	    printf("TPM_Process_NVReadValueAuth: dataSize 0, setting bReadSTClear\n");
 	    /* a. Set D1 -> bReadSTClear to TRUE */
 	    d1NvdataSensitive->pubInfo.bReadSTClear = TRUE;
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_NV);
 	    /* b. Set data to NULL */
 	    /* NOTE Done by TPM_SizedBuffer_Init */
 	}
@@ -1856,6 +2502,10 @@ TPM_RESULT TPM_Process_NVReadValueAuth(tpm_state_t *tpm_state,
 		}
 	    }
 	    /* c. Set data to area pointed to by offset */
+	    if ((returnCode == TPM_SUCCESS) && !isGPIO) {
+		returnCode = TPM_NVDataSensitive_LoadData(d1NvdataSensitive,
+							  tpm_state->tpm_number);
+	    }
 	    if ((returnCode == TPM_SUCCESS) && !isGPIO) {
 		TPM_PrintFour("TPM_Process_NVReadValueAuth: read data",
 			      d1NvdataSensitive->data + offset);
@@ -1933,7 +2583,7 @@ TPM_RESULT TPM_Process_NVReadValueAuth(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -2283,6 +2933,7 @@ TPM_RESULT TPM_Process_NVWriteValue(tpm_state_t *tpm_state,
 	    printf("TPM_Process_NVWriteValue: dataSize 0, setting bWriteSTClear, bWriteDefine\n");
 	    /* a. Set D1 -> bWriteSTClear to TRUE */
 	    d1NvdataSensitive->pubInfo.bWriteSTClear = TRUE;
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_NV);
 	    /* b. Set D1 -> bWriteDefine */
 	    if (!d1NvdataSensitive->pubInfo.bWriteDefine) {	/* save wearout, only write if
 								   FALSE */
@@ -2314,6 +2965,10 @@ TPM_RESULT TPM_Process_NVWriteValue(tpm_state_t *tpm_state,
 		    returnCode = TPM_NOT_FULLWRITE;
 		}
 	    }
+	    if ((returnCode == TPM_SUCCESS) && !isGPIO) {
+		returnCode = TPM_NVDataSensitive_LoadData(d1NvdataSensitive,
+							  tpm_state->tpm_number);
+	    }
 	    if (returnCode == TPM_SUCCESS) {
 		/* not GPIO */
 		if (!isGPIO) {
@@ -2323,9 +2978,13 @@ TPM_RESULT TPM_Process_NVWriteValue(tpm_state_t *tpm_state,
 			printf("TPM_Process_NVWriteValue: Copying data\n");
 			/* d. Write the new value into the NV storage area */
 			memcpy((d1NvdataSensitive->data) + offset, data.buffer, data.size);
+			returnCode =
+			    TPM_NVDataSensitive_DataChanged(d1NvdataSensitive,
+							    &(tpm_state->tpm_nv_data_files));
 			/* must write TPM_PERMANENT_DATA back to NVRAM, set this flag after
 			   strucuture is written */
 			writeAllNV = TRUE;
+			TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_NV);
 		    }
 		    else {
 			printf("TPM_Process_NVWriteValue: Same data, no copy\n");
@@ -2359,12 +3018,14 @@ TPM_RESULT TPM_Process_NVWriteValue(tpm_state_t *tpm_state,
 		printf("TPM_Process_NVWriteValue: Copying data\n");
 		memcpy(tpm_state->tpm_permanent_data.authDIR, data.buffer, TPM_DIGEST_SIZE);
 		writeAllNV = TRUE;
+		TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	    }
 	}
     }
     if ((returnCode == TPM_SUCCESS) && !done && !dir) {
 	/* 16. Set D1 -> bReadSTClear to FALSE (unlocked by a successful write) */
 	d1NvdataSensitive->pubInfo.bReadSTClear = FALSE;
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_NV);
     }
     /* 15.d Write the new value into the NV storage area */
     if (writeAllNV) {
@@ -2374,6 +3035,7 @@ TPM_RESULT TPM_Process_NVWriteValue(tpm_state_t *tpm_state,
 	if (nv1Incremented) {
 	    /* i. Set TPM_PERMANENT_DATA -> noOwnerNVWrite to NV1 */
 	    tpm_state->tpm_permanent_data.noOwnerNVWrite = nv1;
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	}
     }
     returnCode = TPM_PermanentAll_NVStore(tpm_state,
@@ -2432,7 +3094,7 @@ TPM_RESULT TPM_Process_NVWriteValue(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -2667,6 +3329,7 @@ TPM_RESULT TPM_Process_NVWriteValueAuth(tpm_state_t *tpm_state,
 		   "dataSize 0, setting bWriteSTClear, bWriteDefine\n");
 	    /* a. Set D1 -> bWriteSTClear to TRUE */
 	    d1NvdataSensitive->pubInfo.bWriteSTClear = TRUE;
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_NV);
 	    /* b. Set D1 -> bWriteDefine to TRUE */
 	    if (!d1NvdataSensitive->pubInfo.bWriteDefine) {	/* save wearout, only write if
 								   FALSE */
@@ -2698,6 +3361,10 @@ TPM_RESULT TPM_Process_NVWriteValueAuth(tpm_state_t *tpm_state,
 		    returnCode = TPM_NOT_FULLWRITE;
 		}
 	    }
+	    if ((returnCode == TPM_SUCCESS) && !isGPIO) {
+		returnCode = TPM_NVDataSensitive_LoadData(d1NvdataSensitive,
+							  tpm_state->tpm_number);
+	    }
 	    if (returnCode == TPM_SUCCESS) {
 		/* not GPIO */
 		if (!isGPIO) {
@@ -2707,9 +3374,13 @@ TPM_RESULT TPM_Process_NVWriteValueAuth(tpm_state_t *tpm_state,
 			/* d. Write the new value into the NV storage area */
 			printf("TPM_Process_NVWriteValueAuth: Copying data\n");
 			memcpy((d1NvdataSensitive->data) + offset, data.buffer, data.size);
+			returnCode =
+			    TPM_NVDataSensitive_DataChanged(d1NvdataSensitive,
+							    &(tpm_state->tpm_nv_data_files));
 			/* must write TPM_PERMANENT_DATA back to NVRAM, set this flag after
 			   strucuture is written */
 			writeAllNV = TRUE;
+			TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_NV);
 		    }
 		    else {
 			printf("TPM_Process_NVWriteValueAuth: Same data, no copy\n");
@@ -2729,6 +3400,7 @@ TPM_RESULT TPM_Process_NVWriteValueAuth(tpm_state_t *tpm_state,
     /* 12. Set D1 -> bReadSTClear to FALSE */
     if (returnCode == TPM_SUCCESS) {
 	d1NvdataSensitive->pubInfo.bReadSTClear = FALSE;
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_NV);
 	printf("TPM_Process_NVWriteValueAuth: Writing data to NVRAM\n");
     }
     /* write back TPM_PERMANENT_DATA if required */
@@ -2788,7 +3460,7 @@ TPM_RESULT TPM_Process_NVWriteValueAuth(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -2978,6 +3650,7 @@ TPM_RESULT TPM_Process_NVDefineSpace(tpm_state_t *tpm_state,
 	    TPM_SetCapability_Flag(&writeAllNV,					/* altered */
 				   &(tpm_state->tpm_permanent_flags.nvLocked ), /* flag */
 				   TRUE);					/* value */
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
 	}
 	/* c. Return TPM_SUCCESS */
 	done = TRUE;
@@ -3152,7 +3825,7 @@ TPM_RESULT TPM_Process_NVDefineSpace(tpm_state_t *tpm_state,
     if ((returnCode == TPM_SUCCESS) && !done && foundOld) {
 	TPM_AuthSessions_TerminateEntity(&continueAuthSession,
 					 authHandle,
-					 tpm_state->tpm_stclear_data.authSessions,
+					 &(tpm_state->tpm_stclear_data.authSessions),
 					 TPM_ET_NV,
 					 &(d1_old->digest));
     }
@@ -3163,6 +3836,7 @@ TPM_RESULT TPM_Process_NVDefineSpace(tpm_state_t *tpm_state,
 	TPM_NVDataSensitive_Delete(d1_old);
 	/* must write deleted space back to NVRAM */
 	writeAllNV = TRUE;
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_NV);
 	/* 6.e. If NV1_INCREMENTED is TRUE */
 	/* i. Set TPM_PERMANENT_DATA -> noOwnerNVWrite to NV1 */
 	/* NOTE Don't do this step until just before the serialization */
@@ -3258,6 +3932,7 @@ TPM_RESULT TPM_Process_NVDefineSpace(tpm_state_t *tpm_state,
 	/* assign the empty slot to the index now so it will be counted as used space during the
 	   serialization. */
 	pubInfo->nvIndex = newNVIndex;
+	TPM_NVIndexEntries_IndexChanged(&(tpm_state->tpm_nv_index_entries));
 	/* 12.a. Reserve NV space for pubInfo -> dataSize
 
 	   NOTE: Action is out or order.  Must allocate data space now so that the serialization
@@ -3294,12 +3969,15 @@ TPM_RESULT TPM_Process_NVDefineSpace(tpm_state_t *tpm_state,
 	memset(d1_new->data, 0xff, pubInfo->dataSize);
 	/* must write newly defined space back to NVRAM */
 	writeAllNV = TRUE;
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_NV);
+	returnCode = TPM_NVDataSensitive_DataChanged(d1_new, &(tpm_state->tpm_nv_data_files));
     }
     if (returnCode == TPM_SUCCESS) {
 	/* c. If NV1_INCREMENTED is TRUE */
 	if (nv1Incremented) {
 	    /* i. Set TPM_PERMANENT_DATA -> noOwnerNVWrite to NV1 */
 	    tpm_state->tpm_permanent_data.noOwnerNVWrite = nv1;
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	}	    
 	/* 13. Ignore continueAuthSession on input and set to FALSE on output */
 	continueAuthSession = FALSE;
@@ -3362,7 +4040,7 @@ TPM_RESULT TPM_Process_NVDefineSpace(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -3534,6 +4212,7 @@ TPM_RESULT TPM_Process_DirWriteAuth(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	printf("TPM_Process_DirWriteAuth: Writing data\n");
 	TPM_Digest_Copy(tpm_state->tpm_permanent_data.authDIR, newContents);
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	/* write back TPM_PERMANENT_DATA */
 	returnCode = TPM_PermanentAll_NVStore(tpm_state,
 					      TRUE,
@@ -3592,7 +4271,7 @@ TPM_RESULT TPM_Process_DirWriteAuth(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -85,10 +85,15 @@ void       TPM_NVDataPublic_Delete(TPM_NV_DATA_PUBLIC *tpm_nv_data_public);
 void       TPM_NVDataSensitive_Init(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive);
 TPM_RESULT TPM_NVDataSensitive_Load(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive,
 				    TPM_TAG nvEntriesVersion,
+				    TPM_BOOL lazy,
 				    unsigned char **stream,
                                     uint32_t *stream_size);
 TPM_RESULT TPM_NVDataSensitive_Store(TPM_STORE_BUFFER *sbuffer,
                                      const TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive);
+TPM_RESULT TPM_NVDataSensitive_LoadData(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive,
+					uint32_t tpm_number);
+TPM_RESULT TPM_NVDataSensitive_DataChanged(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive,
+					   TPM_NV_DATA_FILES *tpm_nv_data_files);
 void       TPM_NVDataSensitive_Delete(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive);
 
 TPM_RESULT TPM_NVDataSensitive_IsValidIndex(TPM_NV_INDEX nvIndex);
@@ -105,6 +110,10 @@ void       TPM_NVIndexEntries_Trace(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
 TPM_RESULT TPM_NVIndexEntries_Load(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
 				   unsigned char **stream,
 				   uint32_t *stream_size);
+TPM_RESULT TPM_NVIndexEntries_LoadLazy(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+				       unsigned char *stream_start,
+				       unsigned char **stream,
+				       uint32_t *stream_size);
 TPM_RESULT TPM_NVIndexEntries_Store(TPM_STORE_BUFFER *sbuffer,
 				    TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
 void       TPM_NVIndexEntries_StClear(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
@@ -122,6 +131,7 @@ TPM_RESULT TPM_NVIndexEntries_GetFreeEntry(TPM_NV_DATA_SENSITIVE **tpm_nv_data_s
 TPM_RESULT TPM_NVIndexEntries_GetEntry(TPM_NV_DATA_SENSITIVE **tpm_nv_data_sensitive,
 				       TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
 				       TPM_NV_INDEX nvIndex);
+void       TPM_NVIndexEntries_IndexChanged(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
 TPM_RESULT TPM_NVIndexEntries_GetUsedCount(uint32_t *count,
 					   TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
 TPM_RESULT TPM_NVIndexEntries_GetNVList(TPM_STORE_BUFFER *sbuffer,
@@ -137,6 +147,27 @@ TPM_RESULT TPM_NVIndexEntries_GetFreeSpace(uint32_t *freeSpace,
 TPM_RESULT TPM_NVIndexEntries_GetDataPublic(TPM_NV_DATA_PUBLIC **tpm_nv_data_public,
 					    TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
 					    TPM_NV_INDEX nvIndex);
+void       TPM_NVIndexEntries_SetDefinedSize(uint32_t definedSize);
+TPM_RESULT TPM_NVIndexEntries_GetMaxDataCount(uint32_t *maxCount);
+TPM_RESULT TPM_NVIndexEntries_AdoptData(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+					TPM_NV_INDEX_ENTRIES *old,
+					uint32_t tpm_number);
+TPM_RESULT TPM_NVIndexEntries_NVStoreData(TPM_NV_DATA_FILES *new_nv_data_files,
+					  TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+					  TPM_NV_DATA_FILES *tpm_nv_data_files,
+					  uint32_t tpm_number);
+
+/*
+  NV Data Files
+*/
+
+void       TPM_NVDataFiles_Init(TPM_NV_DATA_FILES *tpm_nv_data_files);
+void       TPM_NVDataFiles_Delete(TPM_NV_DATA_FILES *tpm_nv_data_files);
+TPM_RESULT TPM_NVDataFiles_Set(TPM_NV_DATA_FILES *tpm_nv_data_files,
+			       TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
+TPM_RESULT TPM_NVDataFiles_Commit(TPM_NV_DATA_FILES *tpm_nv_data_files,
+				  TPM_NV_DATA_FILES *new_nv_data_files,
+				  uint32_t tpm_number);
 
 /*
   Processing Functions
@@ -63,6 +63,9 @@
 
    The PC Client requires 2048 bytes.  There is at least (currently) 6 bytes of overhead, a tag and
    a count.
+
+   This is the default.  The TPM_NV_DEFINED_SIZE environment variable sets the size at run time.
+   Since each data area is stored in its own NV file, the size is not bounded by TPM_MAX_NV_SPACE.
 */
 
 #ifndef TPM_MAX_NV_DEFINED_SIZE
@@ -416,6 +416,7 @@ TPM_RESULT TPM_Process_TakeOwnership(tpm_state_t *tpm_state,
 					 srkParams.tpm_pcr_info,
 					 srkParams.tpm_pcr_info_long);
 	writeAllNV1 = TRUE;
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
     }
     /* 15.  Create TPM_PERMANENT_DATA -> tpmProof by using the TPM RNG */
     /* NOTE:  Moved here so tpmProof can be inserted into SRK -> migrationAuth */
@@ -492,6 +493,7 @@ TPM_RESULT TPM_Process_TakeOwnership(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV2,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.readPubek),	/* flag */
 			       FALSE);						/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
     }
     /* Store the permanent data and flags back to NVRAM */
     returnCode = TPM_PermanentAll_NVStore(tpm_state,
@@ -554,7 +556,7 @@ TPM_RESULT TPM_Process_TakeOwnership(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     TPM_SizedBuffer_Delete(&encOwnerAuth);	/* @1 */
     TPM_SizedBuffer_Delete(&encSrkAuth);	/* @2 */
@@ -758,7 +760,7 @@ TPM_RESULT TPM_Process_OwnerClear(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     return rcf;
 }
@@ -929,6 +931,8 @@ TPM_RESULT TPM_OwnerClearCommon(tpm_state_t *tpm_state,
     size_t			current;
     TPM_KEY_HANDLE_ENTRY 	*tpm_key_handle_entry;
     
+    /* owner clear alters all permanent state sections */
+    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_ALL);
     /* 3. Unload all loaded keys. */
     /* a. If TPM_PERMANENT_FLAGS -> FIPS is TRUE, the memory locations containing secret or private
        keys MUST be set to all zeros. */
@@ -937,7 +941,7 @@ TPM_RESULT TPM_OwnerClearCommon(tpm_state_t *tpm_state,
 	   /* returns TPM_RETRY when at the end of the table, terminates loop */
 	   (TPM_KeyHandleEntries_GetNextEntry(&tpm_key_handle_entry,
 					      &current,
-					      tpm_state->tpm_key_handle_entries,
+					      &(tpm_state->tpm_key_handle_entries),
 					      start)) == 0) {
 	printf("TPM_OwnerClearCommon: Flushing key handle %08x\n",
 	       tpm_key_handle_entry->handle);
@@ -953,7 +957,7 @@ TPM_RESULT TPM_OwnerClearCommon(tpm_state_t *tpm_state,
     /* a.This includes owner evict keys */
     if (rc == 0) {
 	printf("TPM_OwnerClearCommon: Deleting owner evict keys\n");
-	TPM_KeyHandleEntries_OwnerEvictDelete(tpm_state->tpm_key_handle_entries);
+	TPM_KeyHandleEntries_OwnerEvictDelete(&(tpm_state->tpm_key_handle_entries));
     }
     /* 4.  The TPM MUST NOT modify the following TPM_PERMANENT_DATA items
        a. endorsementKey 
@@ -985,7 +989,7 @@ TPM_RESULT TPM_OwnerClearCommon(tpm_state_t *tpm_state,
 	printf("TPM_OwnerClearCommon: Invalidate delegateKey\n");
 	TPM_SymmetricKeyData_Init(tpm_state->tpm_permanent_data.delegateKey);
 	/* d. delegateTable */
-	TPM_DelegateTable_Delete(&(tpm_state->tpm_permanent_data.delegateTable));
+	TPM_DelegateTable_Clear(&(tpm_state->tpm_permanent_data.delegateTable));
 	/* e. contextKey */
 	printf("TPM_OwnerClearCommon: Invalidate contextKey\n");
 	TPM_SymmetricKeyData_Init(tpm_state->tpm_permanent_data.contextKey);
@@ -1099,7 +1103,7 @@ TPM_RESULT TPM_OwnerClearCommon(tpm_state_t *tpm_state,
 #endif
     /* 13. The TPM MUST invalidate all familyTable entries */
     if (rc == 0) {
-	TPM_FamilyTable_Delete(&(tpm_state->tpm_permanent_data.familyTable));
+	TPM_FamilyTable_Clear(&(tpm_state->tpm_permanent_data.familyTable));
     }
     /* 14. The TPM MUST terminate all sessions, active or saved. */
     /* NOTE: Done by TPM_StclearData_Delete() */
@@ -1470,6 +1474,7 @@ TPM_RESULT TPM_Process_PhysicalPresence(tpm_state_t *tpm_state,
     }
 #endif
     /* Store the permanent flags back to NVRAM */
+    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
     returnCode = TPM_PermanentAll_NVStore(tpm_state,
 					  writeAllNV,
 					  returnCode);
@@ -1642,6 +1647,7 @@ TPM_RESULT TPM_Process_DisableOwnerClear(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.disableOwnerClear),	/* flag */
 			       TRUE);							/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
     }
     /* Store the permanent flags back to NVRAM */
     returnCode = TPM_PermanentAll_NVStore(tpm_state,
@@ -1700,7 +1706,7 @@ TPM_RESULT TPM_Process_DisableOwnerClear(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     return rcf;
 }
@@ -1917,6 +1923,7 @@ TPM_RESULT TPM_Process_ResetEstablishmentBit(tpm_state_t *tpm_state,
 	TPM_SetCapability_Flag(&writeAllNV,					/* altered */
 			       &(tpm_state->tpm_permanent_flags.tpmEstablished),	/* flag */
 			       FALSE);							/* value */
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
 	
     }
     /* Store the permanent flags back to NVRAM */
@@ -549,8 +549,12 @@ TPM_RESULT TPM_PermanentData_Init(TPM_PERMANENT_DATA *tpm_permanent_data,
 	rc = TPM_OrdinalAuditStatus_Init(tpm_permanent_data);
     }
     if (rc == 0) {
-	TPM_FamilyTable_Init(&(tpm_permanent_data->familyTable));
-	TPM_DelegateTable_Init(&(tpm_permanent_data->delegateTable));
+	rc = TPM_FamilyTable_Init(&(tpm_permanent_data->familyTable));
+    }
+    if (rc == 0) {
+	rc = TPM_DelegateTable_Init(&(tpm_permanent_data->delegateTable));
+    }
+    if (rc == 0) {
 	tpm_permanent_data->lastFamilyID = 0;
 	tpm_permanent_data->noOwnerNVWrite = 0;
 	tpm_permanent_data->restrictDelegate = 0;
@@ -584,12 +588,21 @@ TPM_RESULT TPM_PermanentData_Load(TPM_PERMANENT_DATA *tpm_permanent_data,
     TPM_RESULT 		rc = 0;
     size_t 		i;
     TPM_BOOL		tpm_bool;
+    TPM_TAG		permanentDataVersion;
     
      
     printf(" TPM_PermanentData_Load:\n");
     /* check tag */
     if (rc == 0) {
-	rc = TPM_CheckTag(TPM_TAG_PERMANENT_DATA, stream, stream_size);
+	rc = TPM_Load16(&permanentDataVersion, stream, stream_size);
+    }
+    if (rc == 0) {
+	if ((permanentDataVersion != TPM_TAG_PERMANENT_DATA) &&
+	    (permanentDataVersion != TPM_TAG_NVSTATE_PD_V2)) {
+	    printf("TPM_PermanentData_Load: Error (fatal) unsupported version tag %04x\n",
+		   permanentDataVersion);
+	    rc = TPM_FAIL;
+	}
     }
     /* load revMajor */
     /* load revMinor */
@@ -684,12 +697,20 @@ TPM_RESULT TPM_PermanentData_Load(TPM_PERMANENT_DATA *tpm_permanent_data,
     for (i = 0 ; (rc == 0) && (i < (TPM_ORDINALS_MAX/CHAR_BIT)) ; i++) {
 	rc = TPM_Load8(&(tpm_permanent_data->ordinalAuditStatus[i]), stream, stream_size);
     }
-    /* load familyTable */
-    if (rc == 0) {
+    /* load familyTable, the original format has the compiled number of rows */
+    if ((rc == 0) && (permanentDataVersion == TPM_TAG_PERMANENT_DATA)) {
+	rc = TPM_FamilyTable_LoadRows(&(tpm_permanent_data->familyTable),
+				      TPM_NUM_FAMILY_TABLE_ENTRY_MIN, stream, stream_size);
+    }
+    if ((rc == 0) && (permanentDataVersion == TPM_TAG_NVSTATE_PD_V2)) {
 	rc = TPM_FamilyTable_Load(&(tpm_permanent_data->familyTable), stream, stream_size);
     }
     /* load delegateTable */
-    if (rc == 0) {
+    if ((rc == 0) && (permanentDataVersion == TPM_TAG_PERMANENT_DATA)) {
+	rc = TPM_DelegateTable_LoadRows(&(tpm_permanent_data->delegateTable),
+					TPM_NUM_DELEGATE_TABLE_ENTRY_MIN, stream, stream_size);
+    }
+    if ((rc == 0) && (permanentDataVersion == TPM_TAG_NVSTATE_PD_V2)) {
 	rc = TPM_DelegateTable_Load(&(tpm_permanent_data->delegateTable), stream, stream_size);
     }
     /* load lastFamilyID */
@@ -747,7 +768,7 @@ TPM_RESULT TPM_PermanentData_Store(TPM_STORE_BUFFER *sbuffer,
     printf(" TPM_PermanentData_Store:\n");
     /* store tag */
     if (rc == 0) {
-	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_PERMANENT_DATA);
+	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_NVSTATE_PD_V2);
     }
     /* store revMajor */
     /* store revMinor */
@@ -956,8 +977,295 @@ TPM_RESULT TPM_PermanentData_InitDaa(TPM_PERMANENT_DATA *tpm_permanent_data)
 
 /*
   PermanentAll is TPM_PERMANENT_DATA, TPM_PERMANENT_FLAGS, owner evict keys, and NV defined space.
+
+  In NV, each of the four is stored as a separate section, the section serialization followed by
+  its integrity digest.  The TPM_PERMANENT_ALL_NAME file is a manifest holding the copy number and
+  digest of each section.  Since a typical ordinal changes only one section (e.g. an NV write or
+  counter increment), only the changed sections and the manifest are rewritten.  A changed section
+  is written to the copy that the manifest does not use, and writing the manifest switches copies,
+  so that an interrupted update leaves the previous state intact.
+
+  The ordinals record the sections they alter with TPM_PermanentAll_SetDirty(), so that a commit
+  serializes and digests only those sections.
+*/
+
+/* NV base names of the permanent state sections, indexed by TPM_PERMANENT_SECTION_ */
+
+static const char *tpm_permanent_section_names[TPM_PERMANENT_SECTIONS] = {
+    TPM_PERMANENT_DATA_NAME,
+    TPM_PERMANENT_FLAGS_NAME,
+    TPM_OWNER_EVICT_NAME,
+    TPM_NV_INDEX_NAME
+};
+
+/* TRUE if TPM_PermanentAll_NVStore() defers the NV write to TPM_PermanentAll_NVFlush() */
+
+static TPM_BOOL tpm_permanent_group_commit = FALSE;
+
+/* TPM_PermanentAll_Name() forms the NV name of copy 'copy' of a section.  TPM_PERMANENT_COPY_NONE
+   is the V2 section under its base name.
+*/
+
+static void TPM_PermanentAll_Name(char *name,		/* at least TPM_FILENAME_MAX */
+				  size_t section,
+				  unsigned int copy)
+{
+    if (copy == TPM_PERMANENT_COPY_NONE) {
+	sprintf(name, "%s", tpm_permanent_section_names[section]);
+    }
+    else {
+	sprintf(name, "%s%u", tpm_permanent_section_names[section], copy);
+    }
+    return;
+}
+
+/* TPM_PermanentAll_LoadSection() deserializes one section of the TPM NV data from a stream created
+   by TPM_PermanentAll_StoreSection().
+
+   The two functions must be kept in sync.
+*/
+
+static TPM_RESULT TPM_PermanentAll_LoadSection(tpm_state_t *tpm_state,
+					       size_t section,
+					       unsigned char **stream,
+					       uint32_t *stream_size)
+{
+    TPM_RESULT		rc = 0;
+
+    printf(" TPM_PermanentAll_LoadSection: Section %lu\n", (unsigned long)section);
+    switch (section) {
+      case TPM_PERMANENT_SECTION_DATA:
+	/* TPM_PERMANENT_DATA deserialize from stream */
+	rc = TPM_PermanentData_Load(&(tpm_state->tpm_permanent_data),
+				    stream, stream_size, TRUE);
+	break;
+      case TPM_PERMANENT_SECTION_FLAGS:
+	/* TPM_PERMANENT_FLAGS deserialize from stream */
+	rc = TPM_PermanentFlags_Load(&(tpm_state->tpm_permanent_flags),
+				     stream, stream_size);
+	break;
+      case TPM_PERMANENT_SECTION_OE:
+	/* owner evict keys deserialize from stream */
+	rc = TPM_KeyHandleEntries_OwnerEvictLoad(&(tpm_state->tpm_key_handle_entries),
+						 stream, stream_size);
+	break;
+      case TPM_PERMANENT_SECTION_NV:
+	/* NV defined space deserialize from stream */
+	rc = TPM_NVIndexEntries_Load(&(tpm_state->tpm_nv_index_entries),
+				     stream, stream_size);
+	break;
+      default:
+	printf("TPM_PermanentAll_LoadSection: Error (fatal) illegal section %lu\n",
+	       (unsigned long)section);
+	rc = TPM_FAIL;
+	break;
+    }
+    return rc;
+}
+
+/* TPM_PermanentAll_StoreSection() serializes one section of the TPM NV data into a stream that can
+   be restored through TPM_PermanentAll_LoadSection().
+
+   The two functions must be kept in sync.
+*/
+
+static TPM_RESULT TPM_PermanentAll_StoreSection(TPM_STORE_BUFFER *sbuffer,
+						size_t section,
+						tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+
+    printf(" TPM_PermanentAll_StoreSection: Section %lu\n", (unsigned long)section);
+    switch (section) {
+      case TPM_PERMANENT_SECTION_DATA:
+	/* serialize TPM_PERMANENT_DATA  */
+	rc = TPM_PermanentData_Store(sbuffer,
+				     &(tpm_state->tpm_permanent_data), TRUE);
+	break;
+      case TPM_PERMANENT_SECTION_FLAGS:
+	/* serialize TPM_PERMANENT_FLAGS */
+	rc = TPM_PermanentFlags_Store(sbuffer,
+				      &(tpm_state->tpm_permanent_flags));
+	break;
+      case TPM_PERMANENT_SECTION_OE:
+	/* serialize owner evict keys */
+	rc = TPM_KeyHandleEntries_OwnerEvictStore(sbuffer,
+						  &(tpm_state->tpm_key_handle_entries),
+						  &(tpm_state->tpm_owner_evict_files));
+	break;
+      case TPM_PERMANENT_SECTION_NV:
+	/* serialize NV defined space */
+	rc = TPM_NVIndexEntries_Store(sbuffer,
+				      &(tpm_state->tpm_nv_index_entries));
+	break;
+      default:
+	printf("TPM_PermanentAll_StoreSection: Error (fatal) illegal section %lu\n",
+	       (unsigned long)section);
+	rc = TPM_FAIL;
+	break;
+    }
+    return rc;
+}
+
+/* TPM_PermanentAll_Snapshot() serializes the dirty permanent state sections into the in-memory
+   snapshot.  It is called whenever the state is committed, so that the snapshot always holds the
+   state at the start of the next ordinal.  The other sections are unaltered since the last
+   snapshot.  If the snapshot is invalid, all sections are serialized.
+
+   The serialized sections are added to those not yet written to NV.
+
+   'totalLength' returns the size of the equivalent TPM_PermanentAll_Store() stream, for
+   validation against TPM_MAX_NV_SPACE.
+
+   On error, the snapshot is marked invalid and a rollback falls back to reading NV.
+*/
+
+static TPM_RESULT TPM_PermanentAll_Snapshot(uint32_t *totalLength,
+					    tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+    const unsigned char *buffer;
+    uint32_t		length;
+    uint32_t		sections;
+    size_t		section;
+
+    if (tpm_state->permanentSnapshotValid) {
+	sections = tpm_state->permanentSectionsDirty;
+    }
+    else {
+	sections = TPM_PERMANENT_DIRTY_ALL;
+    }
+    printf(" TPM_PermanentAll_Snapshot: Sections %02x\n", sections);
+    /* the V1 format tag and integrity digest, for consistency with TPM_PermanentAll_IsSpace() */
+    *totalLength = sizeof(uint16_t) + TPM_DIGEST_SIZE;
+    for (section = 0 ; (rc == 0) && (section < TPM_PERMANENT_SECTIONS) ; section++) {
+	if (sections & (1 << section)) {
+	    TPM_Sbuffer_Clear(&(tpm_state->permanentSnapshot[section]));
+	    rc = TPM_PermanentAll_StoreSection(&(tpm_state->permanentSnapshot[section]),
+					       section, tpm_state);
+	}
+	if (rc == 0) {
+	    TPM_Sbuffer_Get(&(tpm_state->permanentSnapshot[section]), &buffer, &length);
+	    *totalLength += length;
+	}
+    }
+    if (rc == 0) {
+	tpm_state->permanentSectionsUnwritten |= sections;
+	tpm_state->permanentSectionsDirty = 0;
+    }
+    tpm_state->permanentSnapshotValid = (rc == 0);
+    return rc;
+}
+
+/* TPM_PermanentAll_RestoreSection() replaces one section of the in-memory permanent state with its
+   snapshot.
 */
 
+static TPM_RESULT TPM_PermanentAll_RestoreSection(tpm_state_t *tpm_state,
+						  size_t section)
+{
+    TPM_RESULT		rc = 0;
+    const unsigned char *buffer;
+    uint32_t		length;
+    unsigned char	*stream;
+    uint32_t		stream_size;
+    TPM_NV_DATA_ST 	*tpm_nv_data_st = NULL;	/* array of saved NV index volatile flags */
+    TPM_NV_INDEX_ENTRIES old_nv_index_entries;	/* altered NV defined space */
+    TPM_BOOL		oldSaved = FALSE;
+
+    printf(" TPM_PermanentAll_RestoreSection: Restoring section %s\n",
+	   tpm_permanent_section_names[section]);
+    /* delete the altered section */
+    switch (section) {
+      case TPM_PERMANENT_SECTION_DATA:
+	TPM_PermanentData_Delete(&(tpm_state->tpm_permanent_data), TRUE);
+	/* re-allocate TPM_PERMANENT_DATA data structures */
+	rc = TPM_PermanentData_Init(&(tpm_state->tpm_permanent_data), TRUE);
+	break;
+      case TPM_PERMANENT_SECTION_FLAGS:
+	/* TPM_PERMANENT_FLAGS have no allocated memory, the load overwrites all members */
+	break;
+      case TPM_PERMANENT_SECTION_OE:
+	/* the load keeps the unaltered owner evict keys and deletes the others */
+	break;
+      case TPM_PERMANENT_SECTION_NV:
+	/* Save a copy of the NV defined space volatile state.  It is not part of the snapshot, so it
+	   will be destroyed during the restore. */
+	rc = TPM_NVIndexEntries_GetVolatile(&tpm_nv_data_st,	/* freed @1 */
+					    &(tpm_state->tpm_nv_index_entries));
+	/* The snapshot does not hold the data areas.  Keep the altered entries until the unaltered
+	   data areas are moved to the restored entries. */
+	if (rc == 0) {
+	    old_nv_index_entries = tpm_state->tpm_nv_index_entries;	/* freed @2 */
+	    oldSaved = TRUE;
+	    TPM_NVIndexEntries_Init(&(tpm_state->tpm_nv_index_entries));
+	}
+	break;
+    }
+    /* deserialize the snapshot */
+    if (rc == 0) {
+	TPM_Sbuffer_Get(&(tpm_state->permanentSnapshot[section]), &buffer, &length);
+	stream = (unsigned char *)buffer;
+	stream_size = length;
+	rc = TPM_PermanentAll_LoadSection(tpm_state, section, &stream, &stream_size);
+    }
+    if ((rc == 0) && (section == TPM_PERMANENT_SECTION_NV)) {
+	rc = TPM_NVIndexEntries_SetVolatile(tpm_nv_data_st,
+					    &(tpm_state->tpm_nv_index_entries));
+    }
+    if ((rc == 0) && (section == TPM_PERMANENT_SECTION_NV)) {
+	rc = TPM_NVIndexEntries_AdoptData(&(tpm_state->tpm_nv_index_entries),
+					  &old_nv_index_entries,
+					  tpm_state->tpm_number);
+    }
+    if (oldSaved) {
+	TPM_NVIndexEntries_Delete(&old_nv_index_entries);		/* @2 */
+    }
+    free(tpm_nv_data_st);		/* @1 */
+    return rc;
+}
+
+/* TPM_PermanentAll_Rollback() restores the in-memory permanent state to the snapshot.
+
+   Each section is serialized and compared to its snapshot.  Only the sections that the failing
+   ordinal altered are deleted and reloaded, so that a typical error path neither touches NV nor
+   reloads the EK, SRK and owner evict keys.  All sections are compared, not only the dirty ones,
+   since an ordinal may fail before recording the sections it altered.
+*/
+
+static TPM_RESULT TPM_PermanentAll_Rollback(tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+    TPM_STORE_BUFFER	sbuffer;	/* current section serialization */
+    const unsigned char *buffer;
+    uint32_t		length;
+    const unsigned char *snapshotBuffer;
+    uint32_t		snapshotLength;
+    size_t		section;
+
+    printf(" TPM_PermanentAll_Rollback:\n");
+    TPM_Sbuffer_Init(&sbuffer);			/* freed @1 */
+    for (section = 0 ; (rc == 0) && (section < TPM_PERMANENT_SECTIONS) ; section++) {
+	TPM_Sbuffer_Clear(&sbuffer);
+	rc = TPM_PermanentAll_StoreSection(&sbuffer, section, tpm_state);
+	if (rc == 0) {
+	    TPM_Sbuffer_Get(&sbuffer, &buffer, &length);
+	    TPM_Sbuffer_Get(&(tpm_state->permanentSnapshot[section]),
+			    &snapshotBuffer, &snapshotLength);
+	    if ((length != snapshotLength) ||
+		(memcmp(buffer, snapshotBuffer, length) != 0)) {
+		rc = TPM_PermanentAll_RestoreSection(tpm_state, section);
+	    }
+	}
+    }
+    /* the state is the snapshot again */
+    if (rc == 0) {
+	tpm_state->permanentSectionsDirty = 0;
+    }
+    TPM_Sbuffer_Delete(&sbuffer);		/* @1 */
+    return rc;
+}
+
 /* TPM_PermanentAll_Load() deserializes all TPM NV data from a stream created by
    TPM_PermanentAll_Store().
 
@@ -973,33 +1281,16 @@ TPM_RESULT TPM_PermanentAll_Load(tpm_state_t *tpm_state,
     TPM_RESULT		rc = 0;
     unsigned char	*stream_start = *stream;	/* copy for integrity check */		
     uint32_t		stream_size_start = *stream_size;
+    size_t		section;
     
     printf(" TPM_PermanentAll_Load:\n");
     /* check format tag */
-    /* In the future, if multiple formats are supported, this check will be replaced by a 'switch'
-       on the tag */
     if (rc == 0) {
 	rc = TPM_CheckTag(TPM_TAG_NVSTATE_V1, stream, stream_size);
     }
-    /* TPM_PERMANENT_DATA deserialize from stream */
-    if (rc == 0) {
-	rc = TPM_PermanentData_Load(&(tpm_state->tpm_permanent_data),
-				    stream, stream_size, TRUE);
-    }
-    /* TPM_PERMANENT_FLAGS deserialize from stream */
-    if (rc == 0) {
-	rc = TPM_PermanentFlags_Load(&(tpm_state->tpm_permanent_flags),
-				     stream, stream_size);
-    }
-    /* owner evict keys deserialize from stream */
-    if (rc == 0) {
-	rc = TPM_KeyHandleEntries_OwnerEvictLoad(tpm_state->tpm_key_handle_entries,
-						 stream, stream_size);
-    }
-    /* NV defined space deserialize from stream */
-    if (rc == 0) {
-	rc = TPM_NVIndexEntries_Load(&(tpm_state->tpm_nv_index_entries),
-				     stream, stream_size);
+    /* deserialize the sections from stream */
+    for (section = 0 ; (rc == 0) && (section < TPM_PERMANENT_SECTIONS) ; section++) {
+	rc = TPM_PermanentAll_LoadSection(tpm_state, section, stream, stream_size);
     }
     /* sanity check the stream size */
     if (rc == 0) {
@@ -1032,10 +1323,8 @@ TPM_RESULT TPM_PermanentAll_Load(tpm_state_t *tpm_state,
 
    The TPM_STORE_BUFFER, buffer and length are returned for convenience.
 
-   This has two uses:
-
-   - It is called before the actual NV store to serialize the data
-   - It is called by TPM_NV_DefineSpace to determine if there is enough NV space for the new index
+   This is called by TPM_NV_DefineSpace to determine if there is enough NV space for the new
+   index.  The NV store itself uses the sectioned format, see TPM_PermanentAll_NVStore().
 */
 
 TPM_RESULT TPM_PermanentAll_Store(TPM_STORE_BUFFER *sbuffer,	/* freed by caller */
@@ -1045,31 +1334,16 @@ TPM_RESULT TPM_PermanentAll_Store(TPM_STORE_BUFFER *sbuffer,	/* freed by caller
 {
     TPM_RESULT		rc = 0;
     TPM_DIGEST		tpm_digest;
+    size_t		section;
 
     printf(" TPM_PermanentAll_Store:\n");
     /* overall format tag */
     if (rc == 0) {
 	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_NVSTATE_V1);
     }
-    /* serialize TPM_PERMANENT_DATA  */
-    if (rc == 0) {
-	rc = TPM_PermanentData_Store(sbuffer,
-				     &(tpm_state->tpm_permanent_data), TRUE);
-    }
-    /* serialize TPM_PERMANENT_FLAGS */
-    if (rc == 0) {
-	rc = TPM_PermanentFlags_Store(sbuffer,
-				      &(tpm_state->tpm_permanent_flags));
-    }
-    /* serialize owner evict keys */
-    if (rc == 0) {
-	rc = TPM_KeyHandleEntries_OwnerEvictStore(sbuffer,
-						  tpm_state->tpm_key_handle_entries);
-    }
-    /* serialize NV defined space */
-    if (rc == 0) {
-	rc = TPM_NVIndexEntries_Store(sbuffer,
-				      &(tpm_state->tpm_nv_index_entries));
+    /* serialize the sections */
+    for (section = 0 ; (rc == 0) && (section < TPM_PERMANENT_SECTIONS) ; section++) {
+	rc = TPM_PermanentAll_StoreSection(sbuffer, section, tpm_state);
     }
     if (rc == 0) {
 	/* get the current serialized buffer and its length */
@@ -1091,10 +1365,222 @@ TPM_RESULT TPM_PermanentAll_Store(TPM_STORE_BUFFER *sbuffer,	/* freed by caller
     return rc;
 }
 
+/* TPM_PermanentAll_ReadManifest() parses the TPM_PERMANENT_ALL_NAME manifest, returning the copy
+   number and digest of each section.
+
+   A V3 manifest holds the tag, the copy number and digest of each section, and the manifest
+   integrity digest.  A V2 manifest has no copy numbers, its sections are TPM_PERMANENT_COPY_NONE.
+*/
+
+static TPM_RESULT TPM_PermanentAll_ReadManifest(BYTE *sectionCopies,
+						TPM_DIGEST *sectionDigests,
+						unsigned char *stream,
+						uint32_t stream_size)
+{
+    TPM_RESULT		rc = 0;
+    uint16_t		tag = 0;
+    uint32_t		copySize = 0;
+    size_t		section;
+
+    /* check the manifest integrity digest */
+    if (rc == 0) {
+	if (stream_size < TPM_DIGEST_SIZE) {
+	    printf("TPM_PermanentAll_ReadManifest: Error (fatal) manifest size %u\n",
+		   stream_size);
+	    rc = TPM_FAIL;
+	}
+    }
+    if (rc == 0) {
+	rc = TPM_SHA1_Check(stream + stream_size - TPM_DIGEST_SIZE,
+			    stream_size - TPM_DIGEST_SIZE, stream,
+			    0, NULL);
+    }
+    if (rc == 0) {
+	rc = TPM_Load16(&tag, &stream, &stream_size);
+    }
+    if (rc == 0) {
+	if (tag == TPM_TAG_NVSTATE_V3) {
+	    copySize = sizeof(BYTE);
+	}
+	else if (tag != TPM_TAG_NVSTATE_V2) {
+	    printf("TPM_PermanentAll_ReadManifest: Error (fatal) manifest tag %04hx\n", tag);
+	    rc = TPM_FAIL;
+	}
+    }
+    if (rc == 0) {
+	if (stream_size != ((TPM_PERMANENT_SECTIONS * (copySize + TPM_DIGEST_SIZE)) +
+			    TPM_DIGEST_SIZE)) {
+	    printf("TPM_PermanentAll_ReadManifest: Error (fatal) manifest size %u\n",
+		   stream_size);
+	    rc = TPM_FAIL;
+	}
+    }
+    for (section = 0 ; (rc == 0) && (section < TPM_PERMANENT_SECTIONS) ; section++) {
+	if (tag == TPM_TAG_NVSTATE_V3) {
+	    rc = TPM_Load8(&(sectionCopies[section]), &stream, &stream_size);
+	    if ((rc == 0) && (sectionCopies[section] > 1)) {
+		printf("TPM_PermanentAll_ReadManifest: Error (fatal) section %s copy %u\n",
+		       tpm_permanent_section_names[section], sectionCopies[section]);
+		rc = TPM_FAIL;
+	    }
+	}
+	else {
+	    sectionCopies[section] = TPM_PERMANENT_COPY_NONE;
+	}
+	if (rc == 0) {
+	    rc = TPM_Loadn(sectionDigests[section], TPM_DIGEST_SIZE, &stream, &stream_size);
+	}
+    }
+    return rc;
+}
+
+/* TPM_PermanentAll_NVLoadSections() deserializes the sectioned NV state.  'stream' is the
+   TPM_PERMANENT_ALL_NAME manifest.
+
+   Each section is read from the NV file copy that the manifest records and validated against its
+   own integrity digest and the digest recorded in the manifest.  A mismatch is fatal, since a
+   store never overwrites the copies that the manifest records.
+
+   On success, the section copies and digests are cached in the tpm_state.
+*/
+
+static TPM_RESULT TPM_PermanentAll_NVLoadSections(tpm_state_t *tpm_state,
+						  unsigned char *stream,
+						  uint32_t stream_size)
+{
+    TPM_RESULT		rc = 0;
+    BYTE		sectionCopies[TPM_PERMANENT_SECTIONS];
+    TPM_DIGEST		sectionDigests[TPM_PERMANENT_SECTIONS];
+    char		name[TPM_FILENAME_MAX];
+    unsigned char	*section_stream = NULL;
+    unsigned char	*section_stream_start = NULL;
+    uint32_t		section_stream_size;
+    size_t		section;
+
+    printf(" TPM_PermanentAll_NVLoadSections:\n");
+    if (rc == 0) {
+	rc = TPM_PermanentAll_ReadManifest(sectionCopies, sectionDigests,
+					   stream, stream_size);
+    }
+    for (section = 0 ; (rc == 0) && (section < TPM_PERMANENT_SECTIONS) ; section++) {
+	/* read the section */
+	if (rc == 0) {
+	    TPM_PermanentAll_Name(name, section, sectionCopies[section]);
+	    rc = TPM_NVRAM_LoadData(&section_stream,		/* freed @1 */
+				    &section_stream_size,
+				    tpm_state->tpm_number,
+				    name);
+	}
+	/* the section ends with its integrity digest */
+	if (rc == 0) {
+	    section_stream_start = section_stream;	/* save starting point for free() */
+	    if (section_stream_size < TPM_DIGEST_SIZE) {
+		printf("TPM_PermanentAll_NVLoadSections: Error (fatal) section %s size %u\n",
+		       name, section_stream_size);
+		rc = TPM_FAIL;
+	    }
+	}
+	if (rc == 0) {
+	    section_stream_size -= TPM_DIGEST_SIZE;
+	    rc = TPM_SHA1_Check(section_stream + section_stream_size,
+				section_stream_size, section_stream,
+				0, NULL);
+	}
+	/* the section must be the one recorded in the manifest */
+	if (rc == 0) {
+	    rc = TPM_Digest_Compare(sectionDigests[section],
+				    section_stream + section_stream_size);
+	    if (rc != 0) {
+		printf("TPM_PermanentAll_NVLoadSections: Error (fatal) section %s "
+		       "does not match manifest\n", name);
+	    }
+	}
+	/* NV defined space data is left in the section stream until first accessed */
+	if ((rc == 0) && (section == TPM_PERMANENT_SECTION_NV)) {
+	    rc = TPM_NVIndexEntries_LoadLazy(&(tpm_state->tpm_nv_index_entries),
+					     section_stream_start,
+					     &section_stream, &section_stream_size);
+	    section_stream_start = NULL;	/* now owned by the NV index entries */
+	}
+	else if (rc == 0) {
+	    rc = TPM_PermanentAll_LoadSection(tpm_state, section,
+					      &section_stream, &section_stream_size);
+	}
+	/* sanity check the stream size */
+	if (rc == 0) {
+	    if (section_stream_size != 0) {
+		printf("TPM_PermanentAll_NVLoadSections: Error (fatal) section %s "
+		       "has %u bytes remaining\n", name, section_stream_size);
+		rc = TPM_FAIL;
+	    }
+	}
+	free(section_stream_start);	/* @1 */
+	section_stream_start = NULL;
+    }
+    /* cache the copies and digests of the state now in NV */
+    if (rc == 0) {
+	memcpy(tpm_state->permanentSectionCopies, sectionCopies, sizeof(sectionCopies));
+	memcpy(tpm_state->permanentSectionDigests, sectionDigests, sizeof(sectionDigests));
+	tpm_state->permanentSectionsValid = TRUE;
+    }
+    return rc;
+}
+
+/* TPM_PermanentAll_NVLatest() sets the tpm_state section copies from the manifest in NV.
+
+   It is used when the cached copies may not reflect NV, so that the next store does not overwrite
+   a section copy that the manifest records.  A missing, V1, or V2 manifest records no copies.
+*/
+
+static TPM_RESULT TPM_PermanentAll_NVLatest(tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+    BYTE		sectionCopies[TPM_PERMANENT_SECTIONS];
+    TPM_DIGEST		sectionDigests[TPM_PERMANENT_SECTIONS];
+    unsigned char	*stream = NULL;
+    uint32_t		stream_size;
+    unsigned char	*tag_stream;
+    uint32_t		tag_stream_size;
+    uint16_t		tag = 0;
+    size_t		section;
+
+    for (section = 0 ; section < TPM_PERMANENT_SECTIONS ; section++) {
+	tpm_state->permanentSectionCopies[section] = TPM_PERMANENT_COPY_NONE;
+    }
+    /* Returns TPM_RETRY on non-existent file */
+    if (rc == 0) {
+	rc = TPM_NVRAM_LoadData(&stream,		/* freed @1 */
+				&stream_size,
+				tpm_state->tpm_number,
+				TPM_PERMANENT_ALL_NAME);
+    }
+    if (rc == 0) {
+	tag_stream = stream;
+	tag_stream_size = stream_size;
+	rc = TPM_Load16(&tag, &tag_stream, &tag_stream_size);
+    }
+    if ((rc == 0) && (tag == TPM_TAG_NVSTATE_V3)) {
+	rc = TPM_PermanentAll_ReadManifest(sectionCopies, sectionDigests,
+					   stream, stream_size);
+	if (rc == 0) {
+	    memcpy(tpm_state->permanentSectionCopies, sectionCopies, sizeof(sectionCopies));
+	}
+    }
+    if (rc == TPM_RETRY) {
+	rc = 0;
+    }
+    free(stream);			/* @1 */
+    return rc;
+}
+
 /* TPM_PermanentAll_NVLoad()
 
    Deserialize the TPM_PERMANENT_DATA, TPM_PERMANENT_FLAGS, owner evict keys, and NV defined
-   space from a stream read from the NV file TPM_PERMANENT_ALL_NAME.
+   space from the NV file TPM_PERMANENT_ALL_NAME and the section files it lists.
+
+   A TPM_PERMANENT_ALL_NAME file in the older single stream V1 format, or a V2 manifest of
+   sections without copies, is also accepted.  In that case, the next TPM_PermanentAll_NVStore()
+   writes all sections.
 
    Returns:
 
@@ -1109,8 +1595,15 @@ TPM_RESULT TPM_PermanentAll_NVLoad(tpm_state_t *tpm_state)
     unsigned char	*stream = NULL;
     unsigned char	*stream_start = NULL;
     uint32_t		stream_size;
+    unsigned char	*tag_stream;
+    uint32_t		tag_stream_size;
+    uint16_t		tag = 0;
+    uint32_t		totalLength;
 
     printf(" TPM_PermanentAll_NVLoad:\n");
+    /* until the load completes, the cached section digests and the snapshot are invalid */
+    tpm_state->permanentSectionsValid = FALSE;
+    tpm_state->permanentSnapshotValid = FALSE;
     if (rc == 0) {
 	/* try loading from NVRAM */
 	/* Returns TPM_RETRY on non-existent file */
@@ -1119,28 +1612,243 @@ TPM_RESULT TPM_PermanentAll_NVLoad(tpm_state_t *tpm_state)
 				tpm_state->tpm_number,
 				TPM_PERMANENT_ALL_NAME);
     }
-    /* deserialize from stream */
+    /* get the format tag */
     if (rc == 0) {
 	stream_start = stream;			/* save starting point for free() */
-	rc = TPM_PermanentAll_Load(tpm_state, &stream, &stream_size);
-	if (rc != 0) {
-	    printf("TPM_PermanentAll_NVLoad: Error (fatal) loading deserializing NV state\n");
-	    rc = TPM_FAIL;
+	tag_stream = stream;
+	tag_stream_size = stream_size;
+	rc = TPM_Load16(&tag, &tag_stream, &tag_stream_size);
+    }
+    /* deserialize from stream */
+    if (rc == 0) {
+	if ((tag == TPM_TAG_NVSTATE_V2) || (tag == TPM_TAG_NVSTATE_V3)) {
+	    rc = TPM_PermanentAll_NVLoadSections(tpm_state, stream, stream_size);
+	}
+	else {
+	    printf("  TPM_PermanentAll_NVLoad: Loading single stream format %04hx\n", tag);
+	    rc = TPM_PermanentAll_Load(tpm_state, &stream, &stream_size);
 	}
     }
+    /* record the NV defined space data areas that are in their own NV files */
+    if (rc == 0) {
+	rc = TPM_NVDataFiles_Set(&(tpm_state->tpm_nv_data_files),
+				 &(tpm_state->tpm_nv_index_entries));
+    }
+    /* record the owner evict keys that are in their own NV files */
+    if (rc == 0) {
+	rc = TPM_OwnerEvictFiles_Set(&(tpm_state->tpm_owner_evict_files),
+				     &(tpm_state->tpm_key_handle_entries));
+    }
+    /* the next store moves V2 sections to their copies */
+    if ((rc == 0) && (tag == TPM_TAG_NVSTATE_V2)) {
+	tpm_state->permanentSectionsValid = FALSE;
+    }
+    /* the loaded state is the rollback point for the next ordinal, and is in NV */
+    if (rc == 0) {
+	rc = TPM_PermanentAll_Snapshot(&totalLength, tpm_state);
+    }
+    if (rc == 0) {
+	tpm_state->permanentSectionsUnwritten = 0;
+    }
+    if ((rc != 0) && (rc != TPM_RETRY)) {
+	printf("TPM_PermanentAll_NVLoad: Error (fatal) loading deserializing NV state\n");
+	rc = TPM_FAIL;
+    }
     free(stream_start); /* @1 */
     return rc;
 }
 
-/* TPM_PermanentAll_NVStore() serializes all NV data and stores it in the NV file
-   TPM_PERMANENT_ALL_NAME
+/* TPM_PermanentAll_NVStoreSections() writes the snapshot sections that changed since the last NV
+   read or write, and then writes the TPM_PERMANENT_ALL_NAME manifest.
+
+   The caller must have taken the snapshot with TPM_PermanentAll_Snapshot(), which also validates
+   the total size against TPM_MAX_NV_SPACE.  Only the sections serialized since the last NV write
+   are digested.
+
+   Each changed section is written to the copy that the manifest does not use, and then the
+   manifest is written, switching copies.  An interrupted update therefore leaves the previous
+   manifest and the sections it records intact.  The NV defined space data areas and the owner
+   evict keys are written before the section that records their digests.
+*/
+
+static TPM_RESULT TPM_PermanentAll_NVStoreSections(tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+    TPM_STORE_BUFFER	sbuffer;	/* section serialization and integrity digest */
+    TPM_STORE_BUFFER	manifest;
+    BYTE		sectionCopies[TPM_PERMANENT_SECTIONS];
+    TPM_DIGEST		sectionDigests[TPM_PERMANENT_SECTIONS];
+    TPM_DIGEST		manifestDigest;
+    char		name[TPM_FILENAME_MAX];
+    const unsigned char *buffer;
+    uint32_t		length;
+    uint32_t		sections;
+    TPM_BOOL		sectionsValid;
+    TPM_BOOL		changed = FALSE;
+    TPM_BOOL		nvChanged = FALSE;
+    TPM_NV_DATA_FILES	new_nv_data_files;
+    TPM_BOOL		oeChanged = FALSE;
+    TPM_OWNER_EVICT_FILES new_owner_evict_files;
+    size_t		section;
+
+    printf(" TPM_PermanentAll_NVStoreSections:\n");
+    TPM_Sbuffer_Init(&sbuffer);				/* freed @1 */
+    TPM_Sbuffer_Init(&manifest);			/* freed @2 */
+    TPM_NVDataFiles_Init(&new_nv_data_files);		/* freed @3 */
+    TPM_OwnerEvictFiles_Init(&new_owner_evict_files);	/* freed @4 */
+    sectionsValid = tpm_state->permanentSectionsValid;
+    if (!tpm_state->permanentSnapshotValid) {
+	printf("TPM_PermanentAll_NVStoreSections: Error (fatal), snapshot is invalid\n");
+	rc = TPM_FAIL;
+    }
+    /* if the cache does not reflect NV, write all sections, avoiding the copies in use */
+    if ((rc == 0) && !sectionsValid) {
+	rc = TPM_PermanentAll_NVLatest(tpm_state);
+    }
+    if (sectionsValid) {
+	sections = tpm_state->permanentSectionsUnwritten;
+    }
+    else {
+	sections = TPM_PERMANENT_DIRTY_ALL;
+    }
+    /* write the changed sections */
+    for (section = 0 ; (rc == 0) && (section < TPM_PERMANENT_SECTIONS) ; section++) {
+	/* a section not serialized since the last NV write is unchanged */
+	if (!(sections & (1 << section))) {
+	    sectionCopies[section] = tpm_state->permanentSectionCopies[section];
+	    TPM_Digest_Copy(sectionDigests[section], tpm_state->permanentSectionDigests[section]);
+	    continue;
+	}
+	TPM_Sbuffer_Get(&(tpm_state->permanentSnapshot[section]), &buffer, &length);
+	rc = TPM_SHA1(sectionDigests[section],
+		      length, buffer,
+		      0, NULL);
+	if (rc != 0) {
+	    break;
+	}
+	if (sectionsValid &&
+	    (memcmp(tpm_state->permanentSectionDigests[section],
+		    sectionDigests[section], TPM_DIGEST_SIZE) == 0)) {
+	    sectionCopies[section] = tpm_state->permanentSectionCopies[section];
+	    continue;
+	}
+	/* the copy not in use, a V2 section moves to copy 0 */
+	sectionCopies[section] = (tpm_state->permanentSectionCopies[section] == 0) ? 1 : 0;
+	TPM_PermanentAll_Name(name, section, sectionCopies[section]);
+	printf("  TPM_PermanentAll_NVStoreSections: Writing section %s\n", name);
+	changed = TRUE;
+	/* the snapshot was taken from the current NV defined space, so its data areas are
+	   current */
+	if (section == TPM_PERMANENT_SECTION_NV) {
+	    nvChanged = TRUE;
+	    rc = TPM_NVIndexEntries_NVStoreData(&new_nv_data_files,
+						&(tpm_state->tpm_nv_index_entries),
+						&(tpm_state->tpm_nv_data_files),
+						tpm_state->tpm_number);
+	}
+	/* the snapshot assigned each new owner evict key its NV file copy */
+	if (section == TPM_PERMANENT_SECTION_OE) {
+	    oeChanged = TRUE;
+	    rc = TPM_KeyHandleEntries_OwnerEvictNVStore(&new_owner_evict_files,
+							&(tpm_state->tpm_key_handle_entries),
+							&(tpm_state->tpm_owner_evict_files),
+							tpm_state->tpm_number);
+	}
+	/* append the integrity digest */
+	TPM_Sbuffer_Clear(&sbuffer);
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_AppendSBuffer(&sbuffer, &(tpm_state->permanentSnapshot[section]));
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append(&sbuffer, sectionDigests[section], TPM_DIGEST_SIZE);
+	}
+	if (rc == 0) {
+	    TPM_Sbuffer_Get(&sbuffer, &buffer, &length);
+	    rc = TPM_NVRAM_StoreData(buffer,
+				     length,
+				     tpm_state->tpm_number,
+				     name);
+	}
+    }
+    /* write the manifest, switching to the new section copies */
+    if ((rc == 0) && changed) {
+	rc = TPM_Sbuffer_Append16(&manifest, TPM_TAG_NVSTATE_V3);
+    }
+    for (section = 0 ; (rc == 0) && changed && (section < TPM_PERMANENT_SECTIONS) ; section++) {
+	rc = TPM_Sbuffer_Append(&manifest, &(sectionCopies[section]), sizeof(BYTE));
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append(&manifest, sectionDigests[section], TPM_DIGEST_SIZE);
+	}
+    }
+    /* append the manifest integrity digest */
+    if ((rc == 0) && changed) {
+	TPM_Sbuffer_Get(&manifest, &buffer, &length);
+	rc = TPM_SHA1(manifestDigest,
+		      length, buffer,
+		      0, NULL);
+    }
+    if ((rc == 0) && changed) {
+	rc = TPM_Sbuffer_Append(&manifest, manifestDigest, TPM_DIGEST_SIZE);
+    }
+    if ((rc == 0) && changed) {
+	TPM_Sbuffer_Get(&manifest, &buffer, &length);
+	rc = TPM_NVRAM_StoreData(buffer,
+				 length,
+				 tpm_state->tpm_number,
+				 TPM_PERMANENT_ALL_NAME);
+    }
+    /* the manifest supersedes any V2 sections */
+    for (section = 0 ; (rc == 0) && !sectionsValid && (section < TPM_PERMANENT_SECTIONS) ;
+	 section++) {
+	TPM_PermanentAll_Name(name, section, TPM_PERMANENT_COPY_NONE);
+	rc = TPM_NVRAM_DeleteName(tpm_state->tpm_number,
+				  name,
+				  FALSE);
+    }
+    /* cache the copies and digests of the state now in NV.  After a failure, NV is unknown, so the
+       next store writes all sections. */
+    if (rc == 0) {
+	memcpy(tpm_state->permanentSectionCopies, sectionCopies, sizeof(sectionCopies));
+	memcpy(tpm_state->permanentSectionDigests, sectionDigests, sizeof(sectionDigests));
+	tpm_state->permanentSectionsValid = TRUE;
+	tpm_state->permanentSectionsUnwritten = 0;
+    }
+    else {
+	tpm_state->permanentSectionsValid = FALSE;
+    }
+    /* the manifest now records the new data areas, the NV files of deleted indexes can go */
+    if ((rc == 0) && nvChanged) {
+	rc = TPM_NVDataFiles_Commit(&(tpm_state->tpm_nv_data_files),
+				    &new_nv_data_files,
+				    tpm_state->tpm_number);
+    }
+    if ((rc == 0) && oeChanged) {
+	rc = TPM_OwnerEvictFiles_Commit(&(tpm_state->tpm_owner_evict_files),
+					&new_owner_evict_files,
+					tpm_state->tpm_number);
+    }
+    TPM_Sbuffer_Delete(&sbuffer);			/* @1 */
+    TPM_Sbuffer_Delete(&manifest);			/* @2 */
+    TPM_NVDataFiles_Delete(&new_nv_data_files);		/* @3 */
+    TPM_OwnerEvictFiles_Delete(&new_owner_evict_files);	/* @4 */
+    return rc;
+}
+
+/* TPM_PermanentAll_NVStore() serializes the dirty sections of the NV data and stores the changed
+   sections in NV
 
    If the writeAllNV flag is FALSE, the function is a no-op, and returns the input 'rcIn'.
 
+   The ordinal should have recorded the sections it altered with TPM_PermanentAll_SetDirty().  If
+   it recorded none, all sections are serialized.
+
+   Under group commit, the write is deferred until TPM_PermanentAll_NVFlush().
+
    If writeAllNV is TRUE and rcIn is not TPM_SUCCESS, this indicates that the ordinal
    modified the in-memory TPM_PERMANENT_DATA and/or TPM_PERMANENT_FLAGS structures (perhaps only
-   partially) and then detected an error.  Since the command is failing, roll back the structure by
-   reading the NV file.	 If the read then fails, this is a fatal error.
+   partially) and then detected an error.  Since the command is failing, roll back the altered
+   sections from the in-memory snapshot.  If there is no valid snapshot, roll back by reading the NV
+   file.  If the rollback then fails, this is a fatal error.
 
    Similarly, if writeAllNV is TRUE and the actual NV write fails, this is a fatal error.
 */
@@ -1150,20 +1858,20 @@ TPM_RESULT TPM_PermanentAll_NVStore(tpm_state_t *tpm_state,
 				    TPM_RESULT rcIn)
 {
     TPM_RESULT		rc = 0;
-    TPM_STORE_BUFFER	sbuffer;	/* safe buffer for storing binary data */
-    const unsigned char *buffer;
     uint32_t		length;
     TPM_NV_DATA_ST 	*tpm_nv_data_st = NULL;	/* array of saved NV index volatile flags */ 
 
     printf(" TPM_PermanentAll_NVStore: write flag %u\n", writeAllNV);
-    TPM_Sbuffer_Init(&sbuffer);			/* freed @1 */
     if (writeAllNV) {
 	if (rcIn == TPM_SUCCESS) {
+	    if (tpm_state->permanentSectionsDirty == 0) {
+		printf("  TPM_PermanentAll_NVStore: No dirty sections recorded, "
+		       "serializing all\n");
+		tpm_state->permanentSectionsDirty = TPM_PERMANENT_DIRTY_ALL;
+	    }
 	    /* serialize state to be written to NV */
 	    if (rc == 0) {
-		rc = TPM_PermanentAll_Store(&sbuffer,
-					    &buffer, &length,
-					    tpm_state);
+		rc = TPM_PermanentAll_Snapshot(&length, tpm_state);
 	    }
 	    /* validate the length of the stream against the maximum provided NV space */
 	    if (rc == 0) {
@@ -1174,12 +1882,16 @@ TPM_RESULT TPM_PermanentAll_NVStore(tpm_state_t *tpm_state,
 		    rc = TPM_NOSPACE;
 		}
 	    }
-	    /* store the buffer in NVRAM */
+	    /* write the changed sections to NV, or defer the write */
 	    if (rc == 0) {
-		rc = TPM_NVRAM_StoreData(buffer,
-					 length,
-					 tpm_state->tpm_number,
-					 TPM_PERMANENT_ALL_NAME); 
+		if (tpm_permanent_group_commit) {
+		    printf("   TPM_PermanentAll_NVStore: Deferring write\n");
+		    tpm_state->permanentStorePending = TRUE;
+		    tpm_state->permanentStoreDeferred = TRUE;
+		}
+		else {
+		    rc = TPM_PermanentAll_NVStoreSections(tpm_state);
+		}
 	    }
 	    if (rc != 0) {
 		printf("TPM_PermanentAll_NVStore: Error (fatal), "
@@ -1187,10 +1899,27 @@ TPM_RESULT TPM_PermanentAll_NVStore(tpm_state_t *tpm_state,
 		rc = TPM_FAIL;
 	    }
 	}
-	else {	
+	else if (tpm_state->permanentSnapshotValid) {
 	    /* An in-memory structure was altered, but the ordinal had a subsequent error.  Since
-	       the structure is in an invalid state, roll back to the previous value by reading the
-	       NV file. */
+	       the structure is in an invalid state, roll back to the previous value from the
+	       snapshot. */
+	    printf("  TPM_PermanentAll_NVStore: Ordinal error, "
+		   "rolling back NV structure cache from snapshot\n");
+	    rc = TPM_PermanentAll_Rollback(tpm_state);
+	    /* after a successful rollback, return the ordinal's original error code */
+	    if (rc == 0) {
+		rc = rcIn;
+	    }
+	    /* a failure during rollback is fatal */
+	    else {
+		printf("TPM_PermanentAll_NVStore: Error (fatal), "
+		       "Permanent Data, Flags, or owner evict keys structure is invalid\n");
+		rc = TPM_FAIL;
+	    }
+	}
+	else {	
+	    /* No snapshot, roll back by reading the NV file.  A group commit always leaves a valid
+	       snapshot, so NV is current. */
 	    printf("  TPM_PermanentAll_NVStore: Ordinal error, "
 		   "rolling back NV structure cache\n");
 	    /* Save a copy of the NV defined space volatile state.  It is not stored in NV, so it
@@ -1205,7 +1934,7 @@ TPM_RESULT TPM_PermanentAll_NVStore(tpm_state_t *tpm_state,
 		printf(" TPM_PermanentAllNVStore: Deleting TPM_PERMANENT_DATA structure\n");
 		TPM_PermanentData_Delete(&(tpm_state->tpm_permanent_data), TRUE);
 		printf(" TPM_PermanentAllNVStore: Deleting owner evict keys\n");
-		TPM_KeyHandleEntries_OwnerEvictDelete(tpm_state->tpm_key_handle_entries);
+		TPM_KeyHandleEntries_OwnerEvictDelete(&(tpm_state->tpm_key_handle_entries));
 		printf(" TPM_PermanentAllNVStore: Deleting NV defined space \n");
 		TPM_NVIndexEntries_Delete(&(tpm_state->tpm_nv_index_entries));
 		printf(" TPM_PermanentAllNVStore: "
@@ -1237,14 +1966,82 @@ TPM_RESULT TPM_PermanentAll_NVStore(tpm_state_t *tpm_state,
     else {
 	rc = rcIn;
     }
-    TPM_Sbuffer_Delete(&sbuffer);	/* @1 */
     free(tpm_nv_data_st);		/* @2 */
     return rc;
 }
 
-/* TPM_PermanentAll_NVDelete() deletes ann NV data in the NV file TPM_PERMANENT_ALL_NAME.
+/* TPM_PermanentAll_SetDirty() records that an ordinal altered the permanent state 'sections', a
+   mask of TPM_PERMANENT_DIRTY_ values.  The next TPM_PermanentAll_NVStore() serializes them.
+*/
+
+void TPM_PermanentAll_SetDirty(tpm_state_t *tpm_state,
+			       uint32_t sections)
+{
+    tpm_state->permanentSectionsDirty |= sections;
+    return;
+}
+
+/* TPM_PermanentAll_SetGroupCommit() enables or disables deferring TPM_PermanentAll_NVStore()
+   writes.
+
+   With group commit, the caller must call TPM_PermanentAll_NVFlush() before a response that
+   depends on the write is released, typically once per batch of commands.
+*/
 
-   If mustExist is TRUE, returns an error if the file does not exist.
+void TPM_PermanentAll_SetGroupCommit(TPM_BOOL groupCommit)
+{
+    printf(" TPM_PermanentAll_SetGroupCommit: %u\n", groupCommit);
+    tpm_permanent_group_commit = groupCommit;
+    return;
+}
+
+/* TPM_PermanentAll_NVFlush() writes a permanent state change deferred by group commit.
+
+   A failure is fatal, as for TPM_PermanentAll_NVStore().
+*/
+
+TPM_RESULT TPM_PermanentAll_NVFlush(tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+
+    if (tpm_state->permanentStorePending) {
+	printf(" TPM_PermanentAll_NVFlush:\n");
+	rc = TPM_PermanentAll_NVStoreSections(tpm_state);
+	if (rc == 0) {
+	    tpm_state->permanentStorePending = FALSE;
+	}
+	else {
+	    printf("TPM_PermanentAll_NVFlush: Error (fatal), "
+		   "NV structure in-memory caches are in invalid state\n");
+	    rc = TPM_FAIL;
+	}
+    }
+    return rc;
+}
+
+/* TPM_PermanentAll_NVRetry() records that a deferred write, or the sync that made it durable,
+   failed.
+
+   The in-memory permanent state is kept.  The next write stores all sections again, avoiding the
+   copies named by the manifest in NV, so that NV catches up with memory.  Under group commit, the
+   write stays pending, so that the next TPM_PermanentAll_NVFlush() retries it.
+*/
+
+void TPM_PermanentAll_NVRetry(tpm_state_t *tpm_state)
+{
+    printf(" TPM_PermanentAll_NVRetry:\n");
+    if (tpm_permanent_group_commit) {
+	tpm_state->permanentStorePending = TRUE;
+    }
+    tpm_state->permanentSectionsValid = FALSE;
+    return;
+}
+
+/* TPM_PermanentAll_NVDelete() deletes ann NV data in the NV file TPM_PERMANENT_ALL_NAME and the
+   section files.
+
+   If mustExist is TRUE, returns an error if the TPM_PERMANENT_ALL_NAME file does not exist.  The
+   section files are optional, since a V1 format file has none.
    
    It does not delete the in-memory copy.
 */
@@ -1253,14 +2050,33 @@ TPM_RESULT TPM_PermanentAll_NVDelete(uint32_t tpm_number,
 				     TPM_BOOL mustExist)
 {
     TPM_RESULT		rc = 0;
+    char		name[TPM_FILENAME_MAX];
+    unsigned int	copy;
+    size_t		section;
     
     printf(" TPM_PermanentAll_NVDelete:\n");
-    /* remove the NVRAM file */
+    /* remove the manifest first, so that a partial delete does not leave a manifest that refers
+       to missing sections */
     if (rc == 0) {
 	rc = TPM_NVRAM_DeleteName(tpm_number,
 				  TPM_PERMANENT_ALL_NAME,
 				  mustExist);
     }
+    /* remove the section NVRAM files, both copies and any V2 section */
+    for (section = 0 ; (rc == 0) && (section < TPM_PERMANENT_SECTIONS) ; section++) {
+	for (copy = 0 ; (rc == 0) && (copy < 2) ; copy++) {
+	    TPM_PermanentAll_Name(name, section, copy);
+	    rc = TPM_NVRAM_DeleteName(tpm_number,
+				      name,
+				      FALSE);
+	}
+	if (rc == 0) {
+	    TPM_PermanentAll_Name(name, section, TPM_PERMANENT_COPY_NONE);
+	    rc = TPM_NVRAM_DeleteName(tpm_number,
+				      name,
+				      FALSE);
+	}
+    }
     return rc;
 }
 
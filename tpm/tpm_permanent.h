@@ -83,7 +83,7 @@ void       TPM_PermanentData_Zero(TPM_PERMANENT_DATA *tpm_permanent_data,
 TPM_RESULT TPM_PermanentData_InitDaa(TPM_PERMANENT_DATA *tpm_permanent_data);
 
 /*
-  PermanentAll is TPM_PERMANENT_DATA plus TPM_PERMANENT_FLAGS
+  PermanentAll is TPM_PERMANENT_DATA, TPM_PERMANENT_FLAGS, owner evict keys, and NV defined space
 */
 
 TPM_RESULT TPM_PermanentAll_Load(tpm_state_t *tpm_state,
@@ -100,6 +100,11 @@ TPM_RESULT TPM_PermanentAll_NVStore(tpm_state_t *tpm_state,
 				    TPM_RESULT rcIn);
 TPM_RESULT TPM_PermanentAll_NVDelete(uint32_t tpm_number,
 				     TPM_BOOL mustExist);
+void       TPM_PermanentAll_SetDirty(tpm_state_t *tpm_state,
+				     uint32_t sections);
+void       TPM_PermanentAll_SetGroupCommit(TPM_BOOL groupCommit);
+TPM_RESULT TPM_PermanentAll_NVFlush(tpm_state_t *tpm_state);
+void       TPM_PermanentAll_NVRetry(tpm_state_t *tpm_state);
 
 TPM_RESULT TPM_PermanentAll_IsSpace(tpm_state_t *tpm_state);
 TPM_RESULT TPM_PermanentAll_GetSpace(uint32_t *bytes_free,
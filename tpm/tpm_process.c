@@ -66,6 +66,7 @@
 #include "tpm_memory.h"
 #include "tpm_migration.h"
 #include "tpm_nonce.h"
+#include "tpm_nvfile.h"
 #include "tpm_nvram.h"
 #include "tpm_owner.h"
 #include "tpm_pcr.h"
@@ -99,16 +100,21 @@ static TPM_RESULT TPM_GetCapability_CapProperty(TPM_STORE_BUFFER *capabilityResp
 						uint32_t capProperty);
 static TPM_RESULT TPM_GetCapability_CapVersion(TPM_STORE_BUFFER *capabilityResponse);
 static TPM_RESULT TPM_GetCapability_CapCheckLoaded(TPM_STORE_BUFFER *capabilityResponse,
-						   const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry,
+						   const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
 						   TPM_SIZED_BUFFER *subCap);
 static TPM_RESULT TPM_GetCapability_CapSymMode(TPM_STORE_BUFFER *capabilityResponse,
 					       TPM_SYM_MODE symMode);
 static TPM_RESULT TPM_GetCapability_CapKeyStatus(TPM_STORE_BUFFER *capabilityResponse,
-						 TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+						 TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
 						 uint32_t tpm_key_handle);
 static TPM_RESULT TPM_GetCapability_CapMfr(TPM_STORE_BUFFER *capabilityResponse,
 					   tpm_state_t *tpm_state,
 					   TPM_SIZED_BUFFER *subCap);
+static TPM_RESULT TPM_GetCapability_CapNVMetrics(TPM_STORE_BUFFER *capabilityResponse);
+static TPM_RESULT TPM_GetCapability_CapAuthMetrics(TPM_STORE_BUFFER *capabilityResponse,
+						   tpm_state_t *tpm_state);
+static TPM_RESULT TPM_GetCapability_CapContextMetrics(TPM_STORE_BUFFER *capabilityResponse,
+						      tpm_state_t *tpm_state);
 static TPM_RESULT TPM_GetCapability_CapNVIndex(TPM_STORE_BUFFER *capabilityResponse,
 					       tpm_state_t *tpm_state,
 					       uint32_t nvIndex);
@@ -2048,6 +2054,14 @@ static TPM_ORDINAL_TABLE tpm_ordinal_table[] =
    Ordinal Table Utilities
 */
 
+/* tpm_ordinal_index maps each ordinal below TPM_ORDINALS_MAX to its tpm_ordinal_table entry + 1,
+   0 if the ordinal is not in the table.  It is built on first use, since the audit, permission, and
+   handle lookups run for every command and for every delegated authorization.
+*/
+
+static uint16_t tpm_ordinal_index[TPM_ORDINALS_MAX];
+static TPM_BOOL tpm_ordinal_index_built = FALSE;
+
 /* TPM_OrdinalTable_GetEntry() gets the table entry for the ordinal.
 
    If the ordinal is not in the table, TPM_BAD_ORDINAL is returned
@@ -2062,11 +2076,30 @@ TPM_RESULT TPM_OrdinalTable_GetEntry(TPM_ORDINAL_TABLE **entry,
 
     /* printf(" TPM_OrdinalTable_GetEntry: Ordinal %08x\n", ordinal); */
     *entry = NULL;
-    for (i = 0 ; i < (sizeof(tpm_ordinal_table)/sizeof(TPM_ORDINAL_TABLE)) ; i++) {
-	if (ordinalTable[i].ordinal == ordinal) {	/* if found */
-	    *entry = &(ordinalTable[i]);		/* return the entry */
-	    rc = 0;					/* return found */
-	    break;
+    /* index the ordinal table, the first entry for an ordinal wins, as in the search below */
+    if (!tpm_ordinal_index_built) {
+	for (i = 0 ; i < (sizeof(tpm_ordinal_table)/sizeof(TPM_ORDINAL_TABLE)) ; i++) {
+	    if ((tpm_ordinal_table[i].ordinal < TPM_ORDINALS_MAX) &&
+		(tpm_ordinal_index[tpm_ordinal_table[i].ordinal] == 0)) {
+		tpm_ordinal_index[tpm_ordinal_table[i].ordinal] = i + 1;
+	    }
+	}
+	tpm_ordinal_index_built = TRUE;
+    }
+    if ((ordinalTable == tpm_ordinal_table) && (ordinal < TPM_ORDINALS_MAX)) {
+	if (tpm_ordinal_index[ordinal] != 0) {
+	    *entry = &(ordinalTable[tpm_ordinal_index[ordinal] - 1]);
+	    rc = 0;
+	}
+    }
+    /* TSC ordinals are searched */
+    else {
+	for (i = 0 ; i < (sizeof(tpm_ordinal_table)/sizeof(TPM_ORDINAL_TABLE)) ; i++) {
+	    if (ordinalTable[i].ordinal == ordinal) {	/* if found */
+		*entry = &(ordinalTable[i]);		/* return the entry */
+		rc = 0;					/* return found */
+		break;
+	    }
 	}
     }
     return rc;
@@ -2219,6 +2252,32 @@ TPM_RESULT TPM_OrdinalTable_GetKeyPermission(uint16_t *keyPermissionBlock,
     return rc;
 }
 
+/* TPM_OrdinalTable_GetHandles() gets the number of key handles at the start of the input
+   parameters and the size of the input handle area, which is never encrypted by a transport
+   session.
+
+   keyHandles is 0xffffffff if the handle type is itself a parameter.
+
+   If the ordinal is not in the table, TPM_BAD_ORDINAL is returned.
+*/
+
+TPM_RESULT TPM_OrdinalTable_GetHandles(uint32_t *keyHandles,
+				       uint32_t *inputHandleSize,
+				       TPM_COMMAND_CODE ordinal)
+{
+    TPM_RESULT rc = 0;
+    TPM_ORDINAL_TABLE *entry;
+
+    if (rc == 0) {
+	rc = TPM_OrdinalTable_GetEntry(&entry, tpm_ordinal_table, ordinal);
+    }
+    if (rc == 0) {
+	*keyHandles = entry->keyHandles;
+	*inputHandleSize = entry->inputHandleSize;
+    }
+    return rc;
+}
+
 /* TPM_OrdinalTable_ParseWrappedCmd() parses a transport wrapped command, extracting
 
 	- index into DATAw
@@ -2420,14 +2479,15 @@ TPM_RESULT TPM_OrdinalTable_ParseWrappedRsp(uint32_t *datawStart,
     return rc;
 }
 
-void TPM_KeyHandleEntries_Trace(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries);
+void TPM_KeyHandleEntries_Trace(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries);
 
-void TPM_KeyHandleEntries_Trace(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
+void TPM_KeyHandleEntries_Trace(TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries)
 {
     size_t i;
-    for (i = 0 ; (i < 4) && (i < TPM_KEY_HANDLES) ; i++) {
+    for (i = 0 ; (i < 4) && (i < tpm_key_handle_entries->keyHandles) ; i++) {
 	printf("TPM_KeyHandleEntries_Trace: %lu handle %08x tpm_key %p\n",
-	       (unsigned long)i, tpm_key_handle_entries[i].handle, tpm_key_handle_entries[i].key);
+	       (unsigned long)i, tpm_key_handle_entries->entries[i].handle,
+	       tpm_key_handle_entries->entries[i].key);
     }
     return;
 }
@@ -2552,7 +2612,7 @@ TPM_RESULT TPM_Process(TPM_STORE_BUFFER *response,
     }
     /* NOTE Only for debugging */
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
-	TPM_KeyHandleEntries_Trace(targetInstance->tpm_key_handle_entries);
+	TPM_KeyHandleEntries_Trace(&(targetInstance->tpm_key_handle_entries));
     }
     /* process the ordinal */
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
@@ -2566,16 +2626,16 @@ TPM_RESULT TPM_Process(TPM_STORE_BUFFER *response,
     }
     /* NOTE Only for debugging */
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
-	TPM_KeyHandleEntries_Trace(targetInstance->tpm_key_handle_entries);
+	TPM_KeyHandleEntries_Trace(&(targetInstance->tpm_key_handle_entries));
     }
     /* NOTE Only for debugging */
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
 	TPM_State_Trace(targetInstance);
     }
 #ifdef TPM_VOLATILE_STORE
-    /* save the volatile state after each command to handle fail-over restart */
+    /* checkpoint the volatile state after each command to handle fail-over restart */
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
-	returnCode = TPM_VolatileAll_NVStore(targetInstance);
+	returnCode = TPM_VolatileAll_Checkpoint(targetInstance);
     }
 #endif	/* TPM_VOLATILE_STORE */
     /* If the ordinal processing function returned without a fatal error, append its ordinalResponse
@@ -3049,7 +3109,7 @@ TPM_RESULT TPM_Process_Preprocess(tpm_state_t *tpm_state,
 	    !((ordinal == TPM_ORD_ExecuteTransport) ||
 	      (ordinal == TPM_ORD_ReleaseTransportSigned))) {
 	    rc = TPM_TransportSessions_TerminateHandle
-		 (tpm_state->tpm_stclear_data.transSessions,
+		 (&(tpm_state->tpm_stclear_data.transSessions),
 		  tpm_state->tpm_stany_flags.transportExclusive,
 		  &(tpm_state->tpm_stany_flags.transportExclusive));
 	}
@@ -3264,6 +3324,7 @@ TPM_RESULT TPM_ProcessAudit(tpm_state_t *tpm_state,
 	if (isZero) {
 	    /* i. Increment TPM_PERMANENT_DATA -> auditMonotonicCounter by 1 */
 	    tpm_state->tpm_permanent_data.auditMonotonicCounter.counter++;
+	    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	    printf("  TPM_ProcessAudit: Incrementing auditMonotonicCounter to %u\n",
 		   tpm_state->tpm_permanent_data.auditMonotonicCounter.counter);
 	    rc = TPM_PermanentAll_NVStore(tpm_state,
@@ -3632,11 +3693,11 @@ TPM_RESULT TPM_GetCapabilityCommon(TPM_STORE_BUFFER *capabilityResponse,
 	/* This is command is available for backwards compatibility. It is the same as
 	   TPM_CAP_HANDLE with a resource type of keys. */
 	rc = TPM_KeyHandleEntries_StoreHandles(capabilityResponse,
-					       tpm_state->tpm_key_handle_entries);
+					       &(tpm_state->tpm_key_handle_entries));
 	break;
       case TPM_CAP_CHECK_LOADED: 
 	rc = TPM_GetCapability_CapCheckLoaded(capabilityResponse,
-					      tpm_state->tpm_key_handle_entries,
+					      &(tpm_state->tpm_key_handle_entries),
 					      subCap);
 	break;
       case TPM_CAP_SYM_MODE:
@@ -3651,7 +3712,7 @@ TPM_RESULT TPM_GetCapabilityCommon(TPM_STORE_BUFFER *capabilityResponse,
       case TPM_CAP_KEY_STATUS: 
 	if (subCap->size == sizeof(uint32_t)) {
 	    rc = TPM_GetCapability_CapKeyStatus(capabilityResponse,
-						tpm_state->tpm_key_handle_entries,
+						&(tpm_state->tpm_key_handle_entries),
 						subCap32);
 	}
 	else {
@@ -3862,7 +3923,6 @@ static TPM_RESULT TPM_GetCapability_CapProperty(TPM_STORE_BUFFER *capabilityResp
     TPM_RESULT	rc = 0;
     uint32_t 	uint32;
     uint32_t 	uint32a;
-    uint32_t 	dummy;	/* to hold unused response parameter */
 
     printf(" TPM_GetCapability_CapProperty: capProperty %08x\n", capProperty);
     switch (capProperty) {
@@ -3882,7 +3942,7 @@ static TPM_RESULT TPM_GetCapability_CapProperty(TPM_STORE_BUFFER *capabilityResp
 	break;
       case TPM_CAP_PROP_KEYS:	/* Returns the number of 2048-bit RSA keys that can be loaded. This
 				   MAY vary with time and circumstances. */
-	TPM_KeyHandleEntries_GetSpace(&uint32, tpm_state->tpm_key_handle_entries);
+	TPM_KeyHandleEntries_GetSpace(&uint32, &(tpm_state->tpm_key_handle_entries));
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_KEYS %u\n", uint32);
 	rc = TPM_Sbuffer_Append32(capabilityResponse, uint32);
 	break;
@@ -3894,13 +3954,13 @@ static TPM_RESULT TPM_GetCapability_CapProperty(TPM_STORE_BUFFER *capabilityResp
 	break;
       case TPM_CAP_PROP_AUTHSESS:	/* The number of available authorization sessions. This MAY
 					   vary with time and circumstances. */
-	TPM_AuthSessions_GetSpace(&uint32, tpm_state->tpm_stclear_data.authSessions);
+	TPM_AuthSessions_GetSpace(&uint32, &(tpm_state->tpm_stclear_data.authSessions));
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_AUTHSESS space %u\n", uint32);
 	rc = TPM_Sbuffer_Append32(capabilityResponse, uint32);
 	break;
       case TPM_CAP_PROP_TRANSESS:	/* The number of available transport sessions. This MAY vary
 					   with time and circumstances.	 */
-	TPM_TransportSessions_GetSpace(&uint32, tpm_state->tpm_stclear_data.transSessions);
+	TPM_TransportSessions_GetSpace(&uint32, &(tpm_state->tpm_stclear_data.transSessions));
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_TRANSESS space %u\n", uint32);
 	rc = TPM_Sbuffer_Append32(capabilityResponse, uint32);
 	break;
@@ -3913,14 +3973,15 @@ static TPM_RESULT TPM_GetCapability_CapProperty(TPM_STORE_BUFFER *capabilityResp
       case TPM_CAP_PROP_MAX_AUTHSESS:	/* The maximum number of loaded authorization sessions the
 					   TPM supports. */
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_MAX_AUTHSESS %u\n",
-	       TPM_MIN_AUTH_SESSIONS);
-	rc = TPM_Sbuffer_Append32(capabilityResponse, TPM_MIN_AUTH_SESSIONS);
+	       tpm_state->tpm_stclear_data.authSessions.slots);
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_state->tpm_stclear_data.authSessions.slots);
 	break;
       case TPM_CAP_PROP_MAX_TRANSESS:	/* The maximum number of loaded transport sessions the TPM
 					   supports. */
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_MAX_TRANSESS %u\n",
-	       TPM_MIN_TRANS_SESSIONS);
-	rc = TPM_Sbuffer_Append32(capabilityResponse, TPM_MIN_TRANS_SESSIONS);
+	       tpm_state->tpm_stclear_data.transSessions.slots);
+	rc = TPM_Sbuffer_Append32(capabilityResponse,
+				  tpm_state->tpm_stclear_data.transSessions.slots);
 	break;
       case TPM_CAP_PROP_MAX_COUNTERS:	/* The maximum number of monotonic counters under control of
 					   TPM_CreateCounter */
@@ -3930,8 +3991,9 @@ static TPM_RESULT TPM_GetCapability_CapProperty(TPM_STORE_BUFFER *capabilityResp
 	break;
       case TPM_CAP_PROP_MAX_KEYS:	/* The maximum number of 2048 RSA keys that the TPM can
 					   support. The number does not include the EK or SRK. */
-	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_MAX_KEYS %u\n", TPM_KEY_HANDLES);
-	rc = TPM_Sbuffer_Append32(capabilityResponse, TPM_KEY_HANDLES);
+	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_MAX_KEYS %u\n",
+	       tpm_state->tpm_key_handle_entries.keyHandles);
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_state->tpm_key_handle_entries.keyHandles);
 	break;
       case TPM_CAP_PROP_OWNER:	/* A value of TRUE indicates that the TPM has successfully installed
 				   an owner. */
@@ -3942,19 +4004,21 @@ static TPM_RESULT TPM_GetCapability_CapProperty(TPM_STORE_BUFFER *capabilityResp
 	break;
       case TPM_CAP_PROP_CONTEXT:	/* The number of available saved session slots. This MAY
 					   vary with time and circumstances. */
-	TPM_ContextList_GetSpace(&uint32, &dummy, tpm_state->tpm_stclear_data.contextList);
+	TPM_ContextList_GetSpace(&uint32, NULL, &(tpm_state->tpm_stclear_data.contextList));
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_CONTEXT %u\n", uint32);
 	rc = TPM_Sbuffer_Append32(capabilityResponse, uint32);
 	break;
       case TPM_CAP_PROP_MAX_CONTEXT:	/* The maximum number of saved session slots. */
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_MAX_CONTEXT %u\n",
-	       TPM_MIN_SESSION_LIST);
-	rc = TPM_Sbuffer_Append32(capabilityResponse, TPM_MIN_SESSION_LIST);
+	       tpm_state->tpm_stclear_data.contextList.slots);
+	rc = TPM_Sbuffer_Append32(capabilityResponse,
+				  tpm_state->tpm_stclear_data.contextList.slots);
 	break;
       case TPM_CAP_PROP_FAMILYROWS:	/* The number of rows in the family table */
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_FAMILYROWS %u\n",
-	       TPM_NUM_FAMILY_TABLE_ENTRY_MIN);
-	rc = TPM_Sbuffer_Append32(capabilityResponse, TPM_NUM_FAMILY_TABLE_ENTRY_MIN);
+	       tpm_state->tpm_permanent_data.familyTable.rows);
+	rc = TPM_Sbuffer_Append32(capabilityResponse,
+				  tpm_state->tpm_permanent_data.familyTable.rows);
 	break;
       case TPM_CAP_PROP_TIS_TIMEOUT:
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_TIS_TIMEOUT\n");
@@ -3967,8 +4031,9 @@ static TPM_RESULT TPM_GetCapability_CapProperty(TPM_STORE_BUFFER *capabilityResp
 	break;
       case TPM_CAP_PROP_DELEGATE_ROW:	/* The size of the delegate table in rows. */
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_DELEGATE_ENTRIES %u\n",
-	       TPM_NUM_DELEGATE_TABLE_ENTRY_MIN);
-	rc = TPM_Sbuffer_Append32(capabilityResponse, TPM_NUM_DELEGATE_TABLE_ENTRY_MIN);
+	       tpm_state->tpm_permanent_data.delegateTable.rows);
+	rc = TPM_Sbuffer_Append32(capabilityResponse,
+				  tpm_state->tpm_permanent_data.delegateTable.rows);
 	break;
       case TPM_CAP_PROP_MAX_DAASESS:	/* The maximum number of loaded DAA sessions (join or sign)
 					   that the TPM supports */
@@ -3999,8 +4064,8 @@ static TPM_RESULT TPM_GetCapability_CapProperty(TPM_STORE_BUFFER *capabilityResp
       case TPM_CAP_PROP_SESSIONS: /* UNIT32. The number of available authorization and transport
 				     sessions from the pool. This may vary with time and
 				     circumstances. */
-	TPM_AuthSessions_GetSpace(&uint32, tpm_state->tpm_stclear_data.authSessions);
-	TPM_TransportSessions_GetSpace(&uint32a, tpm_state->tpm_stclear_data.transSessions);
+	TPM_AuthSessions_GetSpace(&uint32, &(tpm_state->tpm_stclear_data.authSessions));
+	TPM_TransportSessions_GetSpace(&uint32a, &(tpm_state->tpm_stclear_data.transSessions));
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_SESSIONS %u + %u\n", uint32, uint32a);
 	rc = TPM_Sbuffer_Append32(capabilityResponse, uint32 + uint32a);
 	break;
@@ -4008,7 +4073,8 @@ static TPM_RESULT TPM_GetCapability_CapProperty(TPM_STORE_BUFFER *capabilityResp
 					 TPM supports. */
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_MAX_SESSIONS\n");
 	rc = TPM_Sbuffer_Append32(capabilityResponse,
-				  TPM_MIN_AUTH_SESSIONS + TPM_MIN_TRANS_SESSIONS);
+				  tpm_state->tpm_stclear_data.authSessions.slots +
+				  tpm_state->tpm_stclear_data.transSessions.slots);
 	break;
       case TPM_CAP_PROP_CMK_RESTRICTION: /* uint32_t TPM_Permanent_Data -> restrictDelegate */
 	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_CMK_RESTRICTION %08x\n",
@@ -4098,7 +4164,7 @@ static TPM_RESULT TPM_GetCapability_CapVersion(TPM_STORE_BUFFER *capabilityRespo
 */
 
 static TPM_RESULT TPM_GetCapability_CapCheckLoaded(TPM_STORE_BUFFER *capabilityResponse,
-						   const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry,
+						   const TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
 						   TPM_SIZED_BUFFER *subCap)
 {
     TPM_RESULT		rc = 0;
@@ -4117,7 +4183,7 @@ static TPM_RESULT TPM_GetCapability_CapCheckLoaded(TPM_STORE_BUFFER *capabilityR
     }
     if (rc == 0) {
 	if (keyParms.algorithmID == TPM_ALG_RSA) {
-	    TPM_KeyHandleEntries_IsSpace(&isSpace, &index, tpm_key_handle_entry);
+	    TPM_KeyHandleEntries_IsSpace(&isSpace, &index, tpm_key_handle_entries);
 	}
 	else {
 	    printf(" TPM_GetCapability_CapCheckLoaded: algorithmID %08x is not TPM_ALG_RSA %08x\n",
@@ -4152,7 +4218,7 @@ static TPM_RESULT TPM_GetCapability_CapSymMode(TPM_STORE_BUFFER *capabilityRespo
  */
 
 static TPM_RESULT TPM_GetCapability_CapKeyStatus(TPM_STORE_BUFFER *capabilityResponse,
-						 TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+						 TPM_KEY_HANDLE_ENTRIES *tpm_key_handle_entries,
 						 uint32_t tpm_key_handle)
 {
     TPM_RESULT			rc = 0;
@@ -4220,6 +4286,33 @@ static TPM_RESULT TPM_GetCapability_CapMfr(TPM_STORE_BUFFER *capabilityResponse,
 	    }
 	    break;
 #endif
+	  case TPM_CAP_NV_METRICS:
+	    if (subCap->size == sizeof(uint32_t)) {
+		rc = TPM_GetCapability_CapNVMetrics(capabilityResponse);
+	    }
+	    else {
+		printf("TPM_GetCapability_CapMfr: Error, Bad subCap size %u\n", subCap->size);
+		rc = TPM_BAD_MODE;
+	    }
+	    break;
+	  case TPM_CAP_AUTH_METRICS:
+	    if (subCap->size == sizeof(uint32_t)) {
+		rc = TPM_GetCapability_CapAuthMetrics(capabilityResponse, tpm_state);
+	    }
+	    else {
+		printf("TPM_GetCapability_CapMfr: Error, Bad subCap size %u\n", subCap->size);
+		rc = TPM_BAD_MODE;
+	    }
+	    break;
+	  case TPM_CAP_CONTEXT_METRICS:
+	    if (subCap->size == sizeof(uint32_t)) {
+		rc = TPM_GetCapability_CapContextMetrics(capabilityResponse, tpm_state);
+	    }
+	    else {
+		printf("TPM_GetCapability_CapMfr: Error, Bad subCap size %u\n", subCap->size);
+		rc = TPM_BAD_MODE;
+	    }
+	    break;
 	  default:
 	    capabilityResponse = capabilityResponse;	/* not used */
 	    tpm_state = tpm_state;			/* not used */
@@ -4231,6 +4324,122 @@ static TPM_RESULT TPM_GetCapability_CapMfr(TPM_STORE_BUFFER *capabilityResponse,
     return rc;
 }
 
+/* TPM_GetCapability_CapNVMetrics() returns the NV write statistics
+
+   writes, bytes, syncs, last write usec, maximum write usec, average write usec
+*/
+
+static TPM_RESULT TPM_GetCapability_CapNVMetrics(TPM_STORE_BUFFER *capabilityResponse)
+{
+    TPM_RESULT		rc = 0;
+    TPM_NVRAM_METRICS	tpm_nvram_metrics;
+    uint32_t		averageUsec = 0;
+
+    TPM_NVRAM_GetMetrics(&tpm_nvram_metrics);
+    if (tpm_nvram_metrics.writes != 0) {
+	averageUsec = (uint32_t)(tpm_nvram_metrics.totalUsec / tpm_nvram_metrics.writes);
+    }
+    printf(" TPM_GetCapability_CapNVMetrics: writes %u average %u usec\n",
+	   tpm_nvram_metrics.writes, averageUsec);
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_nvram_metrics.writes);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_nvram_metrics.bytes);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_nvram_metrics.syncs);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_nvram_metrics.lastUsec);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_nvram_metrics.maxUsec);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, averageUsec);
+    }
+    return rc;
+}
+
+/* TPM_GetCapability_CapAuthMetrics() returns the authorization session table statistics
+
+   slots, active sessions, created, terminated, expired, evicted, exhausted, peak active
+*/
+
+static TPM_RESULT TPM_GetCapability_CapAuthMetrics(TPM_STORE_BUFFER *capabilityResponse,
+						   tpm_state_t *tpm_state)
+{
+    TPM_RESULT			rc = 0;
+    TPM_AUTH_SESSION_METRICS	tpm_auth_session_metrics;
+    uint32_t			space;
+    uint32_t			slots;
+
+    TPM_AuthSessions_GetMetrics(&tpm_auth_session_metrics);
+    TPM_AuthSessions_GetSpace(&space, &(tpm_state->tpm_stclear_data.authSessions));
+    slots = tpm_state->tpm_stclear_data.authSessions.slots;
+    printf(" TPM_GetCapability_CapAuthMetrics: slots %u active %u created %u\n",
+	   slots, slots - space, tpm_auth_session_metrics.created);
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, slots);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, slots - space);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_auth_session_metrics.created);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_auth_session_metrics.terminated);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_auth_session_metrics.expired);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_auth_session_metrics.evicted);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_auth_session_metrics.exhausted);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_auth_session_metrics.peak);
+    }
+    return rc;
+}
+
+/* TPM_GetCapability_CapContextMetrics() returns the saved session context list statistics
+
+   slots, outstanding contexts, peak outstanding, saves refused for lack of space
+*/
+
+static TPM_RESULT TPM_GetCapability_CapContextMetrics(TPM_STORE_BUFFER *capabilityResponse,
+						      tpm_state_t *tpm_state)
+{
+    TPM_RESULT			rc = 0;
+    TPM_CONTEXT_LIST_METRICS	tpm_context_list_metrics;
+    uint32_t			space;
+    uint32_t			slots;
+
+    TPM_ContextList_GetMetrics(&tpm_context_list_metrics);
+    TPM_ContextList_GetSpace(&space, NULL, &(tpm_state->tpm_stclear_data.contextList));
+    slots = tpm_state->tpm_stclear_data.contextList.slots;
+    printf(" TPM_GetCapability_CapContextMetrics: slots %u outstanding %u peak %u\n",
+	   slots, slots - space, tpm_context_list_metrics.peak);
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, slots);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, slots - space);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_context_list_metrics.peak);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(capabilityResponse, tpm_context_list_metrics.exhausted);
+    }
+    return rc;
+}
+
 /* Returns a TPM_NV_DATA_PUBLIC structure that indicates the values for the TPM_NV_INDEX
 */
 
@@ -4301,22 +4510,22 @@ static TPM_RESULT TPM_GetCapability_CapHandle(TPM_STORE_BUFFER *capabilityRespon
       case TPM_RT_KEY:
 	printf("  TPM_GetCapability_CapHandle: TPM_RT_KEY\n");
 	rc = TPM_KeyHandleEntries_StoreHandles(capabilityResponse,
-					       tpm_state->tpm_key_handle_entries);
+					       &(tpm_state->tpm_key_handle_entries));
 	break;
       case TPM_RT_AUTH:
 	printf("  TPM_GetCapability_CapHandle: TPM_RT_AUTH\n");
 	rc = TPM_AuthSessions_StoreHandles(capabilityResponse,
-					   tpm_state->tpm_stclear_data.authSessions);
+					   &(tpm_state->tpm_stclear_data.authSessions));
 	break;
       case TPM_RT_TRANS:
 	printf("  TPM_GetCapability_CapHandle: TPM_RT_TRANS\n");
 	rc = TPM_TransportSessions_StoreHandles(capabilityResponse,
-						tpm_state->tpm_stclear_data.transSessions);
+						&(tpm_state->tpm_stclear_data.transSessions));
 	break;
       case TPM_RT_CONTEXT:
 	printf("  TPM_GetCapability_CapHandle: TPM_RT_CONTEXT\n");
 	rc = TPM_ContextList_StoreHandles(capabilityResponse,
-					  tpm_state->tpm_stclear_data.contextList);
+					  &(tpm_state->tpm_stclear_data.contextList));
 	break;
       case TPM_RT_COUNTER:
 	printf("  TPM_GetCapability_CapHandle: TPM_RT_COUNTER\n");
@@ -4792,7 +5001,7 @@ TPM_RESULT TPM_Process_GetCapabilityOwner(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -5100,7 +5309,7 @@ TPM_RESULT TPM_Process_GetCapabilitySigned(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -5320,7 +5529,7 @@ TPM_RESULT TPM_Process_SetCapability(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -5711,6 +5920,8 @@ static TPM_RESULT TPM_SetCapability_CapPermFlags(tpm_state_t *tpm_state,
 	    rc = TPM_BAD_PARAMETER;
 	}
     }
+    /* all the settable subcapabilities are TPM_PERMANENT_FLAGS */
+    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_FLAGS);
     rc = TPM_PermanentAll_NVStore(tpm_state,
 				  altered,
 				  rc);
@@ -5761,6 +5972,7 @@ static TPM_RESULT TPM_SetCapability_CapPermData(tpm_state_t *tpm_state,
 		if (tpm_state->tpm_permanent_data.restrictDelegate != valueUint32) {
 		    tpm_state->tpm_permanent_data.restrictDelegate = valueUint32;
 		    writeAllNV = TRUE;
+		    TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 		}
 	    }
 	    break;
@@ -5769,6 +5981,7 @@ static TPM_RESULT TPM_SetCapability_CapPermData(tpm_state_t *tpm_state,
 	       new daaProof, tpmDAASeed, and daaBlobKey are generated. */
 		rc = TPM_PermanentData_InitDaa(&(tpm_state->tpm_permanent_data));
 		writeAllNV = TRUE;
+		TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_DATA);
 	    break;
 	  case TPM_PD_REVMAJOR:
 	  case TPM_PD_REVMINOR:
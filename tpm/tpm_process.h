@@ -241,6 +241,9 @@ TPM_RESULT TPM_OrdinalTable_GetOwnerPermission(uint16_t *ownerPermissionBlock,
 TPM_RESULT TPM_OrdinalTable_GetKeyPermission(uint16_t *keyPermissionBlock,
                                              uint32_t *keyPermissionPosition,
                                              TPM_COMMAND_CODE ordinal);
+TPM_RESULT TPM_OrdinalTable_GetHandles(uint32_t *keyHandles,
+                                       uint32_t *inputHandleSize,
+                                       TPM_COMMAND_CODE ordinal);
 TPM_RESULT TPM_OrdinalTable_ParseWrappedCmd(uint32_t *datawStart,
                                             uint32_t *datawLen,
                                             uint32_t *keyHandles,
@@ -0,0 +1,1497 @@
+/********************************************************************************/
+/*                                                                              */
+/*                              Resource Manager                                */
+/*                                                                              */
+/* (c) Copyright IBM Corporation 2006, 2010.					*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tpm_constants.h"
+#include "tpm_debug.h"
+#include "tpm_error.h"
+#include "tpm_global.h"
+#include "tpm_key.h"
+#include "tpm_load.h"
+#include "tpm_process.h"
+#include "tpm_session.h"
+#include "tpm_sizedbuffer.h"
+#include "tpm_store.h"
+#include "tpm_transport.h"
+
+#include "tpm_resource.h"
+
+/* Virtual handle ranges.  Virtual key handles are in the reserved key handle range, so that they
+   never collide with a key handle generated by the TPM.  The TPM session handles are never seen by
+   a client, so any range will do. */
+
+#define TPM_RESOURCE_KEY_BASE		0x40800000
+#define TPM_RESOURCE_AUTH_BASE		0x02000000
+#define TPM_RESOURCE_TRANS_BASE		0x03000000
+#define TPM_RESOURCE_HANDLE_MASK	0x007fffff
+
+/* tag, paramSize, and ordinal or returnCode */
+#define TPM_RESOURCE_HEADER_SIZE	(sizeof(TPM_TAG) + sizeof(uint32_t) + sizeof(uint32_t))
+/* authHandle, nonceOdd, continueAuthSession, auth */
+#define TPM_RESOURCE_AUTH_SIZE		(sizeof(TPM_AUTHHANDLE) + TPM_NONCE_SIZE + \
+					 sizeof(TPM_BOOL) + TPM_AUTHDATA_SIZE)
+/* TPM_ExecuteTransport response currentTicks, locality, wrappedRspSize before wrappedRsp */
+#define TPM_RESOURCE_WRAPPED_RSP	(TPM_RESOURCE_HEADER_SIZE + 8 + \
+					 sizeof(TPM_MODIFIER_INDICATOR) + sizeof(uint32_t))
+/* TPM_CONTEXT_BLOB tag, resourceType, handle, label before contextCount */
+#define TPM_RESOURCE_CONTEXT_COUNT	(sizeof(TPM_STRUCTURE_TAG) + sizeof(TPM_RESOURCE_TYPE) + \
+					 sizeof(TPM_HANDLE) + 16)
+
+/* The handle mapping of one client command.  A command wrapped by TPM_ExecuteTransport has a
+   second one. */
+
+typedef struct tdTPM_RESOURCE_COMMAND {
+    TPM_COMMAND_CODE	ordinal;
+    TPM_RESOURCE_TYPE	created;	/* type of the handle the command returns, 0 for none */
+    TPM_HANDLE		entityHandle;	/* OSAP, DSAP, or TPM_LoadContext entity as sent */
+    TPM_BOOL		entityIsKey;
+    TPM_RESOURCE_ENTRY	*released;	/* swapped out object flushed by the client */
+    TPM_RESOURCE_TYPE	capability;	/* handle list requested by TPM_GetCapability, or 0 */
+} TPM_RESOURCE_COMMAND;
+
+/* local prototypes */
+
+static void       TPM_Resource_Entry_Init(TPM_RESOURCE_ENTRY *tpm_resource_entry);
+static void       TPM_Resource_Entry_Delete(TPM_RESOURCE_ENTRY *tpm_resource_entry);
+static TPM_RESULT TPM_Resource_GetEntry(TPM_RESOURCE_ENTRY **tpm_resource_entry,
+					uint32_t connectionId,
+					TPM_HANDLE virtualHandle);
+static TPM_RESULT TPM_Resource_AddEntry(TPM_RESOURCE_ENTRY **tpm_resource_entry,
+					uint32_t connectionId,
+					TPM_RESOURCE_TYPE resourceType,
+					TPM_HANDLE physicalHandle);
+static void       TPM_Resource_Release(TPM_RESOURCE_ENTRY *tpm_resource_entry);
+static void       TPM_Resource_Count(uint32_t *count,
+				     uint32_t connectionId,
+				     TPM_RESOURCE_TYPE resourceType);
+static TPM_RESULT TPM_Resource_CheckQuota(uint32_t connectionId,
+					  TPM_RESOURCE_TYPE resourceType);
+static void       TPM_Resource_Reconcile(void);
+static void       TPM_Resource_IsLoaded(TPM_BOOL *isLoaded,
+					TPM_RESOURCE_TYPE resourceType,
+					TPM_HANDLE physicalHandle);
+static TPM_BOOL   TPM_Resource_IsSharedKey(TPM_HANDLE keyHandle);
+static void       TPM_Resource_IsSpace(TPM_BOOL *isSpace,
+				       TPM_RESOURCE_TYPE resourceType);
+static void       TPM_Resource_MakeSpace(TPM_RESOURCE_TYPE resourceType);
+static TPM_RESULT TPM_Resource_SwapIn(TPM_RESOURCE_ENTRY *tpm_resource_entry);
+static TPM_RESULT TPM_Resource_SwapOut(TPM_RESOURCE_ENTRY *tpm_resource_entry);
+static TPM_RESULT TPM_Resource_SwapOutBound(TPM_RESOURCE_ENTRY *tpm_resource_entry);
+
+static void       TPM_Resource_Command_Init(TPM_RESOURCE_COMMAND *tpm_resource_command);
+static void       TPM_Resource_MapCommand(TPM_RESOURCE_COMMAND *tpm_resource_command,
+					  uint32_t connectionId,
+					  unsigned char *command,
+					  uint32_t command_size,
+					  TPM_BOOL wrapped);
+static void       TPM_Resource_MapKey(uint32_t connectionId,
+				      unsigned char *command,
+				      uint32_t offset);
+static void       TPM_Resource_MapSession(uint32_t connectionId,
+					  unsigned char *command,
+					  uint32_t offset);
+static void       TPM_Resource_MapTyped(TPM_RESOURCE_COMMAND *tpm_resource_command,
+					uint32_t connectionId,
+					unsigned char *command,
+					uint32_t offset,
+					uint32_t typeOffset,
+					uint32_t limit);
+static TPM_RESULT TPM_Resource_MapResponse(TPM_RESOURCE_COMMAND *tpm_resource_command,
+					   uint32_t connectionId,
+					   unsigned char *response,
+					   uint32_t response_size);
+static TPM_RESULT TPM_Resource_GetCapability(uint32_t connectionId,
+					     TPM_RESOURCE_TYPE resourceType,
+					     unsigned char **response,
+					     uint32_t *response_size,
+					     uint32_t *response_total);
+static TPM_RESULT TPM_Resource_SetResponse(unsigned char **response,
+					   uint32_t *response_size,
+					   uint32_t *response_total,
+					   TPM_RESULT returnCode);
+
+static TPM_RESULT TPM_Resource_StartCommand(TPM_COMMAND_CODE ordinal);
+static TPM_RESULT TPM_Resource_Execute(void);
+static TPM_RESULT TPM_Resource_FlushSpecific(TPM_HANDLE handle,
+					     TPM_RESOURCE_TYPE resourceType);
+static TPM_RESULT TPM_Resource_SaveContext(TPM_RESOURCE_ENTRY *tpm_resource_entry);
+static TPM_RESULT TPM_Resource_LoadContext(TPM_HANDLE *physicalHandle,
+					   TPM_HANDLE entityHandle,
+					   TPM_SIZED_BUFFER *context);
+
+/* the virtual objects of all connections */
+static TPM_RESOURCE_ENTRY tpm_resource_entries[TPM_RESOURCE_OBJECTS];
+static uint32_t tpm_resource_connection_next = 0;
+static uint32_t tpm_resource_handle_next = 0;
+/* the objects of each type that one connection may hold, 0 for no limit */
+static uint32_t tpm_resource_quota_keys = 0;
+static uint32_t tpm_resource_quota_auth = 0;
+static uint32_t tpm_resource_quota_trans = 0;
+/* incremented for each client command.  Objects that the current command references have lastUsed
+   equal to the clock, and are not swapped out. */
+static uint32_t tpm_resource_clock = 0;
+/* the commands that the resource manager sends to the TPM itself */
+static TPM_STORE_BUFFER tpm_resource_command;
+static unsigned char *tpm_resource_rbuffer = NULL;
+static uint32_t tpm_resource_rlength = 0;
+static uint32_t tpm_resource_rtotal = 0;
+
+/*
+  Connections
+*/
+
+/* TPM_Resource_Init() empties the virtual object table.  It is called once, before the first
+   connection.
+*/
+
+void TPM_Resource_Init(void)
+{
+    size_t i;
+
+    printf(" TPM_Resource_Init: %u virtual objects\n", TPM_RESOURCE_OBJECTS);
+    for (i = 0 ; i < TPM_RESOURCE_OBJECTS ; i++) {
+	TPM_Resource_Entry_Init(&(tpm_resource_entries[i]));
+    }
+    TPM_Sbuffer_Init(&tpm_resource_command);
+    return;
+}
+
+/* TPM_Resource_SetQuotas() sets the number of keys, authorization sessions, and transport
+   sessions that one connection may hold.  0 is no limit.
+
+   A command that would create an object beyond the quota fails with TPM_RESOURCES, as if the TPM
+   were full.
+*/
+
+void TPM_Resource_SetQuotas(uint32_t keys,
+			    uint32_t authSessions,
+			    uint32_t transSessions)
+{
+    printf(" TPM_Resource_SetQuotas: %u keys, %u auth sessions, %u transport sessions\n",
+	   keys, authSessions, transSessions);
+    tpm_resource_quota_keys = keys;
+    tpm_resource_quota_auth = authSessions;
+    tpm_resource_quota_trans = transSessions;
+    return;
+}
+
+/* TPM_Resource_Connect() returns the identifier of a new client connection */
+
+TPM_RESULT TPM_Resource_Connect(uint32_t *connectionId)
+{
+    tpm_resource_connection_next++;
+    if (tpm_resource_connection_next == 0) {	/* 0 marks a free entry */
+	tpm_resource_connection_next++;
+    }
+    *connectionId = tpm_resource_connection_next;
+    printf(" TPM_Resource_Connect: Connection %u\n", *connectionId);
+    return 0;
+}
+
+/* TPM_Resource_Disconnect() flushes all objects of the connection, whether loaded in the TPM or
+   swapped out.
+
+   Sessions are flushed before keys, so that flushing a key does not first save a session of the
+   same connection.  Owner evict keys remain loaded.
+*/
+
+void TPM_Resource_Disconnect(uint32_t connectionId)
+{
+    size_t	i;
+    uint32_t	keys;
+    uint32_t	authSessions;
+    uint32_t	transSessions;
+
+    TPM_Resource_Count(&keys, connectionId, TPM_RT_KEY);
+    TPM_Resource_Count(&authSessions, connectionId, TPM_RT_AUTH);
+    TPM_Resource_Count(&transSessions, connectionId, TPM_RT_TRANS);
+    printf(" TPM_Resource_Disconnect: Connection %u, "
+	   "flushing %u keys, %u auth sessions, %u transport sessions\n",
+	   connectionId, keys, authSessions, transSessions);
+    tpm_resource_clock++;
+    for (i = 0 ; i < TPM_RESOURCE_OBJECTS ; i++) {
+	if ((tpm_resource_entries[i].connectionId == connectionId) &&
+	    (tpm_resource_entries[i].resourceType != TPM_RT_KEY)) {
+	    TPM_Resource_Release(&(tpm_resource_entries[i]));
+	}
+    }
+    for (i = 0 ; i < TPM_RESOURCE_OBJECTS ; i++) {
+	if (tpm_resource_entries[i].connectionId == connectionId) {
+	    TPM_Resource_Release(&(tpm_resource_entries[i]));
+	}
+    }
+    return;
+}
+
+/* TPM_Resource_Process() processes a client command on behalf of connection 'connectionId'.
+
+   The virtual handles in the command are mapped to TPM handles, swapping objects in as needed, and
+   a handle returned by the TPM is mapped to a new virtual handle.  The command is processed by
+   TPM_ProcessA(), and the return code has the same meaning.
+*/
+
+TPM_RESULT TPM_Resource_Process(uint32_t connectionId,
+				unsigned char **response,
+				uint32_t *response_size,
+				uint32_t *response_total,
+				unsigned char *command,
+				uint32_t command_size)
+{
+    TPM_RESULT			rc = 0;
+    TPM_RESULT			returnCode = TPM_SUCCESS;	/* resource manager error */
+    TPM_RESOURCE_COMMAND	outer;
+    TPM_RESOURCE_COMMAND	inner;		/* command wrapped by TPM_ExecuteTransport */
+    TPM_BOOL			wrapped = FALSE;
+    uint32_t			wrappedSize;
+
+    printf(" TPM_Resource_Process: Connection %u\n", connectionId);
+    tpm_resource_clock++;
+    TPM_Resource_Command_Init(&outer);
+    TPM_Resource_Command_Init(&inner);
+    /* map the virtual handles in the command, loading objects that were swapped out */
+    TPM_Resource_MapCommand(&outer, connectionId, command, command_size, FALSE);
+    if ((outer.ordinal == TPM_ORD_ExecuteTransport) &&
+	(command_size >= (TPM_RESOURCE_HEADER_SIZE + sizeof(uint32_t)))) {
+	wrappedSize = LOAD32(command, TPM_RESOURCE_HEADER_SIZE);
+	if (wrappedSize <= (command_size - (TPM_RESOURCE_HEADER_SIZE + sizeof(uint32_t)))) {
+	    wrapped = TRUE;
+	    TPM_Resource_MapCommand(&inner, connectionId,
+				    command + TPM_RESOURCE_HEADER_SIZE + sizeof(uint32_t),
+				    wrappedSize, TRUE);
+	}
+    }
+    /* the connection may not hold more than its quota of the returned handle type */
+    if (outer.created != 0) {
+	returnCode = TPM_Resource_CheckQuota(connectionId, outer.created);
+    }
+    if ((returnCode == TPM_SUCCESS) && (inner.created != 0)) {
+	returnCode = TPM_Resource_CheckQuota(connectionId, inner.created);
+    }
+    /* make room for the handle that the command returns */
+    if ((returnCode == TPM_SUCCESS) && (outer.created != 0)) {
+	TPM_Resource_MakeSpace(outer.created);
+    }
+    if ((returnCode == TPM_SUCCESS) && (inner.created != 0)) {
+	TPM_Resource_MakeSpace(inner.created);
+    }
+    /* over quota, the command is not processed */
+    if (returnCode != TPM_SUCCESS) {
+	rc = TPM_Resource_SetResponse(response, response_size, response_total, returnCode);
+    }
+    /* flushing a swapped out object just discards its context */
+    else if (outer.released != NULL) {
+	TPM_Resource_Release(outer.released);
+	rc = TPM_Resource_SetResponse(response, response_size, response_total, TPM_SUCCESS);
+    }
+    else {
+	if (rc == 0) {
+	    rc = TPM_ProcessA(response, response_size, response_total, command, command_size);
+	}
+	/* forget objects that the command flushed or invalidated */
+	if (rc == 0) {
+	    TPM_Resource_Reconcile();
+	}
+	/* map a returned handle to a new virtual handle */
+	if (rc == 0) {
+	    returnCode = TPM_Resource_MapResponse(&outer, connectionId, *response, *response_size);
+	}
+	if ((rc == 0) && (returnCode == TPM_SUCCESS) && wrapped &&
+	    (*response_size >= TPM_RESOURCE_WRAPPED_RSP) &&
+	    (LOAD32(*response, sizeof(TPM_TAG) + sizeof(uint32_t)) == TPM_SUCCESS)) {
+	    wrappedSize = LOAD32(*response, TPM_RESOURCE_WRAPPED_RSP - sizeof(uint32_t));
+	    if (wrappedSize <= (*response_size - TPM_RESOURCE_WRAPPED_RSP)) {
+		returnCode = TPM_Resource_MapResponse(&inner, connectionId,
+						      *response + TPM_RESOURCE_WRAPPED_RSP,
+						      wrappedSize);
+	    }
+	}
+	/* a handle list shows the connection's own virtual handles */
+	if ((rc == 0) && (returnCode == TPM_SUCCESS) && (outer.capability != 0)) {
+	    returnCode = TPM_Resource_GetCapability(connectionId, outer.capability,
+						    response, response_size, response_total);
+	}
+	if ((rc == 0) && (returnCode != TPM_SUCCESS)) {
+	    rc = TPM_Resource_SetResponse(response, response_size, response_total, returnCode);
+	}
+    }
+    return rc;
+}
+
+/*
+  Virtual Objects
+*/
+
+static void TPM_Resource_Entry_Init(TPM_RESOURCE_ENTRY *tpm_resource_entry)
+{
+    tpm_resource_entry->connectionId = 0;
+    tpm_resource_entry->resourceType = 0;
+    tpm_resource_entry->virtualHandle = 0;
+    tpm_resource_entry->physicalHandle = 0;
+    tpm_resource_entry->entityHandle = 0;
+    tpm_resource_entry->entityIsKey = FALSE;
+    TPM_SizedBuffer_Init(&(tpm_resource_entry->context));
+    tpm_resource_entry->lastUsed = 0;
+    return;
+}
+
+static void TPM_Resource_Entry_Delete(TPM_RESOURCE_ENTRY *tpm_resource_entry)
+{
+    TPM_SizedBuffer_Delete(&(tpm_resource_entry->context));
+    TPM_Resource_Entry_Init(tpm_resource_entry);
+    return;
+}
+
+/* TPM_Resource_GetEntry() gets the object of the connection with the virtual handle.
+
+   If 'connectionId' is 0, all connections are searched.
+
+   Returns TPM_BAD_HANDLE if not found.
+*/
+
+static TPM_RESULT TPM_Resource_GetEntry(TPM_RESOURCE_ENTRY **tpm_resource_entry,
+					uint32_t connectionId,
+					TPM_HANDLE virtualHandle)
+{
+    TPM_RESULT	rc = TPM_BAD_HANDLE;
+    size_t	i;
+
+    *tpm_resource_entry = NULL;
+    for (i = 0 ; i < TPM_RESOURCE_OBJECTS ; i++) {
+	if ((tpm_resource_entries[i].connectionId != 0) &&
+	    (tpm_resource_entries[i].virtualHandle == virtualHandle) &&
+	    ((connectionId == 0) || (tpm_resource_entries[i].connectionId == connectionId))) {
+	    *tpm_resource_entry = &(tpm_resource_entries[i]);
+	    rc = 0;
+	    break;
+	}
+    }
+    return rc;
+}
+
+/* TPM_Resource_AddEntry() assigns a new virtual handle to the object loaded at 'physicalHandle'.
+
+   Returns TPM_RESOURCES if the table is full.
+*/
+
+static TPM_RESULT TPM_Resource_AddEntry(TPM_RESOURCE_ENTRY **tpm_resource_entry,
+					uint32_t connectionId,
+					TPM_RESOURCE_TYPE resourceType,
+					TPM_HANDLE physicalHandle)
+{
+    TPM_RESULT		rc = 0;
+    TPM_RESOURCE_ENTRY	*collision;
+    TPM_HANDLE		base;
+    size_t		i;
+
+    *tpm_resource_entry = NULL;
+    for (i = 0 ; i < TPM_RESOURCE_OBJECTS ; i++) {
+	if (tpm_resource_entries[i].connectionId == 0) {
+	    *tpm_resource_entry = &(tpm_resource_entries[i]);
+	    break;
+	}
+    }
+    if (*tpm_resource_entry == NULL) {
+	printf("TPM_Resource_AddEntry: Error, no space for %u virtual objects\n",
+	       TPM_RESOURCE_OBJECTS);
+	rc = TPM_RESOURCES;
+    }
+    if (rc == 0) {
+	switch (resourceType) {
+	  case TPM_RT_KEY:
+	    base = TPM_RESOURCE_KEY_BASE;
+	    break;
+	  case TPM_RT_AUTH:
+	    base = TPM_RESOURCE_AUTH_BASE;
+	    break;
+	  default:
+	    base = TPM_RESOURCE_TRANS_BASE;
+	    break;
+	}
+	/* the table is much smaller than the handle range, so this terminates */
+	do {
+	    tpm_resource_handle_next = (tpm_resource_handle_next + 1) & TPM_RESOURCE_HANDLE_MASK;
+	} while ((tpm_resource_handle_next == 0) ||
+		 (TPM_Resource_GetEntry(&collision, 0, base | tpm_resource_handle_next) == 0));
+	(*tpm_resource_entry)->connectionId = connectionId;
+	(*tpm_resource_entry)->resourceType = resourceType;
+	(*tpm_resource_entry)->virtualHandle = base | tpm_resource_handle_next;
+	(*tpm_resource_entry)->physicalHandle = physicalHandle;
+	(*tpm_resource_entry)->lastUsed = tpm_resource_clock;
+	printf(" TPM_Resource_AddEntry: Connection %u type %08x handle %08x physical %08x\n",
+	       connectionId, resourceType,
+	       (*tpm_resource_entry)->virtualHandle, physicalHandle);
+    }
+    return rc;
+}
+
+/* TPM_Resource_Release() flushes the object from the TPM and frees the entry.
+
+   A key that became owner evict stays loaded.  A swapped out session still holds a slot in the TPM
+   saved context list, which is freed by flushing its contextCount.
+*/
+
+static void TPM_Resource_Release(TPM_RESOURCE_ENTRY *tpm_resource_entry)
+{
+    tpm_state_t		*tpm_state = tpm_instances[0];
+    TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry;
+
+    printf(" TPM_Resource_Release: Connection %u handle %08x physical %08x\n",
+	   tpm_resource_entry->connectionId, tpm_resource_entry->virtualHandle,
+	   tpm_resource_entry->physicalHandle);
+    if (tpm_resource_entry->physicalHandle != 0) {
+	if (tpm_resource_entry->resourceType != TPM_RT_KEY) {
+	    TPM_Resource_FlushSpecific(tpm_resource_entry->physicalHandle,
+				       tpm_resource_entry->resourceType);
+	}
+	else if ((TPM_KeyHandleEntries_GetEntry(&tpm_key_handle_entry,
+						&(tpm_state->tpm_key_handle_entries),
+						tpm_resource_entry->physicalHandle) == 0) &&
+		 !(tpm_key_handle_entry->keyControl & TPM_KEY_CONTROL_OWNER_EVICT)) {
+	    /* sessions of other connections bound to the key survive */
+	    TPM_Resource_SwapOutBound(tpm_resource_entry);
+	    TPM_Resource_FlushSpecific(tpm_resource_entry->physicalHandle, TPM_RT_KEY);
+	}
+    }
+    else if ((tpm_resource_entry->resourceType != TPM_RT_KEY) &&
+	     (tpm_resource_entry->context.size >= (TPM_RESOURCE_CONTEXT_COUNT + sizeof(uint32_t)))) {
+	TPM_Resource_FlushSpecific(LOAD32(tpm_resource_entry->context.buffer,
+					  TPM_RESOURCE_CONTEXT_COUNT),
+				   TPM_RT_CONTEXT);
+    }
+    TPM_Resource_Entry_Delete(tpm_resource_entry);
+    return;
+}
+
+/* TPM_Resource_Count() returns the number of objects of 'resourceType' held by the connection,
+   whether loaded in the TPM or swapped out */
+
+static void TPM_Resource_Count(uint32_t *count,
+			       uint32_t connectionId,
+			       TPM_RESOURCE_TYPE resourceType)
+{
+    size_t i;
+
+    *count = 0;
+    for (i = 0 ; i < TPM_RESOURCE_OBJECTS ; i++) {
+	if ((tpm_resource_entries[i].connectionId == connectionId) &&
+	    (tpm_resource_entries[i].resourceType == resourceType)) {
+	    (*count)++;
+	}
+    }
+    return;
+}
+
+/* TPM_Resource_CheckQuota() returns TPM_RESOURCES if the connection already holds its quota of
+   'resourceType' objects */
+
+static TPM_RESULT TPM_Resource_CheckQuota(uint32_t connectionId,
+					  TPM_RESOURCE_TYPE resourceType)
+{
+    TPM_RESULT	rc = 0;
+    uint32_t	quota;
+    uint32_t	count;
+
+    switch (resourceType) {
+      case TPM_RT_KEY:
+	quota = tpm_resource_quota_keys;
+	break;
+      case TPM_RT_AUTH:
+	quota = tpm_resource_quota_auth;
+	break;
+      default:
+	quota = tpm_resource_quota_trans;
+	break;
+    }
+    if (quota != 0) {
+	TPM_Resource_Count(&count, connectionId, resourceType);
+	if (count >= quota) {
+	    printf("TPM_Resource_CheckQuota: Error, connection %u holds %u of type %08x, quota %u\n",
+		   connectionId, count, resourceType, quota);
+	    rc = TPM_RESOURCES;
+	}
+    }
+    return rc;
+}
+
+/* TPM_Resource_Reconcile() frees the entries of loaded objects that are no longer in the TPM.
+
+   This catches objects flushed by the command itself, sessions terminated by continueAuthSession
+   FALSE, and everything cleared by TPM_Startup.
+*/
+
+static void TPM_Resource_Reconcile(void)
+{
+    TPM_BOOL	isLoaded;
+    size_t	i;
+
+    for (i = 0 ; i < TPM_RESOURCE_OBJECTS ; i++) {
+	if ((tpm_resource_entries[i].connectionId != 0) &&
+	    (tpm_resource_entries[i].physicalHandle != 0)) {
+	    TPM_Resource_IsLoaded(&isLoaded,
+				  tpm_resource_entries[i].resourceType,
+				  tpm_resource_entries[i].physicalHandle);
+	    if (!isLoaded) {
+		printf(" TPM_Resource_Reconcile: Handle %08x physical %08x is gone\n",
+		       tpm_resource_entries[i].virtualHandle,
+		       tpm_resource_entries[i].physicalHandle);
+		TPM_Resource_Entry_Delete(&(tpm_resource_entries[i]));
+	    }
+	}
+    }
+    return;
+}
+
+/* TPM_Resource_IsLoaded() returns 'isLoaded' TRUE if the TPM has an object of the type at
+   'physicalHandle' */
+
+static void TPM_Resource_IsLoaded(TPM_BOOL *isLoaded,
+				  TPM_RESOURCE_TYPE resourceType,
+				  TPM_HANDLE physicalHandle)
+{
+    tpm_state_t			*tpm_state = tpm_instances[0];
+    TPM_KEY_HANDLE_ENTRY	*tpm_key_handle_entry;
+    TPM_AUTH_SESSION_DATA	*tpm_auth_session_data;
+    TPM_TRANSPORT_INTERNAL	*tpm_transport_internal;
+    TPM_RESULT			rc;
+
+    switch (resourceType) {
+      case TPM_RT_KEY:
+	rc = TPM_KeyHandleEntries_GetEntry(&tpm_key_handle_entry,
+					   &(tpm_state->tpm_key_handle_entries),
+					   physicalHandle);
+	break;
+      case TPM_RT_AUTH:
+	rc = TPM_AuthSessions_GetEntry(&tpm_auth_session_data,
+				       &(tpm_state->tpm_stclear_data.authSessions),
+				       physicalHandle);
+	break;
+      case TPM_RT_TRANS:
+	rc = TPM_TransportSessions_GetEntry(&tpm_transport_internal,
+					    &(tpm_state->tpm_stclear_data.transSessions),
+					    physicalHandle);
+	break;
+      default:
+	rc = TPM_INVALID_RESOURCE;
+	break;
+    }
+    *isLoaded = (rc == 0);
+    return;
+}
+
+/* TPM_Resource_IsSharedKey() returns TRUE for a key handle that every connection may use as is:
+   the reserved handles such as TPM_KH_SRK, and owner evict keys.
+*/
+
+static TPM_BOOL TPM_Resource_IsSharedKey(TPM_HANDLE keyHandle)
+{
+    tpm_state_t			*tpm_state = tpm_instances[0];
+    TPM_KEY_HANDLE_ENTRY	*tpm_key_handle_entry;
+    TPM_BOOL			isShared;
+
+    if ((keyHandle & 0xff000000) == 0x40000000) {
+	isShared = ((keyHandle & ~TPM_RESOURCE_HANDLE_MASK) != TPM_RESOURCE_KEY_BASE);
+    }
+    else {
+	isShared = (TPM_KeyHandleEntries_GetEntry(&tpm_key_handle_entry,
+						  &(tpm_state->tpm_key_handle_entries),
+						  keyHandle) == 0) &&
+		   (tpm_key_handle_entry->keyControl & TPM_KEY_CONTROL_OWNER_EVICT);
+    }
+    return isShared;
+}
+
+/*
+  Swapping
+*/
+
+/* TPM_Resource_IsSpace() returns 'isSpace' TRUE if the TPM has a free slot for the type */
+
+static void TPM_Resource_IsSpace(TPM_BOOL *isSpace,
+				 TPM_RESOURCE_TYPE resourceType)
+{
+    tpm_state_t	*tpm_state = tpm_instances[0];
+    uint32_t	index;
+
+    switch (resourceType) {
+      case TPM_RT_KEY:
+	TPM_KeyHandleEntries_IsSpace(isSpace, &index, &(tpm_state->tpm_key_handle_entries));
+	break;
+      case TPM_RT_AUTH:
+	TPM_AuthSessions_IsSpace(isSpace, &index, &(tpm_state->tpm_stclear_data.authSessions));
+	break;
+      case TPM_RT_TRANS:
+	TPM_TransportSessions_IsSpace(isSpace, &index,
+				      &(tpm_state->tpm_stclear_data.transSessions));
+	break;
+      default:
+	*isSpace = TRUE;
+	break;
+    }
+    return;
+}
+
+/* TPM_Resource_MakeSpace() swaps out least recently used objects of the type until the TPM has a
+   free slot.
+
+   Objects referenced by the current command and owner evict keys are never swapped out.  If no
+   object can be swapped out, the TPM reports the shortage when the command runs.
+*/
+
+static void TPM_Resource_MakeSpace(TPM_RESOURCE_TYPE resourceType)
+{
+    tpm_state_t		*tpm_state = tpm_instances[0];
+    TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry;
+    TPM_RESOURCE_ENTRY	*victim;
+    TPM_BOOL		isSpace;
+    size_t		i;
+
+    while (TRUE) {
+	TPM_Resource_IsSpace(&isSpace, resourceType);
+	if (isSpace) {
+	    break;
+	}
+	victim = NULL;
+	for (i = 0 ; i < TPM_RESOURCE_OBJECTS ; i++) {
+	    if ((tpm_resource_entries[i].connectionId == 0) ||
+		(tpm_resource_entries[i].resourceType != resourceType) ||
+		(tpm_resource_entries[i].physicalHandle == 0) ||
+		(tpm_resource_entries[i].lastUsed == tpm_resource_clock)) {
+		continue;
+	    }
+	    if ((resourceType == TPM_RT_KEY) &&
+		(TPM_KeyHandleEntries_GetEntry(&tpm_key_handle_entry,
+					       &(tpm_state->tpm_key_handle_entries),
+					       tpm_resource_entries[i].physicalHandle) == 0) &&
+		(tpm_key_handle_entry->keyControl & TPM_KEY_CONTROL_OWNER_EVICT)) {
+		continue;
+	    }
+	    /* oldest first, the clock may wrap */
+	    if ((victim == NULL) ||
+		((tpm_resource_clock - tpm_resource_entries[i].lastUsed) >
+		 (tpm_resource_clock - victim->lastUsed))) {
+		victim = &(tpm_resource_entries[i]);
+	    }
+	}
+	if (victim == NULL) {
+	    printf(" TPM_Resource_MakeSpace: No object of type %08x can be swapped out\n",
+		   resourceType);
+	    break;
+	}
+	/* do not select an object that cannot be swapped out again */
+	if (TPM_Resource_SwapOut(victim) != 0) {
+	    victim->lastUsed = tpm_resource_clock;
+	}
+    }
+    return;
+}
+
+/* TPM_Resource_SwapIn() loads a swapped out object back into the TPM, and marks it as used by the
+   current command.
+
+   An OSAP or DSAP session bound to a key is loaded against that key, which is swapped in first.  A
+   context that the TPM rejects, e.g. after TPM_Startup(ST_CLEAR), is discarded.
+*/
+
+static TPM_RESULT TPM_Resource_SwapIn(TPM_RESOURCE_ENTRY *tpm_resource_entry)
+{
+    TPM_RESULT		rc = 0;
+    TPM_RESOURCE_ENTRY	*keyEntry;
+    TPM_HANDLE		entityHandle;
+    TPM_HANDLE		physicalHandle;
+
+    tpm_resource_entry->lastUsed = tpm_resource_clock;
+    if (tpm_resource_entry->physicalHandle == 0) {
+	printf(" TPM_Resource_SwapIn: Handle %08x\n", tpm_resource_entry->virtualHandle);
+	entityHandle = tpm_resource_entry->entityHandle;
+	if (tpm_resource_entry->entityIsKey &&
+	    (TPM_Resource_GetEntry(&keyEntry, tpm_resource_entry->connectionId,
+				   entityHandle) == 0) &&
+	    (keyEntry->resourceType == TPM_RT_KEY)) {
+	    rc = TPM_Resource_SwapIn(keyEntry);
+	    if (rc == 0) {
+		entityHandle = keyEntry->physicalHandle;
+	    }
+	}
+	if (rc == 0) {
+	    TPM_Resource_MakeSpace(tpm_resource_entry->resourceType);
+	    rc = TPM_Resource_LoadContext(&physicalHandle, entityHandle,
+					  &(tpm_resource_entry->context));
+	    if (rc == 0) {
+		tpm_resource_entry->physicalHandle = physicalHandle;
+		TPM_SizedBuffer_Delete(&(tpm_resource_entry->context));
+	    }
+	    else if ((rc == TPM_BADCONTEXT) ||
+		     (rc == TPM_BAD_PARAMETER) ||
+		     (rc == TPM_DECRYPT_ERROR) ||
+		     (rc == TPM_RESOURCEMISSING) ||
+		     (rc == TPM_BAD_HANDLE)) {
+		printf("TPM_Resource_SwapIn: Error, discarding handle %08x, rc %08x\n",
+		       tpm_resource_entry->virtualHandle, rc);
+		TPM_Resource_Release(tpm_resource_entry);
+	    }
+	}
+    }
+    return rc;
+}
+
+/* TPM_Resource_SwapOut() saves the object's context and removes it from the TPM.
+
+   TPM_SaveContext invalidates a session.  A key must also be flushed, which terminates the OSAP
+   and DSAP sessions bound to it, so those are swapped out first.
+*/
+
+static TPM_RESULT TPM_Resource_SwapOut(TPM_RESOURCE_ENTRY *tpm_resource_entry)
+{
+    TPM_RESULT	rc = 0;
+
+    printf(" TPM_Resource_SwapOut: Handle %08x physical %08x\n",
+	   tpm_resource_entry->virtualHandle, tpm_resource_entry->physicalHandle);
+    if ((rc == 0) && (tpm_resource_entry->resourceType == TPM_RT_KEY)) {
+	rc = TPM_Resource_SwapOutBound(tpm_resource_entry);
+    }
+    if (rc == 0) {
+	rc = TPM_Resource_SaveContext(tpm_resource_entry);
+    }
+    if ((rc == 0) && (tpm_resource_entry->resourceType == TPM_RT_KEY)) {
+	rc = TPM_Resource_FlushSpecific(tpm_resource_entry->physicalHandle, TPM_RT_KEY);
+	if (rc != 0) {
+	    TPM_SizedBuffer_Delete(&(tpm_resource_entry->context));
+	}
+    }
+    if (rc == 0) {
+	tpm_resource_entry->physicalHandle = 0;
+    }
+    return rc;
+}
+
+/* TPM_Resource_SwapOutBound() swaps out the loaded OSAP and DSAP sessions that are bound to the
+   key, whichever connection owns them.
+
+   The TPM binds a session to the key's public data digest, so a copy of the key loaded by
+   another connection counts as well.
+*/
+
+static TPM_RESULT TPM_Resource_SwapOutBound(TPM_RESOURCE_ENTRY *tpm_resource_entry)
+{
+    TPM_RESULT			rc = 0;
+    tpm_state_t			*tpm_state = tpm_instances[0];
+    TPM_KEY_HANDLE_ENTRY	*tpm_key_handle_entry;
+    TPM_AUTH_SESSION_DATA	*tpm_auth_session_data;
+    size_t			i;
+
+    if (rc == 0) {
+	rc = TPM_KeyHandleEntries_GetEntry(&tpm_key_handle_entry,
+					   &(tpm_state->tpm_key_handle_entries),
+					   tpm_resource_entry->physicalHandle);
+    }
+    if (rc == 0) {
+	if ((tpm_key_handle_entry->key == NULL) ||
+	    (tpm_key_handle_entry->key->tpm_store_asymkey == NULL)) {
+	    printf("TPM_Resource_SwapOutBound: Error, key %08x has no private data\n",
+		   tpm_resource_entry->physicalHandle);
+	    rc = TPM_FAIL;
+	}
+    }
+    for (i = 0 ; (rc == 0) && (i < TPM_RESOURCE_OBJECTS) ; i++) {
+	if ((tpm_resource_entries[i].connectionId == 0) ||
+	    (tpm_resource_entries[i].resourceType != TPM_RT_AUTH) ||
+	    (tpm_resource_entries[i].physicalHandle == 0)) {
+	    continue;
+	}
+	if ((TPM_AuthSessions_GetEntry(&tpm_auth_session_data,
+				       &(tpm_state->tpm_stclear_data.authSessions),
+				       tpm_resource_entries[i].physicalHandle) == 0) &&
+	    ((tpm_auth_session_data->protocolID == TPM_PID_OSAP) ||
+	     (tpm_auth_session_data->protocolID == TPM_PID_DSAP)) &&
+	    (tpm_auth_session_data->entityTypeByte == TPM_ET_KEYHANDLE) &&
+	    (memcmp(tpm_auth_session_data->entityDigest,
+		    tpm_key_handle_entry->key->tpm_store_asymkey->pubDataDigest,
+		    TPM_DIGEST_SIZE) == 0)) {
+	    /* a session in use by the current command pins its key */
+	    if (tpm_resource_entries[i].lastUsed == tpm_resource_clock) {
+		rc = TPM_RESOURCES;
+	    }
+	    else {
+		rc = TPM_Resource_SwapOut(&(tpm_resource_entries[i]));
+	    }
+	}
+    }
+    return rc;
+}
+
+/*
+  Command and Response Mapping
+*/
+
+static void TPM_Resource_Command_Init(TPM_RESOURCE_COMMAND *tpm_resource_command)
+{
+    tpm_resource_command->ordinal = 0;
+    tpm_resource_command->created = 0;
+    tpm_resource_command->entityHandle = 0;
+    tpm_resource_command->entityIsKey = FALSE;
+    tpm_resource_command->released = NULL;
+    tpm_resource_command->capability = 0;
+    return;
+}
+
+/* TPM_Resource_MapCommand() replaces the virtual handles in the command with TPM handles.
+
+   The key handle positions come from the ordinal table.  The authorization handles are at fixed
+   offsets from the end of the command.  Handles are not part of any HMAC, so the command remains
+   valid.
+
+   For a command wrapped in a transport session, 'wrapped' is TRUE.  Only the handle area is
+   touched, since the rest may be encrypted.
+
+   A malformed command is left alone, and the TPM rejects it.
+*/
+
+static void TPM_Resource_MapCommand(TPM_RESOURCE_COMMAND *tpm_resource_command,
+				    uint32_t connectionId,
+				    unsigned char *command,
+				    uint32_t command_size,
+				    TPM_BOOL wrapped)
+{
+    TPM_RESULT		rc = 0;
+    TPM_TAG		tag;
+    uint32_t		authCount;
+    uint32_t		paramEnd;	/* end of the parameters, before the authorizations */
+    uint32_t		limit;		/* end of the area that may be changed */
+    uint32_t		keyHandles;
+    uint32_t		inputHandleSize;
+    uint32_t		capArea;
+    uint32_t		resourceType;
+    TPM_ENTITY_TYPE	entityType;
+    TPM_RESOURCE_ENTRY	*tpm_resource_entry;
+    uint32_t		offset;
+    uint32_t		i;
+
+    if (rc == 0) {
+	if ((command_size < TPM_RESOURCE_HEADER_SIZE) ||
+	    (LOAD32(command, sizeof(TPM_TAG)) != command_size)) {
+	    printf("TPM_Resource_MapCommand: Error, malformed command\n");
+	    rc = TPM_BAD_PARAM_SIZE;
+	}
+    }
+    if (rc == 0) {
+	tag = LOAD16(command, 0);
+	tpm_resource_command->ordinal = LOAD32(command, sizeof(TPM_TAG) + sizeof(uint32_t));
+	switch (tag) {
+	  case TPM_TAG_RQU_AUTH1_COMMAND:
+	    authCount = 1;
+	    break;
+	  case TPM_TAG_RQU_AUTH2_COMMAND:
+	    authCount = 2;
+	    break;
+	  default:
+	    authCount = 0;
+	    break;
+	}
+	if (command_size < (TPM_RESOURCE_HEADER_SIZE + (authCount * TPM_RESOURCE_AUTH_SIZE))) {
+	    printf("TPM_Resource_MapCommand: Error, command too short for %u authorizations\n",
+		   authCount);
+	    rc = TPM_BAD_PARAM_SIZE;
+	}
+    }
+    /* authorization session handles, a transport session for the last one of
+       TPM_ExecuteTransport and TPM_ReleaseTransportSigned */
+    if (rc == 0) {
+	paramEnd = command_size - (authCount * TPM_RESOURCE_AUTH_SIZE);
+	for (i = 0 ; i < authCount ; i++) {
+	    TPM_Resource_MapSession(connectionId, command, paramEnd + (i * TPM_RESOURCE_AUTH_SIZE));
+	}
+	if (TPM_OrdinalTable_GetHandles(&keyHandles, &inputHandleSize,
+					tpm_resource_command->ordinal) != 0) {
+	    keyHandles = 0;
+	    inputHandleSize = 0;
+	}
+	limit = wrapped ? (TPM_RESOURCE_HEADER_SIZE + inputHandleSize) : paramEnd;
+	if (limit > paramEnd) {
+	    limit = paramEnd;
+	}
+	/* leading key handles */
+	for (i = 0 ; (keyHandles != 0xffffffff) && (i < keyHandles) ; i++) {
+	    offset = TPM_RESOURCE_HEADER_SIZE + (i * sizeof(TPM_KEY_HANDLE));
+	    if ((offset + sizeof(TPM_KEY_HANDLE)) <= limit) {
+		TPM_Resource_MapKey(connectionId, command, offset);
+	    }
+	}
+	offset = TPM_RESOURCE_HEADER_SIZE;
+	switch (tpm_resource_command->ordinal) {
+	  case TPM_ORD_LoadKey:
+	  case TPM_ORD_LoadKey2:
+	  case TPM_ORD_LoadKeyContext:
+	    tpm_resource_command->created = TPM_RT_KEY;
+	    break;
+	  case TPM_ORD_OIAP:
+	  case TPM_ORD_LoadAuthContext:
+	    tpm_resource_command->created = TPM_RT_AUTH;
+	    break;
+	  case TPM_ORD_EstablishTransport:
+	    tpm_resource_command->created = TPM_RT_TRANS;
+	    break;
+	  case TPM_ORD_OSAP:
+	  case TPM_ORD_DSAP:
+	    /* entityType, then entityValue or keyHandle.  The session is bound to the entity, which
+	       is needed to load it again. */
+	    tpm_resource_command->created = TPM_RT_AUTH;
+	    if ((offset + sizeof(TPM_ENTITY_TYPE) + sizeof(TPM_HANDLE)) <= limit) {
+		entityType = LOAD16(command, offset);
+		offset += sizeof(TPM_ENTITY_TYPE);
+		tpm_resource_command->entityHandle = LOAD32(command, offset);
+		if (((tpm_resource_command->ordinal == TPM_ORD_OSAP) &&
+		     ((entityType & 0x00ff) == TPM_ET_KEYHANDLE)) ||
+		    ((tpm_resource_command->ordinal == TPM_ORD_DSAP) &&
+		     (entityType == TPM_ET_DEL_KEY_BLOB))) {
+		    tpm_resource_command->entityIsKey = TRUE;
+		    TPM_Resource_MapKey(connectionId, command, offset);
+		}
+	    }
+	    break;
+	  case TPM_ORD_ReleaseTransportSigned:
+	    /* the ordinal table lists no handles, but the first parameter is a key handle */
+	    if ((offset + sizeof(TPM_KEY_HANDLE)) <= limit) {
+		TPM_Resource_MapKey(connectionId, command, offset);
+	    }
+	    break;
+	  case TPM_ORD_Terminate_Handle:
+	    if ((offset + sizeof(TPM_AUTHHANDLE)) <= limit) {
+		TPM_Resource_MapTyped(tpm_resource_command, connectionId, command,
+				      offset, 0, wrapped ? 0 : paramEnd);
+	    }
+	    break;
+	  case TPM_ORD_SaveAuthContext:
+	    if ((offset + sizeof(TPM_AUTHHANDLE)) <= limit) {
+		TPM_Resource_MapSession(connectionId, command, offset);
+	    }
+	    break;
+	  case TPM_ORD_FlushSpecific:
+	  case TPM_ORD_SaveContext:
+	    /* handle, then resourceType, which may be encrypted when wrapped */
+	    if ((offset + sizeof(TPM_HANDLE)) <= limit) {
+		TPM_Resource_MapTyped(tpm_resource_command, connectionId, command,
+				      offset, offset + sizeof(TPM_HANDLE), wrapped ? 0 : paramEnd);
+	    }
+	    break;
+	  case TPM_ORD_LoadContext:
+	    /* entityHandle, keepHandle, contextSize, TPM_CONTEXT_BLOB tag, resourceType */
+	    if ((offset + sizeof(TPM_HANDLE)) <= limit) {
+		tpm_resource_command->entityHandle = LOAD32(command, offset);
+		if ((TPM_Resource_GetEntry(&tpm_resource_entry, connectionId,
+					   tpm_resource_command->entityHandle) == 0) &&
+		    (tpm_resource_entry->resourceType == TPM_RT_KEY)) {
+		    tpm_resource_command->entityIsKey = TRUE;
+		    TPM_Resource_MapKey(connectionId, command, offset);
+		}
+	    }
+	    offset += sizeof(TPM_HANDLE);
+	    if (!wrapped &&
+		((offset + sizeof(TPM_BOOL) + sizeof(uint32_t) + sizeof(TPM_STRUCTURE_TAG) +
+		  sizeof(TPM_RESOURCE_TYPE)) <= paramEnd)) {
+		/* the client sees virtual handles, the TPM handle need not be kept */
+		STORE8(command, offset, FALSE);
+		resourceType = LOAD32(command, offset + sizeof(TPM_BOOL) + sizeof(uint32_t) +
+				      sizeof(TPM_STRUCTURE_TAG));
+		if ((resourceType == TPM_RT_KEY) ||
+		    (resourceType == TPM_RT_AUTH) ||
+		    (resourceType == TPM_RT_TRANS)) {
+		    tpm_resource_command->created = resourceType;
+		}
+	    }
+	    break;
+	  case TPM_ORD_GetCapability:
+	    /* capArea, subCapSize, subCap */
+	    if (!wrapped && ((offset + sizeof(uint32_t) + sizeof(uint32_t)) <= paramEnd)) {
+		capArea = LOAD32(command, offset);
+		if (capArea == TPM_CAP_KEY_HANDLE) {
+		    tpm_resource_command->capability = TPM_RT_KEY;
+		}
+		else if ((capArea == TPM_CAP_HANDLE) &&
+			 (LOAD32(command, offset + sizeof(uint32_t)) == sizeof(TPM_RESOURCE_TYPE)) &&
+			 ((offset + (2 * sizeof(uint32_t)) + sizeof(TPM_RESOURCE_TYPE)) <=
+			  paramEnd)) {
+		    resourceType = LOAD32(command, offset + (2 * sizeof(uint32_t)));
+		    if ((resourceType == TPM_RT_KEY) ||
+			(resourceType == TPM_RT_AUTH) ||
+			(resourceType == TPM_RT_TRANS)) {
+			tpm_resource_command->capability = resourceType;
+		    }
+		}
+	    }
+	    break;
+	  default:
+	    break;
+	}
+    }
+    return;
+}
+
+/* TPM_Resource_MapKey() maps the virtual key handle at 'offset'.
+
+   A handle that is neither the connection's own key nor a shared key is replaced by 0, which the
+   TPM rejects, so that a connection cannot use another connection's key.
+*/
+
+static void TPM_Resource_MapKey(uint32_t connectionId,
+				unsigned char *command,
+				uint32_t offset)
+{
+    TPM_RESOURCE_ENTRY	*tpm_resource_entry;
+    TPM_HANDLE		virtualHandle;
+    TPM_HANDLE		physicalHandle = 0;
+
+    virtualHandle = LOAD32(command, offset);
+    if (TPM_Resource_GetEntry(&tpm_resource_entry, connectionId, virtualHandle) == 0) {
+	if ((tpm_resource_entry->resourceType == TPM_RT_KEY) &&
+	    (TPM_Resource_SwapIn(tpm_resource_entry) == 0)) {
+	    physicalHandle = tpm_resource_entry->physicalHandle;
+	}
+    }
+    else if (TPM_Resource_IsSharedKey(virtualHandle)) {
+	physicalHandle = virtualHandle;
+    }
+    printf("  TPM_Resource_MapKey: Key handle %08x to %08x\n", virtualHandle, physicalHandle);
+    STORE32(command, offset, physicalHandle);
+    return;
+}
+
+/* TPM_Resource_MapSession() maps the virtual authorization or transport session handle at
+   'offset'.  A handle that is not the connection's own is replaced by 0.
+*/
+
+static void TPM_Resource_MapSession(uint32_t connectionId,
+				    unsigned char *command,
+				    uint32_t offset)
+{
+    TPM_RESOURCE_ENTRY	*tpm_resource_entry;
+    TPM_HANDLE		virtualHandle;
+    TPM_HANDLE		physicalHandle = 0;
+
+    virtualHandle = LOAD32(command, offset);
+    if ((TPM_Resource_GetEntry(&tpm_resource_entry, connectionId, virtualHandle) == 0) &&
+	(tpm_resource_entry->resourceType != TPM_RT_KEY) &&
+	(TPM_Resource_SwapIn(tpm_resource_entry) == 0)) {
+	physicalHandle = tpm_resource_entry->physicalHandle;
+    }
+    printf("  TPM_Resource_MapSession: Session handle %08x to %08x\n",
+	   virtualHandle, physicalHandle);
+    STORE32(command, offset, physicalHandle);
+    return;
+}
+
+/* TPM_Resource_MapTyped() maps the handle at 'offset' of a command that flushes or saves an
+   object.
+
+   The connection's own objects are found by virtual handle alone, since the virtual handle ranges
+   differ by type.  Flushing an object that is swapped out needs no TPM, and is recorded in
+   'released'.  For other handles, the resourceType at 'typeOffset' decides.  'limit' is 0 if the
+   resourceType cannot be read.
+*/
+
+static void TPM_Resource_MapTyped(TPM_RESOURCE_COMMAND *tpm_resource_command,
+				  uint32_t connectionId,
+				  unsigned char *command,
+				  uint32_t offset,
+				  uint32_t typeOffset,
+				  uint32_t limit)
+{
+    TPM_RESOURCE_ENTRY	*tpm_resource_entry;
+    TPM_HANDLE		handle;
+    TPM_RESOURCE_TYPE	resourceType = TPM_RT_AUTH;	/* TPM_Terminate_Handle */
+    size_t		i;
+
+    handle = LOAD32(command, offset);
+    if (TPM_Resource_GetEntry(&tpm_resource_entry, connectionId, handle) == 0) {
+	if ((tpm_resource_entry->physicalHandle == 0) &&
+	    (limit != 0) &&
+	    (tpm_resource_command->ordinal != TPM_ORD_SaveContext)) {
+	    printf("  TPM_Resource_MapTyped: Handle %08x is swapped out, discard\n", handle);
+	    tpm_resource_command->released = tpm_resource_entry;
+	}
+	else if (tpm_resource_entry->resourceType == TPM_RT_KEY) {
+	    TPM_Resource_MapKey(connectionId, command, offset);
+	}
+	else {
+	    TPM_Resource_MapSession(connectionId, command, offset);
+	}
+    }
+    else {
+	if (typeOffset != 0) {
+	    if ((typeOffset + sizeof(TPM_RESOURCE_TYPE)) <= limit) {
+		resourceType = LOAD32(command, typeOffset);
+	    }
+	    else {
+		resourceType = 0;	/* unknown */
+	    }
+	}
+	switch (resourceType) {
+	  case TPM_RT_KEY:
+	    TPM_Resource_MapKey(connectionId, command, offset);
+	    break;
+	  case TPM_RT_CONTEXT:
+	    /* a session swapped out by the resource manager, which the client does not know */
+	    for (i = 0 ; i < TPM_RESOURCE_OBJECTS ; i++) {
+		if ((tpm_resource_entries[i].connectionId != 0) &&
+		    (tpm_resource_entries[i].context.size >=
+		     (TPM_RESOURCE_CONTEXT_COUNT + sizeof(uint32_t))) &&
+		    (LOAD32(tpm_resource_entries[i].context.buffer,
+			    TPM_RESOURCE_CONTEXT_COUNT) == handle)) {
+		    STORE32(command, offset, 0);
+		}
+	    }
+	    break;
+	  case TPM_RT_AUTH:
+	  case TPM_RT_TRANS:
+	    TPM_Resource_MapSession(connectionId, command, offset);
+	    break;
+	  case 0:
+	    /* wrapped, only a shared key can be used as is */
+	    if (!TPM_Resource_IsSharedKey(handle)) {
+		STORE32(command, offset, 0);
+	    }
+	    break;
+	  default:
+	    break;
+	}
+    }
+    return;
+}
+
+/* TPM_Resource_MapResponse() gives the handle returned by a successful command a new virtual
+   handle.
+
+   If the virtual object table is full, the new object is flushed and TPM_RESOURCES is returned.
+*/
+
+static TPM_RESULT TPM_Resource_MapResponse(TPM_RESOURCE_COMMAND *tpm_resource_command,
+					   uint32_t connectionId,
+					   unsigned char *response,
+					   uint32_t response_size)
+{
+    TPM_RESULT		rc = 0;
+    TPM_RESOURCE_ENTRY	*tpm_resource_entry;
+    TPM_RESOURCE_TYPE	resourceType;
+    TPM_HANDLE		physicalHandle;
+    TPM_BOOL		isLoaded = FALSE;
+
+    resourceType = tpm_resource_command->created;
+    if ((resourceType != 0) || (tpm_resource_command->ordinal == TPM_ORD_LoadContext)) {
+	if ((response_size >= (TPM_RESOURCE_HEADER_SIZE + sizeof(TPM_HANDLE))) &&
+	    (LOAD32(response, sizeof(TPM_TAG) + sizeof(uint32_t)) == TPM_SUCCESS)) {
+	    physicalHandle = LOAD32(response, TPM_RESOURCE_HEADER_SIZE);
+	    /* the type of a wrapped TPM_LoadContext is found from the TPM */
+	    if (resourceType == 0) {
+		for (resourceType = TPM_RT_KEY ; resourceType <= TPM_RT_TRANS ; resourceType++) {
+		    TPM_Resource_IsLoaded(&isLoaded, resourceType, physicalHandle);
+		    if (isLoaded) {
+			break;
+		    }
+		}
+		if (!isLoaded) {
+		    resourceType = 0;	/* e.g. a DAA session, not virtualized */
+		}
+	    }
+	    if (resourceType != 0) {
+		rc = TPM_Resource_AddEntry(&tpm_resource_entry, connectionId,
+					   resourceType, physicalHandle);
+		if (rc == 0) {
+		    tpm_resource_entry->entityHandle = tpm_resource_command->entityHandle;
+		    tpm_resource_entry->entityIsKey = tpm_resource_command->entityIsKey;
+		    STORE32(response, TPM_RESOURCE_HEADER_SIZE, tpm_resource_entry->virtualHandle);
+		}
+		else {
+		    TPM_Resource_FlushSpecific(physicalHandle, resourceType);
+		}
+	    }
+	}
+    }
+    return rc;
+}
+
+/* TPM_Resource_GetCapability() replaces the TPM_KEY_HANDLE_LIST in a TPM_GetCapability response
+   with the connection's virtual handles of the type.  Shared keys remain in the list.
+*/
+
+static TPM_RESULT TPM_Resource_GetCapability(uint32_t connectionId,
+					     TPM_RESOURCE_TYPE resourceType,
+					     unsigned char **response,
+					     uint32_t *response_size,
+					     uint32_t *response_total)
+{
+    TPM_RESULT		rc = 0;
+    TPM_STORE_BUFFER	handleList;
+    TPM_STORE_BUFFER	sbuffer;
+    const unsigned char	*buffer;
+    uint32_t		length;
+    uint32_t		offset;
+    uint16_t		loaded;
+    uint16_t		count = 0;
+    TPM_HANDLE		handle;
+    size_t		i;
+
+    printf(" TPM_Resource_GetCapability: Connection %u resourceType %08x\n",
+	   connectionId, resourceType);
+    TPM_Sbuffer_Init(&handleList);		/* freed @1 */
+    /* tag, paramSize, returnCode, respSize, then the TPM_KEY_HANDLE_LIST */
+    offset = TPM_RESOURCE_HEADER_SIZE + sizeof(uint32_t);
+    if ((*response_size >= (offset + sizeof(uint16_t))) &&
+	(LOAD32(*response, sizeof(TPM_TAG) + sizeof(uint32_t)) == TPM_SUCCESS)) {
+	loaded = LOAD16(*response, offset);
+	offset += sizeof(uint16_t);
+	for (i = 0 ;
+	     (rc == 0) && (resourceType == TPM_RT_KEY) && (i < loaded) &&
+		 ((offset + sizeof(TPM_HANDLE)) <= *response_size) ;
+	     i++, offset += sizeof(TPM_HANDLE)) {
+	    handle = LOAD32(*response, offset);
+	    if (TPM_Resource_IsSharedKey(handle)) {
+		rc = TPM_Sbuffer_Append32(&handleList, handle);
+		count++;
+	    }
+	}
+	for (i = 0 ; (rc == 0) && (i < TPM_RESOURCE_OBJECTS) ; i++) {
+	    if ((tpm_resource_entries[i].connectionId == connectionId) &&
+		(tpm_resource_entries[i].resourceType == resourceType)) {
+		rc = TPM_Sbuffer_Append32(&handleList, tpm_resource_entries[i].virtualHandle);
+		count++;
+	    }
+	}
+	/* rebuild the response in the same buffer */
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Set(&sbuffer, *response, 0, *response_total);
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_StoreInitialResponse(&sbuffer, TPM_TAG_RQU_COMMAND, TPM_SUCCESS);
+	}
+	if (rc == 0) {
+	    TPM_Sbuffer_Get(&handleList, &buffer, &length);
+	    rc = TPM_Sbuffer_Append32(&sbuffer, sizeof(uint16_t) + length);
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append16(&sbuffer, count);
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append(&sbuffer, buffer, length);
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_StoreFinalResponse(&sbuffer, TPM_SUCCESS, NULL);
+	}
+	if (rc == 0) {
+	    TPM_Sbuffer_GetAll(&sbuffer, response, response_size, response_total);
+	}
+    }
+    TPM_Sbuffer_Delete(&handleList);		/* @1 */
+    return rc;
+}
+
+/* TPM_Resource_SetResponse() replaces the response with one carrying only 'returnCode' */
+
+static TPM_RESULT TPM_Resource_SetResponse(unsigned char **response,
+					   uint32_t *response_size,
+					   uint32_t *response_total,
+					   TPM_RESULT returnCode)
+{
+    TPM_RESULT		rc = 0;
+    TPM_STORE_BUFFER	sbuffer;
+
+    printf(" TPM_Resource_SetResponse: returnCode %08x\n", returnCode);
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Set(&sbuffer, *response, 0, *response_total);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_StoreInitialResponse(&sbuffer, TPM_TAG_RQU_COMMAND, returnCode);
+    }
+    if (rc == 0) {
+	TPM_Sbuffer_GetAll(&sbuffer, response, response_size, response_total);
+    }
+    return rc;
+}
+
+/*
+  Commands sent by the resource manager
+*/
+
+/* TPM_Resource_StartCommand() begins an unauthorized command in tpm_resource_command */
+
+static TPM_RESULT TPM_Resource_StartCommand(TPM_COMMAND_CODE ordinal)
+{
+    TPM_RESULT	rc = 0;
+
+    TPM_Sbuffer_Clear(&tpm_resource_command);
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append16(&tpm_resource_command, TPM_TAG_RQU_COMMAND);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(&tpm_resource_command, 0);	/* paramSize, set on execute */
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(&tpm_resource_command, ordinal);
+    }
+    return rc;
+}
+
+/* TPM_Resource_Execute() processes tpm_resource_command.  The response is left in
+   tpm_resource_rbuffer.
+
+   Returns the TPM returnCode of the response, or the fatal error if there is none.
+*/
+
+static TPM_RESULT TPM_Resource_Execute(void)
+{
+    TPM_RESULT	rc = 0;
+    uint32_t	length;
+
+    if (rc == 0) {
+	length = tpm_resource_command.buffer_current - tpm_resource_command.buffer;
+	STORE32(tpm_resource_command.buffer, sizeof(TPM_TAG), length);
+	tpm_resource_rlength = 0;
+	rc = TPM_ProcessA(&tpm_resource_rbuffer,
+			  &tpm_resource_rlength,
+			  &tpm_resource_rtotal,
+			  tpm_resource_command.buffer,
+			  length);
+    }
+    if (rc == 0) {
+	if (tpm_resource_rlength < TPM_RESOURCE_HEADER_SIZE) {
+	    printf("TPM_Resource_Execute: Error (fatal), response size %u\n",
+		   tpm_resource_rlength);
+	    rc = TPM_FAIL;
+	}
+    }
+    if (rc == 0) {
+	rc = LOAD32(tpm_resource_rbuffer, sizeof(TPM_TAG) + sizeof(uint32_t));
+    }
+    return rc;
+}
+
+static TPM_RESULT TPM_Resource_FlushSpecific(TPM_HANDLE handle,
+					     TPM_RESOURCE_TYPE resourceType)
+{
+    TPM_RESULT	rc = 0;
+
+    printf(" TPM_Resource_FlushSpecific: Handle %08x resourceType %08x\n", handle, resourceType);
+    if (rc == 0) {
+	rc = TPM_Resource_StartCommand(TPM_ORD_FlushSpecific);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(&tpm_resource_command, handle);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(&tpm_resource_command, resourceType);
+    }
+    if (rc == 0) {
+	rc = TPM_Resource_Execute();
+    }
+    return rc;
+}
+
+/* TPM_Resource_SaveContext() saves the loaded object into the entry context */
+
+static TPM_RESULT TPM_Resource_SaveContext(TPM_RESOURCE_ENTRY *tpm_resource_entry)
+{
+    TPM_RESULT		rc = 0;
+    uint32_t		contextSize;
+    unsigned char	label[16];
+
+    memset(label, 0, sizeof(label));
+    if (rc == 0) {
+	rc = TPM_Resource_StartCommand(TPM_ORD_SaveContext);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(&tpm_resource_command, tpm_resource_entry->physicalHandle);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(&tpm_resource_command, tpm_resource_entry->resourceType);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append(&tpm_resource_command, label, sizeof(label));
+    }
+    if (rc == 0) {
+	rc = TPM_Resource_Execute();
+    }
+    /* contextSize, contextBlob */
+    if (rc == 0) {
+	if (tpm_resource_rlength < (TPM_RESOURCE_HEADER_SIZE + sizeof(uint32_t))) {
+	    rc = TPM_FAIL;
+	}
+    }
+    if (rc == 0) {
+	contextSize = LOAD32(tpm_resource_rbuffer, TPM_RESOURCE_HEADER_SIZE);
+	if (contextSize > (tpm_resource_rlength - (TPM_RESOURCE_HEADER_SIZE + sizeof(uint32_t)))) {
+	    rc = TPM_FAIL;
+	}
+    }
+    if (rc == 0) {
+	rc = TPM_SizedBuffer_Set(&(tpm_resource_entry->context), contextSize,
+				 tpm_resource_rbuffer + TPM_RESOURCE_HEADER_SIZE + sizeof(uint32_t));
+    }
+    return rc;
+}
+
+/* TPM_Resource_LoadContext() loads the saved 'context', returning the new TPM handle */
+
+static TPM_RESULT TPM_Resource_LoadContext(TPM_HANDLE *physicalHandle,
+					   TPM_HANDLE entityHandle,
+					   TPM_SIZED_BUFFER *context)
+{
+    TPM_RESULT	rc = 0;
+
+    if (rc == 0) {
+	rc = TPM_Resource_StartCommand(TPM_ORD_LoadContext);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(&tpm_resource_command, entityHandle);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append8(&tpm_resource_command, FALSE);		/* keepHandle */
+    }
+    if (rc == 0) {
+	rc = TPM_SizedBuffer_Store(&tpm_resource_command, context);
+    }
+    if (rc == 0) {
+	rc = TPM_Resource_Execute();
+    }
+    if (rc == 0) {
+	if (tpm_resource_rlength < (TPM_RESOURCE_HEADER_SIZE + sizeof(TPM_HANDLE))) {
+	    rc = TPM_FAIL;
+	}
+    }
+    if (rc == 0) {
+	*physicalHandle = LOAD32(tpm_resource_rbuffer, TPM_RESOURCE_HEADER_SIZE);
+    }
+    return rc;
+}
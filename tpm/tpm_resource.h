@@ -0,0 +1,88 @@
+/********************************************************************************/
+/*                                                                              */
+/*                              Resource Manager                                */
+/*                                                                              */
+/* (c) Copyright IBM Corporation 2006, 2010.					*/
+/*										*/
+/* All rights reserved.								*/
+/* 										*/
+/* Redistribution and use in source and binary forms, with or without		*/
+/* modification, are permitted provided that the following conditions are	*/
+/* met:										*/
+/* 										*/
+/* Redistributions of source code must retain the above copyright notice,	*/
+/* this list of conditions and the following disclaimer.			*/
+/* 										*/
+/* Redistributions in binary form must reproduce the above copyright		*/
+/* notice, this list of conditions and the following disclaimer in the		*/
+/* documentation and/or other materials provided with the distribution.		*/
+/* 										*/
+/* Neither the names of the IBM Corporation nor the names of its		*/
+/* contributors may be used to endorse or promote products derived from		*/
+/* this software without specific prior written permission.			*/
+/* 										*/
+/* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS		*/
+/* "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT		*/
+/* LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR	*/
+/* A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT		*/
+/* HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,	*/
+/* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT		*/
+/* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,	*/
+/* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY	*/
+/* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT		*/
+/* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE	*/
+/* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.		*/
+/********************************************************************************/
+
+#ifndef TPM_RESOURCE_H
+#define TPM_RESOURCE_H
+
+#include "tpm_types.h"
+#include "tpm_structures.h"
+
+/* Resource manager
+
+   When the TPM_RESOURCE_MANAGER environment variable is set, the server keeps client connections
+   open and passes each command through TPM_Resource_Process().  Key, authorization session, and
+   transport session handles are virtualized per connection, so a client sees only its own
+   objects.
+
+   When the TPM runs out of slots, the least recently used object is saved with TPM_SaveContext
+   into an in-memory context cache and flushed.  It is loaded again with TPM_LoadContext when a
+   command references it.  When a connection closes, its objects are flushed.
+
+   TPM_Resource_SetQuotas() limits the keys, authorization sessions, and transport sessions that one
+   connection may hold, so that a client that leaks handles cannot starve the others.
+*/
+
+#ifndef TPM_RESOURCE_OBJECTS
+#define TPM_RESOURCE_OBJECTS	256	/* virtual objects, summed over all connections */
+#endif
+
+/* a virtual object owned by a client connection */
+
+typedef struct tdTPM_RESOURCE_ENTRY {
+    uint32_t		connectionId;	/* owning connection, 0 for a free entry */
+    TPM_RESOURCE_TYPE	resourceType;	/* TPM_RT_KEY, TPM_RT_AUTH, or TPM_RT_TRANS */
+    TPM_HANDLE		virtualHandle;	/* handle seen by the client */
+    TPM_HANDLE		physicalHandle;	/* handle in the TPM, 0 while swapped out */
+    TPM_HANDLE		entityHandle;	/* OSAP or DSAP entity, needed to load the session */
+    TPM_BOOL		entityIsKey;	/* entityHandle is a virtual key handle */
+    TPM_SIZED_BUFFER	context;	/* saved context while swapped out */
+    uint32_t		lastUsed;	/* command count at the last reference */
+} TPM_RESOURCE_ENTRY;
+
+void       TPM_Resource_Init(void);
+void       TPM_Resource_SetQuotas(uint32_t keys,
+                                  uint32_t authSessions,
+                                  uint32_t transSessions);
+TPM_RESULT TPM_Resource_Connect(uint32_t *connectionId);
+void       TPM_Resource_Disconnect(uint32_t connectionId);
+TPM_RESULT TPM_Resource_Process(uint32_t connectionId,
+                                unsigned char **response,
+                                uint32_t *response_size,
+                                uint32_t *response_total,
+                                unsigned char *command,
+                                uint32_t command_size);
+
+#endif
@@ -47,13 +47,72 @@
 /* #include <stdint.h> */
 
 #include "tpm_debug.h"
+#include "tpm_delegate.h"
+#include "tpm_error.h"
 #include "tpm_global.h"
 #include "tpm_io.h"
 #include "tpm_init.h"
+#include "tpm_key.h"
+#include "tpm_memory.h"
+#include "tpm_nvfile.h"
+#include "tpm_nvfilename.h"
 #include "tpm_nvram.h"
+#include "tpm_permanent.h"
 #include "tpm_process.h"
+#include "tpm_resource.h"
+#include "tpm_session.h"
 #include "tpm_startup.h"
+#include "tpm_store.h"
 #include "tpm_svnrevision.h"
+#include "tpm_time.h"
+#include "tpm_transport.h"
+
+/* Group commit
+
+   When the TPM_GROUP_COMMIT environment variable is set, a command that changes the permanent state
+   does not write NV.  Its response is held, and the server continues to accept commands while
+   clients are waiting to connect.  At the end of the batch, one NV write covers all the held
+   commands, and then the responses are released.
+
+   A batch ends when no client is waiting, when TPM_GROUP_COMMIT_RESPONSES responses are held, or
+   when the first held response is TPM_GROUP_COMMIT msec old.  The added latency is therefore
+   bounded by TPM_GROUP_COMMIT msec plus the processing time of one command.  A client command
+   that has not arrived by the end of the batch is only read after the responses are released.
+
+   If the NV write fails, only the commands that changed the permanent state fail.  The state stays
+   in memory and the write stays pending, so the next batch retries it.
+*/
+
+#ifndef TPM_GROUP_COMMIT_RESPONSES
+#define TPM_GROUP_COMMIT_RESPONSES	16
+#endif
+
+/* a response held until the NV write that it depends on completes */
+
+typedef struct tdTPM_HELD_RESPONSE {
+    TPM_CONNECTION_FD	connection_fd;
+    unsigned char	*rbuffer;
+    uint32_t		rlength;
+    TPM_BOOL		deferred;	/* TRUE if the command deferred a permanent state write */
+} TPM_HELD_RESPONSE;
+
+/* maximum time that a response is held in msec, 0 if group commit is disabled */
+static uint32_t group_commit_msec = 0;
+
+/* Resource manager connections
+
+   When the TPM_RESOURCE_MANAGER environment variable is set, a client connection stays open for
+   any number of commands, and up to TPM_SERVER_CONNECTIONS clients are served in turn.
+*/
+
+#ifndef TPM_SERVER_CONNECTIONS
+#define TPM_SERVER_CONNECTIONS		16
+#endif
+
+static TPM_BOOL resource_manager = FALSE;
+static TPM_CONNECTION_FD connection_fds[TPM_SERVER_CONNECTIONS];
+static uint32_t connection_ids[TPM_SERVER_CONNECTIONS];	/* resource manager identifiers */
+static size_t connectionCount = 0;
 
 /* local function prototypes */
 
@@ -63,6 +122,27 @@ static void *mainLoop(void *mainLoopArgs);
 #ifdef TPM_WINDOWS
 static void mainLoop(void *mainLoopArgs);
 #endif
+static TPM_RESULT TPM_Server_HoldResponse(TPM_HELD_RESPONSE *held,
+					  TPM_CONNECTION_FD *connection_fd,
+					  const unsigned char *rbuffer,
+					  uint32_t rlength,
+					  TPM_BOOL deferred);
+static TPM_RESULT TPM_Server_BatchTimeout(uint32_t *msec,
+					  uint32_t held_sec,
+					  uint32_t held_usec);
+static TPM_RESULT TPM_Server_IsBatchDone(TPM_BOOL *done,
+					 size_t heldCount,
+					 uint32_t held_sec,
+					 uint32_t held_usec);
+static void       TPM_Server_ReleaseResponses(TPM_HELD_RESPONSE *held,
+					      size_t *heldCount);
+static TPM_RESULT TPM_Server_IdleTimeout(uint32_t *msec);
+static TPM_RESULT TPM_Server_WaitConnect(void);
+static TPM_RESULT TPM_Server_NextConnection(TPM_BOOL *found,
+					    size_t *connectionIndex,
+					    uint32_t msec,
+					    void *mainLoopArgs);
+static void       TPM_Server_CloseConnection(size_t connectionIndex);
 
 /* if it's threaded and TPM_NUM_THREADS was not specified as a compile time argument, use a default
    value */
@@ -72,6 +152,23 @@ int main(int argc, char **argv)
 {
     TPM_RESULT          rc = 0;
     time_t              start_time;
+    char                *group_commit;
+    char                *nv_defined_size;
+    uint32_t            nv_data_count;
+    char                *key_handles;
+    char                *owner_evict_key_handles;
+    char                *auth_sessions;
+    char                *auth_idle_timeout;
+    char                *auth_lru_evict;
+    char                *trans_sessions;
+    char                *session_list;
+    char                *resource_manager_env;
+    char                *connection_keys;
+    char                *connection_auth_sessions;
+    char                *connection_trans_sessions;
+    char                *context_cache;
+    char                *family_table_rows;
+    char                *delegate_table_rows;
 
 #ifdef TPM_ALLOW_DAEMONIZE
     if (argc > 1 && (!strcmp("-d",argv[1]) || !strcmp("--daemon",argv[1]))) {
@@ -124,12 +221,133 @@ int main(int argc, char **argv)
 	   TPM_MAX_VOLATILESTATE_SPACE);
     printf("Main: Compiled for %u NV defined space\n",
 	   TPM_MAX_NV_DEFINED_SIZE);
+    /* optional number of owner evict key slots, raises the key slots if needed, must be set
+       before the TPM state is allocated */
+    if (rc == 0) {
+        owner_evict_key_handles = getenv("TPM_OWNER_EVICT_KEY_HANDLES");
+        if (owner_evict_key_handles != NULL) {
+            TPM_KeyHandleEntries_SetOwnerEvictKeyHandles(strtoul(owner_evict_key_handles,
+                                                                 NULL, 0));
+        }
+    }
+    /* optional number of key slots, must be set before the TPM state is allocated */
+    if (rc == 0) {
+        key_handles = getenv("TPM_KEY_HANDLES");
+        if (key_handles != NULL) {
+            TPM_KeyHandleEntries_SetKeyHandles(strtoul(key_handles, NULL, 0));
+        }
+    }
+    /* optional number of authorization session slots and abandoned session reclamation, must be
+       set before the TPM state is allocated */
+    if (rc == 0) {
+        auth_sessions = getenv("TPM_AUTH_SESSIONS");
+        if (auth_sessions != NULL) {
+            TPM_AuthSessions_SetSlots(strtoul(auth_sessions, NULL, 0));
+        }
+        auth_idle_timeout = getenv("TPM_AUTH_IDLE_TIMEOUT");
+        auth_lru_evict = getenv("TPM_AUTH_LRU_EVICT");
+        if ((auth_idle_timeout != NULL) || (auth_lru_evict != NULL)) {
+            TPM_AuthSessions_SetReclaim((auth_idle_timeout != NULL) ?
+                                        strtoul(auth_idle_timeout, NULL, 0) : 0,
+                                        (auth_lru_evict != NULL) &&
+                                        (strtoul(auth_lru_evict, NULL, 0) != 0));
+        }
+    }
+    /* optional number of transport session slots, must be set before the TPM state is
+       allocated */
+    if (rc == 0) {
+        trans_sessions = getenv("TPM_TRANS_SESSIONS");
+        if (trans_sessions != NULL) {
+            TPM_TransportSessions_SetSlots(strtoul(trans_sessions, NULL, 0));
+        }
+    }
+    /* optional number of saved session slots, must be set before the TPM state is allocated */
+    if (rc == 0) {
+        session_list = getenv("TPM_SESSION_LIST");
+        if (session_list != NULL) {
+            TPM_ContextList_SetSlots(strtoul(session_list, NULL, 0));
+        }
+    }
+    /* optional cache of saved contexts */
+    if (rc == 0) {
+        context_cache = getenv("TPM_CONTEXT_CACHE");
+        if (context_cache != NULL) {
+            TPM_ContextCache_SetEntries(strtoul(context_cache, NULL, 0));
+        }
+    }
+    /* optional number of family and delegate table rows, must be set before the TPM state is
+       allocated */
+    if (rc == 0) {
+        family_table_rows = getenv("TPM_FAMILY_TABLE_ROWS");
+        if (family_table_rows != NULL) {
+            TPM_FamilyTable_SetRows(strtoul(family_table_rows, NULL, 0));
+        }
+        delegate_table_rows = getenv("TPM_DELEGATE_TABLE_ROWS");
+        if (delegate_table_rows != NULL) {
+            TPM_DelegateTable_SetRows(strtoul(delegate_table_rows, NULL, 0));
+        }
+    }
     /* TPM_Init transitions the TPM from a power-off state to one where the TPM begins an
        initialization process.  TPM_Init could be the result of power being applied to the platform
        or a hard reset. */
     if (rc == 0) {
         rc = TPM_MainInit();
     }
+    /* optional group commit of permanent state writes */
+    if (rc == 0) {
+        group_commit = getenv("TPM_GROUP_COMMIT");
+        if (group_commit != NULL) {
+            group_commit_msec = strtoul(group_commit, NULL, 0);
+        }
+        printf("main: Group commit %u msec\n", group_commit_msec);
+        TPM_PermanentAll_SetGroupCommit(group_commit_msec != 0);
+    }
+    /* optional NV defined space size */
+    if (rc == 0) {
+        nv_defined_size = getenv("TPM_NV_DEFINED_SIZE");
+        if (nv_defined_size != NULL) {
+            TPM_NVIndexEntries_SetDefinedSize(strtoul(nv_defined_size, NULL, 0));
+        }
+    }
+    /* the NV names of the TPM must fit in the journal and the memory map.  Each NV defined space
+       index and owner evict key takes two names. */
+    if (rc == 0) {
+        rc = TPM_NVIndexEntries_GetMaxDataCount(&nv_data_count);
+    }
+    if (rc == 0) {
+        rc = TPM_NVRAM_CheckNames(TPM_NVRAM_FIXED_NAMES +
+                                  (2 * TPM_KeyHandleEntries_GetOwnerEvictKeyHandles()) +
+                                  (2 * nv_data_count));
+    }
+    /* optional resource manager, connections are kept open and handles are virtualized */
+    if (rc == 0) {
+        resource_manager_env = getenv("TPM_RESOURCE_MANAGER");
+        if (resource_manager_env != NULL) {
+            resource_manager = (strtoul(resource_manager_env, NULL, 0) != 0);
+        }
+        printf("main: Resource manager %s\n", resource_manager ? "enabled" : "disabled");
+        if (resource_manager) {
+            TPM_Resource_Init();
+        }
+    }
+    /* optional per connection quotas, 0 or unset is no limit */
+    if ((rc == 0) && resource_manager) {
+        connection_keys = getenv("TPM_CONNECTION_KEYS");
+        connection_auth_sessions = getenv("TPM_CONNECTION_AUTH_SESSIONS");
+        connection_trans_sessions = getenv("TPM_CONNECTION_TRANS_SESSIONS");
+        TPM_Resource_SetQuotas((connection_keys != NULL) ?
+                               strtoul(connection_keys, NULL, 0) : 0,
+                               (connection_auth_sessions != NULL) ?
+                               strtoul(connection_auth_sessions, NULL, 0) : 0,
+                               (connection_trans_sessions != NULL) ?
+                               strtoul(connection_trans_sessions, NULL, 0) : 0);
+    }
+#ifdef TPM_VOLATILE_STORE
+    /* write the volatile state checkpoint after the response rather than before it */
+    if (rc == 0) {
+        TPM_VolatileAll_SetDeferred(TRUE);
+    }
+#endif	/* TPM_VOLATILE_STORE */
     if (rc == 0) {
         mainLoop(NULL);
     }
@@ -163,6 +381,17 @@ static void mainLoop(void *mainLoopArgs)
     unsigned char 	*rbuffer = NULL;                        /* actual response bytes */
     uint32_t            rlength = 0;				/* bytes in response buffer */
     uint32_t		rTotal = 0;				/* total allocated bytes */
+    /* group commit */
+    TPM_HELD_RESPONSE	held[TPM_GROUP_COMMIT_RESPONSES];	/* responses waiting for NV */
+    size_t		heldCount = 0;
+    uint32_t		held_sec = 0;				/* time of the first held response */
+    uint32_t		held_usec = 0;
+    TPM_BOOL		hold;
+    TPM_BOOL		done;
+    uint32_t		msec;					/* time left in the batch */
+    size_t		readyIndex;
+    TPM_BOOL		found;
+    size_t		connectionIndex = 0;			/* resource manager connection */
 #if TPM_THREADED
     unsigned long       threadId;
 
@@ -174,10 +403,45 @@ static void mainLoop(void *mainLoopArgs)
 #endif    
     while (TRUE) {
         /* connect to the client */
-        if (rc == 0) {
+        if ((rc == 0) && !resource_manager) {
+            rc = TPM_Server_WaitConnect();
+        }
+        if ((rc == 0) && !resource_manager) {
             rc = TPM_IO_Connect(&connection_fd,
                                 mainLoopArgs);
         }
+        /* a newly accepted client may not have sent its command yet.  The held responses must
+           not wait for it beyond the end of the batch, so release them first. */
+        if ((rc == 0) && !resource_manager && (heldCount != 0)) {
+            rc = TPM_Server_BatchTimeout(&msec, held_sec, held_usec);
+            if (rc == 0) {
+                rc = TPM_IO_Select(&readyIndex, &connection_fd, 1, FALSE, msec);
+            }
+            if ((rc != 0) || (readyIndex != 0)) {
+                TPM_Server_ReleaseResponses(held, &heldCount);
+            }
+            rc = 0;
+        }
+        /* or wait for a command on an open connection.  While responses are held, the wait ends
+           with the batch, and the held responses are released before waiting further. */
+        if ((rc == 0) && resource_manager) {
+            found = FALSE;
+            while ((rc == 0) && !found) {
+                msec = TPM_IO_WAIT_FOREVER;
+                if (heldCount != 0) {
+                    rc = TPM_Server_BatchTimeout(&msec, held_sec, held_usec);
+                }
+                if ((rc != 0) || (msec == 0)) {
+                    TPM_Server_ReleaseResponses(held, &heldCount);
+                    msec = TPM_IO_WAIT_FOREVER;
+                    rc = 0;
+                }
+                rc = TPM_Server_NextConnection(&found, &connectionIndex, msec, mainLoopArgs);
+            }
+            if (rc == 0) {
+                connection_fd = connection_fds[connectionIndex];
+            }
+        }
         /* was connecting successful? */
         if (rc == 0) {
             /* Read the command.  The number of bytes is determined by 'paramSize' in the stream */
@@ -187,16 +451,60 @@ static void mainLoop(void *mainLoopArgs)
             }
             if (rc == 0) {
 		rlength = 0;				/* clear the response buffer */
-		rc = TPM_ProcessA(&rbuffer,
-				  &rlength,
-				  &rTotal,
-				  command,		/* complete command array */
-				  command_length);	/* actual bytes in command */
+		tpm_instances[0]->permanentStoreDeferred = FALSE;
+		if (!resource_manager) {
+		    rc = TPM_ProcessA(&rbuffer,
+				      &rlength,
+				      &rTotal,
+				      command,		/* complete command array */
+				      command_length);	/* actual bytes in command */
+		}
+		else {
+		    rc = TPM_Resource_Process(connection_ids[connectionIndex],
+					      &rbuffer,
+					      &rlength,
+					      &rTotal,
+					      command,
+					      command_length);
+		}
 	    }
+            /* under group commit, hold the response while a permanent state write is pending.
+               Once one response is held, later responses are held as well, so that no client
+               sees state that is not yet in NV. */
+            hold = FALSE;
+            if ((rc == 0) && (group_commit_msec != 0)) {
+                hold = (heldCount != 0) || tpm_instances[0]->permanentStorePending;
+            }
+            if ((rc == 0) && hold && (heldCount == 0)) {
+                rc = TPM_GetTimeOfDay(&held_sec, &held_usec);
+            }
+            if ((rc == 0) && hold) {
+                rc = TPM_Server_HoldResponse(&(held[heldCount]), &connection_fd,
+                                             rbuffer, rlength,
+                                             tpm_instances[0]->permanentStoreDeferred);
+                if (rc == 0) {
+                    heldCount++;
+                }
+            }
             /* write the results */
-            if (rc == 0) {
+            if ((rc == 0) && !hold) {
                 rc = TPM_IO_Write(&connection_fd, rbuffer, rlength);
             }
+#ifdef TPM_VOLATILE_STORE
+            /* write the volatile state checkpoint of the command.  A failure leaves the previous
+               checkpoint, and the next command retries. */
+            if (rc == 0) {
+                TPM_VolatileAll_NVFlush(tpm_instances[0]);
+            }
+#endif	/* TPM_VOLATILE_STORE */
+            /* complete a group commit of NV writes that is due.  The response was already sent,
+               so a failure only marks the permanent state to be written again. */
+            if ((rc == 0) && !hold) {
+                rc = TPM_NVRAM_Sync(FALSE);
+                if (rc != 0) {
+                    TPM_PermanentAll_NVRetry(tpm_instances[0]);
+                }
+            }
 #ifdef TPM_VOLATILE_STORE
 	    /* temporary code to test TPM_VOLATILE_STORE */
 #ifdef TPM_VOLATILE_TEST
@@ -213,13 +521,34 @@ static void mainLoop(void *mainLoopArgs)
 	    }
 #endif	/* temporary test code */
 #endif	/* TPM_VOLATILE_STORE */
-            /* disconnect from the client, do this even if the read or write fails */
-            rc = TPM_IO_Disconnect(&connection_fd);
+            /* disconnect from the client, do this even if the read or write fails.  A held
+               response keeps its connection until it is released.  Under the resource manager,
+               the connection stays open until the client closes it. */
+            if (resource_manager) {
+                if (rc != 0) {
+                    /* a held response may be for this connection */
+                    if (heldCount != 0) {
+                        TPM_Server_ReleaseResponses(held, &heldCount);
+                    }
+                    TPM_Server_CloseConnection(connectionIndex);
+                }
+            }
+            else if (!hold || (rc != 0)) {
+                rc = TPM_IO_Disconnect(&connection_fd);
+            }
         }
         /* clear the response buffer, does not deallocate memory */
         rc = 0; /* A fatal TPM_Process() error should cause the TPM to enter shutdown.  IO errors
                    are outside the TPM, so the TPM does not shut down.  The main loop should
                    continue to function.*/
+        /* at the end of a batch, write NV once and release the held responses */
+        if (heldCount != 0) {
+            rc = TPM_Server_IsBatchDone(&done, heldCount, held_sec, held_usec);
+            if ((rc != 0) || done) {
+                TPM_Server_ReleaseResponses(held, &heldCount);
+            }
+            rc = 0;
+        }
     }
 #ifdef TPM_POSIX
     return NULL;
@@ -228,3 +557,247 @@ static void mainLoop(void *mainLoopArgs)
     return;
 #endif
 }
+
+/* TPM_Server_HoldResponse() saves a copy of the response and the client connection.  'deferred' is
+   TRUE if the command deferred a permanent state write.
+*/
+
+static TPM_RESULT TPM_Server_HoldResponse(TPM_HELD_RESPONSE *held,
+					  TPM_CONNECTION_FD *connection_fd,
+					  const unsigned char *rbuffer,
+					  uint32_t rlength,
+					  TPM_BOOL deferred)
+{
+    TPM_RESULT	rc = 0;
+
+    printf(" TPM_Server_HoldResponse: Holding %u bytes\n", rlength);
+    held->rbuffer = NULL;
+    held->rlength = rlength;
+    held->deferred = deferred;
+    if (rc == 0) {
+	rc = TPM_Malloc(&(held->rbuffer), rlength);
+    }
+    if (rc == 0) {
+	memcpy(held->rbuffer, rbuffer, rlength);
+	held->connection_fd = *connection_fd;
+    }
+    return rc;
+}
+
+/* TPM_Server_BatchTimeout() returns the time left until the batch that began with the held response
+   at 'held_sec', 'held_usec' ends, 0 if it has ended.
+*/
+
+static TPM_RESULT TPM_Server_BatchTimeout(uint32_t *msec,
+					  uint32_t held_sec,
+					  uint32_t held_usec)
+{
+    TPM_RESULT	rc = 0;
+    uint32_t	now_sec;
+    uint32_t	now_usec;
+    uint32_t	elapsed;
+
+    *msec = 0;
+    rc = TPM_GetTimeOfDay(&now_sec, &now_usec);
+    if (rc == 0) {
+	if ((now_sec - held_sec) >= ((group_commit_msec / 1000) + 1)) {
+	    elapsed = group_commit_msec;		/* saturate rather than wrap */
+	}
+	else {
+	    elapsed = (((now_sec - held_sec) * 1000000) + now_usec - held_usec) / 1000;
+	}
+	if (elapsed < group_commit_msec) {
+	    *msec = group_commit_msec - elapsed;
+	}
+    }
+    return rc;
+}
+
+/* TPM_Server_IsBatchDone() returns 'done' TRUE if the held responses should be released.
+
+   The batch continues while another client is waiting, up to TPM_GROUP_COMMIT_RESPONSES responses
+   and group_commit_msec since the first held response.
+*/
+
+static TPM_RESULT TPM_Server_IsBatchDone(TPM_BOOL *done,
+					 size_t heldCount,
+					 uint32_t held_sec,
+					 uint32_t held_usec)
+{
+    TPM_RESULT	rc = 0;
+    TPM_BOOL	pending = FALSE;
+    uint32_t	msec;
+    size_t	readyIndex;
+
+    *done = TRUE;
+    if ((heldCount < TPM_GROUP_COMMIT_RESPONSES) && !resource_manager) {
+	rc = TPM_IO_IsConnectPending(&pending, 0);
+    }
+    /* under the resource manager, a command on an open connection also continues the batch */
+    if ((heldCount < TPM_GROUP_COMMIT_RESPONSES) && resource_manager) {
+	rc = TPM_IO_Select(&readyIndex, connection_fds, connectionCount,
+			   (connectionCount < TPM_SERVER_CONNECTIONS), 0);
+	pending = (readyIndex <= connectionCount);
+    }
+    if ((rc == 0) && pending) {
+	rc = TPM_Server_BatchTimeout(&msec, held_sec, held_usec);
+    }
+    if ((rc == 0) && pending) {
+	*done = (msec == 0);
+    }
+    return rc;
+}
+
+/* TPM_Server_ReleaseResponses() writes the deferred permanent state to NV and then sends the held
+   responses.
+
+   If the NV write fails, the commands that deferred a permanent state write cannot report success,
+   and a TPM_FAIL response is sent instead.  The other commands did not change the permanent state,
+   and their responses are sent as is.  The state is kept in memory, and the write is retried by
+   the next flush.
+*/
+
+static void TPM_Server_ReleaseResponses(TPM_HELD_RESPONSE *held,
+					size_t *heldCount)
+{
+    TPM_RESULT		rc = 0;
+    TPM_STORE_BUFFER	failResponse;
+    const unsigned char *buffer;
+    uint32_t		length;
+    size_t		i;
+
+    printf(" TPM_Server_ReleaseResponses: Releasing %lu responses\n", (unsigned long)*heldCount);
+    TPM_Sbuffer_Init(&failResponse);	/* freed @1 */
+    /* one NV write covers all held commands */
+    if (rc == 0) {
+	rc = TPM_PermanentAll_NVFlush(tpm_instances[0]);
+    }
+    if (rc == 0) {
+	rc = TPM_NVRAM_Sync(FALSE);
+    }
+    if (rc != 0) {
+	printf("TPM_Server_ReleaseResponses: Error (fatal) writing NV, rc %08x\n", rc);
+	TPM_PermanentAll_NVRetry(tpm_instances[0]);
+	TPM_Sbuffer_StoreInitialResponse(&failResponse, TPM_TAG_RQU_COMMAND, TPM_FAIL);
+    }
+    for (i = 0 ; i < *heldCount ; i++) {
+	if ((rc == 0) || !held[i].deferred) {
+	    TPM_IO_Write(&(held[i].connection_fd), held[i].rbuffer, held[i].rlength);
+	}
+	else {
+	    TPM_Sbuffer_Get(&failResponse, &buffer, &length);
+	    TPM_IO_Write(&(held[i].connection_fd), buffer, length);
+	}
+	if (!resource_manager) {
+	    TPM_IO_Disconnect(&(held[i].connection_fd));
+	}
+	free(held[i].rbuffer);
+	held[i].rbuffer = NULL;
+    }
+    *heldCount = 0;
+    TPM_Sbuffer_Delete(&failResponse);	/* @1 */
+    return;
+}
+
+/* TPM_Server_IdleTimeout() returns the time that the server may wait for a client.
+
+   While NV writes wait for a group sync, this is the time left in the TPM_NV_SYNC interval, and a
+   sync that is already due is done first.  Otherwise, the server waits without a limit.
+*/
+
+static TPM_RESULT TPM_Server_IdleTimeout(uint32_t *msec)
+{
+    TPM_RESULT	rc = 0;
+    TPM_BOOL	pending;
+
+    rc = TPM_NVRAM_SyncTimeout(&pending, msec);
+    /* the responses were already sent, so a failure only marks the permanent state to be written
+       again */
+    if ((rc == 0) && pending && (*msec == 0)) {
+	rc = TPM_NVRAM_Sync(FALSE);
+	if (rc != 0) {
+	    TPM_PermanentAll_NVRetry(tpm_instances[0]);
+	}
+	rc = TPM_NVRAM_SyncTimeout(&pending, msec);
+    }
+    if ((rc == 0) && !pending) {
+	*msec = TPM_IO_WAIT_FOREVER;
+    }
+    return rc;
+}
+
+/* TPM_Server_WaitConnect() returns when a client connection is waiting to be accepted, or when
+   there is no NV write left to sync.  TPM_IO_Connect() then blocks until a client connects.
+*/
+
+static TPM_RESULT TPM_Server_WaitConnect(void)
+{
+    TPM_RESULT	rc = 0;
+    TPM_BOOL	pending = FALSE;
+    uint32_t	msec = 0;
+
+    while ((rc == 0) && !pending && (msec != TPM_IO_WAIT_FOREVER)) {
+	rc = TPM_Server_IdleTimeout(&msec);
+	if ((rc == 0) && (msec != TPM_IO_WAIT_FOREVER)) {
+	    rc = TPM_IO_IsConnectPending(&pending, msec);
+	}
+    }
+    return rc;
+}
+
+/* TPM_Server_NextConnection() waits up to 'msec' for a command on an open connection.  'found' is
+   TRUE and 'connectionIndex' is the index of the connection if there is one.
+
+   New client connections are accepted while waiting, up to TPM_SERVER_CONNECTIONS.  While NV
+   writes wait for a group sync, the wait expires with the TPM_NV_SYNC interval and the writes are
+   synced.
+*/
+
+static TPM_RESULT TPM_Server_NextConnection(TPM_BOOL *found,
+					    size_t *connectionIndex,
+					    uint32_t msec,
+					    void *mainLoopArgs)
+{
+    TPM_RESULT	rc = 0;
+    size_t	readyIndex;
+    uint32_t	idle_msec;
+
+    *found = FALSE;
+    rc = TPM_Server_IdleTimeout(&idle_msec);
+    if (rc == 0) {
+	rc = TPM_IO_Select(&readyIndex, connection_fds, connectionCount,
+			   (connectionCount < TPM_SERVER_CONNECTIONS),
+			   (idle_msec < msec) ? idle_msec : msec);
+    }
+    if ((rc == 0) && (readyIndex < connectionCount)) {
+	*connectionIndex = readyIndex;
+	*found = TRUE;
+    }
+    else if ((rc == 0) && (readyIndex == connectionCount)) {
+	rc = TPM_IO_Connect(&(connection_fds[connectionCount]), mainLoopArgs);
+	if (rc == 0) {
+	    rc = TPM_Resource_Connect(&(connection_ids[connectionCount]));
+	    if (rc == 0) {
+		connectionCount++;
+	    }
+	    else {
+		TPM_IO_Disconnect(&(connection_fds[connectionCount]));
+	    }
+	}
+	printf(" TPM_Server_NextConnection: %lu connections\n", (unsigned long)connectionCount);
+    }
+    return rc;
+}
+
+/* TPM_Server_CloseConnection() flushes the objects of a closed connection and removes it */
+
+static void TPM_Server_CloseConnection(size_t connectionIndex)
+{
+    printf(" TPM_Server_CloseConnection: Connection %u\n", connection_ids[connectionIndex]);
+    TPM_Resource_Disconnect(connection_ids[connectionIndex]);
+    TPM_IO_Disconnect(&(connection_fds[connectionIndex]));
+    connectionCount--;
+    connection_fds[connectionIndex] = connection_fds[connectionCount];
+    connection_ids[connectionIndex] = connection_ids[connectionCount];
+    return;
+}
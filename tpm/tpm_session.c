@@ -53,19 +53,56 @@
 #include "tpm_init.h"
 #include "tpm_io.h"
 #include "tpm_key.h"
+#include "tpm_memory.h"
 #include "tpm_nonce.h"
 #include "tpm_nvram.h"
 #include "tpm_pcr.h"
 #include "tpm_process.h"
 #include "tpm_permanent.h"
 #include "tpm_secret.h"
+#include "tpm_time.h"
 #include "tpm_transport.h"
 #include "tpm_types.h"
 
 #include "tpm_session.h"
 
+/* The number of authorization session slots of tables initialized by TPM_AuthSessions_Init() */
+static uint32_t tpm_auth_session_slots = TPM_MIN_AUTH_SESSIONS;
+/* The session reclamation policy, see TPM_AuthSessions_SetReclaim() */
+static uint32_t tpm_auth_session_idle_timeout = 0;
+static TPM_BOOL tpm_auth_session_lru_evict = FALSE;
+/* session churn statistics since power on */
+static TPM_AUTH_SESSION_METRICS tpm_auth_session_metrics_all;
+/* The number of saved session slots of lists initialized by TPM_ContextList_Init() */
+static uint32_t tpm_context_list_slots = TPM_MIN_SESSION_LIST;
+/* saved session statistics since power on */
+static TPM_CONTEXT_LIST_METRICS tpm_context_list_metrics_all;
+/* The context cache, see TPM_ContextCache_SetEntries() */
+static TPM_CONTEXT_CACHE_ENTRY *tpm_context_cache = NULL;
+static uint32_t tpm_context_cache_entries = 0;
+static uint32_t tpm_context_cache_next = 0;	/* next entry to replace */
+
 /* local function prototypes */
 
+static TPM_CONTEXT_CACHE_ENTRY *TPM_ContextCache_Find(const TPM_CONTEXT_BLOB *tpm_context_blob,
+						      const TPM_SECRET tpmProof);
+
+static TPM_RESULT TPM_ContextList_Allocate(TPM_CONTEXT_LIST *contextList);
+static uint32_t TPM_ContextList_Hash(const TPM_CONTEXT_LIST *contextList,
+				     uint32_t value);
+
+static TPM_RESULT TPM_AuthSessions_Allocate(TPM_AUTH_SESSIONS *authSessions);
+static uint32_t TPM_AuthSessions_Hash(TPM_AUTH_SESSIONS *authSessions,
+				      TPM_AUTHHANDLE authHandle);
+static void TPM_AuthSessions_Touch(TPM_AUTH_SESSIONS *authSessions,
+				   uint32_t slot);
+static void TPM_AuthSessions_Remove(TPM_AUTH_SESSIONS *authSessions,
+				    uint32_t slot);
+static void TPM_AuthSessions_Insert(TPM_AUTH_SESSIONS *authSessions,
+				    uint32_t index,
+				    TPM_AUTHHANDLE authHandle);
+static void TPM_AuthSessions_Reclaim(TPM_AUTH_SESSIONS *authSessions);
+
 static TPM_RESULT TPM_OSAPDelegate(TPM_DIGEST **entityDigest,
 				   TPM_SECRET **authData,
 				   TPM_AUTH_SESSION_DATA *authSession,
@@ -101,6 +138,8 @@ static TPM_RESULT TPM_LoadContext_CheckNvLoaded(tpm_state_t *tpm_state,
 
 void TPM_AuthSessionData_Init(TPM_AUTH_SESSION_DATA *tpm_auth_session_data)
 {
+    size_t i;
+
     printf(" TPM_AuthSessionData_Init:\n");
     tpm_auth_session_data->handle = 0;
     tpm_auth_session_data->protocolID = 0;
@@ -111,6 +150,10 @@ void TPM_AuthSessionData_Init(TPM_AUTH_SESSION_DATA *tpm_auth_session_data)
     TPM_Digest_Init(tpm_auth_session_data->entityDigest);
     TPM_DelegatePublic_Init(&(tpm_auth_session_data->pub));
     tpm_auth_session_data->valid = FALSE;
+    for (i = 0 ; i < TPM_AUTH_SESSION_HMAC_SCHEDULES ; i++) {
+	TPM_HmacSchedule_Init(&(tpm_auth_session_data->hmacSchedules[i]));
+    }
+    tpm_auth_session_data->hmacScheduleNext = 0;
     return;
 }
 
@@ -228,9 +271,14 @@ TPM_RESULT TPM_AuthSessionData_Store(TPM_STORE_BUFFER *sbuffer,
 
 void TPM_AuthSessionData_Delete(TPM_AUTH_SESSION_DATA *tpm_auth_session_data)
 {
+    size_t i;
+
     printf(" TPM_AuthSessionData_Delete:\n");
     if (tpm_auth_session_data != NULL) {
 	TPM_DelegatePublic_Delete(&(tpm_auth_session_data->pub));
+	for (i = 0 ; i < TPM_AUTH_SESSION_HMAC_SCHEDULES ; i++) {
+	    TPM_HmacSchedule_Delete(&(tpm_auth_session_data->hmacSchedules[i]));
+	}
 	TPM_AuthSessionData_Init(tpm_auth_session_data);
     }
     return;
@@ -238,12 +286,20 @@ void TPM_AuthSessionData_Delete(TPM_AUTH_SESSION_DATA *tpm_auth_session_data)
 
 /* TPM_AuthSessionData_Copy() copies the source to the destination.  The source handle is ignored,
    since it might already be used.
+
+   The HMAC key schedules are not copied.  The destination schedules are recalculated on first use.
 */
 
 void TPM_AuthSessionData_Copy(TPM_AUTH_SESSION_DATA *dest_auth_session_data,
 			      TPM_HANDLE tpm_handle,
 			      TPM_AUTH_SESSION_DATA *src_auth_session_data)
 {
+    size_t i;
+
+    for (i = 0 ; i < TPM_AUTH_SESSION_HMAC_SCHEDULES ; i++) {
+	TPM_HmacSchedule_Delete(&(dest_auth_session_data->hmacSchedules[i]));
+    }
+    dest_auth_session_data->hmacScheduleNext = 0;
     dest_auth_session_data->handle = tpm_handle;
     dest_auth_session_data->protocolID = src_auth_session_data->protocolID;
     dest_auth_session_data->entityTypeByte = src_auth_session_data->entityTypeByte;
@@ -269,6 +325,49 @@ TPM_RESULT TPM_AuthSessionData_GetDelegatePublic(TPM_DELEGATE_PUBLIC **delegateP
     return rc;	 
 }
 
+/* TPM_AuthSessionData_GetHmacSchedule() returns the cached HMAC key schedule to be used with
+   'hmacKey'.
+
+   For OSAP and DSAP sessions, the key is always the shared secret, so the first schedule is reused
+   for the life of the session.  OIAP sessions may authorize several entities, so the schedule with
+   a matching key is returned if present.  Otherwise an unused schedule or, round robin, the oldest
+   one is returned, and is recalculated by the HMAC function.
+
+   Returns NULL if the session is not valid, so that secrets are never cached in a free slot.
+*/
+
+void TPM_AuthSessionData_GetHmacSchedule(TPM_HMAC_SCHEDULE **tpm_hmac_schedule,
+					 TPM_AUTH_SESSION_DATA *auth_session_data,
+					 const TPM_SECRET hmacKey)
+{
+    size_t i;
+
+    *tpm_hmac_schedule = NULL;
+    if (auth_session_data->valid) {
+	/* look for a schedule calculated from this key */
+	for (i = 0 ; (i < TPM_AUTH_SESSION_HMAC_SCHEDULES) && (*tpm_hmac_schedule == NULL) ; i++) {
+	    if (auth_session_data->hmacSchedules[i].valid &&
+		(memcmp(auth_session_data->hmacSchedules[i].key, hmacKey, TPM_SECRET_SIZE) == 0)) {
+		*tpm_hmac_schedule = &(auth_session_data->hmacSchedules[i]);
+	    }
+	}
+	/* look for an unused schedule */
+	for (i = 0 ; (i < TPM_AUTH_SESSION_HMAC_SCHEDULES) && (*tpm_hmac_schedule == NULL) ; i++) {
+	    if (!(auth_session_data->hmacSchedules[i].valid)) {
+		*tpm_hmac_schedule = &(auth_session_data->hmacSchedules[i]);
+	    }
+	}
+	/* replace a schedule round robin */
+	if (*tpm_hmac_schedule == NULL) {
+	    *tpm_hmac_schedule =
+		&(auth_session_data->hmacSchedules[auth_session_data->hmacScheduleNext]);
+	    auth_session_data->hmacScheduleNext =
+		(auth_session_data->hmacScheduleNext + 1) % TPM_AUTH_SESSION_HMAC_SCHEDULES;
+	}
+    }
+    return;
+}
+
 /* TPM_AuthSessionData_CheckEncScheme() checks that the encryption scheme specified by
    TPM_ENTITY_TYPE is supported by the TPM (by TPM_AuthSessionData_Decrypt)
 */
@@ -411,13 +510,305 @@ TPM_RESULT TPM_AuthSessionData_Decrypt(TPM_DIGEST a1Even,
   TPM_AUTH_SESSION_DATA (the entire array)
 */
 
-void TPM_AuthSessions_Init(TPM_AUTH_SESSION_DATA *authSessions)
+/* TPM_AuthSessions_SetSlots() sets the number of authorization session slots of tables initialized
+   by subsequent calls to TPM_AuthSessions_Init(), overriding TPM_MIN_AUTH_SESSIONS.
+
+   TPM_MIN_AUTH_SESSIONS remains the minimum.  The maximum is the session array that TPM_Malloc()
+   can allocate.
+*/
+
+void TPM_AuthSessions_SetSlots(uint32_t slots)
 {
-    size_t i;
-    
-    printf(" TPM_AuthSessions_Init:\n");
-    for (i = 0 ; i < TPM_MIN_AUTH_SESSIONS ; i++) {
-	TPM_AuthSessionData_Init(&(authSessions[i]));
+    uint32_t maxSlots = TPM_ALLOC_MAX / sizeof(TPM_AUTH_SESSION_DATA);
+
+    if (slots < TPM_MIN_AUTH_SESSIONS) {
+	printf("TPM_AuthSessions_SetSlots: %u raised to minimum %u\n",
+	       slots, TPM_MIN_AUTH_SESSIONS);
+	slots = TPM_MIN_AUTH_SESSIONS;
+    }
+    if (slots > maxSlots) {
+	printf("TPM_AuthSessions_SetSlots: %u lowered to maximum %u\n", slots, maxSlots);
+	slots = maxSlots;
+    }
+    printf(" TPM_AuthSessions_SetSlots: %u\n", slots);
+    tpm_auth_session_slots = slots;
+    return;
+}
+
+/* TPM_AuthSessions_SetReclaim() sets the policy for reclaiming abandoned sessions when a new
+   session is created.
+
+   If 'idleTimeout' is non-zero, sessions not used for an authorization for that many seconds are
+   terminated.  If 'lruEvict' is TRUE and the table is still full, the least recently used session
+   is terminated.
+
+   The default is neither, as the specification leaves session management to the caller.
+*/
+
+void TPM_AuthSessions_SetReclaim(uint32_t idleTimeout, TPM_BOOL lruEvict)
+{
+    printf(" TPM_AuthSessions_SetReclaim: idle timeout %u sec, LRU eviction %u\n",
+	   idleTimeout, lruEvict);
+    tpm_auth_session_idle_timeout = idleTimeout;
+    tpm_auth_session_lru_evict = lruEvict;
+    return;
+}
+
+/* TPM_AuthSessions_GetMetrics() returns a copy of the session churn statistics */
+
+void TPM_AuthSessions_GetMetrics(TPM_AUTH_SESSION_METRICS *tpm_auth_session_metrics)
+{
+    *tpm_auth_session_metrics = tpm_auth_session_metrics_all;
+    return;
+}
+
+/* TPM_AuthSessions_Init() sets the table to the configured number of empty slots.
+
+   The arrays are allocated on first use by TPM_AuthSessions_Allocate().  Once allocated, they are
+   kept and reset, since an ordinal that invalidates all sessions may still hold a pointer to its
+   own session for the response.  TPM_AuthSessions_Free() frees them.
+
+   Before the first call, the structure must be zero, as done by TPM_Global_Init().
+*/
+
+void TPM_AuthSessions_Init(TPM_AUTH_SESSIONS *authSessions)
+{
+    uint32_t i;
+
+    printf(" TPM_AuthSessions_Init: %u slots\n",
+	   (authSessions->entries != NULL) ? authSessions->slots : tpm_auth_session_slots);
+    if (authSessions->entries == NULL) {
+	authSessions->slots = tpm_auth_session_slots;
+	authSessions->links = NULL;
+	authSessions->buckets = NULL;
+	authSessions->hashSize = 0;
+	authSessions->freeHead = 0;
+    }
+    /* chain all slots on the free list, in order */
+    else {
+	for (i = 0 ; i < authSessions->slots ; i++) {
+	    TPM_AuthSessionData_Init(&(authSessions->entries[i]));
+	    authSessions->links[i].next = ((i + 1) < authSessions->slots) ? (i + 2) : 0;
+	    authSessions->links[i].lruPrev = 0;
+	    authSessions->links[i].lruNext = 0;
+	    authSessions->links[i].lastUsed = 0;
+	}
+	for (i = 0 ; i < authSessions->hashSize ; i++) {
+	    authSessions->buckets[i] = 0;
+	}
+	authSessions->freeHead = 1;
+    }
+    authSessions->freeCount = authSessions->slots;
+    authSessions->lruHead = 0;
+    authSessions->lruTail = 0;
+    return;
+}
+
+/* TPM_AuthSessions_Allocate() allocates the arrays of an initialized table, if not already done.
+   All slots are empty and on the free list.
+*/
+
+static TPM_RESULT TPM_AuthSessions_Allocate(TPM_AUTH_SESSIONS *authSessions)
+{
+    TPM_RESULT	rc = 0;
+
+    if (authSessions->entries == NULL) {
+	printf(" TPM_AuthSessions_Allocate: %u slots\n", authSessions->slots);
+	/* the hash size is the smallest power of 2 not less than the number of slots */
+	for (authSessions->hashSize = 1 ;
+	     authSessions->hashSize < authSessions->slots ;
+	     authSessions->hashSize <<= 1) ;
+	if (rc == 0) {
+	    rc = TPM_Malloc((unsigned char **)&(authSessions->links),
+			    authSessions->slots * sizeof(TPM_AUTH_SESSION_SLOT));
+	}
+	if (rc == 0) {
+	    rc = TPM_Malloc((unsigned char **)&(authSessions->buckets),
+			    authSessions->hashSize * sizeof(uint32_t));
+	}
+	if (rc == 0) {
+	    rc = TPM_Malloc((unsigned char **)&(authSessions->entries),
+			    authSessions->slots * sizeof(TPM_AUTH_SESSION_DATA));
+	}
+	if (rc == 0) {
+	    TPM_AuthSessions_Init(authSessions);
+	}
+	/* entries is the allocated flag, so free the others on failure */
+	else {
+	    free(authSessions->links);
+	    free(authSessions->buckets);
+	    authSessions->links = NULL;
+	    authSessions->buckets = NULL;
+	}
+    }
+    return rc;
+}
+
+/* TPM_AuthSessions_Free() frees the table arrays.  The table must be initialized again before
+   use.
+*/
+
+void TPM_AuthSessions_Free(TPM_AUTH_SESSIONS *authSessions)
+{
+    printf(" TPM_AuthSessions_Free:\n");
+    free(authSessions->entries);
+    free(authSessions->links);
+    free(authSessions->buckets);
+    authSessions->entries = NULL;
+    TPM_AuthSessions_Init(authSessions);
+    return;
+}
+
+/* TPM_AuthSessions_Hash() returns the hash chain for the session handle */
+
+static uint32_t TPM_AuthSessions_Hash(TPM_AUTH_SESSIONS *authSessions,
+				      TPM_AUTHHANDLE authHandle)
+{
+    uint32_t hash;
+
+    hash = authHandle * 0x9e3779b1;
+    hash ^= hash >> 16;
+    return hash & (authSessions->hashSize - 1);
+}
+
+/* TPM_AuthSessions_Touch() marks a valid slot as the most recently used */
+
+static void TPM_AuthSessions_Touch(TPM_AUTH_SESSIONS *authSessions,
+				   uint32_t slot)
+{
+    TPM_AUTH_SESSION_SLOT	*link = &(authSessions->links[slot]);
+    uint32_t			tv_sec;
+    uint32_t			tv_usec;
+
+    /* unlink from the use order, if already there */
+    if (authSessions->lruTail != (slot + 1)) {
+	if ((link->lruPrev != 0) || (authSessions->lruHead == (slot + 1))) {
+	    if (link->lruPrev != 0) {
+		authSessions->links[link->lruPrev - 1].lruNext = link->lruNext;
+	    }
+	    else {
+		authSessions->lruHead = link->lruNext;
+	    }
+	    authSessions->links[link->lruNext - 1].lruPrev = link->lruPrev;
+	}
+	/* append as the most recently used */
+	link->lruPrev = authSessions->lruTail;
+	link->lruNext = 0;
+	if (authSessions->lruTail != 0) {
+	    authSessions->links[authSessions->lruTail - 1].lruNext = slot + 1;
+	}
+	else {
+	    authSessions->lruHead = slot + 1;
+	}
+	authSessions->lruTail = slot + 1;
+    }
+    /* the clock is only needed for the idle timeout */
+    if (tpm_auth_session_idle_timeout != 0) {
+	if (TPM_GetTimeOfDay(&tv_sec, &tv_usec) == 0) {
+	    link->lastUsed = tv_sec;
+	}
+    }
+    return;
+}
+
+/* TPM_AuthSessions_Remove() terminates the session in a valid slot, unlinks the slot from its hash
+   chain and the use order, and returns it to the free list.
+*/
+
+static void TPM_AuthSessions_Remove(TPM_AUTH_SESSIONS *authSessions,
+				    uint32_t slot)
+{
+    TPM_AUTH_SESSION_SLOT	*link = &(authSessions->links[slot]);
+    uint32_t			*chain;
+
+    chain = &(authSessions->buckets[TPM_AuthSessions_Hash(authSessions,
+							  authSessions->entries[slot].handle)]);
+    while ((*chain != 0) && (*chain != (slot + 1))) {
+	chain = &(authSessions->links[*chain - 1].next);
+    }
+    if (*chain != 0) {
+	*chain = link->next;
+    }
+    if (link->lruPrev != 0) {
+	authSessions->links[link->lruPrev - 1].lruNext = link->lruNext;
+    }
+    else {
+	authSessions->lruHead = link->lruNext;
+    }
+    if (link->lruNext != 0) {
+	authSessions->links[link->lruNext - 1].lruPrev = link->lruPrev;
+    }
+    else {
+	authSessions->lruTail = link->lruPrev;
+    }
+    link->lruPrev = 0;
+    link->lruNext = 0;
+    TPM_AuthSessionData_Delete(&(authSessions->entries[slot]));
+    link->next = authSessions->freeHead;
+    authSessions->freeHead = slot + 1;
+    authSessions->freeCount++;
+    return;
+}
+
+/* TPM_AuthSessions_Insert() fills the free slot 'index', taking it from the free list and chaining
+   it from the handle hash as the most recently used.
+*/
+
+static void TPM_AuthSessions_Insert(TPM_AUTH_SESSIONS *authSessions,
+				    uint32_t index,
+				    TPM_AUTHHANDLE authHandle)
+{
+    uint32_t	bucket;
+    uint32_t	active;
+
+    authSessions->freeHead = authSessions->links[index].next;
+    authSessions->freeCount--;
+    authSessions->entries[index].handle = authHandle;
+    authSessions->entries[index].valid = TRUE;
+    bucket = TPM_AuthSessions_Hash(authSessions, authHandle);
+    authSessions->links[index].next = authSessions->buckets[bucket];
+    authSessions->buckets[bucket] = index + 1;
+    TPM_AuthSessions_Touch(authSessions, index);
+    tpm_auth_session_metrics_all.created++;
+    active = authSessions->slots - authSessions->freeCount;
+    if (active > tpm_auth_session_metrics_all.peak) {
+	tpm_auth_session_metrics_all.peak = active;
+    }
+    return;
+}
+
+/* TPM_AuthSessions_Reclaim() applies the TPM_AuthSessions_SetReclaim() policy before a new session
+   is created.
+
+   Sessions idle for at least the timeout are terminated, oldest first.  If the table is still full
+   and LRU eviction is enabled, the least recently used session is terminated.
+*/
+
+static void TPM_AuthSessions_Reclaim(TPM_AUTH_SESSIONS *authSessions)
+{
+    uint32_t	tv_sec;
+    uint32_t	tv_usec;
+    uint32_t	slot;
+
+    if ((tpm_auth_session_idle_timeout != 0) &&
+	(TPM_GetTimeOfDay(&tv_sec, &tv_usec) == 0)) {
+	while ((authSessions->lruHead != 0) &&
+	       ((tv_sec - authSessions->links[authSessions->lruHead - 1].lastUsed) >=
+		tpm_auth_session_idle_timeout)) {
+	    slot = authSessions->lruHead - 1;
+	    printf("  TPM_AuthSessions_Reclaim: Expiring idle handle %08x\n",
+		   authSessions->entries[slot].handle);
+	    TPM_AuthSessions_Remove(authSessions, slot);
+	    tpm_auth_session_metrics_all.expired++;
+	}
+    }
+    if (tpm_auth_session_lru_evict &&
+	(authSessions->freeHead == 0) && (authSessions->lruHead != 0)) {
+	slot = authSessions->lruHead - 1;
+	printf("  TPM_AuthSessions_Reclaim: Evicting least recently used handle %08x\n",
+	       authSessions->entries[slot].handle);
+	TPM_AuthSessions_Remove(authSessions, slot);
+	tpm_auth_session_metrics_all.evicted++;
     }
     return;
 }
@@ -432,13 +823,15 @@ void TPM_AuthSessions_Init(TPM_AUTH_SESSION_DATA *authSessions)
    Before use, call TPM_AuthSessions_Init()
 */
 
-TPM_RESULT TPM_AuthSessions_Load(TPM_AUTH_SESSION_DATA *authSessions,
+TPM_RESULT TPM_AuthSessions_Load(TPM_AUTH_SESSIONS *authSessions,
 				 unsigned char **stream,
 				 uint32_t *stream_size)
 {
     TPM_RESULT		rc = 0;
     size_t		i;
     uint32_t		activeCount;
+    TPM_AUTH_SESSION_DATA tpm_auth_session_data;	/* each session as read from the stream */
+    TPM_AUTHHANDLE	authHandle;
 
     printf(" TPM_AuthSessions_Load:\n");
     /* load active count */
@@ -447,9 +840,9 @@ TPM_RESULT TPM_AuthSessions_Load(TPM_AUTH_SESSION_DATA *authSessions,
     }
     /* load authorization sessions */
     if (rc == 0) {
-	if (activeCount > TPM_MIN_AUTH_SESSIONS) {
+	if (activeCount > authSessions->slots) {
 	    printf("TPM_AuthSessions_Load: Error (fatal) %u sessions, %u slots\n",
-		   activeCount, TPM_MIN_AUTH_SESSIONS);
+		   activeCount, authSessions->slots);
 	    rc = TPM_FAIL;
 	}
     }    
@@ -457,7 +850,17 @@ TPM_RESULT TPM_AuthSessions_Load(TPM_AUTH_SESSION_DATA *authSessions,
 	printf(" TPM_AuthSessions_Load: Loading %u sessions\n", activeCount);
     }
     for (i = 0 ; (rc == 0) && (i < activeCount) ; i++) {
-	rc = TPM_AuthSessionData_Load(&(authSessions[i]), stream, stream_size);
+	TPM_AuthSessionData_Init(&tpm_auth_session_data);	/* freed @1 */
+	rc = TPM_AuthSessionData_Load(&tpm_auth_session_data, stream, stream_size);
+	/* add the session to the table, keeping its handle */
+	if (rc == 0) {
+	    authHandle = tpm_auth_session_data.handle;
+	    rc = TPM_AuthSessions_AddEntry(&authHandle,
+					   TRUE,		/* keep handle */
+					   authSessions,
+					   &tpm_auth_session_data);
+	}
+	TPM_AuthSessionData_Delete(&tpm_auth_session_data);	/* @1 */
     }
     return rc;
 }
@@ -469,72 +872,79 @@ TPM_RESULT TPM_AuthSessions_Load(TPM_AUTH_SESSION_DATA *authSessions,
 */
 
 TPM_RESULT TPM_AuthSessions_Store(TPM_STORE_BUFFER *sbuffer,
-				  TPM_AUTH_SESSION_DATA *authSessions)
+				  TPM_AUTH_SESSIONS *authSessions)
 {
     TPM_RESULT		rc = 0;
     size_t		i;
-    uint32_t		space;		/* free authorization session slots */
     uint32_t		activeCount;	/* used authorization session slots */
     
     /* store active count */
     if (rc == 0) {
-	TPM_AuthSessions_GetSpace(&space, authSessions);
-	activeCount = TPM_MIN_AUTH_SESSIONS - space;
+	activeCount = authSessions->slots - authSessions->freeCount;
 	printf(" TPM_AuthSessions_Store: Storing %u sessions\n", activeCount);
 	rc = TPM_Sbuffer_Append32(sbuffer, activeCount);
     }
     /* store auth sessions */
-    for (i = 0 ; (rc == 0) && (i < TPM_MIN_AUTH_SESSIONS) ; i++) {
-	if ((authSessions[i]).valid) {	  /* if the session is active */
-	    printf("  TPM_AuthSessions_Store: Storing %08x\n", authSessions[i].handle);
-	    rc = TPM_AuthSessionData_Store(sbuffer, &(authSessions[i]));
+    for (i = 0 ; (rc == 0) && (authSessions->entries != NULL) && (i < authSessions->slots) ; i++) {
+	if ((authSessions->entries[i]).valid) {	  /* if the session is active */
+	    printf("  TPM_AuthSessions_Store: Storing %08x\n", authSessions->entries[i].handle);
+	    rc = TPM_AuthSessionData_Store(sbuffer, &(authSessions->entries[i]));
 	}
     }
     return rc;
 }
 
-/* TPM_AuthSessions_Delete() terminates all sessions
-
+/* TPM_AuthSessions_Delete() terminates all sessions.  The table is left initialized and empty.
 */
 
-void TPM_AuthSessions_Delete(TPM_AUTH_SESSION_DATA *authSessions)
+void TPM_AuthSessions_Delete(TPM_AUTH_SESSIONS *authSessions)
 {
     size_t i;
     
     printf(" TPM_AuthSessions_Delete:\n");
-    for (i = 0 ; i < TPM_MIN_AUTH_SESSIONS ; i++) {
-	TPM_AuthSessionData_Delete(&(authSessions[i]));
+    if (authSessions->entries != NULL) {
+	for (i = 0 ; i < authSessions->slots ; i++) {
+	    TPM_AuthSessionData_Delete(&(authSessions->entries[i]));
+	}
     }
+    TPM_AuthSessions_Init(authSessions);
     return;
 }
 
 /* TPM_AuthSessions_IsSpace() returns 'isSpace' TRUE if an entry is available, FALSE if not.
 
-   If TRUE, 'index' holds the first free position.
+   If TRUE, 'index' holds the position at the head of the free list.
 */
 
 void TPM_AuthSessions_IsSpace(TPM_BOOL *isSpace,
 			      uint32_t *index,
-			      TPM_AUTH_SESSION_DATA *authSessions)
+			      TPM_AUTH_SESSIONS *authSessions)
 {
     printf(" TPM_AuthSessions_IsSpace:\n");
-    for (*index = 0, *isSpace = FALSE ; *index < TPM_MIN_AUTH_SESSIONS ; (*index)++) {
-	if (!((authSessions[*index]).valid)) {
-	    printf("  TPM_AuthSessions_IsSpace: Found space at %u\n", *index);
-	    *isSpace = TRUE;
-	    break;
-	}	    
+    /* before first use, all slots are free */
+    if (authSessions->entries == NULL) {
+	*index = 0;
+	*isSpace = (authSessions->slots != 0);
+    }
+    else if (authSessions->freeHead != 0) {
+	*index = authSessions->freeHead - 1;
+	printf("  TPM_AuthSessions_IsSpace: Found space at %u\n", *index);
+	*isSpace = TRUE;
+    }
+    else {
+	*index = authSessions->slots;
+	*isSpace = FALSE;
     }
     return;
 }
 
-void TPM_AuthSessions_Trace(TPM_AUTH_SESSION_DATA *authSessions)
+void TPM_AuthSessions_Trace(TPM_AUTH_SESSIONS *authSessions)
 {
     size_t i;
-    for (i = 0 ; i < TPM_MIN_AUTH_SESSIONS ; i++) {
-	if ((authSessions[i]).valid) {
+    for (i = 0 ; (authSessions->entries != NULL) && (i < authSessions->slots) ; i++) {
+	if ((authSessions->entries[i]).valid) {
 	    printf(" TPM_AuthSessions_Trace: %lu handle %08x\n",
-		   (unsigned long)i, authSessions[i].handle);
+		   (unsigned long)i, authSessions->entries[i].handle);
 	}
     }
     return;
@@ -545,16 +955,10 @@ void TPM_AuthSessions_Trace(TPM_AUTH_SESSION_DATA *authSessions)
 */
 
 void TPM_AuthSessions_GetSpace(uint32_t *space,
-			       TPM_AUTH_SESSION_DATA *authSessions)
+			       TPM_AUTH_SESSIONS *authSessions)
 {
-    uint32_t i;
-
     printf(" TPM_AuthSessions_GetSpace:\n");
-    for (*space = 0 , i = 0 ; i < TPM_MIN_AUTH_SESSIONS ; i++) {
-	if (!((authSessions[i]).valid)) {
-	    (*space)++;
-	}	    
-    }
+    *space = authSessions->freeCount;
     return;
 }
 
@@ -565,22 +969,22 @@ void TPM_AuthSessions_GetSpace(uint32_t *space,
 */
 
 TPM_RESULT TPM_AuthSessions_StoreHandles(TPM_STORE_BUFFER *sbuffer,
-					 TPM_AUTH_SESSION_DATA *authSessions)
+					 TPM_AUTH_SESSIONS *authSessions)
 {
     TPM_RESULT	rc = 0;
-    uint16_t	i;
-    uint32_t	space;
+    uint32_t	i;
     
     printf(" TPM_AuthSessions_StoreHandles:\n");
     /* get the number of loaded handles */
     if (rc == 0) {
-	TPM_AuthSessions_GetSpace(&space, authSessions);
-	/* store loaded handle count.  Cast safe because of TPM_MIN_AUTH_SESSIONS value */
-	rc = TPM_Sbuffer_Append16(sbuffer, (uint16_t)(TPM_MIN_AUTH_SESSIONS - space)); 
+	/* store loaded handle count.  Cast safe because TPM_AuthSessions_SetSlots() bounds the
+	   number of slots */
+	rc = TPM_Sbuffer_Append16(sbuffer,
+				  (uint16_t)(authSessions->slots - authSessions->freeCount)); 
     }
-    for (i = 0 ; (rc == 0) && (i < TPM_MIN_AUTH_SESSIONS) ; i++) {
-	if ((authSessions[i]).valid) {			  /* if the index is loaded */
-	    rc = TPM_Sbuffer_Append32(sbuffer, (authSessions[i]).handle);	/* store it */
+    for (i = 0 ; (rc == 0) && (authSessions->entries != NULL) && (i < authSessions->slots) ; i++) {
+	if ((authSessions->entries[i]).valid) {		/* if the index is loaded */
+	    rc = TPM_Sbuffer_Append32(sbuffer, (authSessions->entries[i]).handle); /* store it */
 	}
     }
     return rc;
@@ -598,19 +1002,24 @@ TPM_RESULT TPM_AuthSessions_StoreHandles(TPM_STORE_BUFFER *sbuffer,
 
 TPM_RESULT TPM_AuthSessions_GetNewHandle(TPM_AUTH_SESSION_DATA **tpm_auth_session_data,
 					 TPM_AUTHHANDLE *authHandle,
-					 TPM_AUTH_SESSION_DATA *authSessions)
+					 TPM_AUTH_SESSIONS *authSessions)
 {
     TPM_RESULT			rc = 0;
     uint32_t			index;
     TPM_BOOL			isSpace;
     
     printf(" TPM_AuthSessions_GetNewHandle:\n");
+    if (rc == 0) {
+	rc = TPM_AuthSessions_Allocate(authSessions);
+    }
     /* is there an empty entry, get the location index */
     if (rc == 0) {
+	TPM_AuthSessions_Reclaim(authSessions);
 	TPM_AuthSessions_IsSpace(&isSpace, &index, authSessions);
 	if (!isSpace) {
 	    printf("TPM_AuthSessions_GetNewHandle: Error, no space in authSessions table\n");
 	    TPM_AuthSessions_Trace(authSessions);
+	    tpm_auth_session_metrics_all.exhausted++;
 	    rc = TPM_RESOURCES;
 	}
     }
@@ -623,15 +1032,14 @@ TPM_RESULT TPM_AuthSessions_GetNewHandle(TPM_AUTH_SESSION_DATA **tpm_auth_sessio
     }
     if (rc == 0) {
 	printf("  TPM_AuthSessions_GetNewHandle: Assigned handle %08x\n", *authHandle);
-	*tpm_auth_session_data = &(authSessions[index]);
+	*tpm_auth_session_data = &(authSessions->entries[index]);
 	/* assign the handle */
-	(*tpm_auth_session_data)->handle = *authHandle;
-	(*tpm_auth_session_data)->valid = TRUE;
+	TPM_AuthSessions_Insert(authSessions, index, *authHandle);
     }
     return rc;
 }
 
-/* TPM_AuthSessions_GetEntry() searches all entries for the entry matching the handle, and
+/* TPM_AuthSessions_GetEntry() searches the hash chain for the entry matching the handle, and
    returns the TPM_AUTH_SESSION_DATA entry associated with the handle.
 
    Returns
@@ -641,20 +1049,23 @@ TPM_RESULT TPM_AuthSessions_GetNewHandle(TPM_AUTH_SESSION_DATA **tpm_auth_sessio
 
 TPM_RESULT TPM_AuthSessions_GetEntry(TPM_AUTH_SESSION_DATA **tpm_auth_session_data, /* session for
 										       authHandle */
-				     TPM_AUTH_SESSION_DATA *authSessions, /* points to first session
-									     */
+				     TPM_AUTH_SESSIONS *authSessions,	/* table of sessions */
 				     TPM_AUTHHANDLE authHandle) /* input */
 {
     TPM_RESULT	rc = 0;
-    size_t	i;
-    TPM_BOOL	found;
+    uint32_t	link;
+    TPM_BOOL	found = FALSE;
     
     printf(" TPM_AuthSessions_GetEntry: authHandle %08x\n", authHandle);
-    for (i = 0, found = FALSE ; (i < TPM_MIN_AUTH_SESSIONS) && !found ; i++) {
-	if ((authSessions[i].valid) &&		    
-	    (authSessions[i].handle == authHandle)) {	  /* found */
-	    found = TRUE;
-	    *tpm_auth_session_data = &(authSessions[i]);
+    if (authSessions->entries != NULL) {
+	for (link = authSessions->buckets[TPM_AuthSessions_Hash(authSessions, authHandle)] ;
+	     (link != 0) && !found ;
+	     link = authSessions->links[link - 1].next) {
+	    if ((authSessions->entries[link - 1].valid) &&
+		(authSessions->entries[link - 1].handle == authHandle)) {	/* found */
+		found = TRUE;
+		*tpm_auth_session_data = &(authSessions->entries[link - 1]);
+	    }
 	}
     }
     if (!found) {
@@ -675,7 +1086,7 @@ TPM_RESULT TPM_AuthSessions_GetEntry(TPM_AUTH_SESSION_DATA **tpm_auth_session_da
 
 TPM_RESULT TPM_AuthSessions_AddEntry(TPM_HANDLE *tpm_handle,				/* i/o */
 				     TPM_BOOL keepHandle,				/* input */
-				     TPM_AUTH_SESSION_DATA *authSessions,		/* input */
+				     TPM_AUTH_SESSIONS *authSessions,			/* input */
 				     TPM_AUTH_SESSION_DATA *tpm_auth_session_data)	/* input */
 {
     TPM_RESULT			rc = 0;
@@ -691,12 +1102,17 @@ TPM_RESULT TPM_AuthSessions_AddEntry(TPM_HANDLE *tpm_handle,				/* i/o */
 	    rc = TPM_FAIL;
 	}
     }
+    if (rc == 0) {
+	rc = TPM_AuthSessions_Allocate(authSessions);
+    }
     /* is there an empty entry, get the location index */
     if (rc == 0) {
+	TPM_AuthSessions_Reclaim(authSessions);
 	TPM_AuthSessions_IsSpace(&isSpace, &index, authSessions);
 	if (!isSpace) {
 	    printf("TPM_AuthSessions_AddEntry: Error, session entries full\n");
 	    TPM_AuthSessions_Trace(authSessions);
+	    tpm_auth_session_metrics_all.exhausted++;
 	    rc = TPM_RESOURCES;
 	}
     }
@@ -708,10 +1124,11 @@ TPM_RESULT TPM_AuthSessions_AddEntry(TPM_HANDLE *tpm_handle,				/* i/o */
 				       (TPM_GETENTRY_FUNCTION_T)TPM_AuthSessions_GetEntry);
     }
     if (rc == 0) {
-	TPM_AuthSessionData_Copy(&(authSessions[index]), *tpm_handle, tpm_auth_session_data);
-	authSessions[index].valid = TRUE;
+	TPM_AuthSessionData_Copy(&(authSessions->entries[index]), *tpm_handle,
+				 tpm_auth_session_data);
+	TPM_AuthSessions_Insert(authSessions, index, *tpm_handle);
 	printf("  TPM_AuthSessions_AddEntry: Index %u handle %08x\n",
-	       index, authSessions[index].handle);
+	       index, authSessions->entries[index].handle);
     }
     return rc;
 }
@@ -764,11 +1181,17 @@ TPM_RESULT TPM_AuthSessions_GetData(TPM_AUTH_SESSION_DATA **tpm_auth_session_dat
     printf(" TPM_AuthSessions_GetData: authHandle %08x\n", authHandle);
     if (rc == 0) {
 	rc = TPM_AuthSessions_GetEntry(tpm_auth_session_data,
-				       tpm_state->tpm_stclear_data.authSessions,
+				       &(tpm_state->tpm_stclear_data.authSessions),
 				       authHandle);
 	if (rc != 0) {
 	    printf("TPM_AuthSessions_GetData: Error, authHandle %08x not found\n", authHandle);
 	}
+	/* an authorization counts as use for the reclamation policy */
+	else {
+	    TPM_AuthSessions_Touch(&(tpm_state->tpm_stclear_data.authSessions),
+				   (uint32_t)(*tpm_auth_session_data -
+					      tpm_state->tpm_stclear_data.authSessions.entries));
+	}
     }
     /* If a specific protocol is required, check that the handle points to the correct session type
        */
@@ -892,7 +1315,7 @@ TPM_RESULT TPM_AuthSessions_GetData(TPM_AUTH_SESSION_DATA **tpm_auth_session_dat
 
 */
 
-TPM_RESULT TPM_AuthSessions_TerminateHandle(TPM_AUTH_SESSION_DATA *authSessions,
+TPM_RESULT TPM_AuthSessions_TerminateHandle(TPM_AUTH_SESSIONS *authSessions,
 					    TPM_AUTHHANDLE authHandle)
 {
     TPM_RESULT	rc = 0;
@@ -903,9 +1326,11 @@ TPM_RESULT TPM_AuthSessions_TerminateHandle(TPM_AUTH_SESSION_DATA *authSessions,
     if (rc == 0) {
 	rc = TPM_AuthSessions_GetEntry(&tpm_auth_session_data, authSessions, authHandle);
     }
-    /* invalidate the valid handle */
+    /* invalidate the valid handle and free its slot */
     if (rc == 0) {
-	TPM_AuthSessionData_Delete(tpm_auth_session_data);
+	TPM_AuthSessions_Remove(authSessions,
+				(uint32_t)(tpm_auth_session_data - authSessions->entries));
+	tpm_auth_session_metrics_all.terminated++;
     }
     return rc;
 }
@@ -922,28 +1347,30 @@ TPM_RESULT TPM_AuthSessions_TerminateHandle(TPM_AUTH_SESSION_DATA *authSessions,
 
 void TPM_AuthSessions_TerminateEntity(TPM_BOOL *continueAuthSession,
 				      TPM_AUTHHANDLE authHandle,
-				      TPM_AUTH_SESSION_DATA *authSessions,
+				      TPM_AUTH_SESSIONS *authSessions,
 				      TPM_ENT_TYPE entityType,
 				      TPM_DIGEST *entityDigest)
 {
     uint32_t		i;
+    TPM_AUTH_SESSION_DATA *entry;
     TPM_BOOL		terminate;
     TPM_RESULT		match;
 
     printf(" TPM_AuthSessions_TerminateEntity: entityType %04x\n", entityType);
-    for (i = 0 ; i < TPM_MIN_AUTH_SESSIONS ; i++) {
+    for (i = 0 ; (authSessions->entries != NULL) && (i < authSessions->slots) ; i++) {
+	entry = &(authSessions->entries[i]);
 	terminate = FALSE;
-	if ((authSessions[i].valid) &&			    /* if the entry is valid */
-	    ((authSessions[i].protocolID == TPM_PID_OSAP) ||	/* if it's OSAP or DSAP */
-	     (authSessions[i].protocolID == TPM_PID_DSAP)) &&
-	    (authSessions[i].entityTypeByte == entityType)) {	/* connected to entity type */
+	if ((entry->valid) &&					/* if the entry is valid */
+	    ((entry->protocolID == TPM_PID_OSAP) ||		/* if it's OSAP or DSAP */
+	     (entry->protocolID == TPM_PID_DSAP)) &&
+	    (entry->entityTypeByte == entityType)) {		/* connected to entity type */
 	    /* if entityDigest is NULL, terminate all matching entityType */
 	    if (entityDigest == NULL) {
 		terminate = TRUE;
 	    }
 	    /* if entityDigest is not NULL, terminate only those matching entityDigest */
 	    else {
-		match = TPM_Digest_Compare(*entityDigest, authSessions[i].entityDigest);
+		match = TPM_Digest_Compare(*entityDigest, entry->entityDigest);
 		if (match == 0) {
 		    terminate = TRUE;
 		}
@@ -951,12 +1378,13 @@ void TPM_AuthSessions_TerminateEntity(TPM_BOOL *continueAuthSession,
 	}
 	if (terminate) {
 	    printf("  TPM_AuthSessions_TerminateEntity: Terminating handle %08x\n",
-		   authSessions[i].handle);
+		   entry->handle);
 	    /* if terminating the ordinal's session */
-	    if (authSessions[i].handle == authHandle) {
+	    if (entry->handle == authHandle) {
 		*continueAuthSession = FALSE;	/* for the ordinal response */
 	    }
-	    TPM_AuthSessionData_Delete(&authSessions[i]);
+	    TPM_AuthSessions_Remove(authSessions, i);
+	    tpm_auth_session_metrics_all.terminated++;
 	}	    
     }
     return;
@@ -976,21 +1404,25 @@ void TPM_AuthSessions_TerminateEntity(TPM_BOOL *continueAuthSession,
 
 void TPM_AuthSessions_TerminatexSAP(TPM_BOOL *continueAuthSession,
 				    TPM_AUTHHANDLE authHandle,
-				    TPM_AUTH_SESSION_DATA *authSessions)
+				    TPM_AUTH_SESSIONS *authSessions)
 {
     uint32_t		i;
+    TPM_AUTH_SESSION_DATA *entry;
 
     printf(" TPM_AuthSessions_TerminatexSAP:\n");
-    for (i = 0 ; i < TPM_MIN_AUTH_SESSIONS ; i++) {
-	if ((authSessions[i].protocolID == TPM_PID_OSAP) ||
-	    (authSessions[i]. protocolID == TPM_PID_DSAP)) {
+    for (i = 0 ; (authSessions->entries != NULL) && (i < authSessions->slots) ; i++) {
+	entry = &(authSessions->entries[i]);
+	if ((entry->valid) &&
+	    ((entry->protocolID == TPM_PID_OSAP) ||
+	     (entry->protocolID == TPM_PID_DSAP))) {
 	    /* if terminating the ordinal's session */
-	    if (authSessions[i].handle == authHandle) {
+	    if (entry->handle == authHandle) {
 		*continueAuthSession = FALSE;	/* for the ordinal response */
 	    }
 	    printf("  TPM_AuthSessions_TerminatexSAP: Terminating handle %08x\n",
-		   authSessions[i].handle);
-	    TPM_AuthSessionData_Delete(&authSessions[i]);
+		   entry->handle);
+	    TPM_AuthSessions_Remove(authSessions, i);
+	    tpm_auth_session_metrics_all.terminated++;
 	}	    
     }
     return;
@@ -999,102 +1431,296 @@ void TPM_AuthSessions_TerminatexSAP(TPM_BOOL *continueAuthSession,
 /*
   Context List
 
-  Methods to manipulate the TPM_STANY_DATA->contextList[TPM_MAX_SESSION_LIST] array
+  Methods to manipulate the TPM_STCLEAR_DATA->contextList table
 */
 
-/* TPM_ContextList_Init()
+/* TPM_ContextList_SetSlots() sets the number of saved session slots of lists initialized by
+   subsequent calls to TPM_ContextList_Init(), overriding TPM_MIN_SESSION_LIST.
 
-   sets members to default values
-   sets all pointers to NULL and sizes to 0
-   always succeeds - no return code
+   TPM_MIN_SESSION_LIST remains the minimum.  The maximum is the array that TPM_Malloc() can
+   allocate.
 */
 
-void TPM_ContextList_Init(uint32_t *contextList)
+void TPM_ContextList_SetSlots(uint32_t slots)
 {
-    size_t i;
-    
-    printf(" TPM_ContextList_Init:\n");
-    for (i = 0 ; i < TPM_MIN_SESSION_LIST ; i++) {
-	contextList[i] = 0;
+    uint32_t maxSlots = TPM_ALLOC_MAX / sizeof(uint32_t);
+
+    if (slots < TPM_MIN_SESSION_LIST) {
+	printf("TPM_ContextList_SetSlots: %u raised to minimum %u\n",
+	       slots, TPM_MIN_SESSION_LIST);
+	slots = TPM_MIN_SESSION_LIST;
+    }
+    if (slots > maxSlots) {
+	printf("TPM_ContextList_SetSlots: %u lowered to maximum %u\n", slots, maxSlots);
+	slots = maxSlots;
+    }
+    printf(" TPM_ContextList_SetSlots: %u\n", slots);
+    tpm_context_list_slots = slots;
+    return;
+}
+
+/* TPM_ContextList_GetMetrics() returns a copy of the saved session statistics */
+
+void TPM_ContextList_GetMetrics(TPM_CONTEXT_LIST_METRICS *tpm_context_list_metrics)
+{
+    *tpm_context_list_metrics = tpm_context_list_metrics_all;
+    return;
+}
+
+/* TPM_ContextList_Init() sets the list to the configured number of empty slots.
+
+   The arrays are allocated on first use by TPM_ContextList_Allocate().  Once allocated, they are
+   kept and reset.  TPM_ContextList_Free() frees them.
+
+   Before the first call, the structure must be zero, as done by TPM_Global_Init().
+*/
+
+void TPM_ContextList_Init(TPM_CONTEXT_LIST *contextList)
+{
+    uint32_t i;
+
+    printf(" TPM_ContextList_Init: %u slots\n",
+	   (contextList->entries != NULL) ? contextList->slots : tpm_context_list_slots);
+    if (contextList->entries == NULL) {
+	contextList->slots = tpm_context_list_slots;
+	contextList->links = NULL;
+	contextList->buckets = NULL;
+	contextList->hashSize = 0;
+	contextList->freeHead = 0;
+    }
+    /* chain all slots on the free list, in order */
+    else {
+	for (i = 0 ; i < contextList->slots ; i++) {
+	    contextList->entries[i] = 0;
+	    contextList->links[i] = ((i + 1) < contextList->slots) ? (i + 2) : 0;
+	}
+	for (i = 0 ; i < contextList->hashSize ; i++) {
+	    contextList->buckets[i] = 0;
+	}
+	contextList->freeHead = 1;
+    }
+    contextList->freeCount = contextList->slots;
+    return;
+}
+
+/* TPM_ContextList_Allocate() allocates the arrays of an initialized list, if not already done.
+   All slots are empty and on the free list.
+*/
+
+static TPM_RESULT TPM_ContextList_Allocate(TPM_CONTEXT_LIST *contextList)
+{
+    TPM_RESULT  rc = 0;
+
+    if (contextList->entries == NULL) {
+	printf(" TPM_ContextList_Allocate: %u slots\n", contextList->slots);
+	/* the hash size is the smallest power of 2 not less than the number of slots */
+	for (contextList->hashSize = 1 ;
+	     contextList->hashSize < contextList->slots ;
+	     contextList->hashSize <<= 1) ;
+	if (rc == 0) {
+	    rc = TPM_Malloc((unsigned char **)&(contextList->links),
+			    contextList->slots * sizeof(uint32_t));
+	}
+	if (rc == 0) {
+	    rc = TPM_Malloc((unsigned char **)&(contextList->buckets),
+			    contextList->hashSize * sizeof(uint32_t));
+	}
+	if (rc == 0) {
+	    rc = TPM_Malloc((unsigned char **)&(contextList->entries),
+			    contextList->slots * sizeof(uint32_t));
+	}
+	if (rc == 0) {
+	    TPM_ContextList_Init(contextList);
+	}
+	/* entries is the allocated flag, so free the others on failure */
+	else {
+	    free(contextList->links);
+	    free(contextList->buckets);
+	    contextList->links = NULL;
+	    contextList->buckets = NULL;
+	}
     }
+    return rc;
+}
+
+/* TPM_ContextList_Free() frees the list arrays.  The list must be initialized again before use.
+*/
+
+void TPM_ContextList_Free(TPM_CONTEXT_LIST *contextList)
+{
+    printf(" TPM_ContextList_Free:\n");
+    free(contextList->entries);
+    free(contextList->links);
+    free(contextList->buckets);
+    contextList->entries = NULL;
+    TPM_ContextList_Init(contextList);
     return;
 }
 
-/* TPM_ContextList_Load()
+/* TPM_ContextList_Hash() returns the hash chain for the context count */
+
+static uint32_t TPM_ContextList_Hash(const TPM_CONTEXT_LIST *contextList,
+				     uint32_t value)
+{
+    uint32_t hash;
+
+    hash = value * 0x9e3779b1;
+    hash ^= hash >> 16;
+    return hash & (contextList->hashSize - 1);
+}
+
+/* TPM_ContextList_Load() reads a list of context counts and adds the non-zero values.
+
+   If 'counted' is TRUE, the stream holds a count followed by the values.  Otherwise, it holds
+   TPM_MIN_SESSION_LIST values, the format before TPM_TAG_STCLEAR_DATA_V3.
 
    deserialize the structure from a 'stream'
    'stream_size' is checked for sufficient data
    returns 0 or error codes
-   
+
    Before use, call TPM_ContextList_Init()
 */
 
-TPM_RESULT TPM_ContextList_Load(uint32_t *contextList,
+TPM_RESULT TPM_ContextList_Load(TPM_CONTEXT_LIST *contextList,
+				TPM_BOOL counted,
 				unsigned char **stream,
 				uint32_t *stream_size)
 {
-    TPM_RESULT		rc = 0;
-    size_t		i;
-    
+    TPM_RESULT          rc = 0;
+    size_t              i;
+    uint32_t            count;
+    uint32_t            value;
+    uint32_t            space;
+    uint32_t            entry;
+
     printf(" TPM_ContextList_Load:\n");
-    for (i = 0 ; (rc == 0) && (i < TPM_MIN_SESSION_LIST) ; i++) {
-	rc = TPM_Load32(&(contextList[i]), stream, stream_size); 
+    if (rc == 0) {
+	if (counted) {
+	    rc = TPM_Load32(&count, stream, stream_size);
+	}
+	else {
+	    count = TPM_MIN_SESSION_LIST;
+	}
+    }
+    for (i = 0 ; (rc == 0) && (i < count) ; i++) {
+	rc = TPM_Load32(&value, stream, stream_size);
+	if ((rc == 0) && (value != 0)) {        /* zero values are free space */
+	    TPM_ContextList_GetSpace(&space, &entry, contextList);
+	    if (space == 0) {
+		printf("TPM_ContextList_Load: Error (fatal) more than %u contexts\n",
+		       contextList->slots);
+		rc = TPM_FAIL;
+	    }
+	    if (rc == 0) {
+		rc = TPM_ContextList_SetEntry(contextList, entry, value);
+	    }
+	}
     }
     return rc;
 }
 
-/* TPM_ContextList_Store()
-   
+/* TPM_ContextList_Store() stores a count of the outstanding contexts, followed by their context
+   counts.
+
    serialize the structure to a stream contained in 'sbuffer'
    returns 0 or error codes
 */
 
 TPM_RESULT TPM_ContextList_Store(TPM_STORE_BUFFER *sbuffer,
-				 const uint32_t *contextList)
+				 const TPM_CONTEXT_LIST *contextList)
 {
-    TPM_RESULT		rc = 0;
-    size_t		i;
+    TPM_RESULT          rc = 0;
+    size_t              i;
 
-    printf(" TPM_ContextList_Store: Storing %u contexts\n", TPM_MIN_SESSION_LIST);
-    for (i = 0 ; (rc == 0) && (i < TPM_MIN_SESSION_LIST) ; i++) {
-	rc = TPM_Sbuffer_Append32(sbuffer, contextList[i]); 
+    printf(" TPM_ContextList_Store: Storing %u contexts\n",
+	   contextList->slots - contextList->freeCount);
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(sbuffer, contextList->slots - contextList->freeCount);
+    }
+    for (i = 0 ; (rc == 0) && (contextList->entries != NULL) && (i < contextList->slots) ; i++) {
+	if (contextList->entries[i] != 0) {
+	    rc = TPM_Sbuffer_Append32(sbuffer, contextList->entries[i]);
+	}
     }
     return rc;
 }
 
 /* TPM_ContextList_GetSpace() returns 'space', the number of unused context list entries.
 
-   If 'space' is non-zero, 'entry' points to the first unused index.
+   If 'space' is non-zero, 'entry' points to the unused index at the head of the free list.  If
+   'entry' is not NULL, the caller wants an entry, so a full list is counted as exhausted.
 */
 
 void TPM_ContextList_GetSpace(uint32_t *space,
 			      uint32_t *entry,
-			      const uint32_t *contextList)
+			      const TPM_CONTEXT_LIST *contextList)
 {
-    uint32_t i;
-
     printf(" TPM_ContextList_GetSpace:\n");
-    for (*space = 0 , i = 0 ; i < TPM_MIN_SESSION_LIST ; i++) {
-	if (contextList[i] == 0) {	/* zero values are free space */
-	    if (*space == 0) {
-		*entry = i;	/* point to the first non-zero entry */
-	    }
-	    (*space)++;
-	}	    
+    *space = contextList->freeCount;
+    if (entry != NULL) {
+	/* before first use, all slots are free */
+	if (contextList->entries == NULL) {
+	    *entry = 0;
+	}
+	else if (contextList->freeHead != 0) {
+	    *entry = contextList->freeHead - 1;
+	}
+	else {
+	    tpm_context_list_metrics_all.exhausted++;
+	}
     }
     return;
 }
 
+/* TPM_ContextList_SetEntry() sets the free 'entry' returned by TPM_ContextList_GetSpace() to the
+   non-zero context count 'value'.
+*/
+
+TPM_RESULT TPM_ContextList_SetEntry(TPM_CONTEXT_LIST *contextList,
+				    uint32_t entry,
+				    uint32_t value)
+{
+    TPM_RESULT  rc = 0;
+    uint32_t    bucket;
+    uint32_t    outstanding;
+
+    printf(" TPM_ContextList_SetEntry: Entry %u value %u\n", entry, value);
+    if (rc == 0) {
+	rc = TPM_ContextList_Allocate(contextList);
+    }
+    if (rc == 0) {
+	if ((value == 0) || (contextList->freeHead != (entry + 1))) {
+	    printf("TPM_ContextList_SetEntry: Error (fatal), entry %u is not free\n", entry);
+	    rc = TPM_FAIL;      /* should never occur */
+	}
+    }
+    if (rc == 0) {
+	contextList->freeHead = contextList->links[entry];
+	contextList->freeCount--;
+	contextList->entries[entry] = value;
+	bucket = TPM_ContextList_Hash(contextList, value);
+	contextList->links[entry] = contextList->buckets[bucket];
+	contextList->buckets[bucket] = entry + 1;
+	outstanding = contextList->slots - contextList->freeCount;
+	if (outstanding > tpm_context_list_metrics_all.peak) {
+	    tpm_context_list_metrics_all.peak = outstanding;
+	}
+    }
+    return rc;
+}
+
 /* TPM_ContextList_GetEntry() gets the entry index corresponding to the value
 
 */
 
 TPM_RESULT TPM_ContextList_GetEntry(uint32_t *entry,
-				    const uint32_t *contextList,
+				    const TPM_CONTEXT_LIST *contextList,
 				    uint32_t value)
 {
-    TPM_RESULT	rc = 0;
-    
+    TPM_RESULT  rc = 0;
+    uint32_t    link;
+    TPM_BOOL    found = FALSE;
+
     printf(" TPM_ContextList_GetEntry:\n");
     if (rc == 0) {
 	if (value == 0) {
@@ -1103,12 +1729,18 @@ TPM_RESULT TPM_ContextList_GetEntry(uint32_t *entry,
 	}
     }
     if (rc == 0) {
-	for (*entry = 0 ; *entry < TPM_MIN_SESSION_LIST ; (*entry)++) {
-	    if (contextList[*entry] == value) {
-		break;
+	if (contextList->entries != NULL) {
+	    for (link = contextList->buckets[TPM_ContextList_Hash(contextList,
+								  value)] ;
+		 (link != 0) && !found ;
+		 link = contextList->links[link - 1]) {
+		if (contextList->entries[link - 1] == value) {
+		    found = TRUE;
+		    *entry = link - 1;
+		}
 	    }
 	}
-	if (*entry == TPM_MIN_SESSION_LIST) {
+	if (!found) {
 	    printf("TPM_ContextList_GetEntry: Error, value %d not found\n", value);
 	    rc = TPM_BADCONTEXT;
 	}
@@ -1116,6 +1748,31 @@ TPM_RESULT TPM_ContextList_GetEntry(uint32_t *entry,
     return rc;
 }
 
+/* TPM_ContextList_ClearEntry() sets the valid 'entry' returned by TPM_ContextList_GetEntry() to 0
+   and returns it to the free list.
+*/
+
+void TPM_ContextList_ClearEntry(TPM_CONTEXT_LIST *contextList,
+				uint32_t entry)
+{
+    uint32_t    *chain;
+
+    printf(" TPM_ContextList_ClearEntry: Entry %u\n", entry);
+    chain = &(contextList->buckets[TPM_ContextList_Hash(contextList,
+							contextList->entries[entry])]);
+    while ((*chain != 0) && (*chain != (entry + 1))) {
+	chain = &(contextList->links[*chain - 1]);
+    }
+    if (*chain != 0) {
+	*chain = contextList->links[entry];
+    }
+    contextList->entries[entry] = 0;
+    contextList->links[entry] = contextList->freeHead;
+    contextList->freeHead = entry + 1;
+    contextList->freeCount++;
+    return;
+}
+
 /* TPM_ContextList_StoreHandles() stores
 
    - the number of loaded context entries
@@ -1123,32 +1780,251 @@ TPM_RESULT TPM_ContextList_GetEntry(uint32_t *entry,
 */
 
 TPM_RESULT TPM_ContextList_StoreHandles(TPM_STORE_BUFFER *sbuffer,
-					const uint32_t *contextList)
+					const TPM_CONTEXT_LIST *contextList)
 {
-    TPM_RESULT	rc = 0;
-    uint16_t	i;
-    uint16_t	loaded;
-    
+    TPM_RESULT  rc = 0;
+    uint32_t    i;
+    uint32_t    loaded;
+
     printf(" TPM_ContextList_StoreHandles:\n");
     if (rc == 0) {
-	loaded = 0;
-	/* count the number of loaded handles */
-	for (i = 0 ; i < TPM_MIN_SESSION_LIST ; i++) {
-	    if (contextList[i] != 0) {
-		loaded++;
-	    }
+	loaded = contextList->slots - contextList->freeCount;
+	/* the handle list count is 16 bits, so larger lists return the first 0xffff */
+	if (loaded > 0xffff) {
+	    loaded = 0xffff;
 	}
 	/* store 'loaded' handle count */
-	rc = TPM_Sbuffer_Append16(sbuffer, loaded); 
+	rc = TPM_Sbuffer_Append16(sbuffer, (uint16_t)loaded);
+    }
+    for (i = 0 ; (rc == 0) && (contextList->entries != NULL) && (i < contextList->slots) &&
+	     (loaded > 0) ; i++) {
+	if (contextList->entries[i] != 0) {     /* if the index is loaded */
+	    rc = TPM_Sbuffer_Append32(sbuffer, contextList->entries[i]); /* store it */
+	    loaded--;
+	}
+    }
+    return rc;
+}
+
+/*
+  Context Cache
+
+  TPM_SaveContext encrypts the context and TPM_LoadContext decrypts and verifies it again, often
+  shortly after when a resource manager swaps keys and sessions.  The context cache keeps the most
+  recent blobs with their clear text, keyed by contextCount and integrityDigest.
+
+  A blob is restored from the cache only if it is byte for byte the blob that the TPM returned and
+  tpmProof is unchanged, so the integrity HMAC would verify.  The contextKey changes only together
+  with tpmProof.  The contextNonce and contextCount checks are done as usual.
+*/
+
+/* TPM_ContextCache_SetEntries() sets the number of context cache entries.  0, the default,
+   disables the cache.
+
+   It must be called before the first TPM_SaveContext.
+*/
+
+void TPM_ContextCache_SetEntries(uint32_t entries)
+{
+    uint32_t maxEntries = TPM_ALLOC_MAX / sizeof(TPM_CONTEXT_CACHE_ENTRY);
+
+    if (entries > maxEntries) {
+	printf("TPM_ContextCache_SetEntries: %u lowered to maximum %u\n", entries, maxEntries);
+	entries = maxEntries;
+    }
+    printf(" TPM_ContextCache_SetEntries: %u\n", entries);
+    tpm_context_cache_entries = entries;
+    return;
+}
+
+/* TPM_ContextCache_Add() adds a blob returned by TPM_SaveContext and its clear text
+   TPM_CONTEXT_SENSITIVE serialization, replacing an older entry if the cache is full.
+
+   The cache is an optimization, so a failure just leaves the blob out.
+*/
+
+void TPM_ContextCache_Add(const TPM_CONTEXT_BLOB *tpm_context_blob,
+			  const TPM_SECRET tpmProof,
+			  TPM_STORE_BUFFER *contextBlob,
+			  TPM_STORE_BUFFER *sensitiveData)
+{
+    TPM_RESULT			rc = 0;
+    TPM_CONTEXT_CACHE_ENTRY	*entry = NULL;
+    uint32_t			i;
+
+    if (tpm_context_cache_entries == 0) {
+	return;
+    }
+    /* allocate the cache on first use */
+    if ((rc == 0) && (tpm_context_cache == NULL)) {
+	rc = TPM_Malloc((unsigned char **)&tpm_context_cache,
+			tpm_context_cache_entries * sizeof(TPM_CONTEXT_CACHE_ENTRY));
+	for (i = 0 ; (rc == 0) && (i < tpm_context_cache_entries) ; i++) {
+	    tpm_context_cache[i].resourceType = 0;
+	    TPM_SizedBuffer_Init(&(tpm_context_cache[i].contextBlob));
+	    TPM_SizedBuffer_Init(&(tpm_context_cache[i].sensitiveData));
+	}
+	if (rc != 0) {
+	    printf("TPM_ContextCache_Add: Error allocating %u entries, cache disabled\n",
+		   tpm_context_cache_entries);
+	    tpm_context_cache_entries = 0;
+	}
+    }
+    /* a free entry, else the oldest */
+    for (i = 0 ; (rc == 0) && (i < tpm_context_cache_entries) ; i++) {
+	if (tpm_context_cache[i].resourceType == 0) {
+	    entry = &(tpm_context_cache[i]);
+	    break;
+	}
+    }
+    if ((rc == 0) && (entry == NULL)) {
+	entry = &(tpm_context_cache[tpm_context_cache_next]);
+	tpm_context_cache_next = (tpm_context_cache_next + 1) % tpm_context_cache_entries;
+    }
+    if (rc == 0) {
+	printf(" TPM_ContextCache_Add: resourceType %08x handle %08x contextCount %u\n",
+	       tpm_context_blob->resourceType, tpm_context_blob->handle,
+	       tpm_context_blob->contextCount);
+	entry->resourceType = 0;
+	rc = TPM_SizedBuffer_SetFromStore(&(entry->contextBlob), contextBlob);
+    }
+    if (rc == 0) {
+	rc = TPM_SizedBuffer_SetFromStore(&(entry->sensitiveData), sensitiveData);
+    }
+    if (rc == 0) {
+	entry->handle = tpm_context_blob->handle;
+	memcpy(entry->label, tpm_context_blob->label, TPM_CONTEXT_LABEL_SIZE);
+	entry->contextCount = tpm_context_blob->contextCount;
+	TPM_Digest_Copy(entry->integrityDigest, tpm_context_blob->integrityDigest);
+	TPM_Secret_Copy(entry->tpmProof, tpmProof);
+	entry->resourceType = tpm_context_blob->resourceType;
+    }
+    return;
+}
+
+/* TPM_ContextCache_GetSaved() handles a key saved again unchanged.
+
+   With the same handle, label, contextNonce, and key, TPM_SaveContext produces the identical blob.
+   If the cache holds it, 'found' is TRUE and the blob is appended to 'contextBlob', so that the
+   HMAC and the encryption are not needed.
+
+   'tpm_context_blob' is the blob being built, before its integrityDigest is calculated.
+   'sensitiveData' is its clear text TPM_CONTEXT_SENSITIVE serialization.
+*/
+
+TPM_RESULT TPM_ContextCache_GetSaved(TPM_BOOL *found,
+				     TPM_STORE_BUFFER *contextBlob,
+				     const TPM_CONTEXT_BLOB *tpm_context_blob,
+				     const TPM_SECRET tpmProof,
+				     TPM_STORE_BUFFER *sensitiveData)
+{
+    TPM_RESULT		rc = 0;
+    const unsigned char	*buffer;
+    uint32_t		length;
+    uint32_t		i;
+
+    *found = FALSE;
+    TPM_Sbuffer_Get(sensitiveData, &buffer, &length);
+    for (i = 0 ; (tpm_context_cache != NULL) && (i < tpm_context_cache_entries) ; i++) {
+	if ((tpm_context_cache[i].resourceType == tpm_context_blob->resourceType) &&
+	    (tpm_context_cache[i].handle == tpm_context_blob->handle) &&
+	    (tpm_context_cache[i].contextCount == tpm_context_blob->contextCount) &&
+	    (memcmp(tpm_context_cache[i].label, tpm_context_blob->label,
+		    TPM_CONTEXT_LABEL_SIZE) == 0) &&
+	    (memcmp(tpm_context_cache[i].tpmProof, tpmProof, TPM_SECRET_SIZE) == 0) &&
+	    (tpm_context_cache[i].sensitiveData.size == length) &&
+	    (memcmp(tpm_context_cache[i].sensitiveData.buffer, buffer, length) == 0)) {
+	    printf(" TPM_ContextCache_GetSaved: Found handle %08x\n", tpm_context_blob->handle);
+	    *found = TRUE;
+	    rc = TPM_Sbuffer_Append(contextBlob,
+				    tpm_context_cache[i].contextBlob.buffer,
+				    tpm_context_cache[i].contextBlob.size);
+	    break;
+	}
     }
-    for (i = 0 ; (rc == 0) && (i < TPM_MIN_SESSION_LIST ) ; i++) {
-	if (contextList[i] != 0) {	/* if the index is loaded */
-	    rc = TPM_Sbuffer_Append32(sbuffer, contextList[i]); /* store it */
+    return rc;
+}
+
+/* TPM_ContextCache_GetSensitive() looks up a blob being loaded.
+
+   'tpm_context_blob' is the deserialized blob, and 'contextBlob' its serialization from the
+   command.  If the cache holds the identical blob created under the current 'tpmProof', 'found'
+   is TRUE and 'sensitiveData' is a copy of the clear text TPM_CONTEXT_SENSITIVE serialization.
+
+   After use, free 'sensitiveData'.
+*/
+
+TPM_RESULT TPM_ContextCache_GetSensitive(TPM_BOOL *found,
+					 unsigned char **sensitiveData,
+					 uint32_t *sensitiveSize,
+					 const TPM_CONTEXT_BLOB *tpm_context_blob,
+					 const TPM_SECRET tpmProof,
+					 const unsigned char *contextBlob,
+					 uint32_t contextSize)
+{
+    TPM_RESULT			rc = 0;
+    TPM_CONTEXT_CACHE_ENTRY	*entry;
+
+    *found = FALSE;
+    entry = TPM_ContextCache_Find(tpm_context_blob, tpmProof);
+    if ((entry != NULL) &&
+	(entry->contextBlob.size == contextSize) &&
+	(memcmp(entry->contextBlob.buffer, contextBlob, contextSize) == 0)) {
+	printf(" TPM_ContextCache_GetSensitive: Found contextCount %u\n",
+	       tpm_context_blob->contextCount);
+	rc = TPM_Malloc(sensitiveData, entry->sensitiveData.size);
+	if (rc == 0) {
+	    memcpy(*sensitiveData, entry->sensitiveData.buffer, entry->sensitiveData.size);
+	    *sensitiveSize = entry->sensitiveData.size;
+	    *found = TRUE;
 	}
     }
     return rc;
 }
 
+/* TPM_ContextCache_DeleteCount() frees the session blob with 'contextCount', after it has been
+   loaded or flushed.  Its context list entry is gone, so it can never be loaded again.
+*/
+
+void TPM_ContextCache_DeleteCount(uint32_t contextCount)
+{
+    uint32_t	i;
+
+    for (i = 0 ; (tpm_context_cache != NULL) && (i < tpm_context_cache_entries) ; i++) {
+	if ((tpm_context_cache[i].resourceType != 0) &&
+	    (tpm_context_cache[i].resourceType != TPM_RT_KEY) &&
+	    (tpm_context_cache[i].contextCount == contextCount)) {
+	    printf(" TPM_ContextCache_DeleteCount: contextCount %u\n", contextCount);
+	    tpm_context_cache[i].resourceType = 0;
+	    TPM_SizedBuffer_Delete(&(tpm_context_cache[i].contextBlob));
+	    TPM_SizedBuffer_Delete(&(tpm_context_cache[i].sensitiveData));
+	}
+    }
+    return;
+}
+
+/* TPM_ContextCache_Find() returns the entry with the blob's type, contextCount, and
+   integrityDigest, created under 'tpmProof', or NULL */
+
+static TPM_CONTEXT_CACHE_ENTRY *TPM_ContextCache_Find(const TPM_CONTEXT_BLOB *tpm_context_blob,
+						      const TPM_SECRET tpmProof)
+{
+    TPM_CONTEXT_CACHE_ENTRY	*entry = NULL;
+    uint32_t			i;
+
+    for (i = 0 ; (tpm_context_cache != NULL) && (i < tpm_context_cache_entries) ; i++) {
+	if ((tpm_context_cache[i].resourceType == tpm_context_blob->resourceType) &&
+	    (tpm_context_cache[i].contextCount == tpm_context_blob->contextCount) &&
+	    (memcmp(tpm_context_cache[i].integrityDigest, tpm_context_blob->integrityDigest,
+		    TPM_DIGEST_SIZE) == 0) &&
+	    (memcmp(tpm_context_cache[i].tpmProof, tpmProof, TPM_SECRET_SIZE) == 0)) {
+	    entry = &(tpm_context_cache[i]);
+	    break;
+	}
+    }
+    return entry;
+}
+
 /*
   TPM_CONTEXT_BLOB
 */
@@ -1470,7 +2346,7 @@ TPM_RESULT TPM_Process_OIAP(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	returnCode = TPM_AuthSessions_GetNewHandle(&authSession,
 						   &authHandle,
-						   tpm_state->tpm_stclear_data.authSessions);
+						   &(tpm_state->tpm_stclear_data.authSessions));
     }
     /* 3. Internally the TPM will do the following: */
     if (returnCode == TPM_SUCCESS) {
@@ -1532,7 +2408,7 @@ TPM_RESULT TPM_Process_OIAP(tpm_state_t *tpm_state,
     }
     /* if the handle is not being returned, it should be terminated */
     if (((returnCode != 0) || (rcf != 0)) && got_handle) {
-	TPM_AuthSessionData_Delete(authSession);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     return rcf;
 }
@@ -1665,7 +2541,7 @@ TPM_RESULT TPM_Process_OSAP(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	returnCode = TPM_AuthSessions_GetNewHandle(&authSession,
 						   &authHandle,
-						   tpm_state->tpm_stclear_data.authSessions);
+						   &(tpm_state->tpm_stclear_data.authSessions));
     }
     if (returnCode == TPM_SUCCESS) {
 	printf("TPM_Process_OSAP: Using authHandle %08x\n", authHandle);
@@ -1903,7 +2779,7 @@ TPM_RESULT TPM_Process_OSAP(tpm_state_t *tpm_state,
     }
     /* if the handle is not being returned, it should be terminated */
     if (((returnCode != 0) || (rcf != 0)) && got_handle) {
-	TPM_AuthSessionData_Delete(authSession);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -2263,7 +3139,7 @@ TPM_RESULT TPM_Process_DSAP(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	returnCode = TPM_AuthSessions_GetNewHandle(&authSession,
 						   &authHandle,
-						   tpm_state->tpm_stclear_data.authSessions);
+						   &(tpm_state->tpm_stclear_data.authSessions));
     }
     if (returnCode == TPM_SUCCESS) {
 	printf("TPM_Process_DSAP: Using authHandle %08x\n", authHandle);
@@ -2372,7 +3248,7 @@ TPM_RESULT TPM_Process_DSAP(tpm_state_t *tpm_state,
     }
     /* if the handle is not being returned, it should be terminated */
     if (((returnCode != 0) || (rcf != 0)) && got_handle) {
-	TPM_AuthSessionData_Delete(authSession);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -2737,7 +3613,7 @@ TPM_RESULT TPM_Process_TerminateHandle(tpm_state_t *tpm_state,
     /* terminate the handle */
     if (returnCode == TPM_SUCCESS) {
 	printf("TPM_Process_TerminateHandle: Using authHandle %08x\n", authHandle);
-	returnCode = TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions,
+	returnCode = TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions),
 						      authHandle);
     }
     /*
@@ -2876,8 +3752,8 @@ TPM_RESULT TPM_Process_FlushSpecific(tpm_state_t *tpm_state,
 		   TPM uses the "context count" value to locate the proper contextList entry and
 		   sets R1 to the contextList entry */
 		returnCode = TPM_ContextList_GetEntry(&r1Resource,	/* index into
-									   contextList[] */
-						      tpm_state->tpm_stclear_data.contextList,
+									   contextList */
+						      &(tpm_state->tpm_stclear_data.contextList),
 						      handle);
 		/* 7. Validate that R1 determined by resourceType and handle points to a valid
 		   allocated resource.	Return TPM_BAD_PARAMETER on error. */
@@ -2891,7 +3767,8 @@ TPM_RESULT TPM_Process_FlushSpecific(tpm_state_t *tpm_state,
 	    /* a. Resources include authorization sessions */
 	    if (returnCode == TPM_SUCCESS) {
 		/* setting the entry to 0 prevents the session from being reloaded. */
-		tpm_state->tpm_stclear_data.contextList[r1Resource] = 0;
+		TPM_ContextList_ClearEntry(&(tpm_state->tpm_stclear_data.contextList), r1Resource);
+		TPM_ContextCache_DeleteCount(handle);
 	    }
 	    break;
 	  case TPM_RT_KEY:
@@ -2900,7 +3777,7 @@ TPM_RESULT TPM_Process_FlushSpecific(tpm_state_t *tpm_state,
 	    if (returnCode == TPM_SUCCESS) {
 		printf("TPM_Process_FlushSpecific: Flushing key handle %08x\n", handle);
 		returnCode = TPM_KeyHandleEntries_GetEntry(&tpm_key_handle_entry,
-							   tpm_state->tpm_key_handle_entries,
+							   &(tpm_state->tpm_key_handle_entries),
 							   handle);
 		/* 7. Validate that R1 determined by resourceType and handle points to a valid
 		   allocated resource.	Return TPM_BAD_PARAMETER on error. */
@@ -2933,7 +3810,7 @@ TPM_RESULT TPM_Process_FlushSpecific(tpm_state_t *tpm_state,
 	    /* a. Resources include authorization sessions */
 	    printf("TPM_Process_FlushSpecific: Flushing authorization session handle %08x\n",
 		   handle);
-	    returnCode = TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions,
+	    returnCode = TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions),
 							  handle);
 	    break;
 	  case TPM_RT_TRANS:
@@ -2945,7 +3822,7 @@ TPM_RESULT TPM_Process_FlushSpecific(tpm_state_t *tpm_state,
 	    /* a. Resources include authorization sessions */
 	    printf("TPM_Process_FlushSpecific: Flushing transport session handle %08x\n", handle);
 	    returnCode = TPM_TransportSessions_TerminateHandle
-			 (tpm_state->tpm_stclear_data.transSessions,
+			 (&(tpm_state->tpm_stclear_data.transSessions),
 			  handle,
 			  &(tpm_state->tpm_stany_flags.transportExclusive));
 	    break;
@@ -3056,6 +3933,7 @@ TPM_RESULT TPM_Process_SaveContext(tpm_state_t *tpm_state,
     uint32_t			contextIndex;		/* free index in context list */
     uint32_t			space;			/* free space in context list */
     TPM_BOOL			isZero;
+    TPM_BOOL			cached = FALSE;		/* blob found in the context cache */
     
     /* output parameters */
     uint32_t		outParamStart;			/* starting point of outParam's */
@@ -3137,21 +4015,21 @@ TPM_RESULT TPM_Process_SaveContext(tpm_state_t *tpm_state,
 	    printf("TPM_Process_SaveContext: Resource is key handle %08x\n", handle);
 	    /* check if the key handle is valid */
 	    returnCode = TPM_KeyHandleEntries_GetEntry(&tpm_key_handle_entry,
-						       tpm_state->tpm_key_handle_entries,
+						       &(tpm_state->tpm_key_handle_entries),
 						       handle);
 	    break;
 	  case TPM_RT_AUTH:
 	    /* b. TPM_RT_AUTH */
 	    printf("TPM_Process_SaveContext: Resource is session handle %08x\n", handle);
 	    returnCode = TPM_AuthSessions_GetEntry(&tpm_auth_session_data,
-						   v1StClearData->authSessions,
+						   &(v1StClearData->authSessions),
 						   handle);
 	    break;
 	  case TPM_RT_TRANS:
 	    /* c. TPM_RT_TRANS */
 	    printf("TPM_Process_SaveContext: Resource is transport handle %08x\n", handle);
 	    returnCode = TPM_TransportSessions_GetEntry(&tpm_transport_internal,
-							v1StClearData->transSessions,
+							&(v1StClearData->transSessions),
 							handle);
 	    break;
 	  case TPM_RT_DAA_TPM:	
@@ -3316,7 +4194,7 @@ TPM_RESULT TPM_Process_SaveContext(tpm_state_t *tpm_state,
 	    /* ii. Find contextIndex such that V1 -> contextList[contextIndex] equals 0. If not
 	       found exit with TPM_NOCONTEXTSPACE */
 	    if (returnCode == TPM_SUCCESS) {
-		TPM_ContextList_GetSpace(&space, &contextIndex, v1StClearData->contextList);
+		TPM_ContextList_GetSpace(&space, &contextIndex, &(v1StClearData->contextList));
 		if (space == 0) {
 		    printf("TPM_Process_SaveContext: Error, no space in context list\n");
 		    returnCode = TPM_NOCONTEXTSPACE;
@@ -3326,7 +4204,10 @@ TPM_RESULT TPM_Process_SaveContext(tpm_state_t *tpm_state,
 		/* iii. Increment V1 -> contextCount by 1 */
 		v1StClearData->contextCount++;
 		/* iv. Set V1-> contextList[contextIndex] to V1 -> contextCount */
-		v1StClearData->contextList[contextIndex] = v1StClearData->contextCount;
+		returnCode = TPM_ContextList_SetEntry(&(v1StClearData->contextList), contextIndex,
+						      v1StClearData->contextCount);
+	    }
+	    if (returnCode == TPM_SUCCESS) {
 		/* v. Set B1 -> contextCount to V1 -> contextCount */
 		b1ContextBlob.contextCount = v1StClearData->contextCount;
 	    }	
@@ -3335,12 +4216,12 @@ TPM_RESULT TPM_Process_SaveContext(tpm_state_t *tpm_state,
 	    if (returnCode == TPM_SUCCESS) {
 		switch (resourceType) {
 		  case TPM_RT_AUTH:
-		    returnCode = TPM_AuthSessions_TerminateHandle(v1StClearData->authSessions,
+		    returnCode = TPM_AuthSessions_TerminateHandle(&(v1StClearData->authSessions),
 								  handle);
 		    break;
 		  case TPM_RT_TRANS:
 		    returnCode = TPM_TransportSessions_TerminateHandle
-				 (v1StClearData->transSessions,
+				 (&(v1StClearData->transSessions),
 				  handle,
 				  &(tpm_state->tpm_stany_flags.transportExclusive));
 		    break;
@@ -3357,9 +4238,18 @@ TPM_RESULT TPM_Process_SaveContext(tpm_state_t *tpm_state,
 	    }
 	}
     }
+    /* A key saved again unchanged under the same label gives the identical blob.  If the context
+       cache holds it, the HMAC and encryption are skipped. */
+    if ((returnCode == TPM_SUCCESS) && (resourceType == TPM_RT_KEY)) {
+	returnCode = TPM_ContextCache_GetSaved(&cached,
+					       &b1_sbuffer,
+					       &b1ContextBlob,
+					       tpm_state->tpm_permanent_data.tpmProof,
+					       &c1_sbuffer);
+    }
     /* 11. Calculate B1 -> integrityDigest the HMAC of B1 using TPM_PERMANENT_DATA -> tpmProof as
        the secret.  NOTE It is calculated on the cleartext data */
-    if (returnCode == TPM_SUCCESS) {
+    if ((returnCode == TPM_SUCCESS) && !cached) {
 	/* This is a bit circular.  It's safe since the TPM_CONTEXT_BLOB is serialized before the
 	   HMAC is generated.  The result is put back into the structure.  */
 	printf("TPM_Process_SaveContext: Digesting TPM_CONTEXT_BLOB\n");
@@ -3372,7 +4262,7 @@ TPM_RESULT TPM_Process_SaveContext(tpm_state_t *tpm_state,
     /* 12. Create E1 by encrypting C1 using K1 as the key */
     /* a. Set B1 -> sensitiveSize to the size of E1 */
     /* b. Set B1 -> sensitiveData to E1 */
-    if (returnCode == TPM_SUCCESS) {
+    if ((returnCode == TPM_SUCCESS) && !cached) {
 	/* The cleartext went into sensitiveData for the integrityDigest calculation.  Free it now,
 	   before the encrypted data is stored there. */
 	TPM_SizedBuffer_Delete(&(b1ContextBlob.sensitiveData));
@@ -3385,8 +4275,14 @@ TPM_RESULT TPM_Process_SaveContext(tpm_state_t *tpm_state,
     /* Since the redundant size parameter must be returned, the TPM_CONTEXT_BLOB is serialized
        first.  Later, rather than the usual _Store to the response, the already serialized buffer is
        stored. */
-    if (returnCode == TPM_SUCCESS) {
+    if ((returnCode == TPM_SUCCESS) && !cached) {
 	returnCode = TPM_ContextBlob_Store(&b1_sbuffer, &b1ContextBlob);
+	if (returnCode == TPM_SUCCESS) {
+	    TPM_ContextCache_Add(&b1ContextBlob,
+				 tpm_state->tpm_permanent_data.tpmProof,
+				 &b1_sbuffer,
+				 &c1_sbuffer);
+	}
     }
     /*
       response
@@ -3486,6 +4382,8 @@ TPM_RESULT TPM_Process_LoadContext(tpm_state_t *tpm_state,
     TPM_DIGEST			entityDigest;		/* digest of the entity corresponding to
 							   entityHandle */
     uint32_t			contextIndex;
+    unsigned char		*contextStart = NULL;	/* serialized contextBlob in the command */
+    TPM_BOOL			cached = FALSE;		/* blob found in the context cache */
 
     /* output parameters */
     uint32_t		outParamStart;	/* starting point of outParam's */
@@ -3521,6 +4419,7 @@ TPM_RESULT TPM_Process_LoadContext(tpm_state_t *tpm_state,
     }
     /* get contextBlob parameter */
     if (returnCode == TPM_SUCCESS) {
+	contextStart = command;
 	returnCode = TPM_ContextBlob_Load(&b1ContextBlob, &command, &paramSize);
     }
     /* save the ending point of inParam's for authorization and auditing */
@@ -3560,6 +4459,16 @@ TPM_RESULT TPM_Process_LoadContext(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	/* 2. Map V1 to TPM_STANY_DATA NOTE MAY be TPM_STCLEAR_DATA */
 	v1StClearData = &(tpm_state->tpm_stclear_data);
+	/* A blob that this TPM returned is in the context cache, already decrypted and verified */
+	returnCode = TPM_ContextCache_GetSensitive(&cached,
+						   &m1Decrypt,
+						   &m1_length,
+						   &b1ContextBlob,
+						   tpm_state->tpm_permanent_data.tpmProof,
+						   contextStart,
+						   command - contextStart);
+    }
+    if ((returnCode == TPM_SUCCESS) && !cached) {
 	/* 3. Create M1 by decrypting B1 -> sensitiveData using TPM_PERMANENT_DATA -> contextKey */
 	printf("TPM_Process_LoadContext: Decrypting sensitiveData\n");
 	returnCode = TPM_SymmetricKeyData_Decrypt(&m1Decrypt,		/* decrypted data */
@@ -3702,7 +4611,8 @@ TPM_RESULT TPM_Process_LoadContext(tpm_state_t *tpm_state,
 	}
     }
     /* 6. Validate the structure */
-    if (returnCode == TPM_SUCCESS) {
+    /* NOTE A blob from the context cache is identical to one created under the same tpmProof */
+    if ((returnCode == TPM_SUCCESS) && !cached) {
 	printf("TPM_Process_LoadContext: Checking integrityDigest\n");
 	/* a. Set H1 to B1 -> integrityDigest */
 	/* NOTE Done by TPM_HMAC_CheckStructure() */
@@ -3713,7 +4623,7 @@ TPM_RESULT TPM_Process_LoadContext(tpm_state_t *tpm_state,
     }
     /* d. Create H2 the HMAC of B1 using TPM_PERMANENT_DATA -> tpmProof as the HMAC key */
     /* e. If H2 does not equal H1 return TPM_BADCONTEXT */
-    if (returnCode == TPM_SUCCESS) {
+    if ((returnCode == TPM_SUCCESS) && !cached) {
 	returnCode = TPM_HMAC_CheckStructure
 		     (tpm_state->tpm_permanent_data.tpmProof,		/* key */
 		      &b1ContextBlob,					/* structure */
@@ -3729,12 +4639,13 @@ TPM_RESULT TPM_Process_LoadContext(tpm_state_t *tpm_state,
 	/* b. If not found then return TPM_BADCONTEXT */
 	if (returnCode == TPM_SUCCESS) {
 	    returnCode = TPM_ContextList_GetEntry(&contextIndex,
-						  v1StClearData->contextList,
+						  &(v1StClearData->contextList),
 						  b1ContextBlob.contextCount);
 	}
 	/* c. Set V1 -> contextList[contextIndex] to 0 */
 	if (returnCode == TPM_SUCCESS) {
-	    v1StClearData->contextList[contextIndex] = 0;
+	    TPM_ContextList_ClearEntry(&(v1StClearData->contextList), contextIndex);
+	    TPM_ContextCache_DeleteCount(b1ContextBlob.contextCount);
 	}
     }
     /* 10. Process B1 to return the resource back into TPM use */
@@ -3745,21 +4656,21 @@ TPM_RESULT TPM_Process_LoadContext(tpm_state_t *tpm_state,
 	  case TPM_RT_KEY:
 	    returnCode = TPM_KeyHandleEntries_AddEntry(&(b1ContextBlob.handle),
 						       keepHandle,
-						       tpm_state->tpm_key_handle_entries,
+						       &(tpm_state->tpm_key_handle_entries),
 						       &tpm_key_handle_entry);
 	    key_added = TRUE;
 	    break;
 	  case TPM_RT_AUTH:
 	    returnCode = TPM_AuthSessions_AddEntry(&(b1ContextBlob.handle),	/* input/output */
 						   keepHandle,
-						   v1StClearData->authSessions,
+						   &(v1StClearData->authSessions),
 						   &tpm_auth_session_data);
 	    auth_session_added = TRUE;
 	    break;
 	  case TPM_RT_TRANS:
 	    returnCode = TPM_TransportSessions_AddEntry(&(b1ContextBlob.handle), /* input/output */
 							keepHandle,
-							v1StClearData->transSessions,
+							&(v1StClearData->transSessions),
 							&tpm_transport_internal);
 	    trans_session_added = TRUE;
 	    break;
@@ -3828,14 +4739,14 @@ TPM_RESULT TPM_Process_LoadContext(tpm_state_t *tpm_state,
 	if (key_added) {
 	    /* if there was a failure and inKey was stored in the handle list, free the handle.
 	       Ignore errors, since only one error code can be returned. */
-	    TPM_KeyHandleEntries_DeleteHandle(tpm_state->tpm_key_handle_entries,
+	    TPM_KeyHandleEntries_DeleteHandle(&(tpm_state->tpm_key_handle_entries),
 					      b1ContextBlob.handle);
 	}
 	if (auth_session_added) {
-	    TPM_AuthSessions_TerminateHandle(v1StClearData->authSessions, b1ContextBlob.handle);
+	    TPM_AuthSessions_TerminateHandle(&(v1StClearData->authSessions), b1ContextBlob.handle);
 	}
 	if (trans_session_added) {
-	    TPM_TransportSessions_TerminateHandle(v1StClearData->transSessions,
+	    TPM_TransportSessions_TerminateHandle(&(v1StClearData->transSessions),
 						  b1ContextBlob.handle,
 						  &(tpm_state->tpm_stany_flags.transportExclusive));
 	}
@@ -3881,8 +4792,12 @@ static TPM_RESULT TPM_LoadContext_CheckKeyLoaded(tpm_state_t *tpm_state,
     /* normal case, key is in the key handle list */
     else {
 	rc = TPM_KeyHandleEntries_GetEntry(&key_handle_entry,
-					   tpm_state->tpm_key_handle_entries,
+					   &(tpm_state->tpm_key_handle_entries),
 					   entityHandle);
+	/* read an owner evict key from NV on first use */
+	if (rc == 0) {
+	    rc = TPM_KeyHandleEntry_LoadKey(key_handle_entry, tpm_state->tpm_number);
+	}
 	if (rc == 0) {
 	    TPM_Digest_Copy(entityDigest, key_handle_entry->key->tpm_store_asymkey->pubDataDigest);
 	}
@@ -3917,13 +4832,17 @@ static TPM_RESULT TPM_LoadContext_CheckKeyLoadedByDigest(tpm_state_t *tpm_state,
 	   /* returns TPM_RETRY when at the end of the table, terminates loop */
 	   (TPM_KeyHandleEntries_GetNextEntry(&key_handle_entry,
 					      &current,
-					      tpm_state->tpm_key_handle_entries,
+					      &(tpm_state->tpm_key_handle_entries),
 					      start)) == 0) {
 	
 
 	start = current + 1;
-	rc = TPM_Digest_Compare(entityDigest,
-				key_handle_entry->key->tpm_store_asymkey->pubDataDigest);
+	/* read an owner evict key from NV on first use */
+	rc = TPM_KeyHandleEntry_LoadKey(key_handle_entry, tpm_state->tpm_number);
+	if (rc == 0) {
+	    rc = TPM_Digest_Compare(entityDigest,
+				    key_handle_entry->key->tpm_store_asymkey->pubDataDigest);
+	}
     }
     /* if that failed, check the SRK */
     if (rc != 0) {
@@ -4103,7 +5022,6 @@ TPM_RESULT TPM_Process_KeyControlOwner(tpm_state_t *tpm_state,
     TPM_KEY_HANDLE_ENTRY	*tpm_key_handle_entry;	/* entry for keyHandle */
     TPM_BOOL			isSpace;
     TPM_BOOL			oldOwnerEvict;		/* original owner evict state */
-    uint16_t 			ownerEvictCount;	/* current number of owner evict keys */
     
     /* output parameters */
     uint32_t		outParamStart;	/* starting point of outParam's */
@@ -4211,13 +5129,17 @@ TPM_RESULT TPM_Process_KeyControlOwner(tpm_state_t *tpm_state,
     /* get the key corresponding to the keyHandle parameter */
     if (returnCode == TPM_SUCCESS) {
 	returnCode = TPM_KeyHandleEntries_GetEntry(&tpm_key_handle_entry,
-						   tpm_state->tpm_key_handle_entries,
+						   &(tpm_state->tpm_key_handle_entries),
 						   keyHandle);
 	if (returnCode != TPM_SUCCESS) {
 	    printf("TPM_Process_KeyControlOwner: Error, key handle not loaded\n");
 	    returnCode = TPM_INVALID_KEYHANDLE;
 	}
     }
+    /* read an owner evict key from NV on first use */
+    if (returnCode == TPM_SUCCESS) {
+	returnCode = TPM_KeyHandleEntry_LoadKey(tpm_key_handle_entry, tpm_state->tpm_number);
+    }
     /* If the keyUsage field of the key indicated by keyHandle does not have the value
        TPM_KEY_SIGNING, TPM_KEY_STORAGE, TPM_KEY_IDENTITY, TPM_KEY_BIND, or TPM_KEY_LEGACY, the TPM
        must return the error code TPM_INVALID_KEYUSAGE. */
@@ -4260,7 +5182,7 @@ TPM_RESULT TPM_Process_KeyControlOwner(tpm_state_t *tpm_state,
 		       OwnerEvict bit set, on error return TPM_NOSPACE */
 		    if (returnCode == TPM_SUCCESS) {
 			TPM_KeyHandleEntries_IsEvictSpace(&isSpace,
-							  tpm_state->tpm_key_handle_entries,
+							  &(tpm_state->tpm_key_handle_entries),
 							  2);	/* minSpace */
 			if (!isSpace) {
 			    printf("TPM_Process_KeyControlOwner: Error, "
@@ -4278,24 +5200,14 @@ TPM_RESULT TPM_Process_KeyControlOwner(tpm_state_t *tpm_state,
 			    returnCode = TPM_BAD_PARAMETER;
 			}
 		    }
-		    /* check the current number of occupied owner evict key slots */
-		    if (returnCode == TPM_SUCCESS) {
-			returnCode = TPM_KeyHandleEntries_OwnerEvictGetCount
-				     (&ownerEvictCount,
-				      tpm_state->tpm_key_handle_entries);
-		    }
-		    /* check that the number of owner evict key slots will not be exceeded */
-		    if (returnCode == TPM_SUCCESS) {
-			if (ownerEvictCount == TPM_OWNER_EVICT_KEY_HANDLES) {
-			    printf("TPM_Process_KeyControlOwner: Error, "
-				   "no evict space, only %u evict slots\n",
-				   TPM_OWNER_EVICT_KEY_HANDLES);
-			    returnCode = TPM_NOSPACE;
-			}
-		    }
-		    /* iii. Set ownerEvict within the internal key storage structure to TRUE. */
+		    /* iii. Set ownerEvict within the internal key storage structure to TRUE.
+		       Returns TPM_NOSPACE if the owner evict key slots are full. */
 		    if (returnCode == TPM_SUCCESS) {
-			tpm_key_handle_entry->keyControl |= TPM_KEY_CONTROL_OWNER_EVICT;
+			returnCode =
+			    TPM_KeyHandleEntries_SetOwnerEvict(&(tpm_state->tpm_key_handle_entries),
+							       tpm_key_handle_entry,
+							       TRUE);
+			TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_OE);
 		    }
 		    /* if the old value was FALSE, write the entry to NVRAM */
 		    if (returnCode == TPM_SUCCESS) {
@@ -4314,7 +5226,11 @@ TPM_RESULT TPM_Process_KeyControlOwner(tpm_state_t *tpm_state,
 		    printf("TPM_Process_KeyControlOwner: setting key not owner evict\n");
 		    /* i. Set ownerEvict within the internal key storage structure to FALSE. */
 		    if (returnCode == TPM_SUCCESS) {
-			tpm_key_handle_entry->keyControl &= ~TPM_KEY_CONTROL_OWNER_EVICT;
+			returnCode =
+			    TPM_KeyHandleEntries_SetOwnerEvict(&(tpm_state->tpm_key_handle_entries),
+							       tpm_key_handle_entry,
+							       FALSE);
+			TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_OE);
 		    }
 		    /* if the old value was TRUE, delete the entry from NVRAM */
 		    if (returnCode == TPM_SUCCESS) {
@@ -4387,7 +5303,7 @@ TPM_RESULT TPM_Process_KeyControlOwner(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -4510,9 +5426,13 @@ TPM_RESULT TPM_Process_SaveKeyContext(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	printf("TPM_Process_SaveKeyContext: Handle %08x\n", keyHandle);
 	returnCode = TPM_KeyHandleEntries_GetEntry(&tpm_key_handle_entry,
-						   tpm_state->tpm_key_handle_entries,
+						   &(tpm_state->tpm_key_handle_entries),
 						   keyHandle);
     }
+    /* read an owner evict key from NV on first use */
+    if (returnCode == TPM_SUCCESS) {
+	returnCode = TPM_KeyHandleEntry_LoadKey(tpm_key_handle_entry, tpm_state->tpm_number);
+    }
     /* use the contextNonceKey to invalidate a blob at power up */
     if (returnCode == TPM_SUCCESS) {
 	/* If TPM_STCLEAR_DATA -> contextNonceKey is NULLS */
@@ -4582,7 +5502,8 @@ TPM_RESULT TPM_Process_SaveKeyContext(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	/* free the key resources, free the key itself, and remove entry from the key handle entries
 	   list */
-	TPM_KeyHandleEntry_Delete(tpm_key_handle_entry);
+	TPM_KeyHandleEntries_DeleteEntry(&(tpm_state->tpm_key_handle_entries),
+					 tpm_key_handle_entry);
     }
     /*
       response
@@ -4809,7 +5730,7 @@ TPM_RESULT TPM_Process_LoadKeyContext(tpm_state_t *tpm_state,
 	       keyContextBlob.handle);
 	/* check if the key handle is free */
 	getRc = TPM_KeyHandleEntries_GetEntry(&used_key_handle_entry,
-					      tpm_state->tpm_key_handle_entries,
+					      &(tpm_state->tpm_key_handle_entries),
 					      keyContextBlob.handle);
 	/* GetEntry TPM_SUCCESS means the handle is already used */
 	if (getRc == TPM_SUCCESS) {
@@ -4824,7 +5745,7 @@ TPM_RESULT TPM_Process_LoadKeyContext(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	printf("TPM_Process_LoadKeyContext: Checking for table space\n");
 	TPM_KeyHandleEntries_IsSpace(&isSpace, &index,
-				     tpm_state->tpm_key_handle_entries);
+				     &(tpm_state->tpm_key_handle_entries));
 	/* if there is no space, return error */
 	if (!isSpace) {
 	    printf("TPM_Process_LoadKeyContext: Error, no room in table\n");
@@ -4836,7 +5757,7 @@ TPM_RESULT TPM_Process_LoadKeyContext(tpm_state_t *tpm_state,
 	printf("TPM_Process_LoadKeyContext: Adding entry to table\n");
 	returnCode = TPM_KeyHandleEntries_AddEntry(&keyHandle,
 						   FALSE,		/* keep handle */
-						   tpm_state->tpm_key_handle_entries,
+						   &(tpm_state->tpm_key_handle_entries),
 						   &tpm_key_handle_entry);
 	key_added = TRUE;
     }
@@ -4894,7 +5815,7 @@ TPM_RESULT TPM_Process_LoadKeyContext(tpm_state_t *tpm_state,
 	if (key_added) {
 	    /* if there was a failure and a key was stored in the handle list, free the handle.
 	       Ignore errors, since only one error code can be returned. */
-	    TPM_KeyHandleEntries_DeleteHandle(tpm_state->tpm_key_handle_entries, keyHandle);
+	    TPM_KeyHandleEntries_DeleteHandle(&(tpm_state->tpm_key_handle_entries), keyHandle);
 	}
     }
     return rcf;
@@ -5017,7 +5938,7 @@ TPM_RESULT TPM_Process_SaveAuthContext(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	printf("TPM_Process_SaveAuthContext: Handle %08x\n", authHandle);
 	returnCode = TPM_AuthSessions_GetEntry(&tpm_auth_session_data,
-					       v1StClearData->authSessions,
+					       &(v1StClearData->authSessions),
 					       authHandle);
     }
     if (returnCode == TPM_SUCCESS) {
@@ -5082,7 +6003,7 @@ TPM_RESULT TPM_Process_SaveAuthContext(tpm_state_t *tpm_state,
     /* iii. Find contextIndex such that V1 -> contextList[contextIndex] equals 0. If not
        found exit with TPM_NOCONTEXTSPACE */
     if (returnCode == TPM_SUCCESS) {
-	TPM_ContextList_GetSpace(&space, &contextIndex, v1StClearData->contextList);
+	TPM_ContextList_GetSpace(&space, &contextIndex, &(v1StClearData->contextList));
 	if (space == 0) {
 	    printf("TPM_Process_SaveAuthContext: Error, no space in context list\n");
 	    returnCode = TPM_NOCONTEXTSPACE;
@@ -5090,14 +6011,17 @@ TPM_RESULT TPM_Process_SaveAuthContext(tpm_state_t *tpm_state,
     }
     if (returnCode == TPM_SUCCESS) {
 	/* iv. Set V1-> contextList[contextIndex] to V1 -> contextCount */
-	v1StClearData->contextList[contextIndex] = v1StClearData->contextCount;
+	returnCode = TPM_ContextList_SetEntry(&(v1StClearData->contextList), contextIndex,
+					      v1StClearData->contextCount);
+    }
+    if (returnCode == TPM_SUCCESS) {
 	/* v. Set B1 -> contextCount to V1 -> contextCount */
 	contextBlob.contextCount = v1StClearData->contextCount;
     }	
     /* c. The TPM MUST invalidate all information regarding the resource except for information
        needed for reloading */
     if (returnCode == TPM_SUCCESS) {
-	returnCode = TPM_AuthSessions_TerminateHandle(v1StClearData->authSessions, authHandle);
+	returnCode = TPM_AuthSessions_TerminateHandle(&(v1StClearData->authSessions), authHandle);
     }
     /* Calculate TPM_CONTEXT_BLOB -> integrityDigest, the HMAC of TPM_CONTEXT_BLOB using
        TPM_PERMANENT_DATA -> tpmProof as the secret */
@@ -5438,7 +6362,7 @@ TPM_RESULT TPM_Process_LoadAuthContext(tpm_state_t *tpm_state,
 	       authContextBlob.handle);
 	/* check if the auth handle is free */
 	getRc = TPM_AuthSessions_GetEntry(&used_auth_session_data,
-					  tpm_state->tpm_stclear_data.authSessions,
+					  &(tpm_state->tpm_stclear_data.authSessions),
 					  authContextBlob.handle);
 	/* GetEntry TPM_SUCCESS means the handle is already used */
 	if (getRc == TPM_SUCCESS) {
@@ -5453,11 +6377,11 @@ TPM_RESULT TPM_Process_LoadAuthContext(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	printf("TPM_Process_LoadAuthContext: Checking for table space\n");
 	TPM_AuthSessions_IsSpace(&isSpace, &index,
-				 tpm_state->tpm_stclear_data.authSessions);
+				 &(tpm_state->tpm_stclear_data.authSessions));
 	/* if there is no space, return error */
 	if (!isSpace) {
 	    printf("TPM_Process_LoadAuthContext: Error, no room in table\n");
-	    TPM_AuthSessions_Trace(tpm_state->tpm_stclear_data.authSessions);
+	    TPM_AuthSessions_Trace(&(tpm_state->tpm_stclear_data.authSessions));
 	    returnCode = TPM_RESOURCES;
 	}
     }
@@ -5467,18 +6391,18 @@ TPM_RESULT TPM_Process_LoadAuthContext(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	printf("TPM_Process_LoadAuthContext: Checking contextCount\n");
 	returnCode = TPM_ContextList_GetEntry(&contextIndex,
-					      v1StClearData->contextList,
+					      &(v1StClearData->contextList),
 					      authContextBlob.contextCount);
     }
     /* c. Set V1 -> contextList[contextIndex] to 0 */
     if (returnCode == TPM_SUCCESS) {
-	v1StClearData->contextList[contextIndex] = 0;
+	TPM_ContextList_ClearEntry(&(v1StClearData->contextList), contextIndex);
     }
     /* restore the entity, try to keep the handle as 'handle' */
     if (returnCode == TPM_SUCCESS) {
 	returnCode = TPM_AuthSessions_AddEntry(&authHandle,		/* input/output */
 					       FALSE,			/* keepHandle */
-					       v1StClearData->authSessions,
+					       &(v1StClearData->authSessions),
 					       &tpm_auth_session_data);
 	auth_session_added = TRUE;
     }
@@ -5533,7 +6457,7 @@ TPM_RESULT TPM_Process_LoadAuthContext(tpm_state_t *tpm_state,
     /* if there was a failure, roll back */
     if ((rcf != 0) || (returnCode != TPM_SUCCESS)) {
 	if (auth_session_added) {
-	    TPM_AuthSessionData_Delete(&tpm_auth_session_data);
+	    TPM_AuthSessions_TerminateHandle(&(v1StClearData->authSessions), authHandle);
 	}
     }
     return rcf;
@@ -44,35 +44,60 @@
 #include "tpm_store.h"
 #include "tpm_types.h"
 
+/* authorization session churn statistics, returned by TPM_GetCapability TPM_CAP_MFR
+   TPM_CAP_AUTH_METRICS */
+
+typedef struct tdTPM_AUTH_SESSION_METRICS {
+    uint32_t created;		/* sessions created by OIAP, OSAP, DSAP, or LoadContext */
+    uint32_t terminated;	/* sessions terminated by the TPM or the caller */
+    uint32_t expired;		/* sessions reclaimed after the idle timeout */
+    uint32_t evicted;		/* least recently used sessions reclaimed for a new session */
+    uint32_t exhausted;		/* new sessions refused with TPM_RESOURCES */
+    uint32_t peak;		/* maximum concurrent sessions */
+} TPM_AUTH_SESSION_METRICS;
+
+/* saved session context statistics, returned by TPM_GetCapability TPM_CAP_MFR
+   TPM_CAP_CONTEXT_METRICS */
+
+typedef struct tdTPM_CONTEXT_LIST_METRICS {
+    uint32_t peak;		/* maximum outstanding saved sessions */
+    uint32_t exhausted;		/* saves refused with TPM_NOCONTEXTSPACE */
+} TPM_CONTEXT_LIST_METRICS;
+
 /*
   TPM_AUTH_SESSION_DATA (the entire array)
 */
 
-void       TPM_AuthSessions_Init(TPM_AUTH_SESSION_DATA *authSessions);
-TPM_RESULT TPM_AuthSessions_Load(TPM_AUTH_SESSION_DATA *authSessions,
+void       TPM_AuthSessions_SetSlots(uint32_t slots);
+void       TPM_AuthSessions_SetReclaim(uint32_t idleTimeout, TPM_BOOL lruEvict);
+void       TPM_AuthSessions_GetMetrics(TPM_AUTH_SESSION_METRICS *tpm_auth_session_metrics);
+
+void       TPM_AuthSessions_Init(TPM_AUTH_SESSIONS *authSessions);
+void       TPM_AuthSessions_Free(TPM_AUTH_SESSIONS *authSessions);
+TPM_RESULT TPM_AuthSessions_Load(TPM_AUTH_SESSIONS *authSessions,
                                  unsigned char **stream,
                                  uint32_t *stream_size);
 TPM_RESULT TPM_AuthSessions_Store(TPM_STORE_BUFFER *sbuffer,
-                                  TPM_AUTH_SESSION_DATA *authSessions);
-void       TPM_AuthSessions_Delete(TPM_AUTH_SESSION_DATA *authSessions);
+                                  TPM_AUTH_SESSIONS *authSessions);
+void       TPM_AuthSessions_Delete(TPM_AUTH_SESSIONS *authSessions);
 
 
 void       TPM_AuthSessions_IsSpace(TPM_BOOL *isSpace, uint32_t *index,
-                                    TPM_AUTH_SESSION_DATA *authSessions);
-void       TPM_AuthSessions_Trace(TPM_AUTH_SESSION_DATA *authSessions);
+                                    TPM_AUTH_SESSIONS *authSessions);
+void       TPM_AuthSessions_Trace(TPM_AUTH_SESSIONS *authSessions);
 void       TPM_AuthSessions_GetSpace(uint32_t *space,
-                                     TPM_AUTH_SESSION_DATA *authSessions);
+                                     TPM_AUTH_SESSIONS *authSessions);
 TPM_RESULT TPM_AuthSessions_StoreHandles(TPM_STORE_BUFFER *sbuffer,
-                                         TPM_AUTH_SESSION_DATA *authSessions);
+                                         TPM_AUTH_SESSIONS *authSessions);
 TPM_RESULT TPM_AuthSessions_GetNewHandle(TPM_AUTH_SESSION_DATA **tpm_auth_session_data,
                                          TPM_AUTHHANDLE *authHandle,
-                                         TPM_AUTH_SESSION_DATA *authSessions);
+                                         TPM_AUTH_SESSIONS *authSessions);
 TPM_RESULT TPM_AuthSessions_GetEntry(TPM_AUTH_SESSION_DATA **tpm_auth_session_data,
-                                     TPM_AUTH_SESSION_DATA *authSessions,
+                                     TPM_AUTH_SESSIONS *authSessions,
                                      TPM_AUTHHANDLE authHandle);
 TPM_RESULT TPM_AuthSessions_AddEntry(TPM_HANDLE *tpm_handle,
                                      TPM_BOOL keepHandle,
-                                     TPM_AUTH_SESSION_DATA *authSessions,
+                                     TPM_AUTH_SESSIONS *authSessions,
                                      TPM_AUTH_SESSION_DATA *tpm_auth_session_data);
 TPM_RESULT TPM_AuthSessions_GetData(TPM_AUTH_SESSION_DATA **tpm_auth_session_data,
                                     TPM_SECRET **hmacKey,
@@ -85,16 +110,16 @@ TPM_RESULT TPM_AuthSessions_GetData(TPM_AUTH_SESSION_DATA **tpm_auth_session_dat
                                     TPM_SECRET *entityAuth,
                                     TPM_DIGEST entityDigest);
 
-TPM_RESULT TPM_AuthSessions_TerminateHandle(TPM_AUTH_SESSION_DATA *authSessions,
+TPM_RESULT TPM_AuthSessions_TerminateHandle(TPM_AUTH_SESSIONS *authSessions,
                                             TPM_AUTHHANDLE authHandle);
 void       TPM_AuthSessions_TerminateEntity(TPM_BOOL *continueAuthSession,
                                             TPM_AUTHHANDLE authHandle,
-                                            TPM_AUTH_SESSION_DATA *authSessions,
+                                            TPM_AUTH_SESSIONS *authSessions,
                                             TPM_ENT_TYPE entityType,
                                             TPM_DIGEST *entityDigest);
 void       TPM_AuthSessions_TerminatexSAP(TPM_BOOL *continueAuthSession,
                                           TPM_AUTHHANDLE authHandle,
-                                          TPM_AUTH_SESSION_DATA *authSessions);
+                                          TPM_AUTH_SESSIONS *authSessions);
 
 /*
   TPM_AUTH_SESSION_DATA (one element of the array)
@@ -115,6 +140,9 @@ void       TPM_AuthSessionData_Copy(TPM_AUTH_SESSION_DATA *dest_auth_session_dat
                                     TPM_AUTH_SESSION_DATA *src_auth_session_data);
 TPM_RESULT TPM_AuthSessionData_GetDelegatePublic(TPM_DELEGATE_PUBLIC **delegatePublic,  
                                                  TPM_AUTH_SESSION_DATA *auth_session_data);
+void       TPM_AuthSessionData_GetHmacSchedule(TPM_HMAC_SCHEDULE **tpm_hmac_schedule,
+                                               TPM_AUTH_SESSION_DATA *auth_session_data,
+                                               const TPM_SECRET hmacKey);
 TPM_RESULT TPM_AuthSessionData_CheckEncScheme(TPM_ADIP_ENC_SCHEME adipEncScheme,
                                               TPM_BOOL FIPS);
 TPM_RESULT TPM_AuthSessionData_Decrypt(TPM_DIGEST a1Even,
@@ -129,21 +157,54 @@ TPM_RESULT TPM_AuthSessionData_Decrypt(TPM_DIGEST a1Even,
   Context List
 */
 
-void       TPM_ContextList_Init(uint32_t *contextList);
-TPM_RESULT TPM_ContextList_Load(uint32_t *contextList,
+void       TPM_ContextList_SetSlots(uint32_t slots);
+void       TPM_ContextList_GetMetrics(TPM_CONTEXT_LIST_METRICS *tpm_context_list_metrics);
+
+void       TPM_ContextList_Init(TPM_CONTEXT_LIST *contextList);
+void       TPM_ContextList_Free(TPM_CONTEXT_LIST *contextList);
+TPM_RESULT TPM_ContextList_Load(TPM_CONTEXT_LIST *contextList,
+                                TPM_BOOL counted,
                                 unsigned char **stream,
                                 uint32_t *stream_size);
 TPM_RESULT TPM_ContextList_Store(TPM_STORE_BUFFER *sbuffer,
-                                 const uint32_t *contextList);
+                                 const TPM_CONTEXT_LIST *contextList);
 
 TPM_RESULT TPM_ContextList_StoreHandles(TPM_STORE_BUFFER *sbuffer,
-                                        const uint32_t *contextList);
+                                        const TPM_CONTEXT_LIST *contextList);
 void       TPM_ContextList_GetSpace(uint32_t *space,
                                     uint32_t *entry,
-                                    const uint32_t *contextList);
+                                    const TPM_CONTEXT_LIST *contextList);
+TPM_RESULT TPM_ContextList_SetEntry(TPM_CONTEXT_LIST *contextList,
+                                    uint32_t entry,
+                                    uint32_t value);
 TPM_RESULT TPM_ContextList_GetEntry(uint32_t *entry,
-                                    const uint32_t *contextList,
+                                    const TPM_CONTEXT_LIST *contextList,
                                     uint32_t value);
+void       TPM_ContextList_ClearEntry(TPM_CONTEXT_LIST *contextList,
+                                      uint32_t entry);
+
+/*
+  Context Cache
+*/
+
+void       TPM_ContextCache_SetEntries(uint32_t entries);
+void       TPM_ContextCache_Add(const TPM_CONTEXT_BLOB *tpm_context_blob,
+                                const TPM_SECRET tpmProof,
+                                TPM_STORE_BUFFER *contextBlob,
+                                TPM_STORE_BUFFER *sensitiveData);
+TPM_RESULT TPM_ContextCache_GetSaved(TPM_BOOL *found,
+                                     TPM_STORE_BUFFER *contextBlob,
+                                     const TPM_CONTEXT_BLOB *tpm_context_blob,
+                                     const TPM_SECRET tpmProof,
+                                     TPM_STORE_BUFFER *sensitiveData);
+TPM_RESULT TPM_ContextCache_GetSensitive(TPM_BOOL *found,
+                                         unsigned char **sensitiveData,
+                                         uint32_t *sensitiveSize,
+                                         const TPM_CONTEXT_BLOB *tpm_context_blob,
+                                         const TPM_SECRET tpmProof,
+                                         const unsigned char *contextBlob,
+                                         uint32_t contextSize);
+void       TPM_ContextCache_DeleteCount(uint32_t contextCount);
 
 /*
   TPM_CONTEXT_BLOB
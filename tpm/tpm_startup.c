@@ -39,6 +39,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "tpm_debug.h"
 #include "tpm_error.h"
@@ -56,6 +57,7 @@
 #include "tpm_nvfilename.h"
 #include "tpm_nvram.h"
 #include "tpm_pcr.h"
+#include "tpm_permanent.h"
 #include "tpm_process.h"
 #include "tpm_session.h"
 
@@ -285,6 +287,10 @@ TPM_RESULT TPM_SaveState_NVStore(tpm_state_t *tpm_state)
 
     printf(" TPM_SaveState_NVStore:\n");
     TPM_Sbuffer_Init(&sbuffer);			/* freed @1 */
+    /* the saved state must not be newer than the permanent state in NV */
+    if (rc == 0) {
+	rc = TPM_PermanentAll_NVFlush(tpm_state);
+    }
     /* serialize relevant data from tpm_state  to be written to NV */
     if (rc == 0) {
 	rc = TPM_SaveState_Store(&sbuffer, tpm_state);
@@ -533,10 +539,516 @@ TPM_RESULT TPM_VolatileAll_Store(TPM_STORE_BUFFER *sbuffer,
     return rc;
 }
 
-/* TPM_VolatileAll_NVLoad() deserializes the entire volatile state data from the NV file
-   TPM_VOLATILESTATE_NAME.
+/*
+  Volatile state checkpoints
+
+  In NV, a checkpoint is a TPM_VOLATILE_MANIFEST_NAME manifest holding a sequence number and the
+  copy number and digest of each section.  Each section is stored as its serialization followed by
+  its integrity digest.  A checkpoint writes only the sections that changed since the previous
+  one, to the section copy that the previous manifest does not use, and then writes the manifest
+  selected by the sequence number.  An interrupted checkpoint therefore never damages the
+  previous one, which TPM_VolatileAll_NVLoad() falls back to.
+*/
+
+/* NV base names of the volatile state sections, indexed by TPM_VOLATILE_SECTION_ */
+
+static const char *tpm_volatile_section_names[TPM_VOLATILE_SECTIONS] = {
+    TPM_VOLATILE_FLAGS_NAME,
+    TPM_VOLATILE_STCLEAR_NAME,
+    TPM_VOLATILE_STANY_NAME,
+    TPM_VOLATILE_KEYS_NAME,
+    TPM_VOLATILE_SHA1_NAME,
+    TPM_VOLATILE_NV_NAME
+};
+
+/* TRUE if TPM_VolatileAll_Checkpoint() defers the NV write to TPM_VolatileAll_NVFlush() */
+
+static TPM_BOOL tpm_volatile_deferred = FALSE;
+
+/* TPM_VolatileAll_Name() forms the NV name of copy 'copy' of a section or manifest */
+
+static void TPM_VolatileAll_Name(char *name,		/* at least TPM_FILENAME_MAX */
+				 const char *baseName,
+				 unsigned int copy)
+{
+    sprintf(name, "%s%u", baseName, copy);
+    return;
+}
+
+/* TPM_VolatileAll_LoadSection() deserializes one section of the volatile state from a stream
+   created by TPM_VolatileAll_StoreSection().
+
+   The two functions must be kept in sync.
+*/
+
+static TPM_RESULT TPM_VolatileAll_LoadSection(tpm_state_t *tpm_state,
+					      size_t section,
+					      unsigned char **stream,
+					      uint32_t *stream_size)
+{
+    TPM_RESULT			rc = 0;
+    TPM_PCR_ATTRIBUTES 		pcrAttrib[TPM_NUM_PCR];
+    size_t			i;
+
+    printf(" TPM_VolatileAll_LoadSection: Section %lu\n", (unsigned long)section);
+    switch (section) {
+      case TPM_VOLATILE_SECTION_FLAGS:
+	/* compiled in TPM parameters */
+	rc = TPM_Parameters_Load(stream, stream_size);
+	/* V1 is the TCG standard returned by the getcap */
+	if (rc == 0) {
+	    rc = TPM_CheckTag(TPM_TAG_STCLEAR_FLAGS_V1, stream, stream_size);
+	}
+	if (rc == 0) {
+	    rc = TPM_StclearFlags_Load(&(tpm_state->tpm_stclear_flags), stream, stream_size);
+	}
+	if (rc == 0) {
+	    rc = TPM_StanyFlags_Load(&(tpm_state->tpm_stany_flags), stream, stream_size);
+	}
+	if (rc == 0) {
+	    rc = TPM_Load32(&(tpm_state->transportHandle), stream, stream_size);
+	}
+	if (rc == 0) {
+	    rc = TPM_Load32(&(tpm_state->testState), stream, stream_size);
+	}
+	break;
+      case TPM_VOLATILE_SECTION_STCLEAR:
+	/* normally, resettable PCRs are not restored.  "All" means to restore everything */
+	for (i = 0 ; i < TPM_NUM_PCR ; i++) {
+	    pcrAttrib[i].pcrReset = FALSE;
+	}
+	rc = TPM_StclearData_Load(&(tpm_state->tpm_stclear_data), stream, stream_size,
+				  (TPM_PCR_ATTRIBUTES *)&pcrAttrib);
+	break;
+      case TPM_VOLATILE_SECTION_STANY:
+	rc = TPM_StanyData_Load(&(tpm_state->tpm_stany_data), stream, stream_size);
+	break;
+      case TPM_VOLATILE_SECTION_KEYS:
+	rc = TPM_KeyHandleEntries_Load(tpm_state, stream, stream_size);
+	break;
+      case TPM_VOLATILE_SECTION_SHA1:
+	/* contexts for the SHA1 and TIS SHA1 functions */
+	rc = TPM_Sha1Context_Load(&(tpm_state->sha1_context), stream, stream_size);
+	if (rc == 0) {
+	    rc = TPM_Sha1Context_Load(&(tpm_state->sha1_context_tis), stream, stream_size);
+	}
+	break;
+      case TPM_VOLATILE_SECTION_NV:
+	rc = TPM_NVIndexEntries_LoadVolatile(&(tpm_state->tpm_nv_index_entries),
+					     stream, stream_size);
+	break;
+      default:
+	printf("TPM_VolatileAll_LoadSection: Error (fatal) illegal section %lu\n",
+	       (unsigned long)section);
+	rc = TPM_FAIL;
+	break;
+    }
+    return rc;
+}
+
+/* TPM_VolatileAll_StoreSection() serializes one section of the volatile state into a stream that
+   can be restored through TPM_VolatileAll_LoadSection().
+
+   The two functions must be kept in sync.
+*/
+
+static TPM_RESULT TPM_VolatileAll_StoreSection(TPM_STORE_BUFFER *sbuffer,
+					       size_t section,
+					       tpm_state_t *tpm_state)
+{
+    TPM_RESULT			rc = 0;
+    TPM_PCR_ATTRIBUTES 		pcrAttrib[TPM_NUM_PCR];
+    size_t			i;
+
+    switch (section) {
+      case TPM_VOLATILE_SECTION_FLAGS:
+	rc = TPM_Parameters_Store(sbuffer);
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_STCLEAR_FLAGS_V1);
+	}
+	if (rc == 0) {
+	    rc = TPM_StclearFlags_Store(sbuffer, &(tpm_state->tpm_stclear_flags));
+	}
+	if (rc == 0) {
+	    rc = TPM_StanyFlags_Store(sbuffer, &(tpm_state->tpm_stany_flags));
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append32(sbuffer, tpm_state->transportHandle);
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append32(sbuffer, tpm_state->testState);
+	}
+	break;
+      case TPM_VOLATILE_SECTION_STCLEAR:
+	for (i = 0 ; i < TPM_NUM_PCR ; i++) {
+	    pcrAttrib[i].pcrReset = FALSE;
+	}
+	rc = TPM_StclearData_Store(sbuffer, &(tpm_state->tpm_stclear_data),
+				   (TPM_PCR_ATTRIBUTES *)&pcrAttrib);
+	break;
+      case TPM_VOLATILE_SECTION_STANY:
+	rc = TPM_StanyData_Store(sbuffer, &(tpm_state->tpm_stany_data));
+	break;
+      case TPM_VOLATILE_SECTION_KEYS:
+	rc = TPM_KeyHandleEntries_Store(sbuffer, tpm_state);
+	break;
+      case TPM_VOLATILE_SECTION_SHA1:
+	rc = TPM_Sha1Context_Store(sbuffer, tpm_state->sha1_context);
+	if (rc == 0) {
+	    rc = TPM_Sha1Context_Store(sbuffer, tpm_state->sha1_context_tis);
+	}
+	break;
+      case TPM_VOLATILE_SECTION_NV:
+	rc = TPM_NVIndexEntries_StoreVolatile(sbuffer,
+					      &(tpm_state->tpm_nv_index_entries));
+	break;
+      default:
+	printf("TPM_VolatileAll_StoreSection: Error (fatal) illegal section %lu\n",
+	       (unsigned long)section);
+	rc = TPM_FAIL;
+	break;
+    }
+    return rc;
+}
+
+/* TPM_VolatileAll_Snapshot() serializes the volatile state sections into the pending checkpoint.
+
+   The total size, as the equivalent TPM_VolatileAll_Store() stream, is validated against
+   TPM_MAX_VOLATILESTATE_SPACE.
+*/
+
+static TPM_RESULT TPM_VolatileAll_Snapshot(tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+    const unsigned char *buffer;
+    uint32_t		length;
+    uint32_t		totalLength = sizeof(uint16_t) + TPM_DIGEST_SIZE;	/* tag, digest */
+    size_t		section;
+
+    printf(" TPM_VolatileAll_Snapshot:\n");
+    for (section = 0 ; (rc == 0) && (section < TPM_VOLATILE_SECTIONS) ; section++) {
+	TPM_Sbuffer_Clear(&(tpm_state->volatileCheckpoint[section]));
+	rc = TPM_VolatileAll_StoreSection(&(tpm_state->volatileCheckpoint[section]),
+					  section, tpm_state);
+	if (rc == 0) {
+	    TPM_Sbuffer_Get(&(tpm_state->volatileCheckpoint[section]), &buffer, &length);
+	    totalLength += length;
+	}
+    }
+    if (rc == 0) {
+	printf("   TPM_VolatileAll_Snapshot: Require %u bytes\n", totalLength);
+	if (totalLength > TPM_MAX_VOLATILESTATE_SPACE) {
+	    printf("TPM_VolatileAll_Snapshot: Error, No space, need %u max %u\n",
+		   totalLength, TPM_MAX_VOLATILESTATE_SPACE);
+	    rc = TPM_NOSPACE;
+	}
+    }
+    return rc;
+}
+
+/* TPM_VolatileAll_NVReadManifest() reads manifest 'copy' and returns its contents.
+
+   'valid' is FALSE if the manifest does not exist or fails its integrity check.
+*/
+
+static TPM_RESULT TPM_VolatileAll_NVReadManifest(TPM_BOOL *valid,
+						 uint32_t *sequence,
+						 BYTE *sectionCopies,
+						 TPM_DIGEST *sectionDigests,
+						 uint32_t tpm_number,
+						 unsigned int copy)
+{
+    TPM_RESULT		rc = 0;
+    char		name[TPM_FILENAME_MAX];
+    unsigned char	*stream = NULL;
+    unsigned char	*stream_start = NULL;
+    uint32_t		stream_size;
+    uint16_t		tag = 0;
+    size_t		section;
+
+    *valid = FALSE;
+    TPM_VolatileAll_Name(name, TPM_VOLATILE_MANIFEST_NAME, copy);
+    /* Returns TPM_RETRY on non-existent file */
+    rc = TPM_NVRAM_LoadData(&stream,			/* freed @1 */
+			    &stream_size,
+			    tpm_number,
+			    name);
+    if (rc == 0) {
+	stream_start = stream;			/* save starting point for free() */
+	/* the manifest is the tag, the sequence number, the section copies and digests, and the
+	   manifest integrity digest */
+	if (stream_size != (sizeof(uint16_t) + sizeof(uint32_t) +
+			    (TPM_VOLATILE_SECTIONS * (sizeof(BYTE) + TPM_DIGEST_SIZE)) +
+			    TPM_DIGEST_SIZE)) {
+	    printf("TPM_VolatileAll_NVReadManifest: Error, %s size %u\n", name, stream_size);
+	    rc = TPM_FAIL;
+	}
+    }
+    if (rc == 0) {
+	rc = TPM_SHA1_Check(stream + stream_size - TPM_DIGEST_SIZE,
+			    stream_size - TPM_DIGEST_SIZE, stream,
+			    0, NULL);
+    }
+    if (rc == 0) {
+	rc = TPM_Load16(&tag, &stream, &stream_size);
+    }
+    if (rc == 0) {
+	if (tag != TPM_TAG_VSTATE_V2) {
+	    printf("TPM_VolatileAll_NVReadManifest: Error, %s tag %04hx\n", name, tag);
+	    rc = TPM_FAIL;
+	}
+    }
+    if (rc == 0) {
+	rc = TPM_Load32(sequence, &stream, &stream_size);
+    }
+    for (section = 0 ; (rc == 0) && (section < TPM_VOLATILE_SECTIONS) ; section++) {
+	rc = TPM_Load8(&(sectionCopies[section]), &stream, &stream_size);
+	if (rc == 0) {
+	    rc = TPM_Loadn(sectionDigests[section], TPM_DIGEST_SIZE, &stream, &stream_size);
+	}
+    }
+    if (rc == 0) {
+	*valid = TRUE;
+    }
+    /* a missing or damaged manifest is not an error, the other manifest may be usable */
+    else if (rc != TPM_RETRY) {
+	printf("  TPM_VolatileAll_NVReadManifest: Ignoring %s\n", name);
+    }
+    free(stream_start);					/* @1 */
+    return 0;
+}
+
+/* TPM_VolatileAll_NVLatest() sets the tpm_state sequence number and section copies from the
+   newest manifest in NV.
+
+   It is used when the cached checkpoint does not reflect NV, so that the next checkpoint is newer
+   than, and does not overwrite the sections of, any existing one.
+*/
+
+static TPM_RESULT TPM_VolatileAll_NVLatest(tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+    TPM_BOOL		valid;
+    uint32_t		sequence;
+    BYTE		sectionCopies[TPM_VOLATILE_SECTIONS];
+    TPM_DIGEST		sectionDigests[TPM_VOLATILE_SECTIONS];
+    TPM_BOOL		found = FALSE;
+    unsigned int	copy;
+
+    for (copy = 0 ; (rc == 0) && (copy < 2) ; copy++) {
+	rc = TPM_VolatileAll_NVReadManifest(&valid, &sequence, sectionCopies, sectionDigests,
+					    tpm_state->tpm_number, copy);
+	if ((rc == 0) && valid &&
+	    (!found || ((int32_t)(sequence - tpm_state->volatileSequence) > 0))) {
+	    found = TRUE;
+	    tpm_state->volatileSequence = sequence;
+	    memcpy(tpm_state->volatileSectionCopies, sectionCopies, sizeof(sectionCopies));
+	}
+    }
+    if ((rc == 0) && found) {
+	printf("  TPM_VolatileAll_NVLatest: Continuing from checkpoint %u\n",
+	       tpm_state->volatileSequence);
+    }
+    return rc;
+}
+
+/* TPM_VolatileAll_NVStoreSections() writes the pending checkpoint.
+
+   The changed sections are written to the copy not used by the last checkpoint, and then the
+   manifest is written with the next sequence number.  On failure, the last checkpoint remains the
+   latest consistent one, and the next call rewrites all sections.
+*/
+
+static TPM_RESULT TPM_VolatileAll_NVStoreSections(tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+    TPM_STORE_BUFFER	sbuffer;	/* section serialization and integrity digest */
+    TPM_STORE_BUFFER	manifest;
+    TPM_DIGEST		sectionDigests[TPM_VOLATILE_SECTIONS];
+    BYTE		sectionCopies[TPM_VOLATILE_SECTIONS];
+    TPM_DIGEST		manifestDigest;
+    char		name[TPM_FILENAME_MAX];
+    const unsigned char *buffer;
+    uint32_t		length;
+    uint32_t		sequence;
+    TPM_BOOL		changed = FALSE;
+    size_t		section;
+
+    TPM_Sbuffer_Init(&sbuffer);				/* freed @1 */
+    TPM_Sbuffer_Init(&manifest);			/* freed @2 */
+    if (!tpm_state->volatileSectionsValid) {
+	rc = TPM_VolatileAll_NVLatest(tpm_state);
+    }
+    sequence = tpm_state->volatileSequence + 1;
+    /* write the changed sections */
+    for (section = 0 ; (rc == 0) && (section < TPM_VOLATILE_SECTIONS) ; section++) {
+	TPM_Sbuffer_Get(&(tpm_state->volatileCheckpoint[section]), &buffer, &length);
+	rc = TPM_SHA1(sectionDigests[section],
+		      length, buffer,
+		      0, NULL);
+	if (rc != 0) {
+	    break;
+	}
+	if (tpm_state->volatileSectionsValid &&
+	    (memcmp(tpm_state->volatileSectionDigests[section],
+		    sectionDigests[section], TPM_DIGEST_SIZE) == 0)) {
+	    sectionCopies[section] = tpm_state->volatileSectionCopies[section];
+	    continue;
+	}
+	sectionCopies[section] = tpm_state->volatileSectionCopies[section] ^ 1;
+	TPM_VolatileAll_Name(name, tpm_volatile_section_names[section], sectionCopies[section]);
+	printf("  TPM_VolatileAll_NVStoreSections: Sequence %u writing section %s\n",
+	       sequence, name);
+	changed = TRUE;
+	/* append the integrity digest */
+	TPM_Sbuffer_Clear(&sbuffer);
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_AppendSBuffer(&sbuffer, &(tpm_state->volatileCheckpoint[section]));
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append(&sbuffer, sectionDigests[section], TPM_DIGEST_SIZE);
+	}
+	if (rc == 0) {
+	    TPM_Sbuffer_Get(&sbuffer, &buffer, &length);
+	    rc = TPM_NVRAM_StoreData(buffer,
+				     length,
+				     tpm_state->tpm_number,
+				     name);
+	}
+    }
+    /* write the manifest.  If no section changed, the last checkpoint is current. */
+    if ((rc == 0) && changed) {
+	rc = TPM_Sbuffer_Append16(&manifest, TPM_TAG_VSTATE_V2);
+    }
+    if ((rc == 0) && changed) {
+	rc = TPM_Sbuffer_Append32(&manifest, sequence);
+    }
+    for (section = 0 ; (rc == 0) && changed && (section < TPM_VOLATILE_SECTIONS) ; section++) {
+	rc = TPM_Sbuffer_Append(&manifest, &(sectionCopies[section]), sizeof(BYTE));
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append(&manifest, sectionDigests[section], TPM_DIGEST_SIZE);
+	}
+    }
+    /* append the manifest integrity digest */
+    if ((rc == 0) && changed) {
+	TPM_Sbuffer_Get(&manifest, &buffer, &length);
+	rc = TPM_SHA1(manifestDigest,
+		      length, buffer,
+		      0, NULL);
+    }
+    if ((rc == 0) && changed) {
+	rc = TPM_Sbuffer_Append(&manifest, manifestDigest, TPM_DIGEST_SIZE);
+    }
+    if ((rc == 0) && changed) {
+	TPM_VolatileAll_Name(name, TPM_VOLATILE_MANIFEST_NAME, sequence % 2);
+	TPM_Sbuffer_Get(&manifest, &buffer, &length);
+	rc = TPM_NVRAM_StoreData(buffer,
+				 length,
+				 tpm_state->tpm_number,
+				 name);
+    }
+    /* the first checkpoint after startup supersedes a single stream V1 file */
+    if ((rc == 0) && !tpm_state->volatileSectionsValid) {
+	rc = TPM_NVRAM_DeleteName(tpm_state->tpm_number,
+				  TPM_VOLATILESTATE_NAME,
+				  FALSE);
+    }
+    if ((rc == 0) && changed) {
+	tpm_state->volatileSequence = sequence;
+    }
+    if (rc == 0) {
+	memcpy(tpm_state->volatileSectionCopies, sectionCopies, sizeof(sectionCopies));
+	memcpy(tpm_state->volatileSectionDigests, sectionDigests, sizeof(sectionDigests));
+	tpm_state->volatileSectionsValid = TRUE;
+    }
+    else {
+	tpm_state->volatileSectionsValid = FALSE;
+    }
+    TPM_Sbuffer_Delete(&sbuffer);			/* @1 */
+    TPM_Sbuffer_Delete(&manifest);			/* @2 */
+    return rc;
+}
+
+/* TPM_VolatileAll_NVLoadSections() loads the checkpoint described by a manifest.
 
-   If the file does not exist (a normal startup), returns success.
+   All sections are read and checked against the manifest digests before any is deserialized, so
+   that an inconsistent checkpoint returns 'valid' FALSE and leaves the TPM state unchanged.
+
+   Returns TPM_FAIL if a consistent checkpoint fails to deserialize.
+*/
+
+static TPM_RESULT TPM_VolatileAll_NVLoadSections(TPM_BOOL *valid,
+						 tpm_state_t *tpm_state,
+						 BYTE *sectionCopies,
+						 TPM_DIGEST *sectionDigests)
+{
+    TPM_RESULT		rc = 0;
+    char		name[TPM_FILENAME_MAX];
+    unsigned char	*section_stream_start[TPM_VOLATILE_SECTIONS];
+    uint32_t		section_stream_size[TPM_VOLATILE_SECTIONS];
+    unsigned char	*stream;
+    uint32_t		stream_size;
+    size_t		section;
+
+    *valid = TRUE;
+    for (section = 0 ; section < TPM_VOLATILE_SECTIONS ; section++) {
+	section_stream_start[section] = NULL;
+    }
+    /* read and check each section */
+    for (section = 0 ; *valid && (section < TPM_VOLATILE_SECTIONS) ; section++) {
+	TPM_VolatileAll_Name(name, tpm_volatile_section_names[section], sectionCopies[section]);
+	rc = TPM_NVRAM_LoadData(&(section_stream_start[section]),	/* freed @1 */
+				&(section_stream_size[section]),
+				tpm_state->tpm_number,
+				name);
+	/* the section ends with its integrity digest, which must be the one in the manifest */
+	if (rc == 0) {
+	    if (section_stream_size[section] < TPM_DIGEST_SIZE) {
+		rc = TPM_FAIL;
+	    }
+	}
+	if (rc == 0) {
+	    section_stream_size[section] -= TPM_DIGEST_SIZE;
+	    rc = TPM_SHA1_Check(sectionDigests[section],
+				section_stream_size[section], section_stream_start[section],
+				0, NULL);
+	}
+	if (rc == 0) {
+	    rc = TPM_Digest_Compare(sectionDigests[section],
+				    section_stream_start[section] + section_stream_size[section]);
+	}
+	if (rc != 0) {
+	    printf("  TPM_VolatileAll_NVLoadSections: Section %s does not match manifest\n",
+		   name);
+	    *valid = FALSE;
+	    rc = 0;
+	}
+    }
+    /* deserialize the consistent checkpoint */
+    for (section = 0 ; *valid && (rc == 0) && (section < TPM_VOLATILE_SECTIONS) ; section++) {
+	stream = section_stream_start[section];
+	stream_size = section_stream_size[section];
+	rc = TPM_VolatileAll_LoadSection(tpm_state, section, &stream, &stream_size);
+	/* sanity check the stream size */
+	if (rc == 0) {
+	    if (stream_size != 0) {
+		printf("TPM_VolatileAll_NVLoadSections: Error (fatal) section %s "
+		       "has %u bytes remaining\n",
+		       tpm_volatile_section_names[section], stream_size);
+		rc = TPM_FAIL;
+	    }
+	}
+    }
+    for (section = 0 ; section < TPM_VOLATILE_SECTIONS ; section++) {
+	free(section_stream_start[section]);				/* @1 */
+    }
+    return rc;
+}
+
+/* TPM_VolatileAll_NVLoad() deserializes the entire volatile state data from the latest consistent
+   checkpoint, or from the single stream V1 file TPM_VOLATILESTATE_NAME if there is no checkpoint.
+
+   If neither exists (a normal startup), returns success.
 
    0 on success or non-existant file
    TPM_FAIL on failure to load (fatal), since it should never occur
@@ -546,12 +1058,58 @@ TPM_RESULT TPM_VolatileAll_NVLoad(tpm_state_t *tpm_state)
 {
     TPM_RESULT		rc = 0;
     TPM_BOOL		done = FALSE;
+    TPM_BOOL		manifestValid[2];
+    uint32_t		sequence[2];
+    BYTE		sectionCopies[2][TPM_VOLATILE_SECTIONS];
+    TPM_DIGEST		sectionDigests[2][TPM_VOLATILE_SECTIONS];
+    unsigned int	first;
+    unsigned int	copy;
+    unsigned int	i;
+    TPM_BOOL		valid;
     unsigned char	*stream = NULL;
     unsigned char	*stream_start = NULL;
     uint32_t		stream_size;
     
     printf(" TPM_VolatileAll_NVLoad:\n");
-    if (rc == 0) {
+    tpm_state->volatileSectionsValid = FALSE;
+    tpm_state->volatileCheckpointPending = FALSE;
+    for (copy = 0 ; (rc == 0) && (copy < 2) ; copy++) {
+	rc = TPM_VolatileAll_NVReadManifest(&(manifestValid[copy]),
+					    &(sequence[copy]),
+					    sectionCopies[copy],
+					    sectionDigests[copy],
+					    tpm_state->tpm_number,
+					    copy);
+    }
+    /* try the newest checkpoint first, allowing for sequence number wrap */
+    if (rc == 0) {
+	first = (manifestValid[1] &&
+		 (!manifestValid[0] || ((int32_t)(sequence[1] - sequence[0]) > 0))) ? 1 : 0;
+    }
+    for (i = 0 ; (rc == 0) && !done && (i < 2) ; i++) {
+	copy = first ^ i;
+	if (!manifestValid[copy]) {
+	    continue;
+	}
+	printf("  TPM_VolatileAll_NVLoad: Loading checkpoint %u\n", sequence[copy]);
+	rc = TPM_VolatileAll_NVLoadSections(&valid, tpm_state,
+					    sectionCopies[copy], sectionDigests[copy]);
+	if ((rc == 0) && valid) {
+	    done = TRUE;
+	    tpm_state->volatileSequence = sequence[copy];
+	    memcpy(tpm_state->volatileSectionCopies, sectionCopies[copy],
+		   sizeof(sectionCopies[copy]));
+	    memcpy(tpm_state->volatileSectionDigests, sectionDigests[copy],
+		   sizeof(sectionDigests[copy]));
+	    tpm_state->volatileSectionsValid = TRUE;
+	}
+    }
+    /* a checkpoint exists, but none is consistent */
+    if ((rc == 0) && !done && (manifestValid[0] || manifestValid[1])) {
+	printf("TPM_VolatileAll_NVLoad: Error (fatal) no consistent checkpoint\n");
+	rc = TPM_FAIL;
+    }
+    if ((rc == 0) && !done) {
 	/* load from NVRAM.  Returns TPM_RETRY on non-existent file. */
 	rc = TPM_NVRAM_LoadData(&stream,			/* freed @1 */
 				&stream_size,
@@ -585,42 +1143,85 @@ TPM_RESULT TPM_VolatileAll_NVLoad(tpm_state_t *tpm_state)
     return rc;
 }
 
-/* TPM_VolatileAll_NVStore() serializes the entire volatile state data and stores it in the NV file
-   TPM_VOLATILESTATE_NAME
+/* TPM_VolatileAll_NVStore() serializes the entire volatile state data and writes the changed
+   sections to NV as a new checkpoint.  Any deferred checkpoint is superseded.
 */
 
 TPM_RESULT TPM_VolatileAll_NVStore(tpm_state_t *tpm_state)
 {
     TPM_RESULT		rc = 0;
-    TPM_STORE_BUFFER	sbuffer;		/* safe buffer for storing binary data */
-    const unsigned char *buffer;
-    uint32_t		length;
 
     printf(" TPM_VolatileAll_NVStore:\n");
-    TPM_Sbuffer_Init(&sbuffer);			/* freed @1 */
-    /* serialize relevant data from tpm_state  to be written to NV */
     if (rc == 0) {
-	rc = TPM_VolatileAll_Store(&sbuffer, tpm_state);
-	/* get the serialized buffer and its length */
-	TPM_Sbuffer_Get(&sbuffer, &buffer, &length);
+	rc = TPM_VolatileAll_Snapshot(tpm_state);
     }
-    /* validate the length of the stream */
     if (rc == 0) {
-	printf("   TPM_VolatileAll_NVStore: Require %u bytes\n", length);
-	if (length > TPM_MAX_VOLATILESTATE_SPACE) {
-	    printf("TPM_VolatileAll_NVStore: Error, No space, need %u max %u\n",
-		   length, TPM_MAX_VOLATILESTATE_SPACE);
-	    rc = TPM_NOSPACE;
-	}
+	rc = TPM_VolatileAll_NVStoreSections(tpm_state);
     }
     if (rc == 0) {
-	/* store the buffer in NVRAM */
-	rc = TPM_NVRAM_StoreData(buffer,
-				 length,
-				 tpm_state->tpm_number,
-				 TPM_VOLATILESTATE_NAME);
+	tpm_state->volatileCheckpointPending = FALSE;
+    }
+    return rc;
+}
+
+/* TPM_VolatileAll_Checkpoint() is called after each successful ordinal to checkpoint the volatile
+   state for a fail-over restart.
+
+   The state is serialized immediately, so that the checkpoint is consistent with the ordinal
+   response.  If deferred checkpoints are enabled, the NV write is left to
+   TPM_VolatileAll_NVFlush(), typically after the response is sent.  A later checkpoint supersedes
+   one that was not yet flushed.
+*/
+
+TPM_RESULT TPM_VolatileAll_Checkpoint(tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+
+    if (rc == 0) {
+	rc = TPM_VolatileAll_Snapshot(tpm_state);
+    }
+    if (rc == 0) {
+	if (tpm_volatile_deferred) {
+	    printf("   TPM_VolatileAll_Checkpoint: Deferring write\n");
+	    tpm_state->volatileCheckpointPending = TRUE;
+	}
+	else {
+	    rc = TPM_VolatileAll_NVStoreSections(tpm_state);
+	}
+    }
+    return rc;
+}
+
+/* TPM_VolatileAll_SetDeferred() enables or disables deferring TPM_VolatileAll_Checkpoint()
+   writes to TPM_VolatileAll_NVFlush().
+*/
+
+void TPM_VolatileAll_SetDeferred(TPM_BOOL deferred)
+{
+    printf(" TPM_VolatileAll_SetDeferred: %u\n", deferred);
+    tpm_volatile_deferred = deferred;
+    return;
+}
+
+/* TPM_VolatileAll_NVFlush() writes a checkpoint deferred by TPM_VolatileAll_Checkpoint().
+
+   On failure, the checkpoint stays pending and is retried by the next call.
+*/
+
+TPM_RESULT TPM_VolatileAll_NVFlush(tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+
+    if (tpm_state->volatileCheckpointPending) {
+	printf(" TPM_VolatileAll_NVFlush:\n");
+	rc = TPM_VolatileAll_NVStoreSections(tpm_state);
+	if (rc == 0) {
+	    tpm_state->volatileCheckpointPending = FALSE;
+	}
+	else {
+	    printf("TPM_VolatileAll_NVFlush: Error writing checkpoint, rc %08x\n", rc);
+	}
     }
-    TPM_Sbuffer_Delete(&sbuffer);	/* @1 */
     return rc;
 }
 
@@ -1193,6 +1794,7 @@ TPM_RESULT TPM_Startup_Clear(tpm_state_t *tpm_state)
 	/* bReadSTClear and bWriteSTClear are volatile, in that they are set FALSE at
 	   TPM_Startup(ST_Clear) */
 	TPM_NVIndexEntries_StClear(&(tpm_state->tpm_nv_index_entries));
+	TPM_PermanentAll_SetDirty(tpm_state, TPM_PERMANENT_DIRTY_NV);
     }
     return returnCode;
 }
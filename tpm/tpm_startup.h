@@ -82,6 +82,9 @@ TPM_RESULT TPM_VolatileAll_Store(TPM_STORE_BUFFER *sbuffer,
 				 tpm_state_t *tpm_state);
 TPM_RESULT TPM_VolatileAll_NVLoad(tpm_state_t *tpm_state);
 TPM_RESULT TPM_VolatileAll_NVStore(tpm_state_t *tpm_state);
+TPM_RESULT TPM_VolatileAll_Checkpoint(tpm_state_t *tpm_state);
+void       TPM_VolatileAll_SetDeferred(TPM_BOOL deferred);
+TPM_RESULT TPM_VolatileAll_NVFlush(tpm_state_t *tpm_state);
 
 /*
   Compiled in TPM Parameters
@@ -1118,7 +1118,7 @@ TPM_RESULT TPM_Process_Seal(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -1506,7 +1506,7 @@ TPM_RESULT TPM_Process_Sealx(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -1979,13 +1979,13 @@ TPM_RESULT TPM_Process_Unseal(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     if (((rcf != 0) ||
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueDataSession) &&
 	dataAuthHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, dataAuthHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), dataAuthHandle);
     }
     /*
       cleanup
@@ -2298,7 +2298,7 @@ TPM_RESULT TPM_Process_UnBind(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -2669,7 +2669,7 @@ TPM_RESULT TPM_Process_CreateWrapKey(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /* cleanup */
     TPM_Key_Delete(&keyInfo);			/* @1 */
@@ -2873,7 +2873,7 @@ TPM_RESULT TPM_Process_LoadKey(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -2885,7 +2885,7 @@ TPM_RESULT TPM_Process_LoadKey(tpm_state_t *tpm_state,
 	if (key_added) {
 	    /* if there was a failure and inKey was stored in the handle list, free the handle.
 	       Ignore errors, since only one error code can be returned. */
-	    TPM_KeyHandleEntries_DeleteHandle(tpm_state->tpm_key_handle_entries, inKeyHandle);
+	    TPM_KeyHandleEntries_DeleteHandle(&(tpm_state->tpm_key_handle_entries), inKeyHandle);
 	}	
     }
     return rcf;
@@ -3109,7 +3109,7 @@ TPM_RESULT TPM_Process_LoadKey2(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -3121,7 +3121,7 @@ TPM_RESULT TPM_Process_LoadKey2(tpm_state_t *tpm_state,
 	if (key_added) {
 	    /* if there was a failure and inKey was stored in the handle list, free the handle.
 	       Ignore errors, since only one error code can be returned. */
-	    TPM_KeyHandleEntries_DeleteHandle(tpm_state->tpm_key_handle_entries, inKeyHandle);
+	    TPM_KeyHandleEntries_DeleteHandle(&(tpm_state->tpm_key_handle_entries), inKeyHandle);
 	}	
     }
     return rcf;
@@ -3313,7 +3313,7 @@ static TPM_RESULT TPM_LoadKeyCommon(TPM_KEY_HANDLE	*inKeyHandle,	/* output */
     if (rc == TPM_SUCCESS) {
 	*inKeyHandle = 0;	/* no preferred value */
 	rc = TPM_KeyHandleEntries_AddKeyEntry(inKeyHandle,			/* output */
-					      tpm_state->tpm_key_handle_entries, /* input */
+					      &(tpm_state->tpm_key_handle_entries), /* input */
 					      inKey,				/* input */
 					      parentPCRStatus,
 					      0);			/* keyControl */
@@ -3331,7 +3331,7 @@ static TPM_RESULT TPM_LoadKeyCommon(TPM_KEY_HANDLE	*inKeyHandle,	/* output */
     }
     if (rc == TPM_SUCCESS) {
 	if (parentPCRUsage) {
-	    rc = TPM_KeyHandleEntries_SetParentPCRStatus(tpm_state->tpm_key_handle_entries,
+	    rc = TPM_KeyHandleEntries_SetParentPCRStatus(&(tpm_state->tpm_key_handle_entries),
 							 *inKeyHandle, TRUE);
 	}
     }	
@@ -3581,7 +3581,7 @@ TPM_RESULT TPM_Process_GetPubKey(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
@@ -894,7 +894,8 @@ typedef struct tdTPM_PUBKEY {
 /* Set the default to 3 so that there can be one owner evict key */
 
 #ifndef TPM_KEY_HANDLES 
-#define TPM_KEY_HANDLES 3     /* entries in global TPM_KEY_HANDLE_ENTRY array */
+#define TPM_KEY_HANDLES 3     /* default and minimum entries in the global key handle table, can
+				 be raised at startup, see TPM_KeyHandleEntries_SetKeyHandles() */
 #endif
 
 /* TPM_GetCapability uses a uint_16 for the number of key slots */
@@ -908,6 +909,9 @@ typedef struct tdTPM_PUBKEY {
 
    A value greater than (TPM_KEY_HANDLES - 2) is useless, as the TPM reserves 2 key slots for
    non-owner evict keys to avoid blocking.
+
+   This is the default and minimum.  It can be raised at startup, see
+   TPM_KeyHandleEntries_SetOwnerEvictKeyHandles().
 */
 
 #ifndef TPM_OWNER_EVICT_KEY_HANDLES 
@@ -929,8 +933,52 @@ typedef struct tdTPM_KEY_HANDLE_ENTRY {
     TPM_BOOL parentPCRStatus;   /* TRUE if parent of this key uses PCR's */
     TPM_KEY_CONTROL keyControl; /* Attributes that can control various aspects of key usage and
                                    manipulation. */
+    TPM_BOOL lazyKey;		/* TRUE if key is a placeholder, read from its owner evict NV file
+				   by TPM_KeyHandleEntry_LoadKey() */
+    BYTE keyCopy;		/* owner evict NV file copy, 0 or 1, or TPM_KEY_COPY_NONE if
+				   keyDigest is not yet calculated */
+    TPM_DIGEST keyDigest;	/* digest of the owner evict NV file */
 } TPM_KEY_HANDLE_ENTRY; 
 
+#define TPM_KEY_COPY_NONE	0xff
+
+/* TPM_KEY_HANDLE_ENTRIES is the table of loaded keys.  The number of slots is set at TPM
+   initialization.
+
+   Occupied slots are chained from a hash of the key handle, empty slots are chained on a free list.
+   A slot is on exactly one chain, so both share the 'next' array.  Chain links hold the slot
+   number plus one, 0 terminates.
+*/
+
+typedef struct tdTPM_KEY_HANDLE_ENTRIES {
+    uint32_t keyHandles;		/* number of slots */
+    TPM_KEY_HANDLE_ENTRY *entries;	/* array of keyHandles slots */
+    uint32_t *next;			/* array of keyHandles chain links */
+    uint32_t *buckets;			/* array of hashSize hash chain heads */
+    uint32_t hashSize;			/* power of 2 */
+    uint32_t freeHead;			/* head of the free list */
+    uint32_t freeCount;			/* number of empty slots */
+    uint32_t ownerEvictKeyHandles;	/* maximum number of owner evict keys */
+    uint32_t *ownerEvict;		/* array of owner evict slots, sorted by handle */
+    uint32_t ownerEvictCount;		/* number of owner evict keys */
+} TPM_KEY_HANDLE_ENTRIES;
+
+/* TPM_OWNER_EVICT_FILES
+
+   The NV file copy and digest of each owner evict key as last written to or read from NV
+*/
+
+typedef struct tdTPM_OWNER_EVICT_FILE {
+    TPM_KEY_HANDLE handle;
+    BYTE keyCopy;
+    TPM_DIGEST keyDigest;
+} TPM_OWNER_EVICT_FILE;
+
+typedef struct tdTPM_OWNER_EVICT_FILES {
+    uint32_t count;
+    TPM_OWNER_EVICT_FILE *file;			/* array sorted by handle */
+} TPM_OWNER_EVICT_FILES;
+
 /* 5.12 TPM_MIGRATIONKEYAUTH rev 87
 
    This structure provides the proof that the associated public key has TPM Owner authorization to
@@ -1171,6 +1219,9 @@ typedef struct tdTPM_FAMILY_TABLE_ENTRY {
 
    The family table is stored in a TPM shielded location. There are no confidential values in the
    family table.  The family table contains a minimum of 8 rows.
+
+   TPM_NUM_FAMILY_TABLE_ENTRY_MIN is the default and minimum number of rows.  It can be raised
+   at startup with TPM_FamilyTable_SetRows().
 */
 
 #ifdef TPM_NUM_FAMILY_TABLE_ENTRY_MIN 
@@ -1184,7 +1235,14 @@ typedef struct tdTPM_FAMILY_TABLE_ENTRY {
 #endif
 
 typedef struct tdTPM_FAMILY_TABLE { 
-    TPM_FAMILY_TABLE_ENTRY famTableRow[TPM_NUM_FAMILY_TABLE_ENTRY_MIN]; 
+    TPM_FAMILY_TABLE_ENTRY *famTableRow;	/* array of 'rows' entries */
+    /* NOTE Added */
+    uint32_t rows;
+    uint32_t *next;		/* per row, the next row + 1 in its hash chain or the free list, 0
+				   at the end */
+    uint32_t *buckets;		/* hash of familyID, the first row + 1 in the chain, 0 if empty */
+    uint32_t hashSize;		/* number of buckets, a power of 2 */
+    uint32_t freeHead;		/* the first invalid row + 1, 0 if none */
 } TPM_FAMILY_TABLE;
 
 /* 20.7 TPM_DELEGATE_LABEL rev 87
@@ -1254,6 +1312,9 @@ typedef struct tdTPM_DELEGATE_TABLE_ROW {
    This is the delegate table. The table contains a minimum of 2 rows.
 
    This will be an entry in the TPM_PERMANENT_DATA structure.
+
+   TPM_NUM_DELEGATE_TABLE_ENTRY_MIN is the default and minimum number of rows.  It can be raised
+   at startup with TPM_DelegateTable_SetRows().
 */
 
 #ifdef TPM_NUM_DELEGATE_TABLE_ENTRY_MIN 
@@ -1268,7 +1329,9 @@ typedef struct tdTPM_DELEGATE_TABLE_ROW {
 
 
 typedef struct tdTPM_DELEGATE_TABLE { 
-    TPM_DELEGATE_TABLE_ROW delRow[TPM_NUM_DELEGATE_TABLE_ENTRY_MIN]; /* The array of delegations */
+    TPM_DELEGATE_TABLE_ROW *delRow;	/* The array of delegations */
+    /* NOTE Added */
+    uint32_t rows;			/* number of rows in delRow */
 } TPM_DELEGATE_TABLE; 
 
 /* 20.11 TPM_DELEGATE_SENSITIVE rev 115
@@ -1426,8 +1489,30 @@ typedef struct tdTPM_TRANSPORT_INTERNAL {
     TPM_DIGEST transDigest;             /* The log of transport events */
     /* added kgold */
     TPM_BOOL valid;                     /* entry is valid */
+    /* symmetric key schedule expanded from authData, not serialized, calculated on first use */
+    TPM_SYMMETRIC_KEY_TOKEN symmetricKey;
 } TPM_TRANSPORT_INTERNAL;
 
+/* TPM_TRANSPORT_SESSIONS is the table of active transport sessions.
+
+   The number of slots is set at TPM initialization, and the arrays are allocated on first use.
+   Valid slots are chained from a hash of the handle.  Empty slots are chained on a free list.
+   Links hold the slot number plus one, 0 terminates.
+
+   NOTE: Vendor specific
+*/
+
+typedef struct tdTPM_TRANSPORT_SESSIONS {
+    uint32_t slots;			/* number of slots */
+    TPM_TRANSPORT_INTERNAL *entries;	/* array of slots sessions, NULL until first use */
+    uint32_t *links;			/* array of slots links, hash chain if the slot is
+					   valid, else free list */
+    uint32_t *buckets;			/* array of hashSize hash chain heads */
+    uint32_t hashSize;			/* power of 2 */
+    uint32_t freeHead;			/* head of the free list */
+    uint32_t freeCount;			/* number of empty slots */
+} TPM_TRANSPORT_SESSIONS;
+
 /* 13.3 TPM_TRANSPORT_LOG_IN rev 87
 
    The logging of transport commands occurs in two steps, before execution with the input 
@@ -1996,7 +2081,29 @@ typedef struct tdTPM_PERMANENT_DATA {
 #endif
 
 #ifndef TPM_MIN_AUTH_SESSIONS 
-#define TPM_MIN_AUTH_SESSIONS 3
+#define TPM_MIN_AUTH_SESSIONS 3	/* default and minimum authorization session slots, can be raised
+				   at startup, see TPM_AuthSessions_SetSlots() */
+#endif
+
+/* TPM_HMAC_SCHEDULE caches the SHA-1 contexts after digesting the HMAC key XOR ipad and key XOR
+   opad blocks.  An HMAC using the same key can start from these contexts rather than redoing the
+   two padded key compressions.
+
+   NOTE: Vendor specific
+*/
+
+typedef struct tdTPM_HMAC_SCHEDULE {
+    TPM_BOOL valid;             /* the contexts below are computed from key */
+    TPM_SECRET key;             /* the HMAC key */
+    void *innerContext;         /* platform dependent SHA-1 context after key XOR ipad */
+    void *outerContext;         /* platform dependent SHA-1 context after key XOR opad */
+} TPM_HMAC_SCHEDULE;
+
+/* The number of HMAC key schedules cached per authorization session.  OSAP and DSAP sessions use
+   only the shared secret.  OIAP sessions may alternate between several entities. */
+
+#ifndef TPM_AUTH_SESSION_HMAC_SCHEDULES
+#define TPM_AUTH_SESSION_HMAC_SCHEDULES 2
 #endif
 
 /* NOTE: Vendor specific */
@@ -2013,8 +2120,45 @@ typedef struct tdTPM_AUTH_SESSION_DATA {
     TPM_DIGEST entityDigest;    /* OSAP tracks which entity established the OSAP session */
     TPM_DELEGATE_PUBLIC pub;    /* DSAP */
     TPM_BOOL valid;             /* added kgold: array entry is valid */
+    /* HMAC key schedules, not serialized, recalculated on first use */
+    TPM_HMAC_SCHEDULE hmacSchedules[TPM_AUTH_SESSION_HMAC_SCHEDULES];
+    uint32_t hmacScheduleNext;  /* next schedule to replace when all are in use */
 } TPM_AUTH_SESSION_DATA;
 
+/* TPM_AUTH_SESSION_SLOT holds the table links for one authorization session slot.  Links hold the
+   slot number plus one, 0 terminates.
+
+   NOTE: Vendor specific
+*/
+
+typedef struct tdTPM_AUTH_SESSION_SLOT {
+    uint32_t next;		/* hash chain if the slot is valid, else free list */
+    uint32_t lruPrev;		/* use order of valid slots */
+    uint32_t lruNext;
+    uint32_t lastUsed;		/* seconds, time of creation or last authorization */
+} TPM_AUTH_SESSION_SLOT;
+
+/* TPM_AUTH_SESSIONS is the table of active authorization sessions.
+
+   The number of slots is set at TPM initialization, and the arrays are allocated on first use.
+   Valid slots are chained from a hash of the handle and kept in use order, least recently used
+   first.  Empty slots are chained on a free list.
+
+   NOTE: Vendor specific
+*/
+
+typedef struct tdTPM_AUTH_SESSIONS {
+    uint32_t slots;			/* number of slots */
+    TPM_AUTH_SESSION_DATA *entries;	/* array of slots sessions, NULL until first use */
+    TPM_AUTH_SESSION_SLOT *links;	/* array of slots links */
+    uint32_t *buckets;			/* array of hashSize hash chain heads */
+    uint32_t hashSize;			/* power of 2 */
+    uint32_t freeHead;			/* head of the free list */
+    uint32_t freeCount;			/* number of empty slots */
+    uint32_t lruHead;			/* least recently used valid slot */
+    uint32_t lruTail;			/* most recently used valid slot */
+} TPM_AUTH_SESSIONS;
+
 
 /* 3.   contextList MUST support a minimum of 16 entries, it MAY support more. */
 
@@ -2028,6 +2172,26 @@ typedef struct tdTPM_AUTH_SESSION_DATA {
 #define TPM_MIN_SESSION_LIST 16
 #endif
 
+/* TPM_CONTEXT_LIST is the list of outstanding saved session context counts.
+
+   The number of slots is set at TPM initialization, and the arrays are allocated on first use.
+   Valid slots are chained from a hash of the context count.  Empty slots hold 0 and are chained on
+   a free list.  Links hold the slot number plus one, 0 terminates.
+
+   NOTE: Vendor specific
+*/
+
+typedef struct tdTPM_CONTEXT_LIST {
+    uint32_t slots;			/* number of slots */
+    uint32_t *entries;			/* array of slots context counts, NULL until first use */
+    uint32_t *links;			/* array of slots links, hash chain if the slot is
+					   valid, else free list */
+    uint32_t *buckets;			/* array of hashSize hash chain heads */
+    uint32_t hashSize;			/* power of 2 */
+    uint32_t freeHead;			/* head of the free list */
+    uint32_t freeCount;			/* number of empty slots */
+} TPM_CONTEXT_LIST;
+
 /* 7.5 TPM_STCLEAR_DATA rev 101
 
    This is an informative structure and not normative. It is purely for convenience of writing the
@@ -2071,11 +2235,10 @@ typedef struct tdTPM_STCLEAR_DATA {
     uint32_t authFailTime;	/* time of threshold failure in seconds */
     /* NOTE: Moved from TPM_STANY_DATA.  Saving this state is optional.  This implementation
        does. */
-    TPM_AUTH_SESSION_DATA authSessions[TPM_MIN_AUTH_SESSIONS];  /* List of current
-                                                                   sessions. Sessions can be OSAP,
-                                                                   OIAP, DSAP and Transport */
+    TPM_AUTH_SESSIONS authSessions;	/* List of current sessions. Sessions can be OSAP, OIAP,
+					   DSAP and Transport */
     /* NOTE: Added for transport */
-    TPM_TRANSPORT_INTERNAL transSessions[TPM_MIN_TRANS_SESSIONS];
+    TPM_TRANSPORT_SESSIONS transSessions;
     /* 22.7 TPM_STANY_DATA Additions (for DAA) - moved to TPM_STCLEAR_DATA for startup state */
     TPM_DAA_SESSION_DATA daaSessions[TPM_MIN_DAA_SESSIONS];
     /* 1. The group of contextNonceSession, contextCount, contextList MUST reset at the same
@@ -2088,10 +2251,10 @@ typedef struct tdTPM_STCLEAR_DATA {
                                            attacks.  This MUST be set to 0 on each TPM_Startup
                                            (ST_Clear).  The value MAY be set to 0 on TPM_Startup
                                            (any). */
-    uint32_t contextList[TPM_MIN_SESSION_LIST];	/* This is the list of outstanding session blobs.
-                                                   All elements of this array MUST be set to 0 on
-                                                   each TPM_Startup (ST_Clear).  The values MAY be
-                                                   set to 0 on TPM_Startup (any). */
+    TPM_CONTEXT_LIST contextList;	/* This is the list of outstanding session blobs.  All
+                                           elements of this array MUST be set to 0 on each
+                                           TPM_Startup (ST_Clear).  The values MAY be set to 0 on
+                                           TPM_Startup (any). */
     /* NOTE Added auditDigest effect, saved with ST_STATE */
     TPM_DIGEST auditDigest;             /* This is the extended value that is the audit log. This
                                            SHALL be set to all zeros at the start of each audit
@@ -2431,6 +2594,24 @@ typedef struct tdTPM_CONTEXT_SENSITIVE {
     TPM_SIZED_BUFFER internalData;      /* The internal data area */
 } TPM_CONTEXT_SENSITIVE;
 
+/* TPM_CONTEXT_CACHE_ENTRY holds a context blob returned by TPM_SaveContext together with its
+   decrypted TPM_CONTEXT_SENSITIVE, so that loading the identical blob again needs neither the
+   decryption nor the integrity HMAC.
+
+   NOTE: Vendor specific
+*/
+
+typedef struct tdTPM_CONTEXT_CACHE_ENTRY {
+    TPM_RESOURCE_TYPE resourceType;     /* 0 if the entry is free */
+    TPM_HANDLE handle;
+    BYTE label[TPM_CONTEXT_LABEL_SIZE];
+    uint32_t contextCount;
+    TPM_DIGEST integrityDigest;
+    TPM_SECRET tpmProof;                /* the HMAC key that the blob was created with */
+    TPM_SIZED_BUFFER contextBlob;       /* serialized TPM_CONTEXT_BLOB */
+    TPM_SIZED_BUFFER sensitiveData;     /* serialized TPM_CONTEXT_SENSITIVE in clear text */
+} TPM_CONTEXT_CACHE_ENTRY;
+
 /* 19.2 TPM_NV_ATTRIBUTES rev 99
 
    This structure allows the TPM to keep track of the data and permissions to manipulate the area. 
@@ -2489,13 +2670,45 @@ typedef struct tdTPM_NV_DATA_SENSITIVE {
                                    the TPM does not provide any confidentiality on the data. */
     /* NOTE Added kg */
     TPM_DIGEST digest;          /* for OSAP comparison */
+    /* NOTE Added.  If data is NULL, the data area in the TPM_NV_INDEX_ENTRIES lazyStream, copied
+       to data on first access */
+    const BYTE *lazyData;
+    /* NOTE Added.  The data area is stored in its own NV file.  The section holding the entry
+       records the digest of the data and the file copy, 0 or 1.  If data and lazyData are both
+       NULL, the data area is read from the file on first access. */
+    TPM_DIGEST dataDigest;
+    BYTE dataCopy;
 } TPM_NV_DATA_SENSITIVE;
 
 typedef struct tdTPM_NV_INDEX_ENTRIES {
     uint32_t nvIndexCount;			/* number of entries */
     TPM_NV_DATA_SENSITIVE *tpm_nvindex_entry;	/* array of TPM_NV_DATA_SENSITIVE */
+    unsigned char *lazyStream;			/* NV stream holding lazyData, or NULL */
+    /* open addressing index from nvIndex to slot number plus one, 0 if empty.  Rebuilt on the
+       next lookup after hashValid is cleared. */
+    uint32_t *hashTable;
+    uint32_t hashSize;				/* power of 2 */
+    TPM_BOOL hashValid;
+    uint32_t freeCount;				/* unused slots when the index was built */
 } TPM_NV_INDEX_ENTRIES;
 
+/* TPM_NV_DATA_FILE
+
+   The NV file copy and digest of an NV defined space data area as last written to or read from
+   NV
+*/
+
+typedef struct tdTPM_NV_DATA_FILE {
+    TPM_NV_INDEX nvIndex;
+    BYTE dataCopy;
+    TPM_DIGEST dataDigest;
+} TPM_NV_DATA_FILE;
+
+typedef struct tdTPM_NV_DATA_FILES {
+    uint32_t count;
+    TPM_NV_DATA_FILE *file;			/* array sorted by nvIndex */
+} TPM_NV_DATA_FILES;
+
 /* TPM_NV_DATA_ST
 
    This is a cache of the the NV defined space volatile flags, used during error rollback
@@ -58,6 +58,20 @@
 
 #include "tpm_transport.h"
 
+/* The number of transport session slots of tables initialized by TPM_TransportSessions_Init() */
+static uint32_t tpm_trans_session_slots = TPM_MIN_TRANS_SESSIONS;
+
+/* local function prototypes */
+
+static TPM_RESULT TPM_TransportSessions_Allocate(TPM_TRANSPORT_SESSIONS *transSessions);
+static uint32_t TPM_TransportSessions_Hash(TPM_TRANSPORT_SESSIONS *transSessions,
+					   TPM_TRANSHANDLE transHandle);
+static void TPM_TransportSessions_Remove(TPM_TRANSPORT_SESSIONS *transSessions,
+					 uint32_t slot);
+static void TPM_TransportSessions_Insert(TPM_TRANSPORT_SESSIONS *transSessions,
+					 uint32_t index,
+					 TPM_TRANSHANDLE transHandle);
+
 /* TPM_Transport_CryptMgf1() takes a 'src', a preallocated 'dest', and an MGF1 'pad' of length
    'len'.
 
@@ -112,6 +126,9 @@ TPM_RESULT TPM_Transport_CryptMgf1(unsigned char *dest,
    It copies 'src' to 'dest' up to 'index'.
    It then encrypts 'src' to 'dest' using 'symmetric_key and 'pad_in' for 'len'
    It then copies the remainder of 'src' to 'dest'
+
+   'symmetric_key_cache' is the session's cached key schedule, see
+   TPM_SymmetricKeyData_StreamCrypt().
 */
 
 TPM_RESULT TPM_Transport_CryptSymmetric(unsigned char *dest,
@@ -120,6 +137,7 @@ TPM_RESULT TPM_Transport_CryptSymmetric(unsigned char *dest,
 					TPM_ENC_SCHEME encScheme,		/* mode */
 					const unsigned char *symmetric_key,
 					uint32_t symmetric_key_size,
+					TPM_SYMMETRIC_KEY_TOKEN *symmetric_key_cache,
 					unsigned char *pad_in,
 					uint32_t pad_in_size,
 					uint32_t size,
@@ -149,6 +167,7 @@ TPM_RESULT TPM_Transport_CryptSymmetric(unsigned char *dest,
 					      encScheme,		/* mode */
 					      symmetric_key,		/* input */
 					      symmetric_key_size,	/* input */
+					      symmetric_key_cache,	/* input/output */
 					      pad_in,			/* input */
 					      pad_in_size);		/* input */
     }
@@ -162,17 +181,181 @@ TPM_RESULT TPM_Transport_CryptSymmetric(unsigned char *dest,
 }
 
 /*
-  Transport Sessions (the entire array)
+  Transport Sessions (the entire table)
+*/
+
+/* TPM_TransportSessions_SetSlots() sets the number of transport session slots of tables
+   initialized by subsequent calls to TPM_TransportSessions_Init(), overriding
+   TPM_MIN_TRANS_SESSIONS.
+
+   TPM_MIN_TRANS_SESSIONS remains the minimum.  The maximum is the session array that TPM_Malloc()
+   can allocate.
 */
 
-void TPM_TransportSessions_Init(TPM_TRANSPORT_INTERNAL *transSessions)
+void TPM_TransportSessions_SetSlots(uint32_t slots)
 {
-    size_t i;
-    
-    printf(" TPM_TransportSessions_Init:\n");
-    for (i = 0 ; i < TPM_MIN_TRANS_SESSIONS ; i++) {
-	TPM_TransportInternal_Init(&(transSessions[i]));
+    uint32_t maxSlots = TPM_ALLOC_MAX / sizeof(TPM_TRANSPORT_INTERNAL);
+
+    if (slots < TPM_MIN_TRANS_SESSIONS) {
+	printf("TPM_TransportSessions_SetSlots: %u raised to minimum %u\n",
+	       slots, TPM_MIN_TRANS_SESSIONS);
+	slots = TPM_MIN_TRANS_SESSIONS;
+    }
+    if (slots > maxSlots) {
+	printf("TPM_TransportSessions_SetSlots: %u lowered to maximum %u\n", slots, maxSlots);
+	slots = maxSlots;
+    }
+    printf(" TPM_TransportSessions_SetSlots: %u\n", slots);
+    tpm_trans_session_slots = slots;
+    return;
+}
+
+/* TPM_TransportSessions_Init() sets the table to the configured number of empty slots.
+
+   The arrays are allocated on first use by TPM_TransportSessions_Allocate().  Once allocated, they
+   are kept and reset, since TPM_ExecuteTransport may still hold a pointer to its own session after
+   the wrapped command invalidates all sessions.  TPM_TransportSessions_Free() frees them.
+
+   Before the first call, the structure must be zero, as done by TPM_Global_Init().
+*/
+
+void TPM_TransportSessions_Init(TPM_TRANSPORT_SESSIONS *transSessions)
+{
+    uint32_t i;
+
+    printf(" TPM_TransportSessions_Init: %u slots\n",
+	   (transSessions->entries != NULL) ? transSessions->slots : tpm_trans_session_slots);
+    if (transSessions->entries == NULL) {
+	transSessions->slots = tpm_trans_session_slots;
+	transSessions->links = NULL;
+	transSessions->buckets = NULL;
+	transSessions->hashSize = 0;
+	transSessions->freeHead = 0;
+    }
+    /* chain all slots on the free list, in order */
+    else {
+	for (i = 0 ; i < transSessions->slots ; i++) {
+	    TPM_TransportInternal_Init(&(transSessions->entries[i]));
+	    transSessions->links[i] = ((i + 1) < transSessions->slots) ? (i + 2) : 0;
+	}
+	for (i = 0 ; i < transSessions->hashSize ; i++) {
+	    transSessions->buckets[i] = 0;
+	}
+	transSessions->freeHead = 1;
     }
+    transSessions->freeCount = transSessions->slots;
+    return;
+}
+
+/* TPM_TransportSessions_Allocate() allocates the arrays of an initialized table, if not already
+   done.  All slots are empty and on the free list.
+*/
+
+static TPM_RESULT TPM_TransportSessions_Allocate(TPM_TRANSPORT_SESSIONS *transSessions)
+{
+    TPM_RESULT  rc = 0;
+
+    if (transSessions->entries == NULL) {
+	printf(" TPM_TransportSessions_Allocate: %u slots\n", transSessions->slots);
+	/* the hash size is the smallest power of 2 not less than the number of slots */
+	for (transSessions->hashSize = 1 ;
+	     transSessions->hashSize < transSessions->slots ;
+	     transSessions->hashSize <<= 1) ;
+	if (rc == 0) {
+	    rc = TPM_Malloc((unsigned char **)&(transSessions->links),
+			    transSessions->slots * sizeof(uint32_t));
+	}
+	if (rc == 0) {
+	    rc = TPM_Malloc((unsigned char **)&(transSessions->buckets),
+			    transSessions->hashSize * sizeof(uint32_t));
+	}
+	if (rc == 0) {
+	    rc = TPM_Malloc((unsigned char **)&(transSessions->entries),
+			    transSessions->slots * sizeof(TPM_TRANSPORT_INTERNAL));
+	}
+	if (rc == 0) {
+	    TPM_TransportSessions_Init(transSessions);
+	}
+	/* entries is the allocated flag, so free the others on failure */
+	else {
+	    free(transSessions->links);
+	    free(transSessions->buckets);
+	    transSessions->links = NULL;
+	    transSessions->buckets = NULL;
+	}
+    }
+    return rc;
+}
+
+/* TPM_TransportSessions_Free() frees the table arrays.  The table must be initialized again before
+   use.
+*/
+
+void TPM_TransportSessions_Free(TPM_TRANSPORT_SESSIONS *transSessions)
+{
+    printf(" TPM_TransportSessions_Free:\n");
+    free(transSessions->entries);
+    free(transSessions->links);
+    free(transSessions->buckets);
+    transSessions->entries = NULL;
+    TPM_TransportSessions_Init(transSessions);
+    return;
+}
+
+/* TPM_TransportSessions_Hash() returns the hash chain for the session handle */
+
+static uint32_t TPM_TransportSessions_Hash(TPM_TRANSPORT_SESSIONS *transSessions,
+					   TPM_TRANSHANDLE transHandle)
+{
+    uint32_t hash;
+
+    hash = transHandle * 0x9e3779b1;
+    hash ^= hash >> 16;
+    return hash & (transSessions->hashSize - 1);
+}
+
+/* TPM_TransportSessions_Remove() terminates the session in a valid slot, unlinks the slot from its
+   hash chain, and returns it to the free list.
+*/
+
+static void TPM_TransportSessions_Remove(TPM_TRANSPORT_SESSIONS *transSessions,
+					 uint32_t slot)
+{
+    uint32_t    *chain;
+
+    chain = &(transSessions->buckets
+	      [TPM_TransportSessions_Hash(transSessions,
+					  transSessions->entries[slot].transHandle)]);
+    while ((*chain != 0) && (*chain != (slot + 1))) {
+	chain = &(transSessions->links[*chain - 1]);
+    }
+    if (*chain != 0) {
+	*chain = transSessions->links[slot];
+    }
+    TPM_TransportInternal_Delete(&(transSessions->entries[slot]));
+    transSessions->links[slot] = transSessions->freeHead;
+    transSessions->freeHead = slot + 1;
+    transSessions->freeCount++;
+    return;
+}
+
+/* TPM_TransportSessions_Insert() fills the free slot 'index', taking it from the free list and
+   chaining it from the handle hash.
+*/
+
+static void TPM_TransportSessions_Insert(TPM_TRANSPORT_SESSIONS *transSessions,
+					 uint32_t index,
+					 TPM_TRANSHANDLE transHandle)
+{
+    uint32_t    bucket;
+
+    transSessions->freeHead = transSessions->links[index];
+    transSessions->freeCount--;
+    transSessions->entries[index].transHandle = transHandle;
+    transSessions->entries[index].valid = TRUE;
+    bucket = TPM_TransportSessions_Hash(transSessions, transHandle);
+    transSessions->links[index] = transSessions->buckets[bucket];
+    transSessions->buckets[bucket] = index + 1;
     return;
 }
 
@@ -182,18 +365,19 @@ void TPM_TransportSessions_Init(TPM_TRANSPORT_INTERNAL *transSessions)
    deserialize the structure from a 'stream'
    'stream_size' is checked for sufficient data
    returns 0 or error codes
-   
+
    Before use, call TPM_TransportSessions_Init()
-   After use, call TPM_TransportSessions_Delete() to free memory
 */
 
-TPM_RESULT TPM_TransportSessions_Load(TPM_TRANSPORT_INTERNAL *transSessions,
+TPM_RESULT TPM_TransportSessions_Load(TPM_TRANSPORT_SESSIONS *transSessions,
 				      unsigned char **stream,
 				      uint32_t *stream_size)
 {
-    TPM_RESULT		rc = 0;
-    size_t		i;
-    uint32_t		activeCount;
+    TPM_RESULT          rc = 0;
+    size_t              i;
+    uint32_t            activeCount;
+    TPM_TRANSPORT_INTERNAL tpm_transport_internal;      /* each session as read from the stream */
+    TPM_TRANSHANDLE     transHandle;
 
     printf(" TPM_TransportSessions_Load:\n");
     /* load active count */
@@ -201,86 +385,100 @@ TPM_RESULT TPM_TransportSessions_Load(TPM_TRANSPORT_INTERNAL *transSessions,
 	rc = TPM_Load32(&activeCount, stream, stream_size);
     }
     if (rc == 0) {
-	if (activeCount > TPM_MIN_TRANS_SESSIONS) {
+	if (activeCount > transSessions->slots) {
 	    printf("TPM_TransportSessions_Load: Error (fatal) %u sessions, %u slots\n",
-		   activeCount, TPM_MIN_TRANS_SESSIONS);
+		   activeCount, transSessions->slots);
 	    rc = TPM_FAIL;
 	}
-    }    
+    }
     if (rc == 0) {
 	printf(" TPM_TransportSessions_Load: Loading %u sessions\n", activeCount);
     }
     for (i = 0 ; (rc == 0) && (i < activeCount) ; i++) {
-	rc = TPM_TransportInternal_Load(&(transSessions[i]), stream, stream_size);
+	TPM_TransportInternal_Init(&tpm_transport_internal);    /* freed @1 */
+	rc = TPM_TransportInternal_Load(&tpm_transport_internal, stream, stream_size);
+	/* add the session to the table, keeping its handle */
+	if (rc == 0) {
+	    transHandle = tpm_transport_internal.transHandle;
+	    rc = TPM_TransportSessions_AddEntry(&transHandle,
+						TRUE,           /* keep handle */
+						transSessions,
+						&tpm_transport_internal);
+	}
+	TPM_TransportInternal_Delete(&tpm_transport_internal);  /* @1 */
     }
     return rc;
 }
 
 /* TPM_TransportSessions_Store() stores a count of the active sessions, followed by the sessions.
-   
+
    serialize the structure to a stream contained in 'sbuffer'
    returns 0 or error codes
 */
 
 TPM_RESULT TPM_TransportSessions_Store(TPM_STORE_BUFFER *sbuffer,
-				       TPM_TRANSPORT_INTERNAL *transSessions)
+				       TPM_TRANSPORT_SESSIONS *transSessions)
 {
-    TPM_RESULT		rc = 0;
-    size_t		i;
-    uint32_t		space;		/* free transport session slots */
-    uint32_t		activeCount;	/* used transport session slots */
+    TPM_RESULT          rc = 0;
+    size_t              i;
+    uint32_t            activeCount;    /* used transport session slots */
 
     /* store active count */
     if (rc == 0) {
-	TPM_TransportSessions_GetSpace(&space, transSessions);
-	activeCount = TPM_MIN_TRANS_SESSIONS - space;
+	activeCount = transSessions->slots - transSessions->freeCount;
 	printf(" TPM_TransSessions_Store: Storing %u sessions\n", activeCount);
 	rc = TPM_Sbuffer_Append32(sbuffer, activeCount);
     }
     /* store transport sessions */
-    for (i = 0 ; (rc == 0) && (i < TPM_MIN_TRANS_SESSIONS) ; i++) {
-	if ((transSessions[i]).valid) {	     /* if the session is active */
-	    rc = TPM_TransportInternal_Store(sbuffer, &(transSessions[i]));
+    for (i = 0 ; (rc == 0) && (transSessions->entries != NULL) && (i < transSessions->slots) ;
+	 i++) {
+	if ((transSessions->entries[i]).valid) {        /* if the session is active */
+	    rc = TPM_TransportInternal_Store(sbuffer, &(transSessions->entries[i]));
 	}
     }
     return rc;
 }
 
-/* TPM_TransportSessions_Delete() terminates all sessions
-
-   No-OP if the parameter is NULL, else:
-   frees memory allocated for the object
-   sets pointers to NULL
-   calls TPM_TransportSessions_Init to set members back to default values
-   The object itself is not freed
-*/   
+/* TPM_TransportSessions_Delete() terminates all sessions.  The table is left initialized and
+   empty.
+*/
 
-void TPM_TransportSessions_Delete(TPM_TRANSPORT_INTERNAL *transSessions)
+void TPM_TransportSessions_Delete(TPM_TRANSPORT_SESSIONS *transSessions)
 {
     size_t i;
-    
+
     printf(" TPM_TransportSessions_Delete:\n");
-    for (i = 0 ; i < TPM_MIN_TRANS_SESSIONS ; i++) {
-	TPM_TransportInternal_Delete(&(transSessions[i]));
+    if (transSessions->entries != NULL) {
+	for (i = 0 ; i < transSessions->slots ; i++) {
+	    TPM_TransportInternal_Delete(&(transSessions->entries[i]));
+	}
     }
+    TPM_TransportSessions_Init(transSessions);
     return;
 }
 
 /* TPM_TransportSessions_IsSpace() returns 'isSpace' TRUE if an entry is available, FALSE if not.
 
-   If TRUE, 'index' holds the first free position.
+   If TRUE, 'index' holds the position at the head of the free list.
 */
 
 void TPM_TransportSessions_IsSpace(TPM_BOOL *isSpace, uint32_t *index,
-				   TPM_TRANSPORT_INTERNAL *transSessions)
+				   TPM_TRANSPORT_SESSIONS *transSessions)
 {
     printf(" TPM_TransportSessions_IsSpace:\n");
-    for (*index = 0, *isSpace = FALSE ; *index < TPM_MIN_TRANS_SESSIONS ; (*index)++) {
-	if (!((transSessions[*index]).valid)) {
-	    printf("  TPM_TransportSessions_IsSpace: Found space at %u\n", *index);
-	    *isSpace = TRUE;
-	    break;
-	}	    
+    /* before first use, all slots are free */
+    if (transSessions->entries == NULL) {
+	*index = 0;
+	*isSpace = (transSessions->slots != 0);
+    }
+    else if (transSessions->freeHead != 0) {
+	*index = transSessions->freeHead - 1;
+	printf("  TPM_TransportSessions_IsSpace: Found space at %u\n", *index);
+	*isSpace = TRUE;
+    }
+    else {
+	*index = transSessions->slots;
+	*isSpace = FALSE;
     }
     return;
 }
@@ -290,16 +488,10 @@ void TPM_TransportSessions_IsSpace(TPM_BOOL *isSpace, uint32_t *index,
 */
 
 void TPM_TransportSessions_GetSpace(uint32_t *space,
-				    TPM_TRANSPORT_INTERNAL *transSessions)
+				    TPM_TRANSPORT_SESSIONS *transSessions)
 {
-    uint32_t i;
-
     printf(" TPM_TransportSessions_GetSpace:\n");
-    for (*space = 0 , i = 0 ; i < TPM_MIN_TRANS_SESSIONS ; i++) {
-	if (!((transSessions[i]).valid)) {
-	    (*space)++;
-	}	    
-    }
+    *space = transSessions->freeCount;
     return;
 }
 
@@ -310,24 +502,26 @@ void TPM_TransportSessions_GetSpace(uint32_t *space,
 */
 
 TPM_RESULT TPM_TransportSessions_StoreHandles(TPM_STORE_BUFFER *sbuffer,
-					      TPM_TRANSPORT_INTERNAL *transSessions)
+					      TPM_TRANSPORT_SESSIONS *transSessions)
 {
-    TPM_RESULT	rc = 0;
-    uint16_t	i;
-    uint32_t	space;
-    
+    TPM_RESULT  rc = 0;
+    uint32_t    i;
+
     printf(" TPM_TransportSessions_StoreHandles:\n");
     /* get the number of loaded handles */
     if (rc == 0) {
-	TPM_TransportSessions_GetSpace(&space, transSessions);
-	/* store loaded handle count.  Cast safe because of TPM_MIN_TRANS_SESSIONS value */
+	/* store loaded handle count.  Cast safe because TPM_TransportSessions_SetSlots() bounds
+	   the number of slots */
 	printf(" TPM_TransportSessions_StoreHandles: %u handles\n",
-	       TPM_MIN_TRANS_SESSIONS - space);
-	rc = TPM_Sbuffer_Append16(sbuffer, (uint16_t)(TPM_MIN_TRANS_SESSIONS - space)); 
+	       transSessions->slots - transSessions->freeCount);
+	rc = TPM_Sbuffer_Append16(sbuffer,
+				  (uint16_t)(transSessions->slots - transSessions->freeCount));
     }
-    for (i = 0 ; (rc == 0) && (i < TPM_MIN_TRANS_SESSIONS) ; i++) {
-	if ((transSessions[i]).valid) {		     /* if the index is loaded */
-	    rc = TPM_Sbuffer_Append32(sbuffer, (transSessions[i]).transHandle); /* store it */
+    for (i = 0 ; (rc == 0) && (transSessions->entries != NULL) && (i < transSessions->slots) ;
+	 i++) {
+	if ((transSessions->entries[i]).valid) {        /* if the index is loaded */
+	    rc = TPM_Sbuffer_Append32(sbuffer,
+				      (transSessions->entries[i]).transHandle); /* store it */
 	}
     }
     return rc;
@@ -342,14 +536,17 @@ TPM_RESULT TPM_TransportSessions_StoreHandles(TPM_STORE_BUFFER *sbuffer,
 */
 
 TPM_RESULT TPM_TransportSessions_GetNewHandle(TPM_TRANSPORT_INTERNAL **tpm_transport_internal,
-					      TPM_TRANSPORT_INTERNAL *transportSessions)
+					      TPM_TRANSPORT_SESSIONS *transportSessions)
 {
-    TPM_RESULT			rc = 0;
-    uint32_t			index;
-    TPM_BOOL			isSpace;
-    TPM_TRANSHANDLE		transportHandle = 0;	/* no suggested value */
-    
+    TPM_RESULT                  rc = 0;
+    uint32_t                    index;
+    TPM_BOOL                    isSpace;
+    TPM_TRANSHANDLE             transportHandle = 0;    /* no suggested value */
+
     printf(" TPM_TransportSessions_GetNewHandle:\n");
+    if (rc == 0) {
+	rc = TPM_TransportSessions_Allocate(transportSessions);
+    }
     /* is there an empty entry, get the location index */
     if (rc == 0) {
 	TPM_TransportSessions_IsSpace(&isSpace, &index, transportSessions);
@@ -361,25 +558,24 @@ TPM_RESULT TPM_TransportSessions_GetNewHandle(TPM_TRANSPORT_INTERNAL **tpm_trans
     }
     /* assign transport handle */
     if (rc == 0) {
-	rc = TPM_Handle_GenerateHandle(&transportHandle,	/* I/O */
-				       transportSessions,	/* handle array */
-				       FALSE,			/* keepHandle */
-				       FALSE,			/* isKeyHandle */
+	rc = TPM_Handle_GenerateHandle(&transportHandle,        /* I/O */
+				       transportSessions,       /* handle array */
+				       FALSE,                   /* keepHandle */
+				       FALSE,                   /* isKeyHandle */
 				       (TPM_GETENTRY_FUNCTION_T)TPM_TransportSessions_GetEntry);
     }
     if (rc == 0) {
 	printf("  TPM_TransportSessions_GetNewHandle: Assigned handle %08x\n", transportHandle);
 	/* return the TPM_TRANSPORT_INTERNAL */
-	*tpm_transport_internal = &(transportSessions[index]);
+	*tpm_transport_internal = &(transportSessions->entries[index]);
 	/* assign the handle */
-	(*tpm_transport_internal)->transHandle = transportHandle;
-	(*tpm_transport_internal)->valid = TRUE;
+	TPM_TransportSessions_Insert(transportSessions, index, transportHandle);
     }
     return rc;
 }
 
-/* TPM_TransportSessions_GetEntry() searches all 'transportSessions' entries for the entry matching
-   the handle, and returns the TPM_TRANSPORT_INTERNAL entry associated with the handle.
+/* TPM_TransportSessions_GetEntry() searches the hash chain for the entry matching the handle, and
+   returns the TPM_TRANSPORT_INTERNAL entry associated with the handle.
 
    Returns
        0 for success
@@ -387,19 +583,24 @@ TPM_RESULT TPM_TransportSessions_GetNewHandle(TPM_TRANSPORT_INTERNAL **tpm_trans
 */
 
 TPM_RESULT TPM_TransportSessions_GetEntry(TPM_TRANSPORT_INTERNAL **tpm_transport_internal,
-					  TPM_TRANSPORT_INTERNAL *transportSessions,	/* array */
-					  TPM_TRANSHANDLE transportHandle)		/* input */
+					  TPM_TRANSPORT_SESSIONS *transportSessions,    /* table */
+					  TPM_TRANSHANDLE transportHandle)              /* input */
 {
-    TPM_RESULT	rc = 0;
-    size_t	i;
-    TPM_BOOL	found;
-    
+    TPM_RESULT  rc = 0;
+    uint32_t    link;
+    TPM_BOOL    found = FALSE;
+
     printf(" TPM_TransportSessions_GetEntry: transportHandle %08x\n", transportHandle);
-    for (i = 0, found = FALSE ; (i < TPM_MIN_TRANS_SESSIONS) && !found ; i++) {
-	if ((transportSessions[i].valid) &&		 
-	    (transportSessions[i].transHandle == transportHandle)) {	  /* found */
-	    found = TRUE;
-	    *tpm_transport_internal = &(transportSessions[i]);
+    if (transportSessions->entries != NULL) {
+	for (link = transportSessions->buckets[TPM_TransportSessions_Hash(transportSessions,
+									  transportHandle)] ;
+	     (link != 0) && !found ;
+	     link = transportSessions->links[link - 1]) {
+	    if ((transportSessions->entries[link - 1].valid) &&
+		(transportSessions->entries[link - 1].transHandle == transportHandle)) {
+		found = TRUE;
+		*tpm_transport_internal = &(transportSessions->entries[link - 1]);
+	    }
 	}
     }
     if (!found) {
@@ -418,24 +619,27 @@ TPM_RESULT TPM_TransportSessions_GetEntry(TPM_TRANSPORT_INTERNAL **tpm_transport
    The handle is returned in tpm_handle.
 */
 
-TPM_RESULT TPM_TransportSessions_AddEntry(TPM_HANDLE *tpm_handle,			/* i/o */
-					  TPM_BOOL keepHandle,				/* input */
-					  TPM_TRANSPORT_INTERNAL *transSessions,	/* input */
+TPM_RESULT TPM_TransportSessions_AddEntry(TPM_HANDLE *tpm_handle,                       /* i/o */
+					  TPM_BOOL keepHandle,                          /* input */
+					  TPM_TRANSPORT_SESSIONS *transSessions,        /* input */
 					  TPM_TRANSPORT_INTERNAL *tpm_transport_internal) /* in */
 {
-    TPM_RESULT			rc = 0;
-    uint32_t			index;
-    TPM_BOOL			isSpace;
-    
+    TPM_RESULT                  rc = 0;
+    uint32_t                    index;
+    TPM_BOOL                    isSpace;
+
     printf(" TPM_TransportSessions_AddEntry: handle %08x, keepHandle %u\n",
 	   *tpm_handle, keepHandle);
     /* check for valid TPM_TRANSPORT_INTERNAL */
     if (rc == 0) {
-	if (tpm_transport_internal == NULL) {	/* NOTE: should never occur */
+	if (tpm_transport_internal == NULL) {   /* NOTE: should never occur */
 	    printf("TPM_TransportSessions_AddEntry: Error (fatal), NULL TPM_TRANSPORT_INTERNAL\n");
 	    rc = TPM_FAIL;
 	}
     }
+    if (rc == 0) {
+	rc = TPM_TransportSessions_Allocate(transSessions);
+    }
     /* is there an empty entry, get the location index */
     if (rc == 0) {
 	TPM_TransportSessions_IsSpace(&isSpace, &index, transSessions);
@@ -445,34 +649,33 @@ TPM_RESULT TPM_TransportSessions_AddEntry(TPM_HANDLE *tpm_handle,			/* i/o */
 	}
     }
     if (rc == 0) {
-	rc = TPM_Handle_GenerateHandle(tpm_handle,		/* I/O */
-				       transSessions,		/* handle array */
-				       keepHandle,		/* keepHandle */
-				       FALSE,			/* isKeyHandle */
+	rc = TPM_Handle_GenerateHandle(tpm_handle,              /* I/O */
+				       transSessions,           /* handle array */
+				       keepHandle,              /* keepHandle */
+				       FALSE,                   /* isKeyHandle */
 				       (TPM_GETENTRY_FUNCTION_T)TPM_TransportSessions_GetEntry);
     }
     if (rc == 0) {
-	tpm_transport_internal->transHandle = *tpm_handle;
-	tpm_transport_internal->valid = TRUE;
-	TPM_TransportInternal_Copy(&(transSessions[index]), tpm_transport_internal);
+	TPM_TransportInternal_Copy(&(transSessions->entries[index]), tpm_transport_internal);
+	TPM_TransportSessions_Insert(transSessions, index, *tpm_handle);
 	printf("  TPM_TransportSessions_AddEntry: Index %u handle %08x\n",
-	       index, transSessions[index].transHandle);
+	       index, transSessions->entries[index].transHandle);
     }
     return rc;
 }
 
 /* TPM_TransportSessions_TerminateHandle() terminates the session associated with
    'transporthHandle'.
-   
+
    If the session is exclusive (indicated by a match with TPM_STANY_FLAGS -> transportExclusive),
    clear that flag.
 */
 
-TPM_RESULT TPM_TransportSessions_TerminateHandle(TPM_TRANSPORT_INTERNAL *transportSessions,
+TPM_RESULT TPM_TransportSessions_TerminateHandle(TPM_TRANSPORT_SESSIONS *transportSessions,
 						 TPM_TRANSHANDLE transportHandle,
 						 TPM_TRANSHANDLE *transportExclusive)
 {
-    TPM_RESULT	rc = 0;
+    TPM_RESULT  rc = 0;
     TPM_TRANSPORT_INTERNAL *tpm_transport_internal;
 
     printf(" TPM_TransportSessions_TerminateHandle: Handle %08x\n", transportHandle);
@@ -489,14 +692,16 @@ TPM_RESULT TPM_TransportSessions_TerminateHandle(TPM_TRANSPORT_INTERNAL *transpo
 	    if (!(tpm_transport_internal->transPublic.transAttributes & TPM_TRANSPORT_EXCLUSIVE)) {
 		printf("TPM_TransportSessions_TerminateHandle: Error (fatal), "
 		       "attribute is not exclusive\n");
-		rc = TPM_FAIL;	/* internal error, should not occur */
+		rc = TPM_FAIL;  /* internal error, should not occur */
 	    }
 	    *transportExclusive = 0;
 	}
     }
-    /* invalidate the valid handle */
+    /* invalidate the valid handle and free the slot */
     if (rc == 0) {
-	TPM_TransportInternal_Delete(tpm_transport_internal);
+	TPM_TransportSessions_Remove(transportSessions,
+				     (uint32_t)(tpm_transport_internal -
+						transportSessions->entries));
     }
     return rc;
 }
@@ -730,6 +935,7 @@ void TPM_TransportInternal_Init(TPM_TRANSPORT_INTERNAL *tpm_transport_internal)
     TPM_Nonce_Init(tpm_transport_internal->transNonceEven);
     TPM_Digest_Init(tpm_transport_internal->transDigest);
     tpm_transport_internal->valid = FALSE;
+    tpm_transport_internal->symmetricKey = NULL;
     return;
 }
 
@@ -834,6 +1040,7 @@ void TPM_TransportInternal_Delete(TPM_TRANSPORT_INTERNAL *tpm_transport_internal
     printf(" TPM_TransportInternal_Delete:\n");
     if (tpm_transport_internal != NULL) {
 	TPM_TransportPublic_Delete(&(tpm_transport_internal->transPublic));
+	TPM_SymmetricKeyData_Free(&(tpm_transport_internal->symmetricKey));
 	TPM_TransportInternal_Init(tpm_transport_internal);
     }
     return;
@@ -841,6 +1048,8 @@ void TPM_TransportInternal_Delete(TPM_TRANSPORT_INTERNAL *tpm_transport_internal
 
 /* TPM_TransportInternal_Copy() copies the source to the destination.
 
+   The cached symmetric key schedule is not copied.  The destination keeps its own, which is
+   recalculated if it does not match authData.
 */
 
 void TPM_TransportInternal_Copy(TPM_TRANSPORT_INTERNAL *dest_transport_internal,
@@ -944,6 +1153,7 @@ TPM_RESULT TPM_TransportInternal_Set(TPM_STORE_BUFFER		*response,
     if (rc == 0) {
 	rc = TPM_Authdata_Generate(transAuth,					/* result */
 				   tpm_transport_internal->authData,		/* HMAC key */
+				   NULL,					/* no key schedule */
 				   outParamDigest,				/* params */
 				   tpm_transport_internal->transNonceEven,
 				   transNonceOdd,
@@ -1573,7 +1783,7 @@ TPM_RESULT TPM_Process_EstablishTransport(tpm_state_t *tpm_state,
 	printf("TPM_Process_EstablishTransport: Construct TPM_TRANSPORT_INTERNAL\n");
 	returnCode =
 	    TPM_TransportSessions_GetNewHandle(&t1TpmTransportInternal,
-					       tpm_state->tpm_stclear_data.transSessions);
+					       &(tpm_state->tpm_stclear_data.transSessions));
     }
     if (returnCode == TPM_SUCCESS) {
 	/* record that the entry is allocated, for invalidation on error */
@@ -1743,12 +1953,12 @@ TPM_RESULT TPM_Process_EstablishTransport(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     if (((rcf != 0) ||
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING))) &&
 	trans_session_added) {
-	TPM_TransportSessions_TerminateHandle(tpm_state->tpm_stclear_data.transSessions,
+	TPM_TransportSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.transSessions),
 					      t1TpmTransportInternal->transHandle,
 					      &(tpm_state->tpm_stany_flags.transportExclusive));
     }
@@ -1935,7 +2145,7 @@ TPM_RESULT TPM_Process_ExecuteTransport(tpm_state_t *tpm_state,
 	if ((tpm_state->tpm_stany_flags.transportExclusive != 0) &&
 	    (tpm_state->tpm_stany_flags.transportExclusive != transHandle)) {
 	    returnCode = TPM_TransportSessions_TerminateHandle
-			 (tpm_state->tpm_stclear_data.transSessions,
+			 (&(tpm_state->tpm_stclear_data.transSessions),
 			  tpm_state->tpm_stany_flags.transportExclusive,
 			  &(tpm_state->tpm_stany_flags.transportExclusive));
 	}
@@ -1943,7 +2153,7 @@ TPM_RESULT TPM_Process_ExecuteTransport(tpm_state_t *tpm_state,
     /* 1. Using transHandle locate the TPM_TRANSPORT_INTERNAL structure T1 */
     if (returnCode == TPM_SUCCESS) {
 	returnCode = TPM_TransportSessions_GetEntry(&t1TpmTransportInternal,
-						    tpm_state->tpm_stclear_data.transSessions,
+						    &(tpm_state->tpm_stclear_data.transSessions),
 						    transHandle);
     }
     /* For the corner case where the wrapped command invalidates the transport session, make a copy
@@ -2062,6 +2272,8 @@ TPM_RESULT TPM_Process_ExecuteTransport(tpm_state_t *tpm_state,
 						 t1TransportCopy.transPublic.encScheme,
 						 t1TransportCopy.authData, /* key */
 						 TPM_AUTHDATA_SIZE,	/* key size */
+						 /* cached key schedule */
+						 &(t1TpmTransportInternal->symmetricKey),
 						 g1Mgf1,		/* pad, IV or CTR */
 						 blockSize,
 						 wrappedCmd.size,	/* total size of buffers */
@@ -2439,6 +2651,11 @@ TPM_RESULT TPM_Process_ExecuteTransport(tpm_state_t *tpm_state,
 						 t1TransportCopy.transPublic.encScheme,
 						 t1TransportCopy.authData, /* key */
 						 TPM_AUTHDATA_SIZE,	/* key size */
+						 /* cached key schedule, unless the wrapped command
+						    invalidated the session */
+						 t1TpmTransportInternal->valid ?
+						 &(t1TpmTransportInternal->symmetricKey) :
+						 &(t1TransportCopy.symmetricKey),
 						 g2Mgf1,		/* pad, IV or CTR */
 						 blockSize,
 						 wrappedRspStreamSize,	/* total size of buffers */
@@ -2526,7 +2743,7 @@ TPM_RESULT TPM_Process_ExecuteTransport(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueTransSession) &&
 	transHandleValid) {
-	TPM_TransportSessions_TerminateHandle(tpm_state->tpm_stclear_data.transSessions,
+	TPM_TransportSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.transSessions),
 					      transHandle,
 					      &(tpm_state->tpm_stany_flags.transportExclusive));
     }
@@ -2699,7 +2916,7 @@ TPM_RESULT TPM_Process_ReleaseTransportSigned(tpm_state_t *tpm_state,
 	if ((tpm_state->tpm_stany_flags.transportExclusive != 0) &&
 	    (tpm_state->tpm_stany_flags.transportExclusive != transHandle)) {
 	    returnCode =
-		TPM_TransportSessions_TerminateHandle(tpm_state->tpm_stclear_data.transSessions,
+		TPM_TransportSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.transSessions),
 						      tpm_state->tpm_stany_flags.transportExclusive,
 						      &(tpm_state->tpm_stany_flags.transportExclusive));
 	}
@@ -2707,7 +2924,7 @@ TPM_RESULT TPM_Process_ReleaseTransportSigned(tpm_state_t *tpm_state,
     /* 1. Using transHandle locate the TPM_TRANSPORT_INTERNAL structure T1 */
     if (returnCode == TPM_SUCCESS) {
 	returnCode = TPM_TransportSessions_GetEntry(&t1TpmTransportInternal,
-						    tpm_state->tpm_stclear_data.transSessions,
+						    &(tpm_state->tpm_stclear_data.transSessions),
 						    transHandle);
     }
     /* get the key corresponding to the keyHandle parameter */
@@ -2914,7 +3131,7 @@ TPM_RESULT TPM_Process_ReleaseTransportSigned(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueTransSession) &&
 	transHandleValid) {
-	TPM_TransportSessions_TerminateHandle(tpm_state->tpm_stclear_data.transSessions,
+	TPM_TransportSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.transSessions),
 					      transHandle,
 					      &(tpm_state->tpm_stany_flags.transportExclusive));
     }
@@ -2923,7 +3140,7 @@ TPM_RESULT TPM_Process_ReleaseTransportSigned(tpm_state_t *tpm_state,
 	 ((returnCode != TPM_SUCCESS) && (returnCode != TPM_DEFEND_LOCK_RUNNING)) ||
 	 !continueAuthSession) &&
 	authHandleValid) {
-	TPM_AuthSessions_TerminateHandle(tpm_state->tpm_stclear_data.authSessions, authHandle);
+	TPM_AuthSessions_TerminateHandle(&(tpm_state->tpm_stclear_data.authSessions), authHandle);
     }
     /*
       cleanup
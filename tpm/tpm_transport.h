@@ -59,6 +59,7 @@ TPM_RESULT TPM_Transport_CryptSymmetric(unsigned char *dest,
                                         TPM_ENC_SCHEME encScheme,
                                         const unsigned char *symmetric_key,
                                         uint32_t symmetric_key_size,
+                                        TPM_SYMMETRIC_KEY_TOKEN *symmetric_key_cache,
                                         unsigned char *pad_in,
                                         uint32_t pad_in_size,
                                         uint32_t size,
@@ -66,33 +67,35 @@ TPM_RESULT TPM_Transport_CryptSymmetric(unsigned char *dest,
                                         uint32_t len);
 
 /*
-  Transport Sessions (the entire array)
+  Transport Sessions (the entire table)
 */
 
-void       TPM_TransportSessions_Init(TPM_TRANSPORT_INTERNAL *transSessions);
-TPM_RESULT TPM_TransportSessions_Load(TPM_TRANSPORT_INTERNAL *transSessions,
+void       TPM_TransportSessions_SetSlots(uint32_t slots);
+void       TPM_TransportSessions_Init(TPM_TRANSPORT_SESSIONS *transSessions);
+TPM_RESULT TPM_TransportSessions_Load(TPM_TRANSPORT_SESSIONS *transSessions,
                                       unsigned char **stream,
                                       uint32_t *stream_size);
 TPM_RESULT TPM_TransportSessions_Store(TPM_STORE_BUFFER *sbuffer,
-                                       TPM_TRANSPORT_INTERNAL *transSessions);
-void       TPM_TransportSessions_Delete(TPM_TRANSPORT_INTERNAL *transSessions);
+                                       TPM_TRANSPORT_SESSIONS *transSessions);
+void       TPM_TransportSessions_Delete(TPM_TRANSPORT_SESSIONS *transSessions);
+void       TPM_TransportSessions_Free(TPM_TRANSPORT_SESSIONS *transSessions);
 
 void       TPM_TransportSessions_IsSpace(TPM_BOOL *isSpace, uint32_t *index,
-                                         TPM_TRANSPORT_INTERNAL *transSessions);
+                                         TPM_TRANSPORT_SESSIONS *transSessions);
 void       TPM_TransportSessions_GetSpace(uint32_t *space,
-                                          TPM_TRANSPORT_INTERNAL *transSessions);
+                                          TPM_TRANSPORT_SESSIONS *transSessions);
 TPM_RESULT TPM_TransportSessions_StoreHandles(TPM_STORE_BUFFER *sbuffer,
-                                              TPM_TRANSPORT_INTERNAL *transSessions);
+                                              TPM_TRANSPORT_SESSIONS *transSessions);
 TPM_RESULT TPM_TransportSessions_GetNewHandle(TPM_TRANSPORT_INTERNAL **tpm_transport_internal,
-                                              TPM_TRANSPORT_INTERNAL *transportSessions);
+                                              TPM_TRANSPORT_SESSIONS *transportSessions);
 TPM_RESULT TPM_TransportSessions_GetEntry(TPM_TRANSPORT_INTERNAL **tpm_transport_internal ,
-                                          TPM_TRANSPORT_INTERNAL *transportSessions,
+                                          TPM_TRANSPORT_SESSIONS *transportSessions,
                                           TPM_TRANSHANDLE transportHandle);
 TPM_RESULT TPM_TransportSessions_AddEntry(TPM_HANDLE *tpm_handle,
                                           TPM_BOOL keepHandle,
-                                          TPM_TRANSPORT_INTERNAL *transSessions,
+                                          TPM_TRANSPORT_SESSIONS *transSessions,
                                           TPM_TRANSPORT_INTERNAL *tpm_transport_internal);
-TPM_RESULT TPM_TransportSessions_TerminateHandle(TPM_TRANSPORT_INTERNAL *tpm_transport_internal,
+TPM_RESULT TPM_TransportSessions_TerminateHandle(TPM_TRANSPORT_SESSIONS *transportSessions,
                                                  TPM_TRANSHANDLE transportHandle,
                                                  TPM_TRANSHANDLE *transportExclusive);
 